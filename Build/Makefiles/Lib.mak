@@ -16,6 +16,9 @@ CORE_SOURCES = 								\
     Ap4VpccAtom.cpp                         \
     Ap4Av1cAtom.cpp                         \
     Ap4ByteStream.cpp                       \
+    Ap4BufferedOutputStream.cpp             \
+    Ap4BoxScanner.cpp                       \
+    Ap4Arena.cpp                            \
     Ap4Co64Atom.cpp                         \
     Ap4ContainerAtom.cpp                    \
     Ap4CttsAtom.cpp                         \
@@ -53,6 +56,7 @@ CORE_SOURCES = 								\
     Ap4OhdrAtom.cpp                         \
     Ap4OmaDcf.cpp                           \
     Ap4Processor.cpp                        \
+    Ap4ThreadPool.cpp                       \
     Ap4Protection.cpp                       \
     Ap4RtpAtom.cpp                          \
     Ap4RtpHint.cpp                          \
@@ -122,6 +126,7 @@ CORE_SOURCES = 								\
     Ap4Dac4Atom.cpp                         \
     Ap4Dac3Atom.cpp                         \
     Ap4SidxAtom.cpp                         \
+    Ap4EmsgAtom.cpp                         \
     Ap4HvccAtom.cpp                         \
     Ap4DvccAtom.cpp                         \
     Ap4SgpdAtom.cpp                         \
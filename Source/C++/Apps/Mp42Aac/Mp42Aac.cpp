@@ -226,11 +226,11 @@ main(int argc, char** argv)
         key_option = true;
     }
 
-    AP4_ByteStream* input  = NULL;
-    AP4_File* input_file   = NULL;
-    AP4_ByteStream* output = NULL;
-    AP4_Movie*      movie  = NULL;
-    AP4_Track*      audio_track = NULL;
+    std::shared_ptr<AP4_ByteStream> input;
+    AP4_File*                       input_file  = NULL;
+    std::shared_ptr<AP4_ByteStream> output;
+    AP4_Movie*                      movie       = NULL;
+    AP4_Track*                      audio_track = NULL;
 
 	// create the input stream
     result = AP4_FileByteStream::Create(*args++, AP4_FileByteStream::STREAM_MODE_READ, input);
@@ -247,7 +247,7 @@ main(int argc, char** argv)
     }
 
 	// open the file
-    input_file = new AP4_File(*input);
+    input_file = new AP4_File(input);
 
     // get the movie
     AP4_SampleDescription* sample_description;
@@ -278,7 +278,7 @@ main(int argc, char** argv)
 
     switch (sample_description->GetType()) {
         case AP4_SampleDescription::TYPE_MPEG: {
-            WriteSamples(audio_track, sample_description, output);
+            WriteSamples(audio_track, sample_description, output.get());
             return_value = 0;
             break;
         }
@@ -289,7 +289,7 @@ main(int argc, char** argv)
                 return_value = 1;
                 break;
             }
-            DecryptAndWriteSamples(audio_track, sample_description, key, output);
+            DecryptAndWriteSamples(audio_track, sample_description, key, output.get());
             result = 0;
             break;
 
@@ -301,8 +301,6 @@ main(int argc, char** argv)
 
 end:
     delete input_file;
-    if (input) input->Release();
-    if (output) output->Release();
 
     return return_value;
 }
@@ -290,21 +290,21 @@ main(int argc, char** argv)
     }
 
 	// create the input stream
-    AP4_ByteStream* input = NULL;
+    std::shared_ptr<AP4_ByteStream> input;
     result = AP4_FileByteStream::Create(*args++, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
     }
     
 	// create the output stream
-    AP4_ByteStream* output = NULL;
+    std::shared_ptr<AP4_ByteStream> output;
     result = AP4_FileByteStream::Create(*args++, AP4_FileByteStream::STREAM_MODE_WRITE, output);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open output (%d)\n", result);
     }
 
 	// open the file
-    AP4_File* input_file = new AP4_File(*input);   
+    AP4_File* input_file = new AP4_File(input);   
 
     // get the movie
     AP4_SampleDescription* sample_description;
@@ -336,7 +336,7 @@ main(int argc, char** argv)
 
     switch (sample_description->GetType()) {
         case AP4_SampleDescription::TYPE_AVC:
-            WriteSamples(video_track, sample_description, output);
+            WriteSamples(video_track, sample_description, output.get());
             break;
 
         case AP4_SampleDescription::TYPE_PROTECTED: 
@@ -344,7 +344,7 @@ main(int argc, char** argv)
                 fprintf(stderr, "ERROR: encrypted tracks require a key\n");
                 goto end;
             }
-            DecryptAndWriteSamples(video_track, sample_description, key, output);
+            DecryptAndWriteSamples(video_track, sample_description, key, output.get());
             break;
 
         default:
@@ -354,8 +354,6 @@ main(int argc, char** argv)
 
 end:
     delete input_file;
-    input->Release();
-    output->Release();
 
     return 0;
 }
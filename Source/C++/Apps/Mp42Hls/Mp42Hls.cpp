@@ -36,6 +36,9 @@
 #include "Ap4StreamCipher.h"
 #include "Ap4Mp4AudioInfo.h"
 
+#include <chrono>
+#include <future>
+
 /*----------------------------------------------------------------------
 |   constants
 +---------------------------------------------------------------------*/
@@ -93,6 +96,7 @@ static struct _Options {
     const char*           encryption_key_format_versions;
     AP4_Array<AP4_String> encryption_key_lines;
     AP4_UI64              pcr_offset;
+    unsigned int          thread_count;
 } Options;
 
 static struct _Stats {
@@ -109,6 +113,7 @@ static struct _Stats {
 |   constants
 +---------------------------------------------------------------------*/
 static const unsigned int DefaultSegmentDurationThreshold = 15; // milliseconds
+static const unsigned int Mpeg2TsPacketSize               = 188;
 
 const AP4_UI08 AP4_MPEG2_STREAM_TYPE_SAMPLE_AES_AVC             = 0xDB;
 const AP4_UI08 AP4_MPEG2_STREAM_TYPE_SAMPLE_AES_ISO_IEC_13818_7 = 0xCF;
@@ -185,6 +190,9 @@ PrintUsageAndExit()
             "    This option can be used multiple times, once for each preformatted key line to be included in the playlist.\n"
             "    (this option is mutually exclusive with the --encryption-key-uri, --encryption-key-format and --encryption-key-format-versions options)\n"
             "    (the IV and METHOD parameters will automatically be added, so they must not appear in the <ext-x-key-line> argument)\n"
+            "  --threads <n>\n"
+            "    Mux and encrypt segments using <n> worker threads (default: 1)\n"
+            "    (use 0 for one thread per CPU core; only used with non-fragmented input)\n"
             );
     exit(1);
 }
@@ -202,15 +210,22 @@ public:
 /*----------------------------------------------------------------------
 |   TrackSampleReader
 +---------------------------------------------------------------------*/
+const AP4_Cardinal TRACK_SAMPLE_READER_BATCH_SIZE = 64;
+
 class TrackSampleReader : public SampleReader
 {
 public:
-    TrackSampleReader(AP4_Track& track) : m_Track(track), m_SampleIndex(0) {}
+    TrackSampleReader(AP4_Track& track) : 
+        m_Track(track), m_SampleIndex(0), m_BatchPosition(0) {}
     AP4_Result ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_data);
     
 private:
-    AP4_Track&  m_Track;
-    AP4_Ordinal m_SampleIndex;
+    AP4_Track&                    m_Track;
+    AP4_Ordinal                   m_SampleIndex;
+    AP4_Array<AP4_Sample>         m_Batch;
+    AP4_Array<AP4_SampleDataView> m_BatchViews;
+    AP4_DataBuffer                m_BatchData;
+    AP4_Ordinal                   m_BatchPosition;
 };
 
 /*----------------------------------------------------------------------
@@ -219,8 +234,22 @@ private:
 AP4_Result 
 TrackSampleReader::ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_data)
 {
-    if (m_SampleIndex >= m_Track.GetSampleCount()) return AP4_ERROR_EOS;
-    return m_Track.ReadSample(m_SampleIndex++, sample, sample_data);
+    // read the next batch of samples when the current one is exhausted
+    if (m_BatchPosition >= m_Batch.ItemCount()) {
+        if (m_SampleIndex >= m_Track.GetSampleCount()) return AP4_ERROR_EOS;
+        AP4_Result result = m_Track.ReadSamples(m_SampleIndex,
+                                                TRACK_SAMPLE_READER_BATCH_SIZE,
+                                                m_Batch,
+                                                m_BatchData,
+                                                m_BatchViews);
+        if (AP4_FAILED(result)) return result;
+        m_SampleIndex  += m_Batch.ItemCount();
+        m_BatchPosition = 0;
+    }
+    
+    sample = m_Batch[m_BatchPosition];
+    const AP4_SampleDataView& view = m_BatchViews[m_BatchPosition++];
+    return sample_data.SetData(view.m_Data, view.m_Size);
 }
 
 /*----------------------------------------------------------------------
@@ -252,16 +281,16 @@ FragmentedSampleReader::ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_da
 /*----------------------------------------------------------------------
 |   OpenOutput
 +---------------------------------------------------------------------*/
-static AP4_ByteStream*
+static std::shared_ptr<AP4_ByteStream>
 OpenOutput(const char* filename_pattern, unsigned int segment_number)
 {
-    AP4_ByteStream* output = NULL;
+    std::shared_ptr<AP4_ByteStream> output;
     char filename[4096];
     sprintf(filename, filename_pattern, segment_number);
     AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_WRITE, output);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open output (%d)\n", result);
-        return NULL;
+        return nullptr;
     }
     
     return output;
@@ -303,7 +332,10 @@ PreventStartCodeEmulation(const AP4_UI08* payload, AP4_Size payload_size, AP4_Da
 +---------------------------------------------------------------------*/
 class EncryptingStream: public AP4_ByteStream {
 public:
-    static AP4_Result Create(const AP4_UI08* key, const AP4_UI08* iv, AP4_ByteStream* output, EncryptingStream*& stream);
+    static AP4_Result Create(const AP4_UI08* key, const AP4_UI08* iv, std::shared_ptr<AP4_ByteStream> output, std::shared_ptr<AP4_ByteStream>& stream);
+    ~EncryptingStream() {
+        delete m_StreamCipher;
+    }
     virtual AP4_Result ReadPartial(void* , AP4_Size, AP4_Size&) {
         return AP4_ERROR_NOT_SUPPORTED;
     }
@@ -340,40 +372,24 @@ public:
     virtual AP4_Result Seek(AP4_Position) { return AP4_ERROR_NOT_SUPPORTED; }
     virtual AP4_Result Tell(AP4_Position& position) { position = m_Size; return AP4_SUCCESS; }
     virtual AP4_Result GetSize(AP4_LargeSize& size) { size = m_Size;     return AP4_SUCCESS; }
-    
-    void AddReference() {
-        ++m_ReferenceCount;
-    }
-    void Release() {
-        if (--m_ReferenceCount == 0) {
-            delete this;
-        }
-    }
+
 
 private:
-    EncryptingStream(AP4_CbcStreamCipher* stream_cipher, AP4_ByteStream* output):
-        m_ReferenceCount(1),
+    EncryptingStream(AP4_CbcStreamCipher* stream_cipher, std::shared_ptr<AP4_ByteStream> output):
         m_StreamCipher(stream_cipher),
         m_Output(output),
-        m_Size(0) {
-        output->AddReference();
-    }
-    ~EncryptingStream() {
-        m_Output->Release();
-        delete m_StreamCipher;
-    }
-    unsigned int         m_ReferenceCount;
-    AP4_CbcStreamCipher* m_StreamCipher;
-    AP4_ByteStream*      m_Output;
-    AP4_LargeSize        m_Size;
+        m_Size(0) {}
+    AP4_CbcStreamCipher*            m_StreamCipher;
+    std::shared_ptr<AP4_ByteStream> m_Output;
+    AP4_LargeSize                   m_Size;
 };
 
 /*----------------------------------------------------------------------
 |   EncryptingStream::Create
 +---------------------------------------------------------------------*/
 AP4_Result
-EncryptingStream::Create(const AP4_UI08* key, const AP4_UI08* iv, AP4_ByteStream* output, EncryptingStream*& stream) {
-    stream = NULL;
+EncryptingStream::Create(const AP4_UI08* key, const AP4_UI08* iv, std::shared_ptr<AP4_ByteStream> output, std::shared_ptr<AP4_ByteStream>& stream) {
+    stream.reset();
     AP4_BlockCipher* block_cipher = NULL;
     AP4_Result result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128,
                                                                              AP4_BlockCipher::ENCRYPT,
@@ -385,7 +401,7 @@ EncryptingStream::Create(const AP4_UI08* key, const AP4_UI08* iv, AP4_ByteStream
     if (AP4_FAILED(result)) return result;
     AP4_CbcStreamCipher* stream_cipher = new AP4_CbcStreamCipher(block_cipher);
     stream_cipher->SetIV(iv);
-    stream = new EncryptingStream(stream_cipher, output);
+    stream.reset(new EncryptingStream(stream_cipher, output));
     
     return AP4_SUCCESS;
 }
@@ -1018,6 +1034,241 @@ ReadSample(SampleReader&   reader,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   WritePlaylists
++---------------------------------------------------------------------*/
+static AP4_Result
+WritePlaylists(AP4_Track*                     video_track,
+               const AP4_Array<double>&       segment_durations,
+               const AP4_Array<AP4_UI32>&     segment_sizes,
+               const AP4_Array<AP4_Position>& segment_positions,
+               const AP4_Array<AP4_Position>& iframe_positions,
+               const AP4_Array<AP4_UI32>&     iframe_sizes,
+               const AP4_Array<double>&       iframe_times,
+               AP4_Array<double>&             iframe_durations,
+               const AP4_Array<AP4_UI32>&     iframe_segment_indexes)
+{
+    std::shared_ptr<AP4_ByteStream> playlist;
+    char                            string_buffer[4096];
+
+    // create the media playlist/index file
+    playlist = OpenOutput(Options.index_filename, 0);
+    if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+
+    unsigned int target_duration = 0;
+    double       total_duration = 0.0;
+    for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
+        if ((unsigned int)(segment_durations[i]+0.5) > target_duration) {
+            target_duration = (unsigned int)segment_durations[i];
+        }
+        total_duration += segment_durations[i];
+    }
+
+    playlist->WriteString("#EXTM3U\r\n");
+    if (Options.hls_version > 1) {
+        sprintf(string_buffer, "#EXT-X-VERSION:%d\r\n", Options.hls_version);
+        playlist->WriteString(string_buffer);
+    }
+    playlist->WriteString("#EXT-X-PLAYLIST-TYPE:VOD\r\n");
+    if (video_track) {
+        playlist->WriteString("#EXT-X-INDEPENDENT-SEGMENTS\r\n");
+    }
+    if (Options.allow_cache) {
+        playlist->WriteString("#EXT-X-ALLOW-CACHE:");
+        playlist->WriteString(Options.allow_cache);
+        playlist->WriteString("\r\n");
+    }
+    playlist->WriteString("#EXT-X-TARGETDURATION:");
+    sprintf(string_buffer, "%d\r\n", target_duration);
+    playlist->WriteString(string_buffer);
+    playlist->WriteString("#EXT-X-MEDIA-SEQUENCE:0\r\n");
+
+    if (Options.encryption_mode != ENCRYPTION_MODE_NONE) {
+        if (Options.encryption_key_lines.ItemCount()) {
+            for (unsigned int i=0; i<Options.encryption_key_lines.ItemCount(); i++) {
+                AP4_String& key_line = Options.encryption_key_lines[i];
+                const char* key_line_cstr = key_line.GetChars();
+                bool omit_iv = false;
+                
+                // omit the IV if the key line starts with a "!" (and skip the "!")
+                if (key_line[0] == '!') {
+                    ++key_line_cstr;
+                    omit_iv = true;
+                }
+                
+                playlist->WriteString("#EXT-X-KEY:METHOD=");
+                if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
+                    playlist->WriteString("AES-128");
+                } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+                    playlist->WriteString("SAMPLE-AES");
+                }
+                playlist->WriteString(",");
+                playlist->WriteString(key_line_cstr);
+                if ((Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM ||
+                     Options.encryption_iv_mode == ENCRYPTION_IV_MODE_FPS) && !omit_iv) {
+                    playlist->WriteString(",IV=0x");
+                    char iv_hex[33];
+                    iv_hex[32] = 0;
+                    AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
+                    playlist->WriteString(iv_hex);
+                }
+                playlist->WriteString("\r\n");
+            }
+        } else {
+            playlist->WriteString("#EXT-X-KEY:METHOD=");
+            if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
+                playlist->WriteString("AES-128");
+            } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+                playlist->WriteString("SAMPLE-AES");
+            }
+            playlist->WriteString(",URI=\"");
+            playlist->WriteString(Options.encryption_key_uri);
+            playlist->WriteString("\"");
+            if (Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM) {
+                playlist->WriteString(",IV=0x");
+                char iv_hex[33];
+                iv_hex[32] = 0;
+                AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
+                playlist->WriteString(iv_hex);
+            }
+            if (Options.encryption_key_format) {
+                playlist->WriteString(",KEYFORMAT=\"");
+                playlist->WriteString(Options.encryption_key_format);
+                playlist->WriteString("\"");
+            }
+            if (Options.encryption_key_format_versions) {
+                playlist->WriteString(",KEYFORMATVERSIONS=\"");
+                playlist->WriteString(Options.encryption_key_format_versions);
+                playlist->WriteString("\"");
+            }
+            playlist->WriteString("\r\n");
+        }
+    }
+    
+    for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
+        if (Options.hls_version >= 3) {
+            sprintf(string_buffer, "#EXTINF:%f,\r\n", segment_durations[i]);
+        } else {
+            sprintf(string_buffer, "#EXTINF:%u,\r\n", (unsigned int)(segment_durations[i]+0.5));
+        }
+        playlist->WriteString(string_buffer);
+        if (Options.output_single_file) {
+            sprintf(string_buffer, "#EXT-X-BYTERANGE:%d@%lld\r\n", segment_sizes[i], segment_positions[i]);
+            playlist->WriteString(string_buffer);
+        }
+        sprintf(string_buffer, Options.segment_url_template, i);
+        playlist->WriteString(string_buffer);
+        playlist->WriteString("\r\n");
+    }
+                    
+    playlist->WriteString("#EXT-X-ENDLIST\r\n");
+    playlist.reset();
+
+    // create the iframe playlist/index file
+    if (video_track && Options.hls_version >= 4) {
+        // compute the iframe durations and target duration
+        for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
+            double iframe_duration = 0.0;
+            if (i+1 < iframe_positions.ItemCount()) {
+                iframe_duration = iframe_times[i+1]-iframe_times[i];
+            } else if (total_duration > iframe_times[i]) {
+                iframe_duration = total_duration-iframe_times[i];
+            }
+            iframe_durations[i] = iframe_duration;
+        }
+        unsigned int iframes_target_duration = 0;
+        for (unsigned int i=0; i<iframe_durations.ItemCount(); i++) {
+            if ((unsigned int)(iframe_durations[i]+0.5) > iframes_target_duration) {
+                iframes_target_duration = (unsigned int)iframe_durations[i];
+            }
+        }
+        
+        playlist = OpenOutput(Options.iframe_index_filename, 0);
+        if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+
+        playlist->WriteString("#EXTM3U\r\n");
+        if (Options.hls_version > 1) {
+            sprintf(string_buffer, "#EXT-X-VERSION:%d\r\n", Options.hls_version);
+            playlist->WriteString(string_buffer);
+        }
+        playlist->WriteString("#EXT-X-PLAYLIST-TYPE:VOD\r\n");
+        playlist->WriteString("#EXT-X-I-FRAMES-ONLY\r\n");
+        playlist->WriteString("#EXT-X-INDEPENDENT-SEGMENTS\r\n");
+        playlist->WriteString("#EXT-X-TARGETDURATION:");
+        sprintf(string_buffer, "%d\r\n", iframes_target_duration);
+        playlist->WriteString(string_buffer);
+        playlist->WriteString("#EXT-X-MEDIA-SEQUENCE:0\r\n");
+
+        if (Options.encryption_mode != ENCRYPTION_MODE_NONE) {
+            playlist->WriteString("#EXT-X-KEY:METHOD=");
+            if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
+                playlist->WriteString("AES-128");
+            } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+                playlist->WriteString("SAMPLE-AES");
+            }
+            playlist->WriteString(",URI=\"");
+            playlist->WriteString(Options.encryption_key_uri);
+            playlist->WriteString("\"");
+            if (Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM) {
+                playlist->WriteString(",IV=0x");
+                char iv_hex[33];
+                iv_hex[32] = 0;
+                AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
+                playlist->WriteString(iv_hex);
+            }
+            if (Options.encryption_key_format) {
+                playlist->WriteString(",KEYFORMAT=\"");
+                playlist->WriteString(Options.encryption_key_format);
+                playlist->WriteString("\"");
+            }
+            if (Options.encryption_key_format_versions) {
+                playlist->WriteString(",KEYFORMATVERSIONS=\"");
+                playlist->WriteString(Options.encryption_key_format_versions);
+                playlist->WriteString("\"");
+            }
+            playlist->WriteString("\r\n");
+        }
+        
+        for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
+            sprintf(string_buffer, "#EXTINF:%f,\r\n", iframe_durations[i]);
+            playlist->WriteString(string_buffer);
+            sprintf(string_buffer, "#EXT-X-BYTERANGE:%d@%lld\r\n", iframe_sizes[i], iframe_positions[i]);
+            playlist->WriteString(string_buffer);
+            sprintf(string_buffer, Options.segment_url_template, iframe_segment_indexes[i]);
+            playlist->WriteString(string_buffer);
+            playlist->WriteString("\r\n");
+        }
+                        
+        playlist->WriteString("#EXT-X-ENDLIST\r\n");
+        playlist.reset();
+    }
+    
+    // update stats
+    Stats.segment_count = segment_sizes.ItemCount();
+    for (unsigned int i=0; i<segment_sizes.ItemCount(); i++) {
+        Stats.segments_total_size     += segment_sizes[i];
+        Stats.segments_total_duration += segment_durations[i];
+    }
+    Stats.iframe_count = iframe_sizes.ItemCount();
+    for (unsigned int i=0; i<iframe_sizes.ItemCount(); i++) {
+        Stats.iframes_total_size += iframe_sizes[i];
+    }
+    for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
+        if (iframe_durations[i] != 0.0) {
+            double iframe_bitrate = 8.0*(double)iframe_sizes[i]/iframe_durations[i];
+            if (iframe_bitrate > Stats.max_iframe_bitrate) {
+                Stats.max_iframe_bitrate = iframe_bitrate;
+            }
+        }
+    }
+    
+    if (Options.verbose) {
+        printf("Conversion complete, total duration=%.2f secs\n", total_duration);
+    }
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   WriteSamples
 +---------------------------------------------------------------------*/
@@ -1047,7 +1298,7 @@ WriteSamples(AP4_Mpeg2TsWriter*               ts_writer,
     bool                    video_eos = false;
     double                  last_ts = 0.0;
     unsigned int            segment_number = 0;
-    AP4_ByteStream*         segment_output = NULL;
+    std::shared_ptr<AP4_ByteStream> segment_output;
     double                  segment_duration = 0.0;
     AP4_Array<double>       segment_durations;
     AP4_Array<AP4_UI32>     segment_sizes;
@@ -1059,9 +1310,7 @@ WriteSamples(AP4_Mpeg2TsWriter*               ts_writer,
     AP4_Array<double>       iframe_durations;
     AP4_Array<AP4_UI32>     iframe_segment_indexes;
     bool                    new_segment = true;
-    AP4_ByteStream*         raw_output = NULL;
-    AP4_ByteStream*         playlist = NULL;
-    char                    string_buffer[4096];
+    std::shared_ptr<AP4_ByteStream> raw_output;
     SampleEncrypter*        sample_encrypter = NULL;
     AP4_Result              result = AP4_SUCCESS;
     
@@ -1152,8 +1401,7 @@ WriteSamples(AP4_Mpeg2TsWriter*               ts_writer,
                                segment_position);
                     }
                     if (!Options.output_single_file) {
-                        segment_output->Release();
-                        segment_output = NULL;
+                        segment_output.reset();
                     }
                     ++segment_number;
                     audio_sample_count = 0;
@@ -1190,13 +1438,12 @@ WriteSamples(AP4_Mpeg2TsWriter*               ts_writer,
                 }
             }
             if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
-                EncryptingStream* encrypting_stream = NULL;
+                std::shared_ptr<AP4_ByteStream> encrypting_stream;
                 result = EncryptingStream::Create(Options.encryption_key, Options.encryption_iv, raw_output, encrypting_stream);
                 if (AP4_FAILED(result)) {
                     fprintf(stderr, "ERROR: failed to create encrypting stream (%d)\n", result);
                     return result;
                 }
-                segment_output->Release();
                 segment_output = encrypting_stream;
             } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
                 delete sample_encrypter;
@@ -1339,225 +1586,632 @@ WriteSamples(AP4_Mpeg2TsWriter*               ts_writer,
         }
     }
     
-    // create the media playlist/index file
-    playlist = OpenOutput(Options.index_filename, 0);
-    if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+    // create the playlists
+    result = WritePlaylists(video_track,
+                            segment_durations,
+                            segment_sizes,
+                            segment_positions,
+                            iframe_positions,
+                            iframe_sizes,
+                            iframe_times,
+                            iframe_durations,
+                            iframe_segment_indexes);
+    if (AP4_FAILED(result)) return result;
+    
+    segment_output.reset();
+    delete sample_encrypter;
+    
+    return result;
+}
 
-    unsigned int target_duration = 0;
-    double       total_duration = 0.0;
-    for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
-        if ((unsigned int)(segment_durations[i]+0.5) > target_duration) {
-            target_duration = (unsigned int)segment_durations[i];
-        }
-        total_duration += segment_durations[i];
-    }
+/*----------------------------------------------------------------------
+|   SegmentJob
++---------------------------------------------------------------------*/
+struct SegmentJob {
+    SegmentJob() :
+        m_Number(0),
+        m_Duration(0.0),
+        m_AudioFirst(0),
+        m_AudioCount(0),
+        m_AudioStartTime(0.0),
+        m_VideoFirst(0),
+        m_VideoCount(0),
+        m_Patched(false) {}
+
+    unsigned int                      m_Number;
+    double                            m_Duration;
+    AP4_DataBuffer                    m_Order;        // one entry per sample, 0=audio, 1=video
+    AP4_Ordinal                       m_AudioFirst;
+    AP4_Cardinal                      m_AudioCount;
+    double                            m_AudioStartTime;
+    AP4_DataBuffer                    m_AudioSetupData; // pending audio sample at the start of the segment
+    AP4_Array<AP4_Sample>             m_AudioSamples;
+    AP4_Array<AP4_SampleDataView>     m_AudioViews;
+    AP4_DataBuffer                    m_AudioData;
+    AP4_Array<AP4_SampleDescription*> m_AudioDescriptions;
+    AP4_Ordinal                       m_VideoFirst;
+    AP4_Cardinal                      m_VideoCount;
+    AP4_Array<AP4_Sample>             m_VideoSamples;
+    AP4_Array<AP4_SampleDataView>     m_VideoViews;
+    AP4_DataBuffer                    m_VideoData;
+    AP4_Array<AP4_SampleDescription*> m_VideoDescriptions;
+    AP4_DataBuffer                    m_Output;
+    AP4_Array<AP4_Position>           m_IFramePositions; // relative to the start of the segment
+    AP4_Array<AP4_UI32>               m_IFrameSizes;
+    AP4_Array<double>                 m_IFrameTimes;
+    bool                              m_Patched;
+    std::future<AP4_Result>           m_Muxed;
+    std::future<AP4_Result>           m_Encrypted;
+};
 
-    playlist->WriteString("#EXTM3U\r\n");
-    if (Options.hls_version > 1) {
-        sprintf(string_buffer, "#EXT-X-VERSION:%d\r\n", Options.hls_version);
-        playlist->WriteString(string_buffer);
+/*----------------------------------------------------------------------
+|   SegmentContext
++---------------------------------------------------------------------*/
+struct SegmentContext {
+    AP4_Track*                       m_AudioTrack;
+    AP4_Mpeg2TsWriter::SampleStream* m_AudioStream;
+    AP4_Track*                       m_VideoTrack;
+    AP4_Mpeg2TsWriter::SampleStream* m_VideoStream;
+    bool                             m_Packed;
+    AP4_UI08                         m_NaluLengthSize;
+    AP4_UI08                         m_ContinuityCounters[8192]; // indexed by PID
+};
+
+/*----------------------------------------------------------------------
+|   GetSegmentIV
++---------------------------------------------------------------------*/
+static void
+GetSegmentIV(unsigned int segment_number, AP4_UI08* iv)
+{
+    AP4_CopyMemory(iv, Options.encryption_iv, 16);
+    if (Options.encryption_iv_mode == ENCRYPTION_IV_MODE_SEQUENCE) {
+        AP4_SetMemory(iv, 0, 16);
+        AP4_BytesFromUInt32BE(&iv[12], segment_number);
     }
-    playlist->WriteString("#EXT-X-PLAYLIST-TYPE:VOD\r\n");
-    if (video_track) {
-        playlist->WriteString("#EXT-X-INDEPENDENT-SEGMENTS\r\n");
+}
+
+/*----------------------------------------------------------------------
+|   LoadSegmentSamples
+|
+|   Runs on the main thread: sample tables and the input stream are not
+|   safe to share between threads.
++---------------------------------------------------------------------*/
+static AP4_Result
+LoadSegmentSamples(SegmentJob& job, SegmentContext& context)
+{
+    AP4_Result result;
+    if (job.m_AudioCount) {
+        result = context.m_AudioTrack->ReadSamples(job.m_AudioFirst,
+                                                   job.m_AudioCount,
+                                                   job.m_AudioSamples,
+                                                   job.m_AudioData,
+                                                   job.m_AudioViews);
+        if (AP4_FAILED(result)) return result;
+        for (unsigned int i=0; i<job.m_AudioSamples.ItemCount(); i++) {
+            job.m_AudioDescriptions.Append(context.m_AudioTrack->GetSampleDescription(job.m_AudioSamples[i].GetDescriptionIndex()));
+        }
     }
-    if (Options.allow_cache) {
-        playlist->WriteString("#EXT-X-ALLOW-CACHE:");
-        playlist->WriteString(Options.allow_cache);
-        playlist->WriteString("\r\n");
+    if (context.m_AudioTrack                                 && 
+        context.m_AudioTrack->GetSampleCount()               &&
+        Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+        AP4_Ordinal index = job.m_AudioFirst;
+        if (index >= context.m_AudioTrack->GetSampleCount()) index = context.m_AudioTrack->GetSampleCount()-1;
+        AP4_Sample sample;
+        result = context.m_AudioTrack->ReadSample(index, sample, job.m_AudioSetupData);
+        if (AP4_FAILED(result)) return result;
     }
-    playlist->WriteString("#EXT-X-TARGETDURATION:");
-    sprintf(string_buffer, "%d\r\n", target_duration);
-    playlist->WriteString(string_buffer);
-    playlist->WriteString("#EXT-X-MEDIA-SEQUENCE:0\r\n");
+    if (job.m_VideoCount) {
+        result = context.m_VideoTrack->ReadSamples(job.m_VideoFirst,
+                                                   job.m_VideoCount,
+                                                   job.m_VideoSamples,
+                                                   job.m_VideoData,
+                                                   job.m_VideoViews);
+        if (AP4_FAILED(result)) return result;
+        for (unsigned int i=0; i<job.m_VideoSamples.ItemCount(); i++) {
+            job.m_VideoDescriptions.Append(context.m_VideoTrack->GetSampleDescription(job.m_VideoSamples[i].GetDescriptionIndex()));
+        }
+    }
+    if (job.m_AudioSamples.ItemCount() != job.m_AudioCount ||
+        job.m_VideoSamples.ItemCount() != job.m_VideoCount) {
+        return AP4_ERROR_INTERNAL;
+    }
+    
+    return AP4_SUCCESS;
+}
 
-    if (Options.encryption_mode != ENCRYPTION_MODE_NONE) {
-        if (Options.encryption_key_lines.ItemCount()) {
-            for (unsigned int i=0; i<Options.encryption_key_lines.ItemCount(); i++) {
-                AP4_String& key_line = Options.encryption_key_lines[i];
-                const char* key_line_cstr = key_line.GetChars();
-                bool omit_iv = false;
-                
-                // omit the IV if the key line starts with a "!" (and skip the "!")
-                if (key_line[0] == '!') {
-                    ++key_line_cstr;
-                    omit_iv = true;
+/*----------------------------------------------------------------------
+|   MuxSegment
+|
+|   Runs on a worker thread, with its own TS writer. The continuity
+|   counters of the packets start at 0 and are fixed up later, in segment
+|   order, by PatchContinuityCounters.
++---------------------------------------------------------------------*/
+static AP4_Result
+MuxSegment(SegmentJob& job, const SegmentContext& context)
+{
+    AP4_MemoryByteStream output(job.m_Output);
+    AP4_Result           result = AP4_SUCCESS;
+    
+    // setup the writers
+    AP4_Mpeg2TsWriter                ts_writer(Options.pmt_pid);
+    AP4_Mpeg2TsWriter::SampleStream* audio_stream = NULL;
+    AP4_Mpeg2TsWriter::SampleStream* video_stream = NULL;
+    PackedAudioWriter                packed_writer;
+    if (context.m_AudioStream) {
+        AP4_Mpeg2TsWriter::SampleStream* proto = context.m_AudioStream;
+        result = ts_writer.SetAudioStream(proto->m_TimeScale,
+                                          proto->m_StreamType,
+                                          proto->m_StreamId,
+                                          audio_stream,
+                                          proto->GetPID(),
+                                          proto->m_Descriptor.GetData(),
+                                          proto->m_Descriptor.GetDataSize(),
+                                          proto->m_PcrOffset);
+        if (AP4_FAILED(result)) return result;
+    }
+    if (context.m_VideoStream) {
+        AP4_Mpeg2TsWriter::SampleStream* proto = context.m_VideoStream;
+        result = ts_writer.SetVideoStream(proto->m_TimeScale,
+                                          proto->m_StreamType,
+                                          proto->m_StreamId,
+                                          video_stream,
+                                          proto->GetPID(),
+                                          proto->m_Descriptor.GetData(),
+                                          proto->m_Descriptor.GetDataSize(),
+                                          proto->m_PcrOffset);
+        if (AP4_FAILED(result)) return result;
+    }
+    SampleEncrypter* sample_encrypter = NULL;
+    if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+        AP4_UI08 iv[16];
+        GetSegmentIV(job.m_Number, iv);
+        result = SampleEncrypter::Create(Options.encryption_key, iv, sample_encrypter);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    // write the segment header
+    if (!context.m_Packed) {
+        if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+            AP4_DataBuffer descriptor;
+            if (audio_stream) {
+                result = MakeSampleAesAudioDescriptor(descriptor, context.m_AudioTrack->GetSampleDescription(0), job.m_AudioSetupData);
+                if (AP4_FAILED(result) || descriptor.GetDataSize() == 0) goto end;
+                audio_stream->SetDescriptor(descriptor.GetData(), descriptor.GetDataSize());
+            }
+            if (video_stream) {
+                result = MakeSampleAesVideoDescriptor(descriptor);
+                if (AP4_FAILED(result) || descriptor.GetDataSize() == 0) goto end;
+                video_stream->SetDescriptor(descriptor.GetData(), descriptor.GetDataSize());
+            }
+        }
+        ts_writer.WritePAT(output);
+        ts_writer.WritePMT(output);
+    } else if (job.m_AudioCount) {
+        AP4_DataBuffer       private_extension_buffer;
+        const char*          private_extension_name = NULL;
+        const unsigned char* private_extension_data = NULL;
+        unsigned int         private_extension_data_size = 0;
+        if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
+            private_extension_name = "com.apple.streaming.audioDescription";
+            result = MakeAudioSetupData(private_extension_buffer, context.m_AudioTrack->GetSampleDescription(0), job.m_AudioSetupData);
+            if (AP4_FAILED(result)) goto end;
+            private_extension_data      = private_extension_buffer.GetData();
+            private_extension_data_size = private_extension_buffer.GetDataSize();
+        }
+        packed_writer.WriteHeader(job.m_AudioStartTime,
+                                  private_extension_name,
+                                  private_extension_data,
+                                  private_extension_data_size,
+                                  output);
+    }
+    
+    // write the samples in the planned order
+    {
+        AP4_DataBuffer sample_data;
+        AP4_Ordinal    audio_index = 0;
+        AP4_Ordinal    video_index = 0;
+        for (unsigned int i=0; i<job.m_Order.GetDataSize(); i++) {
+            if (job.m_Order.GetData()[i] == 0) {
+                AP4_Sample&            sample      = job.m_AudioSamples[audio_index];
+                AP4_SampleDescription* description = job.m_AudioDescriptions[audio_index];
+                const AP4_SampleDataView& view     = job.m_AudioViews[audio_index++];
+                sample_data.SetData(view.m_Data, view.m_Size);
+                if (sample_encrypter) {
+                    result = sample_encrypter->EncryptAudioSample(sample_data, description);
+                    if (AP4_FAILED(result)) goto end;
                 }
-                
-                playlist->WriteString("#EXT-X-KEY:METHOD=");
-                if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
-                    playlist->WriteString("AES-128");
-                } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
-                    playlist->WriteString("SAMPLE-AES");
+                if (audio_stream) {
+                    result = audio_stream->WriteSample(sample, sample_data, description, video_stream==NULL, output);
+                } else {
+                    result = packed_writer.WriteSample(sample, sample_data, description, output);
                 }
-                playlist->WriteString(",");
-                playlist->WriteString(key_line_cstr);
-                if ((Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM ||
-                     Options.encryption_iv_mode == ENCRYPTION_IV_MODE_FPS) && !omit_iv) {
-                    playlist->WriteString(",IV=0x");
-                    char iv_hex[33];
-                    iv_hex[32] = 0;
-                    AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
-                    playlist->WriteString(iv_hex);
+                if (AP4_FAILED(result)) goto end;
+            } else {
+                AP4_Sample&            sample      = job.m_VideoSamples[video_index];
+                AP4_SampleDescription* description = job.m_VideoDescriptions[video_index];
+                const AP4_SampleDataView& view     = job.m_VideoViews[video_index++];
+                sample_data.SetData(view.m_Data, view.m_Size);
+                if (sample_encrypter) {
+                    result = sample_encrypter->EncryptVideoSample(sample_data, context.m_NaluLengthSize);
+                    if (AP4_FAILED(result)) goto end;
+                }
+                AP4_Position frame_start = 0;
+                output.Tell(frame_start);
+                result = video_stream->WriteSample(sample, sample_data, description, true, output);
+                if (AP4_FAILED(result)) goto end;
+                AP4_Position frame_end = 0;
+                output.Tell(frame_end);
+                if (sample.IsSync()) {
+                    job.m_IFramePositions.Append(frame_start);
+                    job.m_IFrameSizes.Append((AP4_UI32)(frame_end-frame_start));
+                    job.m_IFrameTimes.Append((double)sample.GetDts()/(double)context.m_VideoTrack->GetMediaTimeScale());
                 }
-                playlist->WriteString("\r\n");
-            }
-        } else {
-            playlist->WriteString("#EXT-X-KEY:METHOD=");
-            if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
-                playlist->WriteString("AES-128");
-            } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
-                playlist->WriteString("SAMPLE-AES");
-            }
-            playlist->WriteString(",URI=\"");
-            playlist->WriteString(Options.encryption_key_uri);
-            playlist->WriteString("\"");
-            if (Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM) {
-                playlist->WriteString(",IV=0x");
-                char iv_hex[33];
-                iv_hex[32] = 0;
-                AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
-                playlist->WriteString(iv_hex);
-            }
-            if (Options.encryption_key_format) {
-                playlist->WriteString(",KEYFORMAT=\"");
-                playlist->WriteString(Options.encryption_key_format);
-                playlist->WriteString("\"");
-            }
-            if (Options.encryption_key_format_versions) {
-                playlist->WriteString(",KEYFORMATVERSIONS=\"");
-                playlist->WriteString(Options.encryption_key_format_versions);
-                playlist->WriteString("\"");
             }
-            playlist->WriteString("\r\n");
         }
     }
     
-    for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
-        if (Options.hls_version >= 3) {
-            sprintf(string_buffer, "#EXTINF:%f,\r\n", segment_durations[i]);
-        } else {
-            sprintf(string_buffer, "#EXTINF:%u,\r\n", (unsigned int)(segment_durations[i]+0.5));
+end:
+    // the sample data is no longer needed
+    job.m_AudioSamples.Clear();
+    job.m_AudioData.SetDataSize(0);
+    job.m_AudioData.SetBufferSize(0);
+    job.m_VideoSamples.Clear();
+    job.m_VideoData.SetDataSize(0);
+    job.m_VideoData.SetBufferSize(0);
+    delete sample_encrypter;
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   PatchContinuityCounters
++---------------------------------------------------------------------*/
+static void
+PatchContinuityCounters(SegmentJob& job, SegmentContext& context)
+{
+    AP4_UI08*    packet = job.m_Output.UseData();
+    AP4_Cardinal packet_count = job.m_Output.GetDataSize()/Mpeg2TsPacketSize;
+    AP4_UI08     packets_per_pid[8192];
+    AP4_SetMemory(packets_per_pid, 0, sizeof(packets_per_pid));
+    for (unsigned int i=0; i<packet_count; i++, packet += Mpeg2TsPacketSize) {
+        unsigned int pid = ((packet[1]&0x1F)<<8) | packet[2];
+        packet[3] = (packet[3]&0xF0) | ((context.m_ContinuityCounters[pid]+packet[3])&0x0F);
+        ++packets_per_pid[pid];
+    }
+    for (unsigned int pid=0; pid<8192; pid++) {
+        context.m_ContinuityCounters[pid] = (context.m_ContinuityCounters[pid]+packets_per_pid[pid])&0x0F;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   EncryptSegment
++---------------------------------------------------------------------*/
+static AP4_Result
+EncryptSegment(SegmentJob& job)
+{
+    AP4_UI08 iv[16];
+    GetSegmentIV(job.m_Number, iv);
+    AP4_DataBuffer                  encrypted;
+    std::shared_ptr<AP4_ByteStream> output = std::make_shared<AP4_MemoryByteStream>(encrypted);
+    std::shared_ptr<AP4_ByteStream> encrypting_stream;
+    AP4_Result result = EncryptingStream::Create(Options.encryption_key, iv, output, encrypting_stream);
+    if (AP4_FAILED(result)) return result;
+    result = encrypting_stream->Write(job.m_Output.GetData(), job.m_Output.GetDataSize());
+    if (AP4_SUCCEEDED(result)) encrypting_stream->Flush();
+    encrypting_stream.reset();
+    if (AP4_FAILED(result)) return result;
+    
+    return job.m_Output.SetData(encrypted.GetData(), encrypted.GetDataSize());
+}
+
+/*----------------------------------------------------------------------
+|   SegmentWriter
++---------------------------------------------------------------------*/
+struct SegmentWriter {
+    SegmentWriter() : m_Position(0) {}
+    std::shared_ptr<AP4_ByteStream> m_Output;
+    AP4_Position            m_Position;
+    AP4_Array<double>       m_SegmentDurations;
+    AP4_Array<AP4_UI32>     m_SegmentSizes;
+    AP4_Array<AP4_Position> m_SegmentPositions;
+    AP4_Array<AP4_Position> m_IFramePositions;
+    AP4_Array<AP4_UI32>     m_IFrameSizes;
+    AP4_Array<double>       m_IFrameTimes;
+    AP4_Array<double>       m_IFrameDurations;
+    AP4_Array<AP4_UI32>     m_IFrameSegmentIndexes;
+};
+
+/*----------------------------------------------------------------------
+|   WriteSegment
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteSegment(SegmentJob& job, SegmentWriter& writer)
+{
+    // open the output
+    AP4_Position segment_position = 0;
+    if (Options.output_single_file) {
+        segment_position = writer.m_Position;
+    }
+    if (writer.m_Output == NULL) {
+        writer.m_Output = OpenOutput(Options.segment_filename_template, job.m_Number);
+        if (writer.m_Output == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+    }
+    
+    // write the segment
+    AP4_Result result = writer.m_Output->Write(job.m_Output.GetData(), job.m_Output.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    AP4_UI32 segment_size = job.m_Output.GetDataSize();
+    writer.m_Position += segment_size;
+    if (!Options.output_single_file) {
+        writer.m_Output.reset();
+    }
+    
+    // update counters
+    writer.m_SegmentSizes.Append(segment_size);
+    writer.m_SegmentPositions.Append(segment_position);
+    writer.m_SegmentDurations.Append(job.m_Duration);
+    for (unsigned int i=0; i<job.m_IFramePositions.ItemCount(); i++) {
+        writer.m_IFramePositions.Append(segment_position+job.m_IFramePositions[i]);
+        writer.m_IFrameSizes.Append(job.m_IFrameSizes[i]);
+        writer.m_IFrameTimes.Append(job.m_IFrameTimes[i]);
+        writer.m_IFrameSegmentIndexes.Append(job.m_Number);
+        writer.m_IFrameDurations.Append(0.0); // will be computed later
+        if (Options.verbose) {
+            printf("I-Frame: %d@%lld, t=%f\n", job.m_IFrameSizes[i], segment_position+job.m_IFramePositions[i], job.m_IFrameTimes[i]);
         }
-        playlist->WriteString(string_buffer);
-        if (Options.output_single_file) {
-            sprintf(string_buffer, "#EXT-X-BYTERANGE:%d@%lld\r\n", segment_sizes[i], segment_positions[i]);
-            playlist->WriteString(string_buffer);
+    }
+    if (job.m_Duration != 0.0) {
+        double segment_bitrate = 8.0*(double)segment_size/job.m_Duration;
+        if (segment_bitrate > Stats.max_segment_bitrate) {
+            Stats.max_segment_bitrate = segment_bitrate;
         }
-        sprintf(string_buffer, Options.segment_url_template, i);
-        playlist->WriteString(string_buffer);
-        playlist->WriteString("\r\n");
     }
-                    
-    playlist->WriteString("#EXT-X-ENDLIST\r\n");
-    playlist->Release();
+    if (Options.verbose) {
+        printf("Segment %d, duration=%.2f, %d audio samples, %d video samples, %d bytes @%lld\n",
+               job.m_Number, 
+               job.m_Duration,
+               job.m_AudioCount, 
+               job.m_VideoCount,
+               segment_size,
+               segment_position);
+    }
+    
+    return AP4_SUCCESS;
+}
 
-    // create the iframe playlist/index file
-    if (video_track && Options.hls_version >= 4) {
-        // compute the iframe durations and target duration
-        for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
-            double iframe_duration = 0.0;
-            if (i+1 < iframe_positions.ItemCount()) {
-                iframe_duration = iframe_times[i+1]-iframe_times[i];
-            } else if (total_duration > iframe_times[i]) {
-                iframe_duration = total_duration-iframe_times[i];
-            }
-            iframe_durations[i] = iframe_duration;
-        }
-        unsigned int iframes_target_duration = 0;
-        for (unsigned int i=0; i<iframe_durations.ItemCount(); i++) {
-            if ((unsigned int)(iframe_durations[i]+0.5) > iframes_target_duration) {
-                iframes_target_duration = (unsigned int)iframe_durations[i];
+/*----------------------------------------------------------------------
+|   FlushSegments
+|
+|   Fix up and start encrypting the segments that are muxed, in order, then 
+|   write out the oldest segments until at most max_pending are left.
++---------------------------------------------------------------------*/
+static AP4_Result
+FlushSegments(AP4_List<SegmentJob>& pending, 
+              unsigned int          max_pending,
+              SegmentContext&       context,
+              SegmentWriter&        writer,
+              AP4_ThreadPool&       pool)
+{
+    AP4_Result result = AP4_SUCCESS;
+    for (;;) {
+        // post-process the segments that are ready, in order
+        bool must_wait = pending.ItemCount() > max_pending;
+        for (AP4_List<SegmentJob>::Item* item = pending.FirstItem(); item; item = item->GetNext()) {
+            SegmentJob* job = item->GetData();
+            if (job->m_Patched) continue;
+            if (!must_wait && job->m_Muxed.wait_for(std::chrono::seconds(0)) != std::future_status::ready) break;
+            result = job->m_Muxed.get();
+            if (AP4_FAILED(result)) return result;
+            if (!context.m_Packed) PatchContinuityCounters(*job, context);
+            if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
+                job->m_Encrypted = pool.Submit([job]() { return EncryptSegment(*job); });
             }
+            job->m_Patched = true;
+            must_wait = false;
         }
+        if (pending.ItemCount() <= max_pending) break;
         
-        playlist = OpenOutput(Options.iframe_index_filename, 0);
-        if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+        // write out the oldest segment
+        SegmentJob* job = NULL;
+        pending.PopHead(job);
+        if (job->m_Encrypted.valid()) result = job->m_Encrypted.get();
+        if (AP4_SUCCEEDED(result)) result = WriteSegment(*job, writer);
+        delete job;
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
 
-        playlist->WriteString("#EXTM3U\r\n");
-        if (Options.hls_version > 1) {
-            sprintf(string_buffer, "#EXT-X-VERSION:%d\r\n", Options.hls_version);
-            playlist->WriteString(string_buffer);
-        }
-        playlist->WriteString("#EXT-X-PLAYLIST-TYPE:VOD\r\n");
-        playlist->WriteString("#EXT-X-I-FRAMES-ONLY\r\n");
-        playlist->WriteString("#EXT-X-INDEPENDENT-SEGMENTS\r\n");
-        playlist->WriteString("#EXT-X-TARGETDURATION:");
-        sprintf(string_buffer, "%d\r\n", iframes_target_duration);
-        playlist->WriteString(string_buffer);
-        playlist->WriteString("#EXT-X-MEDIA-SEQUENCE:0\r\n");
+/*----------------------------------------------------------------------
+|   AdvanceSample
++---------------------------------------------------------------------*/
+static AP4_Result
+AdvanceSample(AP4_Track*   track, 
+              AP4_Ordinal& index, 
+              AP4_Sample&  sample, 
+              double&      ts, 
+              double&      duration,
+              bool&        eos)
+{
+    if (index >= track->GetSampleCount()) {
+        // advance the timestamp by the last sample's duration
+        ts += duration;
+        eos = true;
+        return AP4_SUCCESS;
+    }
+    AP4_Result result = track->GetSample(index, sample);
+    if (AP4_FAILED(result)) return result;
+    ts = (double)sample.GetDts()/(double)track->GetMediaTimeScale();
+    duration = sample.GetDuration()/(double)track->GetMediaTimeScale();
+    
+    return AP4_SUCCESS;
+}
 
-        if (Options.encryption_mode != ENCRYPTION_MODE_NONE) {
-            playlist->WriteString("#EXT-X-KEY:METHOD=");
-            if (Options.encryption_mode == ENCRYPTION_MODE_AES_128) {
-                playlist->WriteString("AES-128");
-            } else if (Options.encryption_mode == ENCRYPTION_MODE_SAMPLE_AES) {
-                playlist->WriteString("SAMPLE-AES");
+/*----------------------------------------------------------------------
+|   WriteSamplesParallel
+|
+|   Same output as WriteSamples, but the segment boundaries are planned
+|   from the sample tables first, and each segment is then muxed (and
+|   encrypted) on a thread pool. Only the reading of the sample data, the 
+|   continuity counter fixups and the writing of the output happen on the 
+|   calling thread.
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteSamplesParallel(AP4_Track*                       audio_track,
+                     AP4_Mpeg2TsWriter::SampleStream* audio_stream,
+                     AP4_Track*                       video_track,
+                     AP4_Mpeg2TsWriter::SampleStream* video_stream,
+                     bool                             packed,
+                     unsigned int                     segment_duration_threshold,
+                     AP4_UI08                         nalu_length_size,
+                     unsigned int                     thread_count)
+{
+    SegmentContext context;
+    context.m_AudioTrack     = audio_track;
+    context.m_AudioStream    = audio_stream;
+    context.m_VideoTrack     = video_track;
+    context.m_VideoStream    = video_stream;
+    context.m_Packed         = packed;
+    context.m_NaluLengthSize = nalu_length_size;
+    AP4_SetMemory(context.m_ContinuityCounters, 0, sizeof(context.m_ContinuityCounters));
+
+    AP4_ThreadPool       pool(thread_count);
+    AP4_List<SegmentJob> pending;
+    unsigned int         max_pending = 2*thread_count;
+    SegmentWriter        writer;
+    SegmentJob*          job = NULL;
+    AP4_Sample           audio_sample;
+    AP4_Ordinal          audio_index = 0;
+    double               audio_ts = 0.0;
+    double               audio_frame_duration = 0.0;
+    bool                 audio_eos = false;
+    AP4_Sample           video_sample;
+    AP4_Ordinal          video_index = 0;
+    double               video_ts = 0.0;
+    double               video_frame_duration = 0.0;
+    bool                 video_eos = false;
+    double               last_ts = 0.0;
+    unsigned int         segment_number = 0;
+    AP4_Result           result = AP4_SUCCESS;
+    
+    // prime the samples
+    if (audio_track) {
+        result = AdvanceSample(audio_track, audio_index, audio_sample, audio_ts, audio_frame_duration, audio_eos);
+        if (AP4_FAILED(result)) return result;
+    }
+    if (video_track) {
+        result = AdvanceSample(video_track, video_index, video_sample, video_ts, video_frame_duration, video_eos);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    // plan the segments, with the same rules as WriteSamples
+    for (;;) {
+        bool sync_sample = false;
+        AP4_Track* chosen_track= NULL;
+        if (audio_track && !audio_eos) {
+            chosen_track = audio_track;
+            if (video_track == NULL) {
+                if (audio_track->GetSampleDescription(0)->GetFormat() == AP4_SAMPLE_FORMAT_AC_4) {
+                    if (audio_sample.IsSync()) {
+                        sync_sample = true;
+                    }
+                } else {
+                    sync_sample = true;
+                }
             }
-            playlist->WriteString(",URI=\"");
-            playlist->WriteString(Options.encryption_key_uri);
-            playlist->WriteString("\"");
-            if (Options.encryption_iv_mode == ENCRYPTION_IV_MODE_RANDOM) {
-                playlist->WriteString(",IV=0x");
-                char iv_hex[33];
-                iv_hex[32] = 0;
-                AP4_FormatHex(Options.encryption_iv, 16, iv_hex);
-                playlist->WriteString(iv_hex);
+        }
+        if (video_track && !video_eos) {
+            if (audio_track) {
+                if (video_ts <= audio_ts) {
+                    chosen_track = video_track;
+                }
+            } else {
+                chosen_track = video_track;
             }
-            if (Options.encryption_key_format) {
-                playlist->WriteString(",KEYFORMAT=\"");
-                playlist->WriteString(Options.encryption_key_format);
-                playlist->WriteString("\"");
+            if (chosen_track == video_track && video_sample.IsSync()) {
+                sync_sample = true;
             }
-            if (Options.encryption_key_format_versions) {
-                playlist->WriteString(",KEYFORMATVERSIONS=\"");
-                playlist->WriteString(Options.encryption_key_format_versions);
-                playlist->WriteString("\"");
+        }
+        
+        // check if we need to start a new segment
+        if (sync_sample || chosen_track == NULL) {
+            double segment_duration = (video_track ? video_ts : audio_ts) - last_ts;
+            if ((segment_duration >= (double)Options.segment_duration - (double)segment_duration_threshold/1000.0) ||
+                chosen_track == NULL) {
+                last_ts = video_track ? video_ts : audio_ts;
+                if (job) {
+                    // hand the segment over to the thread pool
+                    job->m_Duration = segment_duration;
+                    result = LoadSegmentSamples(*job, context);
+                    if (AP4_FAILED(result)) {
+                        delete job;
+                        break;
+                    }
+                    job->m_Muxed = pool.Submit([job, &context]() { return MuxSegment(*job, context); });
+                    pending.Add(job);
+                    job = NULL;
+                    ++segment_number;
+                    
+                    result = FlushSegments(pending, max_pending, context, writer, pool);
+                    if (AP4_FAILED(result)) break;
+                }
             }
-            playlist->WriteString("\r\n");
         }
+
+        // check if we're done
+        if (chosen_track == NULL) break;
         
-        for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
-            sprintf(string_buffer, "#EXTINF:%f,\r\n", iframe_durations[i]);
-            playlist->WriteString(string_buffer);
-            sprintf(string_buffer, "#EXT-X-BYTERANGE:%d@%lld\r\n", iframe_sizes[i], iframe_positions[i]);
-            playlist->WriteString(string_buffer);
-            sprintf(string_buffer, Options.segment_url_template, iframe_segment_indexes[i]);
-            playlist->WriteString(string_buffer);
-            playlist->WriteString("\r\n");
+        // start a new segment if needed
+        if (job == NULL) {
+            job = new SegmentJob();
+            job->m_Number         = segment_number;
+            job->m_AudioFirst     = audio_index;
+            job->m_AudioStartTime = audio_ts;
+            job->m_VideoFirst     = video_index;
         }
-                        
-        playlist->WriteString("#EXT-X-ENDLIST\r\n");
-        playlist->Release();
+        
+        // assign the sample to the current segment and advance
+        AP4_UI08 kind = (chosen_track == video_track) ? 1 : 0;
+        job->m_Order.AppendData(&kind, 1);
+        if (kind == 0) {
+            ++job->m_AudioCount;
+            ++audio_index;
+            result = AdvanceSample(audio_track, audio_index, audio_sample, audio_ts, audio_frame_duration, audio_eos);
+        } else {
+            ++job->m_VideoCount;
+            ++video_index;
+            result = AdvanceSample(video_track, video_index, video_sample, video_ts, video_frame_duration, video_eos);
+        }
+        if (AP4_FAILED(result)) break;
     }
+    delete job;
     
-    // update stats
-    Stats.segment_count = segment_sizes.ItemCount();
-    for (unsigned int i=0; i<segment_sizes.ItemCount(); i++) {
-        Stats.segments_total_size     += segment_sizes[i];
-        Stats.segments_total_duration += segment_durations[i];
+    // write out the remaining segments
+    if (AP4_SUCCEEDED(result)) {
+        result = FlushSegments(pending, 0, context, writer, pool);
     }
-    Stats.iframe_count = iframe_sizes.ItemCount();
-    for (unsigned int i=0; i<iframe_sizes.ItemCount(); i++) {
-        Stats.iframes_total_size += iframe_sizes[i];
-    }
-    for (unsigned int i=0; i<iframe_positions.ItemCount(); i++) {
-        if (iframe_durations[i] != 0.0) {
-            double iframe_bitrate = 8.0*(double)iframe_sizes[i]/iframe_durations[i];
-            if (iframe_bitrate > Stats.max_iframe_bitrate) {
-                Stats.max_iframe_bitrate = iframe_bitrate;
-            }
+    if (AP4_FAILED(result)) {
+        // wait for the jobs that are still in flight before releasing them
+        SegmentJob* pending_job = NULL;
+        while (AP4_SUCCEEDED(pending.PopHead(pending_job))) {
+            if (pending_job->m_Muxed.valid())     pending_job->m_Muxed.wait();
+            if (pending_job->m_Encrypted.valid()) pending_job->m_Encrypted.wait();
+            delete pending_job;
         }
+        return result;
     }
-    
-    if (Options.verbose) {
-        printf("Conversion complete, total duration=%.2f secs\n", total_duration);
-    }
-    
-    if (segment_output) segment_output->Release();
-    delete sample_encrypter;
-    
-    return result;
+
+    // create the playlists
+    return WritePlaylists(video_track,
+                          writer.m_SegmentDurations,
+                          writer.m_SegmentSizes,
+                          writer.m_SegmentPositions,
+                          writer.m_IFramePositions,
+                          writer.m_IFrameSizes,
+                          writer.m_IFrameTimes,
+                          writer.m_IFrameDurations,
+                          writer.m_IFrameSegmentIndexes);
 }
 
 /*----------------------------------------------------------------------
@@ -1596,6 +2250,7 @@ main(int argc, char** argv)
     Options.encryption_key_format          = NULL;
     Options.encryption_key_format_versions = NULL;
     Options.pcr_offset                     = AP4_MPEG2_TS_DEFAULT_PCR_OFFSET;
+    Options.thread_count                   = 1;
     AP4_SetMemory(Options.encryption_key, 0, sizeof(Options.encryption_key));
     AP4_SetMemory(Options.encryption_iv,  0, sizeof(Options.encryption_iv));
     AP4_SetMemory(&Stats, 0, sizeof(Stats));
@@ -1696,6 +2351,15 @@ main(int argc, char** argv)
                 return 1;
             }
             Options.pcr_offset = (unsigned int)strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--threads")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --threads requires a number\n");
+                return 1;
+            }
+            Options.thread_count = (unsigned int)strtoul(*args++, NULL, 10);
+            if (Options.thread_count == 0) {
+                Options.thread_count = AP4_ThreadPool::GetDefaultThreadCount();
+            }
         } else if (!strcmp(arg, "--output-single-file")) {
             Options.output_single_file = true;
         } else if (!strcmp(arg, "--index-filename")) {
@@ -1883,15 +2547,15 @@ main(int argc, char** argv)
     }
     
 	// create the input stream
-    AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ, input);
+    std::shared_ptr<AP4_ByteStream> input;
+    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
         return 1;
     }
     
 	// open the file
-    AP4_File* input_file = new AP4_File(*input, true);
+    AP4_File* input_file = new AP4_File(input, true);
 
     // get the movie
     AP4_SampleDescription* sample_description;
@@ -1933,7 +2597,6 @@ main(int argc, char** argv)
     if (audio_track == NULL && video_track == NULL) {
         fprintf(stderr, "ERROR: no suitable tracks found\n");
         delete input_file;
-        input->Release();
         return 1;
     }
     if (Options.audio_format == AUDIO_FORMAT_PACKED && video_track != NULL) {
@@ -1955,6 +2618,7 @@ main(int argc, char** argv)
     if (movie->HasFragments()) {
         // create a linear reader to get the samples
         linear_reader = new AP4_LinearReader(*movie, input);
+        linear_reader->EnableFragmentArenas();
     
         if (audio_track) {
             linear_reader->EnableTrack(audio_track->GetId());
@@ -2185,11 +2849,20 @@ main(int argc, char** argv)
         }
     }
     
-    result = WriteSamples(ts_writer, packed_writer,
-                          audio_track, audio_reader, audio_stream,
-                          video_track, video_reader, video_stream,
-                          Options.segment_duration_threshold,
-                          nalu_length_size);
+    if (Options.thread_count > 1 && Options.segment_duration && !movie->HasFragments()) {
+        result = WriteSamplesParallel(audio_track, audio_stream,
+                                      video_track, video_stream,
+                                      packed_writer != NULL,
+                                      Options.segment_duration_threshold,
+                                      nalu_length_size,
+                                      Options.thread_count);
+    } else {
+        result = WriteSamples(ts_writer, packed_writer,
+                              audio_track, audio_reader, audio_stream,
+                              video_track, video_reader, video_stream,
+                              Options.segment_duration_threshold,
+                              nalu_length_size);
+    }
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: failed to write samples (%d)\n", result);
     }
@@ -2282,7 +2955,6 @@ end:
     delete ts_writer;
     delete packed_writer;
     delete input_file;
-    input->Release();
     delete linear_reader;
     delete audio_reader;
     delete video_reader;
@@ -63,6 +63,9 @@ PrintUsageAndExit()
             "  --fragments-info <filename>\n"
             "      Decrypt the fragments read from <input>, with track info read\n"
             "      from <filename>.\n"
+            "  --threads <n>\n"
+            "      Decrypt fragments using <n> worker threads (default: 1)\n"
+            "      (use 0 for one thread per CPU core)\n"
             );
     exit(1);
 }
@@ -101,6 +104,7 @@ main(int argc, char** argv)
     const char* output_filename = NULL;
     const char* fragments_info_filename = NULL;
     bool        show_progress = false;
+    unsigned int thread_count = 1;
 
     char* arg;
     while ((arg = *++argv)) {
@@ -150,6 +154,16 @@ main(int argc, char** argv)
             fragments_info_filename = arg;
         } else if (!strcmp(arg, "--show-progress")) {
             show_progress = true;
+        } else if (!strcmp(arg, "--threads")) {
+            arg = *++argv;
+            if (arg == NULL) {
+                fprintf(stderr, "ERROR: missing argument for --threads option\n");
+                return 1;
+            }
+            thread_count = (unsigned int)strtoul(arg, NULL, 10);
+            if (thread_count == 0) {
+                thread_count = AP4_ThreadPool::GetDefaultThreadCount();
+            }
         } else if (input_filename == NULL) {
             input_filename = arg;
         } else if (output_filename == NULL) {
@@ -172,7 +186,7 @@ main(int argc, char** argv)
 
     // create the input stream
     AP4_Result result;
-    AP4_ByteStream* input = NULL;
+    std::shared_ptr<AP4_ByteStream> input;
     result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s) %d\n", input_filename, result);
@@ -180,7 +194,7 @@ main(int argc, char** argv)
     }
 
     // create the output stream
-    AP4_ByteStream* output = NULL;
+    std::shared_ptr<AP4_ByteStream> output;
     result = AP4_FileByteStream::Create(output_filename, AP4_FileByteStream::STREAM_MODE_WRITE, output);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open output file (%s) %d\n", output_filename, result);
@@ -188,7 +202,7 @@ main(int argc, char** argv)
     }
 
     // create the fragments stream if needed
-    AP4_ByteStream* fragments_info = NULL;
+    std::shared_ptr<AP4_ByteStream> fragments_info;
     if (fragments_info_filename) {
         result = AP4_FileByteStream::Create(fragments_info_filename, AP4_FileByteStream::STREAM_MODE_READ, fragments_info);
         if (AP4_FAILED(result)) {
@@ -199,7 +213,7 @@ main(int argc, char** argv)
 
     // create the decrypting processor
     AP4_Processor* processor = NULL;
-    AP4_File* input_file = new AP4_File(fragments_info?*fragments_info:*input);
+    AP4_File* input_file = new AP4_File(fragments_info?fragments_info:input);
     AP4_FtypAtom* ftyp = input_file->GetFileType();
     if (ftyp) {
         if (ftyp->GetMajorBrand() == AP4_OMA_DCF_BRAND_ODCF || ftyp->HasCompatibleBrand(AP4_OMA_DCF_BRAND_ODCF)) {
@@ -251,11 +265,13 @@ main(int argc, char** argv)
     }
     
     // process/decrypt the file
+    processor->SetThreadCount(thread_count);
+    processor->EnableFragmentArena();
     ProgressListener listener;
     if (fragments_info) {
-        result = processor->Process(*input, *output, *fragments_info, show_progress?&listener:NULL);
+        result = processor->Process(input, *output, fragments_info, show_progress?&listener:NULL);
     } else {
-        result = processor->Process(*input, *output, show_progress?&listener:NULL);
+        result = processor->Process(input, *output, show_progress?&listener:NULL);
     }
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: failed to process the file (%d)\n", result);
@@ -263,8 +279,6 @@ main(int argc, char** argv)
 
     // cleanup
     delete processor;
-    input->Release();
-    output->Release();
 
     return 0;
 }
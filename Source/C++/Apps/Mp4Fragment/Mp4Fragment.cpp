@@ -174,19 +174,14 @@ public:
         return m_Samples.ItemCount();
     }
     virtual AP4_Result GetSample(AP4_Ordinal index, AP4_Sample& sample) {
-        if (index >= m_Samples.ItemCount()) {
-            return AP4_ERROR_OUT_OF_RANGE;
-        } else {
-            sample = m_Samples[index];
-            return AP4_SUCCESS;
-        }
+        return m_Samples.GetSample(index, sample);
     }
     virtual AP4_Result AddSample(AP4_Sample& sample) {
         return m_Samples.Append(sample);
     }
     
 protected:
-    AP4_Array<AP4_Sample> m_Samples;
+    AP4_SampleRecordArray m_Samples;
 };
 
 /*----------------------------------------------------------------------
@@ -199,6 +194,7 @@ public:
     ~TrackCursor();
     
     AP4_Result    Init();
+    AP4_Result    Rewind();
     AP4_Result    SetSampleIndex(AP4_Ordinal sample_index);
     
     AP4_Track*    m_Track;
@@ -245,6 +241,22 @@ TrackCursor::Init()
     return m_Samples->GetSample(0, m_Sample);
 }
 
+/*----------------------------------------------------------------------
+|   TrackCursor::Rewind
++---------------------------------------------------------------------*/
+AP4_Result
+TrackCursor::Rewind()
+{
+    m_SampleIndex       = 0;
+    m_FragmentIndex     = 0;
+    m_Timestamp         = 0;
+    m_UnscaledTimestamp = 0;
+    m_Eos               = false;
+    m_Sample.Reset();
+    
+    return Init();
+}
+
 /*----------------------------------------------------------------------
 |   TrackCursor::SetSampleIndex
 +---------------------------------------------------------------------*/
@@ -300,6 +312,101 @@ public:
     AP4_UI32 m_Duration;
 };
 
+/*----------------------------------------------------------------------
+|   WriteHeader
++---------------------------------------------------------------------*/
+static void
+WriteHeader(AP4_File&       input_file,
+            AP4_Movie*      output_movie,
+            AP4_ByteStream& output_stream)
+{
+    // write the ftyp atom
+    AP4_FtypAtom* ftyp = input_file.GetFileType();
+    if (ftyp) {
+        // keep the existing brand and compatible brands
+        AP4_Array<AP4_UI32> compatible_brands;
+        compatible_brands.EnsureCapacity(ftyp->GetCompatibleBrands().ItemCount()+1);
+        for (unsigned int i=0; i<ftyp->GetCompatibleBrands().ItemCount(); i++) {
+            compatible_brands.Append(ftyp->GetCompatibleBrands()[i]);
+        }
+        
+        // add the compatible brand if it is not already there
+        if (!ftyp->HasCompatibleBrand(AP4_FILE_BRAND_ISO5)) {
+            compatible_brands.Append(AP4_FILE_BRAND_ISO5);
+        }
+
+        // create a replacement
+        AP4_FtypAtom* new_ftyp = new AP4_FtypAtom(ftyp->GetMajorBrand(),
+                                                  ftyp->GetMinorVersion(),
+                                                  &compatible_brands[0],
+                                                  compatible_brands.ItemCount());
+        ftyp = new_ftyp;
+    } else {
+        AP4_UI32 compat[2] = {
+            AP4_FILE_BRAND_ISOM,
+            AP4_FILE_BRAND_ISO5
+        };
+        ftyp = new AP4_FtypAtom(AP4_FTYP_BRAND_MP42, 0, &compat[0], 2);
+    }
+    ftyp->Write(output_stream);
+    delete ftyp;
+    
+    // write the moov atom
+    output_movie->GetMoovAtom()->Write(output_stream);
+}
+
+/*----------------------------------------------------------------------
+|   WriteFragment
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteFragment(FragmentInfo& fragment, AP4_ByteStream& output_stream)
+{
+    AP4_Result result;
+
+    // remember the time and position of this fragment
+    output_stream.Tell(fragment.m_MoofPosition);
+    fragment.m_Tfra->AddEntry(fragment.m_Timestamp, fragment.m_MoofPosition);
+    
+    // write the moof
+    fragment.m_Moof->Write(output_stream);
+    
+    // get the samples of the fragment
+    AP4_Cardinal                  sample_count = fragment.m_SampleIndexes.ItemCount();
+    AP4_Array<AP4_Sample>         samples;
+    AP4_Array<AP4_SampleDataView> views;
+    samples.SetItemCount(sample_count);
+    views.SetItemCount(sample_count);
+    for (unsigned int i=0; i<sample_count; i++) {
+        result = fragment.m_Samples->GetSample(fragment.m_SampleIndexes[i], samples[i]);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to get sample %d (%d)\n", fragment.m_SampleIndexes[i], result);
+            return result;
+        }
+    }
+
+    // read the sample data, samples stored back to back in the input
+    // (which is the common case for interleaved files) are read at once
+    AP4_DataBuffer sample_data;
+    if (sample_count) {
+        result = AP4_Sample::ReadDataBatch(&samples[0], sample_count, sample_data, &views[0]);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to read sample data (%d)\n", result);
+            return result;
+        }
+    }
+
+    // write mdat
+    output_stream.WriteUI32(fragment.m_MdatSize);
+    output_stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+    result = output_stream.Write(sample_data.GetData(), sample_data.GetDataSize());
+    if (AP4_FAILED(result)) {
+        fprintf(stderr, "ERROR: failed to write sample data (%d)\n", result);
+        return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   Fragment
 +---------------------------------------------------------------------*/
@@ -313,7 +420,6 @@ Fragment(AP4_File&                input_file,
          bool                     copy_udta,
          bool                     trun_version_one)
 {
-    AP4_List<FragmentInfo>       fragments;
     AP4_List<IndexedSegmentInfo> indexed_segments;
     IndexedSegmentInfo*          current_indexed_segment = NULL;
     AP4_Result                   result;
@@ -484,7 +590,20 @@ Fragment(AP4_File&                input_file,
         }
     }
     
-    // compute all the fragments
+    // Fragments are written out as soon as they are computed, so that
+    // only one moof is held in memory at any time. When a segment index
+    // is needed, its size must be known before the first fragment is
+    // written, so a first pass computes the fragments without reading or
+    // writing any sample data, and the cursors are then rewound.
+    TrackCursor*  first_anchor_cursor = anchor_cursor;
+    bool          emit = !create_segment_index;
+    AP4_SidxAtom* sidx = NULL;
+    AP4_Position  sidx_position = 0;
+    if (emit) {
+        WriteHeader(input_file, output_movie, output_stream);
+    }
+
+    // compute and write all the fragments
     unsigned int sequence_number = Options.sequence_number_start;
     for(;;) {
         TrackCursor* cursor = NULL;
@@ -520,7 +639,38 @@ Fragment(AP4_File&                input_file,
             }
             cursor = anchor_cursor;
         }
-        if (cursor == NULL) break; // all done
+        if (cursor == NULL) {
+            if (emit) break; // all done
+            
+            // end of the first pass, now we know how many segments to index
+            WriteHeader(input_file, output_movie, output_stream);
+            output_stream.Tell(sidx_position);
+            AP4_UI32 sidx_timescale = timescale ? timescale : indexed_cursor->m_Track->GetMediaTimeScale();
+            AP4_UI64 earliest_presentation_time = (AP4_UI64)(Options.tfdt_start * (double)sidx_timescale);
+            sidx = new AP4_SidxAtom(indexed_cursor->m_Track->GetId(),
+                                    sidx_timescale,
+                                    earliest_presentation_time,
+                                    0);
+            // reserve space for the entries now, but they will be computed and updated later
+            sidx->SetReferenceCount(indexed_segments.ItemCount());
+            sidx->Write(output_stream);
+            
+            // start over, this time writing the fragments
+            indexed_segments.DeleteReferences();
+            indexed_segments.Clear();
+            current_indexed_segment = NULL;
+            for (unsigned int i=0; i<cursors.ItemCount(); i++) {
+                result = cursors[i]->Rewind();
+                if (AP4_FAILED(result)) {
+                    fprintf(stderr, "ERROR: failed to rewind sample cursor (%d)\n", result);
+                    return;
+                }
+            }
+            anchor_cursor   = first_anchor_cursor;
+            sequence_number = Options.sequence_number_start;
+            emit            = true;
+            continue;
+        }
         
         // decide how many samples go into this fragment
         AP4_UI64 target_dts;
@@ -659,7 +809,6 @@ Fragment(AP4_File&                input_file,
         
         // create a new FragmentInfo object to store the fragment details
         FragmentInfo* fragment = new FragmentInfo(cursor->m_Samples, cursor->m_Tfra, cursor->m_Timestamp, moof);
-        fragments.Add(fragment);
         
         // add samples to the fragment
         unsigned int sample_count = 0;
@@ -787,100 +936,16 @@ Fragment(AP4_File&                input_file,
         
         // advance the cursor's fragment index
         ++cursor->m_FragmentIndex;
-    }
-    
-    // write the ftyp atom
-    AP4_FtypAtom* ftyp = input_file.GetFileType();
-    if (ftyp) {
-        // keep the existing brand and compatible brands
-        AP4_Array<AP4_UI32> compatible_brands;
-        compatible_brands.EnsureCapacity(ftyp->GetCompatibleBrands().ItemCount()+1);
-        for (unsigned int i=0; i<ftyp->GetCompatibleBrands().ItemCount(); i++) {
-            compatible_brands.Append(ftyp->GetCompatibleBrands()[i]);
-        }
         
-        // add the compatible brand if it is not already there
-        if (!ftyp->HasCompatibleBrand(AP4_FILE_BRAND_ISO5)) {
-            compatible_brands.Append(AP4_FILE_BRAND_ISO5);
+        // write the fragment and release it
+        if (emit) {
+            result = WriteFragment(*fragment, output_stream);
         }
-
-        // create a replacement
-        AP4_FtypAtom* new_ftyp = new AP4_FtypAtom(ftyp->GetMajorBrand(),
-                                                  ftyp->GetMinorVersion(),
-                                                  &compatible_brands[0],
-                                                  compatible_brands.ItemCount());
-        ftyp = new_ftyp;
-    } else {
-        AP4_UI32 compat[2] = {
-            AP4_FILE_BRAND_ISOM,
-            AP4_FILE_BRAND_ISO5
-        };
-        ftyp = new AP4_FtypAtom(AP4_FTYP_BRAND_MP42, 0, &compat[0], 2);
-    }
-    ftyp->Write(output_stream);
-    delete ftyp;
-    
-    // write the moov atom
-    output_movie->GetMoovAtom()->Write(output_stream);
-
-    // write the (not-yet fully computed) indexes if needed
-    AP4_SidxAtom* sidx = NULL;
-    AP4_Position  sidx_position = 0;
-    output_stream.Tell(sidx_position);
-    if (create_segment_index) {
-        AP4_UI32 sidx_timescale = timescale ? timescale : indexed_cursor->m_Track->GetMediaTimeScale();
-        AP4_UI64 earliest_presentation_time = (AP4_UI64)(Options.tfdt_start * (double)sidx_timescale);
-        sidx = new AP4_SidxAtom(indexed_cursor->m_Track->GetId(),
-                                sidx_timescale,
-                                earliest_presentation_time,
-                                0);
-        // reserve space for the entries now, but they will be computed and updated later
-        sidx->SetReferenceCount(indexed_segments.ItemCount());
-        sidx->Write(output_stream);
+        delete fragment->m_Moof;
+        delete fragment;
+        if (AP4_FAILED(result)) return;
     }
     
-    // write all fragments
-    for (AP4_List<FragmentInfo>::Item* item = fragments.FirstItem();
-                                       item;
-                                       item = item->GetNext()) {
-        FragmentInfo* fragment = item->GetData();
-
-        // remember the time and position of this fragment
-        output_stream.Tell(fragment->m_MoofPosition);
-        fragment->m_Tfra->AddEntry(fragment->m_Timestamp, fragment->m_MoofPosition);
-        
-        // write the moof
-        fragment->m_Moof->Write(output_stream);
-        
-        // write mdat
-        output_stream.WriteUI32(fragment->m_MdatSize);
-        output_stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
-        AP4_DataBuffer sample_data;
-        AP4_Sample     sample;
-        for (unsigned int i=0; i<fragment->m_SampleIndexes.ItemCount(); i++) {
-            // get the sample
-            result = fragment->m_Samples->GetSample(fragment->m_SampleIndexes[i], sample);
-            if (AP4_FAILED(result)) {
-                fprintf(stderr, "ERROR: failed to get sample %d (%d)\n", fragment->m_SampleIndexes[i], result);
-                return;
-            }
-
-            // read the sample data
-            result = sample.ReadData(sample_data);
-            if (AP4_FAILED(result)) {
-                fprintf(stderr, "ERROR: failed to read sample data for sample %d (%d)\n", fragment->m_SampleIndexes[i], result);
-                return;
-            }
-            
-            // write the sample data
-            result = output_stream.Write(sample_data.GetData(), sample_data.GetDataSize());
-            if (AP4_FAILED(result)) {
-                fprintf(stderr, "ERROR: failed to write sample data (%d)\n", result);
-                return;
-            }
-        }
-    }
-
     // update the index and re-write it if needed
     if (create_segment_index) {
         unsigned int segment_index = 0;
@@ -923,13 +988,6 @@ Fragment(AP4_File&                input_file,
     for (unsigned int i=0; i<cursors.ItemCount(); i++) {
         delete cursors[i];
     }
-    for (AP4_List<FragmentInfo>::Item* item = fragments.FirstItem();
-                                       item;
-                                       item = item->GetNext()) {
-        FragmentInfo* fragment = item->GetData();
-        delete fragment->m_Moof;
-    }
-    fragments.DeleteReferences();
     indexed_segments.DeleteReferences();
     delete output_movie;
 }
@@ -990,13 +1048,13 @@ AutoDetectFragmentDuration(TrackCursor* cursor)
 |   AutoDetectAudioFragmentDuration
 +---------------------------------------------------------------------*/
 static unsigned int 
-AutoDetectAudioFragmentDuration(AP4_ByteStream& stream, TrackCursor* cursor)
+AutoDetectAudioFragmentDuration(std::shared_ptr<AP4_ByteStream> stream, TrackCursor* cursor)
 {
     // remember where we are in the stream
     AP4_Position where = 0;
-    stream.Tell(where);
+    stream->Tell(where);
     AP4_LargeSize stream_size = 0;
-    stream.GetSize(stream_size);
+    stream->GetSize(stream_size);
     AP4_LargeSize bytes_available = stream_size-where;
     
     AP4_UI64  fragment_count = 0;
@@ -1020,7 +1078,7 @@ AutoDetectAudioFragmentDuration(AP4_ByteStream& stream, TrackCursor* cursor)
     }
     
     // restore the stream to its original position
-    stream.Seek(where);
+    stream->Seek(where);
     
     // decide if we can infer an fragment size
     if (fragment_count == 0 || cursor->m_Samples->GetSampleCount() == 0) {
@@ -1243,9 +1301,9 @@ main(int argc, char** argv)
         fprintf(stderr, "ERROR: no input specified\n");
         return 1;
     }
-    AP4_ByteStream* input_stream = NULL;
+    std::shared_ptr<AP4_ByteStream> input_stream;
     result = AP4_FileByteStream::Create(input_filename, 
-                                        AP4_FileByteStream::STREAM_MODE_READ, 
+                                        AP4_FileByteStream::STREAM_MODE_READ_MAPPED, 
                                         input_stream);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
@@ -1255,17 +1313,20 @@ main(int argc, char** argv)
         fprintf(stderr, "ERROR: no output specified\n");
         return 1;
     }
-    AP4_ByteStream* output_stream = NULL;
+    std::shared_ptr<AP4_ByteStream> output_file;
     result = AP4_FileByteStream::Create(output_filename, 
                                         AP4_FileByteStream::STREAM_MODE_WRITE,
-                                        output_stream);
+                                        output_file);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot create/open output (%d)\n", result);
         return 1;
     }
     
+    // buffer the output so that fragments are written in the background
+    AP4_BufferedOutputStream output_stream(output_file);
+    
     // parse the input MP4 file (moov only)
-    AP4_File input_file(*input_stream, true);
+    AP4_File input_file(input_stream, true);
     
     // check the file for basic properties
     if (input_file.GetMovie() == NULL) {
@@ -1397,6 +1458,7 @@ main(int argc, char** argv)
     // for fragmented input files, we need to populate the sample arrays
     if (input_file.GetMovie()->HasFragments()) {
         AP4_LinearReader reader(*input_file.GetMovie(), input_stream);
+        reader.EnableFragmentArenas();
         for (unsigned int i=0; i<cursors.ItemCount(); i++) {
             reader.EnableTrack(cursors[i]->m_Track->GetId());
         }
@@ -1450,7 +1512,7 @@ main(int argc, char** argv)
         if (video_track) {
             fragment_duration = AutoDetectFragmentDuration(video_track);
         } else if (audio_track && input_file.GetMovie()->HasFragments()) {
-            fragment_duration = AutoDetectAudioFragmentDuration(*input_stream, audio_track);
+            fragment_duration = AutoDetectAudioFragmentDuration(input_stream, audio_track);
         }
         if (fragment_duration == 0) {
             if (Options.verbosity > 0) {
@@ -1472,11 +1534,14 @@ main(int argc, char** argv)
     } else {
         tracks_to_fragment = cursors;
     }
-    Fragment(input_file, *output_stream, tracks_to_fragment, fragment_duration, timescale, create_segment_index, copy_udta, trun_version_one);
+    Fragment(input_file, output_stream, tracks_to_fragment, fragment_duration, timescale, create_segment_index, copy_udta, trun_version_one);
+    
+    // wait for the buffered output to be written
+    result = output_stream.Flush();
+    if (AP4_FAILED(result)) {
+        fprintf(stderr, "ERROR: failed to write the output (%d)\n", result);
+        return 1;
+    }
     
-    // cleanup and exit
-    if (input_stream)  input_stream->Release();
-    if (output_stream) output_stream->Release();
-
     return 0;
 }
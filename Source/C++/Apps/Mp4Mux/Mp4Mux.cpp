@@ -37,6 +37,9 @@
 
 #include "Ap4.h"
 
+#include <atomic>
+#include <memory>
+
 /*----------------------------------------------------------------------
 |   constants
 +---------------------------------------------------------------------*/
@@ -46,12 +49,17 @@
 
 const unsigned int AP4_MUX_DEFAULT_VIDEO_FRAME_RATE = 24;
 const unsigned int AP4_MUX_READ_BUFFER_SIZE         = 65536;
+const unsigned int AP4_MUX_MEMORY_BLOCK_SIZE        = 0x1000000;  // 16MB
+const AP4_UI64     AP4_MUX_DEFAULT_MEMORY_LIMIT     = 0x40000000; // 1GB
 
 /*----------------------------------------------------------------------
 |   globals
 +---------------------------------------------------------------------*/
 static struct {
-    bool verbose;
+    bool         verbose;
+    bool         memory_storage;
+    AP4_UI64     memory_limit;
+    unsigned int thread_count;
 } Options;
 
 /*----------------------------------------------------------------------
@@ -118,10 +126,36 @@ PrintUsageAndExit()
             "If no type is specified for an input, the type will be inferred from the file extension\n"
             "\n"
             "Options:\n"
-            "  --verbose: show more details\n");
+            "  --verbose: show more details\n"
+            "  --sample-storage <mode>: where the sample data is kept until the output is written\n"
+            "    file:   in a temporary file next to the output (default)\n"
+            "    memory: audio samples are read directly from the inputs, and video samples,\n"
+            "            which need to be reformatted, are kept in memory up to the memory\n"
+            "            limit, and in a temporary file next to the output past it\n"
+            "  --memory-limit <size>: memory limit for the memory sample storage mode, in bytes,\n"
+            "    or with a K, M or G suffix (default: 1G)\n"
+            "  --threads <n>: parse up to <n> inputs concurrently\n"
+            "    (default: one thread per CPU core, use 1 to parse the inputs one at a time)\n");
     exit(1);
 }
 
+/*----------------------------------------------------------------------
+|   ParseSize
++---------------------------------------------------------------------*/
+static AP4_Result
+ParseSize(const char* str, AP4_UI64& size)
+{
+    char* end = NULL;
+    size = strtoull(str, &end, 10);
+    if (end == str) return AP4_ERROR_INVALID_PARAMETERS;
+    switch (toupper(*end)) {
+        case 'K': size <<= 10; ++end; break;
+        case 'M': size <<= 20; ++end; break;
+        case 'G': size <<= 30; ++end; break;
+    }
+    return *end ? AP4_ERROR_INVALID_PARAMETERS : AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   ParseParameters
 +---------------------------------------------------------------------*/
@@ -310,52 +344,331 @@ CheckDoviInputParameters(AP4_Array<Parameter>& parameters)
 }
 
 /*----------------------------------------------------------------------
-|   SampleFileStorage
+|   SampleStorage
 +---------------------------------------------------------------------*/
-class SampleFileStorage
+class SampleStorage
 {
 public:
-    static AP4_Result Create(const char* basename, SampleFileStorage*& sample_file_storage);
-    ~SampleFileStorage() {
-        m_Stream->Release();
-        remove(m_Filename.GetChars());
-    }
-    
-    AP4_ByteStream* GetStream() { return m_Stream; }
-    
+    enum Mode {
+        MODE_FILE,  // all the sample data is copied to a temporary file
+        MODE_MEMORY // samples point into the inputs, or into memory blocks
+                    // until the memory limit is reached, and then into a
+                    // temporary file
+    };
+
+    /**
+     * Create the storage for the samples of one input. The temporary file,
+     * if one is needed, is named after the output and the input index.
+     */
+    static AP4_Result Create(const char*     basename,
+                             unsigned int    index,
+                             Mode            mode,
+                             SampleStorage*& sample_storage);
+    ~SampleStorage();
+
+    /**
+     * Get the stream to which a sample of a given size should be written.
+     */
+    AP4_Result GetStream(AP4_Size sample_size, std::shared_ptr<AP4_ByteStream>& stream);
+
+    /**
+     * Store a frame, of which the first byte is the next byte of a parser
+     * bit stream. The input is the stream from which the parser is fed, and
+     * input_fed is the number of bytes of the input fed to the parser so far.
+     * In memory mode, frames that are stored as is in the input are not
+     * copied: stream and position then point into the input.
+     */
+    AP4_Result StoreFrame(AP4_BitStream&                   source,
+                          AP4_Size                         size,
+                          bool                             byte_swap,
+                          std::shared_ptr<AP4_ByteStream>  input,
+                          AP4_Position                     input_fed,
+                          std::shared_ptr<AP4_ByteStream>& stream,
+                          AP4_Position&                    position);
+
+    /**
+     * Store an access unit as length-prefixed NAL units.
+     */
+    AP4_Result StoreAccessUnit(const AP4_Array<AP4_DataBuffer*>& nal_units,
+                               std::shared_ptr<AP4_ByteStream>&  stream,
+                               AP4_Position&                     position,
+                               AP4_Size&                         size);
+
 private:
-    SampleFileStorage(const char* basename) : m_Stream(NULL) {
-        AP4_Size name_length = (AP4_Size)AP4_StringLength(basename);
-        char* filename = new char[name_length+2];
-        AP4_CopyMemory(filename, basename, name_length);
-        filename[name_length]   = '_';
-        filename[name_length+1] = '\0';
-        m_Filename = filename;
-        delete[] filename;
-    }
-
-    AP4_ByteStream* m_Stream;
-    AP4_String      m_Filename;
+    SampleStorage(const char* filename, Mode mode) : 
+        m_Mode(mode), 
+        m_Filename(filename),
+        m_MemoryReserved(0) {}
+
+    AP4_Result OpenFile();
+
+    Mode                            m_Mode;
+    AP4_String                      m_Filename;
+    std::shared_ptr<AP4_ByteStream> m_File;
+    std::shared_ptr<AP4_ByteStream> m_MemoryBlock;
+    AP4_UI64                        m_MemoryReserved;
 };
 
 /*----------------------------------------------------------------------
-|   SampleFileStorage::Create
+|   ReserveMemory
+|
+|   The memory limit is shared by the storages of all the inputs, which
+|   may be filled concurrently. Each storage releases what it reserved
+|   when it is destroyed.
++---------------------------------------------------------------------*/
+static std::atomic<AP4_UI64> MemoryInUse(0);
+static bool
+ReserveMemory(AP4_UI64 size)
+{
+    AP4_UI64 in_use = MemoryInUse.load();
+    do {
+        if (in_use+size > Options.memory_limit) return false;
+    } while (!MemoryInUse.compare_exchange_weak(in_use, in_use+size));
+    return true;
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::Create
 +---------------------------------------------------------------------*/
 AP4_Result
-SampleFileStorage::Create(const char* basename, SampleFileStorage*& sample_file_storage)
+SampleStorage::Create(const char*     basename,
+                      unsigned int    index,
+                      Mode            mode,
+                      SampleStorage*& sample_storage)
 {
-    sample_file_storage = NULL;
-    SampleFileStorage* object = new SampleFileStorage(basename);
-    AP4_Result result = AP4_FileByteStream::Create(object->m_Filename.GetChars(),
-                                                   AP4_FileByteStream::STREAM_MODE_WRITE,
-                                                   object->m_Stream);
-    if (AP4_FAILED(result)) {
-        return result;
+    sample_storage = NULL;
+    AP4_Size name_length = (AP4_Size)AP4_StringLength(basename);
+    char* filename = new char[name_length+16];
+    snprintf(filename, name_length+16, "%s_%u", basename, index);
+    SampleStorage* object = new SampleStorage(filename, mode);
+    delete[] filename;
+    if (mode == MODE_FILE) {
+        AP4_Result result = object->OpenFile();
+        if (AP4_FAILED(result)) {
+            delete object;
+            return result;
+        }
+    }
+    sample_storage = object;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::~SampleStorage
++---------------------------------------------------------------------*/
+SampleStorage::~SampleStorage()
+{
+    MemoryInUse.fetch_sub(m_MemoryReserved);
+    if (m_File) {
+        m_File.reset();
+        remove(m_Filename.GetChars());
     }
-    sample_file_storage = object;
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::OpenFile
++---------------------------------------------------------------------*/
+AP4_Result
+SampleStorage::OpenFile()
+{
+    if (m_File) return AP4_SUCCESS;
+    return AP4_FileByteStream::Create(m_Filename.GetChars(),
+                                      AP4_FileByteStream::STREAM_MODE_WRITE,
+                                      m_File);
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::GetStream
++---------------------------------------------------------------------*/
+AP4_Result
+SampleStorage::GetStream(AP4_Size sample_size, std::shared_ptr<AP4_ByteStream>& stream)
+{
+    // in memory mode, keep the data in memory as long as there is room for it
+    // (memory buffers are limited to 32-bit sizes, so the data is spread
+    // over blocks, which samples keep alive)
+    if (m_Mode == MODE_MEMORY && ReserveMemory(sample_size)) {
+        m_MemoryReserved += sample_size;
+        AP4_LargeSize block_size = 0;
+        if (m_MemoryBlock) m_MemoryBlock->GetSize(block_size);
+        if (!m_MemoryBlock || block_size+sample_size > AP4_MUX_MEMORY_BLOCK_SIZE) {
+            // allocate the whole block up front, so that it is never
+            // reallocated as it fills up
+            AP4_UI64 capacity = AP4_MUX_MEMORY_BLOCK_SIZE;
+            if (capacity > Options.memory_limit) capacity = Options.memory_limit;
+            if (capacity < sample_size) capacity = sample_size;
+            m_MemoryBlock = std::make_shared<AP4_MemoryByteStream>(new AP4_DataBuffer((AP4_Size)capacity));
+        }
+        stream = m_MemoryBlock;
+        return AP4_SUCCESS;
+    }
+
+    // otherwise use the temporary file
+    AP4_Result result = OpenFile();
+    if (AP4_FAILED(result)) return result;
+    stream = m_File;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::StoreFrame
++---------------------------------------------------------------------*/
+AP4_Result
+SampleStorage::StoreFrame(AP4_BitStream&                   source,
+                          AP4_Size                         size,
+                          bool                             byte_swap,
+                          std::shared_ptr<AP4_ByteStream>  input,
+                          AP4_Position                     input_fed,
+                          std::shared_ptr<AP4_ByteStream>& stream,
+                          AP4_Position&                    position)
+{
+    // the unread bytes of the parser are the last bytes fed to it
+    if (m_Mode == MODE_MEMORY && !byte_swap) {
+        stream   = input;
+        position = input_fed-source.GetBytesAvailable();
+        return source.SkipBytes(size);
+    }
+
+    AP4_DataBuffer sample_data(size);
+    sample_data.SetDataSize(size);
+    AP4_Result result = source.ReadBytes(sample_data.UseData(), size);
+    if (AP4_FAILED(result)) return result;
+    if (byte_swap) {
+        AP4_ByteSwap16(sample_data.UseData(), (unsigned int)size);
+    }
+    result = GetStream(size, stream);
+    if (AP4_FAILED(result)) return result;
+    stream->Tell(position);
+    return stream->Write(sample_data.GetData(), size);
+}
+
+/*----------------------------------------------------------------------
+|   SampleStorage::StoreAccessUnit
++---------------------------------------------------------------------*/
+AP4_Result
+SampleStorage::StoreAccessUnit(const AP4_Array<AP4_DataBuffer*>& nal_units,
+                               std::shared_ptr<AP4_ByteStream>&  stream,
+                               AP4_Position&                     position,
+                               AP4_Size&                         size)
+{
+    // compute the total size of the sample data
+    size = 0;
+    for (unsigned int i=0; i<nal_units.ItemCount(); i++) {
+        size += 4+nal_units[i]->GetDataSize();
+    }
+
+    // write the NAL units, each prefixed with its length
+    AP4_Result result = GetStream(size, stream);
+    if (AP4_FAILED(result)) return result;
+    stream->Tell(position);
+    for (unsigned int i=0; i<nal_units.ItemCount(); i++) {
+        result = stream->WriteUI32(nal_units[i]->GetDataSize());
+        if (AP4_FAILED(result)) return result;
+        result = stream->Write(nal_units[i]->GetData(), nal_units[i]->GetDataSize());
+        if (AP4_FAILED(result)) return result;
+    }
+
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   TrackImport
++---------------------------------------------------------------------*/
+/**
+ * Import of the track(s) of one input. Inputs are parsed concurrently, each
+ * into its own TrackImport, and the tracks are added to the movie once all
+ * the inputs have been parsed, in the order of the inputs.
+ */
+class TrackImport
+{
+public:
+    TrackImport(const char* input_name, const char* input_type) :
+        m_InputName(input_name),
+        m_InputType(input_type),
+        m_IsDovi(false),
+        m_Storage(NULL),
+        m_HasEditList(false),
+        m_EditDuration(0),
+        m_EditScaledDuration(0),
+        m_EditTimeScale(0),
+        m_EditMediaTime(0) {}
+    ~TrackImport() {
+        for (unsigned int i=0; i<m_Tracks.ItemCount(); i++) {
+            delete m_Tracks[i];
+        }
+        delete m_Storage;
+    }
+
+    void AddTrack(AP4_Track* track) { m_Tracks.Append(track); }
+
+    /**
+     * Add an edit list to the imported track. Its duration depends on the
+     * time scale of the movie at the time the track is added to it, so the
+     * edit list is only created then.
+     * duration is used when the movie has no time scale yet, and otherwise
+     * scaled_duration is converted from time_scale to the movie time scale.
+     */
+    void SetEditList(AP4_UI64 duration,
+                     AP4_UI64 scaled_duration,
+                     AP4_UI32 time_scale,
+                     AP4_UI64 media_time) {
+        m_HasEditList        = true;
+        m_EditDuration       = duration;
+        m_EditScaledDuration = scaled_duration;
+        m_EditTimeScale      = time_scale;
+        m_EditMediaTime      = media_time;
+    }
+
+    AP4_Result Run();
+    void       AddTracksToMovie(AP4_Movie& movie, AP4_Array<AP4_UI32>& brands);
+
+    // members
+    const char*           m_InputName;
+    const char*           m_InputType;
+    AP4_Array<Parameter>  m_Parameters;
+    bool                  m_IsDovi;
+    SampleStorage*        m_Storage;
+    AP4_Array<AP4_Track*> m_Tracks;
+    AP4_Array<AP4_UI32>   m_Brands;
+    bool                  m_HasEditList;
+    AP4_UI64              m_EditDuration;
+    AP4_UI64              m_EditScaledDuration;
+    AP4_UI32              m_EditTimeScale;
+    AP4_UI64              m_EditMediaTime;
+};
+
+/*----------------------------------------------------------------------
+|   TrackImport::AddTracksToMovie
++---------------------------------------------------------------------*/
+void
+TrackImport::AddTracksToMovie(AP4_Movie& movie, AP4_Array<AP4_UI32>& brands)
+{
+    for (unsigned int i=0; i<m_Tracks.ItemCount(); i++) {
+        AP4_Track* track = m_Tracks[i];
+        if (m_HasEditList) {
+            // create an 'edts' container
+            AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
+            AP4_ElstAtom* new_elst = new AP4_ElstAtom();
+            AP4_UI64 duration = 0;
+            if (!movie.GetTimeScale()) {
+                duration = m_EditDuration;
+            } else {
+                duration = AP4_ConvertTime(m_EditScaledDuration, m_EditTimeScale, movie.GetTimeScale());
+            }
+            AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, m_EditMediaTime, 1);
+            new_elst->AddEntry(new_elst_entry);
+            new_edts->AddChild(new_elst);
+            track->UseTrakAtom()->AddChild(new_edts, 1);
+        }
+        movie.AddTrack(track);
+    }
+    m_Tracks.Clear();
+
+    // update the brands list
+    for (unsigned int i=0; i<m_Brands.ItemCount(); i++) {
+        brands.Append(m_Brands[i]);
+    }
+}
+
 /*----------------------------------------------------------------------
 |   SortSamples
 +---------------------------------------------------------------------*/
@@ -412,22 +725,22 @@ GetLanguageFromParameters(AP4_Array<Parameter>& parameters, const char* defaut_v
 /*----------------------------------------------------------------------
 |   AddAacTrack
 +---------------------------------------------------------------------*/
-static void
-AddAacTrack(AP4_Movie&            movie,
+static AP4_Result
+AddAacTrack(TrackImport&          import,
             const char*           input_name,
             AP4_Array<Parameter>& parameters,
-            SampleFileStorage&    sample_storage)
+            SampleStorage&        sample_storage)
 {
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // create a sample table
     AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable();
@@ -441,6 +754,7 @@ AddAacTrack(AP4_Movie&            movie,
     AP4_UI32     sample_rate = 0;
     AP4_Cardinal sample_count = 0;
     bool eos = false;
+    AP4_Position input_fed = 0;
     for(;;) {
         // try to get a frame
         AP4_AacFrame frame;
@@ -480,16 +794,18 @@ AddAacTrack(AP4_Movie&            movie,
                 sample_rate = (AP4_UI32)frame.m_Info.m_SamplingFrequency;
             }
 
-            // read and store the sample data
-            AP4_Position position = 0;
-            sample_storage.GetStream()->Tell(position);
-            AP4_DataBuffer sample_data(frame.m_Info.m_FrameLength);
-            sample_data.SetDataSize(frame.m_Info.m_FrameLength);
-            frame.m_Source->ReadBytes(sample_data.UseData(), frame.m_Info.m_FrameLength);
-            sample_storage.GetStream()->Write(sample_data.GetData(), frame.m_Info.m_FrameLength);
+            // store the sample data
+            std::shared_ptr<AP4_ByteStream> sample_stream;
+            AP4_Position                    position = 0;
+            result = sample_storage.StoreFrame(*frame.m_Source, frame.m_Info.m_FrameLength, false, input, input_fed, sample_stream, position);
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                delete sample_table;
+                return result;
+            }
 
             // add the sample to the table
-            sample_table->AddSample(*sample_storage.GetStream(), position, frame.m_Info.m_FrameLength, 1024, sample_description_index, 0, 0, true);
+            sample_table->AddSample(sample_stream, position, frame.m_Info.m_FrameLength, 1024, sample_description_index, 0, 0, true);
             sample_count++;
         } else {
             if (result == AP4_ERROR_CORRUPTED_BITSTREAM) {
@@ -513,14 +829,18 @@ AddAacTrack(AP4_Movie&            movie,
                 AP4_Size to_feed = bytes_read;
                 result = parser.Feed(input_buffer, &to_feed);
                 if (AP4_FAILED(result)) {
-                    AP4_Debug("ERROR: parser.Feed() failed (%d)\n", result);
-                    return;
+                    fprintf(stderr, "ERROR: parser.Feed() failed (%d)\n", result);
+                    delete sample_table;
+                    return result;
                 }
+                input_fed += to_feed;
+            } else if (result == AP4_ERROR_EOS) {
+                eos = true;
+                parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
             } else {
-                if (result == AP4_ERROR_EOS) {
-                    eos = true;
-                    parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
-                }
+                fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+                delete sample_table;
+                return result;
             }
         }
     }
@@ -536,31 +856,31 @@ AddAacTrack(AP4_Movie&            movie,
                                      language,          // language
                                      0, 0);             // width, height
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
  |   AddAc3Track
  +---------------------------------------------------------------------*/
-static void
-AddAc3Track(AP4_Movie&             movie,
+static AP4_Result
+AddAc3Track(TrackImport&           import,
             const char*             input_name,
             AP4_Array<Parameter>&   parameters,
-            SampleFileStorage&      sample_storage)
+            SampleStorage&          sample_storage)
 {
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // create a sample table
     AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable(); // chunk_size is used to control chunk size in 'stsc' box
@@ -575,6 +895,7 @@ AddAc3Track(AP4_Movie&             movie,
     AP4_Cardinal sample_count = 0;
 
     bool eos = false;
+    AP4_Position input_fed = 0;
     for(;;) {
         // try to get a frame
         AP4_Ac3Frame frame;
@@ -606,19 +927,18 @@ AddAc3Track(AP4_Movie&             movie,
                 sample_rate      = frame.m_Info.m_SampleRate;
             }
 
-            // read and store the sample data
-            AP4_Position position = 0;
-            sample_storage.GetStream()->Tell(position);
-            AP4_DataBuffer sample_data(frame.m_Info.m_FrameSize);
-            sample_data.SetDataSize(frame.m_Info.m_FrameSize);
-            frame.m_Source->ReadBytes(sample_data.UseData(), frame.m_Info.m_FrameSize);
-            if (frame.m_LittleEndian) {
-                AP4_ByteSwap16(sample_data.UseData(), (unsigned int)frame.m_Info.m_FrameSize);
+            // store the sample data
+            std::shared_ptr<AP4_ByteStream> sample_stream;
+            AP4_Position                    position = 0;
+            result = sample_storage.StoreFrame(*frame.m_Source, frame.m_Info.m_FrameSize, frame.m_LittleEndian, input, input_fed, sample_stream, position);
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                delete sample_table;
+                return result;
             }
-            sample_storage.GetStream()->Write(sample_data.GetData(), frame.m_Info.m_FrameSize);
 
             // add the sample to the table
-            sample_table->AddSample(*sample_storage.GetStream(), position, frame.m_Info.m_FrameSize, 1536, sample_description_index, 0, 0, true);
+            sample_table->AddSample(sample_stream, position, frame.m_Info.m_FrameSize, 1536, sample_description_index, 0, 0, true);
             sample_count++;
         } else {
             if (eos) break;
@@ -635,14 +955,18 @@ AddAc3Track(AP4_Movie&             movie,
                 AP4_Size to_feed = bytes_read;
                 result = parser.Feed(input_buffer, &to_feed);
                 if (AP4_FAILED(result)) {
-                    AP4_Debug("ERROR: parser.Feed() failed (%d)\n", result);
-                    return;
+                    fprintf(stderr, "ERROR: parser.Feed() failed (%d)\n", result);
+                    delete sample_table;
+                    return result;
                 }
+                input_fed += to_feed;
+            } else if (result == AP4_ERROR_EOS) {
+                eos = true;
+                parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
             } else {
-                if (result == AP4_ERROR_EOS) {
-                    eos = true;
-                    parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
-                }
+                fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+                delete sample_table;
+                return result;
             }
         }
     }
@@ -660,46 +984,37 @@ AddAc3Track(AP4_Movie&             movie,
 
     // add an edit list with MediaTime==0 to ac3 track defautly.
     if (1) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = sample_count * 1536;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), sample_rate, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, 0, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(sample_count * 1536,
+                           1000*sample_table->GetSampleCount(),
+                           sample_rate,
+                           0);
     }
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddEac3Track
 +---------------------------------------------------------------------*/
-static void
-AddEac3Track(AP4_Movie&             movie,
+static AP4_Result
+AddEac3Track(TrackImport&           import,
             const char*             input_name,
             AP4_Array<Parameter>&   parameters,
-            SampleFileStorage&      sample_storage)
+            SampleStorage&          sample_storage)
 {
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // create a sample table
     AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable(); // The parameter chunk_size is used to control chunk size in 'stsc' box
@@ -714,6 +1029,7 @@ AddEac3Track(AP4_Movie&             movie,
     AP4_Cardinal sample_count = 0;
 
     bool eos = false;
+    AP4_Position input_fed = 0;
     for(;;) {
         // try to get a frame
         AP4_Eac3Frame frame;
@@ -746,19 +1062,18 @@ AddEac3Track(AP4_Movie&             movie,
                 sample_rate      = frame.m_Info.m_SampleRate;
             }
 
-            // read and store the sample data
-            AP4_Position position = 0;
-            sample_storage.GetStream()->Tell(position);
-            AP4_DataBuffer sample_data(frame.m_Info.m_FrameSize);
-            sample_data.SetDataSize(frame.m_Info.m_FrameSize);
-            frame.m_Source->ReadBytes(sample_data.UseData(), frame.m_Info.m_FrameSize);
-            if (frame.m_LittleEndian) {
-                AP4_ByteSwap16(sample_data.UseData(), (unsigned int)frame.m_Info.m_FrameSize);
+            // store the sample data
+            std::shared_ptr<AP4_ByteStream> sample_stream;
+            AP4_Position                    position = 0;
+            result = sample_storage.StoreFrame(*frame.m_Source, frame.m_Info.m_FrameSize, frame.m_LittleEndian, input, input_fed, sample_stream, position);
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                delete sample_table;
+                return result;
             }
-            sample_storage.GetStream()->Write(sample_data.GetData(), frame.m_Info.m_FrameSize);
 
             // add the sample to the table
-            sample_table->AddSample(*sample_storage.GetStream(), position, frame.m_Info.m_FrameSize, 1536, sample_description_index, 0, 0, true);
+            sample_table->AddSample(sample_stream, position, frame.m_Info.m_FrameSize, 1536, sample_description_index, 0, 0, true);
             sample_count++;
         } else {
             if (result == AP4_ERROR_CORRUPTED_BITSTREAM) {
@@ -782,14 +1097,18 @@ AddEac3Track(AP4_Movie&             movie,
                 AP4_Size to_feed = bytes_read;
                 result = parser.Feed(input_buffer, &to_feed);
                 if (AP4_FAILED(result)) {
-                    AP4_Debug("ERROR: parser.Feed() failed (%d)\n", result);
-                    return;
+                    fprintf(stderr, "ERROR: parser.Feed() failed (%d)\n", result);
+                    delete sample_table;
+                    return result;
                 }
+                input_fed += to_feed;
+            } else if (result == AP4_ERROR_EOS) {
+                eos = true;
+                parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
             } else {
-                if (result == AP4_ERROR_EOS) {
-                    eos = true;
-                    parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
-                }
+                fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+                delete sample_table;
+                return result;
             }
         }
     }
@@ -807,46 +1126,37 @@ AddEac3Track(AP4_Movie&             movie,
 
     // add an edit list with MediaTime==0 to ec3 track defautly.
     if (1) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = sample_count * 1536;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), sample_rate, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, 0, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(sample_count * 1536,
+                           1000*sample_table->GetSampleCount(),
+                           sample_rate,
+                           0);
     }
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddAc4Track
 +---------------------------------------------------------------------*/
-static void
-AddAc4Track(AP4_Movie&            movie,
+static AP4_Result
+AddAc4Track(TrackImport&          import,
             const char*           input_name,
             AP4_Array<Parameter>& parameters,
-            SampleFileStorage&    sample_storage)
+            SampleStorage&        sample_storage)
 {
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // create a sample table
     AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable(); // The parameter chunk_size is used to control chunk size in 'stsc' box
@@ -862,6 +1172,7 @@ AddAc4Track(AP4_Movie&            movie,
     AP4_Cardinal sample_duration = 0;
     AP4_Cardinal media_time_scale = 0;
     bool eos = false;
+    AP4_Position input_fed = 0;
     for(;;) {
         // try to get a frame
         AP4_Ac4Frame frame;
@@ -895,16 +1206,18 @@ AddAc4Track(AP4_Movie&            movie,
 
             }
 
-            // read and store the sample data
-            AP4_Position position = 0;
-            sample_storage.GetStream()->Tell(position);
-            AP4_DataBuffer sample_data(frame.m_Info.m_FrameSize);
-            sample_data.SetDataSize(frame.m_Info.m_FrameSize);
-            frame.m_Source->ReadBytes(sample_data.UseData(), frame.m_Info.m_FrameSize);
-            sample_storage.GetStream()->Write(sample_data.GetData(), frame.m_Info.m_FrameSize);
+            // store the sample data
+            std::shared_ptr<AP4_ByteStream> sample_stream;
+            AP4_Position                    position = 0;
+            result = sample_storage.StoreFrame(*frame.m_Source, frame.m_Info.m_FrameSize, false, input, input_fed, sample_stream, position);
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                delete sample_table;
+                return result;
+            }
 
             // add the sample to the table
-            sample_table->AddSample(*sample_storage.GetStream(), position, frame.m_Info.m_FrameSize, sample_duration, sample_description_index, 0, 0, (frame.m_Info.m_Iframe == 1));
+            sample_table->AddSample(sample_stream, position, frame.m_Info.m_FrameSize, sample_duration, sample_description_index, 0, 0, (frame.m_Info.m_Iframe == 1));
             sample_count++;
             // Skip the CRC word for 0xAC41 stream
             frame.m_Source->SkipBytes(frame.m_Info.m_CRCSize);
@@ -930,14 +1243,18 @@ AddAc4Track(AP4_Movie&            movie,
                 AP4_Size to_feed = bytes_read;
                 result = parser.Feed(input_buffer, &to_feed);
                 if (AP4_FAILED(result)) {
-                    AP4_Debug("ERROR: parser.Feed() failed (%d)\n", result);
-                    return;
+                    fprintf(stderr, "ERROR: parser.Feed() failed (%d)\n", result);
+                    delete sample_table;
+                    return result;
                 }
+                input_fed += to_feed;
+            } else if (result == AP4_ERROR_EOS) {
+                eos = true;
+                parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
             } else {
-                if (result == AP4_ERROR_EOS) {
-                    eos = true;
-                    parser.Feed(NULL, NULL, AP4_BITSTREAM_FLAG_EOS);
-                }
+                fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+                delete sample_table;
+                return result;
             }
         }
     }
@@ -955,47 +1272,38 @@ AddAc4Track(AP4_Movie&            movie,
 
     // add an edit list with MediaTime==0 to ac4 track defautly.
     if (1) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = AP4_UI64(sample_count) * sample_duration;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), media_time_scale, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, 0, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(AP4_UI64(sample_count) * sample_duration,
+                           1000*sample_table->GetSampleCount(),
+                           media_time_scale,
+                           0);
     }
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddH264Track
 +---------------------------------------------------------------------*/
-static void
-AddH264Track(AP4_Movie&            movie,
+static AP4_Result
+AddH264Track(TrackImport&          import,
              const char*           input_name,
              AP4_Array<Parameter>& parameters,
              AP4_Array<AP4_UI32>&  brands,
-             SampleFileStorage&    sample_storage)
+             SampleStorage&        sample_storage)
 {
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // see if the frame rate is specified
     unsigned int video_frame_rate = AP4_MUX_DEFAULT_VIDEO_FRAME_RATE*1000;
@@ -1004,8 +1312,7 @@ AddH264Track(AP4_Movie&            movie,
             double frame_rate = atof(parameters[i].m_Value.GetChars());
             if (frame_rate == 0.0) {
                 fprintf(stderr, "ERROR: invalid video frame rate %s\n", parameters[i].m_Value.GetChars());
-                input->Release();
-                return;
+                return AP4_ERROR_INVALID_PARAMETERS;
             }
             video_frame_rate = (unsigned int)(1000.0*frame_rate);
         }
@@ -1029,8 +1336,9 @@ AddH264Track(AP4_Movie&            movie,
         } else if (result == AP4_ERROR_EOS) {
             eos = true;
         } else {
-            fprintf(stderr, "ERROR: failed to read from input file\n");
-            break;
+            fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+            delete sample_table;
+            return result;
         }
         AP4_Size offset = 0;
         bool     found_access_unit = false;
@@ -1046,7 +1354,8 @@ AddH264Track(AP4_Movie&            movie,
                                  eos);
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: Feed() failed (%d)\n", result);
-                break;
+                delete sample_table;
+                return result;
             }
             if (access_unit_info.nal_units.ItemCount()) {
                 // we got one access unit
@@ -1058,22 +1367,20 @@ AddH264Track(AP4_Movie&            movie,
                            access_unit_info.display_order);
                 }
                 
-                // compute the total size of the sample data
-                unsigned int sample_data_size = 0;
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-                }
-
                 // store the sample data
-                AP4_Position position = 0;
-                sample_storage.GetStream()->Tell(position);
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_storage.GetStream()->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-                    sample_storage.GetStream()->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
+                std::shared_ptr<AP4_ByteStream> sample_stream;
+                AP4_Position                    position = 0;
+                AP4_Size                        sample_data_size = 0;
+                result = sample_storage.StoreAccessUnit(access_unit_info.nal_units, sample_stream, position, sample_data_size);
+                if (AP4_FAILED(result)) {
+                    fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                    access_unit_info.Reset();
+                    delete sample_table;
+                    return result;
                 }
 
                 // add the sample to the track
-                sample_table->AddSample(*sample_storage.GetStream(), position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_idr);
+                sample_table->AddSample(sample_stream, position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_idr);
             
                 // remember the sample order
                 sample_orders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
@@ -1122,8 +1429,8 @@ AddH264Track(AP4_Movie&            movie,
     }
     if (sps == NULL) {
         fprintf(stderr, "ERROR: no sequence parameter set found in video\n");
-        input->Release();
-        return;
+        delete sample_table;
+        return AP4_ERROR_INVALID_FORMAT;
     }
     unsigned int video_width = 0;
     unsigned int video_height = 0;
@@ -1186,38 +1493,29 @@ AddH264Track(AP4_Movie&            movie,
                                      );
     // Use an edit list to compensate for the inital cts offset
     if (max_delta) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = video_media_duration;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), media_timescale, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, max_delta*1000ULL, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(video_media_duration,
+                           1000*sample_table->GetSampleCount(),
+                           media_timescale,
+                           max_delta*1000ULL);
     }
     // update the brands list
     brands.Append(AP4_FILE_BRAND_AVC1);
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddH264DoviTrack
 +---------------------------------------------------------------------*/
-static void
-AddH264DoviTrack(AP4_Movie&            movie,
+static AP4_Result
+AddH264DoviTrack(TrackImport&          import,
                  const char*           input_name,
                  AP4_Array<Parameter>& parameters,
                  AP4_Array<AP4_UI32>&  brands,
-                 SampleFileStorage&    sample_storage)
+                 SampleStorage&        sample_storage)
 {
     double frame_rate = 0.0;
     //based on the Dovi iso spec, set the following values to const 
@@ -1233,16 +1531,16 @@ AddH264DoviTrack(AP4_Movie&            movie,
 
     AP4_UI32 format = 0;
 
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // see if the frame rate is specified
     AP4_UI32 video_frame_rate = AP4_MUX_DEFAULT_VIDEO_FRAME_RATE*1000;
@@ -1251,8 +1549,7 @@ AddH264DoviTrack(AP4_Movie&            movie,
             frame_rate = atof(parameters[i].m_Value.GetChars());
             if (frame_rate == 0.0) {
                 fprintf(stderr, "ERROR: invalid video frame rate %s\n", parameters[i].m_Value.GetChars());
-                input->Release();
-                return;
+                return AP4_ERROR_INVALID_PARAMETERS;
             }
             video_frame_rate = (unsigned int)(1000.0*frame_rate);
         } else if (parameters[i].m_Name == "format") {
@@ -1302,8 +1599,9 @@ AddH264DoviTrack(AP4_Movie&            movie,
         } else if (result == AP4_ERROR_EOS) {
             eos = true;
         } else {
-            fprintf(stderr, "ERROR: failed to read from input file\n");
-            break;
+            fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+            delete sample_table;
+            return result;
         }
         AP4_Size offset = 0;
         bool     found_access_unit = false;
@@ -1319,7 +1617,8 @@ AddH264DoviTrack(AP4_Movie&            movie,
                                  eos);
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: Feed() failed (%d)\n", result);
-                break;
+                delete sample_table;
+                return result;
             }
             if (access_unit_info.nal_units.ItemCount()) {
                 // we got one access unit
@@ -1331,22 +1630,20 @@ AddH264DoviTrack(AP4_Movie&            movie,
                            access_unit_info.display_order);
                 }
                 
-                // compute the total size of the sample data
-                unsigned int sample_data_size = 0;
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-                }
-
                 // store the sample data
-                AP4_Position position = 0;
-                sample_storage.GetStream()->Tell(position);
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_storage.GetStream()->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-                    sample_storage.GetStream()->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
+                std::shared_ptr<AP4_ByteStream> sample_stream;
+                AP4_Position                    position = 0;
+                AP4_Size                        sample_data_size = 0;
+                result = sample_storage.StoreAccessUnit(access_unit_info.nal_units, sample_stream, position, sample_data_size);
+                if (AP4_FAILED(result)) {
+                    fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                    access_unit_info.Reset();
+                    delete sample_table;
+                    return result;
                 }
 
                 // add the sample to the track
-                sample_table->AddSample(*sample_storage.GetStream(), position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_idr);
+                sample_table->AddSample(sample_stream, position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_idr);
 
                 // remember the sample order
                 sample_orders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
@@ -1395,8 +1692,8 @@ AddH264DoviTrack(AP4_Movie&            movie,
     }
     if (sps == NULL) {
         fprintf(stderr, "ERROR: no sequence parameter set found in video\n");
-        input->Release();
-        return;
+        delete sample_table;
+        return AP4_ERROR_INVALID_FORMAT;
     }
     unsigned int video_width = 0;
     unsigned int video_height = 0;
@@ -1470,53 +1767,44 @@ AddH264DoviTrack(AP4_Movie&            movie,
                                      );
     // Using edit list to compensate the inital cts offset
     if (max_delta) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = video_media_duration;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), media_timescale, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, max_delta*1000ULL, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(video_media_duration,
+                           1000*sample_table->GetSampleCount(),
+                           media_timescale,
+                           max_delta*1000ULL);
     }
     // update the brands list
     brands.Append(format);
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddH265Track
 +---------------------------------------------------------------------*/
-static void
-AddH265Track(AP4_Movie&            movie,
+static AP4_Result
+AddH265Track(TrackImport&          import,
              const char*           input_name,
              AP4_Array<Parameter>& parameters,
              AP4_Array<AP4_UI32>&  brands,
-             SampleFileStorage&    sample_storage)
+             SampleStorage&        sample_storage)
 {
     unsigned int video_width = 0;
     unsigned int video_height = 0;
     AP4_UI32     format = AP4_SAMPLE_FORMAT_HVC1;
     
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // see if the frame rate is specified
     unsigned int video_frame_rate = AP4_MUX_DEFAULT_VIDEO_FRAME_RATE*1000;
@@ -1525,8 +1813,7 @@ AddH265Track(AP4_Movie&            movie,
             double frame_rate = atof(parameters[i].m_Value.GetChars());
             if (frame_rate == 0.0) {
                 fprintf(stderr, "ERROR: invalid video frame rate %s\n", parameters[i].m_Value.GetChars());
-                input->Release();
-                return;
+                return AP4_ERROR_INVALID_PARAMETERS;
             }
             video_frame_rate = (unsigned int)(1000.0*frame_rate);
         } else if (parameters[i].m_Name == "format") {
@@ -1556,8 +1843,9 @@ AddH265Track(AP4_Movie&            movie,
         } else if (result == AP4_ERROR_EOS) {
             eos = true;
         } else {
-            fprintf(stderr, "ERROR: failed to read from input file\n");
-            break;
+            fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+            delete sample_table;
+            return result;
         }
         AP4_Size offset = 0;
         bool     found_access_unit = false;
@@ -1573,7 +1861,8 @@ AddH265Track(AP4_Movie&            movie,
                                  eos);
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: Feed() failed (%d)\n", result);
-                break;
+                delete sample_table;
+                return result;
             }
             if (access_unit_info.nal_units.ItemCount()) {
                 // we got one access unit
@@ -1585,22 +1874,20 @@ AddH265Track(AP4_Movie&            movie,
                            access_unit_info.display_order);
                 }
                 
-                // compute the total size of the sample data
-                unsigned int sample_data_size = 0;
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-                }
-                
                 // store the sample data
-                AP4_Position position = 0;
-                sample_storage.GetStream()->Tell(position);
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_storage.GetStream()->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-                    sample_storage.GetStream()->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
+                std::shared_ptr<AP4_ByteStream> sample_stream;
+                AP4_Position                    position = 0;
+                AP4_Size                        sample_data_size = 0;
+                result = sample_storage.StoreAccessUnit(access_unit_info.nal_units, sample_stream, position, sample_data_size);
+                if (AP4_FAILED(result)) {
+                    fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                    access_unit_info.Reset();
+                    delete sample_table;
+                    return result;
                 }
                 
                 // add the sample to the track
-                sample_table->AddSample(*sample_storage.GetStream(), position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_random_access);
+                sample_table->AddSample(sample_stream, position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_random_access);
             
                 // remember the sample order
                 sample_orders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
@@ -1647,8 +1934,8 @@ AddH265Track(AP4_Movie&            movie,
     }
     if (sps == NULL) {
         fprintf(stderr, "ERROR: no sequence parameter set found in video\n");
-        input->Release();
-        return;
+        delete sample_table;
+        return AP4_ERROR_INVALID_FORMAT;
     }
     
     // collect parameters from the first SPS entry
@@ -1748,38 +2035,29 @@ AddH265Track(AP4_Movie&            movie,
 
     // Use an edit list to compensate for the inital cts offset
     if (max_delta) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = video_media_duration;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), media_timescale, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, max_delta*1000ULL, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(video_media_duration,
+                           1000*sample_table->GetSampleCount(),
+                           media_timescale,
+                           max_delta*1000ULL);
     }
     // update the brands list
     brands.Append(AP4_FILE_BRAND_HVC1);
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddH265DoviTrack
 +---------------------------------------------------------------------*/
-static void
-AddH265DoviTrack(AP4_Movie&           movie,
+static AP4_Result
+AddH265DoviTrack(TrackImport&         import,
                 const char*           input_name,
                 AP4_Array<Parameter>& parameters,
                 AP4_Array<AP4_UI32>&  brands,
-                SampleFileStorage&    sample_storage)
+                SampleStorage&        sample_storage)
 {
     AP4_UI32 video_width = 0;
     AP4_UI32 video_height = 0;
@@ -1798,16 +2076,16 @@ AddH265DoviTrack(AP4_Movie&           movie,
 
     AP4_UI32 format = 0;
     
-    AP4_ByteStream* input;
+    std::shared_ptr<AP4_ByteStream> input;
     AP4_Result result = AP4_FileByteStream::Create(input_name, AP4_FileByteStream::STREAM_MODE_READ, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file '%s' (%d))\n", input_name, result);
-        return;
+        return result;
     }
 
     // check if we have a language parameter
     const char* language = GetLanguageFromParameters(parameters, "und");
-    if (!language) return;
+    if (!language) return AP4_ERROR_INVALID_PARAMETERS;
 
     // see if the frame rate/format/dv_profile/dv_bc is specified
     unsigned int video_frame_rate = AP4_MUX_DEFAULT_VIDEO_FRAME_RATE*1000;
@@ -1816,8 +2094,7 @@ AddH265DoviTrack(AP4_Movie&           movie,
             frame_rate = atof(parameters[i].m_Value.GetChars());
             if (frame_rate == 0.0) {
                 fprintf(stderr, "ERROR: invalid video frame rate %s\n", parameters[i].m_Value.GetChars());
-                input->Release();
-                return;
+                return AP4_ERROR_INVALID_PARAMETERS;
             }
             video_frame_rate = (unsigned int)(1000.0*frame_rate);
         } else if (parameters[i].m_Name == "format") {
@@ -1873,8 +2150,9 @@ AddH265DoviTrack(AP4_Movie&           movie,
         } else if (result == AP4_ERROR_EOS) {
             eos = true;
         } else {
-            fprintf(stderr, "ERROR: failed to read from input file\n");
-            break;
+            fprintf(stderr, "ERROR: failed to read from input file (%d)\n", result);
+            delete sample_table;
+            return result;
         }
         AP4_Size offset = 0;
         bool     found_access_unit = false;
@@ -1890,7 +2168,8 @@ AddH265DoviTrack(AP4_Movie&           movie,
                                  eos);
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: Feed() failed (%d)\n", result);
-                break;
+                delete sample_table;
+                return result;
             }
             if (access_unit_info.nal_units.ItemCount()) {
                 // we got one access unit
@@ -1902,22 +2181,20 @@ AddH265DoviTrack(AP4_Movie&           movie,
                            access_unit_info.display_order);
                 }
                 
-                // compute the total size of the sample data
-                unsigned int sample_data_size = 0;
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-                }
-                
                 // store the sample data
-                AP4_Position position = 0;
-                sample_storage.GetStream()->Tell(position);
-                for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-                    sample_storage.GetStream()->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-                    sample_storage.GetStream()->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
+                std::shared_ptr<AP4_ByteStream> sample_stream;
+                AP4_Position                    position = 0;
+                AP4_Size                        sample_data_size = 0;
+                result = sample_storage.StoreAccessUnit(access_unit_info.nal_units, sample_stream, position, sample_data_size);
+                if (AP4_FAILED(result)) {
+                    fprintf(stderr, "ERROR: failed to store the sample data (%d)\n", result);
+                    access_unit_info.Reset();
+                    delete sample_table;
+                    return result;
                 }
                 
                 // add the sample to the track
-                sample_table->AddSample(*sample_storage.GetStream(), position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_random_access);
+                sample_table->AddSample(sample_stream, position, sample_data_size, 1000, 0, 0, 0, access_unit_info.is_random_access);
             
                 // remember the sample order
                 sample_orders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
@@ -1964,8 +2241,8 @@ AddH265DoviTrack(AP4_Movie&           movie,
     }
     if (sps == NULL) {
         fprintf(stderr, "ERROR: no sequence parameter set found in video\n");
-        input->Release();
-        return;
+        delete sample_table;
+        return AP4_ERROR_INVALID_FORMAT;
     }
     
     // collect parameters from the first SPS entry
@@ -2085,19 +2362,10 @@ AddH265DoviTrack(AP4_Movie&           movie,
                                      );
     // Using edit list to compensate the inital cts offset
     if (max_delta) {
-        // create an 'edts' container
-        AP4_ContainerAtom* new_edts = new AP4_ContainerAtom(AP4_ATOM_TYPE_EDTS);
-        AP4_ElstAtom* new_elst = new AP4_ElstAtom();
-        AP4_UI64 duration = 0;
-        if (!movie.GetTimeScale()) {
-            duration = video_media_duration;
-        } else {
-            duration = AP4_ConvertTime(1000*sample_table->GetSampleCount(), media_timescale, movie.GetTimeScale());
-        }
-        AP4_ElstEntry new_elst_entry = AP4_ElstEntry(duration, max_delta*1000ULL, 1);
-        new_elst->AddEntry(new_elst_entry);
-        new_edts->AddChild(new_elst);
-        track->UseTrakAtom()->AddChild(new_edts, 1);
+        import.SetEditList(video_media_duration,
+                           1000*sample_table->GetSampleCount(),
+                           media_timescale,
+                           max_delta*1000ULL);
     }
     // update the brands list
     brands.Append(format);
@@ -2109,36 +2377,36 @@ AddH265DoviTrack(AP4_Movie&           movie,
         }
     }
 
-    // cleanup
-    input->Release();
 
-    movie.AddTrack(track);
+    import.AddTrack(track);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AddMp4Tracks
 +---------------------------------------------------------------------*/
-static void
-AddMp4Tracks(AP4_Movie&            movie,
+static AP4_Result
+AddMp4Tracks(TrackImport&          import,
              const char*           input_name,
              AP4_Array<Parameter>& parameters,
              AP4_Array<AP4_UI32>&  /*brands*/)
 {
     // open the input
-    AP4_ByteStream* input_stream = NULL;
+    std::shared_ptr<AP4_ByteStream> input_stream;
     AP4_Result result = AP4_FileByteStream::Create(input_name,
                                                    AP4_FileByteStream::STREAM_MODE_READ, 
                                                    input_stream);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file %s (%d)\n", input_name, result);
-        return;
+        return result;
     }
     
-    AP4_File file(*input_stream, true);
-    input_stream->Release();
+    AP4_File file(input_stream, true);
     AP4_Movie* input_movie = file.GetMovie();
     if (input_movie == NULL) {
-        return;
+        fprintf(stderr, "ERROR: no movie found in %s\n", input_name);
+        return AP4_ERROR_INVALID_FORMAT;
     }
 
     // check if we have a language parameter
@@ -2152,7 +2420,7 @@ AddMp4Tracks(AP4_Movie&            movie,
                 AP4_Track* track = input_movie->GetTrack(AP4_Track::TYPE_AUDIO);
                 if (track == NULL) {
                     fprintf(stderr, "ERROR: no audio track found in %s\n", input_name);
-                    return;
+                    return AP4_ERROR_NO_SUCH_ITEM;
                 } else {
                     track_id = track->GetId();
                 }
@@ -2160,15 +2428,15 @@ AddMp4Tracks(AP4_Movie&            movie,
                 AP4_Track* track = input_movie->GetTrack(AP4_Track::TYPE_VIDEO);
                 if (track == NULL) {
                     fprintf(stderr, "ERROR: no video track found in %s\n", input_name);
-                    return;
+                    return AP4_ERROR_NO_SUCH_ITEM;
                 } else {
                     track_id = track->GetId();
                 }
             } else {
                 track_id = (unsigned int)strtoul(parameters[i].m_Value.GetChars(), NULL, 10);
                 if (track_id == 0) {
-                    fprintf(stderr, "ERROR: invalid track ID specified");
-                    return;
+                    fprintf(stderr, "ERROR: invalid track ID specified\n");
+                    return AP4_ERROR_INVALID_PARAMETERS;
                 }
             }
         }
@@ -2182,6 +2450,7 @@ AddMp4Tracks(AP4_Movie&            movie,
         }
     }
     
+    unsigned int track_count = 0;
     AP4_List<AP4_Track>::Item* track_item = input_movie->GetTracks().FirstItem();
     while (track_item) {
         AP4_Track* track = track_item->GetData();
@@ -2196,10 +2465,51 @@ AddMp4Tracks(AP4_Movie&            movie,
                 track->SetTrackLanguage(language);
             }
 
-            movie.AddTrack(track);
+            import.AddTrack(track);
+            track_count++;
         }
         track_item = track_item->GetNext();
     }
+    if (track_count == 0) {
+        fprintf(stderr, "ERROR: no track to import from %s\n", input_name);
+        return AP4_ERROR_NO_SUCH_ITEM;
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   TrackImport::Run
++---------------------------------------------------------------------*/
+AP4_Result
+TrackImport::Run()
+{
+    const char* input_type = m_InputType;
+    if (!strcmp(input_type, "h264")) {
+        if (m_IsDovi) {
+            return AddH264DoviTrack(*this, m_InputName, m_Parameters, m_Brands, *m_Storage);
+        } else {
+            return AddH264Track(*this, m_InputName, m_Parameters, m_Brands, *m_Storage);
+        }
+    } else if (!strcmp(input_type, "h265")) {
+        if (m_IsDovi) {
+            return AddH265DoviTrack(*this, m_InputName, m_Parameters, m_Brands, *m_Storage);
+        } else {
+            return AddH265Track(*this, m_InputName, m_Parameters, m_Brands, *m_Storage);
+        }
+    } else if (!strcmp(input_type, "aac")) {
+        return AddAacTrack(*this, m_InputName, m_Parameters, *m_Storage);
+    } else if (!strcmp(input_type, "ac3")) {
+        return AddAc3Track(*this, m_InputName, m_Parameters, *m_Storage);
+    } else if (!strcmp(input_type, "ec3")) {
+        return AddEac3Track(*this, m_InputName, m_Parameters, *m_Storage);
+    } else if (!strcmp(input_type, "ac4")) {
+        return AddAc4Track(*this, m_InputName, m_Parameters, *m_Storage);
+    } else if (!strcmp(input_type, "mp4")) {
+        return AddMp4Tracks(*this, m_InputName, m_Parameters, m_Brands);
+    } else {
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
 }
 
 /*----------------------------------------------------------------------
@@ -2211,7 +2521,10 @@ main(int argc, char** argv)
     if (argc < 2) {
         PrintUsageAndExit();
     }
-    Options.verbose = false;
+    Options.verbose        = false;
+    Options.memory_storage = false;
+    Options.memory_limit   = AP4_MUX_DEFAULT_MEMORY_LIMIT;
+    Options.thread_count   = AP4_ThreadPool::GetDefaultThreadCount();
     
     const char* output_filename = NULL;
     AP4_Array<char*> input_names;
@@ -2221,6 +2534,40 @@ main(int argc, char** argv)
             Options.verbose = true;
         } else if (!strcmp(arg, "--track")) {
             input_names.Append(*++argv);
+        } else if (!strcmp(arg, "--threads")) {
+            const char* count = *++argv;
+            if (count == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --threads option\n");
+                return 1;
+            }
+            Options.thread_count = (unsigned int)strtoul(count, NULL, 10);
+            if (Options.thread_count == 0) {
+                Options.thread_count = AP4_ThreadPool::GetDefaultThreadCount();
+            }
+        } else if (!strcmp(arg, "--sample-storage")) {
+            const char* mode = *++argv;
+            if (mode == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --sample-storage option\n");
+                return 1;
+            }
+            if (!strcmp(mode, "file")) {
+                Options.memory_storage = false;
+            } else if (!strcmp(mode, "memory")) {
+                Options.memory_storage = true;
+            } else {
+                fprintf(stderr, "ERROR: invalid sample storage mode '%s'\n", mode);
+                return 1;
+            }
+        } else if (!strcmp(arg, "--memory-limit")) {
+            const char* limit = *++argv;
+            if (limit == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --memory-limit option\n");
+                return 1;
+            }
+            if (AP4_FAILED(ParseSize(limit, Options.memory_limit))) {
+                fprintf(stderr, "ERROR: invalid memory limit '%s'\n", limit);
+                return 1;
+            }
         } else if (output_filename == NULL) {
             output_filename = arg;
         } else {
@@ -2252,15 +2599,8 @@ main(int argc, char** argv)
     brands.Append(AP4_FILE_BRAND_ISOM);
     brands.Append(AP4_FILE_BRAND_MP42);
 
-    // create a temp file to store the sample data
-    SampleFileStorage* sample_storage = NULL;
-    AP4_Result result = SampleFileStorage::Create(output_filename, sample_storage);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: failed to create temporary sample data storage (%d)\n", result);
-        return 1;
-    }
-    
-    // add all the tracks
+    // collect the inputs
+    AP4_Array<TrackImport*> imports;
     bool hasDovi = false;
     AP4_UI08 dolby_vision_ccid = 0;
     for (unsigned int i=0; i<input_names.ItemCount(); i++) {
@@ -2305,7 +2645,6 @@ main(int argc, char** argv)
                 }
             } else {
                 fprintf(stderr, "ERROR: unable to determine type for input '%s'\n", input_name);
-                delete sample_storage;
                 return 1;
             }
         }
@@ -2332,49 +2671,82 @@ main(int argc, char** argv)
             }
         }
 
-        if (!strcmp(input_type, "h264")) {
-            if (isDovi) {
-                if (CheckDoviInputParameters(parameters) != AP4_SUCCESS) {
-                    fprintf(stderr, "ERROR: dolby vision input parameter error\n");
-                    delete sample_storage;
-                    return 1;
-                } else {
-                    AddH264DoviTrack(*movie, input_name, parameters, brands, *sample_storage);
-                    hasDovi = true;
-                }
-            } else {
-                AddH264Track(*movie, input_name, parameters, brands, *sample_storage);
-            }
-        } else if (!strcmp(input_type, "h265")) {
-            if (isDovi) {
-                if (CheckDoviInputParameters(parameters) != AP4_SUCCESS) {
-                    fprintf(stderr, "ERROR: dolby vision input parameter error\n");
-                    delete sample_storage;
-                    return 1;
-                } else {
-                    AddH265DoviTrack(*movie, input_name, parameters, brands, *sample_storage);
-                    hasDovi = true;
-                }
+        if (isDovi) {
+            if (strcmp(input_type, "h264") && strcmp(input_type, "h265")) {
+                isDovi = false;
+            } else if (CheckDoviInputParameters(parameters) != AP4_SUCCESS) {
+                fprintf(stderr, "ERROR: dolby vision input parameter error\n");
+                return 1;
             } else {
-                AddH265Track(*movie, input_name, parameters, brands, *sample_storage);
-            }
-        } else if (!strcmp(input_type, "aac")) {
-            AddAacTrack(*movie, input_name, parameters, *sample_storage);
-        } else if (!strcmp(input_type, "ac3")) {
-            AddAc3Track(*movie, input_name, parameters, *sample_storage);
-        } else if (!strcmp(input_type, "ec3")) {
-            AddEac3Track(*movie, input_name, parameters, *sample_storage);
-        } else if (!strcmp(input_type, "ac4")) {
-            AddAc4Track(*movie, input_name, parameters, *sample_storage);
-        } else if (!strcmp(input_type, "mp4")) {
-            AddMp4Tracks(*movie, input_name, parameters, brands);
-        } else {
+                hasDovi = true;
+            }
+        }
+        if (strcmp(input_type, "h264") &&
+            strcmp(input_type, "h265") &&
+            strcmp(input_type, "aac")  &&
+            strcmp(input_type, "ac3")  &&
+            strcmp(input_type, "ec3")  &&
+            strcmp(input_type, "ac4")  &&
+            strcmp(input_type, "mp4")) {
             fprintf(stderr, "ERROR: unsupported input type '%s'\n", input_type);
-            delete sample_storage;
+            return 1;
+        }
+
+        TrackImport* import = new TrackImport(input_name, input_type);
+        import->m_Parameters = parameters;
+        import->m_IsDovi     = isDovi;
+        imports.Append(import);
+    }
+
+    // create the storage for the sample data
+    for (unsigned int i=0; i<imports.ItemCount(); i++) {
+        AP4_Result result = SampleStorage::Create(output_filename,
+                                                  i,
+                                                  Options.memory_storage ?
+                                                  SampleStorage::MODE_MEMORY :
+                                                  SampleStorage::MODE_FILE,
+                                                  imports[i]->m_Storage);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to create the sample data storage (%d)\n", result);
+            for (unsigned int j=0; j<imports.ItemCount(); j++) {
+                delete imports[j];
+            }
             return 1;
         }
     }
 
+    // parse the inputs, each on its own thread
+    bool import_failed = false;
+    {
+        unsigned int thread_count = Options.thread_count;
+        if (thread_count > imports.ItemCount()) thread_count = imports.ItemCount();
+        AP4_ThreadPool pool(thread_count);
+        std::vector<std::future<AP4_Result> > results;
+        for (unsigned int i=0; i<imports.ItemCount(); i++) {
+            TrackImport* import = imports[i];
+            results.push_back(pool.Submit([import]() { return import->Run(); }));
+        }
+        for (unsigned int i=0; i<results.size(); i++) {
+            AP4_Result result = results[i].get();
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to import '%s' (%d)\n", imports[i]->m_InputName, result);
+                import_failed = true;
+            }
+        }
+    }
+    if (import_failed) {
+        for (unsigned int i=0; i<imports.ItemCount(); i++) {
+            delete imports[i];
+        }
+        delete movie;
+        return 1;
+    }
+
+    // add all the tracks, in the order of the inputs
+    for (unsigned int i=0; i<imports.ItemCount(); i++) {
+        imports[i]->AddTracksToMovie(*movie, brands);
+    }
+
     // for Dolby Vision, add the 'dby1' brand
     if (hasDovi) {
         brands.Append(AP4_FILE_BRAND_DBY1);
@@ -2390,11 +2762,14 @@ main(int argc, char** argv)
     movie->GetMvhdAtom()->SetNextTrackId(movie->GetTracks().ItemCount() + 1);
 
     // open the output
-    AP4_ByteStream* output = NULL;
-    result = AP4_FileByteStream::Create(output_filename, AP4_FileByteStream::STREAM_MODE_WRITE, output);
+    std::shared_ptr<AP4_ByteStream> output_file;
+    AP4_Result result = AP4_FileByteStream::Create(output_filename, AP4_FileByteStream::STREAM_MODE_WRITE, output_file);
     if (AP4_FAILED(result)) {
-        AP4_Debug("ERROR: cannot open output '%s' (%d)\n", output_filename, result);
-        delete sample_storage;
+        fprintf(stderr, "ERROR: cannot open output '%s' (%d)\n", output_filename, result);
+        for (unsigned int i=0; i<imports.ItemCount(); i++) {
+            delete imports[i];
+        }
+        delete movie;
         return 1;
     }
     
@@ -2405,13 +2780,21 @@ main(int argc, char** argv)
         // set the file type
         file.SetFileType(AP4_FILE_BRAND_MP42, 1, &brands[0], brands.ItemCount());
 
-        // write the file to the output
-        AP4_FileWriter::Write(file, *output);
+        // write the file to the output, buffering it so that the writes
+        // to disk overlap with reading the samples from the storage
+        AP4_BufferedOutputStream output(output_file);
+        result = AP4_FileWriter::Write(file, output);
+        AP4_Result flush_result = output.Flush();
+        if (AP4_SUCCEEDED(result)) result = flush_result;
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to write the output (%d)\n", result);
+        }
     }
     
     // cleanup
-    delete sample_storage;
-    output->Release();
+    for (unsigned int i=0; i<imports.ItemCount(); i++) {
+        delete imports[i];
+    }
     
-    return 0;
+    return AP4_FAILED(result) ? 1 : 0;
 }
@@ -247,15 +247,15 @@ main(int argc, char** argv)
     }
     
 	// create the input stream
-    AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ, input);
+    std::shared_ptr<AP4_ByteStream> input;
+    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
         return 1;
     }
     
     // get the movie
-    AP4_File* file = new AP4_File(*input, true);
+    AP4_File* file = new AP4_File(input, true);
     AP4_Movie* movie = file->GetMovie();
     if (movie == NULL) {
         fprintf(stderr, "no movie found in file\n");
@@ -290,7 +290,7 @@ main(int argc, char** argv)
     }
     
     // save the init segment
-    AP4_ByteStream* output = NULL;
+    std::shared_ptr<AP4_ByteStream> output;
     result = AP4_FileByteStream::Create(Options.init_segment_name, AP4_FileByteStream::STREAM_MODE_WRITE, output);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open output file (%d)\n", result);
@@ -350,7 +350,7 @@ main(int argc, char** argv)
     AP4_DefaultAtomFactory atom_factory;
     for (;!Options.init_only;) {
         // process the next atom
-        result = atom_factory.CreateAtomFromStream(*input, atom);
+        result = atom_factory.CreateAtomFromStream(input, atom);
         if (AP4_FAILED(result)) break;
         
         if (atom->GetType() == AP4_ATOM_TYPE_MOOF) {
@@ -386,10 +386,7 @@ main(int argc, char** argv)
             // open a new file for this fragment if this moof is a segment start
             char segment_name[4096];
             if (Options.track_id_count == 0 || track_id == Options.track_ids[0]) {
-                if (output) {
-                    output->Release();
-                    output = NULL;
-                }
+                output.reset();
 
                 AP4_UI64 p[2] = {0,0};
                 unsigned int params_len = (unsigned int)strlen(Options.pattern_params);
@@ -428,8 +425,6 @@ main(int argc, char** argv)
 
     // cleanup
     delete file;
-    if (input) input->Release();
-    if (output) output->Release();
     
     return 0;
 }
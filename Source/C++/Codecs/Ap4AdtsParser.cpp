@@ -31,6 +31,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4BitStream.h"
 #include "Ap4AdtsParser.h"
+#include "Ap4Utils.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -182,7 +183,24 @@ AP4_AdtsParser::FindHeader(AP4_UI08* header)
     AP4_Size available = m_Bits.GetBytesAvailable();
 
     /* look for the sync pattern */
-    while (available-- >= AP4_ADTS_HEADER_SIZE) {
+    while (available >= AP4_ADTS_HEADER_SIZE) {
+        /* skip directly to the next byte that can start a sync word */
+        if (m_Bits.m_BitsCached == 0) {
+            AP4_Size scan_size = m_Bits.GetContiguousBytesAvailable();
+            if (scan_size > available-(AP4_ADTS_HEADER_SIZE-1)) {
+                scan_size = available-(AP4_ADTS_HEADER_SIZE-1);
+            }
+            const AP4_UI08* scan = m_Bits.m_Buffer+m_Bits.m_Out;
+            const AP4_UI08* sync = (const AP4_UI08*)memchr(scan, 0xFF, scan_size);
+            AP4_Size skip = sync ? (AP4_Size)(sync-scan) : scan_size;
+            if (skip) {
+                m_Bits.SkipBytes(skip);
+                available -= skip;
+                continue;
+            }
+        }
+
+        --available;
         m_Bits.PeekBytes(header, 2);
 
         if ((((header[0] << 8) | header[1]) & AP4_ADTS_SYNC_MASK) == AP4_ADTS_SYNC_PATTERN) {
@@ -198,6 +216,95 @@ AP4_AdtsParser::FindHeader(AP4_UI08* header)
     return AP4_ERROR_NOT_ENOUGH_DATA;
 }
 
+/*----------------------------------------------------------------------+
+|    GetFrameInfo
++----------------------------------------------------------------------*/
+static void
+GetFrameInfo(const AP4_AdtsHeader& adts_header, AP4_AacFrameInfo& frame_info)
+{
+    frame_info.m_Standard = (adts_header.m_Id == 1 ? 
+                            AP4_AAC_STANDARD_MPEG2 :
+                            AP4_AAC_STANDARD_MPEG4);
+    switch (adts_header.m_ProfileObjectType) {
+        case 0:
+            frame_info.m_Profile = AP4_AAC_PROFILE_MAIN;
+            break;
+
+        case 1:
+            frame_info.m_Profile = AP4_AAC_PROFILE_LC;
+            break;
+
+        case 2: 
+            frame_info.m_Profile = AP4_AAC_PROFILE_SSR;
+            break;
+
+        case 3:
+            frame_info.m_Profile = AP4_AAC_PROFILE_LTP;
+    }
+    frame_info.m_FrameLength = adts_header.m_FrameLength-AP4_ADTS_HEADER_SIZE;
+    frame_info.m_ChannelConfiguration = adts_header.m_ChannelConfiguration;
+    frame_info.m_SamplingFrequencyIndex = adts_header.m_SamplingFrequencyIndex;
+    frame_info.m_SamplingFrequency = AP4_AdtsSamplingFrequencyTable[adts_header.m_SamplingFrequencyIndex];
+}
+
+/*----------------------------------------------------------------------+
+|    AP4_AdtsParser::FindFrame
++----------------------------------------------------------------------*/
+AP4_Result
+AP4_AdtsParser::FindFrame(const AP4_UI08*   data,
+                          AP4_Size          data_size,
+                          AP4_Size&         frame_offset,
+                          AP4_Size&         frame_size,
+                          AP4_AacFrameInfo& frame_info,
+                          bool              eos)
+{
+    frame_offset = 0;
+    frame_size   = 0;
+    while (frame_offset+AP4_ADTS_HEADER_SIZE <= data_size) {
+        /* skip directly to the next byte that can start a sync word */
+        const AP4_UI08* header = data+frame_offset;
+        if (header[0] != 0xFF) {
+            AP4_Size scan_size = data_size-frame_offset-(AP4_ADTS_HEADER_SIZE-1);
+            const AP4_UI08* sync = (const AP4_UI08*)memchr(header, 0xFF, scan_size);
+            frame_offset += sync ? (AP4_Size)(sync-header) : scan_size;
+            continue;
+        }
+
+        /* check the header */
+        AP4_AdtsHeader adts_header(header);
+        unsigned int header_size = AP4_ADTS_HEADER_SIZE+(adts_header.m_ProtectionAbsent ? 0 : 2);
+        if ((((header[0] << 8) | header[1]) & AP4_ADTS_SYNC_MASK) != AP4_ADTS_SYNC_PATTERN ||
+            AP4_FAILED(adts_header.Check()) ||
+            adts_header.m_FrameLength < header_size) {
+            ++frame_offset;
+            continue;
+        }
+
+        /* the frame must be followed by a matching header, unless it is the last one */
+        AP4_Size available = data_size-frame_offset;
+        if (available >= adts_header.m_FrameLength+AP4_ADTS_HEADER_SIZE) {
+            const AP4_UI08* next_header = header+adts_header.m_FrameLength;
+            AP4_AdtsHeader next_adts_header(next_header);
+            if (AP4_FAILED(next_adts_header.Check()) ||
+                !AP4_AdtsHeader::MatchFixed(const_cast<AP4_UI08*>(next_header), const_cast<AP4_UI08*>(header))) {
+                ++frame_offset;
+                continue;
+            }
+        } else if (available < adts_header.m_FrameLength || !eos) {
+            return AP4_ERROR_NOT_ENOUGH_DATA;
+        }
+
+        GetFrameInfo(adts_header, frame_info);
+        frame_info.m_FrameLength = adts_header.m_FrameLength-header_size;
+        frame_size = adts_header.m_FrameLength;
+        return AP4_SUCCESS;
+    }
+
+    /* the last bytes may be the start of a header */
+    if (eos) frame_offset = data_size;
+    return AP4_ERROR_NOT_ENOUGH_DATA;
+}
+
 /*----------------------------------------------------------------------+
 |    AP4_AdtsParser::FindFrame
 +----------------------------------------------------------------------*/
@@ -250,29 +357,7 @@ AP4_AdtsParser::FindFrame(AP4_AacFrame& frame)
     m_Bits.SkipBytes(AP4_ADTS_HEADER_SIZE);
 
     /* fill in the frame info */
-    frame.m_Info.m_Standard = (adts_header.m_Id == 1 ? 
-                            AP4_AAC_STANDARD_MPEG2 :
-                            AP4_AAC_STANDARD_MPEG4);
-    switch (adts_header.m_ProfileObjectType) {
-        case 0:
-            frame.m_Info.m_Profile = AP4_AAC_PROFILE_MAIN;
-            break;
-
-        case 1:
-            frame.m_Info.m_Profile = AP4_AAC_PROFILE_LC;
-            break;
-
-        case 2: 
-            frame.m_Info.m_Profile = AP4_AAC_PROFILE_SSR;
-            break;
-
-        case 3:
-            frame.m_Info.m_Profile = AP4_AAC_PROFILE_LTP;
-    }
-    frame.m_Info.m_FrameLength = adts_header.m_FrameLength-AP4_ADTS_HEADER_SIZE;
-    frame.m_Info.m_ChannelConfiguration = adts_header.m_ChannelConfiguration;
-    frame.m_Info.m_SamplingFrequencyIndex = adts_header.m_SamplingFrequencyIndex;
-    frame.m_Info.m_SamplingFrequency = AP4_AdtsSamplingFrequencyTable[adts_header.m_SamplingFrequencyIndex];
+    GetFrameInfo(adts_header, frame.m_Info);
 
     /* skip crc if present */
     if (adts_header.m_ProtectionAbsent == 0) {
@@ -110,6 +110,32 @@ public:
     AP4_Size   GetBytesFree();
     AP4_Size   GetBytesAvailable();
 
+    // class methods
+    /**
+     * Find the next complete ADTS frame in a buffer owned by the caller,
+     * without copying it.
+     *
+     * @param frame_offset Offset of the frame in the buffer. When no frame
+     * is found, number of bytes at the start of the buffer that can be
+     * discarded.
+     * @param frame_size Size of the frame, including its header.
+     * @param frame_info Information about the frame. The raw frame data is
+     * the last m_FrameLength bytes of the frame (the header and CRC, if any,
+     * are not included).
+     * @param eos Boolean flag that indicates if this buffer is the last
+     * buffer in the stream/file (End Of Stream). Unless eos is true, a
+     * frame is only returned once the header of the next frame is available.
+     *
+     * @return AP4_SUCCESS if a frame was found, AP4_ERROR_NOT_ENOUGH_DATA if
+     * more data is needed.
+     */
+    static AP4_Result FindFrame(const AP4_UI08*   data,
+                                AP4_Size          data_size,
+                                AP4_Size&         frame_offset,
+                                AP4_Size&         frame_size,
+                                AP4_AacFrameInfo& frame_info,
+                                bool              eos=false);
+
 private:
     // methods
     AP4_Result FindHeader(AP4_UI08* header);
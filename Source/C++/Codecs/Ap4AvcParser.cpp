@@ -139,13 +139,15 @@ AP4_AvcFrameParser::AP4_AvcFrameParser() :
     m_NalRefIdc(0),
     m_SliceHeader(NULL),
     m_AccessUnitVclNalUnitCount(0),
+    m_AccessUnitIsIntra(false),
     m_TotalNalUnitCount(0),
     m_TotalAccessUnitCount(0),
     m_PrevFrameNum(0),
     m_PrevFrameNumOffset(0),
     m_PrevPicOrderCntMsb(0),
     m_PrevPicOrderCntLsb(0),
-    m_keepParameterSets(true)
+    m_keepParameterSets(true),
+    m_CopyNalUnitData(true)
 {
     for (unsigned int i=0; i<256; i++) {
         m_PPS[i] = NULL;
@@ -958,6 +960,7 @@ AP4_AvcFrameParser::CheckIfAccessUnitIsCompleted(AccessUnitInfo& access_unit_inf
     // emit the access unit (transfer ownership)
     access_unit_info.nal_units     = m_AccessUnitData;
     access_unit_info.is_idr        = (m_NalUnitType == AP4_AVC_NAL_UNIT_TYPE_CODED_SLICE_OF_IDR_PICTURE);
+    access_unit_info.is_intra      = m_AccessUnitIsIntra;
     access_unit_info.decode_order  = m_TotalAccessUnitCount;
     access_unit_info.display_order = pic_order_cnt;
     m_AccessUnitData.Clear();
@@ -978,7 +981,14 @@ AP4_AvcFrameParser::CheckIfAccessUnitIsCompleted(AccessUnitInfo& access_unit_inf
 void
 AP4_AvcFrameParser::AppendNalUnitData(const unsigned char* data, unsigned int data_size)
 {
-    m_AccessUnitData.Append(new AP4_DataBuffer(data, data_size));
+    if (m_CopyNalUnitData) {
+        m_AccessUnitData.Append(new AP4_DataBuffer(data, data_size));
+    } else {
+        AP4_DataBuffer* nal_unit = new AP4_DataBuffer();
+        nal_unit->SetBuffer(const_cast<AP4_Byte*>(data), data_size);
+        nal_unit->SetDataSize(data_size);
+        m_AccessUnitData.Append(nal_unit);
+    }
 }
 
 /*----------------------------------------------------------------------
@@ -1077,6 +1087,15 @@ AP4_AvcFrameParser::Feed(const AP4_UI08* nal_unit,
                 }
             }
 
+            // keep track of whether all the slices of the access unit are intra slices
+            unsigned int slice_type = slice_header->slice_type % 5;
+            bool is_intra_slice = (slice_type == AP4_AVC_SLICE_TYPE_I || slice_type == AP4_AVC_SLICE_TYPE_SI);
+            if (m_AccessUnitVclNalUnitCount == 1) {
+                m_AccessUnitIsIntra = is_intra_slice;
+            } else {
+                m_AccessUnitIsIntra = m_AccessUnitIsIntra && is_intra_slice;
+            }
+
             // buffer this NAL unit
             AppendNalUnitData(nal_unit, nal_unit_size);
             delete m_SliceHeader;
@@ -1151,6 +1170,7 @@ AP4_AvcFrameParser::AccessUnitInfo::Reset()
     }
     nal_units.Clear();
     is_idr = false;
+    is_intra = false;
     decode_order = 0;
     display_order = 0;
 }
@@ -225,6 +225,7 @@ public:
     struct AccessUnitInfo {
         AP4_Array<AP4_DataBuffer*> nal_units;
         bool                       is_idr;
+        bool                       is_intra; // all the slices are I or SI slices
         AP4_UI32                   decode_order;
         AP4_UI32                   display_order;
         
@@ -295,6 +296,14 @@ public:
 
     void SetParameterControl(bool isKeep) { m_keepParameterSets = isKeep; }
 
+    /**
+     * Control whether the NAL unit data of the access units is copied (the
+     * default) or not. When it is not copied, the buffers returned in
+     * AccessUnitInfo::nal_units point to the memory passed to the NAL unit
+     * Feed() method, which must remain valid until the access unit is freed.
+     */
+    void SetCopyNalUnitData(bool copy) { m_CopyNalUnitData = copy; }
+
 private:
     // methods
     bool SameFrame(unsigned int nal_unit_type_1, unsigned int nal_ref_idc_1, AP4_AvcSliceHeader& sh1,
@@ -313,6 +322,7 @@ private:
     unsigned int                 m_NalRefIdc;
     AP4_AvcSliceHeader*          m_SliceHeader;
     unsigned int                 m_AccessUnitVclNalUnitCount;
+    bool                         m_AccessUnitIsIntra;
     
     // accumulator for NAL unit data
     unsigned int                 m_TotalNalUnitCount;
@@ -327,6 +337,9 @@ private:
 
     // control if the parameter sets(SPS, PPS) need to be stored in stream('mdat')
     bool                       m_keepParameterSets;
+
+    // when false, the access units point to the NAL unit data that was fed
+    bool                       m_CopyNalUnitData;
 };
 
 #endif // _AP4_AVC_PARSER_H_
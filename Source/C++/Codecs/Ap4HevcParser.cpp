@@ -1106,7 +1106,8 @@ AP4_HevcFrameParser::AP4_HevcFrameParser() :
     m_VclNalUnitsInAccessUnit(0),
     m_PrevTid0Pic_PicOrderCntMsb(0),
     m_PrevTid0Pic_PicOrderCntLsb(0),
-    m_keepParameterSets(true)
+    m_keepParameterSets(true),
+    m_CopyNalUnitData(true)
 {
     for (unsigned int i=0; i<=AP4_HEVC_PPS_MAX_ID; i++) {
         m_PPS[i] = NULL;
@@ -1148,7 +1149,14 @@ AP4_HevcFrameParser::~AP4_HevcFrameParser()
 void
 AP4_HevcFrameParser::AppendNalUnitData(const unsigned char* data, unsigned int data_size)
 {
-    m_AccessUnitData.Append(new AP4_DataBuffer(data, data_size));
+    if (m_CopyNalUnitData) {
+        m_AccessUnitData.Append(new AP4_DataBuffer(data, data_size));
+    } else {
+        AP4_DataBuffer* nal_unit = new AP4_DataBuffer();
+        nal_unit->SetBuffer(const_cast<AP4_Byte*>(data), data_size);
+        nal_unit->SetDataSize(data_size);
+        m_AccessUnitData.Append(nal_unit);
+    }
 }
 
 /*----------------------------------------------------------------------
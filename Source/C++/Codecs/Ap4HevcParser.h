@@ -472,6 +472,14 @@ public:
     AP4_HevcPictureParameterSet**  GetPictureParameterSets()  { return &m_PPS[0]; }
 
     void SetParameterControl(bool isKeep) { m_keepParameterSets = isKeep; }
+
+    /**
+     * Control whether the NAL unit data of the access units is copied (the
+     * default) or not. When it is not copied, the buffers returned in
+     * AccessUnitInfo::nal_units point to the memory passed to the NAL unit
+     * Feed() method, which must remain valid until the access unit is freed.
+     */
+    void SetCopyNalUnitData(bool copy) { m_CopyNalUnitData = copy; }
     
 private:
     // methods
@@ -500,6 +508,9 @@ private:
 
     // control if the parameter sets(VPS, SPS, PPS) need to be stored in stream('mdat')
     bool                       m_keepParameterSets;
+
+    // when false, the access units point to the NAL unit data that was fed
+    bool                       m_CopyNalUnitData;
 };
 
 #endif // _AP4_HEVC_PARSER_H_
@@ -41,32 +41,231 @@ AP4_NalParser::AP4_NalParser() :
 {
 }
 
+/*----------------------------------------------------------------------
+|   SIMD scanning
+|
+|   Start codes (00 00 01) and emulation prevention bytes (00 00 03) are
+|   both a pair of zero bytes followed by a marker byte. The kernels below
+|   look for that pattern 16 (SSE2, NEON) or 32 (AVX2) positions at a time
+|   by comparing three overlapping loads, and fall back to a scalar scan
+|   for the tail of the buffer.
++---------------------------------------------------------------------*/
+#if !defined(AP4_CONFIG_NO_SIMD)
+#if (defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))) || \
+    (defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+#define AP4_NAL_SCAN_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define AP4_NAL_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || (defined(__ARM_NEON) && defined(__arm__))
+#define AP4_NAL_SCAN_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/*----------------------------------------------------------------------
+|   FindMarkerScalar
++---------------------------------------------------------------------*/
+static AP4_Size
+FindMarkerScalar(const AP4_UI08* data, AP4_Size data_size, AP4_Size offset, AP4_UI08 marker)
+{
+    // skip ahead by as many bytes as the byte at offset+2 allows
+    while (offset+3 <= data_size) {
+        AP4_UI08 third = data[offset+2];
+        if (third != 0 && third != marker) {
+            offset += 3;
+        } else if (data[offset+1] != 0) {
+            offset += 2;
+        } else if (data[offset] != 0 || third != marker) {
+            offset += 1;
+        } else {
+            return offset;
+        }
+    }
+    return data_size;
+}
+
+#if defined(AP4_NAL_SCAN_AVX2)
+/*----------------------------------------------------------------------
+|   FindMarkerAvx2
++---------------------------------------------------------------------*/
+__attribute__((target("avx2"))) static AP4_Size
+FindMarkerAvx2(const AP4_UI08* data, AP4_Size data_size, AP4_Size offset, AP4_UI08 marker)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mark = _mm256_set1_epi8((char)marker);
+    while (offset+32+2 <= data_size) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(data+offset));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(data+offset+1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*)(data+offset+2));
+        __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                        _mm256_cmpeq_epi8(b1, zero)),
+                                       _mm256_cmpeq_epi8(b2, mark));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask) return offset+__builtin_ctz(mask);
+        offset += 32;
+    }
+    return FindMarkerScalar(data, data_size, offset, marker);
+}
+
+/*----------------------------------------------------------------------
+|   HaveAvx2
++---------------------------------------------------------------------*/
+static bool
+HaveAvx2()
+{
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    return have_avx2;
+}
+#endif
+
+/*----------------------------------------------------------------------
+|   FindMarker
+|
+|   Returns the offset of the first 00 00 <marker> sequence in the buffer,
+|   or data_size if there is none.
++---------------------------------------------------------------------*/
+static AP4_Size
+FindMarker(const AP4_UI08* data, AP4_Size data_size, AP4_UI08 marker)
+{
+    AP4_Size offset = 0;
+#if defined(AP4_NAL_SCAN_AVX2)
+    if (data_size >= 64 && HaveAvx2()) {
+        return FindMarkerAvx2(data, data_size, offset, marker);
+    }
+#endif
+#if defined(AP4_NAL_SCAN_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mark = _mm_set1_epi8((char)marker);
+    while (offset+16+2 <= data_size) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(data+offset));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(data+offset+1));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(data+offset+2));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+                                                  _mm_cmpeq_epi8(b1, zero)),
+                                    _mm_cmpeq_epi8(b2, mark));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            for (unsigned int i=0; ; i++) {
+                if (mask & (1<<i)) return offset+i;
+            }
+        }
+        offset += 16;
+    }
+#elif defined(AP4_NAL_SCAN_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t mark = vdupq_n_u8(marker);
+    while (offset+16+2 <= data_size) {
+        uint8x16_t b0 = vld1q_u8(data+offset);
+        uint8x16_t b1 = vld1q_u8(data+offset+1);
+        uint8x16_t b2 = vld1q_u8(data+offset+2);
+        uint8x16_t hit = vandq_u8(vandq_u8(vceqq_u8(b0, zero), vceqq_u8(b1, zero)), vceqq_u8(b2, mark));
+        // narrow the 16 byte mask to 4 bits per lane
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) {
+            for (unsigned int i=0; ; i++) {
+                if (mask & ((uint64_t)0xF<<(4*i))) return offset+i;
+            }
+        }
+        offset += 16;
+    }
+#endif
+    return FindMarkerScalar(data, data_size, offset, marker);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_NalParser::FindStartCode
++---------------------------------------------------------------------*/
+AP4_Size
+AP4_NalParser::FindStartCode(const AP4_UI08* data, AP4_Size data_size)
+{
+    return FindMarker(data, data_size, 1);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_NalParser::FindNalUnits
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_NalParser::FindNalUnits(const AP4_UI08*              data,
+                            AP4_Size                     data_size,
+                            AP4_Array<AP4_NalUnitRange>& nal_units,
+                            AP4_Size&                    bytes_consumed,
+                            bool                         eos)
+{
+    AP4_Size start_code = FindStartCode(data, data_size);
+    if (start_code == data_size) {
+        // keep the last bytes, they may be the beginning of a start code
+        if (eos) {
+            bytes_consumed = data_size;
+        } else {
+            bytes_consumed = data_size > 2 ? data_size-2 : 0;
+        }
+        return AP4_SUCCESS;
+    }
+
+    for (;;) {
+        AP4_Size nalu_start = start_code+3;
+        AP4_Size next_start_code = nalu_start+FindStartCode(data+nalu_start, data_size-nalu_start);
+        if (next_start_code == data_size) {
+            // the last NAL unit is only complete at the end of the stream
+            if (eos) {
+                if (data_size > nalu_start) {
+                    AP4_NalUnitRange nal_unit = { nalu_start, data_size-nalu_start };
+                    AP4_Result result = nal_units.Append(nal_unit);
+                    if (AP4_FAILED(result)) return result;
+                }
+                bytes_consumed = data_size;
+            } else {
+                bytes_consumed = start_code;
+            }
+            return AP4_SUCCESS;
+        }
+
+        // a zero byte just before the start code belongs to a 4-byte start code
+        AP4_Size nalu_end = next_start_code;
+        if (nalu_end > nalu_start && data[nalu_end-1] == 0) --nalu_end;
+        AP4_NalUnitRange nal_unit = { nalu_start, nalu_end-nalu_start };
+        AP4_Result result = nal_units.Append(nal_unit);
+        if (AP4_FAILED(result)) return result;
+        start_code = next_start_code;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_NalParser::Unescape
 +---------------------------------------------------------------------*/
 void
 AP4_NalParser::Unescape(AP4_DataBuffer &data)
 {
-    unsigned int zero_count = 0;
-    unsigned int bytes_removed = 0;
-    AP4_UI08* out      = data.UseData();
-    const AP4_UI08* in = data.GetData();
-    AP4_Size  in_size  = data.GetDataSize();
+    AP4_UI08* buffer    = data.UseData();
+    AP4_Size  in_size   = data.GetDataSize();
+    AP4_Size  out_size  = 0;
+    AP4_Size  copied    = 0; // input bytes already moved to the output
+    AP4_Size  run_start = 0; // where zero bytes started being counted
+    AP4_Size  search    = 0;
     
-    for (unsigned int i=0; i<in_size; i++) {
-        if (zero_count == 2 && in[i] == 3 && i+1 < in_size && in[i+1] <= 3) {
-            ++bytes_removed;
-            zero_count = 0;
-        } else {
-            out[i-bytes_removed] = in[i];
-            if (in[i] == 0) {
-                ++zero_count;
-            } else {
-                zero_count = 0;
+    while (search < in_size) {
+        AP4_Size escape = search+FindMarker(buffer+search, in_size-search, 3);
+        if (escape >= in_size) break;
+
+        // the 03 byte is only an emulation prevention byte if it follows
+        // exactly two zero bytes and is followed by a byte <= 3
+        AP4_Size epb = escape+2;
+        search = epb+1;
+        if (epb+1 < in_size && buffer[epb+1] <= 3 &&
+            (escape == run_start || buffer[escape-1] != 0)) {
+            if (out_size != copied) {
+                memmove(buffer+out_size, buffer+copied, epb-copied);
             }
+            out_size += epb-copied;
+            copied = run_start = epb+1;
         }
     }
-    data.SetDataSize(in_size-bytes_removed);
+    if (copied == 0) return;
+    memmove(buffer+out_size, buffer+copied, in_size-copied);
+    data.SetDataSize(out_size+(in_size-copied));
 }
 
 /*----------------------------------------------------------------------
@@ -77,9 +276,10 @@ AP4_NalParser::CountEmulationPreventionBytes(const AP4_UI08* data,
                                              unsigned int    data_size,
                                              unsigned int    unescaped_size)
 {
-    unsigned int zero_count = 0;
     unsigned int bytes_produced = 0;
     unsigned int emulation_prevention_bytes = 0;
+    unsigned int run_start = 0;
+    unsigned int search = 0;
     
     // shortcut
     if (data_size <= 2) {
@@ -87,19 +287,21 @@ AP4_NalParser::CountEmulationPreventionBytes(const AP4_UI08* data,
         return 0;
     }
     
-    for (unsigned int i=0; i<data_size; i++) {
-        if (zero_count == 2 && data[i] == 3 && i+1 < data_size && data[i+1] <= 3) {
-            ++emulation_prevention_bytes;
-            zero_count = 0;
-        } else {
-            if (++bytes_produced >= unescaped_size) {
+    while (search < data_size) {
+        unsigned int escape = search+FindMarker(data+search, data_size-search, 3);
+        if (escape >= data_size) break;
+
+        unsigned int epb = escape+2;
+        search = epb+1;
+        if (epb+1 < data_size && data[epb+1] <= 3 &&
+            (escape == run_start || data[escape-1] != 0)) {
+            // stop if the bytes before this one already produce enough
+            if (bytes_produced+(epb-run_start) >= unescaped_size) {
                 break;
             }
-            if (data[i] == 0) {
-                ++zero_count;
-            } else {
-                zero_count = 0;
-            }
+            bytes_produced += epb-run_start;
+            run_start = epb+1;
+            ++emulation_prevention_bytes;
         }
     }
     return emulation_prevention_bytes;
@@ -125,6 +327,28 @@ AP4_NalParser::Feed(const void*            data,
     unsigned int payload_end  = 0;
     bool         found_nalu = false;
     for (data_offset=0; data_offset<data_size && !found_nalu; data_offset++) {
+        if (m_State == STATE_IN_NALU && m_ZeroTrail == 0) {
+            // fast path: jump to the next start code, if any
+            const AP4_UI08* bytes = (const AP4_UI08*)data;
+            AP4_Size start_code = data_offset+FindStartCode(bytes+data_offset, data_size-data_offset);
+            AP4_Size zero_end;
+            if (start_code < data_size) {
+                zero_end      = start_code+2;
+                payload_end   = zero_end;
+                data_offset   = zero_end; // the 01 byte is consumed by the loop
+                found_nalu    = true;
+                m_State       = STATE_START_NALU;
+            } else {
+                zero_end      = data_size;
+                payload_end   = data_size;
+                data_offset   = data_size-1;
+            }
+            // count the zeros that may be part of the next start code
+            for (AP4_Size i=zero_end; i > payload_start && bytes[i-1] == 0; i--) {
+                ++m_ZeroTrail;
+            }
+            continue;
+        }
         unsigned char byte = ((const unsigned char*)data)[data_offset];
         switch (m_State) {
             case STATE_RESET:
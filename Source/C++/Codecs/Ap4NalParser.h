@@ -35,6 +35,18 @@
 #include "Ap4Types.h"
 #include "Ap4Results.h"
 #include "Ap4DataBuffer.h"
+#include "Ap4Array.h"
+
+/*----------------------------------------------------------------------
+|   AP4_NalUnitRange
++---------------------------------------------------------------------*/
+/**
+ * Location of a NAL unit inside a buffer owned by the caller.
+ */
+struct AP4_NalUnitRange {
+    AP4_Size m_Offset; // offset of the first byte after the start code
+    AP4_Size m_Size;   // size of the NAL unit, without the next start code
+};
 
 /*----------------------------------------------------------------------
 |   AP4_NalParser
@@ -55,6 +67,36 @@ public:
     static unsigned int CountEmulationPreventionBytes(const AP4_UI08* data,
                                                       unsigned int    data_size,
                                                       unsigned int    unescaped_size);
+
+    /**
+     * Find the first 00 00 01 start code in a buffer.
+     *
+     * @return The offset of the first zero byte of the start code, or
+     * data_size if the buffer does not contain a start code.
+     */
+    static AP4_Size FindStartCode(const AP4_UI08* data, AP4_Size data_size);
+
+    /**
+     * Find the NAL units of an Annex B byte stream without copying them.
+     *
+     * The NAL units are reported as offsets into the caller's buffer,
+     * with the same boundaries as the ones returned by Feed().
+     *
+     * @param data Pointer to the memory buffer with the data to scan.
+     * @param data_size Size in bytes of the buffer pointed to by the
+     * data pointer.
+     * @param nal_units Array to which the complete NAL units are appended.
+     * @param bytes_consumed Number of bytes of the buffer that the caller
+     * can discard. Unless eos is true, the last NAL unit of the buffer is
+     * not reported, and the next buffer should start with its start code.
+     * @param eos Boolean flag that indicates if this buffer is the last
+     * buffer in the stream/file (End Of Stream).
+     */
+    static AP4_Result FindNalUnits(const AP4_UI08*              data,
+                                   AP4_Size                     data_size,
+                                   AP4_Array<AP4_NalUnitRange>& nal_units,
+                                   AP4_Size&                    bytes_consumed,
+                                   bool                         eos=false);
     
     // constructor
     AP4_NalParser();
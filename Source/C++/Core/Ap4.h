@@ -232,6 +232,7 @@
 #include "Ap4Utils.h"
 #include "Ap4DynamicCast.h"
 #include "Ap4FileByteStream.h"
+#include "Ap4BufferedOutputStream.h"
 #include "Ap4Movie.h"
 #include "Ap4Track.h"
 #include "Ap4File.h"
@@ -239,8 +240,11 @@
 #include "Ap4FileCopier.h"
 #include "Ap4HintTrackReader.h"
 #include "Ap4Processor.h"
+#include "Ap4ThreadPool.h"
+#include "Ap4Arena.h"
 #include "Ap4MetaData.h"
 #include "Ap4AtomFactory.h"
+#include "Ap4BoxScanner.h"
 #include "Ap4SampleEntry.h"
 #include "Ap4Sample.h"
 #include "Ap4DataBuffer.h"
@@ -316,6 +320,7 @@
 #include "Ap4Dec3Atom.h"
 #include "Ap4Dac4Atom.h"
 #include "Ap4SidxAtom.h"
+#include "Ap4EmsgAtom.h"
 #include "Ap4AdtsParser.h"
 #include "Ap4Ac4Parser.h"
 #include "Ap4AvcParser.h"
@@ -0,0 +1,199 @@
+/*****************************************************************
+|
+|    AP4 - Arena Allocator
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Arena.h"
+
+#include <new>
+
+/*----------------------------------------------------------------------
+|   globals
++---------------------------------------------------------------------*/
+static thread_local AP4_Arena* AP4_CurrentArena = NULL;
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaAlign
++---------------------------------------------------------------------*/
+static inline size_t
+AP4_ArenaAlign(size_t size)
+{
+    return (size+AP4_ARENA_ALIGNMENT-1)&~(size_t)(AP4_ARENA_ALIGNMENT-1);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::AP4_Arena
++---------------------------------------------------------------------*/
+AP4_Arena::AP4_Arena(AP4_Size block_size) :
+    m_BlockSize(AP4_ArenaAlign(block_size ? block_size : AP4_ARENA_DEFAULT_BLOCK_SIZE)),
+    m_Blocks(NULL),
+    m_Current(NULL),
+    m_Cursor(NULL),
+    m_Limit(NULL),
+    m_LargeBlocks(NULL)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::~AP4_Arena
++---------------------------------------------------------------------*/
+AP4_Arena::~AP4_Arena()
+{
+    Reset();
+    while (m_Blocks) {
+        Block* next = m_Blocks->m_Next;
+        ::operator delete((void*)m_Blocks);
+        m_Blocks = next;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::CreateBlock
++---------------------------------------------------------------------*/
+AP4_Arena::Block*
+AP4_Arena::CreateBlock(size_t size)
+{
+    Block* block = (Block*)::operator new(AP4_ArenaAlign(sizeof(Block))+size);
+    block->m_Next = NULL;
+    block->m_Size = size;
+    return block;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::GetBlockData
++---------------------------------------------------------------------*/
+AP4_UI08*
+AP4_Arena::GetBlockData(Block* block)
+{
+    return (AP4_UI08*)block+AP4_ArenaAlign(sizeof(Block));
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Allocate
++---------------------------------------------------------------------*/
+void*
+AP4_Arena::Allocate(size_t size)
+{
+    size = AP4_ArenaAlign(size ? size : 1);
+
+    // large allocations get their own block
+    if (size > m_BlockSize/4) {
+        Block* block = CreateBlock(size);
+        block->m_Next = m_LargeBlocks;
+        m_LargeBlocks = block;
+        return GetBlockData(block);
+    }
+
+    // move on to the next block if this one is full
+    if (m_Cursor == NULL || size > (size_t)(m_Limit-m_Cursor)) {
+        Block* next = m_Current ? m_Current->m_Next : m_Blocks;
+        if (next == NULL) {
+            next = CreateBlock(m_BlockSize);
+            if (m_Current) {
+                m_Current->m_Next = next;
+            } else {
+                m_Blocks = next;
+            }
+        }
+        m_Current = next;
+        m_Cursor  = GetBlockData(next);
+        m_Limit   = m_Cursor+next->m_Size;
+    }
+
+    void* memory = m_Cursor;
+    m_Cursor += size;
+    return memory;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Reset
++---------------------------------------------------------------------*/
+void
+AP4_Arena::Reset()
+{
+    while (m_LargeBlocks) {
+        Block* next = m_LargeBlocks->m_Next;
+        ::operator delete((void*)m_LargeBlocks);
+        m_LargeBlocks = next;
+    }
+    m_Current = NULL;
+    m_Cursor  = NULL;
+    m_Limit   = NULL;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaScope::AP4_ArenaScope
++---------------------------------------------------------------------*/
+AP4_ArenaScope::AP4_ArenaScope(AP4_Arena* arena) :
+    m_Previous(AP4_CurrentArena)
+{
+    AP4_CurrentArena = arena;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaScope::~AP4_ArenaScope
++---------------------------------------------------------------------*/
+AP4_ArenaScope::~AP4_ArenaScope()
+{
+    AP4_CurrentArena = m_Previous;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaScope::GetCurrent
++---------------------------------------------------------------------*/
+AP4_Arena*
+AP4_ArenaScope::GetCurrent()
+{
+    return AP4_CurrentArena;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaObject::operator new
++---------------------------------------------------------------------*/
+void*
+AP4_ArenaObject::operator new(size_t size)
+{
+    // each object is preceded by a header that records where it came from
+    AP4_Arena* arena  = AP4_CurrentArena;
+    size_t     header = AP4_ArenaAlign(sizeof(AP4_Arena*));
+    void*      memory = arena ? arena->Allocate(header+size) : ::operator new(header+size);
+    *(AP4_Arena**)memory = arena;
+    return (AP4_UI08*)memory+header;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaObject::operator delete
++---------------------------------------------------------------------*/
+void
+AP4_ArenaObject::operator delete(void* object)
+{
+    if (object == NULL) return;
+    void* memory = (AP4_UI08*)object-AP4_ArenaAlign(sizeof(AP4_Arena*));
+    if (*(AP4_Arena**)memory == NULL) ::operator delete(memory);
+}
@@ -0,0 +1,129 @@
+/*****************************************************************
+|
+|    AP4 - Arena Allocator
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_ARENA_H_
+#define _AP4_ARENA_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+
+#include <stddef.h>
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_ARENA_DEFAULT_BLOCK_SIZE = 64*1024;
+const AP4_Size AP4_ARENA_ALIGNMENT          = 16;
+
+/*----------------------------------------------------------------------
+|   AP4_Arena
++---------------------------------------------------------------------*/
+/**
+ * Monotonic allocator for atom trees and their tables.
+ * Arenas are opt-in: atoms (and the entries of the lists that hold them)
+ * created by an AP4_AtomFactory that has an arena, as well as the tables of
+ * those atoms and any AP4_Array constructed with an arena, take their
+ * storage from it. Everything else uses the heap.
+ * Deleting an object that uses an arena still runs its destructor, but the
+ * memory is only reclaimed, all at once, when the arena is reset or
+ * destroyed. Everything allocated from an arena must therefore be destroyed
+ * before the arena is reset or destroyed, which is easiest to guarantee with
+ * one arena per file or per fragment.
+ * An arena may only be used by one thread at a time.
+ */
+class AP4_Arena
+{
+public:
+    // methods
+    AP4_Arena(AP4_Size block_size = AP4_ARENA_DEFAULT_BLOCK_SIZE);
+    ~AP4_Arena();
+    void* Allocate(size_t size);
+
+    /**
+     * Make all the memory allocated so far available again. The blocks
+     * are kept, so an arena that is reset for every fragment stops
+     * allocating from the heap once it has grown to the fragment size.
+     */
+    void Reset();
+
+private:
+    // types
+    struct Block {
+        Block*   m_Next;
+        size_t   m_Size;
+    };
+
+    // methods
+    Block*    CreateBlock(size_t size);
+    AP4_UI08* GetBlockData(Block* block);
+
+    // members
+    AP4_Size  m_BlockSize;
+    Block*    m_Blocks;      // regular blocks, in use order
+    Block*    m_Current;
+    AP4_UI08* m_Cursor;
+    AP4_UI08* m_Limit;
+    Block*    m_LargeBlocks; // dedicated blocks for large allocations
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaScope
++---------------------------------------------------------------------*/
+/**
+ * Make an arena the current arena of the calling thread while the scope
+ * is alive. Scopes may be nested, and a NULL arena selects the heap.
+ */
+class AP4_ArenaScope
+{
+public:
+    explicit AP4_ArenaScope(AP4_Arena* arena);
+    ~AP4_ArenaScope();
+    static AP4_Arena* GetCurrent();
+
+private:
+    AP4_Arena* m_Previous;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ArenaObject
++---------------------------------------------------------------------*/
+/**
+ * Base class for objects that are allocated from the current arena of the
+ * calling thread (see AP4_ArenaScope), or from the heap if there is none.
+ * Deleting an object allocated from an arena only runs its destructor.
+ */
+class AP4_ArenaObject
+{
+public:
+    static void* operator new(size_t size);
+    static void  operator delete(void* object);
+};
+
+#endif // _AP4_ARENA_H_
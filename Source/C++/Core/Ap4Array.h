@@ -42,6 +42,7 @@
 #endif
 #include "Ap4Types.h"
 #include "Ap4Results.h"
+#include "Ap4Arena.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -56,7 +57,12 @@ class AP4_Array
 {
 public:
     // methods
-             AP4_Array(): m_AllocatedCount(0), m_ItemCount(0), m_Items(0) {}
+             AP4_Array(): m_AllocatedCount(0), m_ItemCount(0), m_Items(0), m_Arena(0) {}
+    /**
+     * Create an empty array whose storage is allocated from an arena
+     * (see AP4_Arena). The arena must outlive the array.
+     */
+    explicit AP4_Array(AP4_Arena* arena): m_AllocatedCount(0), m_ItemCount(0), m_Items(0), m_Arena(arena) {}
              AP4_Array(const T* items, AP4_Size count);
     AP4_Array(const AP4_Array<T>& copy);
     AP4_Array& operator=(const AP4_Array& copy);
@@ -75,6 +81,7 @@ protected:
     AP4_Cardinal m_AllocatedCount;
     AP4_Cardinal m_ItemCount;
     T*           m_Items;
+    AP4_Arena*   m_Arena;
 };
 
 /*----------------------------------------------------------------------
@@ -84,7 +91,8 @@ template <typename T>
 AP4_Array<T>::AP4_Array(const T* items, AP4_Size count) :
     m_AllocatedCount(count),
     m_ItemCount(count),
-    m_Items((T*)::operator new(count*sizeof(T)))
+    m_Items((T*)::operator new(count*sizeof(T))),
+    m_Arena(0)
 {
     for (unsigned int i=0; i<count; i++) {
         new ((void*)&m_Items[i]) T(items[i]);
@@ -99,7 +107,8 @@ inline
 AP4_Array<T>::AP4_Array(const AP4_Array<T>& copy) :
     m_AllocatedCount(0),
     m_ItemCount(0),
-    m_Items(0)
+    m_Items(0),
+    m_Arena(0)
 {
     EnsureCapacity(copy.ItemCount());
     for (unsigned int i=0; i<copy.m_ItemCount; i++) {
@@ -115,7 +124,7 @@ template <typename T>
 AP4_Array<T>::~AP4_Array()
 {
     Clear();
-    ::operator delete((void*)m_Items);
+    if (m_Arena == NULL) ::operator delete((void*)m_Items);
 }
 
 /*----------------------------------------------------------------------
@@ -169,7 +178,7 @@ AP4_Array<T>::EnsureCapacity(AP4_Cardinal count)
     if (count <= m_AllocatedCount) return AP4_SUCCESS;
 
     // (re)allocate the items
-    T* new_items = (T*) ::operator new (count*sizeof(T));
+    T* new_items = (T*)(m_Arena ? m_Arena->Allocate(count*sizeof(T)) : ::operator new(count*sizeof(T)));
     if (new_items == NULL) {
         return AP4_ERROR_OUT_OF_MEMORY;
     }
@@ -178,7 +187,7 @@ AP4_Array<T>::EnsureCapacity(AP4_Cardinal count)
             new ((void*)&new_items[i]) T(m_Items[i]);
             m_Items[i].~T();
         }
-        ::operator delete((void*)m_Items);
+        if (m_Arena == NULL) ::operator delete((void*)m_Items);
     }
     m_Items = new_items;
     m_AllocatedCount = count;
@@ -259,6 +268,42 @@ AP4_Array<T>::Append(const T& item)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_FindRange
++---------------------------------------------------------------------*/
+/**
+ * Find the range that contains a value, given the boundaries of
+ * range_count consecutive ranges: range i is [starts[i], starts[i+1]),
+ * so starts has range_count+1 non-decreasing items, and the value must
+ * be in [starts[0], starts[range_count]).
+ * The hint range and the one that follows it are checked first, so that
+ * sequential lookups are O(1). Other lookups are a binary search.
+ * Empty ranges are never returned.
+ */
+template <typename T>
+AP4_Ordinal
+AP4_FindRange(const AP4_Array<T>& starts, 
+              AP4_Cardinal        range_count, 
+              T                   value, 
+              AP4_Ordinal         hint)
+{
+    if (hint < range_count && value >= starts[hint]) {
+        if (value < starts[hint+1]) return hint;
+        if (hint+1 < range_count && value < starts[hint+2]) return hint+1;
+    }
+    AP4_Ordinal low  = 0;
+    AP4_Ordinal high = range_count;
+    while (high-low > 1) {
+        AP4_Ordinal middle = low+(high-low)/2;
+        if (starts[middle] <= value) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
 #endif // _AP4_ARRAY_H_
 
 
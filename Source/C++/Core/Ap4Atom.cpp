@@ -440,6 +440,39 @@ AP4_UnknownAtom::Clone()
     return new AP4_UnknownAtom(*this);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_DeferredPayload::Attach
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_DeferredPayload::Attach(std::shared_ptr<AP4_ByteStream> stream, AP4_Size size)
+{
+    AP4_Result result = stream->Tell(m_Position);
+    if (AP4_FAILED(result)) return result;
+    m_Stream = std::move(stream);
+    m_Size   = size;
+    m_Pending.store(true, std::memory_order_release);
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DeferredPayload::Load
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_DeferredPayload::Load(AP4_UI08* buffer)
+{
+    if (m_Stream == nullptr) return AP4_ERROR_INVALID_STATE;
+
+    // read the payload from the stored offset, leaving the stream
+    // position alone
+    AP4_Result result = m_Stream->ReadAt(m_Position, buffer, m_Size);
+
+    // the payload is only ever loaded once
+    m_Stream.reset();
+
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_NullTerminatedStringAtom::AP4_NullTerminatedStringAtom
 +---------------------------------------------------------------------*/
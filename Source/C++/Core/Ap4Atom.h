@@ -46,6 +46,10 @@
 #include "Ap4Debug.h"
 #include "Ap4DynamicCast.h"
 #include "Ap4Array.h"
+#include "Ap4Arena.h"
+
+#include <atomic>
+#include <mutex>
 
 /*----------------------------------------------------------------------
 |   macros
@@ -258,7 +262,7 @@ private:
 /**
  * Abstract base class for all atom types.
  */
-class AP4_Atom {
+class AP4_Atom : public AP4_ArenaObject {
 public:
      AP4_IMPLEMENT_DYNAMIC_CAST(AP4_Atom)
 
@@ -422,6 +426,63 @@ private:
     AP4_DataBuffer  m_Payload;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_DeferredPayload
++---------------------------------------------------------------------*/
+/**
+ * Helper used by table atoms whose entries are decoded on first access
+ * rather than when the atom is parsed.
+ * Instances keep a reference to the source stream and the position of
+ * the not-yet-decoded bytes until Load() is called.
+ * Decoding goes through Resolve(), so that concurrent readers of the
+ * same atom decode the entries exactly once, and all see its result.
+ */
+class AP4_DeferredPayload {
+public:
+    // constructor
+    AP4_DeferredPayload() : m_Position(0), m_Size(0), m_Pending(false), m_Result(AP4_SUCCESS) {}
+
+    // methods
+    /**
+     * Record the current position of the stream as the start of a
+     * payload of the given size. The stream position is not changed.
+     */
+    AP4_Result Attach(std::shared_ptr<AP4_ByteStream> stream, AP4_Size size);
+    /**
+     * Read the payload into the buffer (which must be able to hold
+     * GetSize() bytes) and release the reference to the source stream.
+     * The position of the source stream is preserved.
+     */
+    AP4_Result Load(AP4_UI08* buffer);
+    /**
+     * Call decode(), which is expected to call Load(), if the payload is
+     * still pending. Concurrent callers block until the first one is done,
+     * so the decoded entries are complete when Resolve returns.
+     * @return The result of decode(), on this call and all later ones.
+     */
+    template <typename DECODE>
+    AP4_Result Resolve(DECODE decode) {
+        if (!m_Pending.load(std::memory_order_acquire)) return m_Result.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (!m_Pending.load(std::memory_order_relaxed)) return m_Result.load(std::memory_order_relaxed);
+        AP4_Result result = decode();
+        m_Result.store(result, std::memory_order_relaxed);
+        m_Pending.store(false, std::memory_order_release);
+        return result;
+    }
+    bool       IsPending() const { return m_Pending.load(std::memory_order_acquire); }
+    AP4_Size   GetSize() const   { return m_Size; }
+
+private:
+    // members
+    std::shared_ptr<AP4_ByteStream> m_Stream;
+    AP4_Position                    m_Position;
+    AP4_Size                        m_Size;
+    std::atomic<bool>               m_Pending;
+    std::atomic<AP4_Result>         m_Result;
+    std::mutex                      m_Lock;
+};
+
 /*----------------------------------------------------------------------
 |   AP4_NullTerminatedStringAtom
 +---------------------------------------------------------------------*/
@@ -590,7 +651,9 @@ const AP4_Atom::Type AP4_ATOM_TYPE_DAC3 = AP4_ATOM_TYPE('d','a','c','3');
 const AP4_Atom::Type AP4_ATOM_TYPE_DEC3 = AP4_ATOM_TYPE('d','e','c','3');
 const AP4_Atom::Type AP4_ATOM_TYPE_DAC4 = AP4_ATOM_TYPE('d','a','c','4');
 const AP4_Atom::Type AP4_ATOM_TYPE_SIDX = AP4_ATOM_TYPE('s','i','d','x');
+const AP4_Atom::Type AP4_ATOM_TYPE_EMSG = AP4_ATOM_TYPE('e','m','s','g');
 const AP4_Atom::Type AP4_ATOM_TYPE_SSIX = AP4_ATOM_TYPE('s','s','i','x');
+const AP4_Atom::Type AP4_ATOM_TYPE_STYP = AP4_ATOM_TYPE('s','t','y','p');
 const AP4_Atom::Type AP4_ATOM_TYPE_SBGP = AP4_ATOM_TYPE('s','b','g','p');
 const AP4_Atom::Type AP4_ATOM_TYPE_SGPD = AP4_ATOM_TYPE('s','g','p','d');
 
@@ -108,6 +108,7 @@
 #include "Ap4Dec3Atom.h"
 #include "Ap4Dac4Atom.h"
 #include "Ap4SidxAtom.h"
+#include "Ap4EmsgAtom.h"
 #include "Ap4SbgpAtom.h"
 #include "Ap4SgpdAtom.h"
 
@@ -169,6 +170,9 @@ AP4_AtomFactory::CreateAtomFromStream(std::shared_ptr<AP4_ByteStream> stream,
     // NULL by default
     atom = NULL;
 
+    // the atom and its children are allocated from this factory's arena
+    AP4_ArenaScope arena_scope(m_Arena);
+
     // check that there are enough bytes for at least a header
     if (bytes_available < 8) return AP4_ERROR_EOS;
 
@@ -437,7 +441,7 @@ AP4_AtomFactory::CreateAtomFromStream(std::shared_ptr<AP4_ByteStream> stream,
 
           case AP4_ATOM_TYPE_TRUN:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_TrunAtom::Create(size_32, *stream);
+            atom = AP4_TrunAtom::Create(size_32, *stream, m_Arena);
             break;
 
           case AP4_ATOM_TYPE_TFRA:
@@ -467,17 +471,29 @@ AP4_AtomFactory::CreateAtomFromStream(std::shared_ptr<AP4_ByteStream> stream,
 
           case AP4_ATOM_TYPE_STCO:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StcoAtom::Create(size_32, *stream);
+            if (m_DeferredPayloadThreshold && size_32 > m_DeferredPayloadThreshold) {
+                atom = AP4_StcoAtom::CreateDeferred(size_32, stream);
+            } else {
+                atom = AP4_StcoAtom::Create(size_32, *stream);
+            }
             break;
 
           case AP4_ATOM_TYPE_CO64:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_Co64Atom::Create(size_32, *stream);
+            if (m_DeferredPayloadThreshold && size_32 > m_DeferredPayloadThreshold) {
+                atom = AP4_Co64Atom::CreateDeferred(size_32, stream);
+            } else {
+                atom = AP4_Co64Atom::Create(size_32, *stream);
+            }
             break;
 
           case AP4_ATOM_TYPE_STSZ:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StszAtom::Create(size_32, *stream);
+            if (m_DeferredPayloadThreshold && size_32 > m_DeferredPayloadThreshold) {
+                atom = AP4_StszAtom::CreateDeferred(size_32, stream);
+            } else {
+                atom = AP4_StszAtom::Create(size_32, *stream);
+            }
             break;
 
           case AP4_ATOM_TYPE_STZ2:
@@ -487,12 +503,20 @@ AP4_AtomFactory::CreateAtomFromStream(std::shared_ptr<AP4_ByteStream> stream,
 
           case AP4_ATOM_TYPE_STTS:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_SttsAtom::Create(size_32, *stream);
+            if (m_DeferredPayloadThreshold && size_32 > m_DeferredPayloadThreshold) {
+                atom = AP4_SttsAtom::CreateDeferred(size_32, stream);
+            } else {
+                atom = AP4_SttsAtom::Create(size_32, *stream);
+            }
             break;
 
           case AP4_ATOM_TYPE_CTTS:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_CttsAtom::Create(size_32, *stream);
+            if (m_DeferredPayloadThreshold && size_32 > m_DeferredPayloadThreshold) {
+                atom = AP4_CttsAtom::CreateDeferred(size_32, stream);
+            } else {
+                atom = AP4_CttsAtom::Create(size_32, *stream);
+            }
             break;
 
           case AP4_ATOM_TYPE_STSS:
@@ -741,6 +765,11 @@ AP4_AtomFactory::CreateAtomFromStream(std::shared_ptr<AP4_ByteStream> stream,
             atom = AP4_SidxAtom::Create(size_32, *stream);
             break;
 
+          case AP4_ATOM_TYPE_EMSG:
+            if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
+            atom = AP4_EmsgAtom::Create(size_32, *stream);
+            break;
+
           case AP4_ATOM_TYPE_SBGP:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
             atom = AP4_SbgpAtom::Create(size_32, *stream);
@@ -62,7 +62,7 @@ class AP4_AtomFactory {
     };
 
     // constructor
-    AP4_AtomFactory() {}
+    AP4_AtomFactory() : m_DeferredPayloadThreshold(0), m_Arena(NULL) {}
 
     // destructor
     virtual ~AP4_AtomFactory();
@@ -86,6 +86,24 @@ class AP4_AtomFactory {
                                      AP4_LargeSize                   bytes_available,
                                      AP4_AtomParent&                 atoms);
 
+    /**
+     * Defer decoding of sample tables (stts, ctts, stsz, stco, co64)
+     * whose payload is larger than the given number of bytes until their
+     * entries are first accessed. A threshold of 0 disables deferred
+     * decoding (the default).
+     */
+    void     SetDeferredPayloadThreshold(AP4_Size threshold) { m_DeferredPayloadThreshold = threshold; }
+    AP4_Size GetDeferredPayloadThreshold() const             { return m_DeferredPayloadThreshold;      }
+
+    /**
+     * Allocate the atoms created by this factory, the lists that hold
+     * their children and the tables of the fragment atoms (trun) from an
+     * arena (see AP4_Arena), or from the heap if arena is NULL (the
+     * default), so that a whole atom tree is reclaimed at once.
+     */
+    void       SetArena(AP4_Arena* arena) { m_Arena = arena; }
+    AP4_Arena* GetArena() const           { return m_Arena;  }
+
     // context
     void PushContext(AP4_Atom::Type context);
     void PopContext();
@@ -95,6 +113,8 @@ private:
     // members
     AP4_Array<AP4_Atom::Type> m_ContextStack;
     AP4_List<TypeHandler>     m_TypeHandlers;
+    AP4_Size                  m_DeferredPayloadThreshold;
+    AP4_Arena*                m_Arena;
 };
 
 /*----------------------------------------------------------------------
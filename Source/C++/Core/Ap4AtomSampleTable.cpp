@@ -56,7 +56,9 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_AtomSampleTable)
 +---------------------------------------------------------------------*/
 AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom*              stbl, 
                                          std::shared_ptr<AP4_ByteStream> sample_stream) :
-    m_SampleStream(std::move(sample_stream))
+    m_SampleStream(std::move(sample_stream)),
+    m_SampleIndexEnabled(false),
+    m_SampleIndex(NULL)
 {
     m_StscAtom = AP4_DYNAMIC_CAST(AP4_StscAtom, stbl->GetChild(AP4_ATOM_TYPE_STSC));
     m_StcoAtom = AP4_DYNAMIC_CAST(AP4_StcoAtom, stbl->GetChild(AP4_ATOM_TYPE_STCO));
@@ -74,7 +76,175 @@ AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom*              stbl,
 +---------------------------------------------------------------------*/
 AP4_AtomSampleTable::~AP4_AtomSampleTable()
 {
+    delete m_SampleIndex.load();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::EnableSampleIndex
++---------------------------------------------------------------------*/
+void
+AP4_AtomSampleTable::EnableSampleIndex(bool enable)
+{
+    m_SampleIndexEnabled = enable;
+    if (!enable) InvalidateSampleIndex();
+}
 
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::InvalidateSampleIndex
++---------------------------------------------------------------------*/
+void
+AP4_AtomSampleTable::InvalidateSampleIndex()
+{
+    delete m_SampleIndex.exchange(NULL);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::GetSampleIndex
++---------------------------------------------------------------------*/
+AP4_AtomSampleTable::SampleIndex*
+AP4_AtomSampleTable::GetSampleIndex()
+{
+    if (!m_SampleIndexEnabled.load(std::memory_order_relaxed)) return NULL;
+    SampleIndex* index = m_SampleIndex.load(std::memory_order_acquire);
+    if (index == NULL) {
+        // build the index once, even with concurrent readers
+        std::lock_guard<std::mutex> lock(m_SampleIndexLock);
+        index = m_SampleIndex.load(std::memory_order_acquire);
+        if (index == NULL && m_SampleIndexEnabled.load(std::memory_order_relaxed)) {
+            // if the index can't be built, we fall back to the atom tables
+            if (AP4_FAILED(BuildSampleIndex())) m_SampleIndexEnabled = false;
+            index = m_SampleIndex.load(std::memory_order_acquire);
+        }
+    }
+    return index;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::BuildSampleIndex
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomSampleTable::BuildSampleIndex()
+{
+    AP4_Result result;
+
+    // start fresh
+    InvalidateSampleIndex();
+
+    // check that we have all the tables we need
+    if (m_StscAtom == NULL) return AP4_ERROR_INVALID_FORMAT;
+    if (m_StcoAtom == NULL && m_Co64Atom == NULL) return AP4_ERROR_INVALID_FORMAT;
+    if (m_StszAtom == NULL && m_Stz2Atom == NULL) return AP4_ERROR_INVALID_FORMAT;
+
+    AP4_Cardinal sample_count = GetSampleCount();
+    SampleIndex* index = new SampleIndex();
+    if (AP4_FAILED(result = index->m_Offsets.SetItemCount(sample_count))            ||
+        AP4_FAILED(result = index->m_Dts.SetItemCount(sample_count))                ||
+        AP4_FAILED(result = index->m_Sizes.SetItemCount(sample_count))              ||
+        AP4_FAILED(result = index->m_Durations.SetItemCount(sample_count))          ||
+        AP4_FAILED(result = index->m_CtsDeltas.SetItemCount(sample_count))          ||
+        AP4_FAILED(result = index->m_DescriptionIndexes.SetItemCount(sample_count)) ||
+        AP4_FAILED(result = index->m_SyncFlags.SetItemCount(sample_count))) {
+        delete index;
+        return result;
+    }
+
+    // walk all the samples in order: the per-atom lookup caches make each
+    // step O(1), so the whole index is built in linear time
+    AP4_Ordinal                current_chunk = 0;
+    AP4_UI64                   offset        = 0;
+    AP4_Size                   size          = 0;
+    const AP4_Array<AP4_UI32>* sync          = m_StssAtom ? &m_StssAtom->GetEntries() : NULL;
+    AP4_Ordinal                sync_entry    = 0;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        AP4_Ordinal sample = i+1; // the atom API is 1-based
+
+        // chunk and position in chunk
+        AP4_Ordinal chunk, skip, desc;
+        result = m_StscAtom->GetChunkForSample(sample, chunk, skip, desc);
+        if (AP4_FAILED(result)) break;
+        if (skip > sample || desc == 0 || desc > 0xFFFF) {
+            result = AP4_ERROR_INVALID_FORMAT;
+            break;
+        }
+        if (i == 0 || chunk != current_chunk) {
+            // first sample in a chunk: get the chunk offset
+            if (m_StcoAtom) {
+                AP4_UI32 offset_32;
+                result = m_StcoAtom->GetChunkOffset(chunk, offset_32);
+                offset = offset_32;
+            } else {
+                result = m_Co64Atom->GetChunkOffset(chunk, offset);
+            }
+            if (AP4_FAILED(result)) break;
+
+            // add the size of the samples that precede this one in the chunk
+            for (AP4_Ordinal j=sample-skip; j<sample; j++) {
+                AP4_Size skipped_size = 0;
+                result = m_StszAtom ? m_StszAtom->GetSampleSize(j, skipped_size)
+                                    : m_Stz2Atom->GetSampleSize(j, skipped_size);
+                if (AP4_FAILED(result)) break;
+                offset += skipped_size;
+            }
+            if (AP4_FAILED(result)) break;
+            current_chunk = chunk;
+        } else {
+            // next sample in the same chunk
+            offset += size;
+        }
+
+        // size
+        result = m_StszAtom ? m_StszAtom->GetSampleSize(sample, size)
+                            : m_Stz2Atom->GetSampleSize(sample, size);
+        if (AP4_FAILED(result)) break;
+
+        // timing
+        AP4_UI64 dts        = 0;
+        AP4_UI32 duration   = 0;
+        AP4_UI32 cts_offset = 0;
+        if (m_SttsAtom) {
+            result = m_SttsAtom->GetDts(sample, dts, &duration);
+            if (AP4_FAILED(result)) break;
+        }
+        if (m_CttsAtom) {
+            result = m_CttsAtom->GetCtsOffset(sample, cts_offset);
+            if (AP4_FAILED(result)) break;
+        }
+
+        // sync flag
+        bool is_sync = true;
+        if (sync) {
+            while (sync_entry < sync->ItemCount() && (*sync)[sync_entry] < sample) {
+                ++sync_entry;
+            }
+            is_sync = (sync_entry < sync->ItemCount() && (*sync)[sync_entry] == sample);
+        }
+
+        index->m_Offsets[i]            = offset;
+        index->m_Dts[i]                = dts;
+        index->m_Sizes[i]              = size;
+        index->m_Durations[i]          = duration;
+        index->m_CtsDeltas[i]          = cts_offset;
+        index->m_DescriptionIndexes[i] = (AP4_UI16)(desc-1);
+        index->m_SyncFlags[i]          = is_sync ? 1 : 0;
+    }
+    if (AP4_FAILED(result)) {
+        delete index;
+        return result;
+    }
+
+    // binary searches on the sync sample table require it to be sorted
+    index->m_SyncEntriesSorted = true;
+    if (sync) {
+        for (AP4_Ordinal i=1; i<sync->ItemCount(); i++) {
+            if ((*sync)[i] < (*sync)[i-1]) {
+                index->m_SyncEntriesSorted = false;
+                break;
+            }
+        }
+    }
+
+    m_SampleIndex.store(index, std::memory_order_release);
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -86,6 +256,25 @@ AP4_AtomSampleTable::GetSample(AP4_Ordinal index,
 {
     AP4_Result result;
 
+    // use the sample index if we have one
+    SampleIndex* sample_index = GetSampleIndex();
+    if (sample_index) {
+        if (index >= sample_index->m_Offsets.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+        sample.SetDescriptionIndex(sample_index->m_DescriptionIndexes[index]);
+        sample.SetDuration(sample_index->m_Durations[index]);
+        sample.SetDts(sample_index->m_Dts[index]);
+        if (m_CttsAtom == NULL) {
+            sample.SetCts(sample_index->m_Dts[index]);
+        } else {
+            sample.SetCtsDelta(sample_index->m_CtsDeltas[index]);
+        }
+        sample.SetSize(sample_index->m_Sizes[index]);
+        sample.SetSync(sample_index->m_SyncFlags[index] != 0);
+        sample.SetOffset(sample_index->m_Offsets[index]);
+        sample.SetDataStream(m_SampleStream);
+        return AP4_SUCCESS;
+    }
+
     // check that we have an stsc atom
     if (!m_StscAtom) {
         return AP4_ERROR_INVALID_FORMAT;
@@ -118,19 +307,17 @@ AP4_AtomSampleTable::GetSample(AP4_Ordinal index,
     }
     if (AP4_FAILED(result)) return result;
     
-    // compute the additional offset inside the chunk
-    for (unsigned int i = index-skip; i < index; i++) {
-        AP4_Size size = 0;
-        if (m_StszAtom) {
-            result = m_StszAtom->GetSampleSize(i, size); 
-        } else if (m_Stz2Atom) {
-            result = m_Stz2Atom->GetSampleSize(i, size); 
-        } else {
-            result = AP4_ERROR_INVALID_FORMAT;
-        }
-        if (AP4_FAILED(result)) return result;
-        offset += size;
+    // add the size of the samples that precede this one in the chunk
+    AP4_UI64 offset_in_chunk = 0;
+    if (m_StszAtom) {
+        result = m_StszAtom->GetSampleRangeSize(index-skip, skip, offset_in_chunk);
+    } else if (m_Stz2Atom) {
+        result = m_Stz2Atom->GetSampleRangeSize(index-skip, skip, offset_in_chunk);
+    } else {
+        result = AP4_ERROR_INVALID_FORMAT;
     }
+    if (AP4_FAILED(result)) return result;
+    offset += offset_in_chunk;
 
     // set the description index
     sample.SetDescriptionIndex(desc-1); // adjust for 0-based indexes
@@ -297,6 +484,7 @@ AP4_Result
 AP4_AtomSampleTable::SetChunkOffset(AP4_Ordinal  chunk_index, 
                                     AP4_Position offset)
 {
+    InvalidateSampleIndex();
     if (m_StcoAtom) {
         if ((offset >> 32) != 0) return AP4_ERROR_OUT_OF_RANGE;
         return m_StcoAtom->SetChunkOffset(chunk_index+1, (AP4_UI32)offset);
@@ -313,6 +501,7 @@ AP4_AtomSampleTable::SetChunkOffset(AP4_Ordinal  chunk_index,
 AP4_Result 
 AP4_AtomSampleTable::SetSampleSize(AP4_Ordinal sample_index, AP4_Size size)
 {
+    InvalidateSampleIndex();
     if (m_StszAtom) {
         return m_StszAtom->SetSampleSize(sample_index+1, size);
     } else if (m_Stz2Atom) {
@@ -329,6 +518,29 @@ AP4_Result
 AP4_AtomSampleTable::GetSampleIndexForTimeStamp(AP4_UI64     ts, 
                                                 AP4_Ordinal& sample_index)
 {
+    // use the sample index if we have one
+    SampleIndex* index = GetSampleIndex();
+    if (index && m_SttsAtom) {
+        // find the last sample with a dts <= ts
+        sample_index = 0;
+        AP4_Cardinal count = index->m_Dts.ItemCount();
+        AP4_Ordinal  lo    = 0;
+        AP4_Ordinal  hi    = count;
+        while (lo < hi) {
+            AP4_Ordinal mid = lo+(hi-lo)/2;
+            if (index->m_Dts[mid] <= ts) {
+                lo = mid+1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) return AP4_FAILURE;
+        AP4_Ordinal candidate = lo-1;
+        if (ts >= index->m_Dts[candidate]+index->m_Durations[candidate]) return AP4_FAILURE;
+        sample_index = candidate;
+        return AP4_SUCCESS;
+    }
+
     return m_SttsAtom ? m_SttsAtom->GetSampleIndexForTimeStamp(ts, sample_index) 
                       : AP4_FAILURE;
 }
@@ -344,6 +556,30 @@ AP4_AtomSampleTable::GetNearestSyncSampleIndex(AP4_Ordinal sample_index, bool be
     
     sample_index += 1; // the table is 1-based
     AP4_Cardinal entry_count = m_StssAtom->GetEntries().ItemCount();
+
+    // use a binary search if the sample index tells us we can
+    SampleIndex* index = GetSampleIndex();
+    if (index && index->m_SyncEntriesSorted) {
+        // find the first entry >= sample_index
+        const AP4_Array<AP4_UI32>& entries = m_StssAtom->GetEntries();
+        AP4_Ordinal lo = 0;
+        AP4_Ordinal hi = entry_count;
+        while (lo < hi) {
+            AP4_Ordinal mid = lo+(hi-lo)/2;
+            if (entries[mid] < sample_index) {
+                lo = mid+1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (before) {
+            return (lo && entries[lo-1]) ? entries[lo-1]-1 : 0;
+        } else {
+            if (lo == entry_count) return GetSampleCount();
+            return entries[lo] ? entries[lo]-1 : sample_index-1;
+        }
+    }
+
     if (before) {
         AP4_Ordinal cursor = 0;    
         for (unsigned int i=0; i<entry_count; i++) {
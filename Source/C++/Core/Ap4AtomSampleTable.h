@@ -35,9 +35,12 @@
 |   includes
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
+#include "Ap4Array.h"
 #include "Ap4SampleTable.h"
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 /*----------------------------------------------------------------------
 |   forward declarations
@@ -87,7 +90,38 @@ class AP4_AtomSampleTable : public AP4_SampleTable
     virtual AP4_Result SetChunkOffset(AP4_Ordinal chunk_index, AP4_Position offset);
     virtual AP4_Result SetSampleSize(AP4_Ordinal sample_index, AP4_Size size);
 
+    /**
+     * Enable or disable the flattened random-access sample index.
+     * When enabled, the index is built from the atom tables on the first
+     * lookup, after which GetSample is O(1) and GetSampleIndexForTimeStamp
+     * and GetNearestSyncSampleIndex are O(log n).
+     * The index is disabled by default.
+     */
+    void       EnableSampleIndex(bool enable = true);
+    bool       IsSampleIndexEnabled() const { return m_SampleIndexEnabled.load(std::memory_order_relaxed); }
+
+    /**
+     * Build the sample index now, rather than on the first lookup.
+     */
+    AP4_Result BuildSampleIndex();
+
 private:
+    // types
+    struct SampleIndex {
+        AP4_Array<AP4_UI64> m_Offsets;
+        AP4_Array<AP4_UI64> m_Dts;
+        AP4_Array<AP4_UI32> m_Sizes;
+        AP4_Array<AP4_UI32> m_Durations;
+        AP4_Array<AP4_UI32> m_CtsDeltas;
+        AP4_Array<AP4_UI16> m_DescriptionIndexes;
+        AP4_Array<AP4_UI08> m_SyncFlags;
+        bool                m_SyncEntriesSorted;
+    };
+
+    // methods
+    SampleIndex* GetSampleIndex();
+    void         InvalidateSampleIndex();
+
     // members
     std::shared_ptr<AP4_ByteStream> m_SampleStream;
     AP4_StscAtom*   m_StscAtom;
@@ -99,6 +133,9 @@ private:
     AP4_StsdAtom*   m_StsdAtom;
     AP4_StssAtom*   m_StssAtom;
     AP4_Co64Atom*   m_Co64Atom;
+    std::atomic<bool>         m_SampleIndexEnabled;
+    std::atomic<SampleIndex*> m_SampleIndex;
+    std::mutex                m_SampleIndexLock;
 };
 
 #endif // _AP4_ATOM_SAMPLE_TABLE_H_
@@ -0,0 +1,344 @@
+/*****************************************************************
+|
+|    AP4 - Box Scanner
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4BoxScanner.h"
+#include "Ap4TfhdAtom.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::IsContainer
++---------------------------------------------------------------------*/
+bool
+AP4_BoxScanner::IsContainer(AP4_Atom::Type type, AP4_Size& children_offset)
+{
+    switch (type) {
+        case AP4_ATOM_TYPE_MOOV:
+        case AP4_ATOM_TYPE_TRAK:
+        case AP4_ATOM_TYPE_MDIA:
+        case AP4_ATOM_TYPE_MINF:
+        case AP4_ATOM_TYPE_STBL:
+        case AP4_ATOM_TYPE_EDTS:
+        case AP4_ATOM_TYPE_DINF:
+        case AP4_ATOM_TYPE_UDTA:
+        case AP4_ATOM_TYPE_MVEX:
+        case AP4_ATOM_TYPE_MOOF:
+        case AP4_ATOM_TYPE_TRAF:
+        case AP4_ATOM_TYPE_MFRA:
+        case AP4_ATOM_TYPE_SINF:
+        case AP4_ATOM_TYPE_SCHI:
+            children_offset = 0;
+            return true;
+
+        case AP4_ATOM_TYPE_META:
+            // version and flags
+            children_offset = 4;
+            return true;
+
+        case AP4_ATOM_TYPE_STSD:
+        case AP4_ATOM_TYPE_DREF:
+            // version, flags and entry count
+            children_offset = 8;
+            return true;
+
+        default:
+            children_offset = 0;
+            return false;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::AP4_BoxScanner
++---------------------------------------------------------------------*/
+AP4_BoxScanner::AP4_BoxScanner(const AP4_UI08* data, AP4_Size size) :
+    m_Data(data),
+    m_Position(0),
+    m_End(size)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::AP4_BoxScanner
++---------------------------------------------------------------------*/
+AP4_BoxScanner::AP4_BoxScanner(const AP4_UI08* data, AP4_Position start, AP4_Position end) :
+    m_Data(data),
+    m_Position(start <= end ? start : end),
+    m_End(end)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::Next
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::Next(Box& box)
+{
+    if (m_Position == m_End) return AP4_ERROR_EOS;
+
+    // basic header
+    AP4_UI64 available = m_End-m_Position;
+    if (available < AP4_ATOM_HEADER_SIZE) {
+        m_Position = m_End;
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    const AP4_UI08* header = m_Data+m_Position;
+    AP4_UI64 size        = AP4_BytesToUInt32BE(header);
+    AP4_UI32 header_size = AP4_ATOM_HEADER_SIZE;
+    box.m_Type   = AP4_BytesToUInt32BE(header+4);
+    box.m_Offset = m_Position;
+
+    // large size, or a box that extends to the end of the range
+    if (size == 1) {
+        if (available < AP4_ATOM_HEADER_SIZE_64) {
+            m_Position = m_End;
+            return AP4_ERROR_INVALID_FORMAT;
+        }
+        size        = AP4_BytesToUInt64BE(header+8);
+        header_size = AP4_ATOM_HEADER_SIZE_64;
+    } else if (size == 0) {
+        size = available;
+    }
+
+    // extended type
+    if (box.m_Type == AP4_ATOM_TYPE_UUID) header_size += 16;
+
+    // check that the box fits
+    if (size < header_size || size > available) {
+        m_Position = m_End;
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    box.m_HeaderSize = header_size;
+    box.m_Size       = size;
+    m_Position += size;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::GetChildren
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::GetChildren(const Box& box, AP4_BoxScanner& children) const
+{
+    AP4_Size children_offset = 0;
+    if (!IsContainer(box.m_Type, children_offset)) return AP4_ERROR_NOT_SUPPORTED;
+    if (box.GetPayloadSize() < children_offset) return AP4_ERROR_INVALID_FORMAT;
+    children = AP4_BoxScanner(m_Data, box.GetPayloadOffset()+children_offset, box.m_Offset+box.m_Size);
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::ReadTfhd
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::ReadTfhd(const Box& box, TfhdFields& fields) const
+{
+    fields = TfhdFields();
+    if (box.m_Type != AP4_ATOM_TYPE_TFHD) return AP4_ERROR_INVALID_PARAMETERS;
+    const AP4_UI08* payload = GetPayload(box);
+    AP4_UI64        size    = box.GetPayloadSize();
+    if (size < 8) return AP4_ERROR_INVALID_FORMAT;
+    fields.m_Flags   = AP4_BytesToUInt32BE(payload)&0xFFFFFF;
+    fields.m_TrackId = AP4_BytesToUInt32BE(payload+4);
+
+    // optional fields
+    AP4_UI64 needed = 8;
+    if (fields.m_Flags & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT)         needed += 8;
+    if (fields.m_Flags & AP4_TFHD_FLAG_SAMPLE_DESCRIPTION_INDEX_PRESENT) needed += 4;
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_DURATION_PRESENT)  needed += 4;
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT)      needed += 4;
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT)     needed += 4;
+    if (size < needed) return AP4_ERROR_INVALID_FORMAT;
+    const AP4_UI08* field = payload+8;
+    if (fields.m_Flags & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
+        fields.m_BaseDataOffset = AP4_BytesToUInt64BE(field);
+        field += 8;
+    }
+    if (fields.m_Flags & AP4_TFHD_FLAG_SAMPLE_DESCRIPTION_INDEX_PRESENT) {
+        fields.m_SampleDescriptionIndex = AP4_BytesToUInt32BE(field);
+        field += 4;
+    }
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_DURATION_PRESENT) {
+        fields.m_DefaultSampleDuration = AP4_BytesToUInt32BE(field);
+        field += 4;
+    }
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) {
+        fields.m_DefaultSampleSize = AP4_BytesToUInt32BE(field);
+        field += 4;
+    }
+    if (fields.m_Flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT) {
+        fields.m_DefaultSampleFlags = AP4_BytesToUInt32BE(field);
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::ReadTfdt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::ReadTfdt(const Box& box, AP4_UI64& base_media_decode_time) const
+{
+    base_media_decode_time = 0;
+    if (box.m_Type != AP4_ATOM_TYPE_TFDT) return AP4_ERROR_INVALID_PARAMETERS;
+    const AP4_UI08* payload = GetPayload(box);
+    AP4_UI64        size    = box.GetPayloadSize();
+    if (size < 8) return AP4_ERROR_INVALID_FORMAT;
+    if (payload[0] == 0) {
+        base_media_decode_time = AP4_BytesToUInt32BE(payload+4);
+    } else if (payload[0] == 1) {
+        if (size < 12) return AP4_ERROR_INVALID_FORMAT;
+        base_media_decode_time = AP4_BytesToUInt64BE(payload+4);
+    } else {
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::ReadTrun
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::ReadTrun(const Box&           box,
+                         TrunFields&          fields,
+                         AP4_TrunAtom::Entry* entries,
+                         AP4_Cardinal         max_entries) const
+{
+    fields = TrunFields();
+    if (box.m_Type != AP4_ATOM_TYPE_TRUN) return AP4_ERROR_INVALID_PARAMETERS;
+    const AP4_UI08* payload = GetPayload(box);
+    AP4_UI64        size    = box.GetPayloadSize();
+    if (size < 8) return AP4_ERROR_INVALID_FORMAT;
+    fields.m_Flags       = AP4_BytesToUInt32BE(payload)&0xFFFFFF;
+    fields.m_SampleCount = AP4_BytesToUInt32BE(payload+4);
+
+    // check that everything is there
+    unsigned int optional_fields_count = AP4_TrunAtom::ComputeOptionalFieldsCount(fields.m_Flags);
+    unsigned int record_fields_count   = AP4_TrunAtom::ComputeRecordFieldsCount(fields.m_Flags);
+    if (size < 8+4*(AP4_UI64)optional_fields_count+4*(AP4_UI64)record_fields_count*fields.m_SampleCount) {
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+
+    // optional fields, of which only the first two are known
+    const AP4_UI08* field = payload+8;
+    if (fields.m_Flags & AP4_TRUN_FLAG_DATA_OFFSET_PRESENT) {
+        fields.m_DataOffset = (AP4_SI32)AP4_BytesToUInt32BE(field);
+        field += 4;
+    }
+    if (fields.m_Flags & AP4_TRUN_FLAG_FIRST_SAMPLE_FLAGS_PRESENT) {
+        fields.m_FirstSampleFlags = AP4_BytesToUInt32BE(field);
+    }
+    if (fields.m_SampleCount > max_entries || (fields.m_SampleCount && entries == NULL)) {
+        return AP4_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    // entries, skipping unknown record fields
+    const AP4_UI08* record = payload+8+4*optional_fields_count;
+    for (AP4_Ordinal i=0; i<fields.m_SampleCount; i++, record += 4*record_fields_count) {
+        AP4_TrunAtom::Entry& entry = entries[i];
+        entry = AP4_TrunAtom::Entry();
+        field = record;
+        if (fields.m_Flags & AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT) {
+            entry.sample_duration = AP4_BytesToUInt32BE(field);
+            field += 4;
+        }
+        if (fields.m_Flags & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) {
+            entry.sample_size = AP4_BytesToUInt32BE(field);
+            field += 4;
+        }
+        if (fields.m_Flags & AP4_TRUN_FLAG_SAMPLE_FLAGS_PRESENT) {
+            entry.sample_flags = AP4_BytesToUInt32BE(field);
+            field += 4;
+        }
+        if (fields.m_Flags & AP4_TRUN_FLAG_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT) {
+            entry.sample_composition_time_offset = AP4_BytesToUInt32BE(field);
+        }
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner::ReadSidx
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BoxScanner::ReadSidx(const Box&               box,
+                         SidxFields&              fields,
+                         AP4_SidxAtom::Reference* references,
+                         AP4_Cardinal             max_references) const
+{
+    fields = SidxFields();
+    if (box.m_Type != AP4_ATOM_TYPE_SIDX) return AP4_ERROR_INVALID_PARAMETERS;
+    const AP4_UI08* payload = GetPayload(box);
+    AP4_UI64        size    = box.GetPayloadSize();
+    if (size < 12) return AP4_ERROR_INVALID_FORMAT;
+    AP4_UI08 version = payload[0];
+    fields.m_ReferenceId = AP4_BytesToUInt32BE(payload+4);
+    fields.m_TimeScale   = AP4_BytesToUInt32BE(payload+8);
+    const AP4_UI08* field = payload+12;
+    if (version == 0) {
+        if (size < 12+8+4) return AP4_ERROR_INVALID_FORMAT;
+        fields.m_EarliestPresentationTime = AP4_BytesToUInt32BE(field);
+        fields.m_FirstOffset              = AP4_BytesToUInt32BE(field+4);
+        field += 8;
+    } else {
+        if (size < 12+16+4) return AP4_ERROR_INVALID_FORMAT;
+        fields.m_EarliestPresentationTime = AP4_BytesToUInt64BE(field);
+        fields.m_FirstOffset              = AP4_BytesToUInt64BE(field+8);
+        field += 16;
+    }
+    fields.m_ReferenceCount = AP4_BytesToUInt16BE(field+2); // after 16 reserved bits
+    field += 4;
+    if (size < (AP4_UI64)(field-payload)+12*(AP4_UI64)fields.m_ReferenceCount) {
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    if (fields.m_ReferenceCount > max_references || (fields.m_ReferenceCount && references == NULL)) {
+        return AP4_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    // references
+    for (AP4_Ordinal i=0; i<fields.m_ReferenceCount; i++) {
+        AP4_UI32 value0 = AP4_BytesToUInt32BE(field);
+        AP4_UI32 value1 = AP4_BytesToUInt32BE(field+4);
+        AP4_UI32 value2 = AP4_BytesToUInt32BE(field+8);
+        AP4_SidxAtom::Reference& reference = references[i];
+        reference.m_ReferenceType      = (AP4_UI08)(value0>>31);
+        reference.m_ReferencedSize     = value0&0x7FFFFFFF;
+        reference.m_SubsegmentDuration = value1;
+        reference.m_StartsWithSap      = (value2&0x80000000) != 0;
+        reference.m_SapType            = (AP4_UI08)((value2>>28)&0x07);
+        reference.m_SapDeltaTime       = value2&0x0FFFFFFF;
+        field += 12;
+    }
+
+    return AP4_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/*****************************************************************
+|
+|    AP4 - Box Scanner
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_BOX_SCANNER_H_
+#define _AP4_BOX_SCANNER_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+#include "Ap4Results.h"
+#include "Ap4Atom.h"
+#include "Ap4TrunAtom.h"
+#include "Ap4SidxAtom.h"
+
+/*----------------------------------------------------------------------
+|   AP4_BoxScanner
++---------------------------------------------------------------------*/
+/**
+ * Iterator over the boxes of a byte range, without creating atom objects.
+ * The data is typically a memory buffer or the view of a memory-mapped
+ * file (see AP4_ByteStream::GetDataView). Boxes are reported with their
+ * offset from the start of that data, so offsets found in a scan of a
+ * whole file are file offsets.
+ * Children of well-known containers can be scanned with GetChildren(),
+ * and the fields of tfhd, tfdt, trun and sidx boxes can be decoded
+ * directly into caller-provided storage, which makes it possible to
+ * index large fragmented files without any allocation.
+ */
+class AP4_BoxScanner
+{
+public:
+    // types
+    struct Box {
+        Box() : m_Type(0), m_HeaderSize(0), m_Offset(0), m_Size(0) {}
+        AP4_Position GetPayloadOffset() const { return m_Offset+m_HeaderSize; }
+        AP4_UI64     GetPayloadSize()   const { return m_Size-m_HeaderSize;   }
+
+        AP4_Atom::Type m_Type;
+        AP4_UI32       m_HeaderSize; // including the 64-bit size and uuid extended type, if any
+        AP4_Position   m_Offset;
+        AP4_UI64       m_Size;       // including the header
+    };
+    struct TfhdFields {
+        TfhdFields() : 
+            m_Flags(0), 
+            m_TrackId(0), 
+            m_BaseDataOffset(0), 
+            m_SampleDescriptionIndex(0), 
+            m_DefaultSampleDuration(0), 
+            m_DefaultSampleSize(0), 
+            m_DefaultSampleFlags(0) {}
+        AP4_UI32 m_Flags;
+        AP4_UI32 m_TrackId;
+        AP4_UI64 m_BaseDataOffset;
+        AP4_UI32 m_SampleDescriptionIndex;
+        AP4_UI32 m_DefaultSampleDuration;
+        AP4_UI32 m_DefaultSampleSize;
+        AP4_UI32 m_DefaultSampleFlags;
+    };
+    struct TrunFields {
+        TrunFields() : m_Flags(0), m_SampleCount(0), m_DataOffset(0), m_FirstSampleFlags(0) {}
+        AP4_UI32 m_Flags;
+        AP4_UI32 m_SampleCount;
+        AP4_SI32 m_DataOffset;
+        AP4_UI32 m_FirstSampleFlags;
+    };
+    struct SidxFields {
+        SidxFields() : 
+            m_ReferenceId(0), 
+            m_TimeScale(0), 
+            m_EarliestPresentationTime(0), 
+            m_FirstOffset(0), 
+            m_ReferenceCount(0) {}
+        AP4_UI32 m_ReferenceId;
+        AP4_UI32 m_TimeScale;
+        AP4_UI64 m_EarliestPresentationTime;
+        AP4_UI64 m_FirstOffset;
+        AP4_UI32 m_ReferenceCount;
+    };
+
+    // class methods
+    /**
+     * Check if a box type is a container whose children GetChildren() can
+     * scan, and return how many payload bytes precede the first child.
+     */
+    static bool IsContainer(AP4_Atom::Type type, AP4_Size& children_offset);
+
+    // methods
+    /**
+     * Scan the boxes in data[0..size].
+     */
+    AP4_BoxScanner(const AP4_UI08* data, AP4_Size size);
+
+    /**
+     * Scan the boxes in data[start..end]. If start is past end, the range
+     * is empty.
+     */
+    AP4_BoxScanner(const AP4_UI08* data, AP4_Position start, AP4_Position end);
+
+    /**
+     * Get the next box.
+     * @return AP4_SUCCESS, AP4_ERROR_EOS when there are no more boxes, or
+     * AP4_ERROR_INVALID_FORMAT if the next box header is truncated or its
+     * size does not fit in the scanned range. In that case, the scan stops.
+     */
+    AP4_Result Next(Box& box);
+
+    /**
+     * Get a scanner for the children of a box returned by this scanner
+     * or by one of its child scanners.
+     * @return AP4_ERROR_NOT_SUPPORTED if the box is not a known container.
+     */
+    AP4_Result GetChildren(const Box& box, AP4_BoxScanner& children) const;
+
+    /**
+     * Get a pointer to the payload of a box.
+     */
+    const AP4_UI08* GetPayload(const Box& box) const { return m_Data+box.GetPayloadOffset(); }
+
+    /**
+     * Decode the fields of a tfhd box.
+     */
+    AP4_Result ReadTfhd(const Box& box, TfhdFields& fields) const;
+
+    /**
+     * Decode the base media decode time of a tfdt box.
+     */
+    AP4_Result ReadTfdt(const Box& box, AP4_UI64& base_media_decode_time) const;
+
+    /**
+     * Decode the fields and entries of a trun box.
+     * Optional per-sample fields that are absent are set to 0.
+     * @param entries Array of at least max_entries entries, or NULL.
+     * @return AP4_ERROR_BUFFER_TOO_SMALL, with the fields set, if there
+     * are more than max_entries entries.
+     */
+    AP4_Result ReadTrun(const Box&           box,
+                        TrunFields&          fields,
+                        AP4_TrunAtom::Entry* entries,
+                        AP4_Cardinal         max_entries) const;
+
+    /**
+     * Decode the fields and references of a sidx box.
+     * @param references Array of at least max_references references, or NULL.
+     * @return AP4_ERROR_BUFFER_TOO_SMALL, with the fields set, if there
+     * are more than max_references references.
+     */
+    AP4_Result ReadSidx(const Box&               box,
+                        SidxFields&              fields,
+                        AP4_SidxAtom::Reference* references,
+                        AP4_Cardinal             max_references) const;
+
+private:
+    // members
+    const AP4_UI08* m_Data;
+    AP4_Position    m_Position;
+    AP4_Position    m_End;
+};
+
+#endif // _AP4_BOX_SCANNER_H_
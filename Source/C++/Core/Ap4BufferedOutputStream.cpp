@@ -0,0 +1,248 @@
+/*****************************************************************
+|
+|    AP4 - Buffered Output Stream
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4BufferedOutputStream.h"
+#include "Ap4Utils.h"
+
+#include <chrono>
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::AP4_BufferedOutputStream
++---------------------------------------------------------------------*/
+AP4_BufferedOutputStream::AP4_BufferedOutputStream(std::shared_ptr<AP4_ByteStream> sink,
+                                                   AP4_Size                        buffer_size,
+                                                   AP4_Cardinal                    buffer_count) :
+    m_Sink(std::move(sink)),
+    m_SinkPosition(0),
+    m_Size(0),
+    m_BufferSize(buffer_size ? buffer_size : AP4_BUFFERED_OUTPUT_STREAM_DEFAULT_BUFFER_SIZE),
+    m_BufferCount(buffer_count ? buffer_count : 1),
+    m_BufferStart(0),
+    m_BufferPosition(0),
+    m_Error(AP4_SUCCESS),
+    m_Writer(1)
+{
+    m_Buffer = std::make_unique<AP4_DataBuffer>(m_BufferSize);
+
+    // start where the sink currently is
+    if (AP4_FAILED(m_Sink->Tell(m_SinkPosition))) m_SinkPosition = 0;
+    if (AP4_FAILED(m_Sink->GetSize(m_Size))) m_Size = 0;
+    m_BufferStart = m_SinkPosition;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::~AP4_BufferedOutputStream
++---------------------------------------------------------------------*/
+AP4_BufferedOutputStream::~AP4_BufferedOutputStream()
+{
+    Flush();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::WriteToSink
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::WriteToSink(const AP4_DataBuffer& buffer, AP4_Position position)
+{
+    // this runs on the writer thread
+    if (position != m_SinkPosition) {
+        AP4_Result result = m_Sink->Seek(position);
+        if (AP4_FAILED(result)) return result;
+        m_SinkPosition = position;
+    }
+    AP4_Result result = m_Sink->Write(buffer.GetData(), buffer.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    m_SinkPosition += buffer.GetDataSize();
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::WaitForOldest
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::WaitForOldest()
+{
+    PendingBuffer oldest = std::move(m_Pending.front());
+    m_Pending.pop_front();
+    AP4_Result result = oldest.m_Result.get();
+    if (AP4_FAILED(result) && AP4_SUCCEEDED(m_Error)) m_Error = result;
+    m_FreeBuffers.push_back(std::move(oldest.m_Buffer));
+
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::SubmitBuffer
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::SubmitBuffer()
+{
+    AP4_Position next = m_BufferStart+m_BufferPosition;
+    AP4_Size     size = m_Buffer->GetDataSize();
+    if (size) {
+        // wait for a free slot
+        while (m_Pending.size() >= m_BufferCount) {
+            WaitForOldest();
+        }
+
+        // hand the buffer to the writer thread
+        if (m_BufferStart+size > m_Size) m_Size = m_BufferStart+size;
+        PendingBuffer pending;
+        pending.m_Buffer = std::move(m_Buffer);
+        const AP4_DataBuffer* data  = pending.m_Buffer.get();
+        AP4_Position          start = m_BufferStart;
+        pending.m_Result = m_Writer.Submit([this, data, start] { return WriteToSink(*data, start); });
+        m_Pending.push_back(std::move(pending));
+
+        // recycle the buffers that are already written
+        while (!m_Pending.empty() &&
+               m_Pending.front().m_Result.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            WaitForOldest();
+        }
+
+        // start a new buffer
+        if (m_FreeBuffers.empty()) {
+            m_Buffer = std::make_unique<AP4_DataBuffer>(m_BufferSize);
+        } else {
+            m_Buffer = std::move(m_FreeBuffers.back());
+            m_FreeBuffers.pop_back();
+            m_Buffer->SetDataSize(0);
+        }
+    }
+    m_BufferStart    = next;
+    m_BufferPosition = 0;
+
+    return m_Error;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::WritePartial(const void* buffer,
+                                       AP4_Size    bytes_to_write,
+                                       AP4_Size&   bytes_written)
+{
+    bytes_written = 0;
+    if (AP4_FAILED(m_Error)) return m_Error;
+    if (bytes_to_write == 0) return AP4_SUCCESS;
+
+    // move on to a new buffer if this one is full
+    if (m_BufferPosition == m_BufferSize) {
+        AP4_Result result = SubmitBuffer();
+        if (AP4_FAILED(result)) return result;
+    }
+
+    // copy as much as fits
+    AP4_Size chunk = m_BufferSize-m_BufferPosition;
+    if (chunk > bytes_to_write) chunk = bytes_to_write;
+    AP4_CopyMemory(m_Buffer->UseData()+m_BufferPosition, buffer, chunk);
+    m_BufferPosition += chunk;
+    if (m_BufferPosition > m_Buffer->GetDataSize()) {
+        m_Buffer->SetDataSize(m_BufferPosition);
+    }
+    bytes_written = chunk;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::ReadPartial(void*     buffer,
+                                      AP4_Size  bytes_to_read,
+                                      AP4_Size& bytes_read)
+{
+    // reading back is rare, so just make sure everything is in the sink
+    bytes_read = 0;
+    AP4_Result result = Flush();
+    if (AP4_FAILED(result)) return result;
+
+    // nothing is pending now, so we can use the sink directly
+    result = m_Sink->Seek(m_BufferStart);
+    if (AP4_FAILED(result)) return result;
+    result = m_Sink->ReadPartial(buffer, bytes_to_read, bytes_read);
+    m_SinkPosition = m_BufferStart+bytes_read;
+    m_BufferStart  = m_SinkPosition;
+
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::Seek(AP4_Position position)
+{
+    if (AP4_FAILED(m_Error)) return m_Error;
+
+    // patch in place if the position is in the current buffer
+    if (position >= m_BufferStart && position <= m_BufferStart+m_Buffer->GetDataSize()) {
+        m_BufferPosition = (AP4_Size)(position-m_BufferStart);
+        return AP4_SUCCESS;
+    }
+
+    // otherwise start a new buffer at that position
+    AP4_Result result = SubmitBuffer();
+    m_BufferStart = position;
+
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::GetSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::GetSize(AP4_LargeSize& size)
+{
+    size = m_Size;
+    if (m_BufferStart+m_Buffer->GetDataSize() > size) {
+        size = m_BufferStart+m_Buffer->GetDataSize();
+    }
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream::Flush
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedOutputStream::Flush()
+{
+    SubmitBuffer();
+    while (!m_Pending.empty()) {
+        WaitForOldest();
+    }
+    if (AP4_FAILED(m_Error)) return m_Error;
+
+    return m_Sink->Flush();
+}
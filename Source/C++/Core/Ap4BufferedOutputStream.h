@@ -0,0 +1,125 @@
+/*****************************************************************
+|
+|    AP4 - Buffered Output Stream
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_BUFFERED_OUTPUT_STREAM_H_
+#define _AP4_BUFFERED_OUTPUT_STREAM_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+#include "Ap4Results.h"
+#include "Ap4ByteStream.h"
+#include "Ap4DataBuffer.h"
+#include "Ap4ThreadPool.h"
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <vector>
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size     AP4_BUFFERED_OUTPUT_STREAM_DEFAULT_BUFFER_SIZE  = 4*1024*1024;
+const AP4_Cardinal AP4_BUFFERED_OUTPUT_STREAM_DEFAULT_BUFFER_COUNT = 4;
+
+/*----------------------------------------------------------------------
+|   AP4_BufferedOutputStream
++---------------------------------------------------------------------*/
+/**
+ * Write-behind decorator for an output stream.
+ * Writes are collected into large buffers, and full buffers are written
+ * to the sink stream by a background thread, in the order in which they
+ * were produced, so that the caller does not wait for the I/O.
+ * Seeking back into the buffer being filled (to patch a size field, for
+ * example) is done in memory. Seeking anywhere else hands the current
+ * buffer to the background thread and starts a new one at the new
+ * position, so patches of data that has already been handed off are
+ * simply applied after it.
+ * At most buffer_count buffers are in flight at any time: when they are
+ * all in use, the caller waits for the oldest one to be written.
+ * Errors reported by the sink are returned by the next write, seek or
+ * flush. The sink must not be used directly until Flush() has returned.
+ */
+class AP4_BufferedOutputStream : public AP4_ByteStream
+{
+public:
+    AP4_BufferedOutputStream(std::shared_ptr<AP4_ByteStream> sink,
+                             AP4_Size     buffer_size  = AP4_BUFFERED_OUTPUT_STREAM_DEFAULT_BUFFER_SIZE,
+                             AP4_Cardinal buffer_count = AP4_BUFFERED_OUTPUT_STREAM_DEFAULT_BUFFER_COUNT);
+    virtual ~AP4_BufferedOutputStream();
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer, 
+                           AP4_Size  bytes_to_read, 
+                           AP4_Size& bytes_read);
+    AP4_Result WritePartial(const void* buffer, 
+                            AP4_Size    bytes_to_write, 
+                            AP4_Size&   bytes_written);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position) {
+        position = m_BufferStart+m_BufferPosition;
+        return AP4_SUCCESS;
+    }
+    AP4_Result GetSize(AP4_LargeSize& size);
+
+    /**
+     * Wait for all buffered data to be written to the sink, then flush the
+     * sink. Returns the first error reported while writing, if any.
+     */
+    AP4_Result Flush();
+
+private:
+    // types
+    struct PendingBuffer {
+        std::unique_ptr<AP4_DataBuffer> m_Buffer;
+        std::future<AP4_Result>         m_Result;
+    };
+
+    // methods
+    AP4_Result SubmitBuffer();
+    AP4_Result WaitForOldest();
+    AP4_Result WriteToSink(const AP4_DataBuffer& buffer, AP4_Position position);
+
+    // members
+    std::shared_ptr<AP4_ByteStream>              m_Sink;
+    AP4_Position                                 m_SinkPosition; // only used by the writer thread
+    AP4_LargeSize                                m_Size; // not counting the current buffer
+    AP4_Size                                     m_BufferSize;
+    AP4_Cardinal                                 m_BufferCount;
+    std::unique_ptr<AP4_DataBuffer>              m_Buffer;
+    AP4_Position                                 m_BufferStart;
+    AP4_Size                                     m_BufferPosition;
+    std::deque<PendingBuffer>                    m_Pending;
+    std::vector<std::unique_ptr<AP4_DataBuffer> > m_FreeBuffers;
+    AP4_Result                                   m_Error;
+    AP4_ThreadPool                               m_Writer;
+};
+
+#endif // _AP4_BUFFERED_OUTPUT_STREAM_H_
@@ -64,6 +64,31 @@ AP4_ByteStream::Read(void* buffer, AP4_Size bytes_to_read)
     return AP4_SUCCESS;
 }  
 
+/*----------------------------------------------------------------------
+|   AP4_ByteStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ByteStream::ReadAt(AP4_Position position, void* buffer, AP4_Size bytes_to_read)
+{
+    std::lock_guard<std::mutex> lock(m_ReadAtLock);
+
+    // remember the current position
+    AP4_Position saved_position;
+    AP4_Result result = Tell(saved_position);
+    if (AP4_FAILED(result)) return result;
+
+    // read from the requested position
+    result = Seek(position);
+    if (AP4_SUCCEEDED(result)) {
+        result = Read(buffer, bytes_to_read);
+    }
+
+    // restore the position
+    Seek(saved_position);
+
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Stream::Write
 +---------------------------------------------------------------------*/
@@ -513,6 +538,29 @@ AP4_SubStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SubStream::GetDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SubStream::GetDataView(AP4_Position     position,
+                           AP4_Size         size,
+                           const AP4_UI08*& data)
+{
+    data = NULL;
+    if (position+size > m_Size) return AP4_ERROR_OUT_OF_RANGE;
+    return m_Container->GetDataView(m_Offset+position, size, data);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SubStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SubStream::ReadAt(AP4_Position position, void* buffer, AP4_Size bytes_to_read)
+{
+    if (position+bytes_to_read > m_Size) return AP4_ERROR_EOS;
+    return m_Container->ReadAt(m_Offset+position, buffer, bytes_to_read);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_DupStream::AP4_DupStream
 +---------------------------------------------------------------------*/
@@ -553,6 +601,15 @@ AP4_DupStream::ReadPartial(void*     buffer,
     return result;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_DupStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_DupStream::ReadAt(AP4_Position position, void* buffer, AP4_Size bytes_to_read)
+{
+    return m_OriginalStream->ReadAt(position, buffer, bytes_to_read);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_DupStream::WritePartial
 +---------------------------------------------------------------------*/
@@ -684,6 +741,17 @@ AP4_MemoryByteStream::ReadPartial(void*     buffer,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MemoryByteStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MemoryByteStream::ReadAt(AP4_Position position, void* buffer, AP4_Size bytes_to_read)
+{
+    if (position+bytes_to_read > m_Buffer->GetDataSize()) return AP4_ERROR_EOS;
+    AP4_CopyMemory(buffer, m_Buffer->GetData()+position, bytes_to_read);
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_MemoryByteStream::WritePartial
 +---------------------------------------------------------------------*/
@@ -741,6 +809,183 @@ AP4_MemoryByteStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MemoryByteStream::GetDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MemoryByteStream::GetDataView(AP4_Position     position,
+                                  AP4_Size         size,
+                                  const AP4_UI08*& data)
+{
+    data = NULL;
+    if (position+size > m_Buffer->GetDataSize()) return AP4_ERROR_OUT_OF_RANGE;
+    data = m_Buffer->GetData()+position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::AP4_BufferChainByteStream
++---------------------------------------------------------------------*/
+AP4_BufferChainByteStream::AP4_BufferChainByteStream() :
+    m_Size(0),
+    m_Position(0),
+    m_SliceIndex(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::AppendSlice
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::AppendSlice(const Slice& slice)
+{
+    if (slice.m_Size == 0) return AP4_SUCCESS;
+
+    // extend the last slice if the new one follows it in the same buffer
+    AP4_Cardinal slice_count = m_Slices.ItemCount();
+    if (slice_count) {
+        Slice& last = m_Slices[slice_count-1];
+        if (last.m_Buffer == slice.m_Buffer && last.m_Offset+last.m_Size == slice.m_Offset) {
+            last.m_Size += slice.m_Size;
+            m_Size      += slice.m_Size;
+            return AP4_SUCCESS;
+        }
+    }
+
+    AP4_Result result = m_Slices.Append(slice);
+    if (AP4_FAILED(result)) return result;
+    m_Slices[slice_count].m_Position = m_Size;
+    m_Size += slice.m_Size;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::AppendReference
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::AppendReference(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                           AP4_Size                              offset,
+                                           AP4_Size                              size)
+{
+    if (!buffer) return AP4_ERROR_INVALID_PARAMETERS;
+    if ((AP4_UI64)offset+size > buffer->GetDataSize()) return AP4_ERROR_OUT_OF_RANGE;
+    Slice slice = { std::move(buffer), offset, size, 0 };
+    return AppendSlice(slice);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::AppendData
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::AppendData(const AP4_UI08* data, AP4_Size size)
+{
+    Slice slice = { NULL, m_Data.GetDataSize(), size, 0 };
+    AP4_Result result = m_Data.AppendData(data, size);
+    if (AP4_FAILED(result)) return result;
+    return AppendSlice(slice);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::ReadPartial(void*     buffer,
+                                       AP4_Size  bytes_to_read,
+                                       AP4_Size& bytes_read)
+{
+    // default values
+    bytes_read = 0;
+
+    // shortcut
+    if (bytes_to_read == 0) {
+        return AP4_SUCCESS;
+    }
+
+    // check for end of stream
+    if (m_Position >= m_Size) {
+        return AP4_ERROR_EOS;
+    }
+
+    // read from the slices, starting with the one at the current position
+    AP4_UI08* out = (AP4_UI08*)buffer;
+    while (bytes_to_read && m_SliceIndex < m_Slices.ItemCount()) {
+        const Slice& slice = m_Slices[m_SliceIndex];
+        AP4_Size slice_offset = (AP4_Size)(m_Position-slice.m_Position);
+        AP4_Size chunk = slice.m_Size-slice_offset;
+        if (chunk > bytes_to_read) chunk = bytes_to_read;
+        AP4_CopyMemory(out, GetSliceData(slice)+slice_offset, chunk);
+        out           += chunk;
+        bytes_read    += chunk;
+        bytes_to_read -= chunk;
+        m_Position    += chunk;
+        if (slice_offset+chunk == slice.m_Size) ++m_SliceIndex;
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::WritePartial(const void* /* buffer */,
+                                        AP4_Size    /* bytes_to_write */,
+                                        AP4_Size&   bytes_written)
+{
+    bytes_written = 0;
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::Seek(AP4_Position position)
+{
+    if (position > m_Size) return AP4_ERROR_OUT_OF_RANGE;
+
+    // binary search for the slice that contains the position
+    AP4_Cardinal low  = 0;
+    AP4_Cardinal high = m_Slices.ItemCount();
+    while (low < high) {
+        AP4_Cardinal middle = low+(high-low)/2;
+        if (m_Slices[middle].m_Position+m_Slices[middle].m_Size <= position) {
+            low = middle+1;
+        } else {
+            high = middle;
+        }
+    }
+    m_SliceIndex = low;
+    m_Position   = position;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream::CopyTo
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferChainByteStream::CopyTo(AP4_ByteStream& stream, AP4_LargeSize size)
+{
+    if (m_Position+size > m_Size) return AP4_ERROR_EOS;
+
+    // write directly from the slices, without an intermediate buffer
+    while (size) {
+        const Slice& slice = m_Slices[m_SliceIndex];
+        AP4_Size slice_offset = (AP4_Size)(m_Position-slice.m_Position);
+        AP4_Size chunk = slice.m_Size-slice_offset;
+        if (chunk > size) chunk = (AP4_Size)size;
+        AP4_Result result = stream.Write(GetSliceData(slice)+slice_offset, chunk);
+        if (AP4_FAILED(result)) return result;
+        size       -= chunk;
+        m_Position += chunk;
+        if (slice_offset+chunk == slice.m_Size) ++m_SliceIndex;
+    }
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_BufferedInputStream::AP4_BufferedInputStream
 +---------------------------------------------------------------------*/
@@ -820,6 +1065,22 @@ AP4_BufferedInputStream::ReadPartial(void*     buffer,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_BufferedInputStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_BufferedInputStream::ReadAt(AP4_Position position, void* buffer, AP4_Size bytes_to_read)
+{
+    // serve the read from the buffer if it is entirely in there, otherwise
+    // go to the source directly, without disturbing the buffer
+    AP4_Position buffer_start = m_SourcePosition-m_Buffer.GetDataSize();
+    if (position >= buffer_start && position+bytes_to_read <= m_SourcePosition) {
+        AP4_CopyMemory(buffer, m_Buffer.GetData()+(position-buffer_start), bytes_to_read);
+        return AP4_SUCCESS;
+    }
+    return m_Source->ReadAt(position, buffer, bytes_to_read);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_BufferedInputStream::WritePartial
 +---------------------------------------------------------------------*/
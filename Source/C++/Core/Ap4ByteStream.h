@@ -38,8 +38,10 @@
 #include "Ap4Interfaces.h"
 #include "Ap4Results.h"
 #include "Ap4DataBuffer.h"
+#include "Ap4Array.h"
 
 #include <memory>
+#include <mutex>
 
 /*----------------------------------------------------------------------
 |   class references
@@ -83,6 +85,42 @@ class AP4_ByteStream
     virtual AP4_Result GetSize(AP4_LargeSize& size) = 0;
     virtual AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
     virtual AP4_Result Flush() { return AP4_SUCCESS; }
+
+    /**
+     * Get a read-only pointer to a range of the stream data, without copying.
+     * This is only supported by streams whose data is already in memory
+     * (memory streams, memory-mapped files, and sub-streams of those).
+     * The pointer remains valid until the stream is written to or destroyed.
+     * This does not change the current stream position.
+     *
+     * @return AP4_SUCCESS if the view can be obtained, AP4_ERROR_NOT_SUPPORTED
+     * if the stream does not support views, or AP4_ERROR_OUT_OF_RANGE if the
+     * range is not entirely within the stream.
+     */
+    virtual AP4_Result GetDataView(AP4_Position     /* position */,
+                                   AP4_Size         /* size */,
+                                   const AP4_UI08*& data) {
+        data = NULL;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+
+    /**
+     * Read exactly bytes_to_read bytes starting at the given position,
+     * without using or changing the current stream position.
+     * ReadAt may be called from several threads at the same time on the
+     * same stream, which is what concurrent readers of a parsed AP4_File
+     * rely on. Subclasses should override this with a native positional
+     * read where they can. The default implementation emulates it with
+     * Seek and Read under a lock, so it is only safe with respect to
+     * other ReadAt calls, not to concurrent Seek/Read on the same stream.
+     */
+    virtual AP4_Result ReadAt(AP4_Position position,
+                              void*        buffer,
+                              AP4_Size     bytes_to_read);
+
+private:
+    // members
+    std::mutex m_ReadAtLock;
 };
 
 /*----------------------------------------------------------------------
@@ -111,6 +149,12 @@ class AP4_SubStream : public AP4_ByteStream
         size = m_Size;
         return AP4_SUCCESS;
     }
+    AP4_Result GetDataView(AP4_Position     position,
+                           AP4_Size         size,
+                           const AP4_UI08*& data);
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
 
  private:
     std::shared_ptr<AP4_ByteStream> m_Container;
@@ -142,6 +186,9 @@ class AP4_DupStream : public AP4_ByteStream
     AP4_Result GetSize(AP4_LargeSize& size) {
         return m_OriginalStream->GetSize(size);
     }
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
 
  private:
     std::shared_ptr<AP4_ByteStream> m_OriginalStream;
@@ -176,6 +223,12 @@ public:
         size = m_Buffer->GetDataSize();
         return AP4_SUCCESS;
     }
+    AP4_Result GetDataView(AP4_Position     position,
+                           AP4_Size         size,
+                           const AP4_UI08*& data);
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
 
     // methods
     const AP4_UI08* GetData()     { return m_Buffer->GetData(); }
@@ -188,6 +241,67 @@ private:
     AP4_Position    m_Position;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_BufferChainByteStream
++---------------------------------------------------------------------*/
+/**
+ * Read-only stream made of a chain of slices of reference-counted buffers.
+ * The buffers are not copied: the stream keeps a reference to them, so they
+ * must not be modified after they are appended. Small amounts of data (like
+ * the length prefixes of NAL units) can also be appended by value.
+ */
+class AP4_BufferChainByteStream : public AP4_ByteStream
+{
+public:
+    AP4_BufferChainByteStream();
+
+    // methods
+    AP4_Result AppendReference(std::shared_ptr<const AP4_DataBuffer> buffer,
+                               AP4_Size                              offset,
+                               AP4_Size                              size);
+    AP4_Result AppendData(const AP4_UI08* data, AP4_Size size);
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer,
+                           AP4_Size  bytes_to_read,
+                           AP4_Size& bytes_read);
+    AP4_Result WritePartial(const void* buffer,
+                            AP4_Size    bytes_to_write,
+                            AP4_Size&   bytes_written);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position) {
+        position = m_Position;
+        return AP4_SUCCESS;
+    }
+    AP4_Result GetSize(AP4_LargeSize& size) {
+        size = m_Size;
+        return AP4_SUCCESS;
+    }
+    AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
+
+private:
+    // types
+    struct Slice {
+        std::shared_ptr<const AP4_DataBuffer> m_Buffer; // NULL for data stored in m_Data
+        AP4_Size                              m_Offset;
+        AP4_Size                              m_Size;
+        AP4_Position                          m_Position; // position of the slice in the stream
+    };
+
+    // methods
+    const AP4_UI08* GetSliceData(const Slice& slice) {
+        return (slice.m_Buffer ? slice.m_Buffer->GetData() : m_Data.GetData())+slice.m_Offset;
+    }
+    AP4_Result AppendSlice(const Slice& slice);
+
+    // members
+    AP4_Array<Slice> m_Slices;
+    AP4_DataBuffer   m_Data;
+    AP4_LargeSize    m_Size;
+    AP4_Position     m_Position;
+    AP4_Cardinal     m_SliceIndex; // slice that contains m_Position
+};
+
 /*----------------------------------------------------------------------
 |   AP4_BufferedInputStream
 +---------------------------------------------------------------------*/
@@ -208,6 +322,9 @@ public:
     AP4_Result Seek(AP4_Position position);
     AP4_Result Tell(AP4_Position& position);
     AP4_Result GetSize(AP4_LargeSize& size) { return m_Source->GetSize(size); }
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
 
 protected:
     AP4_Result Refill();
@@ -49,7 +49,21 @@ AP4_Co64Atom::Create(AP4_Size size, AP4_ByteStream& stream)
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_Co64Atom(size, version, flags, stream);
+    return new AP4_Co64Atom(size, version, flags, stream, nullptr);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Co64Atom::CreateDeferred
++---------------------------------------------------------------------*/
+AP4_Co64Atom*
+AP4_Co64Atom::CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(*stream, version, flags))) return NULL;
+    if (version != 0) return NULL;
+    return new AP4_Co64Atom(size, version, flags, *stream, stream);
 }
 
 /*----------------------------------------------------------------------
@@ -68,22 +82,55 @@ AP4_Atom(AP4_ATOM_TYPE_CO64,
 /*----------------------------------------------------------------------
 |   AP4_Co64Atom::AP4_Co64Atom
 +---------------------------------------------------------------------*/
-AP4_Co64Atom::AP4_Co64Atom(AP4_UI32        size, 
-                           AP4_UI08        version,
-                           AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_CO64, size, version, flags)
+AP4_Co64Atom::AP4_Co64Atom(AP4_UI32                        size, 
+                           AP4_UI08                        version,
+                           AP4_UI32                        flags,
+                           AP4_ByteStream&                 stream,
+                           std::shared_ptr<AP4_ByteStream> deferred_source) :
+    AP4_Atom(AP4_ATOM_TYPE_CO64, size, version, flags),
+    m_Entries(NULL),
+    m_EntryCount(0)
 {
     stream.ReadUI32(m_EntryCount);
     if (m_EntryCount > (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8) {
         m_EntryCount = (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8;
     }
+
+    // defer reading the entries until they are needed
+    if (deferred_source) {
+        if (AP4_FAILED(m_DeferredEntries.Attach(std::move(deferred_source), m_EntryCount*8))) {
+            m_EntryCount = 0;
+        }
+        return;
+    }
+
     m_Entries = new AP4_UI64[m_EntryCount];
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         stream.ReadUI64(m_Entries[i]);
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Co64Atom::LoadEntries
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Co64Atom::LoadEntries()
+{
+    unsigned char* buffer = new unsigned char[m_EntryCount*8];
+    AP4_Result     result = m_DeferredEntries.Load(buffer);
+    if (AP4_FAILED(result)) {
+        delete[] buffer;
+        return result;
+    }
+    m_Entries = new AP4_UI64[m_EntryCount];
+    for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
+        m_Entries[i] = AP4_BytesToUInt64BE(&buffer[i*8]);
+    }
+    delete[] buffer;
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Co64Atom::~AP4_Co64Atom
 +---------------------------------------------------------------------*/
@@ -98,6 +145,9 @@ AP4_Co64Atom::~AP4_Co64Atom()
 AP4_Result
 AP4_Co64Atom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI64& chunk_offset)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     // check the bounds
     if (chunk > m_EntryCount || chunk == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
@@ -115,6 +165,9 @@ AP4_Co64Atom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI64& chunk_offset)
 AP4_Result
 AP4_Co64Atom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI64 chunk_offset)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     // check the bounds
     if (chunk > m_EntryCount || chunk == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
@@ -132,6 +185,9 @@ AP4_Co64Atom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI64 chunk_offset)
 AP4_Result
 AP4_Co64Atom::AdjustChunkOffsets(AP4_SI64 delta)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         m_Entries[i] += delta;
     }
@@ -145,7 +201,8 @@ AP4_Co64Atom::AdjustChunkOffsets(AP4_SI64 delta)
 AP4_Result
 AP4_Co64Atom::WriteFields(AP4_ByteStream& stream)
 {
-    AP4_Result result;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
 
     // entry count
     result = stream.WriteUI32(m_EntryCount);
@@ -168,6 +225,8 @@ AP4_Co64Atom::InspectFields(AP4_AtomInspector& inspector)
 {
     inspector.AddField("entry_count", m_EntryCount);
     if (inspector.GetVerbosity() >= 1) {
+        AP4_Result result = EnsureEntries();
+        if (AP4_FAILED(result)) return result;
         inspector.StartArray("entries", m_EntryCount);
         for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
             inspector.AddField(NULL, m_Entries[i]);
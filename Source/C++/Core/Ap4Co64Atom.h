@@ -45,6 +45,11 @@ public:
 
     // class methods
     static AP4_Co64Atom* Create(AP4_Size size, AP4_ByteStream& stream);
+    /**
+     * Create an atom whose entries are only decoded on first access.
+     * The stream must remain valid, and its content unchanged, until then.
+     */
+    static AP4_Co64Atom* CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream);
 
     // methods
     AP4_Co64Atom(AP4_UI64* offsets, AP4_UI32 offset_count);
@@ -52,21 +57,25 @@ public:
     virtual AP4_Result InspectFields(AP4_AtomInspector& inspector);
     virtual AP4_Result WriteFields(AP4_ByteStream& stream);
     AP4_Cardinal GetChunkCount()   { return m_EntryCount; }
-    AP4_UI64*    GetChunkOffsets() { return m_Entries;    }
+    AP4_UI64*    GetChunkOffsets() { return AP4_SUCCEEDED(EnsureEntries()) ? m_Entries : NULL; }
     AP4_Result   GetChunkOffset(AP4_Ordinal chunk, AP4_UI64& chunk_offset);
     AP4_Result   SetChunkOffset(AP4_Ordinal chunk, AP4_UI64  chunk_offset);
     AP4_Result   AdjustChunkOffsets(AP4_SI64 delta);
 
 private:
     // methods
-    AP4_Co64Atom(AP4_UI32        size, 
-                 AP4_UI08        version,
-                 AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+    AP4_Co64Atom(AP4_UI32                        size, 
+                 AP4_UI08                        version,
+                 AP4_UI32                        flags,
+                 AP4_ByteStream&                 stream,
+                 std::shared_ptr<AP4_ByteStream> deferred_source);
+    AP4_Result LoadEntries();
+    AP4_Result EnsureEntries() { return m_DeferredEntries.Resolve([this] { return LoadEntries(); }); }
 
     // members
-    AP4_UI64* m_Entries;
-    AP4_UI32  m_EntryCount;
+    AP4_UI64*           m_Entries;
+    AP4_UI32            m_EntryCount;
+    AP4_DeferredPayload m_DeferredEntries;
 };
 
 #endif // _AP4_CO64_ATOM_H_
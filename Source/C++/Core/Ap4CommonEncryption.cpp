@@ -504,6 +504,35 @@ AP4_CencSampleEncrypter::~AP4_CencSampleEncrypter()
     delete m_Cipher;
 }
 
+/*----------------------------------------------------------------------
+|   AdvanceCtrIv
++---------------------------------------------------------------------*/
+static AP4_Result
+AdvanceCtrIv(AP4_UI08* iv, unsigned int iv_size, AP4_UI64 encrypted_size)
+{
+    if (iv_size == 16) {
+        // the counter runs on from one sample to the next
+        AP4_UI64 counter = AP4_BytesToUInt64BE(&iv[8]);
+        AP4_BytesFromUInt64BE(&iv[8], counter+(encrypted_size+15)/16);
+    } else if (iv_size == 8) {
+        AP4_UI64 counter = AP4_BytesToUInt64BE(&iv[0]);
+        AP4_BytesFromUInt64BE(&iv[0], counter+1);
+    } else {
+        return AP4_ERROR_INTERNAL;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSampleEncrypter::AdvanceIv
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSampleEncrypter::AdvanceIv(AP4_UI64 encrypted_size)
+{
+    return AdvanceCtrIv(m_Iv, m_IvSize, encrypted_size);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencCtrSampleEncrypter::EncryptSampleData
 +---------------------------------------------------------------------*/
@@ -530,18 +559,16 @@ AP4_CencCtrSampleEncrypter::EncryptSampleData(AP4_DataBuffer& data_in,
     }
     
     // update the IV
-    if (m_IvSize == 16) {
-        unsigned int block_count = (data_in.GetDataSize()+15)/16;
-        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
-        AP4_BytesFromUInt64BE(&m_Iv[8], counter+block_count);
-    } else if (m_IvSize == 8){
-        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
-        AP4_BytesFromUInt64BE(&m_Iv[0], counter+1);
-    } else {
-        return AP4_ERROR_INTERNAL;
-    }
-    
-    return AP4_SUCCESS;
+    return AdvanceIv(data_in.GetDataSize());
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSubSampleEncrypter::AdvanceIv
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSubSampleEncrypter::AdvanceIv(AP4_UI64 encrypted_size)
+{
+    return AdvanceCtrIv(m_Iv, m_IvSize, encrypted_size);
 }
 
 /*----------------------------------------------------------------------
@@ -563,7 +590,7 @@ AP4_CencCtrSubSampleEncrypter::EncryptSampleData(AP4_DataBuffer& data_in,
     AP4_UI08*       out = data_out.UseData();
     
     // setup the IV
-    unsigned int total_encrypted = 0;
+    AP4_UI64 total_encrypted = 0;
     m_Cipher->SetIV(m_Iv);
 
     // get the subsample map
@@ -572,34 +599,25 @@ AP4_CencCtrSubSampleEncrypter::EncryptSampleData(AP4_DataBuffer& data_in,
     AP4_Result result = m_SubSampleMapper->GetSubSampleMap(data_in, bytes_of_cleartext_data, bytes_of_encrypted_data);
     if (AP4_FAILED(result)) return result;
 
-    // process the data
-    for (unsigned int i=0; i<bytes_of_cleartext_data.ItemCount(); i++) {
-        // copy the cleartext portion
-        AP4_CopyMemory(out, in, bytes_of_cleartext_data[i]);
-        
-        // encrypt the rest
-        if (bytes_of_encrypted_data[i]) {
-            AP4_Size out_size = bytes_of_encrypted_data[i];
-            m_Cipher->ProcessBuffer(in+bytes_of_cleartext_data[i], 
-                                    bytes_of_encrypted_data[i], 
-                                    out+bytes_of_cleartext_data[i], 
-                                    &out_size);
-            total_encrypted += bytes_of_encrypted_data[i];
-        }
-        
-        // move the pointers
-        in  += bytes_of_cleartext_data[i]+bytes_of_encrypted_data[i];
-        out += bytes_of_cleartext_data[i]+bytes_of_encrypted_data[i];
+    // process the data, the counter runs on from one subsample to the next
+    // (ProcessSubSamples only joins the ranges when that can't change the
+    // output)
+    if (bytes_of_cleartext_data.ItemCount()) {
+        result = m_Cipher->ProcessSubSamples(in,
+                                             out,
+                                             bytes_of_cleartext_data.ItemCount(),
+                                             &bytes_of_cleartext_data[0],
+                                             &bytes_of_encrypted_data[0],
+                                             m_Scratch);
+        if (AP4_FAILED(result)) return result;
+    }
+    for (unsigned int i=0; i<bytes_of_encrypted_data.ItemCount(); i++) {
+        total_encrypted += bytes_of_encrypted_data[i];
     }
     
     // update the IV
-    if (m_IvSize == 16) {
-        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
-        AP4_BytesFromUInt64BE(&m_Iv[8], counter+(total_encrypted+15)/16);
-    } else {
-        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
-        AP4_BytesFromUInt64BE(&m_Iv[0], counter+1);
-    }
+    result = AdvanceIv(total_encrypted);
+    if (AP4_FAILED(result)) return result;
     
     // encode the sample infos
     unsigned int sample_info_count = bytes_of_cleartext_data.ItemCount();
@@ -887,17 +905,87 @@ AP4_CencTrackEncrypter::ProcessSample(AP4_DataBuffer& data_in,
     return data_out.SetData(data_in.GetData(), data_in.GetDataSize());
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentSubSampleMapper
+|
+|   Subsample mapper that returns, in order, the subsample maps computed
+|   for the samples of a fragment before they are encrypted.
++---------------------------------------------------------------------*/
+class AP4_CencFragmentSubSampleMapper : public AP4_CencSubSampleMapper
+{
+public:
+    // constructor
+    AP4_CencFragmentSubSampleMapper() :
+        AP4_CencSubSampleMapper(0, 0),
+        m_NextSample(0),
+        m_NextEntry(0) {}
+    
+    // methods
+    AP4_Result AddSubSampleMap(const AP4_Array<AP4_UI16>& bytes_of_cleartext_data,
+                               const AP4_Array<AP4_UI32>& bytes_of_encrypted_data);
+    virtual AP4_Result GetSubSampleMap(AP4_DataBuffer&      sample_data,
+                                       AP4_Array<AP4_UI16>& bytes_of_cleartext_data,
+                                       AP4_Array<AP4_UI32>& bytes_of_encrypted_data);
+
+private:
+    // members
+    AP4_Array<AP4_Cardinal> m_EntryCounts; // one per sample
+    AP4_Array<AP4_UI16>     m_BytesOfCleartextData;
+    AP4_Array<AP4_UI32>     m_BytesOfEncryptedData;
+    AP4_Ordinal             m_NextSample;
+    AP4_Ordinal             m_NextEntry;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentSubSampleMapper::AddSubSampleMap
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencFragmentSubSampleMapper::AddSubSampleMap(const AP4_Array<AP4_UI16>& bytes_of_cleartext_data,
+                                                 const AP4_Array<AP4_UI32>& bytes_of_encrypted_data)
+{
+    if (bytes_of_cleartext_data.ItemCount() != bytes_of_encrypted_data.ItemCount()) {
+        return AP4_ERROR_INVALID_PARAMETERS;
+    }
+    for (unsigned int i=0; i<bytes_of_cleartext_data.ItemCount(); i++) {
+        m_BytesOfCleartextData.Append(bytes_of_cleartext_data[i]);
+        m_BytesOfEncryptedData.Append(bytes_of_encrypted_data[i]);
+    }
+    return m_EntryCounts.Append(bytes_of_cleartext_data.ItemCount());
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentSubSampleMapper::GetSubSampleMap
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencFragmentSubSampleMapper::GetSubSampleMap(AP4_DataBuffer&      /* sample_data */,
+                                                 AP4_Array<AP4_UI16>& bytes_of_cleartext_data,
+                                                 AP4_Array<AP4_UI32>& bytes_of_encrypted_data)
+{
+    if (m_NextSample >= m_EntryCounts.ItemCount()) return AP4_ERROR_INVALID_STATE;
+    for (unsigned int i=0; i<m_EntryCounts[m_NextSample]; i++, m_NextEntry++) {
+        bytes_of_cleartext_data.Append(m_BytesOfCleartextData[m_NextEntry]);
+        bytes_of_encrypted_data.Append(m_BytesOfEncryptedData[m_NextEntry]);
+    }
+    ++m_NextSample;
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencFragmentEncrypter
 +---------------------------------------------------------------------*/
 class AP4_CencFragmentEncrypter : public AP4_Processor::FragmentHandler {
 public:
-    // constructor
+    // constructor and destructor
     AP4_CencFragmentEncrypter(AP4_CencVariant                         variant,
                               AP4_UI32                                options,
                               AP4_ContainerAtom*                      traf,
                               AP4_CencEncryptingProcessor::Encrypter* encrypter,
-                              AP4_UI32                                cleartext_sample_description_index);
+                              bool                                    cleartext,
+                              AP4_UI32                                cleartext_sample_description_index,
+                              AP4_CencSampleEncrypter*                fragment_sample_encrypter,
+                              AP4_CencFragmentSubSampleMapper*        fragment_subsample_mapper);
+    ~AP4_CencFragmentEncrypter();
 
     // methods
     virtual AP4_Result ProcessFragment();
@@ -905,6 +993,7 @@ public:
                                      AP4_DataBuffer& data_out);
     virtual AP4_Result PrepareForSamples(AP4_FragmentSampleTable* sample_table);
     virtual AP4_Result FinishFragment();
+    virtual bool       IsIndependent() { return m_Cleartext || m_FragmentSampleEncrypter; }
     
 private:
     // members
@@ -916,7 +1005,10 @@ private:
     AP4_SaizAtom*                           m_Saiz;
     AP4_SaioAtom*                           m_Saio;
     AP4_CencEncryptingProcessor::Encrypter* m_Encrypter;
+    bool                                    m_Cleartext; // in the cleartext lead
     AP4_UI32                                m_CleartextSampleDescriptionIndex;
+    AP4_CencSampleEncrypter*                m_FragmentSampleEncrypter; // NULL when the track's encrypter is used
+    AP4_CencFragmentSubSampleMapper*        m_FragmentSubSampleMapper; // owned by m_FragmentSampleEncrypter
 };
 
 /*----------------------------------------------------------------------
@@ -926,7 +1018,10 @@ AP4_CencFragmentEncrypter::AP4_CencFragmentEncrypter(AP4_CencVariant
                                                      AP4_UI32                                options,
                                                      AP4_ContainerAtom*                      traf,
                                                      AP4_CencEncryptingProcessor::Encrypter* encrypter,
-                                                     AP4_UI32                                cleartext_sample_description_index) :
+                                                     bool                                    cleartext,
+                                                     AP4_UI32                                cleartext_sample_description_index,
+                                                     AP4_CencSampleEncrypter*                fragment_sample_encrypter,
+                                                     AP4_CencFragmentSubSampleMapper*        fragment_subsample_mapper) :
     m_Variant(variant),
     m_Options(options),
     m_Traf(traf),
@@ -935,8 +1030,19 @@ AP4_CencFragmentEncrypter::AP4_CencFragmentEncrypter(AP4_CencVariant
     m_Saiz(NULL),
     m_Saio(NULL),
     m_Encrypter(encrypter),
-    m_CleartextSampleDescriptionIndex(cleartext_sample_description_index)
+    m_Cleartext(cleartext),
+    m_CleartextSampleDescriptionIndex(cleartext_sample_description_index),
+    m_FragmentSampleEncrypter(fragment_sample_encrypter),
+    m_FragmentSubSampleMapper(fragment_subsample_mapper)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::~AP4_CencFragmentEncrypter
++---------------------------------------------------------------------*/
+AP4_CencFragmentEncrypter::~AP4_CencFragmentEncrypter()
 {
+    delete m_FragmentSampleEncrypter;
 }
 
 /*----------------------------------------------------------------------
@@ -959,7 +1065,7 @@ AP4_CencFragmentEncrypter::ProcessFragment()
     }
     
     // if we're still in the cleartext lead, update the tfhd and stop
-    if (m_Encrypter->m_CurrentFragment < m_Encrypter->m_CleartextFragments && m_CleartextSampleDescriptionIndex) {
+    if (m_Cleartext && m_CleartextSampleDescriptionIndex) {
         if (tfhd) {
             tfhd->SetSampleDescriptionIndex(m_CleartextSampleDescriptionIndex);
             tfhd->SetFlags(tfhd->GetFlags() | AP4_TFHD_FLAG_SAMPLE_DESCRIPTION_INDEX_PRESENT);
@@ -1053,10 +1159,17 @@ AP4_CencFragmentEncrypter::ProcessFragment()
 AP4_Result 
 AP4_CencFragmentEncrypter::PrepareForSamples(AP4_FragmentSampleTable* sample_table) {
     // do nothing if we're still in the clear lead part
-    if (m_Encrypter->m_CurrentFragment < m_Encrypter->m_CleartextFragments) {
+    if (m_Cleartext) {
         return AP4_SUCCESS;
     }
 
+    // the samples of the fragment are encrypted with the current IV of the
+    // track, which then moves on past them for the next fragment
+    AP4_CencSampleEncrypter* track_sample_encrypter = m_Encrypter->m_SampleEncrypter;
+    if (m_FragmentSampleEncrypter) {
+        m_FragmentSampleEncrypter->SetIv(track_sample_encrypter->GetIv());
+    }
+
     AP4_Cardinal sample_count = sample_table->GetSampleCount();
 
     // resize the saio atom if we have one
@@ -1064,7 +1177,16 @@ AP4_CencFragmentEncrypter::PrepareForSamples(AP4_FragmentSampleTable* sample_tab
         m_Saio->AddEntry(0); // we'll compute the offset later
     }
     
-    if (!m_Encrypter->m_SampleEncrypter->UseSubSamples()) {
+    if (!track_sample_encrypter->UseSubSamples()) {
+        if (m_FragmentSampleEncrypter) {
+            for (unsigned int i=0; i<sample_count; i++) {
+                AP4_Sample sample;
+                AP4_Result result = sample_table->GetSample(i, sample);
+                if (AP4_FAILED(result)) return result;
+                result = track_sample_encrypter->AdvanceIv(sample.GetSize());
+                if (AP4_FAILED(result)) return result;
+            }
+        }
         m_SampleEncryptionAtom->SetSampleInfosSize(sample_count*m_SampleEncryptionAtom->GetPerSampleIvSize());
         if (m_SampleEncryptionAtomShadow) {
             m_SampleEncryptionAtomShadow->SetSampleInfosSize(sample_count*m_SampleEncryptionAtomShadow->GetPerSampleIvSize());
@@ -1099,11 +1221,21 @@ AP4_CencFragmentEncrypter::PrepareForSamples(AP4_FragmentSampleTable* sample_tab
         if (AP4_FAILED(result)) return result;
         bytes_of_cleartext_data.SetItemCount(0);
         bytes_of_encrypted_data.SetItemCount(0);
-        result = m_Encrypter->m_SampleEncrypter->GetSubSampleMap(sample_data, 
-                                                                 bytes_of_cleartext_data,
-                                                                 bytes_of_encrypted_data);
+        result = track_sample_encrypter->GetSubSampleMap(sample_data, 
+                                                         bytes_of_cleartext_data,
+                                                         bytes_of_encrypted_data);
         if (AP4_FAILED(result)) return result;
         sample_info_size += 2+bytes_of_cleartext_data.ItemCount()*6;
+        if (m_FragmentSampleEncrypter) {
+            AP4_UI64 encrypted_size = 0;
+            for (unsigned int j=0; j<bytes_of_encrypted_data.ItemCount(); j++) {
+                encrypted_size += bytes_of_encrypted_data[j];
+            }
+            result = track_sample_encrypter->AdvanceIv(encrypted_size);
+            if (AP4_FAILED(result)) return result;
+            result = m_FragmentSubSampleMapper->AddSubSampleMap(bytes_of_cleartext_data, bytes_of_encrypted_data);
+            if (AP4_FAILED(result)) return result;
+        }
         
         if (m_Saiz) {
             m_Saiz->SetSampleInfoSize(i, (AP4_UI08)(m_SampleEncryptionAtom->GetPerSampleIvSize()+2+bytes_of_cleartext_data.ItemCount()*6));
@@ -1125,18 +1257,21 @@ AP4_CencFragmentEncrypter::ProcessSample(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out)
 {
     // just copy data if we're still in the clear lead part
-    if (m_Encrypter->m_CurrentFragment < m_Encrypter->m_CleartextFragments) {
+    if (m_Cleartext) {
         data_out.SetData(data_in.GetData(), data_in.GetDataSize());
         return AP4_SUCCESS;
     }
     
     // copy the current IV
+    AP4_CencSampleEncrypter* sample_encrypter = m_FragmentSampleEncrypter ? 
+                                                m_FragmentSampleEncrypter :
+                                                m_Encrypter->m_SampleEncrypter;
     AP4_UI08 iv[16];
-    AP4_CopyMemory(iv, m_Encrypter->m_SampleEncrypter->GetIv(), 16);
+    AP4_CopyMemory(iv, sample_encrypter->GetIv(), 16);
     
     // encrypt the sample
     AP4_DataBuffer sample_infos;
-    AP4_Result result = m_Encrypter->m_SampleEncrypter->EncryptSampleData(data_in, data_out, sample_infos);
+    AP4_Result result = sample_encrypter->EncryptSampleData(data_in, data_out, sample_infos);
     if (AP4_FAILED(result)) return result;
 
     // update the sample info
@@ -1154,9 +1289,7 @@ AP4_CencFragmentEncrypter::ProcessSample(AP4_DataBuffer& data_in,
 AP4_Result 
 AP4_CencFragmentEncrypter::FinishFragment()
 {
-    if (m_Encrypter->m_CurrentFragment++ < m_Encrypter->m_CleartextFragments) {
-        return AP4_SUCCESS;
-    }
+    if (m_Cleartext) return AP4_SUCCESS;
 
     if (!m_Saio) return AP4_SUCCESS;
 
@@ -1496,8 +1629,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
     AP4_Processor::TrackHandler* track_encrypter;
     AP4_UI08                     cipher_iv_size = 16;
     AP4_BlockCipher::CipherMode  cipher_mode;
-    AP4_BlockCipher::CtrParams   cipher_ctr_params;
-    const void*                  cipher_mode_params = NULL;
     AP4_UI08                     crypt_byte_block = 0;
     AP4_UI08                     skip_byte_block = 0;
     bool                         constant_iv = false;
@@ -1505,8 +1636,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
     switch (m_Variant) {
         case AP4_CENC_VARIANT_PIFF_CTR:
             cipher_mode = AP4_BlockCipher::CTR;
-            cipher_ctr_params.counter_size = 8;
-            cipher_mode_params = &cipher_ctr_params;
             cipher_iv_size = 8;
             track_encrypter = new AP4_CencTrackEncrypter(m_Variant,
                                                          1,
@@ -1536,8 +1665,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             
         case AP4_CENC_VARIANT_MPEG_CENC:
             cipher_mode = AP4_BlockCipher::CTR;
-            cipher_ctr_params.counter_size = 8;
-            cipher_mode_params = &cipher_ctr_params;
             if ((m_Options & OPTION_IV_SIZE_8) ||
                 ((m_Options & OPTION_PIFF_COMPATIBILITY) && !(m_Options & OPTION_PIFF_IV_SIZE_16))) {
                 cipher_iv_size = 8;
@@ -1557,8 +1684,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             
         case AP4_CENC_VARIANT_MPEG_CENS:
             cipher_mode = AP4_BlockCipher::CTR;
-            cipher_ctr_params.counter_size = 8;
-            cipher_mode_params = &cipher_ctr_params;
             if (m_Options & OPTION_IV_SIZE_8) {
                 cipher_iv_size = 8;
             }
@@ -1616,20 +1741,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             return NULL;
     }
     
-    // create a block cipher
-    AP4_BlockCipher* block_cipher = NULL;
-    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128,
-                                                           AP4_BlockCipher::ENCRYPT, 
-                                                           cipher_mode,
-                                                           cipher_mode_params,
-                                                           key->GetData(), 
-                                                           key->GetDataSize(), 
-                                                           block_cipher);
-    if (AP4_FAILED(result)) {
-        delete track_encrypter;
-        return NULL;
-    }
-    
     // compute the size of NAL units
     unsigned int nalu_length_size = 0;
     if (format == AP4_ATOM_TYPE_AVC1 ||
@@ -1653,70 +1764,116 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
     }
 
     // add a new cipher state for this track
+    SampleEncrypterParams sample_encrypter_params;
+    sample_encrypter_params.m_CipherMode             = cipher_mode;
+    sample_encrypter_params.m_Key.SetData(key->GetData(), key->GetDataSize());
+    sample_encrypter_params.m_IvSize                 = cipher_iv_size;
+    sample_encrypter_params.m_CryptByteBlock         = crypt_byte_block;
+    sample_encrypter_params.m_SkipByteBlock          = skip_byte_block;
+    sample_encrypter_params.m_ConstantIv             = constant_iv;
+    sample_encrypter_params.m_ResetIvAtEachSubsample = reset_iv_at_each_subsample;
+    sample_encrypter_params.m_UseSubSamples          = nalu_length_size != 0;
+    AP4_CencSubSampleMapper* subsample_mapper = NULL;
+    if (nalu_length_size) {
+        if (cipher_mode == AP4_BlockCipher::CTR) {
+            subsample_mapper = new AP4_CencAdvancedSubSampleMapper(nalu_length_size, format);
+        } else if (m_Variant == AP4_CENC_VARIANT_MPEG_CBCS) {
+            subsample_mapper = new AP4_CencCbcsSubSampleMapper(nalu_length_size, format, trak);
+        } else {
+            subsample_mapper = new AP4_CencBasicSubSampleMapper(nalu_length_size, format);
+        }
+    }
     AP4_CencSampleEncrypter* sample_encrypter = NULL;
-    AP4_StreamCipher*        stream_cipher = NULL;
-    switch (cipher_mode) {
+    AP4_Result result = CreateSampleEncrypter(sample_encrypter_params, subsample_mapper, sample_encrypter);
+    if (AP4_FAILED(result)) {
+        delete track_encrypter;
+        return NULL;
+    }
+    sample_encrypter->SetIv(iv->GetData());
+
+    // if we need to leave some samples unencrypted, create clones of the sample descriptions
+    const char* clear_lead = m_PropertyMap.GetProperty(trak->GetId(), "ClearLeadFragments");
+    AP4_UI32 clear_fragments = 0;
+    if (clear_lead) {
+        clear_fragments = AP4_ParseIntegerU(clear_lead);
+        unsigned int sample_description_count = stsd->GetSampleDescriptionCount();
+        for (unsigned int i=0; i<sample_description_count; i++) {
+            stsd->AddChild(stsd->GetSampleEntry(i)->Clone());
+        }
+    }
+    
+    m_Encrypters.Add(new Encrypter(trak->GetId(), clear_fragments, sample_encrypter, sample_encrypter_params));
+    return track_encrypter;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencEncryptingProcessor::CreateSampleEncrypter
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencEncryptingProcessor::CreateSampleEncrypter(const SampleEncrypterParams& params,
+                                                   AP4_CencSubSampleMapper*     subsample_mapper,
+                                                   AP4_CencSampleEncrypter*&    sample_encrypter)
+{
+    sample_encrypter = NULL;
+    
+    // create a block cipher
+    AP4_BlockCipher*           block_cipher = NULL;
+    AP4_BlockCipher::CtrParams cipher_ctr_params;
+    cipher_ctr_params.counter_size = 8;
+    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128,
+                                                           AP4_BlockCipher::ENCRYPT, 
+                                                           params.m_CipherMode,
+                                                           params.m_CipherMode == AP4_BlockCipher::CTR ?
+                                                           &cipher_ctr_params : NULL,
+                                                           params.m_Key.GetData(), 
+                                                           params.m_Key.GetDataSize(), 
+                                                           block_cipher);
+    if (AP4_FAILED(result)) {
+        delete subsample_mapper;
+        return result;
+    }
+    
+    // the sample encrypter owns the stream cipher and the subsample mapper
+    AP4_StreamCipher* stream_cipher = NULL;
+    switch (params.m_CipherMode) {
         case AP4_BlockCipher::CBC:
             stream_cipher = new AP4_CbcStreamCipher(block_cipher);
-            if (crypt_byte_block && skip_byte_block) {
-                stream_cipher = new AP4_PatternStreamCipher(stream_cipher, crypt_byte_block, skip_byte_block);
+            if (params.m_CryptByteBlock && params.m_SkipByteBlock) {
+                stream_cipher = new AP4_PatternStreamCipher(stream_cipher, params.m_CryptByteBlock, params.m_SkipByteBlock);
             }
-
-            if (nalu_length_size) {
-                AP4_CencSubSampleMapper* subsample_mapper = NULL;
-                if (m_Variant == AP4_CENC_VARIANT_MPEG_CBCS) {
-                    subsample_mapper = new AP4_CencCbcsSubSampleMapper(nalu_length_size, format, trak);
-                } else {
-                    subsample_mapper = new AP4_CencBasicSubSampleMapper(nalu_length_size, format);
-                }
+            if (subsample_mapper) {
                 sample_encrypter = new AP4_CencCbcSubSampleEncrypter(stream_cipher,
-                                                                     constant_iv,
-                                                                     reset_iv_at_each_subsample,
+                                                                     params.m_ConstantIv,
+                                                                     params.m_ResetIvAtEachSubsample,
                                                                      subsample_mapper);
             } else {
-                sample_encrypter = new AP4_CencCbcSampleEncrypter(stream_cipher, constant_iv);
+                sample_encrypter = new AP4_CencCbcSampleEncrypter(stream_cipher, params.m_ConstantIv);
             }
-
             break;
             
         case AP4_BlockCipher::CTR:
             stream_cipher = new AP4_CtrStreamCipher(block_cipher, 16);
-            if (crypt_byte_block && skip_byte_block) {
-                stream_cipher = new AP4_PatternStreamCipher(stream_cipher, crypt_byte_block, skip_byte_block);
+            if (params.m_CryptByteBlock && params.m_SkipByteBlock) {
+                stream_cipher = new AP4_PatternStreamCipher(stream_cipher, params.m_CryptByteBlock, params.m_SkipByteBlock);
             }
-            if (nalu_length_size) {
-                AP4_CencSubSampleMapper* subsample_mapper = new AP4_CencAdvancedSubSampleMapper(nalu_length_size, format);
+            if (subsample_mapper) {
                 sample_encrypter = new AP4_CencCtrSubSampleEncrypter(stream_cipher,
-                                                                     constant_iv,
-                                                                     reset_iv_at_each_subsample,
-                                                                     cipher_iv_size,
+                                                                     params.m_ConstantIv,
+                                                                     params.m_ResetIvAtEachSubsample,
+                                                                     params.m_IvSize,
                                                                      subsample_mapper);
             } else {
-                sample_encrypter = new AP4_CencCtrSampleEncrypter(stream_cipher, constant_iv, cipher_iv_size);
+                sample_encrypter = new AP4_CencCtrSampleEncrypter(stream_cipher, params.m_ConstantIv, params.m_IvSize);
             }
             break;
-    }
-    if (sample_encrypter == NULL) {
-        delete stream_cipher;
-        delete block_cipher;
-        delete track_encrypter;
-        return NULL;
-    }
-    sample_encrypter->SetIv(iv->GetData());
-
-    // if we need to leave some samples unencrypted, create clones of the sample descriptions
-    const char* clear_lead = m_PropertyMap.GetProperty(trak->GetId(), "ClearLeadFragments");
-    AP4_UI32 clear_fragments = 0;
-    if (clear_lead) {
-        clear_fragments = AP4_ParseIntegerU(clear_lead);
-        unsigned int sample_description_count = stsd->GetSampleDescriptionCount();
-        for (unsigned int i=0; i<sample_description_count; i++) {
-            stsd->AddChild(stsd->GetSampleEntry(i)->Clone());
-        }
+            
+        default:
+            delete block_cipher;
+            delete subsample_mapper;
+            return AP4_ERROR_INVALID_PARAMETERS;
     }
     
-    m_Encrypters.Add(new Encrypter(trak->GetId(), clear_fragments, sample_encrypter));
-    return track_encrypter;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -1745,10 +1902,13 @@ AP4_CencEncryptingProcessor::CreateFragmentHandler(AP4_TrakAtom*      trak,
     }
     if (encrypter == NULL) return NULL;
     
+    // the fragments are counted as they are created, since they may be
+    // finished out of order with respect to the creation of the next ones
+    bool cleartext = encrypter->m_CurrentFragment++ < encrypter->m_CleartextFragments;
     AP4_UI32 clear_sample_description_index = 0;
     const char* clear_lead = m_PropertyMap.GetProperty(trak->GetId(), "ClearLeadFragments");
     if (clear_lead) {
-        if (encrypter->m_CurrentFragment < encrypter->m_CleartextFragments) {
+        if (cleartext) {
             // find the stsd atom
             AP4_StsdAtom* stsd = AP4_DYNAMIC_CAST(AP4_StsdAtom, trak->FindChild("mdia/minf/stbl/stsd"));
             if (stsd) {
@@ -1765,7 +1925,33 @@ AP4_CencEncryptingProcessor::CreateFragmentHandler(AP4_TrakAtom*      trak,
             }
         }
     }
-    return new AP4_CencFragmentEncrypter(m_Variant, m_Options, traf, encrypter, clear_sample_description_index);
+    
+    // when the IVs of a fragment can be computed without encrypting the
+    // previous fragments (counter mode or constant IV), the fragment gets a
+    // sample encrypter of its own, so that it can be encrypted concurrently
+    // with other fragments (see AP4_Processor::SetThreadCount())
+    AP4_CencSampleEncrypter*         fragment_sample_encrypter = NULL;
+    AP4_CencFragmentSubSampleMapper* fragment_subsample_mapper = NULL;
+    const SampleEncrypterParams&     params = encrypter->m_SampleEncrypterParams;
+    if (!cleartext && (params.m_CipherMode == AP4_BlockCipher::CTR || params.m_ConstantIv)) {
+        if (params.m_UseSubSamples) {
+            fragment_subsample_mapper = new AP4_CencFragmentSubSampleMapper();
+        }
+        if (AP4_FAILED(CreateSampleEncrypter(params, fragment_subsample_mapper, fragment_sample_encrypter))) {
+            // fall back to the track's sample encrypter
+            fragment_sample_encrypter = NULL;
+            fragment_subsample_mapper = NULL;
+        }
+    }
+    
+    return new AP4_CencFragmentEncrypter(m_Variant,
+                                         m_Options,
+                                         traf,
+                                         encrypter,
+                                         cleartext,
+                                         clear_sample_description_index,
+                                         fragment_sample_encrypter,
+                                         fragment_subsample_mapper);
 }
 
 /*----------------------------------------------------------------------
@@ -1893,35 +2079,55 @@ AP4_CencSingleSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     m_Cipher->SetIV(iv);
 
     if (subsample_count) {
-        // process the sample data, one sub-sample at a time
+        // check bounds
         const AP4_UI08* in_end = data_in.GetData()+data_in.GetDataSize();
+        AP4_UI64 subsamples_size = 0;
+        bool     aligned         = true;
         for (unsigned int i=0; i<subsample_count; i++) {
-            AP4_UI16 cleartext_size = bytes_of_cleartext_data[i];
-            AP4_UI32 encrypted_size = bytes_of_encrypted_data[i];
-
-            // check bounds
-            if ((unsigned int)(in_end-in) < cleartext_size+encrypted_size) {
-                return AP4_ERROR_INVALID_FORMAT;
-            }
+            subsamples_size += bytes_of_cleartext_data[i]+(AP4_UI64)bytes_of_encrypted_data[i];
+            if (bytes_of_encrypted_data[i]%16) aligned = false;
+        }
+        if (subsamples_size > data_in.GetDataSize()) {
+            return AP4_ERROR_INVALID_FORMAT;
+        }
 
-            // copy the cleartext portion
-            if (cleartext_size) {
-                AP4_CopyMemory(out, in, cleartext_size);
-            }
-            
-            // decrypt the rest
-            if (encrypted_size) {
-                if (m_ResetIvAtEachSubsample) {
-                    m_Cipher->SetIV(iv);
+        if (!m_ResetIvAtEachSubsample && (aligned || !m_FullBlocksOnly)) {
+            // the cipher state carries over from one sub-sample to the next,
+            // so all the encrypted ranges can be processed in one pass
+            AP4_Result result = m_Cipher->ProcessSubSamples(in,
+                                                            out,
+                                                            subsample_count,
+                                                            bytes_of_cleartext_data,
+                                                            bytes_of_encrypted_data,
+                                                            m_Scratch);
+            if (AP4_FAILED(result)) return result;
+            in  += subsamples_size;
+            out += subsamples_size;
+        } else {
+            // process the sample data, one sub-sample at a time
+            for (unsigned int i=0; i<subsample_count; i++) {
+                AP4_UI16 cleartext_size = bytes_of_cleartext_data[i];
+                AP4_UI32 encrypted_size = bytes_of_encrypted_data[i];
+
+                // copy the cleartext portion
+                if (cleartext_size) {
+                    AP4_CopyMemory(out, in, cleartext_size);
                 }
                 
-                AP4_Result result = m_Cipher->ProcessBuffer(in+cleartext_size, encrypted_size, out+cleartext_size, &encrypted_size, false);
-                if (AP4_FAILED(result)) return result;
+                // decrypt the rest
+                if (encrypted_size) {
+                    if (m_ResetIvAtEachSubsample) {
+                        m_Cipher->SetIV(iv);
+                    }
+                    
+                    AP4_Result result = m_Cipher->ProcessBuffer(in+cleartext_size, encrypted_size, out+cleartext_size, &encrypted_size, false);
+                    if (AP4_FAILED(result)) return result;
+                }
+                
+                // move the pointers and udate counters
+                in  += cleartext_size+encrypted_size;
+                out += cleartext_size+encrypted_size;
             }
-            
-            // move the pointers and udate counters
-            in  += cleartext_size+encrypted_size;
-            out += cleartext_size+encrypted_size;
         }
 
         // copy any leftover partial block
@@ -2275,6 +2481,8 @@ public:
     virtual AP4_Result FinishFragment();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    // each fragment has its own sample decrypter
+    virtual bool IsIndependent() { return true; }
 
 private:
     // members
@@ -374,6 +374,16 @@ public:
 
     void            SetIv(const AP4_UI08* iv) { AP4_CopyMemory(m_Iv, iv, 16); }
     const AP4_UI08* GetIv()                   { return m_Iv;                  }
+    
+    /**
+     * Update the IV as EncryptSampleData() does for a sample of which
+     * encrypted_size bytes are encrypted, without encrypting anything.
+     * Returns AP4_ERROR_NOT_SUPPORTED when the next IV depends on the
+     * encrypted data (CBC chaining).
+     */
+    virtual AP4_Result AdvanceIv(AP4_UI64 /* encrypted_size */) {
+        return m_ConstantIv ? AP4_SUCCESS : AP4_ERROR_NOT_SUPPORTED;
+    }
     virtual bool    UseSubSamples()           { return false;                 }
     virtual AP4_Result GetSubSampleMap(AP4_DataBuffer&      /* sample_data */, 
                                        AP4_Array<AP4_UI16>& /* bytes_of_cleartext_data */, 
@@ -404,6 +414,7 @@ public:
     virtual AP4_Result EncryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          AP4_DataBuffer& sample_infos);
+    virtual AP4_Result AdvanceIv(AP4_UI64 encrypted_size);
     
 protected:
     unsigned int m_IvSize;
@@ -559,9 +570,11 @@ public:
     virtual AP4_Result EncryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          AP4_DataBuffer& sample_infos);
+    virtual AP4_Result AdvanceIv(AP4_UI64 encrypted_size);
     
 protected:
-    unsigned int m_IvSize;
+    unsigned int   m_IvSize;
+    AP4_DataBuffer m_Scratch;
 };
 
 /*----------------------------------------------------------------------
@@ -600,17 +613,32 @@ public:
     static const AP4_UI32 OPTION_NO_SENC            = 0x10; ///< Don't output an 'senc' atom
 
     // types
+    struct SampleEncrypterParams {
+        AP4_BlockCipher::CipherMode m_CipherMode;
+        AP4_DataBuffer              m_Key;
+        AP4_UI08                    m_IvSize;
+        AP4_UI08                    m_CryptByteBlock;
+        AP4_UI08                    m_SkipByteBlock;
+        bool                        m_ConstantIv;
+        bool                        m_ResetIvAtEachSubsample;
+        bool                        m_UseSubSamples;
+    };
     struct Encrypter {
-        Encrypter(AP4_UI32 track_id, AP4_UI32 cleartext_fragments, AP4_CencSampleEncrypter* sample_encrypter) :
+        Encrypter(AP4_UI32                     track_id,
+                  AP4_UI32                     cleartext_fragments,
+                  AP4_CencSampleEncrypter*     sample_encrypter,
+                  const SampleEncrypterParams& sample_encrypter_params) :
             m_TrackId(track_id),
             m_CurrentFragment(0),
             m_CleartextFragments(cleartext_fragments),
-            m_SampleEncrypter(sample_encrypter) {}
+            m_SampleEncrypter(sample_encrypter),
+            m_SampleEncrypterParams(sample_encrypter_params) {}
         ~Encrypter() { delete m_SampleEncrypter; }
         AP4_UI32                 m_TrackId;
         AP4_UI32                 m_CurrentFragment;
         AP4_UI32                 m_CleartextFragments;
         AP4_CencSampleEncrypter* m_SampleEncrypter;
+        SampleEncrypterParams    m_SampleEncrypterParams; // to create the sample encrypters of single fragments
     };
 
     // constructor
@@ -636,6 +664,11 @@ public:
                                                                   AP4_Position       moof_offset);
     
 protected:    
+    // methods
+    AP4_Result CreateSampleEncrypter(const SampleEncrypterParams& params,
+                                     AP4_CencSubSampleMapper*     subsample_mapper,
+                                     AP4_CencSampleEncrypter*&    sample_encrypter);
+
     // members
     AP4_CencVariant          m_Variant;
     AP4_UI32                 m_Options;
@@ -691,7 +724,8 @@ public:
     // methods
     AP4_CencSingleSampleDecrypter(AP4_StreamCipher* cipher) :
         m_Cipher(cipher),
-        m_FullBlocksOnly(false) {}
+        m_FullBlocksOnly(false),
+        m_ResetIvAtEachSubsample(false) {}
     virtual ~AP4_CencSingleSampleDecrypter();
     virtual AP4_Result DecryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
@@ -721,6 +755,7 @@ private:
     AP4_StreamCipher* m_Cipher;
     bool              m_FullBlocksOnly;
     bool              m_ResetIvAtEachSubsample;
+    AP4_DataBuffer    m_Scratch;
 };
 
 /*----------------------------------------------------------------------
@@ -147,6 +147,20 @@
 #define AP4_ftell ftello
 #endif
 
+/* memory-mapped files */
+#if !defined(AP4_CONFIG_NO_MMAP) && !defined(AP4_CONFIG_HAVE_MMAP)
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define AP4_CONFIG_HAVE_MMAP
+#endif
+#endif
+
+/* positional reads */
+#if !defined(AP4_CONFIG_NO_PREAD) && !defined(AP4_CONFIG_HAVE_PREAD)
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define AP4_CONFIG_HAVE_PREAD
+#endif
+#endif
+
 /* some compilers (ex: MSVC 8) deprecate those, so we rename them */
 #if !defined(AP4_snprintf)
 #define AP4_snprintf snprintf
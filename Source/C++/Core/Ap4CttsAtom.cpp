@@ -49,31 +49,45 @@ AP4_CttsAtom::Create(AP4_UI32 size, AP4_ByteStream& stream)
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version > 1) return NULL;
-    return new AP4_CttsAtom(size, version, flags, stream);
+    return new AP4_CttsAtom(size, version, flags, stream, nullptr);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::CreateDeferred
++---------------------------------------------------------------------*/
+AP4_CttsAtom*
+AP4_CttsAtom::CreateDeferred(AP4_UI32 size, std::shared_ptr<AP4_ByteStream> stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(*stream, version, flags))) return NULL;
+    if (version > 1) return NULL;
+    return new AP4_CttsAtom(size, version, flags, *stream, stream);
 }
 
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::AP4_CttsAtom
 +---------------------------------------------------------------------*/
 AP4_CttsAtom::AP4_CttsAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_CTTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_CTTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_StartsReady(false),
+    m_LookupCache(0)
 {
-    m_LookupCache.sample      = 0;
-    m_LookupCache.entry_index = 0;
 }
 
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::AP4_CttsAtom
 +---------------------------------------------------------------------*/
-AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size, 
-                           AP4_UI08        version,
-                           AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_CTTS, size, version, flags)
+AP4_CttsAtom::AP4_CttsAtom(AP4_UI32                        size, 
+                           AP4_UI08                        version,
+                           AP4_UI32                        flags,
+                           AP4_ByteStream&                 stream,
+                           std::shared_ptr<AP4_ByteStream> deferred_source) :
+    AP4_Atom(AP4_ATOM_TYPE_CTTS, size, version, flags),
+    m_StartsReady(false),
+    m_LookupCache(0)
 {
-    m_LookupCache.sample      = 0;
-    m_LookupCache.entry_index = 0;
-
     if (size < AP4_FULL_ATOM_HEADER_SIZE + 4) {
         return;
     }
@@ -87,6 +101,12 @@ AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size,
         return;
     }
 
+    // defer reading the entries until they are needed
+    if (deferred_source) {
+        m_DeferredEntries.Attach(std::move(deferred_source), entry_count*8);
+        return;
+    }
+
     // read the entries
     m_Entries.SetItemCount(entry_count);
     unsigned char* buffer = new unsigned char[entry_count*8];
@@ -118,14 +138,70 @@ AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size,
     //}
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::LoadEntries
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CttsAtom::LoadEntries()
+{
+    AP4_Size       payload_size = m_DeferredEntries.GetSize();
+    unsigned char* buffer = new unsigned char[payload_size];
+    AP4_Result     result = m_DeferredEntries.Load(buffer);
+    if (AP4_FAILED(result)) {
+        delete[] buffer;
+        return result;
+    }
+    m_Entries.SetItemCount(payload_size/8);
+    for (unsigned int i=0; i<payload_size/8; i++) {
+        m_Entries[i].m_SampleCount  = AP4_BytesToUInt32BE(&buffer[i*8  ]);
+        m_Entries[i].m_SampleOffset = AP4_BytesToUInt32BE(&buffer[i*8+4]);
+    }
+    delete[] buffer;
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::AddEntry
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_CttsAtom::AddEntry(AP4_UI32 count, AP4_UI32 cts_offset)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
     m_Entries.Append(AP4_CttsTableEntry(count, cts_offset));
     m_Size32 += 8;
+
+    // keep the entry starts up to date if they have been computed already
+    if (m_StartsReady.load(std::memory_order_relaxed)) {
+        m_FirstSamples.Append(m_FirstSamples[m_Entries.ItemCount()-1]+count);
+    }
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::EnsureStarts
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CttsAtom::EnsureStarts()
+{
+    if (m_StartsReady.load(std::memory_order_acquire)) return AP4_SUCCESS;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+    std::lock_guard<std::mutex> lock(m_StartsLock);
+    if (m_StartsReady.load(std::memory_order_relaxed)) return AP4_SUCCESS;
+
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    m_FirstSamples.SetItemCount(entry_count+1);
+    AP4_UI64 sample = 0;
+    for (AP4_Ordinal i=0; i<entry_count; i++) {
+        m_FirstSamples[i] = sample;
+        sample += m_Entries[i].m_SampleCount;
+    }
+    m_FirstSamples[entry_count] = sample;
+
+    m_StartsReady.store(true, std::memory_order_release);
+
     return AP4_SUCCESS;
 }
 
@@ -140,37 +216,23 @@ AP4_CttsAtom::GetCtsOffset(AP4_Ordinal sample, AP4_UI32& cts_offset)
     
     // sample indexes start at 1
     if (sample == 0) return AP4_ERROR_OUT_OF_RANGE;
-    
-    // check the lookup cache
-    AP4_Ordinal lookup_start = 0;
-    AP4_Ordinal sample_start = 0;
-    if (sample >= m_LookupCache.sample) {
-        // start from the cached entry
-        lookup_start = m_LookupCache.entry_index;
-        sample_start = m_LookupCache.sample;
-    }
-
-    for (AP4_Ordinal i = lookup_start; i < m_Entries.ItemCount(); i++) {
-        AP4_CttsTableEntry& entry = m_Entries[i];
-
-        // check if we have reached the sample
-        if (sample <= sample_start+entry.m_SampleCount) {
-            // we are within the sample range for the current entry
-            cts_offset = entry.m_SampleOffset;
-
-            // update the lookup cache
-            m_LookupCache.entry_index = i;
-            m_LookupCache.sample      = sample_start;
+    --sample;
 
-            return AP4_SUCCESS;
-        }
+    // check that the sample is in the table
+    AP4_Result result = EnsureStarts();
+    if (AP4_FAILED(result)) return result;
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    if (sample >= m_FirstSamples[entry_count]) return AP4_ERROR_OUT_OF_RANGE;
 
-        // update the upper bound
-        sample_start += entry.m_SampleCount;        
-    }
+    // find the entry, starting from the last one used
+    AP4_Ordinal i = AP4_FindRange(m_FirstSamples, 
+                                  entry_count, 
+                                  (AP4_UI64)sample, 
+                                  m_LookupCache.load(std::memory_order_relaxed));
+    m_LookupCache.store(i, std::memory_order_relaxed);
+    cts_offset = m_Entries[i].m_SampleOffset;
 
-    // sample is greater than the number of samples
-    return AP4_ERROR_OUT_OF_RANGE;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -179,7 +241,8 @@ AP4_CttsAtom::GetCtsOffset(AP4_Ordinal sample, AP4_UI32& cts_offset)
 AP4_Result
 AP4_CttsAtom::WriteFields(AP4_ByteStream& stream)
 {
-    AP4_Result result;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
 
     // write the entry count
     AP4_Cardinal entry_count = m_Entries.ItemCount();
@@ -206,6 +269,8 @@ AP4_CttsAtom::WriteFields(AP4_ByteStream& stream)
 AP4_Result
 AP4_CttsAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     if (inspector.GetVerbosity() >= 2) {
@@ -36,6 +36,9 @@
 #include "Ap4Types.h"
 #include "Ap4Array.h"
 
+#include <atomic>
+#include <mutex>
+
 /*----------------------------------------------------------------------
 |   class references
 +---------------------------------------------------------------------*/
@@ -68,6 +71,11 @@ public:
 
     // class methods
     static AP4_CttsAtom* Create(AP4_UI32 size, AP4_ByteStream& stream);
+    /**
+     * Create an atom whose entries are only decoded on first access.
+     * The stream must remain valid, and its content unchanged, until then.
+     */
+    static AP4_CttsAtom* CreateDeferred(AP4_UI32 size, std::shared_ptr<AP4_ByteStream> stream);
 
     // constructor
     AP4_CttsAtom();
@@ -80,17 +88,24 @@ public:
 
 private:
     // methods
-    AP4_CttsAtom(AP4_UI32        size, 
-                 AP4_UI08        version,
-                 AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+    AP4_CttsAtom(AP4_UI32                        size, 
+                 AP4_UI08                        version,
+                 AP4_UI32                        flags,
+                 AP4_ByteStream&                 stream,
+                 std::shared_ptr<AP4_ByteStream> deferred_source);
+    AP4_Result LoadEntries();
+    AP4_Result EnsureEntries() { return m_DeferredEntries.Resolve([this] { return LoadEntries(); }); }
+    AP4_Result EnsureStarts();
 
     // members
     AP4_Array<AP4_CttsTableEntry> m_Entries;
-    struct {
-        AP4_Ordinal sample;
-        AP4_Ordinal entry_index;
-    } m_LookupCache;
+    // first sample of each entry, plus the sample count at the end,
+    // computed on the first lookup
+    AP4_Array<AP4_UI64>           m_FirstSamples;
+    std::atomic<bool>             m_StartsReady;
+    std::mutex                    m_StartsLock;
+    std::atomic<AP4_Ordinal>      m_LookupCache; // entry of the last lookup
+    AP4_DeferredPayload           m_DeferredEntries;
 };
 
 #endif // _AP4_CTTS_ATOM_H_
@@ -0,0 +1,198 @@
+/*****************************************************************
+|
+|    AP4 - emsg Atoms
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4EmsgAtom.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const unsigned int AP4_EMSG_MAX_PAYLOAD_SIZE = 16*1024*1024; // 16MB, for sanity
+
+/*----------------------------------------------------------------------
+|   dynamic cast support
++---------------------------------------------------------------------*/
+AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_EmsgAtom)
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::Create
++---------------------------------------------------------------------*/
+AP4_EmsgAtom*
+AP4_EmsgAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
+    if (version > 1) return NULL;
+
+    // read the whole payload, since the strings come first in version 0
+    AP4_Size payload_size = size-AP4_FULL_ATOM_HEADER_SIZE;
+    if (payload_size > AP4_EMSG_MAX_PAYLOAD_SIZE) return NULL;
+    AP4_DataBuffer payload(payload_size);
+    if (AP4_FAILED(stream.Read(payload.UseData(), payload_size))) return NULL;
+    
+    AP4_EmsgAtom* emsg = new AP4_EmsgAtom(size, version, flags);
+    if (AP4_FAILED(emsg->ParsePayload(payload.GetData(), payload_size))) {
+        delete emsg;
+        return NULL;
+    }
+    return emsg;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::AP4_EmsgAtom
++---------------------------------------------------------------------*/
+AP4_EmsgAtom::AP4_EmsgAtom(const char*     scheme_id_uri,
+                           const char*     value,
+                           AP4_UI32        timescale,
+                           AP4_UI64        presentation_time,
+                           AP4_UI32        event_duration,
+                           AP4_UI32        id,
+                           const AP4_UI08* message_data,
+                           AP4_Size        message_data_size) :
+    AP4_Atom(AP4_ATOM_TYPE_EMSG, AP4_FULL_ATOM_HEADER_SIZE+20, 1, 0),
+    m_SchemeIdUri(scheme_id_uri),
+    m_Value(value),
+    m_TimeScale(timescale),
+    m_PresentationTime(presentation_time),
+    m_EventDuration(event_duration),
+    m_Id(id)
+{
+    if (message_data && message_data_size) {
+        m_MessageData.SetData(message_data, message_data_size);
+    }
+    m_Size32 += m_SchemeIdUri.GetLength()+1+m_Value.GetLength()+1+message_data_size;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::AP4_EmsgAtom
++---------------------------------------------------------------------*/
+AP4_EmsgAtom::AP4_EmsgAtom(AP4_UI32 size, AP4_UI08 version, AP4_UI32 flags) :
+    AP4_Atom(AP4_ATOM_TYPE_EMSG, size, version, flags),
+    m_TimeScale(0),
+    m_PresentationTime(0),
+    m_EventDuration(0),
+    m_Id(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::ParsePayload
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_EmsgAtom::ParsePayload(const AP4_UI08* payload, AP4_Size payload_size)
+{
+    // each string takes at least its terminating null
+    if (payload_size < 2) return AP4_ERROR_INVALID_FORMAT;
+    const AP4_UI08* data = payload;
+    const AP4_UI08* end  = payload+payload_size;
+
+    // the fixed fields come first in version 1
+    if (m_Version == 1) {
+        if (payload_size < 20+2) return AP4_ERROR_INVALID_FORMAT;
+        m_TimeScale        = AP4_BytesToUInt32BE(data);
+        m_PresentationTime = AP4_BytesToUInt64BE(data+4);
+        m_EventDuration    = AP4_BytesToUInt32BE(data+12);
+        m_Id               = AP4_BytesToUInt32BE(data+16);
+        data += 20;
+    }
+
+    // two null-terminated strings
+    const AP4_UI08* scheme_id_uri_end = (const AP4_UI08*)memchr(data, 0, end-data);
+    if (scheme_id_uri_end == NULL) return AP4_ERROR_INVALID_FORMAT;
+    m_SchemeIdUri.Assign((const char*)data, (AP4_Size)(scheme_id_uri_end-data));
+    data = scheme_id_uri_end+1;
+    const AP4_UI08* value_end = (const AP4_UI08*)memchr(data, 0, end-data);
+    if (value_end == NULL) return AP4_ERROR_INVALID_FORMAT;
+    m_Value.Assign((const char*)data, (AP4_Size)(value_end-data));
+    data = value_end+1;
+
+    // the fixed fields come after the strings in version 0
+    if (m_Version == 0) {
+        if (end-data < 16) return AP4_ERROR_INVALID_FORMAT;
+        m_TimeScale        = AP4_BytesToUInt32BE(data);
+        m_PresentationTime = AP4_BytesToUInt32BE(data+4);
+        m_EventDuration    = AP4_BytesToUInt32BE(data+8);
+        m_Id               = AP4_BytesToUInt32BE(data+12);
+        data += 16;
+    }
+    m_MessageData.SetData(data, (AP4_Size)(end-data));
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::WriteFields
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_EmsgAtom::WriteFields(AP4_ByteStream& stream)
+{
+    AP4_Result result;
+    if (m_Version == 1) {
+        stream.WriteUI32(m_TimeScale);
+        stream.WriteUI64(m_PresentationTime);
+        stream.WriteUI32(m_EventDuration);
+        stream.WriteUI32(m_Id);
+    }
+    stream.Write(m_SchemeIdUri.GetChars(), m_SchemeIdUri.GetLength()+1);
+    result = stream.Write(m_Value.GetChars(), m_Value.GetLength()+1);
+    if (AP4_FAILED(result)) return result;
+    if (m_Version == 0) {
+        stream.WriteUI32(m_TimeScale);
+        stream.WriteUI32((AP4_UI32)m_PresentationTime);
+        stream.WriteUI32(m_EventDuration);
+        result = stream.WriteUI32(m_Id);
+        if (AP4_FAILED(result)) return result;
+    }
+    if (m_MessageData.GetDataSize()) {
+        return stream.Write(m_MessageData.GetData(), m_MessageData.GetDataSize());
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom::InspectFields
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_EmsgAtom::InspectFields(AP4_AtomInspector& inspector)
+{
+    inspector.AddField("scheme_id_uri", m_SchemeIdUri.GetChars());
+    inspector.AddField("value", m_Value.GetChars());
+    inspector.AddField("timescale", m_TimeScale);
+    inspector.AddField(m_Version == 0 ? "presentation_time_delta" : "presentation_time", m_PresentationTime);
+    inspector.AddField("event_duration", m_EventDuration);
+    inspector.AddField("id", m_Id);
+    inspector.AddField("message_data", m_MessageData.GetData(), m_MessageData.GetDataSize());
+    
+    return AP4_SUCCESS;
+}
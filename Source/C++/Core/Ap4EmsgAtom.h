@@ -0,0 +1,93 @@
+/*****************************************************************
+|
+|    AP4 - emsg Atoms
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_EMSG_ATOM_H_
+#define _AP4_EMSG_ATOM_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Atom.h"
+#include "Ap4String.h"
+#include "Ap4DataBuffer.h"
+
+/*----------------------------------------------------------------------
+|   AP4_EmsgAtom
++---------------------------------------------------------------------*/
+/**
+ * Event message box (ISO/IEC 23009-1). Version 0 signals the presentation
+ * time of the event relative to the start of the segment, version 1 signals
+ * it on the media timeline. New atoms are created with version 1.
+ */
+class AP4_EmsgAtom : public AP4_Atom
+{
+public:
+    AP4_IMPLEMENT_DYNAMIC_CAST(AP4_EmsgAtom)
+
+    // class methods
+    static AP4_EmsgAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+
+    // constructor
+    AP4_EmsgAtom(const char*     scheme_id_uri,
+                 const char*     value,
+                 AP4_UI32        timescale,
+                 AP4_UI64        presentation_time,
+                 AP4_UI32        event_duration,
+                 AP4_UI32        id,
+                 const AP4_UI08* message_data = NULL,
+                 AP4_Size        message_data_size = 0);
+
+    // methods
+    virtual AP4_Result InspectFields(AP4_AtomInspector& inspector);
+    virtual AP4_Result WriteFields(AP4_ByteStream& stream);
+
+    // accessors
+    const AP4_String&     GetSchemeIdUri()       { return m_SchemeIdUri;      }
+    const AP4_String&     GetValue()             { return m_Value;            }
+    AP4_UI32              GetTimeScale()         { return m_TimeScale;        }
+    AP4_UI64              GetPresentationTime()  { return m_PresentationTime; } // delta for version 0
+    AP4_UI32              GetEventDuration()     { return m_EventDuration;    }
+    AP4_UI32              GetId()                { return m_Id;               }
+    const AP4_DataBuffer& GetMessageData()       { return m_MessageData;      }
+
+private:
+    // methods
+    AP4_EmsgAtom(AP4_UI32 size, AP4_UI08 version, AP4_UI32 flags);
+    AP4_Result ParsePayload(const AP4_UI08* payload, AP4_Size payload_size);
+
+    // members
+    AP4_String     m_SchemeIdUri;
+    AP4_String     m_Value;
+    AP4_UI32       m_TimeScale;
+    AP4_UI64       m_PresentationTime;
+    AP4_UI32       m_EventDuration;
+    AP4_UI32       m_Id;
+    AP4_DataBuffer m_MessageData;
+};
+
+#endif // _AP4_EMSG_ATOM_H_
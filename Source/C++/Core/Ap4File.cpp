@@ -41,6 +41,12 @@
 #include "Ap4FtypAtom.h"
 #include "Ap4MetaData.h"
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+// tables at or below this size are cheaper to decode than to defer
+static const AP4_Size AP4_FILE_DEFERRED_TABLE_THRESHOLD = 4096;
+
 /*----------------------------------------------------------------------
 |   AP4_File::AP4_File
 +---------------------------------------------------------------------*/
@@ -57,26 +63,39 @@ AP4_File::AP4_File(AP4_Movie* movie) :
 +---------------------------------------------------------------------*/
 AP4_File::AP4_File(std::shared_ptr<AP4_ByteStream> stream,
                    AP4_AtomFactory&                atom_factory,
-                   bool                            moov_only) :
+                   bool                            moov_only,
+                   bool                            deferred_tables) :
     m_Movie(NULL),
     m_FileType(NULL),
     m_MetaData(NULL),
     m_MoovIsBeforeMdat(true)
 {
-    ParseStream(stream, atom_factory, moov_only);
+    // only use the default threshold for the duration of the parsing, 
+    // and only if the factory doesn't have one of its own
+    if (deferred_tables && atom_factory.GetDeferredPayloadThreshold() == 0) {
+        atom_factory.SetDeferredPayloadThreshold(AP4_FILE_DEFERRED_TABLE_THRESHOLD);
+        ParseStream(stream, atom_factory, moov_only);
+        atom_factory.SetDeferredPayloadThreshold(0);
+    } else {
+        ParseStream(stream, atom_factory, moov_only);
+    }
 }
 
 /*----------------------------------------------------------------------
 |   AP4_File::AP4_File
 +---------------------------------------------------------------------*/
 AP4_File::AP4_File(std::shared_ptr<AP4_ByteStream> stream,
-                   bool                            moov_only) :
+                   bool                            moov_only,
+                   bool                            deferred_tables) :
     m_Movie(NULL),
     m_FileType(NULL),
     m_MetaData(NULL),
     m_MoovIsBeforeMdat(true)
 {
     AP4_DefaultAtomFactory atom_factory;
+    if (deferred_tables) {
+        atom_factory.SetDeferredPayloadThreshold(AP4_FILE_DEFERRED_TABLE_THRESHOLD);
+    }
     ParseStream(stream, atom_factory, moov_only);
 }
 
@@ -86,6 +86,17 @@ const AP4_UI32 AP4_FILE_BRAND_DB4G = AP4_ATOM_TYPE('d','b','4','g');
 
 /**
  * The AP4_File object is the top level object for MP4 Files.
+ *
+ * Concurrent reads: once an AP4_File has been parsed, its movie, tracks
+ * and sample tables may be shared by several threads as long as none of
+ * them modifies the file. GetSample, ReadSample, ReadSamples,
+ * GetSampleDescription and the time/sync lookups are then safe to call
+ * concurrently: the lookup caches in the sample table atoms are shared
+ * hints that tolerate concurrent updates, lazily decoded tables and the
+ * sample index are built exactly once, and sample data is fetched with
+ * AP4_ByteStream::ReadAt, which does not touch the shared stream
+ * position. AP4_Sample and AP4_DataBuffer objects must not be shared
+ * between threads.
  */
 
 class AP4_File : public AP4_AtomParent {
@@ -104,10 +115,15 @@ public:
      * @param moov_only indicates whether parsing of the atoms should stop
      * when the moov atom is found or if all atoms should be parsed until the
      * end of the file. 
+     * @param deferred_tables when true, large sample tables are only decoded
+     * when first accessed, unless the atom factory already has its own
+     * deferred payload threshold. The stream must then remain unchanged for
+     * the lifetime of the file object.
      */
     AP4_File(std::shared_ptr<AP4_ByteStream> stream,
              AP4_AtomFactory&                atom_factory,
-             bool                            moov_only);
+             bool                            moov_only,
+             bool                            deferred_tables = false);
 
     /**
      * Constructs an AP4_File from a stream using the default atom factory
@@ -115,8 +131,13 @@ public:
      * @param moov_only indicates whether parsing of the atoms should stop
      * when the moov atom is found or if all atoms should be parsed until the
      * end of the file. 
+     * @param deferred_tables when true, large sample tables (stts, ctts,
+     * stsz, stco and co64) are only decoded when first accessed. The stream
+     * must then remain unchanged for the lifetime of the file object.
      */
-    AP4_File(std::shared_ptr<AP4_ByteStream> stream, bool moov_only = false);
+    AP4_File(std::shared_ptr<AP4_ByteStream> stream,
+             bool                            moov_only = false,
+             bool                            deferred_tables = false);
 
     /**
      * Destroys the AP4_File instance 
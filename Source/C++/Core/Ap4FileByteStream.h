@@ -50,14 +50,17 @@ public:
     typedef enum {
         STREAM_MODE_READ        = 0,
         STREAM_MODE_WRITE       = 1,
-        STREAM_MODE_READ_WRITE  = 2
+        STREAM_MODE_READ_WRITE  = 2,
+        STREAM_MODE_READ_MAPPED = 3  // read-only, memory-mapped when supported
     } Mode;
 
     /**
      * Create a stream from a file (opened or created).
      *
      * @param name Name of the file to open or create
-     * @param mode Mode to use for the file
+     * @param mode Mode to use for the file. With STREAM_MODE_READ_MAPPED, the
+     * file is memory-mapped and the stream supports GetDataView, on platforms
+     * where that is available (it falls back to STREAM_MODE_READ otherwise).
      * @param stream Reference to a pointer where the stream object will
      * be returned
      * @return AP4_SUCCESS if the file can be opened or created, or an error code if
@@ -93,6 +96,19 @@ public:
     AP4_Result Tell(AP4_Position& position) { return m_Delegate->Tell(position); }
     AP4_Result GetSize(AP4_LargeSize& size) { return m_Delegate->GetSize(size);  }
     AP4_Result Flush()                      { return m_Delegate->Flush();        }
+    AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size) {
+        return m_Delegate->CopyTo(stream, size);
+    }
+    AP4_Result GetDataView(AP4_Position     position,
+                           AP4_Size         size,
+                           const AP4_UI08*& data) {
+        return m_Delegate->GetDataView(position, size, data);
+    }
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read) {
+        return m_Delegate->ReadAt(position, buffer, bytes_to_read);
+    }
 
 protected:
     // members
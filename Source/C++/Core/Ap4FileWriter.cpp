@@ -157,16 +157,28 @@ AP4_FileWriter::Write(AP4_File& file, AP4_ByteStream& stream, Interleaving /* in
         AP4_Track*    track = track_item->GetData();
         AP4_TrakAtom* trak  = track->UseTrakAtom();
         
-        // restore the backed-up chunk offsets
-        result = trak->SetChunkOffsets(*trak_chunk_offsets_backup[t]);
+        // restore the backed-up chunk offsets, even after a write error
+        AP4_Result restore_result = trak->SetChunkOffsets(*trak_chunk_offsets_backup[t]);
+        if (AP4_FAILED(result)) continue;
+        result = restore_result;
 
         // write all the track's samples
         AP4_Cardinal   sample_count = track->GetSampleCount();
         AP4_Sample     sample;
         AP4_DataBuffer sample_data;
-        for (AP4_Ordinal i=0; i<sample_count; i++) {
-            track->ReadSample(i, sample, sample_data);
-            stream.Write(sample_data.GetData(), sample_data.GetDataSize());
+        for (AP4_Ordinal i=0; i<sample_count && AP4_SUCCEEDED(result); i++) {
+            result = track->GetSample(i, sample);
+            if (AP4_FAILED(result)) break;
+            const AP4_UI08* sample_view = NULL;
+            if (AP4_SUCCEEDED(sample.GetDataView(sample_view))) {
+                // the data is already in memory, write it without a copy
+                result = stream.Write(sample_view, sample.GetSize());
+            } else {
+                result = sample.ReadData(sample_data);
+                if (AP4_SUCCEEDED(result)) {
+                    result = stream.Write(sample_data.GetData(), sample_data.GetDataSize());
+                }
+            }
         }
     }
 
@@ -51,7 +51,9 @@ AP4_FragmentSampleTable::AP4_FragmentSampleTable(AP4_ContainerAtom*
                                                  std::shared_ptr<AP4_ByteStream> sample_stream,
                                                  AP4_Position                    moof_offset,
                                                  AP4_Position                    mdat_payload_offset,
-                                                 AP4_UI64                        dts_origin) :
+                                                 AP4_UI64                        dts_origin,
+                                                 AP4_Arena*                      arena) :
+    m_Samples(arena),
     m_Duration(0)
 {
     AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
@@ -122,6 +124,11 @@ AP4_FragmentSampleTable::AddTrun(AP4_TrunAtom*                   trun,
     // update the number of samples
     unsigned int start = m_Samples.ItemCount();
     m_Samples.SetItemCount(start + trun->GetEntries().ItemCount());
+
+    // all the samples of the run share the same data stream
+    AP4_UI32   stream_index = AP4_SAMPLE_RECORD_NO_DATA_STREAM;
+    AP4_Result result = m_Samples.AddDataStream(sample_stream, stream_index);
+    if (AP4_FAILED(result)) return result;
         
     // base data offset
     AP4_Position data_offset = 0;
@@ -176,7 +183,7 @@ AP4_FragmentSampleTable::AddTrun(AP4_TrunAtom*                   trun,
     AP4_UI64 dts = dts_origin;
     for (unsigned int i=0; i<trun->GetEntries().ItemCount(); i++) {
         const AP4_TrunAtom::Entry& entry  = trun->GetEntries()[i];
-        AP4_Sample&                sample = m_Samples[start+i];
+        AP4_SampleRecord&          sample = m_Samples[start+i];
         
         // sample size
         if (trun_flags & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) {
@@ -212,7 +219,7 @@ AP4_FragmentSampleTable::AddTrun(AP4_TrunAtom*                   trun,
         }
         
         // data stream
-        if (sample_stream != nullptr) sample.SetDataStream(sample_stream);
+        sample.m_DataStreamIndex = stream_index;
         
         // data offset
         sample.SetOffset(data_offset);
@@ -242,12 +249,7 @@ AP4_Result
 AP4_FragmentSampleTable::GetSample(AP4_Ordinal index, 
                                    AP4_Sample& sample)
 {
-    if (index >= m_Samples.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
-
-    // copy the sample
-    sample = m_Samples[index];
-
-    return AP4_SUCCESS;
+    return m_Samples.GetSample(index, sample);
 }
 
 /*----------------------------------------------------------------------
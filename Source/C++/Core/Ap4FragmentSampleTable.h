@@ -37,6 +37,7 @@
 #include "Ap4Types.h"
 #include "Ap4SampleTable.h"
 #include "Ap4Array.h"
+#include "Ap4Sample.h"
 
 #include <memory>
 
@@ -61,7 +62,8 @@ class AP4_FragmentSampleTable : public AP4_SampleTable
                                      std::shared_ptr<AP4_ByteStream> sample_stream,
                                      AP4_Position                    moof_offset,
                                      AP4_Position                    mdat_payload_offset, // hack because MS doesn't implement the spec correctly
-                                     AP4_UI64                        dts_origin=0);
+                                     AP4_UI64                        dts_origin=0,
+                                     AP4_Arena*                      arena=NULL);
     virtual ~AP4_FragmentSampleTable();
 
     // AP4_SampleTable methods
@@ -76,11 +78,12 @@ class AP4_FragmentSampleTable : public AP4_SampleTable
     virtual AP4_Ordinal  GetNearestSyncSampleIndex(AP4_Ordinal index, bool before=true);
 
     // methods
-    AP4_UI64 GetDuration() { return m_Duration; }
+    AP4_UI64                     GetDuration() { return m_Duration; }
+    const AP4_SampleRecordArray& GetSampleRecords() { return m_Samples; }
     
 private:
     // members
-    AP4_Array<AP4_Sample> m_Samples;
+    AP4_SampleRecordArray m_Samples;
     AP4_UI64              m_Duration;
     
     // methods
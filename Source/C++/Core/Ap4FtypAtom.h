@@ -52,6 +52,7 @@ const AP4_UI32 AP4_FTYP_BRAND_ISML = AP4_ATOM_TYPE('i','s','m','l');
 const AP4_UI32 AP4_FTYP_BRAND_PIFF = AP4_ATOM_TYPE('p','i','f','f');
 const AP4_UI32 AP4_FTYP_BRAND_ISO2 = AP4_ATOM_TYPE('i','s','o','2');
 const AP4_UI32 AP4_FTYP_BRAND_MSDH = AP4_ATOM_TYPE('m','s','d','h');
+const AP4_UI32 AP4_FTYP_BRAND_MSIX = AP4_ATOM_TYPE('m','s','i','x');
 
 /*----------------------------------------------------------------------
 |   AP4_FtypAtom
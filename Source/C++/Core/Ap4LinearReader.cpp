@@ -51,8 +51,13 @@ AP4_LinearReader::AP4_LinearReader(AP4_Movie&                      movie,
     m_NextFragmentPosition(0),
     m_BufferFullness(0),
     m_BufferFullnessPeak(0),
-    m_Mfra(NULL)
+    m_Mfra(NULL),
+    m_ReadAheadSize(AP4_LINEAR_READER_DEFAULT_READ_AHEAD_SIZE),
+    m_ReadAheadOffset(0),
+    m_FragmentArenaIndex(0)
 {
+    m_FragmentArenas[0] = NULL;
+    m_FragmentArenas[1] = NULL;
     m_HasFragments = movie.HasFragments();
     if (m_FragmentStream != nullptr) {
         m_FragmentStream->Tell(m_CurrentFragmentPosition);
@@ -70,6 +75,8 @@ AP4_LinearReader::~AP4_LinearReader()
     }
     delete m_Fragment;
     delete m_Mfra;
+    delete m_FragmentArenas[0];
+    delete m_FragmentArenas[1];
 }
 
 /*----------------------------------------------------------------------
@@ -291,8 +298,10 @@ AP4_LinearReader::ProcessMoof(AP4_ContainerAtom* moof,
     AP4_Result result;
    
     // create a new fragment
+    // (its atoms were parsed into the other arena, which becomes current)
     delete m_Fragment;
     m_Fragment = new AP4_MovieFragment(moof);
+    m_FragmentArenaIndex ^= 1;
     
     // update the trackers
     AP4_Array<AP4_UI32> ids;
@@ -313,7 +322,8 @@ AP4_LinearReader::ProcessMoof(AP4_ContainerAtom* moof,
                                                        moof_offset, 
                                                        mdat_payload_offset, 
                                                        tracker->m_NextDts,
-                                                       sample_table);
+                                                       sample_table,
+                                                       m_FragmentArenas[m_FragmentArenaIndex]);
                 if (AP4_FAILED(result)) return result;
                 tracker->m_SampleTable = sample_table;
                 tracker->m_SampleTableIsOwned = true;
@@ -342,7 +352,16 @@ AP4_LinearReader::AdvanceFragment()
     // read atoms until we find a moof
     assert(m_HasFragments);
     if (!m_FragmentStream) return AP4_ERROR_INVALID_STATE;
+
+    // parse into the arena that held the fragment before the current one,
+    // whose atoms and tables have all been deleted by now
     AP4_DefaultAtomFactory atom_factory;
+    if (m_FragmentArenas[0]) {
+        AP4_Arena* arena = m_FragmentArenas[m_FragmentArenaIndex^1];
+        arena->Reset();
+        atom_factory.SetArena(arena);
+    }
+
     do {
         AP4_Atom* atom = NULL;
         AP4_Position last_position = 0;
@@ -456,7 +475,7 @@ AP4_LinearReader::Advance(bool read_data)
             if (next_tracker->m_Reader) {
                 result = next_tracker->m_Reader->ReadSampleData(*buffer->m_Sample, buffer->m_Data);
             } else {
-                result = buffer->m_Sample->ReadData(buffer->m_Data);
+                result = ReadSampleData(*buffer->m_Sample, buffer->m_Data);
             }
             if (AP4_FAILED(result)) {
                 delete buffer;
@@ -481,6 +500,69 @@ AP4_LinearReader::Advance(bool read_data)
     return AP4_ERROR_EOS;   
 }
 
+/*----------------------------------------------------------------------
+|   AP4_LinearReader::SetReadAheadSize
++---------------------------------------------------------------------*/
+void
+AP4_LinearReader::SetReadAheadSize(AP4_Size size)
+{
+    m_ReadAheadSize = size;
+    m_ReadAheadStream.reset();
+    m_ReadAheadBuffer.SetDataSize(0);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinearReader::EnableFragmentArenas
++---------------------------------------------------------------------*/
+void
+AP4_LinearReader::EnableFragmentArenas()
+{
+    if (m_FragmentArenas[0] == NULL) {
+        m_FragmentArenas[0] = new AP4_Arena();
+        m_FragmentArenas[1] = new AP4_Arena();
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_LinearReader::ReadSampleData
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_LinearReader::ReadSampleData(AP4_Sample& sample, AP4_DataBuffer& sample_data)
+{
+    std::shared_ptr<AP4_ByteStream> stream = sample.GetDataStream();
+    AP4_Position offset = sample.GetOffset();
+    AP4_Size     size   = sample.GetSize();
+
+    // large samples are read directly
+    if (stream == nullptr || size == 0 || size > m_ReadAheadSize) {
+        return sample.ReadData(sample_data);
+    }
+
+    // refill the window if the sample is not entirely in it
+    if (stream != m_ReadAheadStream ||
+        offset < m_ReadAheadOffset  ||
+        offset+size > m_ReadAheadOffset+m_ReadAheadBuffer.GetDataSize()) {
+        m_ReadAheadStream.reset();
+        AP4_LargeSize stream_size = 0;
+        if (AP4_FAILED(stream->GetSize(stream_size)) || offset+size > stream_size) {
+            return sample.ReadData(sample_data);
+        }
+        AP4_Size window = m_ReadAheadSize;
+        if (offset+window > stream_size) window = (AP4_Size)(stream_size-offset);
+        AP4_Result result = m_ReadAheadBuffer.SetDataSize(window);
+        if (AP4_FAILED(result)) return result;
+        result = stream->ReadAt(offset, m_ReadAheadBuffer.UseData(), window);
+        if (AP4_FAILED(result)) {
+            m_ReadAheadBuffer.SetDataSize(0);
+            return result;
+        }
+        m_ReadAheadStream = stream;
+        m_ReadAheadOffset = offset;
+    }
+
+    return sample_data.SetData(m_ReadAheadBuffer.GetData()+(offset-m_ReadAheadOffset), size);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_LinearReader::PopSample
 +---------------------------------------------------------------------*/
@@ -39,6 +39,7 @@
 #include "Ap4Movie.h"
 #include "Ap4Sample.h"
 #include "Ap4Protection.h"
+#include "Ap4Arena.h"
 
 #include <memory>
 
@@ -54,6 +55,8 @@ class AP4_MovieFragment;
 const unsigned int AP4_LINEAR_READER_INITIALIZED = 1;
 const unsigned int AP4_LINEAR_READER_FLAG_EOS    = 2;
 
+const AP4_Size AP4_LINEAR_READER_DEFAULT_READ_AHEAD_SIZE = 256*1024;
+
 /*----------------------------------------------------------------------
 |   AP4_LinearReader
 +---------------------------------------------------------------------*/
@@ -89,6 +92,24 @@ public:
     AP4_Result SetSampleIndex(AP4_UI32 track_id, AP4_UI32 sample_index);
     
     AP4_Result SeekTo(AP4_UI32 time_ms, AP4_UI32* actual_time_ms = 0);
+
+    /**
+     * Set the size of the window used to read sample data ahead.
+     * Sample data is read from the source in blocks of up to that size,
+     * so that samples stored next to each other (across all enabled tracks)
+     * are fetched with a single read. A size of 0 disables read-ahead.
+     */
+    void SetReadAheadSize(AP4_Size size);
+
+    /**
+     * Allocate each fragment (the moof atom tree, the trun entries and
+     * the fragment sample tables) from an arena. Two arenas are used in
+     * turn, and the one holding fragment N-2 is reset when fragment N is
+     * read, so that a whole fragment is reclaimed at once.
+     * Subclasses that keep the atoms or tables of a fragment beyond the
+     * processing of the next fragment must not enable this.
+     */
+    void EnableFragmentArenas();
     
     // accessors
     AP4_Size GetBufferFullness() { return m_BufferFullness; }
@@ -175,6 +196,7 @@ protected:
                               AP4_UI32&       track_id);
     void       FlushQueue(Tracker* tracker);
     void       FlushQueues();
+    AP4_Result ReadSampleData(AP4_Sample& sample, AP4_DataBuffer& sample_data);
     
     // members
     AP4_Movie&                      m_Movie;
@@ -187,6 +209,12 @@ protected:
     AP4_Size                        m_BufferFullness;
     AP4_Size                        m_BufferFullnessPeak;
     AP4_ContainerAtom*              m_Mfra;
+    AP4_Size                        m_ReadAheadSize;
+    AP4_DataBuffer                  m_ReadAheadBuffer;
+    std::shared_ptr<AP4_ByteStream> m_ReadAheadStream;
+    AP4_Position                    m_ReadAheadOffset;
+    AP4_Arena*                      m_FragmentArenas[2];
+    unsigned int                    m_FragmentArenaIndex;
 };
 
 /*----------------------------------------------------------------------
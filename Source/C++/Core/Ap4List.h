@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
 #include "Ap4Results.h"
+#include "Ap4Arena.h"
 
 /*----------------------------------------------------------------------
 |   forward references
@@ -48,7 +49,7 @@ class AP4_List
 {
 public:
     // types
-    class Item
+    class Item : public AP4_ArenaObject
     {
     public:
         // types
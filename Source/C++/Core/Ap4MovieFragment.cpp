@@ -130,7 +130,8 @@ AP4_MovieFragment::CreateSampleTable(AP4_MoovAtom*                   moov,
                                      AP4_Position                    moof_offset,
                                      AP4_Position                    mdat_payload_offset,
                                      AP4_UI64                        dts_origin,
-                                     AP4_FragmentSampleTable*&       sample_table)
+                                     AP4_FragmentSampleTable*&       sample_table,
+                                     AP4_Arena*                      arena)
 {
     // default value
     sample_table = NULL;
@@ -160,7 +161,8 @@ AP4_MovieFragment::CreateSampleTable(AP4_MoovAtom*                   moov,
                                                    sample_stream,
                                                    moof_offset,
                                                    mdat_payload_offset,
-                                                   dts_origin);
+                                                   dts_origin,
+                                                   arena);
         return AP4_SUCCESS;
     }
     
@@ -177,8 +179,9 @@ AP4_MovieFragment::CreateSampleTable(AP4_Movie*                      movie,
                                      AP4_Position                    moof_offset,
                                      AP4_Position                    mdat_payload_offset,
                                      AP4_UI64                        dts_origin,
-                                     AP4_FragmentSampleTable*&       sample_table)
+                                     AP4_FragmentSampleTable*&       sample_table,
+                                     AP4_Arena*                      arena)
 {
     AP4_MoovAtom* moov = movie?movie->GetMoovAtom():NULL;
-    return CreateSampleTable(moov, track_id, sample_stream, moof_offset, mdat_payload_offset, dts_origin, sample_table);
+    return CreateSampleTable(moov, track_id, sample_stream, moof_offset, mdat_payload_offset, dts_origin, sample_table, arena);
 }
@@ -75,14 +75,16 @@ public:
                                          AP4_Position                    moof_offset,
                                          AP4_Position                    mdat_payload_offset, // hack because MS doesn't implement the spec properly
                                          AP4_UI64                        dts_origin,
-                                         AP4_FragmentSampleTable*&       sample_table);
+                                         AP4_FragmentSampleTable*&       sample_table,
+                                         AP4_Arena*                      arena = NULL);
     AP4_Result         CreateSampleTable(AP4_Movie*                      movie,
                                          AP4_UI32                        track_id,
                                          std::shared_ptr<AP4_ByteStream> sample_stream,
                                          AP4_Position                    moof_offset,
                                          AP4_Position                    mdat_payload_offset, // hack because MS doesn't implement the spec properly
                                          AP4_UI64                        dts_origin,
-                                         AP4_FragmentSampleTable*&       sample_table);
+                                         AP4_FragmentSampleTable*&       sample_table,
+                                         AP4_Arena*                      arena = NULL);
     
 private:
     // members
@@ -45,34 +45,6 @@ const unsigned int AP4_MPEG2TS_PACKET_PAYLOAD_SIZE = 184;
 const unsigned int AP4_MPEG2TS_SYNC_BYTE           = 0x47;
 const unsigned int AP4_MPEG2TS_PCR_ADAPTATION_SIZE = 6;
 
-static unsigned char const StuffingBytes[AP4_MPEG2TS_PACKET_SIZE] = 
-{
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-    0xFF, 0xFF, 0xFF, 0xFF
-};
-
 const unsigned int AP4_HEVC_NALU_TYPE_VPS_NUT        = 32;
 const unsigned int AP4_HEVC_NALU_TYPE_SPS_NUT        = 33;
 const unsigned int AP4_HEVC_NALU_TYPE_PPS_NUT        = 34;
@@ -208,19 +180,18 @@ ComputeCRC(const unsigned char* data, unsigned int data_size)
 }
 
 /*----------------------------------------------------------------------
-|   AP4_Mpeg2TsWriter::Stream::WritePacketHeader
+|   AP4_Mpeg2TsWriter::Stream::FormatPacketHeader
 +---------------------------------------------------------------------*/
-void
-AP4_Mpeg2TsWriter::Stream::WritePacketHeader(bool            payload_start, 
-                                             unsigned int&   payload_size,
-                                             bool            with_pcr,
-                                             AP4_UI64        pcr,
-                                             AP4_ByteStream& output)
+AP4_UI08*
+AP4_Mpeg2TsWriter::Stream::FormatPacketHeader(bool          payload_start, 
+                                              unsigned int& payload_size,
+                                              bool          with_pcr,
+                                              AP4_UI64      pcr,
+                                              AP4_UI08*     packet)
 {
-    unsigned char header[4];
-    header[0] = AP4_MPEG2TS_SYNC_BYTE;
-    header[1] = (AP4_UI08)(((payload_start?1:0)<<6) | (m_PID >> 8));
-    header[2] = m_PID & 0xFF;
+    packet[0] = AP4_MPEG2TS_SYNC_BYTE;
+    packet[1] = (AP4_UI08)(((payload_start?1:0)<<6) | (m_PID >> 8));
+    packet[2] = m_PID & 0xFF;
     
     unsigned int adaptation_field_size = 0;
     if (with_pcr) adaptation_field_size += 2+AP4_MPEG2TS_PCR_ADAPTATION_SIZE;
@@ -237,39 +208,67 @@ AP4_Mpeg2TsWriter::Stream::WritePacketHeader(bool            payload_start,
     
     if (adaptation_field_size == 0) {
         // no adaptation field
-        header[3] = (1<<4) | ((m_ContinuityCounter++)&0x0F);
-        output.Write(header, 4);
+        packet[3] = (AP4_UI08)((1<<4) | ((m_ContinuityCounter++)&0x0F));
     } else {
         // adaptation field present
-        header[3] = (3<<4) | ((m_ContinuityCounter++)&0x0F);
-        output.Write(header, 4);
+        packet[3] = (AP4_UI08)((3<<4) | ((m_ContinuityCounter++)&0x0F));
         
         if (adaptation_field_size == 1) {
             // just one byte (stuffing)
-            output.WriteUI08(0);
+            packet[4] = 0;
         } else {
             // two or more bytes (stuffing and/or PCR)
-            output.WriteUI08((AP4_UI08)(adaptation_field_size-1));
-            output.WriteUI08(with_pcr?(1<<4):0);
+            packet[4] = (AP4_UI08)(adaptation_field_size-1);
+            packet[5] = with_pcr?(1<<4):0;
             unsigned int pcr_size = 0;
             if (with_pcr) {
                 pcr_size = AP4_MPEG2TS_PCR_ADAPTATION_SIZE;
-                AP4_UI64 pcr_base = pcr/300;
+                AP4_UI64 pcr_base = (pcr/300) & 0x1FFFFFFFFULL;
                 AP4_UI32 pcr_ext  = (AP4_UI32)(pcr%300);
-                AP4_BitWriter writer(pcr_size);
-                writer.Write((AP4_UI32)(pcr_base>>32), 1);
-                writer.Write((AP4_UI32)pcr_base, 32);
-                writer.Write(0x3F, 6);
-                writer.Write(pcr_ext, 9);
-                output.Write(writer.GetData(), pcr_size);
+                packet[6]  = (AP4_UI08)(pcr_base>>25);
+                packet[7]  = (AP4_UI08)(pcr_base>>17);
+                packet[8]  = (AP4_UI08)(pcr_base>> 9);
+                packet[9]  = (AP4_UI08)(pcr_base>> 1);
+                packet[10] = (AP4_UI08)(((pcr_base&1)<<7) | 0x7E | (pcr_ext>>8));
+                packet[11] = (AP4_UI08)(pcr_ext);
             } 
             if (adaptation_field_size > 2) {
-                output.Write(StuffingBytes, adaptation_field_size-pcr_size-2);
+                AP4_SetMemory(&packet[6+pcr_size], 0xFF, adaptation_field_size-pcr_size-2);
             }
         }
     }
+    
+    return packet+4+adaptation_field_size;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mpeg2TsWriter::Stream::WritePacketHeader
++---------------------------------------------------------------------*/
+void
+AP4_Mpeg2TsWriter::Stream::WritePacketHeader(bool            payload_start, 
+                                             unsigned int&   payload_size,
+                                             bool            with_pcr,
+                                             AP4_UI64        pcr,
+                                             AP4_ByteStream& output)
+{
+    AP4_UI08  packet[AP4_MPEG2TS_PACKET_SIZE];
+    AP4_UI08* payload = FormatPacketHeader(payload_start, payload_size, with_pcr, pcr, packet);
+    output.Write(packet, (AP4_Size)(payload-packet));
 } 
 
+/*----------------------------------------------------------------------
+|   FormatTimestamp
++---------------------------------------------------------------------*/
+static void
+FormatTimestamp(AP4_UI08* buffer, unsigned int prefix, AP4_UI64 ts)
+{
+    buffer[0] = (AP4_UI08)((prefix<<4) | (((ts>>30)&0x07)<<1) | 1);
+    buffer[1] = (AP4_UI08)(ts>>22);
+    buffer[2] = (AP4_UI08)((((ts>>15)&0x7F)<<1) | 1);
+    buffer[3] = (AP4_UI08)(ts>>7);
+    buffer[4] = (AP4_UI08)(((ts&0x7F)<<1) | 1);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Mpeg2TsWriter::SampleStream::WritePES
 +---------------------------------------------------------------------*/
@@ -281,6 +280,23 @@ AP4_Mpeg2TsWriter::SampleStream::WritePES(const unsigned char* data,
                                           AP4_UI64             pts, 
                                           bool                 with_pcr, 
                                           AP4_ByteStream&      output)
+{
+    return WritePES(NULL, 0, data, data_size, dts, with_dts, pts, with_pcr, output);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mpeg2TsWriter::SampleStream::WritePES
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Mpeg2TsWriter::SampleStream::WritePES(const unsigned char* prefix,
+                                          unsigned int         prefix_size,
+                                          const unsigned char* data, 
+                                          unsigned int         data_size, 
+                                          AP4_UI64             dts, 
+                                          bool                 with_dts, 
+                                          AP4_UI64             pts, 
+                                          bool                 with_pcr, 
+                                          AP4_ByteStream&      output)
 {
     // ISO/IEC 13818-1 section 2.7.5 says a DTS shall appear only if the
     // decoding time differs from the presentation time.
@@ -289,69 +305,69 @@ AP4_Mpeg2TsWriter::SampleStream::WritePES(const unsigned char* data,
     }
     
     unsigned int pes_header_size = 14+(with_dts?5:0);
-    AP4_BitWriter pes_header(pes_header_size);
+    AP4_UI08     pes_header[19];
     
     // adjust the base timestamp, offset from the PCR
     dts += m_PcrOffset;
     pts += m_PcrOffset;
     
-    pes_header.Write(0x000001, 24);    // packet_start_code_prefix
-    pes_header.Write(m_StreamId, 8);   // stream_id
-    pes_header.Write(m_StreamId == AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO?0:(data_size+pes_header_size-6), 16); // PES_packet_length
-    pes_header.Write(2, 2);            // '01'
-    pes_header.Write(0, 2);            // PES_scrambling_control
-    pes_header.Write(0, 1);            // PES_priority
-    pes_header.Write(1, 1);            // data_alignment_indicator
-    pes_header.Write(0, 1);            // copyright
-    pes_header.Write(0, 1);            // original_or_copy
-    pes_header.Write(with_dts?3:2, 2); // PTS_DTS_flags
-    pes_header.Write(0, 1);            // ESCR_flag
-    pes_header.Write(0, 1);            // ES_rate_flag
-    pes_header.Write(0, 1);            // DSM_trick_mode_flag
-    pes_header.Write(0, 1);            // additional_copy_info_flag
-    pes_header.Write(0, 1);            // PES_CRC_flag
-    pes_header.Write(0, 1);            // PES_extension_flag
-    pes_header.Write(pes_header_size-9, 8);// PES_header_data_length
-    
-    pes_header.Write(with_dts?3:2, 4);         // '0010' or '0011'
-    pes_header.Write((AP4_UI32)(pts>>30), 3);  // PTS[32..30]
-    pes_header.Write(1, 1);                    // marker_bit
-    pes_header.Write((AP4_UI32)(pts>>15), 15); // PTS[29..15]
-    pes_header.Write(1, 1);                    // marker_bit
-    pes_header.Write((AP4_UI32)pts, 15);       // PTS[14..0]
-    pes_header.Write(1, 1);                    // market_bit
-    
+    unsigned int pes_packet_length = 0;
+    if (m_StreamId != AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO) {
+        pes_packet_length = (prefix_size+data_size+pes_header_size-6) & 0xFFFF;
+    }
+    pes_header[0] = 0x00;                           // packet_start_code_prefix
+    pes_header[1] = 0x00;
+    pes_header[2] = 0x01;
+    pes_header[3] = (AP4_UI08)m_StreamId;           // stream_id
+    pes_header[4] = (AP4_UI08)(pes_packet_length>>8); // PES_packet_length
+    pes_header[5] = (AP4_UI08)(pes_packet_length);
+    pes_header[6] = 0x84;                           // '10', not scrambled, data_alignment_indicator
+    pes_header[7] = (AP4_UI08)((with_dts?3:2)<<6);  // PTS_DTS_flags, no other flags
+    pes_header[8] = (AP4_UI08)(pes_header_size-9);  // PES_header_data_length
+    FormatTimestamp(&pes_header[9], with_dts?3:2, pts);
     if (with_dts) {
-        pes_header.Write(1, 4);                    // '0001'
-        pes_header.Write((AP4_UI32)(dts>>30), 3);  // DTS[32..30]
-        pes_header.Write(1, 1);                    // marker_bit
-        pes_header.Write((AP4_UI32)(dts>>15), 15); // DTS[29..15]
-        pes_header.Write(1, 1);                    // marker_bit
-        pes_header.Write((AP4_UI32)dts, 15);       // DTS[14..0]
-        pes_header.Write(1, 1);                    // market_bit
+        FormatTimestamp(&pes_header[14], 1, dts);
     }
     
-    bool first_packet = true;
-    data_size += pes_header_size; // add size of PES header
-    while (data_size) {
-        unsigned int payload_size = data_size;
-        if (payload_size > AP4_MPEG2TS_PACKET_PAYLOAD_SIZE) payload_size = AP4_MPEG2TS_PACKET_PAYLOAD_SIZE;
-        
-        if (first_packet)  {
-            WritePacketHeader(first_packet, payload_size, with_pcr, ((with_dts?dts:pts)-m_PcrOffset)*300, output);
-            first_packet = false;
-            output.Write(pes_header.GetData(), pes_header_size);
-            output.Write(data, payload_size-pes_header_size);
-            data += payload_size-pes_header_size;
+    // compute how many packets we need and make room for them
+    unsigned int total_size   = pes_header_size+prefix_size+data_size;
+    unsigned int first_size   = AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-(with_pcr?2+AP4_MPEG2TS_PCR_ADAPTATION_SIZE:0);
+    unsigned int packet_count = 1;
+    if (total_size > first_size) {
+        packet_count += (total_size-first_size+AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-1)/AP4_MPEG2TS_PACKET_PAYLOAD_SIZE;
+    }
+    AP4_Result result = m_Packets.SetDataSize(packet_count*AP4_MPEG2TS_PACKET_SIZE);
+    if (AP4_FAILED(result)) return result;
+    
+    // format all the packets
+    const unsigned char* sources[3]      = { pes_header,      prefix,      data      };
+    unsigned int         source_sizes[3] = { pes_header_size, prefix_size, data_size };
+    unsigned int         source = 0;
+    AP4_UI08*            packet = m_Packets.UseData();
+    for (unsigned int i=0; i<packet_count; i++, packet += AP4_MPEG2TS_PACKET_SIZE) {
+        unsigned int payload_size = total_size;
+        AP4_UI08* payload;
+        if (i == 0) {
+            payload = FormatPacketHeader(true, payload_size, with_pcr, ((with_dts?dts:pts)-m_PcrOffset)*300, packet);
         } else {
-            WritePacketHeader(first_packet, payload_size, false, 0, output);
-            output.Write(data, payload_size);
-            data += payload_size;
+            payload = FormatPacketHeader(false, payload_size, false, 0, packet);
+        }
+        total_size -= payload_size;
+        
+        // fill the payload from the PES header, prefix and data, in that order
+        while (payload_size) {
+            while (source_sizes[source] == 0) ++source;
+            unsigned int chunk = source_sizes[source];
+            if (chunk > payload_size) chunk = payload_size;
+            AP4_CopyMemory(payload, sources[source], chunk);
+            payload              += chunk;
+            payload_size         -= chunk;
+            sources[source]      += chunk;
+            source_sizes[source] -= chunk;
         }
-        data_size -= payload_size;
     }
     
-    return AP4_SUCCESS;
+    return output.Write(m_Packets.GetData(), m_Packets.GetDataSize());
 }
 
 /*----------------------------------------------------------------------
@@ -372,6 +388,19 @@ public:
                            AP4_DataBuffer&        sample_data, 
                            AP4_SampleDescription* sample_description,
                            bool                   with_pcr, 
+                           AP4_ByteStream&        output) {
+        return WriteSample(sample,
+                           sample_data.GetData(),
+                           sample_data.GetDataSize(),
+                           sample_description,
+                           with_pcr,
+                           output);
+    }
+    AP4_Result WriteSample(AP4_Sample&            sample,
+                           const AP4_UI08*        sample_data,
+                           AP4_Size               sample_data_size,
+                           AP4_SampleDescription* sample_description,
+                           bool                   with_pcr, 
                            AP4_ByteStream&        output);
     
 private:
@@ -413,7 +442,8 @@ AP4_Mpeg2TsAudioSampleStream::Create(AP4_UI16                          pid,
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_Mpeg2TsAudioSampleStream::WriteSample(AP4_Sample&            sample,
-                                          AP4_DataBuffer&        sample_data,
+                                          const AP4_UI08*        sample_data,
+                                          AP4_Size               sample_data_size,
                                           AP4_SampleDescription* sample_description,
                                           bool                   with_pcr, 
                                           AP4_ByteStream&        output)
@@ -448,17 +478,15 @@ AP4_Mpeg2TsAudioSampleStream::WriteSample(AP4_Sample&            sample,
         unsigned int sampling_frequency_index = GetSamplingFrequencyIndex(sample_rate);
         unsigned int channel_configuration    = channel_count;
 
-        unsigned char* buffer = new unsigned char[7+sample_data.GetDataSize()];
-        MakeAdtsHeader(buffer, sample_data.GetDataSize(), sampling_frequency_index, channel_configuration);
-        AP4_CopyMemory(buffer+7, sample_data.GetData(), sample_data.GetDataSize());
+        unsigned char adts_header[7];
+        MakeAdtsHeader(adts_header, sample_data_size, sampling_frequency_index, channel_configuration);
         AP4_UI64 ts = AP4_ConvertTime(sample.GetDts(), m_TimeScale, 90000);
-        WritePES(buffer, 7+sample.GetSize(), ts, false, ts, with_pcr, output);
-        delete[] buffer;
+        WritePES(adts_header, 7, sample_data, sample_data_size, ts, false, ts, with_pcr, output);
     } else if (sample_description->GetFormat() == AP4_SAMPLE_FORMAT_AC_3 ||
                sample_description->GetFormat() == AP4_SAMPLE_FORMAT_EC_3 ||
                sample_description->GetFormat() == AP4_SAMPLE_FORMAT_AC_4) {
         AP4_UI64 ts = AP4_ConvertTime(sample.GetDts(), m_TimeScale, 90000);
-        WritePES(sample_data.GetData(), sample_data.GetDataSize(), ts, false, ts, with_pcr, output);
+        WritePES(sample_data, sample_data_size, ts, false, ts, with_pcr, output);
     } else {
         return AP4_ERROR_NOT_SUPPORTED;
     }
@@ -482,7 +510,20 @@ public:
                              AP4_Size                          descriptor_length,
                              AP4_UI64                          pcr_offset = AP4_MPEG2_TS_DEFAULT_PCR_OFFSET);
     AP4_Result WriteSample(AP4_Sample&            sample,
-                           AP4_DataBuffer&        sample_data,
+                           AP4_DataBuffer&        sample_data, 
+                           AP4_SampleDescription* sample_description,
+                           bool                   with_pcr, 
+                           AP4_ByteStream&        output) {
+        return WriteSample(sample,
+                           sample_data.GetData(),
+                           sample_data.GetDataSize(),
+                           sample_description,
+                           with_pcr,
+                           output);
+    }
+    AP4_Result WriteSample(AP4_Sample&            sample,
+                           const AP4_UI08*        sample_data,
+                           AP4_Size               sample_data_size,
                            AP4_SampleDescription* sample_description,
                            bool                   with_pcr, 
                            AP4_ByteStream&        output);
@@ -510,6 +551,7 @@ private:
     AP4_DataBuffer m_Prefix;
     unsigned int   m_NaluLengthSize;
     AP4_UI64       m_SamplesWritten;
+    AP4_DataBuffer m_PesData;
 };
 
 /*----------------------------------------------------------------------
@@ -535,7 +577,8 @@ AP4_Mpeg2TsVideoSampleStream::Create(AP4_UI16                          pid,
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_Mpeg2TsVideoSampleStream::WriteSample(AP4_Sample&            sample,
-                                          AP4_DataBuffer&        sample_data, 
+                                          const AP4_UI08*        sample_data,
+                                          AP4_Size               sample_data_size,
                                           AP4_SampleDescription* sample_description,
                                           bool                   with_pcr, 
                                           AP4_ByteStream&        output)
@@ -652,11 +695,12 @@ AP4_Mpeg2TsVideoSampleStream::WriteSample(AP4_Sample&            sample,
     }
     
     // write the NAL units
-    const unsigned char* data      = sample_data.GetData();
-    unsigned int         data_size = sample_data.GetDataSize();
+    const unsigned char* data      = sample_data;
+    unsigned int         data_size = sample_data_size;
     
-    // allocate a buffer for the PES packet
-    AP4_DataBuffer pes_data;
+    // reuse the buffer for the PES packet
+    AP4_DataBuffer& pes_data = m_PesData;
+    pes_data.SetDataSize(0);
 
     // output all NALUs
     for (unsigned int nalu_count = 0; data_size; nalu_count++) {
@@ -768,8 +812,9 @@ AP4_Mpeg2TsWriter::~AP4_Mpeg2TsWriter()
 AP4_Result
 AP4_Mpeg2TsWriter::WritePAT(AP4_ByteStream& output)
 {
+    AP4_UI08     packet[AP4_MPEG2TS_PACKET_SIZE];
     unsigned int payload_size = AP4_MPEG2TS_PACKET_PAYLOAD_SIZE;
-    m_PAT->WritePacketHeader(true, payload_size, false, 0, output);
+    AP4_UI08*    payload = m_PAT->FormatPacketHeader(true, payload_size, false, 0, packet);
     
     AP4_BitWriter writer(1024);
     
@@ -790,11 +835,10 @@ AP4_Mpeg2TsWriter::WritePAT(AP4_ByteStream& output)
     writer.Write(m_PMT->GetPID(), 13); // program_map_PID
     writer.Write(ComputeCRC(writer.GetData()+1, 17-1-4), 32);
     
-    output.Write(writer.GetData(), 17);
+    AP4_CopyMemory(payload, writer.GetData(), 17);
+    AP4_SetMemory(payload+17, 0xFF, AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-17);
     
-    output.Write(StuffingBytes, AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-17);
-    
-    return AP4_SUCCESS;
+    return output.Write(packet, AP4_MPEG2TS_PACKET_SIZE);
 }
 
 /*----------------------------------------------------------------------
@@ -808,8 +852,9 @@ AP4_Mpeg2TsWriter::WritePMT(AP4_ByteStream& output)
         return AP4_ERROR_INVALID_STATE;
     }
     
+    AP4_UI08     packet[AP4_MPEG2TS_PACKET_SIZE];
     unsigned int payload_size = AP4_MPEG2TS_PACKET_PAYLOAD_SIZE;
-    m_PMT->WritePacketHeader(true, payload_size, false, 0, output);
+    AP4_UI08*    payload = m_PMT->FormatPacketHeader(true, payload_size, false, 0, packet);
     
     AP4_BitWriter writer(1024);
     
@@ -865,10 +910,10 @@ AP4_Mpeg2TsWriter::WritePMT(AP4_ByteStream& output)
     
     writer.Write(ComputeCRC(writer.GetData()+1, section_length-1), 32); // CRC
     
-    output.Write(writer.GetData(), section_length+4);
-    output.Write(StuffingBytes, AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-(section_length+4));
+    AP4_CopyMemory(payload, writer.GetData(), section_length+4);
+    AP4_SetMemory(payload+section_length+4, 0xFF, AP4_MPEG2TS_PACKET_PAYLOAD_SIZE-(section_length+4));
     
-    return AP4_SUCCESS;
+    return output.Write(packet, AP4_MPEG2TS_PACKET_SIZE);
 }
 
 /*----------------------------------------------------------------------
@@ -938,6 +983,16 @@ AP4_Mpeg2TsWriter::SampleStream::WriteSample(AP4_Sample&            sample,
                                              bool                   with_pcr, 
                                              AP4_ByteStream&        output)
 {
+    const AP4_UI08* sample_view = NULL;
+    if (AP4_SUCCEEDED(sample.GetDataView(sample_view))) {
+        // the data is already in memory, pass it on without a copy
+        return WriteSample(sample,
+                           sample_view,
+                           sample.GetSize(),
+                           sample_description,
+                           with_pcr,
+                           output);
+    }
     AP4_DataBuffer sample_data;
     AP4_Result result = sample.ReadData(sample_data);
     if (AP4_FAILED(result)) return result;
@@ -948,4 +1003,27 @@ AP4_Mpeg2TsWriter::SampleStream::WriteSample(AP4_Sample&            sample,
                        output);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Mpeg2TsWriter::SampleStream::WriteSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_Mpeg2TsWriter::SampleStream::WriteSample(AP4_Sample&            sample, 
+                                             const AP4_UI08*        sample_data,
+                                             AP4_Size               sample_data_size,
+                                             AP4_SampleDescription* sample_description,
+                                             bool                   with_pcr, 
+                                             AP4_ByteStream&        output)
+{
+    // the data may be read-only while the AP4_DataBuffer variant may
+    // modify it, so copy it
+    AP4_DataBuffer buffer;
+    AP4_Result result = buffer.SetData(sample_data, sample_data_size);
+    if (AP4_FAILED(result)) return result;
+    return WriteSample(sample,
+                       buffer,
+                       sample_description,
+                       with_pcr,
+                       output);
+}
+
 
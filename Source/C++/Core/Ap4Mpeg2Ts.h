@@ -86,6 +86,16 @@ public:
                                bool            with_pcr,
                                AP4_UI64        pcr,
                                AP4_ByteStream& output);
+        /**
+         * Format a packet header (and adaptation field, if any) in place.
+         * packet must point to a buffer of at least 188 bytes.
+         * Returns a pointer to where the payload of the packet starts.
+         */
+        AP4_UI08* FormatPacketHeader(bool          payload_start, 
+                                     unsigned int& payload_size,
+                                     bool          with_pcr,
+                                     AP4_UI64      pcr,
+                                     AP4_UI08*     packet);
         
     private:
         AP4_UI16     m_PID;
@@ -125,6 +135,18 @@ public:
                                        bool                   with_pcr, 
                                        AP4_ByteStream&        output) = 0;
 
+        /**
+         * Write a sample whose data may be read-only, such as a view of a
+         * mapped file. The default implementation copies the data and calls
+         * the AP4_DataBuffer variant, which may modify it.
+         */
+        virtual AP4_Result WriteSample(AP4_Sample&            sample,
+                                       const AP4_UI08*        sample_data,
+                                       AP4_Size               sample_data_size,
+                                       AP4_SampleDescription* sample_description,
+                                       bool                   with_pcr,
+                                       AP4_ByteStream&        output);
+
         AP4_Result WriteSample(AP4_Sample&            sample, 
                                AP4_SampleDescription* sample_description,
                                bool                   with_pcr, 
@@ -142,6 +164,24 @@ public:
         AP4_UI32       m_TimeScale;
         AP4_DataBuffer m_Descriptor;
         AP4_UI64       m_PcrOffset;
+        
+    protected:
+        /**
+         * Write a PES packet whose payload is the concatenation of prefix
+         * and data. All the TS packets are formatted in a buffer that is
+         * reused from one call to the next, and written with a single call.
+         */
+        AP4_Result WritePES(const unsigned char* prefix,
+                            unsigned int         prefix_size,
+                            const unsigned char* data, 
+                            unsigned int         data_size, 
+                            AP4_UI64             dts, 
+                            bool                 with_dts, 
+                            AP4_UI64             pts, 
+                            bool                 with_pcr, 
+                            AP4_ByteStream&      output);
+        
+        AP4_DataBuffer m_Packets;
     };
     
     // constructor
@@ -48,6 +48,7 @@
 #include "Ap4SidxAtom.h"
 #include "Ap4DataBuffer.h"
 #include "Ap4Debug.h"
+#include "Ap4ThreadPool.h"
 
 /*----------------------------------------------------------------------
 |   types
@@ -62,12 +63,12 @@ struct AP4_SampleLocator {
     AP4_AtomSampleTable* m_SampleTable;
     AP4_Ordinal          m_SampleIndex;
     AP4_Ordinal          m_ChunkIndex;
-    AP4_Sample           m_Sample;
 };
 
 struct AP4_SampleCursor {
     AP4_SampleCursor() : m_EndReached(false) {}
     AP4_SampleLocator m_Locator;
+    AP4_Sample        m_Sample;
     bool              m_EndReached;
 };
 
@@ -137,257 +138,470 @@ FindFragmentMapEntry(AP4_Array<FragmentMapEntry>& fragment_map, AP4_UI64 fragmen
 }
 
 /*----------------------------------------------------------------------
-|   AP4_Processor::ProcessFragments
+|   AP4_ProcessorFragment
++---------------------------------------------------------------------*/
+struct AP4_ProcessorFragment {
+    AP4_ProcessorFragment(AP4_ContainerAtom* moof,
+                          AP4_UI64           offset,
+                          unsigned int       index) :
+        m_Moof(moof),
+        m_Offset(offset),
+        m_Index(index),
+        m_Fragment(new AP4_MovieFragment(moof)),
+        m_SamplesLoaded(false) {}
+    ~AP4_ProcessorFragment() {
+        delete m_Fragment;
+        for (unsigned int i=0; i<m_Handlers.ItemCount(); i++) {
+            delete m_Handlers[i];
+        }
+        for (unsigned int i=0; i<m_SampleTables.ItemCount(); i++) {
+            delete m_SampleTables[i];
+        }
+        for (unsigned int i=0; i<m_SampleData.ItemCount(); i++) {
+            delete m_SampleData[i];
+        }
+    }
+
+    bool       CanProcessConcurrently();
+    AP4_Result LoadSamples();
+    AP4_Result ProcessSamples();
+
+    AP4_ContainerAtom*                         m_Moof;
+    AP4_UI64                                   m_Offset;
+    unsigned int                               m_Index;
+    AP4_MovieFragment*                         m_Fragment;
+    AP4_Array<AP4_Processor::FragmentHandler*> m_Handlers;
+    AP4_Array<AP4_FragmentSampleTable*>        m_SampleTables;
+    bool                                       m_SamplesLoaded;
+    AP4_Array<AP4_DataBuffer*>                 m_SampleData;
+    std::future<AP4_Result>                    m_Processed;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ProcessorFragment::CanProcessConcurrently
++---------------------------------------------------------------------*/
+bool
+AP4_ProcessorFragment::CanProcessConcurrently()
+{
+    bool has_handler = false;
+    for (unsigned int i=0; i<m_Handlers.ItemCount(); i++) {
+        if (m_Handlers[i] == NULL) continue;
+        if (!m_Handlers[i]->IsIndependent()) return false;
+        has_handler = true;
+    }
+    return has_handler;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ProcessorFragment::LoadSamples
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_Processor::ProcessFragments(AP4_MoovAtom*                   moov, 
-                                AP4_List<AP4_AtomLocator>&      atoms, 
-                                AP4_ContainerAtom*              mfra,
-                                AP4_SidxAtom*                   sidx,
-                                AP4_Position                    sidx_position,
-                                std::shared_ptr<AP4_ByteStream> input, 
-                                AP4_ByteStream&                 output)
+AP4_ProcessorFragment::LoadSamples()
 {
-    unsigned int fragment_index = 0;
-    AP4_Array<FragmentMapEntry> fragment_map;
+    AP4_Array<AP4_SampleDataView> views;
+    AP4_DataBuffer                arena;
+    for (unsigned int i=0; i<m_SampleTables.ItemCount(); i++) {
+        const AP4_SampleRecordArray& samples = m_SampleTables[i]->GetSampleRecords();
+        AP4_Cardinal sample_count = samples.ItemCount();
+        if (sample_count == 0) continue;
+
+        // read the samples of the track fragment with as few reads as possible
+        AP4_Result result = views.SetItemCount(sample_count);
+        if (AP4_FAILED(result)) return result;
+        bool batched = AP4_SUCCEEDED(samples.ReadDataBatch(0, sample_count, arena, &views[0]));
+        for (unsigned int j=0; j<sample_count; j++) {
+            AP4_DataBuffer* data = new AP4_DataBuffer();
+            m_SampleData.Append(data);
+            if (batched) {
+                result = data->SetData(views[j].m_Data, views[j].m_Size);
+            } else {
+                AP4_Sample sample;
+                result = samples.GetSample(j, sample);
+                if (AP4_SUCCEEDED(result)) result = sample.ReadData(*data);
+            }
+            if (AP4_FAILED(result)) return result;
+        }
+    }
+    m_SamplesLoaded = true;
     
-    for (AP4_List<AP4_AtomLocator>::Item* item = atoms.FirstItem();
-                                          item;
-                                          item = item->GetNext(), ++fragment_index) {
-        AP4_AtomLocator*   locator     = item->GetData();
-        AP4_Atom*          atom        = locator->m_Atom;
-        AP4_UI64           atom_offset = locator->m_Offset;
-        AP4_UI64           mdat_payload_offset = atom_offset+atom->GetSize()+AP4_ATOM_HEADER_SIZE;
-        AP4_Sample         sample;
-        AP4_DataBuffer     sample_data_in;
-        AP4_DataBuffer     sample_data_out;
-        AP4_Result         result;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ProcessorFragment::ProcessSamples
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ProcessorFragment::ProcessSamples()
+{
+    unsigned int sample_ordinal = 0;
+    for (unsigned int i=0; i<m_SampleTables.ItemCount(); i++) {
+        AP4_Processor::FragmentHandler* handler = m_Handlers[i];
+        for (unsigned int j=0; j<m_SampleTables[i]->GetSampleCount(); j++, sample_ordinal++) {
+            if (handler == NULL) continue;
+            AP4_DataBuffer* data_out = new AP4_DataBuffer();
+            AP4_Result result = handler->ProcessSample(*m_SampleData[sample_ordinal], *data_out);
+            if (AP4_FAILED(result)) {
+                delete data_out;
+                return result;
+            }
+            delete m_SampleData[sample_ordinal];
+            m_SampleData[sample_ordinal] = data_out;
+        }
+    }
     
-        // if this is not a moof atom, just write it back and continue
-        if (atom->GetType() != AP4_ATOM_TYPE_MOOF) {
-            result = atom->Write(output);
-            if (AP4_FAILED(result)) return result;
-            continue;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Processor::PrepareFragment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Processor::PrepareFragment(AP4_MoovAtom*                   moov,
+                               AP4_ProcessorFragment&          fragment,
+                               std::shared_ptr<AP4_ByteStream> input)
+{
+    AP4_ContainerAtom* moof                = fragment.m_Moof;
+    AP4_UI64           atom_offset         = fragment.m_Offset;
+    AP4_UI64           mdat_payload_offset = atom_offset+moof->GetSize()+AP4_ATOM_HEADER_SIZE;
+    AP4_Result         result;
+
+    // process all the traf atoms
+    AP4_Array<AP4_Processor::FragmentHandler*>& handlers      = fragment.m_Handlers;
+    AP4_Array<AP4_FragmentSampleTable*>&        sample_tables = fragment.m_SampleTables;
+    for (;AP4_Atom* child = moof->GetChild(AP4_ATOM_TYPE_TRAF, handlers.ItemCount());) {
+        AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, child);
+        AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+        
+        // find the 'trak' for this track
+        AP4_TrakAtom* trak = NULL;
+        for (AP4_List<AP4_Atom>::Item* child_item = moov->GetChildren().FirstItem();
+                                       child_item;
+                                       child_item = child_item->GetNext()) {
+            AP4_Atom* child_atom = child_item->GetData();
+            if (child_atom->GetType() == AP4_ATOM_TYPE_TRAK) {
+                trak = AP4_DYNAMIC_CAST(AP4_TrakAtom, child_atom);
+                if (trak) {
+                    AP4_TkhdAtom* tkhd = AP4_DYNAMIC_CAST(AP4_TkhdAtom, trak->GetChild(AP4_ATOM_TYPE_TKHD));
+                    if (tkhd && tkhd->GetTrackId() == tfhd->GetTrackId()) {
+                        break;
+                    }
+                }
+                trak = NULL;
+            }
         }
         
-        // parse the moof
-        AP4_ContainerAtom* moof = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
-        AP4_MovieFragment* fragment = new AP4_MovieFragment(moof);
-
-        // process all the traf atoms
-        AP4_Array<AP4_Processor::FragmentHandler*> handlers;
-        AP4_Array<AP4_FragmentSampleTable*> sample_tables;
-        for (;AP4_Atom* child = moof->GetChild(AP4_ATOM_TYPE_TRAF, handlers.ItemCount());) {
-            AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, child);
-            AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
-            
-            // find the 'trak' for this track
-            AP4_TrakAtom* trak = NULL;
-            for (AP4_List<AP4_Atom>::Item* child_item = moov->GetChildren().FirstItem();
+        // find the 'trex' for this track
+        AP4_ContainerAtom* mvex = NULL;
+        AP4_TrexAtom*      trex = NULL;
+        mvex = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov->GetChild(AP4_ATOM_TYPE_MVEX));
+        if (mvex) {
+            for (AP4_List<AP4_Atom>::Item* child_item = mvex->GetChildren().FirstItem();
                                            child_item;
                                            child_item = child_item->GetNext()) {
                 AP4_Atom* child_atom = child_item->GetData();
-                if (child_atom->GetType() == AP4_ATOM_TYPE_TRAK) {
-                    trak = AP4_DYNAMIC_CAST(AP4_TrakAtom, child_atom);
-                    if (trak) {
-                        AP4_TkhdAtom* tkhd = AP4_DYNAMIC_CAST(AP4_TkhdAtom, trak->GetChild(AP4_ATOM_TYPE_TKHD));
-                        if (tkhd && tkhd->GetTrackId() == tfhd->GetTrackId()) {
-                            break;
-                        }
-                    }
-                    trak = NULL;
-                }
-            }
-            
-            // find the 'trex' for this track
-            AP4_ContainerAtom* mvex = NULL;
-            AP4_TrexAtom*      trex = NULL;
-            mvex = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov->GetChild(AP4_ATOM_TYPE_MVEX));
-            if (mvex) {
-                for (AP4_List<AP4_Atom>::Item* child_item = mvex->GetChildren().FirstItem();
-                                               child_item;
-                                               child_item = child_item->GetNext()) {
-                    AP4_Atom* child_atom = child_item->GetData();
-                    if (child_atom->GetType() == AP4_ATOM_TYPE_TREX) {
-                        trex = AP4_DYNAMIC_CAST(AP4_TrexAtom, child_atom);
-                        if (trex && trex->GetTrackId() == tfhd->GetTrackId()) {
-                            break;
-                        }
-                        trex = NULL;
+                if (child_atom->GetType() == AP4_ATOM_TYPE_TREX) {
+                    trex = AP4_DYNAMIC_CAST(AP4_TrexAtom, child_atom);
+                    if (trex && trex->GetTrackId() == tfhd->GetTrackId()) {
+                        break;
                     }
+                    trex = NULL;
                 }
             }
+        }
 
-            // create the handler for this traf
-            AP4_Processor::FragmentHandler* handler = CreateFragmentHandler(trak, trex, traf, *input, atom_offset);
-            if (handler) {
-                result = handler->ProcessFragment();
-                if (AP4_FAILED(result)) return result;
+        // create the handler for this traf
+        AP4_Processor::FragmentHandler* handler = CreateFragmentHandler(trak, trex, traf, *input, atom_offset);
+        if (handler) {
+            result = handler->ProcessFragment();
+            if (AP4_FAILED(result)) {
+                delete handler;
+                return result;
             }
-            handlers.Append(handler);
-            
-            // create a sample table object so we can read the sample data
-            AP4_FragmentSampleTable* sample_table = NULL;
-            result = fragment->CreateSampleTable(moov, tfhd->GetTrackId(), input, atom_offset, mdat_payload_offset, 0, sample_table);
-            if (AP4_FAILED(result)) return result;
-            sample_tables.Append(sample_table);
-            
-            // let the handler look at the samples before we process them
-            if (handler) result = handler->PrepareForSamples(sample_table);
-            if (AP4_FAILED(result)) return result;
         }
-             
-        // write the moof
-        AP4_UI64 moof_out_start = 0;
-        output.Tell(moof_out_start);
-        moof->Write(output);
+        handlers.Append(handler);
         
-        // remember the location of this fragment
-        FragmentMapEntry map_entry = {atom_offset, moof_out_start};
-        fragment_map.Append(map_entry);
-
-        // write an mdat header
-        AP4_Position mdat_out_start;
-        AP4_UI64 mdat_size = AP4_ATOM_HEADER_SIZE;
-        output.Tell(mdat_out_start);
-        output.WriteUI32(0);
-        output.WriteUI32(AP4_ATOM_TYPE_MDAT);
-
-        // process all track runs
-        for (unsigned int i=0; i<handlers.ItemCount(); i++) {
-            AP4_Processor::FragmentHandler* handler = handlers[i];
-
-            // get the track ID
-            AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof->GetChild(AP4_ATOM_TYPE_TRAF, i));
-            if (traf == NULL) continue;
-            AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
-            
-            // compute the base data offset
-            AP4_UI64 base_data_offset;
-            if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
-                base_data_offset = mdat_out_start+AP4_ATOM_HEADER_SIZE;
-            } else {
-                base_data_offset = moof_out_start;
-            }
-            
-            // build a list of all trun atoms
-            AP4_Array<AP4_TrunAtom*> truns;
-            for (AP4_List<AP4_Atom>::Item* child_item = traf->GetChildren().FirstItem();
-                                           child_item;
-                                           child_item = child_item->GetNext()) {
-                AP4_Atom* child_atom = child_item->GetData();
-                if (child_atom->GetType() == AP4_ATOM_TYPE_TRUN) {
-                    AP4_TrunAtom* trun = AP4_DYNAMIC_CAST(AP4_TrunAtom, child_atom);
-                    if (trun) {
-                        truns.Append(trun);
-                    }
+        // create a sample table object so we can read the sample data
+        AP4_FragmentSampleTable* sample_table = NULL;
+        result = fragment.m_Fragment->CreateSampleTable(moov, tfhd->GetTrackId(), input, atom_offset, mdat_payload_offset, 0, sample_table);
+        if (AP4_FAILED(result)) return result;
+        sample_tables.Append(sample_table);
+        
+        // let the handler look at the samples before we process them
+        if (handler) result = handler->PrepareForSamples(sample_table);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   WriteFragment
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteFragment(AP4_ProcessorFragment&       fragment,
+              AP4_ByteStream&              output,
+              AP4_SidxAtom*                sidx,
+              AP4_Position                 sidx_position,
+              AP4_Array<FragmentMapEntry>& fragment_map)
+{
+    AP4_ContainerAtom*                          moof          = fragment.m_Moof;
+    AP4_Array<AP4_Processor::FragmentHandler*>& handlers      = fragment.m_Handlers;
+    AP4_Array<AP4_FragmentSampleTable*>&        sample_tables = fragment.m_SampleTables;
+    unsigned int                                sample_ordinal = 0;
+    AP4_Sample                                  sample;
+    AP4_DataBuffer                              sample_data_in;
+    AP4_DataBuffer                              sample_data_out;
+    AP4_Result                                  result;
+         
+    // write the moof
+    AP4_UI64 moof_out_start = 0;
+    output.Tell(moof_out_start);
+    moof->Write(output);
+    
+    // remember the location of this fragment
+    FragmentMapEntry map_entry = {fragment.m_Offset, moof_out_start};
+    fragment_map.Append(map_entry);
+
+    // write an mdat header
+    AP4_Position mdat_out_start;
+    AP4_UI64 mdat_size = AP4_ATOM_HEADER_SIZE;
+    output.Tell(mdat_out_start);
+    output.WriteUI32(0);
+    output.WriteUI32(AP4_ATOM_TYPE_MDAT);
+
+    // process all track runs
+    for (unsigned int i=0; i<handlers.ItemCount(); i++) {
+        AP4_Processor::FragmentHandler* handler = handlers[i];
+
+        // get the track ID
+        AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof->GetChild(AP4_ATOM_TYPE_TRAF, i));
+        if (traf == NULL) continue;
+        AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+        
+        // compute the base data offset
+        AP4_UI64 base_data_offset;
+        if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
+            base_data_offset = mdat_out_start+AP4_ATOM_HEADER_SIZE;
+        } else {
+            base_data_offset = moof_out_start;
+        }
+        
+        // build a list of all trun atoms
+        AP4_Array<AP4_TrunAtom*> truns;
+        for (AP4_List<AP4_Atom>::Item* child_item = traf->GetChildren().FirstItem();
+                                       child_item;
+                                       child_item = child_item->GetNext()) {
+            AP4_Atom* child_atom = child_item->GetData();
+            if (child_atom->GetType() == AP4_ATOM_TYPE_TRUN) {
+                AP4_TrunAtom* trun = AP4_DYNAMIC_CAST(AP4_TrunAtom, child_atom);
+                if (trun) {
+                    truns.Append(trun);
                 }
             }
-            if (!truns.ItemCount()) {
-                continue;
+        }
+        if (!truns.ItemCount()) {
+            sample_ordinal += sample_tables[i]->GetSampleCount();
+            continue;
+        }
+        AP4_Ordinal   trun_index        = 0;
+        AP4_Ordinal   trun_sample_index = 0;
+        AP4_TrunAtom* trun = truns[0];
+        trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
+        
+        // write the mdat
+        AP4_UI32 default_sample_size = 0;
+        for (unsigned int j=0; j<sample_tables[i]->GetSampleCount(); j++, trun_sample_index++) {
+            // advance the trun index if necessary
+            if (trun_sample_index >= trun->GetEntries().ItemCount()) {
+                trun = truns[++trun_index];
+                trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
+                trun_sample_index = 0;
             }
-            AP4_Ordinal   trun_index        = 0;
-            AP4_Ordinal   trun_sample_index = 0;
-            AP4_TrunAtom* trun = truns[0];
-            trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
             
-            // write the mdat
-            AP4_UI32 default_sample_size = 0;
-            for (unsigned int j=0; j<sample_tables[i]->GetSampleCount(); j++, trun_sample_index++) {
-                // advance the trun index if necessary
-                if (trun_sample_index >= trun->GetEntries().ItemCount()) {
-                    trun = truns[++trun_index];
-                    trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
-                    trun_sample_index = 0;
-                }
-                
-                // get the next sample
+            // get the sample data, processing it now unless that was done ahead of time
+            AP4_DataBuffer* sample_data = NULL;
+            if (fragment.m_SamplesLoaded) {
+                sample_data = fragment.m_SampleData[sample_ordinal++];
+            } else {
                 result = sample_tables[i]->GetSample(j, sample);
                 if (AP4_FAILED(result)) return result;
-                sample.ReadData(sample_data_in);
-                
-                // process the sample data
+                result = sample.ReadData(sample_data_in);
+                if (AP4_FAILED(result)) return result;
                 if (handler) {
                     result = handler->ProcessSample(sample_data_in, sample_data_out);
                     if (AP4_FAILED(result)) return result;
-
-                    // write the sample data
-                    result = output.Write(sample_data_out.GetData(), sample_data_out.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_out.GetDataSize();
-                    
-                    // update the trun entry
-                    trun->UseEntries()[trun_sample_index].sample_size = sample_data_out.GetDataSize();
-
-                    // if this entry uses the default sample size, adjust the default accordingly
-                    // (NOTE: there's only one default, so this assumes, of course, that all sample
-                    // sizes change the same way, if they change at all)
-                    if (default_sample_size == 0 && (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) == 0) {
-                        default_sample_size = sample_data_out.GetDataSize();
-                    }
+                    sample_data = &sample_data_out;
                 } else {
-                    // write the sample data (unmodified)
-                    result = output.Write(sample_data_in.GetData(), sample_data_in.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_in.GetDataSize();
+                    sample_data = &sample_data_in;
                 }
             }
+            
+            // write the sample data
+            result = output.Write(sample_data->GetData(), sample_data->GetDataSize());
+            if (AP4_FAILED(result)) return result;
+
+            // update the mdat size
+            mdat_size += sample_data->GetDataSize();
 
             if (handler) {
-                // update the tfhd header
-                if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
-                    tfhd->SetBaseDataOffset(mdat_out_start+AP4_ATOM_HEADER_SIZE);
+                // update the trun entry
+                trun->UseEntries()[trun_sample_index].sample_size = sample_data->GetDataSize();
+
+                // if this entry uses the default sample size, adjust the default accordingly
+                // (NOTE: there's only one default, so this assumes, of course, that all sample
+                // sizes change the same way, if they change at all)
+                if (default_sample_size == 0 && (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) == 0) {
+                    default_sample_size = sample_data->GetDataSize();
                 }
-                if (tfhd->GetFlags() & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) {
-                    if (default_sample_size) {
-                        tfhd->SetDefaultSampleSize(default_sample_size);
-                    }
+            }
+        }
+
+        if (handler) {
+            // update the tfhd header
+            if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
+                tfhd->SetBaseDataOffset(mdat_out_start+AP4_ATOM_HEADER_SIZE);
+            }
+            if (tfhd->GetFlags() & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) {
+                if (default_sample_size) {
+                    tfhd->SetDefaultSampleSize(default_sample_size);
                 }
-                
-                // give the handler a chance to update the atoms
-                handler->FinishFragment();
             }
+            
+            // give the handler a chance to update the atoms
+            handler->FinishFragment();
         }
+    }
 
-        // update the mdat header
-        AP4_Position mdat_out_end;
-        output.Tell(mdat_out_end);
+    // update the mdat header
+    AP4_Position mdat_out_end;
+    output.Tell(mdat_out_end);
 #if defined(AP4_DEBUG)
-        AP4_ASSERT(mdat_out_end-mdat_out_start == mdat_size);
+    AP4_ASSERT(mdat_out_end-mdat_out_start == mdat_size);
 #endif
-        output.Seek(mdat_out_start);
-        output.WriteUI32((AP4_UI32)mdat_size);
-        output.Seek(mdat_out_end);
-        
-        // update the moof if needed
-        output.Seek(moof_out_start);
-        moof->Write(output);
-        output.Seek(mdat_out_end);
-        
-        // update the sidx if we have one
-        if (sidx && fragment_index < sidx->GetReferences().ItemCount()) {
-            if (fragment_index == 0) {
-                sidx->SetFirstOffset(moof_out_start-(sidx_position+sidx->GetSize()));
-            }
-            AP4_LargeSize fragment_size = mdat_out_end-moof_out_start;
-            AP4_SidxAtom::Reference& sidx_ref = sidx->UseReferences()[fragment_index];
-            sidx_ref.m_ReferencedSize = (AP4_UI32)fragment_size;
+    output.Seek(mdat_out_start);
+    output.WriteUI32((AP4_UI32)mdat_size);
+    output.Seek(mdat_out_end);
+    
+    // update the moof if needed
+    output.Seek(moof_out_start);
+    moof->Write(output);
+    output.Seek(mdat_out_end);
+    
+    // update the sidx if we have one
+    unsigned int fragment_index = fragment.m_Index;
+    if (sidx && fragment_index < sidx->GetReferences().ItemCount()) {
+        if (fragment_index == 0) {
+            sidx->SetFirstOffset(moof_out_start-(sidx_position+sidx->GetSize()));
+        }
+        AP4_LargeSize fragment_size = mdat_out_end-moof_out_start;
+        AP4_SidxAtom::Reference& sidx_ref = sidx->UseReferences()[fragment_index];
+        sidx_ref.m_ReferencedSize = (AP4_UI32)fragment_size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   WritePendingFragments
++---------------------------------------------------------------------*/
+static AP4_Result
+WritePendingFragments(AP4_List<AP4_ProcessorFragment>& pending,
+                      AP4_Cardinal                     max_pending,
+                      AP4_ByteStream&                  output,
+                      AP4_SidxAtom*                    sidx,
+                      AP4_Position                     sidx_position,
+                      AP4_Array<FragmentMapEntry>&     fragment_map)
+{
+    // write out the oldest fragments, in order, until no more than
+    // max_pending fragments remain in flight
+    while (pending.ItemCount() > max_pending) {
+        AP4_ProcessorFragment* fragment = NULL;
+        pending.PopHead(fragment);
+        AP4_Result result = fragment->m_Processed.get();
+        if (AP4_SUCCEEDED(result)) {
+            result = WriteFragment(*fragment, output, sidx, sidx_position, fragment_map);
         }
-        
-        // cleanup
         delete fragment;
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Processor::ProcessFragments
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Processor::ProcessFragments(AP4_MoovAtom*                   moov, 
+                                AP4_List<AP4_AtomLocator>&      atoms, 
+                                AP4_ContainerAtom*              mfra,
+                                AP4_SidxAtom*                   sidx,
+                                AP4_Position                    sidx_position,
+                                std::shared_ptr<AP4_ByteStream> input, 
+                                AP4_ByteStream&                 output)
+{
+    unsigned int                    fragment_index = 0;
+    AP4_Array<FragmentMapEntry>     fragment_map;
+    AP4_List<AP4_ProcessorFragment> pending;
+    AP4_Result                      result = AP4_SUCCESS;
+
+    // fragments whose handlers are independent are processed by a pool of
+    // workers while the following fragments are read and the previous ones
+    // are written out, in order
+    std::unique_ptr<AP4_ThreadPool> workers;
+    if (m_ThreadCount > 1) {
+        workers.reset(new AP4_ThreadPool(m_ThreadCount));
+    }
+    
+    for (AP4_List<AP4_AtomLocator>::Item* item = atoms.FirstItem();
+                                          item && AP4_SUCCEEDED(result);
+                                          item = item->GetNext(), ++fragment_index) {
+        AP4_AtomLocator* locator = item->GetData();
+        AP4_Atom*        atom    = locator->m_Atom;
+    
+        // if this is not a moof atom, just write it back and continue
+        if (atom->GetType() != AP4_ATOM_TYPE_MOOF) {
+            result = WritePendingFragments(pending, 0, output, sidx, sidx_position, fragment_map);
+            if (AP4_SUCCEEDED(result)) result = atom->Write(output);
+            continue;
+        }
         
-        for (unsigned int i=0; i<handlers.ItemCount(); i++) {
-            delete handlers[i];
+        // parse the moof
+        AP4_ContainerAtom*     moof     = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+        AP4_ProcessorFragment* fragment = new AP4_ProcessorFragment(moof, locator->m_Offset, fragment_index);
+        result = PrepareFragment(moov, *fragment, input);
+        if (AP4_FAILED(result)) {
+            delete fragment;
+            break;
         }
-        for (unsigned int i=0; i<sample_tables.ItemCount(); i++) {
-            delete sample_tables[i];
+
+        if (workers && fragment->CanProcessConcurrently()) {
+            result = fragment->LoadSamples();
+            if (AP4_FAILED(result)) {
+                delete fragment;
+                break;
+            }
+            fragment->m_Processed = workers->Submit([fragment]() { return fragment->ProcessSamples(); });
+            pending.Add(fragment);
+            result = WritePendingFragments(pending, 2*workers->GetThreadCount(), output, sidx, sidx_position, fragment_map);
+        } else {
+            result = WritePendingFragments(pending, 0, output, sidx, sidx_position, fragment_map);
+            if (AP4_SUCCEEDED(result)) {
+                result = WriteFragment(*fragment, output, sidx, sidx_position, fragment_map);
+            }
+            delete fragment;
         }
     }
+    if (AP4_SUCCEEDED(result)) {
+        result = WritePendingFragments(pending, 0, output, sidx, sidx_position, fragment_map);
+    }
+    
+    // on failure, let the workers finish with the fragments still in flight
+    for (AP4_ProcessorFragment* fragment = NULL; AP4_SUCCEEDED(pending.PopHead(fragment));) {
+        fragment->m_Processed.wait();
+        delete fragment;
+    }
+    if (AP4_FAILED(result)) return result;
     
     // update the mfra if we have one
     if (mfra) {
@@ -446,6 +660,12 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
     // keep all atoms except [mdat]
     // keep a ref to [moov]
     // put [moof] atoms in a separate list
+    // (the fragment arena is declared first so that it outlives the atoms)
+    std::unique_ptr<AP4_Arena>  fragment_arena;
+    AP4_Arena*                  factory_arena = atom_factory.GetArena();
+    if (m_UseFragmentArena && factory_arena == NULL) {
+        fragment_arena.reset(new AP4_Arena());
+    }
     AP4_AtomParent              top_level;
     AP4_MoovAtom*               moov = NULL;
     AP4_ContainerAtom*          mfra = NULL;
@@ -480,6 +700,8 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             delete atom;
             continue;
         } else if (!fragments && (in_fragments || atom->GetType() == AP4_ATOM_TYPE_MOOF)) {
+            // everything after the first fragment is parsed into the arena
+            if (!in_fragments && fragment_arena) atom_factory.SetArena(fragment_arena.get());
             in_fragments = true;
             frags.Add(new AP4_AtomLocator(atom, stream_offset));
             continue;
@@ -496,6 +718,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
     
     // if we have a fragments stream, get the fragment locators from there
     if (fragments) {
+        if (fragment_arena) atom_factory.SetArena(fragment_arena.get());
         stream_offset = 0;
         for (AP4_Atom* atom = NULL;
             AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(fragments, atom));
@@ -507,6 +730,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             frags.Add(new AP4_AtomLocator(atom, stream_offset));
         }
     }
+    atom_factory.SetArena(factory_arena);
     
     // initialize the processor
     AP4_Result result = Initialize(top_level, *input);
@@ -514,6 +738,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
 
     // process the tracks if we have a moov atom
     AP4_Array<AP4_SampleLocator> locators;
+    AP4_SampleRecordArray        locator_samples; // parallel to locators
     AP4_Cardinal                 track_count       = 0;
     AP4_List<AP4_TrakAtom>*      trak_atoms        = NULL;
     AP4_LargeSize                mdat_payload_size = 0;
@@ -556,7 +781,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             cursors[index].m_Locator.m_SampleIndex = 0;
             cursors[index].m_Locator.m_ChunkIndex  = 0;
             if (cursors[index].m_Locator.m_SampleTable->GetSampleCount()) {
-                cursors[index].m_Locator.m_SampleTable->GetSample(0, cursors[index].m_Locator.m_Sample);
+                cursors[index].m_Locator.m_SampleTable->GetSample(0, cursors[index].m_Sample);
             } else {
                 cursors[index].m_EndReached = true;
             }
@@ -572,8 +797,8 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             for (unsigned int i=0; i<track_count; i++) {
                 if (!cursors[i].m_EndReached &&
                     cursors[i].m_Locator.m_SampleTable &&
-                    cursors[i].m_Locator.m_Sample.GetOffset() <= min_offset) {
-                    min_offset = cursors[i].m_Locator.m_Sample.GetOffset();
+                    cursors[i].m_Sample.GetOffset() <= min_offset) {
+                    min_offset = cursors[i].m_Sample.GetOffset();
                     cursor = i;
                 }
             }
@@ -584,6 +809,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             // append this locator to the layout list
             AP4_SampleLocator& locator = cursors[cursor].m_Locator;
             locators.Append(locator);
+            locator_samples.Append(cursors[cursor].m_Sample);
 
             // move the cursor to the next sample
             locator.m_SampleIndex++;
@@ -592,7 +818,7 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
                 cursors[cursor].m_EndReached = true;
             } else {
                 // get the next sample info
-                locator.m_SampleTable->GetSample(locator.m_SampleIndex, locator.m_Sample);
+                locator.m_SampleTable->GetSample(locator.m_SampleIndex, cursors[cursor].m_Sample);
                 AP4_Ordinal skip, sdesc;
                 locator.m_SampleTable->GetChunkForSample(locator.m_SampleIndex,
                                                          locator.m_ChunkIndex,
@@ -619,10 +845,12 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             AP4_Size sample_size;
             TrackHandler* handler = m_TrackHandlers[locator.m_TrakIndex];
             if (handler) {
-                sample_size = handler->GetProcessedSampleSize(locator.m_Sample);
+                AP4_Sample sample;
+                locator_samples.GetSample(i, sample);
+                sample_size = handler->GetProcessedSampleSize(sample);
                 locator.m_SampleTable->SetSampleSize(locator.m_SampleIndex, sample_size);
             } else {
-                sample_size = locator.m_Sample.GetSize();
+                sample_size = locator_samples[i].GetSize();
             }
             current_chunk_size += sample_size;
             mdat_payload_size  += sample_size;
@@ -687,7 +915,8 @@ AP4_Processor::ProcessInternal(std::shared_ptr<AP4_ByteStream> input,
             AP4_DataBuffer data_out;
             for (unsigned int i=0; i<locators.ItemCount(); i++) {
                 AP4_SampleLocator& locator = locators[i];
-                locator.m_Sample.ReadData(data_in);
+                locator_samples.GetSample(i, sample);
+                sample.ReadData(data_in);
                 TrackHandler* handler = m_TrackHandlers[locator.m_TrakIndex];
                 if (handler) {
                     result = handler->ProcessSample(data_in, data_out);
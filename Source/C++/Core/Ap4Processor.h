@@ -53,6 +53,7 @@ class AP4_TrexAtom;
 class AP4_SidxAtom;
 class AP4_FragmentSampleTable;
 struct AP4_AtomLocator;
+struct AP4_ProcessorFragment;
 
 /*----------------------------------------------------------------------
 |   AP4_Processor
@@ -152,6 +153,15 @@ public:
          */
         virtual AP4_Result FinishFragment() { return AP4_SUCCESS; }
 
+        /**
+         * A fragment handler may override this method to return true if
+         * its ProcessSample() method does not depend on, or modify, any state
+         * shared with the handlers of other fragments. The samples of fragments
+         * for which all handlers are independent may be processed on worker
+         * threads, concurrently with other fragments (see SetThreadCount()).
+         */
+        virtual bool IsIndependent() { return false; }
+
         /**
          * Process the data of one sample.
          * @param data_in Data buffer with the data of the sample to process.
@@ -162,11 +172,35 @@ public:
                                          AP4_DataBuffer& data_out) = 0;
     };
 
+    /**
+     *  Default constructor
+     */
+    AP4_Processor() : m_ThreadCount(1), m_UseFragmentArena(false) {}
+
     /**
      *  Default destructor
      */
     virtual ~AP4_Processor() { m_ExternalTrackData.DeleteReferences(); }
 
+    /**
+     * Set the number of worker threads used to process the samples of
+     * fragmented inputs. With more than one thread, fragments for which all
+     * fragment handlers are independent (see FragmentHandler::IsIndependent())
+     * are processed concurrently, while being read and written in order, so
+     * the output is identical to the output of a single-threaded run.
+     * @param thread_count Number of worker threads, or 1 (the default) to
+     * process everything on the calling thread.
+     */
+    void SetThreadCount(unsigned int thread_count) { m_ThreadCount = thread_count; }
+
+    /**
+     * Parse the movie fragments of the input into an arena (see AP4_Arena)
+     * instead of the heap, unless the atom factory passed to Process()
+     * already has an arena. All the fragments are reclaimed at once when
+     * Process() returns, so handlers must not keep any of their atoms.
+     */
+    void EnableFragmentArena() { m_UseFragmentArena = true; }
+
     /**
      * Process the input stream into an output stream.
      * @param input Input stream from which to read the input file.
@@ -268,11 +302,17 @@ protected:
                                 AP4_Position                    sidx_position,
                                 std::shared_ptr<AP4_ByteStream> input,
                                 AP4_ByteStream&                 output);
+
+    AP4_Result PrepareFragment(AP4_MoovAtom*                   moov,
+                               AP4_ProcessorFragment&          fragment,
+                               std::shared_ptr<AP4_ByteStream> input);
     
     
     AP4_List<ExternalTrackData> m_ExternalTrackData;
     AP4_Array<AP4_UI32>         m_TrackIds;
     AP4_Array<TrackHandler*>    m_TrackHandlers;
+    unsigned int                m_ThreadCount;
+    bool                        m_UseFragmentArena;
 };
 
 #endif // _AP4_PROCESSOR_H_
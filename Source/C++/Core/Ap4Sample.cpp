@@ -38,6 +38,11 @@
 #include "Ap4ByteStream.h"
 #include "Ap4Atom.h"
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Cardinal AP4_SAMPLE_RECORD_STREAM_LOOKBACK = 8;
+
 /*----------------------------------------------------------------------
 |   AP4_Sample::AP4_Sample
 +---------------------------------------------------------------------*/
@@ -156,10 +161,109 @@ AP4_Sample::ReadData(AP4_DataBuffer& data, AP4_Size size, AP4_Size offset)
     result = data.SetDataSize(size);
     if (AP4_FAILED(result)) return result;
 
-    // get the data from the stream
-    result = m_DataStream->Seek(m_Offset+offset);
+    // get the data from the stream with a positional read, so that samples
+    // sharing a stream can be read from several threads
+    return m_DataStream->ReadAt(m_Offset+offset, data.UseData(), size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Sample::GetDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Sample::GetDataView(const AP4_UI08*& data)
+{
+    data = NULL;
+    if (m_DataStream == NULL) return AP4_FAILURE;
+    return m_DataStream->GetDataView(m_Offset, m_Size, data);
+}
+
+/*----------------------------------------------------------------------
+|   ReadSampleRuns
++---------------------------------------------------------------------*/
+// SAMPLE_INFO is called as info(i, stream, offset, size) to describe
+// the i-th sample
+template <typename SAMPLE_INFO>
+static AP4_Result
+ReadSampleRuns(AP4_Cardinal        sample_count,
+               SAMPLE_INFO         info,
+               AP4_DataBuffer&     arena,
+               AP4_SampleDataView* views)
+{
+    // compute the total size
+    AP4_UI64 total_size = 0;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        AP4_ByteStream* stream;
+        AP4_Position    offset;
+        AP4_Size        size;
+        info(i, stream, offset, size);
+        if (size && stream == NULL) return AP4_FAILURE;
+        total_size += size;
+    }
+    if (total_size > 0xFFFFFFFF) return AP4_ERROR_OUT_OF_RANGE;
+    AP4_Result result = arena.SetDataSize((AP4_Size)total_size);
     if (AP4_FAILED(result)) return result;
-    return m_DataStream->Read(data.UseData(), size);
+
+    // read runs of contiguous samples with one read each
+    AP4_UI08* data = arena.UseData();
+    AP4_Ordinal run_start = 0;
+    while (run_start < sample_count) {
+        AP4_ByteStream* stream;
+        AP4_Position    offset;
+        AP4_Size        sample_size;
+        info(run_start, stream, offset, sample_size);
+        AP4_UI64    size    = sample_size;
+        AP4_Ordinal run_end = run_start+1;
+        views[run_start].m_Size = sample_size;
+        while (run_end < sample_count) {
+            AP4_ByteStream* next_stream;
+            AP4_Position    next_offset;
+            info(run_end, next_stream, next_offset, sample_size);
+            if (next_stream != stream || next_offset != offset+size) break;
+            views[run_end].m_Size = sample_size;
+            size += sample_size;
+            ++run_end;
+        }
+
+        if (size) {
+            AP4_LargeSize stream_size = 0;
+            if (AP4_SUCCEEDED(stream->GetSize(stream_size)) && offset+size > stream_size) {
+                return AP4_ERROR_OUT_OF_RANGE;
+            }
+            result = stream->ReadAt(offset, data, (AP4_Size)size);
+            if (AP4_FAILED(result)) return result;
+        }
+
+        // setup the views for this run
+        for (AP4_Ordinal i=run_start; i<run_end; i++) {
+            views[i].m_Data = data;
+            data += views[i].m_Size;
+        }
+        run_start = run_end;
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Sample::ReadDataBatch
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Sample::ReadDataBatch(const AP4_Sample*   samples,
+                          AP4_Cardinal        sample_count,
+                          AP4_DataBuffer&     arena,
+                          AP4_SampleDataView* views)
+{
+    return ReadSampleRuns(sample_count,
+                          [samples](AP4_Ordinal      i,
+                                    AP4_ByteStream*& stream,
+                                    AP4_Position&    offset,
+                                    AP4_Size&        size) {
+                              stream = samples[i].m_DataStream.get();
+                              offset = samples[i].m_Offset;
+                              size   = samples[i].m_Size;
+                          },
+                          arena,
+                          views);
 }
 
 /*----------------------------------------------------------------------
@@ -206,3 +310,146 @@ AP4_Sample::Reset()
     m_IsSync           = false;
 }
 
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::Clear
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::Clear()
+{
+    m_DataStreams.Clear();
+    return m_Records.Clear();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::RemoveFirst
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::RemoveFirst(AP4_Cardinal count)
+{
+    if (count > m_Records.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+    if (count == 0) return AP4_SUCCESS;
+
+    // move the remaining records to the front, re-indexing their streams
+    AP4_Array<std::shared_ptr<AP4_ByteStream>> data_streams = m_DataStreams;
+    m_DataStreams.Clear();
+    AP4_Cardinal remaining = m_Records.ItemCount()-count;
+    for (unsigned int i=0; i<remaining; i++) {
+        AP4_SampleRecord& record = m_Records[i] = m_Records[count+i];
+        if (record.m_DataStreamIndex < data_streams.ItemCount()) {
+            AP4_Result result = AddDataStream(data_streams[record.m_DataStreamIndex],
+                                              record.m_DataStreamIndex);
+            if (AP4_FAILED(result)) return result;
+        }
+    }
+    
+    return m_Records.SetItemCount(remaining);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::AddDataStream
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::AddDataStream(std::shared_ptr<AP4_ByteStream> stream, AP4_UI32& index)
+{
+    if (stream == nullptr) {
+        index = AP4_SAMPLE_RECORD_NO_DATA_STREAM;
+        return AP4_SUCCESS;
+    }
+
+    // consecutive samples almost always share one of the last few streams
+    // (one per interleaved track), so only those are checked, which keeps
+    // appending O(1)
+    AP4_Cardinal stream_count = m_DataStreams.ItemCount();
+    AP4_Cardinal lookback = stream_count < AP4_SAMPLE_RECORD_STREAM_LOOKBACK ?
+                            stream_count : AP4_SAMPLE_RECORD_STREAM_LOOKBACK;
+    for (AP4_Ordinal i=stream_count; i>stream_count-lookback; i--) {
+        if (m_DataStreams[i-1] == stream) {
+            index = i-1;
+            return AP4_SUCCESS;
+        }
+    }
+    index = stream_count;
+    return m_DataStreams.Append(stream);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::Append
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::Append(const AP4_Sample& sample)
+{
+    AP4_SampleRecord record;
+    AP4_Result result = AddDataStream(sample.m_DataStream, record.m_DataStreamIndex);
+    if (AP4_FAILED(result)) return result;
+    record.m_Offset           = sample.m_Offset;
+    record.m_Dts              = sample.m_Dts;
+    record.m_Size             = sample.m_Size;
+    record.m_Duration         = sample.m_Duration;
+    record.m_DescriptionIndex = sample.m_DescriptionIndex;
+    record.m_CtsDelta         = sample.m_CtsDelta;
+    record.m_Flags            = sample.m_IsSync ? AP4_SAMPLE_RECORD_FLAG_SYNC : 0;
+
+    return m_Records.Append(record);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::GetDataStream
++---------------------------------------------------------------------*/
+AP4_ByteStream*
+AP4_SampleRecordArray::GetDataStream(const AP4_SampleRecord& record) const
+{
+    if (record.m_DataStreamIndex >= m_DataStreams.ItemCount()) return NULL;
+    return m_DataStreams[record.m_DataStreamIndex].get();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::GetSample
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::GetSample(AP4_Ordinal index, AP4_Sample& sample) const
+{
+    if (index >= m_Records.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+
+    const AP4_SampleRecord& record = m_Records[index];
+    if (record.m_DataStreamIndex < m_DataStreams.ItemCount()) {
+        sample.m_DataStream = m_DataStreams[record.m_DataStreamIndex];
+    } else {
+        sample.m_DataStream.reset();
+    }
+    sample.m_Offset           = record.m_Offset;
+    sample.m_Size             = record.m_Size;
+    sample.m_Duration         = record.m_Duration;
+    sample.m_DescriptionIndex = record.m_DescriptionIndex;
+    sample.m_Dts              = record.m_Dts;
+    sample.m_CtsDelta         = record.m_CtsDelta;
+    sample.m_IsSync           = record.IsSync();
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray::ReadDataBatch
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleRecordArray::ReadDataBatch(AP4_Ordinal         first,
+                                     AP4_Cardinal        count,
+                                     AP4_DataBuffer&     arena,
+                                     AP4_SampleDataView* views) const
+{
+    if (first > m_Records.ItemCount() || count > m_Records.ItemCount()-first) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+    const AP4_SampleRecord* records = &m_Records[first];
+    return ReadSampleRuns(count,
+                          [this, records](AP4_Ordinal      i,
+                                          AP4_ByteStream*& stream,
+                                          AP4_Position&    offset,
+                                          AP4_Size&        size) {
+                              stream = GetDataStream(records[i]);
+                              offset = records[i].m_Offset;
+                              size   = records[i].m_Size;
+                          },
+                          arena,
+                          views);
+}
@@ -35,6 +35,7 @@
 |   includes
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
+#include "Ap4Array.h"
 
 #include <memory>
 
@@ -43,6 +44,68 @@
 +---------------------------------------------------------------------*/
 class AP4_ByteStream;
 class AP4_DataBuffer;
+class AP4_Sample;
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_UI32 AP4_SAMPLE_RECORD_FLAG_SYNC      = 0x00000001;
+const AP4_UI32 AP4_SAMPLE_RECORD_NO_DATA_STREAM = 0xFFFFFFFF;
+
+/*----------------------------------------------------------------------
+|   AP4_SampleDataView
++---------------------------------------------------------------------*/
+/**
+ * Read-only view of the payload of one sample, pointing into a buffer
+ * filled by AP4_Sample::ReadDataBatch.
+ */
+struct AP4_SampleDataView {
+    const AP4_UI08* m_Data;
+    AP4_Size        m_Size;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SampleRecord
++---------------------------------------------------------------------*/
+/**
+ * Plain-data description of a sample, for use in large sample arrays.
+ * Unlike AP4_Sample, a record does not hold a reference to its data
+ * stream: it only stores the index of the stream in the
+ * AP4_SampleRecordArray that contains it, so records can be copied
+ * without touching any reference count.
+ * The accessors mirror the ones of AP4_Sample.
+ */
+struct AP4_SampleRecord {
+    // methods
+    AP4_Position GetOffset() const           { return m_Offset;           }
+    void         SetOffset(AP4_Position o)   { m_Offset = o;              }
+    AP4_Size     GetSize() const             { return m_Size;             }
+    void         SetSize(AP4_Size size)      { m_Size = size;             }
+    AP4_UI32     GetDuration() const         { return m_Duration;         }
+    void         SetDuration(AP4_UI32 d)     { m_Duration = d;            }
+    AP4_Ordinal  GetDescriptionIndex() const { return m_DescriptionIndex; }
+    void         SetDescriptionIndex(AP4_Ordinal index) { m_DescriptionIndex = index; }
+    AP4_UI64     GetDts() const              { return m_Dts;              }
+    void         SetDts(AP4_UI64 dts)        { m_Dts = dts;               }
+    AP4_UI64     GetCts() const              { return m_Dts+m_CtsDelta;   }
+    void         SetCts(AP4_UI64 cts)        { m_CtsDelta = (cts > m_Dts) ? (AP4_SI32)(cts-m_Dts) : 0; }
+    AP4_UI32     GetCtsDelta() const         { return (AP4_UI32)m_CtsDelta; }
+    void         SetCtsDelta(AP4_UI32 delta) { m_CtsDelta = (AP4_SI32)delta; }
+    bool         IsSync() const              { return (m_Flags & AP4_SAMPLE_RECORD_FLAG_SYNC) != 0; }
+    void         SetSync(bool is_sync) {
+        m_Flags = is_sync ? (m_Flags | AP4_SAMPLE_RECORD_FLAG_SYNC) : (m_Flags & ~AP4_SAMPLE_RECORD_FLAG_SYNC);
+    }
+
+    // members
+    AP4_UI64 m_Offset;
+    AP4_UI64 m_Dts;
+    AP4_UI32 m_Size;
+    AP4_UI32 m_Duration;
+    AP4_UI32 m_DescriptionIndex;
+    AP4_SI32 m_CtsDelta;
+    AP4_UI32 m_DataStreamIndex;
+    AP4_UI32 m_Flags;
+};
 
 /*----------------------------------------------------------------------
 |   AP4_Sample DO NOT DERIVE FROM THIS CLASS
@@ -96,13 +159,42 @@ public:
                              AP4_Size        size, 
                              AP4_Size        offset = 0);
     void            Detach();
+
+    /**
+     * Get a read-only pointer to the sample data, without copying it.
+     * This only works when the sample's data stream supports views (see
+     * AP4_ByteStream::GetDataView), for example with memory-mapped files.
+     * The pointer remains valid as long as the data stream exists.
+     *
+     * @return AP4_SUCCESS if a view could be obtained, or an error code
+     * otherwise, in which case the caller should use ReadData instead.
+     */
+    AP4_Result      GetDataView(const AP4_UI08*& data);
+
+    /**
+     * Read the data of several samples into a single caller-provided arena.
+     * Samples that are stored back to back in the same data stream (for
+     * example samples of the same chunk) are fetched with a single read.
+     *
+     * @param samples Array of samples whose data should be read.
+     * @param sample_count Number of entries in the samples array.
+     * @param arena Buffer that receives the data of all samples, in order.
+     * Its data size is set to the sum of the sample sizes.
+     * @param views Array of at least sample_count entries that receives,
+     * for each sample, a view into the arena. The views remain valid until
+     * the arena is modified or destroyed.
+     */
+    static AP4_Result ReadDataBatch(const AP4_Sample*   samples,
+                                    AP4_Cardinal        sample_count,
+                                    AP4_DataBuffer&     arena,
+                                    AP4_SampleDataView* views);
     
     // sample properties accessors
     std::shared_ptr<AP4_ByteStream> GetDataStream();
     void                            SetDataStream(std::shared_ptr<AP4_ByteStream> stream);
     AP4_Position                    GetOffset() const { return m_Offset; }
     void                            SetOffset(AP4_Position offset) { m_Offset = offset; }
-    AP4_Size                        GetSize() { return m_Size; }
+    AP4_Size                        GetSize() const { return m_Size; }
     void                            SetSize(AP4_Size size) { m_Size = size; }
     AP4_Ordinal                     GetDescriptionIndex() const { return m_DescriptionIndex; }
     void                            SetDescriptionIndex(AP4_Ordinal index) { m_DescriptionIndex = index; }
@@ -165,6 +257,9 @@ public:
     void            Reset();
 
 private:
+    // friends
+    friend class AP4_SampleRecordArray;
+
     std::shared_ptr<AP4_ByteStream> m_DataStream;
     AP4_Position                    m_Offset;
     AP4_Size                        m_Size;
@@ -175,4 +270,70 @@ private:
     bool                            m_IsSync;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_SampleRecordArray
++---------------------------------------------------------------------*/
+/**
+ * Array of sample records, with the data streams they refer to held
+ * once for the whole array rather than once per sample.
+ */
+class AP4_SampleRecordArray
+{
+public:
+    // methods
+    AP4_SampleRecordArray() {}
+    /**
+     * The records are allocated from an arena (see AP4_Arena).
+     */
+    explicit AP4_SampleRecordArray(AP4_Arena* arena) : m_Records(arena) {}
+    AP4_Cardinal            ItemCount() const { return m_Records.ItemCount(); }
+    AP4_SampleRecord&       operator[](unsigned long idx)       { return m_Records[idx]; }
+    const AP4_SampleRecord& operator[](unsigned long idx) const { return m_Records[idx]; }
+    AP4_Result              EnsureCapacity(AP4_Cardinal count) { return m_Records.EnsureCapacity(count); }
+    AP4_Result              SetItemCount(AP4_Cardinal count)   { return m_Records.SetItemCount(count);   }
+    AP4_Result              Clear();
+
+    /**
+     * Remove the first count records, releasing the data streams that are
+     * no longer referenced.
+     */
+    AP4_Result RemoveFirst(AP4_Cardinal count);
+
+    /**
+     * Append a sample, converting it to a record.
+     */
+    AP4_Result Append(const AP4_Sample& sample);
+    AP4_Result Append(const AP4_SampleRecord& record) { return m_Records.Append(record); }
+
+    /**
+     * Get the index under which records refer to a data stream, adding
+     * the stream to the array unless it is one of the most recently
+     * added ones.
+     */
+    AP4_Result AddDataStream(std::shared_ptr<AP4_ByteStream> stream, AP4_UI32& index);
+
+    /**
+     * Get the data stream a record refers to (may be NULL).
+     */
+    AP4_ByteStream* GetDataStream(const AP4_SampleRecord& record) const;
+
+    /**
+     * Fill an AP4_Sample object with the record at the given index.
+     */
+    AP4_Result GetSample(AP4_Ordinal index, AP4_Sample& sample) const;
+
+    /**
+     * Same as AP4_Sample::ReadDataBatch, for a range of records.
+     */
+    AP4_Result ReadDataBatch(AP4_Ordinal         first,
+                             AP4_Cardinal        count,
+                             AP4_DataBuffer&     arena,
+                             AP4_SampleDataView* views) const;
+
+private:
+    // members
+    AP4_Array<AP4_SampleRecord>                m_Records;
+    AP4_Array<std::shared_ptr<AP4_ByteStream>> m_DataStreams;
+};
+
 #endif // _AP4_SAMPLE_H_
\ No newline at end of file
@@ -44,12 +44,87 @@
 #include "Ap4MfhdAtom.h"
 #include "Ap4TrunAtom.h"
 #include "Ap4TfdtAtom.h"
+#include "Ap4SidxAtom.h"
 
 /*----------------------------------------------------------------------
 |   constants
 +---------------------------------------------------------------------*/
 const AP4_UI32     AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE = 1000;
+const AP4_UI32     AP4_SEGMENT_BUILDER_BRAND_CMFS        = AP4_ATOM_TYPE('c','m','f','s');
 const unsigned int AP4_STREAM_FEEDER_DEFAULT_BUFFER_SIZE = 65536;
+const unsigned int AP4_STREAM_FEEDER_MAX_SPARE_BUFFERS   = 16;
+
+/*----------------------------------------------------------------------
+|   WriteSegmentType
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteSegmentType(AP4_ByteStream& stream, const AP4_UI32* compatible_brands, AP4_Cardinal compatible_brand_count)
+{
+    stream.WriteUI32(AP4_ATOM_HEADER_SIZE+8+4*compatible_brand_count);
+    stream.WriteUI32(AP4_ATOM_TYPE_STYP);
+    stream.WriteUI32(AP4_FTYP_BRAND_MSDH);
+    AP4_Result result = stream.WriteUI32(0);
+    for (unsigned int i=0; i<compatible_brand_count; i++) {
+        result = stream.WriteUI32(compatible_brands[i]);
+    }
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   WriteTracksInitSegment
+|
+|   Write an ftyp and a moov with an mvex, for tracks created by segment
+|   builders (the tracks are deleted).
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteTracksInitSegment(AP4_ByteStream&              stream,
+                       AP4_Array<AP4_Track*>&       tracks,
+                       const AP4_Array<AP4_UI32>&   compatible_brands)
+{
+    // create the output file object
+    AP4_Movie* output_movie = new AP4_Movie(AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE);
+    
+    // create an mvex container
+    AP4_ContainerAtom* mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
+    AP4_MehdAtom* mehd = new AP4_MehdAtom(0);
+    mvex->AddChild(mehd);
+    
+    // add the tracks, with a trex entry for each
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        output_movie->AddTrack(tracks[i]);
+        AP4_TrexAtom* trex = new AP4_TrexAtom(tracks[i]->GetId(),
+                                              1,
+                                              0,
+                                              0,
+                                              0);
+        mvex->AddChild(trex);
+    }
+    
+    // the mvex container to the moov container
+    output_movie->GetMoovAtom()->AddChild(mvex);
+    
+    // write the ftyp atom
+    AP4_Array<AP4_UI32> brands;
+    brands.Append(AP4_FILE_BRAND_ISOM);
+    brands.Append(AP4_FILE_BRAND_MP42);
+    brands.Append(AP4_FILE_BRAND_MP41);
+    for (unsigned int i=0; i<compatible_brands.ItemCount(); i++) {
+        brands.Append(compatible_brands[i]);
+    }
+    
+    AP4_FtypAtom* ftyp = new AP4_FtypAtom(AP4_FILE_BRAND_MP42, 1, &brands[0], brands.ItemCount());
+    ftyp->Write(stream);
+    delete ftyp;
+    
+    // write the moov atom
+    AP4_Result result = output_movie->GetMoovAtom()->Write(stream);
+    
+    // cleanup
+    delete output_movie;
+    
+    return result;
+}
 
 /*----------------------------------------------------------------------
 |   AP4_SegmentBuilder::AP4_SegmentBuilder
@@ -64,7 +139,10 @@ AP4_SegmentBuilder::AP4_SegmentBuilder(AP4_Track::Type track_type,
     m_SampleStartNumber(0),
     m_MediaTimeOrigin(media_time_origin),
     m_MediaStartTime(0),
-    m_MediaDuration(0)
+    m_MediaDuration(0),
+    m_ChunkSampleCount(0),
+    m_ChunkDuration(0),
+    m_Muxed(false)
 {
 }
 
@@ -89,22 +167,176 @@ AP4_SegmentBuilder::AddSample(AP4_Sample& sample)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::CreateTrack
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::CreateTrack(AP4_Track*& track)
+{
+    track = NULL;
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::WriteInitSegment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
+{
+    AP4_Track* track = NULL;
+    AP4_Result result = CreateTrack(track);
+    if (AP4_FAILED(result)) return result;
+    
+    AP4_Array<AP4_Track*> tracks;
+    tracks.Append(track);
+    AP4_Array<AP4_UI32> compatible_brands;
+    if (GetCompatibleBrand()) {
+        compatible_brands.Append(GetCompatibleBrand());
+    }
+    return WriteTracksInitSegment(stream, tracks, compatible_brands);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SegmentBuilder::WriteMediaSegment
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_SegmentBuilder::WriteMediaSegment(AP4_ByteStream& stream, unsigned int sequence_number)
 {
-    unsigned int tfhd_flags = AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF;
-    if (m_TrackType == AP4_Track::TYPE_VIDEO) {
-        tfhd_flags |= AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT;
+    return WriteFragment(stream, sequence_number, m_Samples.ItemCount(), false);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::SetChunkTarget
++---------------------------------------------------------------------*/
+void
+AP4_SegmentBuilder::SetChunkTarget(AP4_Cardinal sample_count, AP4_UI32 duration_ms)
+{
+    m_ChunkSampleCount = sample_count;
+    m_ChunkDuration    = duration_ms;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::IsChunkIndependent
++---------------------------------------------------------------------*/
+bool
+AP4_SegmentBuilder::IsChunkIndependent()
+{
+    return m_Samples.ItemCount() != 0 && m_Samples[0].IsSync();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::GetChunkSampleCount
++---------------------------------------------------------------------*/
+AP4_Cardinal
+AP4_SegmentBuilder::GetChunkSampleCount(bool flush)
+{
+    AP4_Cardinal closed_count = CloseSamples(flush);
+    AP4_UI64     max_duration = (AP4_UI64)m_ChunkDuration*m_Timescale/1000;
+    AP4_UI64     duration     = 0;
+    for (unsigned int i=0; i<closed_count; i++) {
+        // video chunks end before sync samples
+        if (i && m_TrackType == AP4_Track::TYPE_VIDEO && m_Samples[i].IsSync()) {
+            return i;
+        }
+        duration += m_Samples[i].GetDuration();
+        if ((m_ChunkSampleCount && i+1 >= m_ChunkSampleCount) ||
+            (max_duration       && duration >= max_duration)) {
+            return i+1;
+        }
+    }
+    
+    return flush ? closed_count : 0;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::WriteMediaChunk
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::WriteMediaChunk(AP4_ByteStream& stream,
+                                    unsigned int    sequence_number,
+                                    bool            starts_segment,
+                                    bool            flush)
+{
+    if (m_ChunkSampleCount == 0 && m_ChunkDuration == 0) {
+        return AP4_ERROR_INVALID_STATE;
     }
+    AP4_Cardinal sample_count = GetChunkSampleCount(flush);
+    if (sample_count == 0) return AP4_ERROR_NOT_ENOUGH_DATA;
     
+    // signal the start of a segment with an 'styp' box
+    if (starts_segment) {
+        const AP4_UI32 brands[2] = { AP4_FTYP_BRAND_MSDH, AP4_SEGMENT_BUILDER_BRAND_CMFS };
+        AP4_Result result = WriteSegmentType(stream, brands, 2);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return WriteFragment(stream, sequence_number, sample_count, true);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::WriteFragment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::WriteFragment(AP4_ByteStream& stream,
+                                  unsigned int    sequence_number,
+                                  AP4_Cardinal    sample_count,
+                                  bool            is_chunk)
+{
     // setup the moof structure
     AP4_ContainerAtom* moof = new AP4_ContainerAtom(AP4_ATOM_TYPE_MOOF);
     AP4_MfhdAtom* mfhd = new AP4_MfhdAtom(sequence_number);
     moof->AddChild(mfhd);
-    AP4_ContainerAtom* traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
+    AP4_ContainerAtom* traf = NULL;
+    AP4_TrunAtom*      trun = NULL;
+    AP4_UI32           data_size = 0;
+    AP4_Result result = CreateTrackFragment(sample_count, is_chunk, traf, trun, data_size);
+    if (AP4_FAILED(result)) {
+        delete moof;
+        return result;
+    }
+    moof->AddChild(traf);
+    
+    // update moof and children
+    trun->SetDataOffset((AP4_UI32)moof->GetSize()+AP4_ATOM_HEADER_SIZE);
+    
+    // write moof
+    moof->Write(stream);
+    delete moof;
+    
+    // write mdat
+    stream.WriteUI32(AP4_ATOM_HEADER_SIZE+data_size);
+    stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+    result = WriteSampleData(stream, sample_count);
+    if (AP4_FAILED(result)) return result;
+    
+    // the samples are no longer needed
+    RemoveSamples(sample_count);
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::CreateTrackFragment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::CreateTrackFragment(AP4_Cardinal        sample_count,
+                                        bool                is_chunk,
+                                        AP4_ContainerAtom*& traf,
+                                        AP4_TrunAtom*&      trun,
+                                        AP4_UI32&           data_size)
+{
+    traf      = NULL;
+    trun      = NULL;
+    data_size = 0;
+    if (sample_count > m_Samples.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+    
+    unsigned int tfhd_flags = AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF;
+    if (m_TrackType == AP4_Track::TYPE_VIDEO) {
+        tfhd_flags |= AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT;
+    }
+    
+    // setup the traf structure
+    traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
     AP4_TfhdAtom* tfhd = new AP4_TfhdAtom(tfhd_flags,
                                           m_TrackId,
                                           0,
@@ -124,20 +356,23 @@ AP4_SegmentBuilder::WriteMediaSegment(AP4_ByteStream& stream, unsigned int seque
                           AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT;
     AP4_UI32 first_sample_flags = 0;
     if (m_TrackType == AP4_Track::TYPE_VIDEO) {
-        trun_flags |= AP4_TRUN_FLAG_FIRST_SAMPLE_FLAGS_PRESENT;
-        first_sample_flags = 0x2000000; // sample_depends_on=2 (I frame)
+        // chunks that don't start with a sync sample only use the default flags
+        if (!is_chunk || (sample_count && m_Samples[0].IsSync())) {
+            trun_flags |= AP4_TRUN_FLAG_FIRST_SAMPLE_FLAGS_PRESENT;
+            first_sample_flags = 0x2000000; // sample_depends_on=2 (I frame)
+        }
+    }
+    trun = new AP4_TrunAtom(trun_flags, 0, first_sample_flags);
+    if (is_chunk && m_TrackType == AP4_Track::TYPE_VIDEO) {
+        trun->SetVersion(1); // signed composition time offsets
     }
-    AP4_TrunAtom* trun = new AP4_TrunAtom(trun_flags, 0, first_sample_flags);
     
     traf->AddChild(trun);
-    moof->AddChild(traf);
     
     // add samples to the fragment
-    AP4_Array<AP4_UI32>            sample_indexes;
     AP4_Array<AP4_TrunAtom::Entry> trun_entries;
-    AP4_UI32                       mdat_size = AP4_ATOM_HEADER_SIZE;
-    trun_entries.SetItemCount(m_Samples.ItemCount());
-    for (unsigned int i=0; i<m_Samples.ItemCount(); i++) {
+    trun_entries.SetItemCount(sample_count);
+    for (unsigned int i=0; i<sample_count; i++) {
         // if we have one non-zero CTS delta, we'll need to express it
         if (m_Samples[i].GetCtsDelta()) {
             trun->SetFlags(trun->GetFlags() | AP4_TRUN_FLAG_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT);
@@ -149,22 +384,25 @@ AP4_SegmentBuilder::WriteMediaSegment(AP4_ByteStream& stream, unsigned int seque
         trun_entry.sample_size                    = m_Samples[i].GetSize();
         trun_entry.sample_composition_time_offset = m_Samples[i].GetCtsDelta();
         
-        mdat_size += trun_entry.sample_size;
+        data_size += trun_entry.sample_size;
     }
-    
-    // update moof and children
     trun->SetEntries(trun_entries);
-    trun->SetDataOffset((AP4_UI32)moof->GetSize()+AP4_ATOM_HEADER_SIZE);
-    
-    // write moof
-    moof->Write(stream);
     
-    // write mdat
-    stream.WriteUI32(mdat_size);
-    stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
-    for (unsigned int i=0; i<m_Samples.ItemCount(); i++) {
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::WriteSampleData
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentBuilder::WriteSampleData(AP4_ByteStream& stream, AP4_Cardinal sample_count)
+{
+    for (unsigned int i=0; i<sample_count; i++) {
         AP4_Result result;
-        auto data_stream = m_Samples[i].GetDataStream();
+        AP4_ByteStream* data_stream = m_Samples.GetDataStream(m_Samples[i]);
+        if (data_stream == NULL) {
+            return AP4_ERROR_INVALID_STATE;
+        }
         result = data_stream->Seek(m_Samples[i].GetOffset());
         if (AP4_FAILED(result)) {
             return result;
@@ -175,16 +413,31 @@ AP4_SegmentBuilder::WriteMediaSegment(AP4_ByteStream& stream, unsigned int seque
         }
     }
     
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentBuilder::RemoveSamples
++---------------------------------------------------------------------*/
+void
+AP4_SegmentBuilder::RemoveSamples(AP4_Cardinal sample_count)
+{
+    AP4_UI64 duration = 0;
+    for (unsigned int i=0; i<sample_count; i++) {
+        duration += m_Samples[i].GetDuration();
+    }
+    
     // update counters
-    m_SampleStartNumber += m_Samples.ItemCount();
-    m_MediaStartTime    += m_MediaDuration;
-    m_MediaDuration      = 0;
+    m_SampleStartNumber += sample_count;
+    m_MediaStartTime    += duration;
+    m_MediaDuration     -= duration;
     
     // cleanup
-    delete moof;
-    m_Samples.Clear();
-
-    return AP4_SUCCESS;
+    if (sample_count == m_Samples.ItemCount()) {
+        m_Samples.Clear();
+    } else {
+        m_Samples.RemoveFirst(sample_count);
+    }
 }
 
 /*----------------------------------------------------------------------
@@ -197,6 +450,22 @@ AP4_FeedSegmentBuilder::AP4_FeedSegmentBuilder(AP4_Track::Type track_type,
 {
 }
 
+/*----------------------------------------------------------------------
+|   AP4_FeedSegmentBuilder::FeedBuffer
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FeedSegmentBuilder::FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                   AP4_Size                              offset,
+                                   AP4_Size                              size,
+                                   AP4_Size&                             bytes_consumed,
+                                   bool                                  eos)
+{
+    if (eos && size == 0) {
+        return Feed(NULL, 0, bytes_consumed);
+    }
+    return Feed(buffer->GetData()+offset, size, bytes_consumed);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_VideoSegmentBuilder::AP4_VideoSegmentBuilder
 +---------------------------------------------------------------------*/
@@ -204,7 +473,18 @@ AP4_VideoSegmentBuilder::AP4_VideoSegmentBuilder(AP4_UI32 track_id,
                                                  double   frames_per_second,
                                                  AP4_UI64 media_time_origin) :
     AP4_FeedSegmentBuilder(AP4_Track::TYPE_VIDEO, track_id, media_time_origin),
-    m_FramesPerSecond(frames_per_second)
+    m_FramesPerSecond(frames_per_second),
+    m_GopStart(0),
+    m_GopDisplayOrderBase(0),
+    m_LastDisplayOrder(0),
+    m_DisplayOrderStep(0),
+    m_ClosedSampleCount(0),
+    m_ScanIndex(0),
+    m_ScanStart(0),
+    m_ScanPosition(0),
+    m_ScanEnd(0),
+    m_ScanConsumed(0),
+    m_ScanEos(false)
 {
     m_Timescale = (unsigned int)(frames_per_second*1000.0);
 }
@@ -239,77 +519,331 @@ AP4_VideoSegmentBuilder::SortSamples(SampleOrder* array, unsigned int n)
 }
 
 /*----------------------------------------------------------------------
-|   AP4_VideoSegmentBuilder::WriteVideoInitSegment
+|   AP4_VideoSegmentBuilder::AddAccessUnit
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_VideoSegmentBuilder::WriteVideoInitSegment(AP4_ByteStream&        stream,
-                                               AP4_SampleDescription* sample_description,
-                                               unsigned int           width,
-                                               unsigned int           height,
-                                               AP4_UI32               brand)
+AP4_VideoSegmentBuilder::AddAccessUnit(AP4_Sample& sample,
+                                       AP4_UI32    decode_order,
+                                       AP4_UI32    display_order,
+                                       bool        is_random_access)
 {
-    // create the output file object
-    AP4_Movie* output_movie = new AP4_Movie(AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE);
-
-    // create an mvex container
-    AP4_ContainerAtom* mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
-    AP4_MehdAtom* mehd = new AP4_MehdAtom(0);
-    mvex->AddChild(mehd);
+    // a new GOP starts at a sync sample or other random access point, which
+    // completes the previous one (in open GOPs, the display order does not
+    // go back to 0, and leading samples may have a lower display order)
+    if ((sample.IsSync() || is_random_access) && m_GopDisplayOrders.ItemCount()) {
+        CloseGop(true);
+    }
+    
+    AP4_Result result = AddSample(sample);
+    if (AP4_FAILED(result)) return result;
 
-    // create a sample table (with no samples) to hold the sample description
-    AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable();
-    sample_table->AddSampleDescription(sample_description, true);
+    // without chunks or muxing, composition times are computed for whole segments
+    if (!HasIncrementalTiming()) {
+        return m_SampleOrders.Append(SampleOrder(decode_order, display_order));
+    }
+    
+    if (m_GopDisplayOrders.ItemCount() == 0) {
+        m_GopStart = m_SampleStartNumber+m_Samples.ItemCount()-1;
+        
+        // when the display order continues from the previous GOP, the GOP 
+        // starts right after it in display order (the leading samples of an
+        // open GOP come after the first one in decode order), and otherwise
+        // it starts with its first sample
+        if (m_DisplayOrderStep && display_order > m_LastDisplayOrder) {
+            m_GopDisplayOrderBase = m_LastDisplayOrder+m_DisplayOrderStep;
+        } else {
+            m_GopDisplayOrderBase = display_order;
+        }
+    }
+    result = m_GopDisplayOrders.Append(display_order);
+    if (AP4_FAILED(result)) return result;
+    
+    // once the display order step is known, the samples of the GOP can be
+    // closed as soon as no display order between the lowest one of the GOP
+    // and the highest one seen so far is missing
+    if (m_DisplayOrderStep) {
+        AP4_UI32 min_display_order = m_GopDisplayOrders[0];
+        AP4_UI32 max_display_order = m_GopDisplayOrders[0];
+        for (unsigned int i=1; i<m_GopDisplayOrders.ItemCount(); i++) {
+            if (m_GopDisplayOrders[i] < min_display_order) {
+                min_display_order = m_GopDisplayOrders[i];
+            }
+            if (m_GopDisplayOrders[i] > max_display_order) {
+                max_display_order = m_GopDisplayOrders[i];
+            }
+        }
+        if (min_display_order >= m_GopDisplayOrderBase) {
+            AP4_UI32 span = max_display_order-m_GopDisplayOrderBase;
+            if ((span%m_DisplayOrderStep) == 0 &&
+                span/m_DisplayOrderStep+1 == m_GopDisplayOrders.ItemCount()) {
+                // the samples that follow come after all of these in display order
+                CloseGop(true);
+            }
+        }
+    }
+    
+    return AP4_SUCCESS;
+}
 
-    // create the track
-    AP4_Track* output_track = new AP4_Track(AP4_Track::TYPE_VIDEO,
-                                            sample_table,
-                                            m_TrackId,
-                                            AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE,
-                                            0,
-                                            m_Timescale,
-                                            0,
-                                            m_TrackLanguage.GetChars(),
-                                            width << 16,
-                                            height << 16);
-    output_movie->AddTrack(output_track);
-
-    // add a trex entry to the mvex container
-    AP4_TrexAtom* trex = new AP4_TrexAtom(m_TrackId,
-                                          1,
-                                          0,
-                                          0,
-                                          0);
-    mvex->AddChild(trex);
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::AddAccessUnit
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_VideoSegmentBuilder::AddAccessUnit(const AP4_Array<AP4_DataBuffer*>& nal_units,
+                                       bool                              by_reference,
+                                       bool                              is_sync,
+                                       bool                              is_random_access,
+                                       AP4_UI32                          decode_order,
+                                       AP4_UI32                          display_order)
+{
+    AP4_Result result;
+    
+    // format the sample data: each NAL unit is prefixed with its size
+    std::shared_ptr<AP4_ByteStream> sample_data;
+    AP4_Size sample_data_size = 0;
+    if (by_reference) {
+        // the NAL units are in the buffers that were fed, in feed order
+        auto chain = std::make_shared<AP4_BufferChainByteStream>();
+        int last_reference = -1;
+        for (unsigned int i=0; i<nal_units.ItemCount(); i++) {
+            const AP4_DataBuffer* nal_unit = nal_units[i];
+            AP4_UI08 nal_unit_size[4];
+            AP4_BytesFromUInt32BE(nal_unit_size, nal_unit->GetDataSize());
+            result = chain->AppendData(nal_unit_size, 4);
+            if (AP4_FAILED(result)) return result;
+            int reference = -1;
+            for (unsigned int j=last_reference+1; j<m_NalUnitReferences.ItemCount(); j++) {
+                const NalUnitReference& nal_unit_reference = m_NalUnitReferences[j];
+                if (nal_unit_reference.m_Buffer->GetData()+nal_unit_reference.m_Offset == nal_unit->GetData()) {
+                    reference = (int)j;
+                    break;
+                }
+            }
+            if (reference >= 0) {
+                const NalUnitReference& nal_unit_reference = m_NalUnitReferences[reference];
+                result = chain->AppendReference(nal_unit_reference.m_Buffer,
+                                                nal_unit_reference.m_Offset,
+                                                nal_unit_reference.m_Size);
+                last_reference = reference;
+            } else {
+                // not a NAL unit that was fed (should not happen), copy it
+                result = chain->AppendData(nal_unit->GetData(), nal_unit->GetDataSize());
+            }
+            if (AP4_FAILED(result)) return result;
+            sample_data_size += 4+nal_unit->GetDataSize();
+        }
+        
+        // the frame parser no longer refers to the NAL units fed before the
+        // last one of the access unit
+        if (last_reference >= 0) {
+            AP4_Cardinal remaining = m_NalUnitReferences.ItemCount()-(last_reference+1);
+            for (unsigned int i=0; i<remaining; i++) {
+                m_NalUnitReferences[i] = m_NalUnitReferences[last_reference+1+i];
+            }
+            m_NalUnitReferences.SetItemCount(remaining);
+        }
+        sample_data = chain;
+    } else {
+        for (unsigned int i=0; i<nal_units.ItemCount(); i++) {
+            sample_data_size += 4+nal_units[i]->GetDataSize();
+        }
+        auto memory_stream = std::make_shared<AP4_MemoryByteStream>(sample_data_size);
+        for (unsigned int i=0; i<nal_units.ItemCount(); i++) {
+            memory_stream->WriteUI32(nal_units[i]->GetDataSize());
+            memory_stream->Write(nal_units[i]->GetData(), nal_units[i]->GetDataSize());
+        }
+        sample_data = memory_stream;
+    }
+    
+    // compute the timestamp in a drift-less manner
+    AP4_UI32 duration = 0;
+    AP4_UI64 dts      = 0;
+    if (m_Timescale !=0 && m_FramesPerSecond != 0.0) {
+        AP4_UI64 this_sample_time = m_MediaStartTime+m_MediaDuration;
+        AP4_UI64 next_sample_time = (AP4_UI64)((double)m_Timescale*(double)(m_SampleStartNumber+m_Samples.ItemCount()+1)/m_FramesPerSecond);
+        duration = (AP4_UI32)(next_sample_time-this_sample_time);
+        dts      = (AP4_UI64)((double)m_Timescale/m_FramesPerSecond*(double)m_Samples.ItemCount());
+    }
 
-    // update the mehd duration
-    // TBD mehd->SetDuration(0);
+    // create a new sample and add it to the list
+    AP4_Sample sample(sample_data, 0, sample_data_size, duration, 0, dts, 0, is_sync);
+    return AddAccessUnit(sample, decode_order, display_order, is_random_access);
+}
 
-    // the mvex container to the moov container
-    output_movie->GetMoovAtom()->AddChild(mvex);
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::NextNalUnit
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_VideoSegmentBuilder::NextNalUnit(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                     AP4_Size                              offset,
+                                     AP4_Size                              size,
+                                     bool                                  eos,
+                                     AP4_Size&                             bytes_consumed,
+                                     const AP4_UI08*&                      nal_unit,
+                                     AP4_Size&                             nal_unit_size)
+{
+    nal_unit      = NULL;
+    nal_unit_size = 0;
+    
+    // scan the data for complete NAL units, unless it continues the previous scan
+    AP4_Size position = offset+bytes_consumed;
+    if (buffer != m_ScanBuffer   ||
+        position != m_ScanPosition ||
+        offset+size != m_ScanEnd ||
+        eos != m_ScanEos) {
+        AP4_Size scan_consumed = 0;
+        m_ScanNalUnits.SetItemCount(0);
+        AP4_Result result = AP4_NalParser::FindNalUnits(buffer->GetData()+position,
+                                                        offset+size-position,
+                                                        m_ScanNalUnits,
+                                                        scan_consumed,
+                                                        eos);
+        if (AP4_FAILED(result)) return result;
+        m_ScanBuffer   = buffer;
+        m_ScanIndex    = 0;
+        m_ScanStart    = position;
+        m_ScanPosition = position;
+        m_ScanEnd      = offset+size;
+        m_ScanConsumed = position+scan_consumed;
+        m_ScanEos      = eos;
+    }
+    
+    // no more complete NAL units: the rest is needed with more data
+    if (m_ScanIndex == m_ScanNalUnits.ItemCount()) {
+        bytes_consumed = m_ScanConsumed-offset;
+        m_ScanBuffer = NULL;
+        return AP4_SUCCESS;
+    }
+    
+    // remember where the NAL unit is, until it is part of an access unit
+    const AP4_NalUnitRange& range = m_ScanNalUnits[m_ScanIndex++];
+    NalUnitReference nal_unit_reference = { buffer, m_ScanStart+range.m_Offset, range.m_Size };
+    AP4_Result result = m_NalUnitReferences.Append(nal_unit_reference);
+    if (AP4_FAILED(result)) return result;
+    nal_unit       = buffer->GetData()+nal_unit_reference.m_Offset;
+    nal_unit_size  = range.m_Size;
+    bytes_consumed = nal_unit_reference.m_Offset+range.m_Size-offset;
+    m_ScanPosition = offset+bytes_consumed;
+    
+    return AP4_SUCCESS;
+}
 
-    // write the ftyp atom
-    AP4_Array<AP4_UI32> brands;
-    brands.Append(AP4_FILE_BRAND_ISOM);
-    brands.Append(AP4_FILE_BRAND_MP42);
-    brands.Append(AP4_FILE_BRAND_MP41);
-    brands.Append(brand);
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::GetSampleTime
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_VideoSegmentBuilder::GetSampleTime(AP4_UI64 sample_number)
+{
+    if (m_Timescale == 0 || m_FramesPerSecond == 0.0) return 0;
+    return (AP4_UI64)((double)m_Timescale*(double)sample_number/m_FramesPerSecond);
+}
 
-    AP4_FtypAtom* ftyp = new AP4_FtypAtom(AP4_FILE_BRAND_MP42, 1, &brands[0], brands.ItemCount());
-    ftyp->Write(stream);
-    delete ftyp;
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::CloseGop
++---------------------------------------------------------------------*/
+void
+AP4_VideoSegmentBuilder::CloseGop(bool complete)
+{
+    AP4_Cardinal count = m_GopDisplayOrders.ItemCount();
+    if (count == 0) return;
+    
+    // sort the samples of the GOP by display order
+    AP4_Array<SampleOrder> orders;
+    orders.EnsureCapacity(count);
+    for (unsigned int i=0; i<count; i++) {
+        orders.Append(SampleOrder(i, m_GopDisplayOrders[i]));
+    }
+    SortSamples(&orders[0], count);
+    
+    // learn the display order step from complete GOPs
+    if (complete) {
+        for (unsigned int i=1; i<count; i++) {
+            AP4_UI32 step = orders[i].m_DisplayOrder-orders[i-1].m_DisplayOrder;
+            if (step && (m_DisplayOrderStep == 0 || step < m_DisplayOrderStep)) {
+                m_DisplayOrderStep = step;
+            }
+        }
+    }
+    
+    // set the composition time offset of the samples not written yet, which
+    // may be negative since there is no initial composition delay
+    for (unsigned int i=0; i<count; i++) {
+        AP4_UI64 sample_number = m_GopStart+orders[i].m_DecodeOrder;
+        if (sample_number < m_SampleStartNumber) continue;
+        AP4_SampleRecord& sample = m_Samples[(AP4_Ordinal)(sample_number-m_SampleStartNumber)];
+        AP4_SI64 delta = (AP4_SI64)GetSampleTime(m_GopStart+i)-(AP4_SI64)GetSampleTime(sample_number);
+        sample.SetCtsDelta((AP4_UI32)(AP4_SI32)delta);
+    }
+    m_ClosedSampleCount = m_GopStart+count;
+    
+    if (complete) {
+        m_LastDisplayOrder = orders[count-1].m_DisplayOrder;
+        m_GopDisplayOrders.Clear();
+    }
+}
 
-    // write the moov atom
-    AP4_Result result = output_movie->GetMoovAtom()->Write(stream);
-    if (AP4_FAILED(result)) {
-        return result;
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::CloseSamples
++---------------------------------------------------------------------*/
+AP4_Cardinal
+AP4_VideoSegmentBuilder::CloseSamples(bool flush)
+{
+    if (flush) {
+        CloseGop(false);
     }
+    if (m_ClosedSampleCount <= m_SampleStartNumber) return 0;
+    return (AP4_Cardinal)(m_ClosedSampleCount-m_SampleStartNumber);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::CreateVideoTrack
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_VideoSegmentBuilder::CreateVideoTrack(AP4_SampleDescription* sample_description,
+                                          unsigned int           width,
+                                          unsigned int           height,
+                                          AP4_Track*&            track)
+{
+    // create a sample table (with no samples) to hold the sample description
+    AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable();
+    sample_table->AddSampleDescription(sample_description, true);
 
-    // cleanup
-    delete output_movie;
+    // create the track
+    track = new AP4_Track(AP4_Track::TYPE_VIDEO,
+                          sample_table,
+                          m_TrackId,
+                          AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE,
+                          0,
+                          m_Timescale,
+                          0,
+                          m_TrackLanguage.GetChars(),
+                          width << 16,
+                          height << 16);
     
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_VideoSegmentBuilder::WriteVideoInitSegment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_VideoSegmentBuilder::WriteVideoInitSegment(AP4_ByteStream&        stream,
+                                               AP4_SampleDescription* sample_description,
+                                               unsigned int           width,
+                                               unsigned int           height,
+                                               AP4_UI32               brand)
+{
+    AP4_Track* track = NULL;
+    AP4_Result result = CreateVideoTrack(sample_description, width, height, track);
+    if (AP4_FAILED(result)) return result;
+    
+    AP4_Array<AP4_Track*> tracks;
+    tracks.Append(track);
+    AP4_Array<AP4_UI32> compatible_brands;
+    compatible_brands.Append(brand);
+    return WriteTracksInitSegment(stream, tracks, compatible_brands);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_VideoSegmentBuilder::WriteMediaSegment
 +---------------------------------------------------------------------*/
@@ -384,59 +918,78 @@ AP4_AvcSegmentBuilder::Feed(const void* data,
     AP4_Result result;
     
     AP4_AvcFrameParser::AccessUnitInfo access_unit_info;
+    m_FrameParser.SetCopyNalUnitData(true);
     result = m_FrameParser.Feed(data, data_size, bytes_consumed, access_unit_info, data == NULL);
     if (AP4_FAILED(result)) return result;
     
     // check if we have an access unit
     if (access_unit_info.nal_units.ItemCount()) {
-        // compute the total size of the sample data
-        unsigned int sample_data_size = 0;
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-        }
-        
-        // format the sample data
-        auto sample_data = std::make_shared<AP4_MemoryByteStream>(sample_data_size);
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            sample_data->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-            sample_data->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
-        }
+        result = AddAccessUnit(access_unit_info.nal_units,
+                               false,
+                               access_unit_info.is_idr,
+                               access_unit_info.is_idr || access_unit_info.is_intra,
+                               access_unit_info.decode_order,
+                               access_unit_info.display_order);
+        access_unit_info.Reset();
+        if (AP4_FAILED(result)) return result;
         
-        // compute the timestamp in a drift-less manner
-        AP4_UI32 duration = 0;
-        AP4_UI64 dts      = 0;
-        if (m_Timescale !=0 && m_FramesPerSecond != 0.0) {
-            AP4_UI64 this_sample_time = m_MediaStartTime+m_MediaDuration;
-            AP4_UI64 next_sample_time = (AP4_UI64)((double)m_Timescale*(double)(m_SampleStartNumber+m_Samples.ItemCount()+1)/m_FramesPerSecond);
-            duration = (AP4_UI32)(next_sample_time-this_sample_time);
-            dts      = (AP4_UI64)((double)m_Timescale/m_FramesPerSecond*(double)m_Samples.ItemCount());
-        }
-
-        // create a new sample and add it to the list
-        AP4_Sample sample(sample_data, 0, sample_data_size, duration, 0, dts, 0, access_unit_info.is_idr);
-        AddSample(sample);
-        
-        // remember the sample order
-        m_SampleOrders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
+        return 1; // one access unit returned
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AvcSegmentBuilder::FeedBuffer
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AvcSegmentBuilder::FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                  AP4_Size                              offset,
+                                  AP4_Size                              size,
+                                  AP4_Size&                             bytes_consumed,
+                                  bool                                  eos)
+{
+    bytes_consumed = 0;
+    
+    // the access units refer to the NAL units in the buffers
+    m_FrameParser.SetCopyNalUnitData(false);
+    
+    // feed NAL units to the frame parser until an access unit is complete
+    AP4_AvcFrameParser::AccessUnitInfo access_unit_info;
+    for (;;) {
+        const AP4_UI08* nal_unit      = NULL;
+        AP4_Size        nal_unit_size = 0;
+        AP4_Result result = NextNalUnit(buffer, offset, size, eos, bytes_consumed, nal_unit, nal_unit_size);
+        if (AP4_FAILED(result)) return result;
+        result = m_FrameParser.Feed(nal_unit, nal_unit_size, access_unit_info, eos && nal_unit == NULL);
+        if (AP4_FAILED(result)) return result;
         
-        // free the memory buffers
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            delete access_unit_info.nal_units[i];
+        if (access_unit_info.nal_units.ItemCount()) {
+            result = AddAccessUnit(access_unit_info.nal_units,
+                                   true,
+                                   access_unit_info.is_idr,
+                                   access_unit_info.is_idr || access_unit_info.is_intra,
+                                   access_unit_info.decode_order,
+                                   access_unit_info.display_order);
+            access_unit_info.Reset();
+            if (AP4_FAILED(result)) return result;
+            
+            return 1; // one access unit returned
         }
-        access_unit_info.nal_units.Clear();
-        
-        return 1; // one access unit returned
+        if (nal_unit == NULL) break;
     }
     
     return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
-|   AP4_AvcSegmentBuilder::WriteInitSegment
+|   AP4_AvcSegmentBuilder::CreateTrack
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_AvcSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
+AP4_AvcSegmentBuilder::CreateTrack(AP4_Track*& track)
 {
+    track = NULL;
+    
     // compute the track parameters
     AP4_AvcSequenceParameterSet* sps = NULL;
     for (unsigned int i=0; i<=AP4_AVC_SPS_MAX_ID; i++) {
@@ -487,11 +1040,7 @@ AP4_AvcSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
                                      pps_array);
 
     // let the base class finish the work
-    return AP4_VideoSegmentBuilder::WriteVideoInitSegment(stream,
-                                                          sample_description,
-                                                          video_width,
-                                                          video_height,
-                                                          AP4_FILE_BRAND_AVC1);
+    return CreateVideoTrack(sample_description, video_width, video_height, track);
 }
 
 /*----------------------------------------------------------------------
@@ -517,59 +1066,78 @@ AP4_HevcSegmentBuilder::Feed(const void* data,
     AP4_Result result;
     
     AP4_HevcFrameParser::AccessUnitInfo access_unit_info;
+    m_FrameParser.SetCopyNalUnitData(true);
     result = m_FrameParser.Feed(data, data_size, bytes_consumed, access_unit_info, data == NULL);
     if (AP4_FAILED(result)) return result;
     
     // check if we have an access unit
     if (access_unit_info.nal_units.ItemCount()) {
-        // compute the total size of the sample data
-        unsigned int sample_data_size = 0;
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            sample_data_size += 4+access_unit_info.nal_units[i]->GetDataSize();
-        }
-        
-        // format the sample data
-        auto sample_data = std::make_shared<AP4_MemoryByteStream>(sample_data_size);
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            sample_data->WriteUI32(access_unit_info.nal_units[i]->GetDataSize());
-            sample_data->Write(access_unit_info.nal_units[i]->GetData(), access_unit_info.nal_units[i]->GetDataSize());
-        }
-        
-        // compute the timestamp in a drift-less manner
-        AP4_UI32 duration = 0;
-        AP4_UI64 dts      = 0;
-        if (m_Timescale !=0 && m_FramesPerSecond != 0.0) {
-            AP4_UI64 this_sample_time = m_MediaStartTime+m_MediaDuration;
-            AP4_UI64 next_sample_time = (AP4_UI64)((double)m_Timescale*(double)(m_SampleStartNumber+m_Samples.ItemCount()+1)/m_FramesPerSecond);
-            duration = (AP4_UI32)(next_sample_time-this_sample_time);
-            dts      = (AP4_UI64)((double)m_Timescale/m_FramesPerSecond*(double)m_Samples.ItemCount());
-        }
-
-        // create a new sample and add it to the list
-        AP4_Sample sample(sample_data, 0, sample_data_size, duration, 0, dts, 0, access_unit_info.is_random_access);
-        AddSample(sample);
+        result = AddAccessUnit(access_unit_info.nal_units,
+                               false,
+                               access_unit_info.is_random_access,
+                               access_unit_info.is_random_access,
+                               access_unit_info.decode_order,
+                               access_unit_info.display_order);
+        access_unit_info.Reset();
+        if (AP4_FAILED(result)) return result;
         
-        // remember the sample order
-        m_SampleOrders.Append(SampleOrder(access_unit_info.decode_order, access_unit_info.display_order));
+        return 1; // one access unit returned
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_HevcSegmentBuilder::FeedBuffer
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_HevcSegmentBuilder::FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                   AP4_Size                              offset,
+                                   AP4_Size                              size,
+                                   AP4_Size&                             bytes_consumed,
+                                   bool                                  eos)
+{
+    bytes_consumed = 0;
+    
+    // the access units refer to the NAL units in the buffers
+    m_FrameParser.SetCopyNalUnitData(false);
+    
+    // feed NAL units to the frame parser until an access unit is complete
+    AP4_HevcFrameParser::AccessUnitInfo access_unit_info;
+    for (;;) {
+        const AP4_UI08* nal_unit      = NULL;
+        AP4_Size        nal_unit_size = 0;
+        AP4_Result result = NextNalUnit(buffer, offset, size, eos, bytes_consumed, nal_unit, nal_unit_size);
+        if (AP4_FAILED(result)) return result;
+        result = m_FrameParser.Feed(nal_unit, nal_unit_size, access_unit_info, eos && nal_unit == NULL);
+        if (AP4_FAILED(result)) return result;
         
-        // free the memory buffers
-        for (unsigned int i=0; i<access_unit_info.nal_units.ItemCount(); i++) {
-            delete access_unit_info.nal_units[i];
+        if (access_unit_info.nal_units.ItemCount()) {
+            result = AddAccessUnit(access_unit_info.nal_units,
+                                   true,
+                                   access_unit_info.is_random_access,
+                                   access_unit_info.is_random_access,
+                                   access_unit_info.decode_order,
+                                   access_unit_info.display_order);
+            access_unit_info.Reset();
+            if (AP4_FAILED(result)) return result;
+            
+            return 1; // one access unit returned
         }
-        access_unit_info.nal_units.Clear();
-        
-        return 1; // one access unit returned
+        if (nal_unit == NULL) break;
     }
     
     return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
-|   AP4_HevcSegmentBuilder::WriteInitSegment
+|   AP4_HevcSegmentBuilder::CreateTrack
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_HevcSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
+AP4_HevcSegmentBuilder::CreateTrack(AP4_Track*& track)
 {
+    track = NULL;
+    
     // check that we have at least one SPS
     AP4_HevcSequenceParameterSet* sps = NULL;
     for (unsigned int i=0; i<=AP4_HEVC_SPS_MAX_ID; i++) {
@@ -654,11 +1222,7 @@ AP4_HevcSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
                                       parameters_completeness);
 
     // let the base class finish the work
-    return AP4_VideoSegmentBuilder::WriteVideoInitSegment(stream,
-                                                          sample_description,
-                                                          video_width,
-                                                          video_height,
-                                                          AP4_FILE_BRAND_HVC1);
+    return CreateVideoTrack(sample_description, video_width, video_height, track);
 }
 
 /*----------------------------------------------------------------------
@@ -694,35 +1258,12 @@ AP4_AacSegmentBuilder::Feed(const void* data,
     AP4_Result result = m_FrameParser.FindFrame(frame);
     if (AP4_SUCCEEDED(result)) {
         if (!m_SampleDescription) {
-            // create a sample description for our samples
-            AP4_DataBuffer dsi;
-            unsigned char aac_dsi[2];
-
-            unsigned int object_type = 2; // AAC LC by default
-            aac_dsi[0] = (AP4_UI08)((object_type<<3) | (frame.m_Info.m_SamplingFrequencyIndex>>1));
-            aac_dsi[1] = (AP4_UI08)(((frame.m_Info.m_SamplingFrequencyIndex&1)<<7) | (frame.m_Info.m_ChannelConfiguration<<3));
-
-            dsi.SetData(aac_dsi, 2);
-            m_SampleDescription =
-                new AP4_MpegAudioSampleDescription(
-                AP4_OTI_MPEG4_AUDIO,   // object type
-                (AP4_UI32)frame.m_Info.m_SamplingFrequency,
-                16,                    // sample size
-                (AP4_UI16)frame.m_Info.m_ChannelConfiguration,
-                &dsi,                  // decoder info
-                6144,                  // buffer size
-                128000,                // max bitrate
-                128000);               // average bitrate
-            
-            m_Timescale = (AP4_UI32)frame.m_Info.m_SamplingFrequency;
+            CreateSampleDescription(frame.m_Info);
         }
 
-        // read and store the sample data
-        AP4_DataBuffer sample_data(frame.m_Info.m_FrameLength);
-        sample_data.SetDataSize(frame.m_Info.m_FrameLength);
-        frame.m_Source->ReadBytes(sample_data.UseData(), frame.m_Info.m_FrameLength);
+        // read the sample data directly into its stream
         auto sample_data_stream = std::make_shared<AP4_MemoryByteStream>(frame.m_Info.m_FrameLength);
-        sample_data_stream->Write(sample_data.GetData(), sample_data.GetDataSize());
+        frame.m_Source->ReadBytes(sample_data_stream->UseData(), frame.m_Info.m_FrameLength);
 
         // add the sample to the table
         AP4_Sample sample(sample_data_stream, 0, frame.m_Info.m_FrameLength, 1024, 0, 0, 0, true);
@@ -748,71 +1289,108 @@ AP4_AacSegmentBuilder::Feed(const void* data,
 }
 
 /*----------------------------------------------------------------------
-|   AP4_AacSegmentBuilder::WriteInitSegment
+|   AP4_AacSegmentBuilder::CreateSampleDescription
++---------------------------------------------------------------------*/
+void
+AP4_AacSegmentBuilder::CreateSampleDescription(const AP4_AacFrameInfo& frame_info)
+{
+    // create a sample description for our samples
+    AP4_DataBuffer dsi;
+    unsigned char aac_dsi[2];
+
+    unsigned int object_type = 2; // AAC LC by default
+    aac_dsi[0] = (AP4_UI08)((object_type<<3) | (frame_info.m_SamplingFrequencyIndex>>1));
+    aac_dsi[1] = (AP4_UI08)(((frame_info.m_SamplingFrequencyIndex&1)<<7) | (frame_info.m_ChannelConfiguration<<3));
+
+    dsi.SetData(aac_dsi, 2);
+    m_SampleDescription =
+        new AP4_MpegAudioSampleDescription(
+        AP4_OTI_MPEG4_AUDIO,   // object type
+        (AP4_UI32)frame_info.m_SamplingFrequency,
+        16,                    // sample size
+        (AP4_UI16)frame_info.m_ChannelConfiguration,
+        &dsi,                  // decoder info
+        6144,                  // buffer size
+        128000,                // max bitrate
+        128000);               // average bitrate
+    
+    m_Timescale = (AP4_UI32)frame_info.m_SamplingFrequency;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AacSegmentBuilder::FeedBuffer
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_AacSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
+AP4_AacSegmentBuilder::FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                  AP4_Size                              offset,
+                                  AP4_Size                              size,
+                                  AP4_Size&                             bytes_consumed,
+                                  bool                                  eos)
 {
-    AP4_Result result;
+    bytes_consumed = 0;
     
-    // check that we have a sample description
+    // look for a complete frame in the buffer
+    AP4_Size         frame_offset = 0;
+    AP4_Size         frame_size   = 0;
+    AP4_AacFrameInfo frame_info;
+    AP4_Result result = AP4_AdtsParser::FindFrame(buffer->GetData()+offset,
+                                                  size,
+                                                  frame_offset,
+                                                  frame_size,
+                                                  frame_info,
+                                                  eos);
+    if (AP4_FAILED(result)) {
+        bytes_consumed = frame_offset;
+        return result == AP4_ERROR_NOT_ENOUGH_DATA ? AP4_SUCCESS : result;
+    }
     if (!m_SampleDescription) {
-        return AP4_ERROR_INVALID_STATE;
+        CreateSampleDescription(frame_info);
     }
     
-    // create the output file object
-    AP4_Movie* output_movie = new AP4_Movie(AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE);
+    // the sample refers to the raw frame data in the buffer
+    auto sample_data_stream = std::make_shared<AP4_BufferChainByteStream>();
+    result = sample_data_stream->AppendReference(buffer,
+                                                 offset+frame_offset+frame_size-frame_info.m_FrameLength,
+                                                 frame_info.m_FrameLength);
+    if (AP4_FAILED(result)) return result;
+    AP4_Sample sample(sample_data_stream, 0, frame_info.m_FrameLength, 1024, 0, 0, 0, true);
+    result = AddSample(sample);
+    if (AP4_FAILED(result)) return result;
+    bytes_consumed = frame_offset+frame_size;
     
-    // create an mvex container
-    AP4_ContainerAtom* mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
-    AP4_MehdAtom* mehd = new AP4_MehdAtom(0);
-    mvex->AddChild(mehd);
+    return 1;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AacSegmentBuilder::CreateTrack
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AacSegmentBuilder::CreateTrack(AP4_Track*& track)
+{
+    track = NULL;
+    
+    // check that we have a sample description
+    if (!m_SampleDescription) {
+        return AP4_ERROR_INVALID_STATE;
+    }
     
     // create a sample table (with no samples) to hold the sample description
     AP4_SyntheticSampleTable* sample_table = new AP4_SyntheticSampleTable();
     sample_table->AddSampleDescription(m_SampleDescription, false);
     
     // create the track
-    AP4_Track* output_track = new AP4_Track(AP4_Track::TYPE_AUDIO,
-                                            sample_table,
-                                            m_TrackId,
-                                            AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE,
-                                            0,
-                                            m_Timescale,
-                                            0,
-                                            m_TrackLanguage.GetChars(),
-                                            0,
-                                            0);
-    output_movie->AddTrack(output_track);
-    
-    // add a trex entry to the mvex container
-    AP4_TrexAtom* trex = new AP4_TrexAtom(m_TrackId,
-                                          1,
-                                          0,
-                                          0,
-                                          0);
-    mvex->AddChild(trex);
-    
-    // the mvex container to the moov container
-    output_movie->GetMoovAtom()->AddChild(mvex);
-    
-    // write the ftyp atom
-    AP4_Array<AP4_UI32> brands;
-    brands.Append(AP4_FILE_BRAND_ISOM);
-    brands.Append(AP4_FILE_BRAND_MP42);
-    brands.Append(AP4_FILE_BRAND_MP41);
-    
-    AP4_FtypAtom* ftyp = new AP4_FtypAtom(AP4_FILE_BRAND_MP42, 1, &brands[0], brands.ItemCount());
-    ftyp->Write(stream);
-    delete ftyp;
-    
-    // write the moov atom
-    result = output_movie->GetMoovAtom()->Write(stream);
-    
-    // cleanup
-    delete output_movie;
+    track = new AP4_Track(AP4_Track::TYPE_AUDIO,
+                          sample_table,
+                          m_TrackId,
+                          AP4_SEGMENT_BUILDER_DEFAULT_TIMESCALE,
+                          0,
+                          m_Timescale,
+                          0,
+                          m_TrackLanguage.GetChars(),
+                          0,
+                          0);
     
-    return result;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -821,24 +1399,70 @@ AP4_AacSegmentBuilder::WriteInitSegment(AP4_ByteStream& stream)
 AP4_StreamFeeder::AP4_StreamFeeder(std::shared_ptr<AP4_ByteStream> source, AP4_FeedSegmentBuilder& builder) :
     m_Source(std::move(source)),
     m_Builder(builder),
-    m_FeedBuffer(NULL),
-    m_FeedBufferSize(0),
     m_FeedBytesPending(0),
-    m_FeedBytesParsed(0)
+    m_FeedBytesParsed(0),
+    m_NeedsMoreData(false),
+    m_Eos(false)
 {
     AP4_ASSERT(m_Source);
-    m_FeedBuffer = new AP4_UI08[AP4_STREAM_FEEDER_DEFAULT_BUFFER_SIZE];
-    if (m_FeedBuffer) {
-        m_FeedBufferSize = AP4_STREAM_FEEDER_DEFAULT_BUFFER_SIZE;
-    }
 }
 
 /*----------------------------------------------------------------------
-|   AP4_StreamFeeder::~AP4_StreamFeeder
+|   AP4_StreamFeeder::FillBuffer
 +---------------------------------------------------------------------*/
-AP4_StreamFeeder::~AP4_StreamFeeder()
+AP4_Result
+AP4_StreamFeeder::FillBuffer()
 {
-    delete[] m_FeedBuffer;
+    // make room for at least as much new data as what is pending
+    AP4_Size buffer_size = AP4_STREAM_FEEDER_DEFAULT_BUFFER_SIZE;
+    if (m_FeedBytesPending > buffer_size/2) {
+        buffer_size = 2*m_FeedBytesPending;
+    }
+    
+    // a buffer can only be reused when nothing else refers to it (the
+    // builder releases the buffers when it writes the samples that refer
+    // to them, so they are recycled instead of being freed and reallocated)
+    std::shared_ptr<AP4_DataBuffer> buffer;
+    for (unsigned int i=0; i<m_SpareBuffers.ItemCount(); i++) {
+        std::shared_ptr<AP4_DataBuffer>& spare = m_SpareBuffers[i];
+        long references = (spare == m_FeedBuffer) ? 2 : 1;
+        if (spare.use_count() == references && spare->GetBufferSize() >= buffer_size) {
+            buffer = spare;
+            break;
+        }
+    }
+    if (!buffer) {
+        buffer = std::make_shared<AP4_DataBuffer>(buffer_size);
+        if (buffer->GetBufferSize() < buffer_size) return AP4_ERROR_OUT_OF_MEMORY;
+        if (m_SpareBuffers.ItemCount() < AP4_STREAM_FEEDER_MAX_SPARE_BUFFERS) {
+            m_SpareBuffers.Append(buffer);
+        }
+    }
+    
+    // keep the bytes not yet parsed at the start of the buffer
+    if (m_FeedBytesPending) {
+        memmove(buffer->UseData(), m_FeedBuffer->GetData()+m_FeedBytesParsed, m_FeedBytesPending);
+    }
+    buffer->SetDataSize(m_FeedBytesPending);
+    m_FeedBuffer      = buffer;
+    m_FeedBytesParsed = 0;
+    
+    // read more data
+    AP4_Size bytes_read = 0;
+    AP4_Result result = m_Source->ReadPartial(buffer->UseData()+m_FeedBytesPending,
+                                              buffer->GetBufferSize()-m_FeedBytesPending,
+                                              bytes_read);
+    if (result == AP4_ERROR_EOS || (AP4_SUCCEEDED(result) && bytes_read == 0)) {
+        m_Eos = true;
+        return AP4_SUCCESS;
+    }
+    if (AP4_FAILED(result)) {
+        return result;
+    }
+    m_FeedBytesPending += bytes_read;
+    buffer->SetDataSize(m_FeedBytesPending);
+    
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -847,27 +1471,318 @@ AP4_StreamFeeder::~AP4_StreamFeeder()
 AP4_Result
 AP4_StreamFeeder::Feed()
 {
-    // read more data if the buffer is empty
-    if (m_FeedBytesPending == 0) {
-        m_FeedBytesParsed = 0;
-        if (!m_FeedBufferSize) return AP4_ERROR_INTERNAL;
-        AP4_Result result = m_Source->ReadPartial(m_FeedBuffer, m_FeedBufferSize, m_FeedBytesPending);
-        if (AP4_FAILED(result)) {
-            return result;
-        }
-        if (m_FeedBytesPending == 0) {
-            return AP4_ERROR_EOS;
-        }
+    // read more data if the buffer is empty or the builder needs more
+    if (!m_Eos && (m_FeedBytesPending == 0 || m_NeedsMoreData)) {
+        AP4_Result result = FillBuffer();
+        if (AP4_FAILED(result)) return result;
     }
 
-    // feed the builder
+    // feed the builder (and flush it at the end of the stream)
     AP4_Size bytes_consumed = 0;
-    AP4_Result result = m_Builder.Feed(&m_FeedBuffer[m_FeedBytesParsed], m_FeedBytesPending, bytes_consumed);
+    AP4_Result result = m_Builder.FeedBuffer(m_FeedBuffer,
+                                             m_FeedBytesParsed,
+                                             m_FeedBytesPending,
+                                             bytes_consumed,
+                                             m_Eos);
     if (result < 0) return result;
 
     // update counters
     m_FeedBytesParsed  += bytes_consumed;
     m_FeedBytesPending -= bytes_consumed;
     
+    // the builder can't make progress without more data
+    m_NeedsMoreData = (result == AP4_SUCCESS && bytes_consumed == 0);
+    if (m_NeedsMoreData && m_Eos) {
+        return AP4_ERROR_EOS;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::AP4_SegmentMuxer
++---------------------------------------------------------------------*/
+AP4_SegmentMuxer::AP4_SegmentMuxer(AP4_UI32 segment_duration_ms) :
+    m_SegmentDuration(segment_duration_ms),
+    m_ReferenceIndex(0),
+    m_SegmentIndexEnabled(true)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::~AP4_SegmentMuxer
++---------------------------------------------------------------------*/
+AP4_SegmentMuxer::~AP4_SegmentMuxer()
+{
+    m_Events.DeleteReferences();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::AddBuilder
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentMuxer::AddBuilder(AP4_SegmentBuilder& builder)
+{
+    // the timing of the samples must be final as they are added
+    if (builder.m_Samples.ItemCount() || builder.m_SampleStartNumber) {
+        return AP4_ERROR_INVALID_STATE;
+    }
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (m_Builders[i] == &builder || m_Builders[i]->GetTrackId() == builder.GetTrackId()) {
+            return AP4_ERROR_INVALID_PARAMETERS;
+        }
+    }
+    AP4_Result result = m_Builders.Append(&builder);
+    if (AP4_FAILED(result)) return result;
+    builder.m_Muxed = true;
+    
+    // the first video track is the reference track
+    if (builder.m_TrackType == AP4_Track::TYPE_VIDEO &&
+        m_Builders[m_ReferenceIndex]->m_TrackType != AP4_Track::TYPE_VIDEO) {
+        m_ReferenceIndex = m_Builders.ItemCount()-1;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::AddEvent
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentMuxer::AddEvent(const char*     scheme_id_uri,
+                           const char*     value,
+                           AP4_UI32        timescale,
+                           AP4_UI64        presentation_time,
+                           AP4_UI32        event_duration,
+                           AP4_UI32        id,
+                           const AP4_UI08* message_data,
+                           AP4_Size        message_data_size)
+{
+    return m_Events.Add(new AP4_EmsgAtom(scheme_id_uri,
+                                         value,
+                                         timescale,
+                                         presentation_time,
+                                         event_duration,
+                                         id,
+                                         message_data,
+                                         message_data_size));
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::WriteInitSegment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentMuxer::WriteInitSegment(AP4_ByteStream& stream)
+{
+    if (m_Builders.ItemCount() == 0) return AP4_ERROR_INVALID_STATE;
+    
+    // one track per builder
+    AP4_Array<AP4_Track*> tracks;
+    AP4_Array<AP4_UI32>   compatible_brands;
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        AP4_Track* track = NULL;
+        AP4_Result result = m_Builders[i]->CreateTrack(track);
+        if (AP4_FAILED(result)) {
+            for (unsigned int j=0; j<tracks.ItemCount(); j++) {
+                delete tracks[j];
+            }
+            return result;
+        }
+        tracks.Append(track);
+        
+        AP4_UI32 brand = m_Builders[i]->GetCompatibleBrand();
+        bool     found = (brand == 0);
+        for (unsigned int j=0; j<compatible_brands.ItemCount() && !found; j++) {
+            found = (compatible_brands[j] == brand);
+        }
+        if (!found) compatible_brands.Append(brand);
+    }
+    
+    return WriteTracksInitSegment(stream, tracks, compatible_brands);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::GetSegmentSampleCounts
++---------------------------------------------------------------------*/
+bool
+AP4_SegmentMuxer::GetSegmentSampleCounts(bool flush, AP4_Array<AP4_Cardinal>& sample_counts)
+{
+    sample_counts.SetItemCount(m_Builders.ItemCount());
+    if (m_Builders.ItemCount() == 0) return false;
+    
+    // at the end of the stream, everything is written
+    if (flush) {
+        bool empty = true;
+        for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+            sample_counts[i] = m_Builders[i]->CloseSamples(true);
+            if (sample_counts[i]) empty = false;
+        }
+        return !empty;
+    }
+    
+    // the segment ends before the first sync sample of the reference track
+    // that is at least one segment duration after the start of the segment
+    // (the sync sample itself may not be closed yet, as with open GOPs, but
+    // all the samples before it are)
+    AP4_SegmentBuilder* reference    = m_Builders[m_ReferenceIndex];
+    AP4_Cardinal        closed_count = reference->CloseSamples(false);
+    AP4_UI64            min_duration = (AP4_UI64)m_SegmentDuration*reference->m_Timescale/1000;
+    AP4_UI64            duration     = 0;
+    AP4_Cardinal        count        = 0;
+    for (unsigned int i=0; i<=closed_count && i<reference->m_Samples.ItemCount(); i++) {
+        if (i && duration >= min_duration && reference->m_Samples[i].IsSync()) {
+            count = i;
+            break;
+        }
+        if (i == closed_count) break;
+        duration += reference->m_Samples[i].GetDuration();
+    }
+    if (count == 0) return false;
+    sample_counts[m_ReferenceIndex] = count;
+    
+    // the other tracks have the samples that start before the end of the
+    // segment, which they must have received entirely
+    AP4_UI64 end_time = reference->m_MediaTimeOrigin+reference->m_MediaStartTime+duration;
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (i == m_ReferenceIndex) continue;
+        AP4_SegmentBuilder* builder = m_Builders[i];
+        if (builder->m_Timescale == 0 || reference->m_Timescale == 0) return false;
+        closed_count = builder->CloseSamples(false);
+        AP4_UI64 time = builder->m_MediaTimeOrigin+builder->m_MediaStartTime;
+        AP4_Cardinal j = 0;
+        for (; j<closed_count && time*reference->m_Timescale < end_time*builder->m_Timescale; j++) {
+            time += builder->m_Samples[j].GetDuration();
+        }
+        if (time*reference->m_Timescale < end_time*builder->m_Timescale) return false;
+        sample_counts[i] = j;
+    }
+    
+    return true;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::IsSegmentReady
++---------------------------------------------------------------------*/
+bool
+AP4_SegmentMuxer::IsSegmentReady()
+{
+    AP4_Array<AP4_Cardinal> sample_counts;
+    return GetSegmentSampleCounts(false, sample_counts);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer::WriteMediaSegment
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SegmentMuxer::WriteMediaSegment(AP4_ByteStream& stream,
+                                    unsigned int    sequence_number,
+                                    bool            flush)
+{
+    AP4_Array<AP4_Cardinal> sample_counts;
+    if (!GetSegmentSampleCounts(flush, sample_counts)) {
+        return AP4_ERROR_NOT_ENOUGH_DATA;
+    }
+    
+    // one traf per track that has samples in the segment (as with chunks,
+    // the video composition time offsets may be negative)
+    AP4_ContainerAtom* moof = new AP4_ContainerAtom(AP4_ATOM_TYPE_MOOF);
+    moof->AddChild(new AP4_MfhdAtom(sequence_number));
+    AP4_Array<AP4_TrunAtom*> truns;
+    AP4_Array<AP4_UI32>      data_sizes;
+    truns.SetItemCount(m_Builders.ItemCount());
+    data_sizes.SetItemCount(m_Builders.ItemCount());
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (sample_counts[i] == 0) continue;
+        AP4_ContainerAtom* traf = NULL;
+        AP4_Result result = m_Builders[i]->CreateTrackFragment(sample_counts[i], true, traf, truns[i], data_sizes[i]);
+        if (AP4_FAILED(result)) {
+            delete moof;
+            return result;
+        }
+        moof->AddChild(traf);
+    }
+    
+    // the samples of each track follow those of the previous one in the mdat
+    AP4_UI32 mdat_size = AP4_ATOM_HEADER_SIZE;
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (truns[i] == NULL) continue;
+        truns[i]->SetDataOffset((AP4_UI32)moof->GetSize()+mdat_size);
+        mdat_size += data_sizes[i];
+    }
+    
+    // signal the start of a segment with an 'styp' box
+    AP4_UI32 brands[2] = { AP4_FTYP_BRAND_MSDH, AP4_FTYP_BRAND_MSIX };
+    AP4_Result result = WriteSegmentType(stream, brands, m_SegmentIndexEnabled ? 2 : 1);
+    if (AP4_FAILED(result)) {
+        delete moof;
+        return result;
+    }
+    
+    // index the segment with a single reference to the reference track
+    if (m_SegmentIndexEnabled) {
+        AP4_SegmentBuilder* reference = m_Builders[m_ReferenceIndex];
+        AP4_Cardinal        count     = sample_counts[m_ReferenceIndex];
+        AP4_UI64            start     = reference->m_MediaTimeOrigin+reference->m_MediaStartTime;
+        AP4_UI64            duration  = 0;
+        AP4_SI64            earliest_presentation_time = (AP4_SI64)start;
+        for (unsigned int i=0; i<count; i++) {
+            const AP4_SampleRecord& sample = reference->m_Samples[i];
+            AP4_SI64 presentation_time = (AP4_SI64)(start+duration)+(AP4_SI32)sample.GetCtsDelta();
+            if (i == 0 || presentation_time < earliest_presentation_time) {
+                earliest_presentation_time = presentation_time;
+            }
+            duration += sample.GetDuration();
+        }
+        AP4_UI64 referenced_size = moof->GetSize()+mdat_size;
+        for (AP4_List<AP4_EmsgAtom>::Item* item = m_Events.FirstItem(); item; item = item->GetNext()) {
+            referenced_size += item->GetData()->GetSize();
+        }
+        
+        AP4_SidxAtom sidx(reference->GetTrackId(),
+                          reference->m_Timescale,
+                          earliest_presentation_time > 0 ? (AP4_UI64)earliest_presentation_time : 0,
+                          0);
+        AP4_SidxAtom::Reference sidx_reference;
+        sidx_reference.m_ReferencedSize     = (AP4_UI32)referenced_size;
+        sidx_reference.m_SubsegmentDuration = (AP4_UI32)duration;
+        sidx_reference.m_StartsWithSap      = count && reference->m_Samples[0].IsSync();
+        sidx_reference.m_SapType            = sidx_reference.m_StartsWithSap ? 1 : 0;
+        sidx.SetReferenceCount(1);
+        sidx.SetReference(0, sidx_reference);
+        result = sidx.Write(stream);
+        if (AP4_FAILED(result)) {
+            delete moof;
+            return result;
+        }
+    }
+    
+    // the events come before the moof
+    for (AP4_List<AP4_EmsgAtom>::Item* item = m_Events.FirstItem(); item; item = item->GetNext()) {
+        result = item->GetData()->Write(stream);
+        if (AP4_FAILED(result)) {
+            delete moof;
+            return result;
+        }
+    }
+    m_Events.DeleteReferences();
+    
+    // write the moof and the mdat
+    result = moof->Write(stream);
+    delete moof;
+    if (AP4_FAILED(result)) return result;
+    stream.WriteUI32(mdat_size);
+    result = stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+    if (AP4_FAILED(result)) return result;
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (sample_counts[i] == 0) continue;
+        result = m_Builders[i]->WriteSampleData(stream, sample_counts[i]);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    // the samples are no longer needed
+    for (unsigned int i=0; i<m_Builders.ItemCount(); i++) {
+        if (sample_counts[i]) m_Builders[i]->RemoveSamples(sample_counts[i]);
+    }
+    
     return AP4_SUCCESS;
 }
@@ -42,7 +42,9 @@
 #include "Ap4Sample.h"
 #include "Ap4String.h"
 #include "Ap4Track.h"
+#include "Ap4File.h"
 #include "Ap4SampleDescription.h"
+#include "Ap4EmsgAtom.h"
 
 #include <memory>
 
@@ -51,6 +53,8 @@
 +---------------------------------------------------------------------*/
 class AP4_ByteStream;
 class AP4_MpegAudioSampleDescription;
+class AP4_ContainerAtom;
+class AP4_TrunAtom;
 
 /*----------------------------------------------------------------------
 |   AP4_SegmentBuilder
@@ -69,16 +73,73 @@ public:
     AP4_UI32               GetTimescale()      { return m_Timescale;      }
     AP4_UI64               GetMediaStartTime() { return m_MediaStartTime; }
     AP4_UI64               GetMediaDuration()  { return m_MediaDuration;  }
-    AP4_Array<AP4_Sample>& GetSamples()        { return m_Samples;        }
+    AP4_SampleRecordArray& GetSamples()        { return m_Samples;        }
     
     // methods
     virtual AP4_Result AddSample(AP4_Sample& sample);
-    //virtual AP4_Result CreateTrack(AP4_Track*& track); // create an AP4_Track object representing the media so far
+    virtual AP4_Result CreateTrack(AP4_Track*& track); // create an AP4_Track object representing the media so far
+    virtual AP4_UI32   GetCompatibleBrand() { return 0; } // brand added to the init segment, if any
     virtual AP4_Result WriteMediaSegment(AP4_ByteStream& stream, unsigned int sequence_number);
-    virtual AP4_Result WriteInitSegment(AP4_ByteStream& stream) = 0;
+    virtual AP4_Result WriteInitSegment(AP4_ByteStream& stream);
+
+    /**
+     * Enable chunked output (low-latency CMAF). Instead of writing whole
+     * segments with WriteMediaSegment, samples are written as moof+mdat
+     * chunks with WriteMediaChunk, as soon as a chunk of sample_count
+     * samples or duration_ms milliseconds (whichever comes first, 0 meaning
+     * no limit) is available. Video chunks also end before each sync sample,
+     * so that every GOP starts an independent chunk.
+     */
+    void SetChunkTarget(AP4_Cardinal sample_count, AP4_UI32 duration_ms);
+
+    /**
+     * Returns true when a chunk can be written.
+     */
+    bool IsChunkReady() { return GetChunkSampleCount(false) != 0; }
+
+    /**
+     * Returns true if the next chunk starts with a sync sample, in which case
+     * it can start a new segment (or an independent LL-HLS part).
+     */
+    bool IsChunkIndependent();
+
+    /**
+     * Write the next chunk. The first chunk of a segment is preceded by an
+     * 'styp' box. When flush is true, all the samples added so far are
+     * written, even if the chunk target is not reached (end of stream).
+     * Returns AP4_ERROR_NOT_ENOUGH_DATA when there is no chunk to write.
+     */
+    AP4_Result WriteMediaChunk(AP4_ByteStream& stream,
+                               unsigned int    sequence_number,
+                               bool            starts_segment,
+                               bool            flush = false);
     
 protected:
+    // friends
+    friend class AP4_SegmentMuxer;
+
     // methods
+    /**
+     * Returns the number of samples, from the start of m_Samples, whose
+     * timing is final. When flush is true, the timing of all the samples
+     * must be finalized.
+     */
+    virtual AP4_Cardinal CloseSamples(bool /* flush */) { return m_Samples.ItemCount(); }
+    bool         HasIncrementalTiming() { return m_ChunkSampleCount || m_ChunkDuration || m_Muxed; }
+    AP4_Cardinal GetChunkSampleCount(bool flush);
+    AP4_Result   WriteFragment(AP4_ByteStream& stream,
+                               unsigned int    sequence_number,
+                               AP4_Cardinal    sample_count,
+                               bool            is_chunk);
+    AP4_Result   CreateTrackFragment(AP4_Cardinal        sample_count,
+                                     bool                is_chunk,
+                                     AP4_ContainerAtom*& traf,
+                                     AP4_TrunAtom*&      trun,
+                                     AP4_UI32&           data_size);
+    AP4_Result   WriteSampleData(AP4_ByteStream& stream, AP4_Cardinal sample_count);
+    void         RemoveSamples(AP4_Cardinal sample_count);
+
+    // members
     AP4_Track::Type       m_TrackType;
     AP4_UI32              m_TrackId;
     AP4_String            m_TrackLanguage;
@@ -87,7 +148,10 @@ protected:
     AP4_UI64              m_MediaTimeOrigin;
     AP4_UI64              m_MediaStartTime;
     AP4_UI64              m_MediaDuration;
-    AP4_Array<AP4_Sample> m_Samples;
+    AP4_SampleRecordArray m_Samples;
+    AP4_Cardinal          m_ChunkSampleCount;
+    AP4_UI32              m_ChunkDuration; // in milliseconds
+    bool                  m_Muxed;         // added to an AP4_SegmentMuxer
 };
 
 /*----------------------------------------------------------------------
@@ -105,6 +169,23 @@ public:
     virtual AP4_Result Feed(const void* data,
                             AP4_Size    data_size,
                             AP4_Size&   bytes_consumed) = 0;
+
+    /**
+     * Feed size bytes of a reference-counted buffer, starting at offset.
+     * Builders that support it keep references to the buffer instead of
+     * copying the sample data, so the bytes fed must not be modified
+     * afterwards. As with Feed(), the bytes that are not consumed must be
+     * fed again at the start of the next call (possibly from another
+     * buffer). Returns 1 when a sample was added, or AP4_SUCCESS when more
+     * data is needed. When eos is true, all the remaining data is processed.
+     * Feed() and FeedBuffer() should not be mixed on the same builder.
+     * The default implementation calls Feed().
+     */
+    virtual AP4_Result FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                                  AP4_Size                              offset,
+                                  AP4_Size                              size,
+                                  AP4_Size&                             bytes_consumed,
+                                  bool                                  eos = false);
 };
 
 /*----------------------------------------------------------------------
@@ -130,18 +211,72 @@ protected:
         AP4_UI32 m_DecodeOrder;
         AP4_UI32 m_DisplayOrder;
     };
+    struct NalUnitReference {
+        std::shared_ptr<const AP4_DataBuffer> m_Buffer;
+        AP4_Size                              m_Offset;
+        AP4_Size                              m_Size;
+    };
     
     // methods
     void SortSamples(SampleOrder* array, unsigned int n);
+    AP4_Result AddAccessUnit(AP4_Sample& sample,
+                             AP4_UI32    decode_order,
+                             AP4_UI32    display_order,
+                             bool        is_random_access = false);
+    AP4_Result AddAccessUnit(const AP4_Array<AP4_DataBuffer*>& nal_units,
+                             bool                              by_reference,
+                             bool                              is_sync,
+                             bool                              is_random_access,
+                             AP4_UI32                          decode_order,
+                             AP4_UI32                          display_order);
+    AP4_Result NextNalUnit(std::shared_ptr<const AP4_DataBuffer> buffer,
+                           AP4_Size                              offset,
+                           AP4_Size                              size,
+                           bool                                  eos,
+                           AP4_Size&                             bytes_consumed,
+                           const AP4_UI08*&                      nal_unit,
+                           AP4_Size&                             nal_unit_size);
+    AP4_UI64 GetSampleTime(AP4_UI64 sample_number);
+    void CloseGop(bool complete);
+    AP4_Result CreateVideoTrack(AP4_SampleDescription* sample_description,
+                                unsigned int           width,
+                                unsigned int           height,
+                                AP4_Track*&            track);
     AP4_Result WriteVideoInitSegment(AP4_ByteStream&        stream,
                                      AP4_SampleDescription* sample_description,
                                      unsigned int           width,
                                      unsigned int           height,
                                      AP4_UI32               brand);
 
+    // AP4_SegmentBuilder methods
+    virtual AP4_Cardinal CloseSamples(bool flush);
+
     // members
     double                 m_FramesPerSecond;
     AP4_Array<SampleOrder> m_SampleOrders;
+
+    // chunked or muxed output: the composition time of a sample is final once the
+    // display order of all the samples of its GOP that come before it in
+    // display order is known
+    AP4_Array<AP4_UI32>    m_GopDisplayOrders;      // in decode order
+    AP4_UI64               m_GopStart;              // number of the first sample of the GOP
+    AP4_UI32               m_GopDisplayOrderBase;   // lowest display order of the GOP
+    AP4_UI32               m_LastDisplayOrder;      // highest display order of the closed GOPs
+    AP4_UI32               m_DisplayOrderStep;      // 0 until a whole GOP has been seen
+    AP4_UI64               m_ClosedSampleCount;     // samples with a final composition time
+
+    // FeedBuffer(): the NAL units passed to the frame parser, in feed order,
+    // until they are part of an access unit, and the NAL units found in the
+    // buffer being fed that have not been passed to the frame parser yet
+    AP4_Array<NalUnitReference>           m_NalUnitReferences;
+    std::shared_ptr<const AP4_DataBuffer> m_ScanBuffer;
+    AP4_Array<AP4_NalUnitRange>           m_ScanNalUnits; // relative to m_ScanStart
+    AP4_Cardinal                          m_ScanIndex;
+    AP4_Size                              m_ScanStart;
+    AP4_Size                              m_ScanPosition; // where the next call is expected to start
+    AP4_Size                              m_ScanEnd;
+    AP4_Size                              m_ScanConsumed;
+    bool                                  m_ScanEos;
 };
 
 /*----------------------------------------------------------------------
@@ -156,12 +291,18 @@ public:
                           AP4_UI64 media_time_origin = 0);
     
     // AP4_SegmentBuilder methods
-    virtual AP4_Result WriteInitSegment(AP4_ByteStream& stream);
+    virtual AP4_Result CreateTrack(AP4_Track*& track);
+    virtual AP4_UI32   GetCompatibleBrand() { return AP4_FILE_BRAND_AVC1; }
 
     // methods
     AP4_Result Feed(const void* data,
                     AP4_Size    data_size,
                     AP4_Size&   bytes_consumed);
+    AP4_Result FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                          AP4_Size                              offset,
+                          AP4_Size                              size,
+                          AP4_Size&                             bytes_consumed,
+                          bool                                  eos = false);
     
 protected:
     // members
@@ -181,12 +322,18 @@ public:
                            AP4_UI64 media_time_origin = 0);
     
     // AP4_SegmentBuilder methods
-    virtual AP4_Result WriteInitSegment(AP4_ByteStream& stream);
+    virtual AP4_Result CreateTrack(AP4_Track*& track);
+    virtual AP4_UI32   GetCompatibleBrand() { return AP4_FILE_BRAND_HVC1; }
 
     // methods
     AP4_Result Feed(const void* data,
                     AP4_Size    data_size,
                     AP4_Size&   bytes_consumed);
+    AP4_Result FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                          AP4_Size                              offset,
+                          AP4_Size                              size,
+                          AP4_Size&                             bytes_consumed,
+                          bool                                  eos = false);
     
 protected:
     // members
@@ -205,41 +352,131 @@ public:
     ~AP4_AacSegmentBuilder();
     
     // AP4_SegmentBuilder methods
-    virtual AP4_Result WriteInitSegment(AP4_ByteStream& stream);
+    virtual AP4_Result CreateTrack(AP4_Track*& track);
 
     // methods
     AP4_Result Feed(const void* data,
                     AP4_Size    data_size,
                     AP4_Size&   bytes_consumed);
+    AP4_Result FeedBuffer(std::shared_ptr<const AP4_DataBuffer> buffer,
+                          AP4_Size                              offset,
+                          AP4_Size                              size,
+                          AP4_Size&                             bytes_consumed,
+                          bool                                  eos = false);
     
 protected:
     // members
     AP4_AdtsParser                  m_FrameParser;
     AP4_MpegAudioSampleDescription* m_SampleDescription;
+
+    // methods
+    void CreateSampleDescription(const AP4_AacFrameInfo& frame_info);
 };
 
 /*----------------------------------------------------------------------
 |   AP4_StreamFeeder
 |
-|   Class that can be used to feed an AP4_FeedSegmentBuilder from a stream
+|   Class that can be used to feed an AP4_FeedSegmentBuilder from a stream.
+|   The data is read into reference-counted buffers that the builder can
+|   reference instead of copying the sample data (a buffer is only reused
+|   when the builder no longer references it, and up to a few buffers are
+|   kept for recycling).
 +---------------------------------------------------------------------*/
 class AP4_StreamFeeder
 {
 public:
-    // constructor and destructor
+    // constructor
     AP4_StreamFeeder(std::shared_ptr<AP4_ByteStream> source, AP4_FeedSegmentBuilder& builder);
-    ~AP4_StreamFeeder();
     
     // methods
     AP4_Result Feed(); // Read some data from the stream and feed it to the builder
     
 private:
-    std::shared_ptr<AP4_ByteStream> m_Source;
-    AP4_FeedSegmentBuilder&         m_Builder;
-    AP4_UI08*                       m_FeedBuffer;
-    AP4_Size                        m_FeedBufferSize;
-    AP4_Size                        m_FeedBytesPending;  // number of bytes not yet parsed
-    AP4_Size                        m_FeedBytesParsed;   // number of bytes already parsed
+    // methods
+    AP4_Result FillBuffer();
+
+    // members
+    std::shared_ptr<AP4_ByteStream>             m_Source;
+    AP4_FeedSegmentBuilder&                     m_Builder;
+    std::shared_ptr<AP4_DataBuffer>             m_FeedBuffer;
+    AP4_Array<std::shared_ptr<AP4_DataBuffer> > m_SpareBuffers;      // buffers that can be recycled
+    AP4_Size                                    m_FeedBytesPending;  // number of bytes not yet parsed
+    AP4_Size                                    m_FeedBytesParsed;   // number of bytes already parsed
+    bool                                        m_NeedsMoreData;     // the pending bytes are not enough for the builder
+    bool                                        m_Eos;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SegmentMuxer
+|
+|   Class that multiplexes the tracks of several segment builders: one init
+|   segment with all the tracks, and media segments with one 'traf' per
+|   track in the 'moof' and the samples of each track in a contiguous run
+|   of the 'mdat'. The first video track (or the first track when there is
+|   no video) is the reference track: segments start with one of its sync
+|   samples, and the other tracks are split at the same time. Each segment
+|   starts with an 'styp' box, followed by a 'sidx' box (unless disabled)
+|   and by the 'emsg' boxes of the events added since the previous segment.
++---------------------------------------------------------------------*/
+class AP4_SegmentMuxer
+{
+public:
+    // constructor and destructor
+    AP4_SegmentMuxer(AP4_UI32 segment_duration_ms);
+    ~AP4_SegmentMuxer();
+    
+    // methods
+    /**
+     * Add the track of a builder (not owned by the muxer). This must be
+     * done before any sample is added to the builder, which must not also
+     * be used for chunked output.
+     */
+    AP4_Result AddBuilder(AP4_SegmentBuilder& builder);
+    void       EnableSegmentIndex(bool enable) { m_SegmentIndexEnabled = enable; }
+    
+    /**
+     * Add an event, written as an 'emsg' box (version 1) in the next media
+     * segment. The presentation time is on the media timeline, in units of
+     * the event timescale.
+     */
+    AP4_Result AddEvent(const char*     scheme_id_uri,
+                        const char*     value,
+                        AP4_UI32        timescale,
+                        AP4_UI64        presentation_time,
+                        AP4_UI32        event_duration,
+                        AP4_UI32        id,
+                        const AP4_UI08* message_data = NULL,
+                        AP4_Size        message_data_size = 0);
+    
+    AP4_Result WriteInitSegment(AP4_ByteStream& stream);
+    
+    /**
+     * Returns true when a media segment can be written: the reference track
+     * has a sync sample at least one segment duration after the start of the
+     * segment, and the other tracks have samples up to that point.
+     */
+    bool IsSegmentReady();
+    
+    /**
+     * Write the next media segment. When flush is true (end of stream), all
+     * the samples added so far are written, without waiting for the next
+     * sync sample. Returns AP4_ERROR_NOT_ENOUGH_DATA when there is no
+     * segment to write.
+     */
+    AP4_Result WriteMediaSegment(AP4_ByteStream& stream,
+                                 unsigned int    sequence_number,
+                                 bool            flush = false);
+    
+private:
+    // methods
+    bool GetSegmentSampleCounts(bool flush, AP4_Array<AP4_Cardinal>& sample_counts);
+    
+    // members
+    AP4_UI32                       m_SegmentDuration; // in milliseconds
+    AP4_Array<AP4_SegmentBuilder*> m_Builders;
+    AP4_Ordinal                    m_ReferenceIndex;  // index of the reference track in m_Builders
+    bool                           m_SegmentIndexEnabled;
+    AP4_List<AP4_EmsgAtom>         m_Events;          // events not written yet
 };
 
 #endif // _AP4_SEGMENT_BUILDER_H_
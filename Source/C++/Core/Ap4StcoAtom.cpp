@@ -49,7 +49,21 @@ AP4_StcoAtom::Create(AP4_Size size, AP4_ByteStream& stream)
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StcoAtom(size, version, flags, stream);
+    return new AP4_StcoAtom(size, version, flags, stream, nullptr);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StcoAtom::CreateDeferred
++---------------------------------------------------------------------*/
+AP4_StcoAtom*
+AP4_StcoAtom::CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(*stream, version, flags))) return NULL;
+    if (version != 0) return NULL;
+    return new AP4_StcoAtom(size, version, flags, *stream, stream);
 }
 
 /*----------------------------------------------------------------------
@@ -68,10 +82,11 @@ AP4_Atom(AP4_ATOM_TYPE_STCO,
 /*----------------------------------------------------------------------
 |   AP4_StcoAtom::AP4_StcoAtom
 +---------------------------------------------------------------------*/
-AP4_StcoAtom::AP4_StcoAtom(AP4_UI32        size, 
-                           AP4_UI08        version,
-                           AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+AP4_StcoAtom::AP4_StcoAtom(AP4_UI32                        size, 
+                           AP4_UI08                        version,
+                           AP4_UI32                        flags,
+                           AP4_ByteStream&                 stream,
+                           std::shared_ptr<AP4_ByteStream> deferred_source) :
     AP4_Atom(AP4_ATOM_TYPE_STCO, size, version, flags),
     m_Entries(NULL),
     m_EntryCount(0)
@@ -83,6 +98,15 @@ AP4_StcoAtom::AP4_StcoAtom(AP4_UI32        size,
     if (m_EntryCount > (size-AP4_FULL_ATOM_HEADER_SIZE-4)/4) {
         m_EntryCount = (size-AP4_FULL_ATOM_HEADER_SIZE-4)/4;
     }
+
+    // defer reading the entries until they are needed
+    if (deferred_source) {
+        if (AP4_FAILED(m_DeferredEntries.Attach(std::move(deferred_source), m_EntryCount*4))) {
+            m_EntryCount = 0;
+        }
+        return;
+    }
+
     m_Entries = new AP4_UI32[m_EntryCount];
     unsigned char* buffer = new unsigned char[m_EntryCount*4];
     AP4_Result result = stream.Read(buffer, m_EntryCount*4);
@@ -96,6 +120,27 @@ AP4_StcoAtom::AP4_StcoAtom(AP4_UI32        size,
     delete[] buffer;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StcoAtom::LoadEntries
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StcoAtom::LoadEntries()
+{
+    unsigned char* buffer = new unsigned char[m_EntryCount*4];
+    AP4_Result     result = m_DeferredEntries.Load(buffer);
+    if (AP4_FAILED(result)) {
+        delete[] buffer;
+        return result;
+    }
+    m_Entries = new AP4_UI32[m_EntryCount];
+    for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
+        m_Entries[i] = AP4_BytesToUInt32BE(&buffer[i*4]);
+    }
+    delete[] buffer;
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StcoAtom::~AP4_StcoAtom
 +---------------------------------------------------------------------*/
@@ -110,6 +155,9 @@ AP4_StcoAtom::~AP4_StcoAtom()
 AP4_Result
 AP4_StcoAtom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI32& chunk_offset)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     // check the bounds
     if (chunk > m_EntryCount || chunk == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
@@ -127,6 +175,9 @@ AP4_StcoAtom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI32& chunk_offset)
 AP4_Result
 AP4_StcoAtom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI32 chunk_offset)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     // check the bounds
     if (chunk > m_EntryCount || chunk == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
@@ -144,6 +195,9 @@ AP4_StcoAtom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI32 chunk_offset)
 AP4_Result
 AP4_StcoAtom::AdjustChunkOffsets(int delta)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         m_Entries[i] += delta;
     }
@@ -157,7 +211,8 @@ AP4_StcoAtom::AdjustChunkOffsets(int delta)
 AP4_Result
 AP4_StcoAtom::WriteFields(AP4_ByteStream& stream)
 {
-    AP4_Result result;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
 
     // entry count
     result = stream.WriteUI32(m_EntryCount);
@@ -180,6 +235,8 @@ AP4_StcoAtom::InspectFields(AP4_AtomInspector& inspector)
 {
     inspector.AddField("entry_count", m_EntryCount);
     if (inspector.GetVerbosity() >= 1) {
+        AP4_Result result = EnsureEntries();
+        if (AP4_FAILED(result)) return result;
         inspector.StartArray("entries", m_EntryCount);
         for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
             inspector.AddField(NULL, m_Entries[i]);
@@ -172,11 +172,9 @@ AP4_StscAtom::GetChunkForSample(AP4_Ordinal  sample,
 
     // decide whether to start the search from the cached index
     // or from the start
-    AP4_Ordinal group;
-    if (m_CachedChunkGroup < m_Entries.ItemCount() &&
-        m_Entries[m_CachedChunkGroup].m_FirstSample <= sample) {
-        group = m_CachedChunkGroup;
-    } else {
+    AP4_Ordinal group = m_CachedChunkGroup.load(std::memory_order_relaxed);
+    if (group >= m_Entries.ItemCount() ||
+        m_Entries[group].m_FirstSample > sample) {
         group = 0;
     }
 
@@ -215,7 +213,7 @@ AP4_StscAtom::GetChunkForSample(AP4_Ordinal  sample,
 
         // cache the result (to accelerate finding the right group
         // next time around)
-        m_CachedChunkGroup = group;
+        m_CachedChunkGroup.store(group, std::memory_order_relaxed);
 
         return AP4_SUCCESS;
     }
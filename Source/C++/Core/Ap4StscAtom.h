@@ -36,6 +36,8 @@
 #include "Ap4Atom.h"
 #include "Ap4Array.h"
 
+#include <atomic>
+
 /*----------------------------------------------------------------------
 |   AP4_StscTableEntry
 +---------------------------------------------------------------------*/
@@ -105,7 +107,7 @@ private:
 
     // members
     AP4_Array<AP4_StscTableEntry> m_Entries;
-    AP4_Ordinal                   m_CachedChunkGroup;
+    std::atomic<AP4_Ordinal>      m_CachedChunkGroup; // shared hint, safe for concurrent readers
 };
 
 #endif // _AP4_STSC_ATOM_H_
@@ -171,6 +171,9 @@ AP4_StsdAtom::GetSampleDescription(AP4_Ordinal index)
     // check index
     if (index >= m_Children.ItemCount()) return NULL;
 
+    // the descriptions are created on demand, possibly by concurrent readers
+    std::lock_guard<std::mutex> lock(m_SampleDescriptionsLock);
+
     // return the description if we already have it in the internal table
     if (m_SampleDescriptions[index]) return m_SampleDescriptions[index];
 
@@ -78,6 +78,7 @@ private:
 
     // members
     AP4_Array<AP4_SampleDescription*> m_SampleDescriptions;
+    std::mutex                        m_SampleDescriptionsLock;
 };
 
 #endif // _AP4_STSD_ATOM_H_
@@ -56,7 +56,8 @@ AP4_StssAtom::Create(AP4_Size size, AP4_ByteStream& stream)
 |   AP4_StssAtom::AP4_StssAtom
 +---------------------------------------------------------------------*/
 AP4_StssAtom::AP4_StssAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_LookupCache(0)
 {
 }
 
@@ -137,15 +138,16 @@ AP4_StssAtom::IsSampleSync(AP4_Ordinal sample)
     if (sample == 0 || m_Entries.ItemCount() == 0) return false;
 
     // see if we can start from the cached index
-    if (m_Entries[m_LookupCache] <= sample) {
-        entry_index = m_LookupCache;
+    AP4_Ordinal cached_index = m_LookupCache.load(std::memory_order_relaxed);
+    if (cached_index < m_Entries.ItemCount() && m_Entries[cached_index] <= sample) {
+        entry_index = cached_index;
     }
 
     // do a linear search
     while (entry_index < m_Entries.ItemCount() &&
            m_Entries[entry_index] <= sample) {
         if (m_Entries[entry_index] == sample) {
-            m_LookupCache = entry_index;
+            m_LookupCache.store(entry_index, std::memory_order_relaxed);
             return true;
         }
 	    entry_index++;
@@ -35,6 +35,8 @@
 #include "Ap4Array.h"
 #include "Ap4Atom.h"
 
+#include <atomic>
+
 /*----------------------------------------------------------------------
 |   AP4_StssAtom
 +---------------------------------------------------------------------*/
@@ -66,7 +68,7 @@ private:
     
     // members
     AP4_Array<AP4_UI32> m_Entries;
-    AP4_Ordinal         m_LookupCache;
+    std::atomic<AP4_Ordinal> m_LookupCache; // shared hint, safe for concurrent readers
 };
 
 #endif // _AP4_STSS_ATOM_H_
@@ -49,7 +49,21 @@ AP4_StszAtom::Create(AP4_Size size, AP4_ByteStream& stream)
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StszAtom(size, version, flags, stream);
+    return new AP4_StszAtom(size, version, flags, stream, nullptr);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StszAtom::CreateDeferred
++---------------------------------------------------------------------*/
+AP4_StszAtom*
+AP4_StszAtom::CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(*stream, version, flags))) return NULL;
+    if (version != 0) return NULL;
+    return new AP4_StszAtom(size, version, flags, *stream, stream);
 }
 
 /*----------------------------------------------------------------------
@@ -65,10 +79,11 @@ AP4_StszAtom::AP4_StszAtom() :
 /*----------------------------------------------------------------------
 |   AP4_StszAtom::AP4_StszAtom
 +---------------------------------------------------------------------*/
-AP4_StszAtom::AP4_StszAtom(AP4_UI32        size, 
-                           AP4_UI08        version,
-                           AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+AP4_StszAtom::AP4_StszAtom(AP4_UI32                        size, 
+                           AP4_UI08                        version,
+                           AP4_UI32                        flags,
+                           AP4_ByteStream&                 stream,
+                           std::shared_ptr<AP4_ByteStream> deferred_source) :
     AP4_Atom(AP4_ATOM_TYPE_STSZ, size, version, flags),
     m_SampleSize(0),
     m_SampleCount(0)
@@ -85,6 +100,15 @@ AP4_StszAtom::AP4_StszAtom(AP4_UI32        size,
         if (sample_count > (size - AP4_FULL_ATOM_HEADER_SIZE - 8) / 4) {
             return;
         }
+
+        // defer reading the entries until they are needed
+        if (deferred_source) {
+            if (AP4_FAILED(m_DeferredEntries.Attach(std::move(deferred_source), sample_count*4))) {
+                return;
+            }
+            m_SampleCount = sample_count;
+            return;
+        }
         
         // read the entries
         unsigned char* buffer = new unsigned char[sample_count * 4];
@@ -102,13 +126,36 @@ AP4_StszAtom::AP4_StszAtom(AP4_UI32        size,
     m_SampleCount = sample_count;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StszAtom::LoadEntries
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StszAtom::LoadEntries()
+{
+    AP4_Size       payload_size = m_DeferredEntries.GetSize();
+    unsigned char* buffer = new unsigned char[payload_size];
+    AP4_Result     result = m_DeferredEntries.Load(buffer);
+    if (AP4_FAILED(result)) {
+        delete[] buffer;
+        return result;
+    }
+    m_Entries.SetItemCount(payload_size/4);
+    for (unsigned int i = 0; i < payload_size/4; i++) {
+        m_Entries[i] = AP4_BytesToUInt32BE(&buffer[i * 4]);
+    }
+    delete[] buffer;
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StszAtom::WriteFields
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_StszAtom::WriteFields(AP4_ByteStream& stream)
 {
-    AP4_Result result;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
 
     // sample size
     result = stream.WriteUI32(m_SampleSize);
@@ -153,12 +200,45 @@ AP4_StszAtom::GetSampleSize(AP4_Ordinal sample, AP4_Size& sample_size)
         if (m_SampleSize != 0) { // constant size
             sample_size = m_SampleSize;
         } else {
+            AP4_Result result = EnsureEntries();
+            if (AP4_FAILED(result)) {
+                sample_size = 0;
+                return result;
+            }
             sample_size = m_Entries[sample - 1];
         }
         return AP4_SUCCESS;
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StszAtom::GetSampleRangeSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StszAtom::GetSampleRangeSize(AP4_Ordinal first, AP4_Cardinal count, AP4_UI64& range_size)
+{
+    // check the range
+    range_size = 0;
+    if (count == 0) return AP4_SUCCESS;
+    if (first == 0 || (AP4_UI64)first-1+count > m_SampleCount) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+
+    // constant size
+    if (m_SampleSize != 0) {
+        range_size = (AP4_UI64)count*(AP4_UI64)m_SampleSize;
+        return AP4_SUCCESS;
+    }
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+    if ((AP4_UI64)first-1+count > m_Entries.ItemCount()) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+    range_size = m_SampleOffsets.GetRangeTotal(m_Entries, first-1, count);
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StszAtom::SetSampleSize
 +---------------------------------------------------------------------*/
@@ -169,6 +249,8 @@ AP4_StszAtom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
     if (sample > m_SampleCount || sample == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
     } else {
+        AP4_Result result = EnsureEntries();
+        if (AP4_FAILED(result)) return result;
         if (m_Entries.ItemCount() == 0) {
             // all samples must have the same size
             if (sample_size != m_SampleSize) {
@@ -188,6 +270,7 @@ AP4_StszAtom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
                 return AP4_ERROR_OUT_OF_RANGE;
             }
             m_Entries[sample - 1] = sample_size;
+            m_SampleOffsets.Invalidate();
         }
 
         return AP4_SUCCESS;
@@ -200,8 +283,11 @@ AP4_StszAtom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
 AP4_Result 
 AP4_StszAtom::AddEntry(AP4_UI32 size)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
     m_Entries.Append(size);
     m_SampleCount++;
+    m_SampleOffsets.Append(size);
     m_Size32 += 4;
 
     return AP4_SUCCESS;
@@ -217,6 +303,8 @@ AP4_StszAtom::InspectFields(AP4_AtomInspector& inspector)
     inspector.AddField("sample_count", m_SampleCount);
 
     if (inspector.GetVerbosity() >= 2) {
+        AP4_Result result = EnsureEntries();
+        if (AP4_FAILED(result)) return result;
         inspector.StartArray("entries", m_Entries.ItemCount());
         for (AP4_Ordinal i=0; i<m_Entries.ItemCount(); i++) {
             inspector.AddField(NULL, m_Entries[i]);
@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Array.h"
 #include "Ap4Atom.h"
+#include "Ap4Utils.h"
 
 /*----------------------------------------------------------------------
 |   AP4_StszAtom
@@ -45,6 +46,11 @@ public:
 
     // class methods
     static AP4_StszAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    /**
+     * Create an atom whose entries are only decoded on first access.
+     * The stream must remain valid, and its content unchanged, until then.
+     */
+    static AP4_StszAtom* CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream);
 
     // methods
     AP4_StszAtom();
@@ -65,19 +71,33 @@ public:
      */
     virtual AP4_Result SetSampleSize(AP4_Ordinal sample, 
                                      AP4_Size    sample_size);
+    /**
+     * Get the total size of a range of consecutive samples.
+     * @param first 1-based index of the first sample of the range.
+     * @param count Number of samples in the range.
+     * @param range_size Sum of the sizes of the samples in the range.
+     */
+    virtual AP4_Result GetSampleRangeSize(AP4_Ordinal  first,
+                                          AP4_Cardinal count,
+                                          AP4_UI64&    range_size);
     virtual AP4_Result AddEntry(AP4_UI32 size);
 
 private:
     // methods
-    AP4_StszAtom(AP4_UI32        size, 
-                 AP4_UI08        version,
-                 AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+    AP4_StszAtom(AP4_UI32                        size, 
+                 AP4_UI08                        version,
+                 AP4_UI32                        flags,
+                 AP4_ByteStream&                 stream,
+                 std::shared_ptr<AP4_ByteStream> deferred_source);
+    AP4_Result LoadEntries();
+    AP4_Result EnsureEntries() { return m_DeferredEntries.Resolve([this] { return LoadEntries(); }); }
 
     // members
     AP4_UI32            m_SampleSize;
     AP4_UI32            m_SampleCount;
     AP4_Array<AP4_UI32> m_Entries;
+    AP4_RunningTotals   m_SampleOffsets; // running totals of the entries
+    AP4_DeferredPayload m_DeferredEntries;
 };
 
 #endif // _AP4_STSZ_ATOM_H_
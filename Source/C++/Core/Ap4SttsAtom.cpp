@@ -49,35 +49,58 @@ AP4_SttsAtom::Create(AP4_Size size, AP4_ByteStream& stream)
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_SttsAtom(size, version, flags, stream);
+    return new AP4_SttsAtom(size, version, flags, stream, nullptr);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::CreateDeferred
++---------------------------------------------------------------------*/
+AP4_SttsAtom*
+AP4_SttsAtom::CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream)
+{
+    AP4_UI08 version;
+    AP4_UI32 flags;
+    if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
+    if (AP4_FAILED(AP4_Atom::ReadFullHeader(*stream, version, flags))) return NULL;
+    if (version != 0) return NULL;
+    return new AP4_SttsAtom(size, version, flags, *stream, stream);
 }
 
 /*----------------------------------------------------------------------
 |   AP4_SttsAtom::AP4_SttsAtom
 +---------------------------------------------------------------------*/
 AP4_SttsAtom::AP4_SttsAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_STTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_STTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_StartsReady(false),
+    m_LookupCache(0)
 {
-    m_LookupCache.entry_index = 0;
-    m_LookupCache.sample      = 0;
-    m_LookupCache.dts         = 0;
 }
 
 /*----------------------------------------------------------------------
 |   AP4_SttsAtom::AP4_SttsAtom
 +---------------------------------------------------------------------*/
-AP4_SttsAtom::AP4_SttsAtom(AP4_UI32        size, 
-                           AP4_UI08        version,
-                           AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_STTS, size, version, flags)
+AP4_SttsAtom::AP4_SttsAtom(AP4_UI32                        size, 
+                           AP4_UI08                        version,
+                           AP4_UI32                        flags,
+                           AP4_ByteStream&                 stream,
+                           std::shared_ptr<AP4_ByteStream> deferred_source) :
+    AP4_Atom(AP4_ATOM_TYPE_STTS, size, version, flags),
+    m_StartsReady(false),
+    m_LookupCache(0)
 {
-    m_LookupCache.entry_index = 0;
-    m_LookupCache.sample      = 0;
-    m_LookupCache.dts         = 0;
-
     AP4_UI32 entry_count;
     stream.ReadUI32(entry_count);
+
+    // defer reading the entries until they are needed
+    if (deferred_source) {
+        if (size < AP4_FULL_ATOM_HEADER_SIZE+4) return;
+        if (entry_count > (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8) {
+            entry_count = (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8;
+        }
+        m_DeferredEntries.Attach(std::move(deferred_source), entry_count*8);
+        return;
+    }
+
     while (entry_count--) {
         AP4_UI32 sample_count;
         AP4_UI32 sample_duration;
@@ -89,6 +112,60 @@ AP4_SttsAtom::AP4_SttsAtom(AP4_UI32        size,
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::LoadEntries
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SttsAtom::LoadEntries()
+{
+    AP4_Size       payload_size = m_DeferredEntries.GetSize();
+    unsigned char* buffer = new unsigned char[payload_size];
+    AP4_Result     result = m_DeferredEntries.Load(buffer);
+    if (AP4_FAILED(result)) {
+        delete[] buffer;
+        return result;
+    }
+    m_Entries.SetItemCount(payload_size/8);
+    for (unsigned int i=0; i<payload_size/8; i++) {
+        m_Entries[i].m_SampleCount    = AP4_BytesToUInt32BE(&buffer[i*8  ]);
+        m_Entries[i].m_SampleDuration = AP4_BytesToUInt32BE(&buffer[i*8+4]);
+    }
+    delete[] buffer;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::EnsureStarts
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SttsAtom::EnsureStarts()
+{
+    if (m_StartsReady.load(std::memory_order_acquire)) return AP4_SUCCESS;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
+    std::lock_guard<std::mutex> lock(m_StartsLock);
+    if (m_StartsReady.load(std::memory_order_relaxed)) return AP4_SUCCESS;
+
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    m_FirstSamples.SetItemCount(entry_count+1);
+    m_FirstDts.SetItemCount(entry_count+1);
+    AP4_UI64 sample = 0;
+    AP4_UI64 dts    = 0;
+    for (AP4_Ordinal i=0; i<entry_count; i++) {
+        m_FirstSamples[i] = sample;
+        m_FirstDts[i]     = dts;
+        sample += m_Entries[i].m_SampleCount;
+        dts    += (AP4_UI64)m_Entries[i].m_SampleCount * (AP4_UI64)m_Entries[i].m_SampleDuration;
+    }
+    m_FirstSamples[entry_count] = sample;
+    m_FirstDts[entry_count]     = dts;
+
+    m_StartsReady.store(true, std::memory_order_release);
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SttsAtom::GetDts
 +---------------------------------------------------------------------*/
@@ -103,42 +180,24 @@ AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
     if (sample == 0) return AP4_ERROR_OUT_OF_RANGE;
     --sample;
 
-    // check the lookup cache
-    AP4_Ordinal lookup_start = 0;
-    AP4_Ordinal sample_start = 0;
-    AP4_UI64    dts_start    = 0;
-    if (sample >= m_LookupCache.sample) {
-        // start from the cached entry
-        lookup_start = m_LookupCache.entry_index;
-        sample_start = m_LookupCache.sample;
-        dts_start    = m_LookupCache.dts;
-    }
+    // check that the sample is in the table
+    AP4_Result result = EnsureStarts();
+    if (AP4_FAILED(result)) return result;
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    if (sample >= m_FirstSamples[entry_count]) return AP4_ERROR_OUT_OF_RANGE;
 
-    // look from the last known point
-    for (AP4_Ordinal i = lookup_start; i < m_Entries.ItemCount(); i++) {
-        AP4_SttsTableEntry& entry = m_Entries[i];
+    // find the entry, starting from the last one used
+    AP4_Ordinal i = AP4_FindRange(m_FirstSamples, 
+                                  entry_count, 
+                                  (AP4_UI64)sample, 
+                                  m_LookupCache.load(std::memory_order_relaxed));
+    m_LookupCache.store(i, std::memory_order_relaxed);
 
-        // check if we have reached the sample
-        if (sample < sample_start+entry.m_SampleCount) {
-            // we are within the sample range for the current entry
-            dts = dts_start + (AP4_UI64)(sample - sample_start) * (AP4_UI64)entry.m_SampleDuration;
-            if (duration) *duration = entry.m_SampleDuration;
-            
-            // update the lookup cache
-            m_LookupCache.entry_index = i;
-            m_LookupCache.sample      = sample_start;
-            m_LookupCache.dts         = dts_start;
+    const AP4_SttsTableEntry& entry = m_Entries[i];
+    dts = m_FirstDts[i] + (sample - m_FirstSamples[i]) * (AP4_UI64)entry.m_SampleDuration;
+    if (duration) *duration = entry.m_SampleDuration;
             
-            return AP4_SUCCESS;
-        }
- 
-        // update the sample and dts bases
-        sample_start += entry.m_SampleCount;
-        dts_start    += (AP4_UI64)entry.m_SampleCount * (AP4_UI64)entry.m_SampleDuration;
-    }
-
-    // sample is greater than the number of samples
-    return AP4_ERROR_OUT_OF_RANGE;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -147,9 +206,18 @@ AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
 AP4_Result
 AP4_SttsAtom::AddEntry(AP4_UI32 sample_count, AP4_UI32 sample_duration)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
     m_Entries.Append(AP4_SttsTableEntry(sample_count, sample_duration));
     m_Size32 += 8;
 
+    // keep the entry starts up to date if they have been computed already
+    if (m_StartsReady.load(std::memory_order_relaxed)) {
+        AP4_Cardinal entry_count = m_Entries.ItemCount();
+        m_FirstSamples.Append(m_FirstSamples[entry_count-1]+sample_count);
+        m_FirstDts.Append(m_FirstDts[entry_count-1]+(AP4_UI64)sample_count*(AP4_UI64)sample_duration);
+    }
+
     return AP4_SUCCESS;
 }
 
@@ -159,7 +227,8 @@ AP4_SttsAtom::AddEntry(AP4_UI32 sample_count, AP4_UI32 sample_duration)
 AP4_Result
 AP4_SttsAtom::WriteFields(AP4_ByteStream& stream)
 {
-    AP4_Result result;
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
 
     // write the entry count
     AP4_Cardinal entry_count = m_Entries.ItemCount();
@@ -187,30 +256,24 @@ AP4_Result
 AP4_SttsAtom::GetSampleIndexForTimeStamp(AP4_UI64      ts, 
                                          AP4_Ordinal&  sample_index)
 {
-    // init
-    AP4_Cardinal entry_count = m_Entries.ItemCount();
-    AP4_UI64 accumulated = 0;
+    // check that the timestamp is in the table
     sample_index = 0;
-    
-    for (AP4_Ordinal i=0; i<entry_count; i++) {
-        AP4_UI64 next_accumulated = 
-            accumulated +
-            (AP4_UI64)m_Entries[i].m_SampleCount * 
-            (AP4_UI64)m_Entries[i].m_SampleDuration;
-        
-        // check if the ts is in the range of this entry
-        if (ts < next_accumulated) {
-            sample_index += (AP4_UI32)((ts - accumulated) / m_Entries[i].m_SampleDuration);
-            return AP4_SUCCESS;
-        }
+    AP4_Result result = EnsureStarts();
+    if (AP4_FAILED(result)) return result;
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    if (ts >= m_FirstDts[entry_count]) return AP4_FAILURE;
 
-        // update accumulated and sample
-        accumulated = next_accumulated;
-        sample_index += m_Entries[i].m_SampleCount;
-    }
+    // find the entry, starting from the last one used
+    AP4_Ordinal i = AP4_FindRange(m_FirstDts, 
+                                  entry_count, 
+                                  ts, 
+                                  m_LookupCache.load(std::memory_order_relaxed));
+    m_LookupCache.store(i, std::memory_order_relaxed);
 
-    // ts not in range of the table
-    return AP4_FAILURE;
+    // entries found this way never have a zero duration
+    sample_index = (AP4_Ordinal)(m_FirstSamples[i] + (ts - m_FirstDts[i]) / m_Entries[i].m_SampleDuration);
+
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -219,6 +282,8 @@ AP4_SttsAtom::GetSampleIndexForTimeStamp(AP4_UI64      ts,
 AP4_Result
 AP4_SttsAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    AP4_Result result = EnsureEntries();
+    if (AP4_FAILED(result)) return result;
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     if (inspector.GetVerbosity() >= 1) {
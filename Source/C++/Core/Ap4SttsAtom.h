@@ -35,6 +35,9 @@
 #include "Ap4Array.h"
 #include "Ap4Atom.h"
 
+#include <atomic>
+#include <mutex>
+
 /*----------------------------------------------------------------------
 |   AP4_SttsTableEntry
 +---------------------------------------------------------------------*/
@@ -62,6 +65,11 @@ public:
 
     // class methods
     static AP4_SttsAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    /**
+     * Create an atom whose entries are only decoded on first access.
+     * The stream must remain valid, and its content unchanged, until then.
+     */
+    static AP4_SttsAtom* CreateDeferred(AP4_Size size, std::shared_ptr<AP4_ByteStream> stream);
 
     // methods
     AP4_SttsAtom();
@@ -74,18 +82,25 @@ public:
 
 private:
     // methods
-    AP4_SttsAtom(AP4_UI32        size, 
-                 AP4_UI08        version,
-                 AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+    AP4_SttsAtom(AP4_UI32                        size, 
+                 AP4_UI08                        version,
+                 AP4_UI32                        flags,
+                 AP4_ByteStream&                 stream,
+                 std::shared_ptr<AP4_ByteStream> deferred_source);
+    AP4_Result LoadEntries();
+    AP4_Result EnsureEntries() { return m_DeferredEntries.Resolve([this] { return LoadEntries(); }); }
+    AP4_Result EnsureStarts();
 
     // members
     AP4_Array<AP4_SttsTableEntry> m_Entries;
-    struct {
-        AP4_Ordinal entry_index;
-        AP4_Ordinal sample;
-        AP4_UI64    dts;
-    } m_LookupCache;
+    // first sample and first dts of each entry, plus the totals at the end,
+    // computed on the first lookup
+    AP4_Array<AP4_UI64>           m_FirstSamples;
+    AP4_Array<AP4_UI64>           m_FirstDts;
+    std::atomic<bool>             m_StartsReady;
+    std::mutex                    m_StartsLock;
+    std::atomic<AP4_Ordinal>      m_LookupCache; // entry of the last lookup
+    AP4_DeferredPayload           m_DeferredEntries;
 };
 
 #endif // _AP4_STTS_ATOM_H_
@@ -212,6 +212,26 @@ AP4_Stz2Atom::GetSampleSize(AP4_Ordinal sample, AP4_Size& sample_size)
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Stz2Atom::GetSampleRangeSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Stz2Atom::GetSampleRangeSize(AP4_Ordinal first, AP4_Cardinal count, AP4_UI64& range_size)
+{
+    // check the range
+    range_size = 0;
+    if (count == 0) return AP4_SUCCESS;
+    if (first == 0 || (AP4_UI64)first-1+count > m_SampleCount) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+    if ((AP4_UI64)first-1+count > m_Entries.ItemCount()) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+    range_size = m_SampleOffsets.GetRangeTotal(m_Entries, first-1, count);
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Stz2Atom::SetSampleSize
 +---------------------------------------------------------------------*/
@@ -223,6 +243,7 @@ AP4_Stz2Atom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
         return AP4_ERROR_OUT_OF_RANGE;
     } else {
         m_Entries[sample - 1] = sample_size;
+        m_SampleOffsets.Invalidate();
         return AP4_SUCCESS;
     }
 }
@@ -235,6 +256,7 @@ AP4_Stz2Atom::AddEntry(AP4_UI32 size)
 {
     m_Entries.Append(size);
     m_SampleCount++;
+    m_SampleOffsets.Append(size);
     if (m_FieldSize == 4) {
         if ((m_SampleCount%2) == 1) {
             m_Size32++;
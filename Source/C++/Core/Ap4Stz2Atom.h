@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Array.h"
 #include "Ap4Atom.h"
+#include "Ap4Utils.h"
 
 /*----------------------------------------------------------------------
 |   AP4_Stz2Atom
@@ -60,6 +61,15 @@ public:
      */
     virtual AP4_Result SetSampleSize(AP4_Ordinal sample, 
                                      AP4_Size    sample_size);
+    /**
+     * Get the total size of a range of consecutive samples.
+     * @param first 1-based index of the first sample of the range.
+     * @param count Number of samples in the range.
+     * @param range_size Sum of the sizes of the samples in the range.
+     */
+    virtual AP4_Result GetSampleRangeSize(AP4_Ordinal  first,
+                                          AP4_Cardinal count,
+                                          AP4_UI64&    range_size);
 
     virtual AP4_Result AddEntry(AP4_UI32 size);
 
@@ -74,6 +84,7 @@ private:
     AP4_UI08            m_FieldSize;
     AP4_UI32            m_SampleCount;
     AP4_Array<AP4_UI32> m_Entries;
+    AP4_RunningTotals   m_SampleOffsets; // running totals of the entries
 };
 
 #endif // _AP4_STZ2_ATOM_H_
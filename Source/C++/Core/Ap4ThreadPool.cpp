@@ -0,0 +1,105 @@
+/*****************************************************************
+|
+|    AP4 - Thread Pool
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4ThreadPool.h"
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool::GetDefaultThreadCount
++---------------------------------------------------------------------*/
+unsigned int
+AP4_ThreadPool::GetDefaultThreadCount()
+{
+    unsigned int count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool::AP4_ThreadPool
++---------------------------------------------------------------------*/
+AP4_ThreadPool::AP4_ThreadPool(unsigned int thread_count) :
+    m_Stopping(false)
+{
+    if (thread_count == 0) thread_count = 1;
+    m_Threads.reserve(thread_count);
+    for (unsigned int i=0; i<thread_count; i++) {
+        m_Threads.emplace_back(&AP4_ThreadPool::Run, this);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool::~AP4_ThreadPool
++---------------------------------------------------------------------*/
+AP4_ThreadPool::~AP4_ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stopping = true;
+    }
+    m_TaskAvailable.notify_all();
+    for (unsigned int i=0; i<m_Threads.size(); i++) {
+        m_Threads[i].join();
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool::Submit
++---------------------------------------------------------------------*/
+std::future<AP4_Result>
+AP4_ThreadPool::Submit(Task task)
+{
+    std::packaged_task<AP4_Result()> packaged(std::move(task));
+    std::future<AP4_Result> result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Tasks.push_back(std::move(packaged));
+    }
+    m_TaskAvailable.notify_one();
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool::Run
++---------------------------------------------------------------------*/
+void
+AP4_ThreadPool::Run()
+{
+    for (;;) {
+        std::packaged_task<AP4_Result()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_TaskAvailable.wait(lock, [this] { return m_Stopping || !m_Tasks.empty(); });
+            if (m_Tasks.empty()) return; // stopping, and nothing left to do
+            task = std::move(m_Tasks.front());
+            m_Tasks.pop_front();
+        }
+        task();
+    }
+}
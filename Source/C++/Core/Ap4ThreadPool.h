@@ -0,0 +1,85 @@
+/*****************************************************************
+|
+|    AP4 - Thread Pool
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_THREAD_POOL_H_
+#define _AP4_THREAD_POOL_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+#include "Ap4Results.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadPool
++---------------------------------------------------------------------*/
+/**
+ * Fixed-size pool of worker threads executing tasks in submission order.
+ * Tasks return an AP4_Result that can be collected through the future
+ * returned by Submit(). Destroying the pool waits for all submitted
+ * tasks to complete.
+ */
+class AP4_ThreadPool {
+public:
+    // types
+    typedef std::function<AP4_Result()> Task;
+
+    // class methods
+    /**
+     * Returns the number of threads that can run concurrently on this
+     * machine, or 1 if that number cannot be determined.
+     */
+    static unsigned int GetDefaultThreadCount();
+
+    // methods
+    AP4_ThreadPool(unsigned int thread_count);
+    ~AP4_ThreadPool();
+    std::future<AP4_Result> Submit(Task task);
+    unsigned int GetThreadCount() const { return (unsigned int)m_Threads.size(); }
+
+private:
+    // methods
+    void Run();
+
+    // members
+    std::vector<std::thread>                    m_Threads;
+    std::deque<std::packaged_task<AP4_Result()> > m_Tasks;
+    std::mutex                                  m_Lock;
+    std::condition_variable                     m_TaskAvailable;
+    bool                                        m_Stopping;
+};
+
+#endif // _AP4_THREAD_POOL_H_
@@ -475,6 +475,49 @@ AP4_Track::ReadSample(AP4_Ordinal     index,
     return sample.ReadData(data);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Track::ReadSamples
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Track::ReadSamples(AP4_Ordinal                    first_index,
+                       AP4_Cardinal                   sample_count,
+                       AP4_Array<AP4_Sample>&         samples,
+                       AP4_DataBuffer&                arena,
+                       AP4_Array<AP4_SampleDataView>& views)
+{
+    samples.Clear();
+    views.Clear();
+
+    // clamp the range to the end of the track
+    AP4_Cardinal track_sample_count = GetSampleCount();
+    if (first_index >= track_sample_count) return AP4_ERROR_OUT_OF_RANGE;
+    if (sample_count > track_sample_count-first_index) {
+        sample_count = track_sample_count-first_index;
+    }
+    if (sample_count == 0) return arena.SetDataSize(0);
+
+    // get the samples
+    AP4_Result result = samples.SetItemCount(sample_count);
+    if (AP4_FAILED(result)) return result;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        result = GetSample(first_index+i, samples[i]);
+        if (AP4_FAILED(result)) {
+            samples.Clear();
+            return result;
+        }
+    }
+
+    // read the data
+    result = views.SetItemCount(sample_count);
+    if (AP4_FAILED(result)) return result;
+    result = AP4_Sample::ReadDataBatch(&samples[0], sample_count, arena, &views[0]);
+    if (AP4_FAILED(result)) {
+        samples.Clear();
+        views.Clear();
+    }
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Track::GetSampleIndexForTimeStampMs
 +---------------------------------------------------------------------*/
@@ -50,6 +50,7 @@ class AP4_TrakAtom;
 class AP4_MoovAtom;
 class AP4_SampleDescription;
 class AP4_SampleTable;
+struct AP4_SampleDataView;
 
 /*----------------------------------------------------------------------
 |   constants
@@ -123,6 +124,19 @@ class AP4_Track {
     AP4_Result   ReadSample(AP4_Ordinal     index,
                             AP4_Sample&     sample,
                             AP4_DataBuffer& data);
+    /**
+     * Read up to sample_count consecutive samples, starting at first_index.
+     * The data of all samples is placed in the arena, and views into it are
+     * returned in the same order as the samples. Samples stored next to each
+     * other in the file are read with a single I/O operation.
+     * On success, the samples and views arrays contain the same number of
+     * entries, which may be less than sample_count at the end of the track.
+     */
+    AP4_Result   ReadSamples(AP4_Ordinal                     first_index,
+                             AP4_Cardinal                    sample_count,
+                             AP4_Array<AP4_Sample>&          samples,
+                             AP4_DataBuffer&                 arena,
+                             AP4_Array<AP4_SampleDataView>&  views);
     AP4_Result   GetSampleIndexForTimeStampMs(AP4_UI32     ts_ms,
                                               AP4_Ordinal& index);
     AP4_Ordinal  GetNearestSyncSampleIndex(AP4_Ordinal index, bool before=true);
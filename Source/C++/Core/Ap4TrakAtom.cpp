@@ -340,6 +340,7 @@ AP4_TrakAtom::GetChunkOffsets(AP4_Array<AP4_UI64>& chunk_offsets)
         if (stco == NULL) return AP4_ERROR_INTERNAL;
         AP4_Cardinal    stco_chunk_count   = stco->GetChunkCount();
         const AP4_UI32* stco_chunk_offsets = stco->GetChunkOffsets();
+        if (stco_chunk_count && stco_chunk_offsets == NULL) return AP4_ERROR_INVALID_FORMAT;
         chunk_offsets.SetItemCount(stco_chunk_count);
         for (unsigned int i=0; i<stco_chunk_count; i++) {
             chunk_offsets[i] = stco_chunk_offsets[i];
@@ -350,6 +351,7 @@ AP4_TrakAtom::GetChunkOffsets(AP4_Array<AP4_UI64>& chunk_offsets)
         if (co64 == NULL) return AP4_ERROR_INTERNAL;
         AP4_Cardinal    co64_chunk_count   = co64->GetChunkCount();
         const AP4_UI64* co64_chunk_offsets = co64->GetChunkOffsets();
+        if (co64_chunk_count && co64_chunk_offsets == NULL) return AP4_ERROR_INVALID_FORMAT;
         chunk_offsets.SetItemCount(co64_chunk_count);
         for (unsigned int i=0; i<co64_chunk_count; i++) {
             chunk_offsets[i] = co64_chunk_offsets[i];
@@ -372,6 +374,7 @@ AP4_TrakAtom::SetChunkOffsets(const AP4_Array<AP4_UI64>& chunk_offsets)
         if (stco == NULL) return AP4_ERROR_INTERNAL;
         AP4_Cardinal stco_chunk_count   = stco->GetChunkCount();
         AP4_UI32*    stco_chunk_offsets = stco->GetChunkOffsets();
+        if (stco_chunk_count && stco_chunk_offsets == NULL) return AP4_ERROR_INVALID_FORMAT;
         if (stco_chunk_count > chunk_offsets.ItemCount()) {
             return AP4_ERROR_OUT_OF_RANGE;
         }
@@ -384,6 +387,7 @@ AP4_TrakAtom::SetChunkOffsets(const AP4_Array<AP4_UI64>& chunk_offsets)
         if (co64 == NULL) return AP4_ERROR_INTERNAL;
         AP4_Cardinal co64_chunk_count   = co64->GetChunkCount();
         AP4_UI64*    co64_chunk_offsets = co64->GetChunkOffsets();
+        if (co64_chunk_count && co64_chunk_offsets == NULL) return AP4_ERROR_INVALID_FORMAT;
         if (co64_chunk_count > chunk_offsets.ItemCount()) {
             return AP4_ERROR_OUT_OF_RANGE;
         }
@@ -41,14 +41,14 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_TrunAtom)
 |   AP4_TrunAtom::Create
 +---------------------------------------------------------------------*/
 AP4_TrunAtom*
-AP4_TrunAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_TrunAtom::Create(AP4_Size size, AP4_ByteStream& stream, AP4_Arena* arena)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (size < AP4_FULL_ATOM_HEADER_SIZE) return NULL;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version > 1) return NULL;
-    return new AP4_TrunAtom(size, version, flags, stream);
+    return new AP4_TrunAtom(size, version, flags, stream, arena);
 }
 
 /*----------------------------------------------------------------------
@@ -98,8 +98,10 @@ AP4_TrunAtom::AP4_TrunAtom(AP4_UI32 flags,
 AP4_TrunAtom::AP4_TrunAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_TRUN, size, version, flags)
+                           AP4_ByteStream& stream,
+                           AP4_Arena*      arena) :
+    AP4_Atom(AP4_ATOM_TYPE_TRUN, size, version, flags),
+    m_Entries(arena)
 {
     if (size < AP4_FULL_ATOM_HEADER_SIZE + 4) {
         return;
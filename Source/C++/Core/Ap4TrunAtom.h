@@ -63,7 +63,7 @@ public:
     };
     
     // class methods
-    static AP4_TrunAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_TrunAtom* Create(AP4_Size size, AP4_ByteStream& stream, AP4_Arena* arena = NULL);
     static unsigned int  ComputeOptionalFieldsCount(AP4_UI32 flags);
     static unsigned int  ComputeRecordFieldsCount(AP4_UI32 flags);
 
@@ -89,7 +89,8 @@ private:
     AP4_TrunAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 AP4_Arena*      arena);
 
     // members
     AP4_SI32         m_DataOffset;
@@ -32,6 +32,20 @@
 #include "Ap4Utils.h"
 #include "Ap4Debug.h"
 
+/*----------------------------------------------------------------------
+|   SIMD support
++---------------------------------------------------------------------*/
+#if !defined(AP4_CONFIG_NO_SIMD)
+#if (defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))) || \
+    (defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+#define AP4_RUNNING_TOTALS_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define AP4_RUNNING_TOTALS_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 /*----------------------------------------------------------------------
 |   AP4_GlobalOptions::g_Entry
 +---------------------------------------------------------------------*/
@@ -206,6 +220,98 @@ AP4_ConvertTime(AP4_UI64 time_value,
     return ((AP4_UI64)(0.5+(double)time_value*ratio));
 }
 
+/*----------------------------------------------------------------------
+|   AP4_ComputeRunningTotals
+|
+|   The SIMD kernels widen 4 values at a time to two pairs of 64-bit
+|   lanes, add each pair's first lane into its second lane, then add the
+|   total carried from the previous pair.
++---------------------------------------------------------------------*/
+void
+AP4_ComputeRunningTotals(const AP4_UI32* values, AP4_Cardinal count, AP4_UI64* totals)
+{
+    AP4_Cardinal i     = 0;
+    AP4_UI64     total = 0;
+    totals[0] = 0;
+#if defined(AP4_RUNNING_TOTALS_SSE2)
+    const __m128i zero  = _mm_setzero_si128();
+    __m128i       carry = zero;
+    for (; i+4 <= count; i += 4) {
+        __m128i v  = _mm_loadu_si128((const __m128i*)(values+i));
+        __m128i lo = _mm_unpacklo_epi32(v, zero);
+        __m128i hi = _mm_unpackhi_epi32(v, zero);
+        lo = _mm_add_epi64(_mm_add_epi64(lo, _mm_slli_si128(lo, 8)), carry);
+        carry = _mm_unpackhi_epi64(lo, lo);
+        hi = _mm_add_epi64(_mm_add_epi64(hi, _mm_slli_si128(hi, 8)), carry);
+        carry = _mm_unpackhi_epi64(hi, hi);
+        _mm_storeu_si128((__m128i*)(totals+i+1), lo);
+        _mm_storeu_si128((__m128i*)(totals+i+3), hi);
+    }
+    if (i) total = totals[i];
+#elif defined(AP4_RUNNING_TOTALS_NEON)
+    const uint64x2_t zero  = vdupq_n_u64(0);
+    uint64x2_t       carry = zero;
+    for (; i+4 <= count; i += 4) {
+        uint32x4_t v  = vld1q_u32(values+i);
+        uint64x2_t lo = vmovl_u32(vget_low_u32(v));
+        uint64x2_t hi = vmovl_u32(vget_high_u32(v));
+        lo = vaddq_u64(vaddq_u64(lo, vextq_u64(zero, lo, 1)), carry);
+        carry = vdupq_laneq_u64(lo, 1);
+        hi = vaddq_u64(vaddq_u64(hi, vextq_u64(zero, hi, 1)), carry);
+        carry = vdupq_laneq_u64(hi, 1);
+        vst1q_u64(totals+i+1, lo);
+        vst1q_u64(totals+i+3, hi);
+    }
+    if (i) total = totals[i];
+#endif
+    for (; i<count; i++) {
+        total += values[i];
+        totals[i+1] = total;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_RunningTotals::GetRangeTotal
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_RunningTotals::GetRangeTotal(const AP4_Array<AP4_UI32>& values,
+                                 AP4_Ordinal                first,
+                                 AP4_Cardinal               count)
+{
+    // short ranges are cheaper to add up directly
+    if (count <= MAX_DIRECT_RANGE_SIZE) {
+        AP4_UI64 total = 0;
+        for (AP4_Ordinal i=first; i<first+count; i++) {
+            total += values[i];
+        }
+        return total;
+    }
+
+    // longer ones use the running totals
+    if (!m_Ready.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (!m_Ready.load(std::memory_order_relaxed)) {
+            AP4_Cardinal value_count = values.ItemCount();
+            m_Totals.SetItemCount(value_count+1);
+            AP4_ComputeRunningTotals(value_count ? &values[0] : NULL, value_count, &m_Totals[0]);
+            m_Ready.store(true, std::memory_order_release);
+        }
+    }
+    return m_Totals[first+count]-m_Totals[first];
+}
+
+/*----------------------------------------------------------------------
+|   AP4_RunningTotals::Append
++---------------------------------------------------------------------*/
+void
+AP4_RunningTotals::Append(AP4_UI32 value)
+{
+    // keep the totals up to date if they have been computed already
+    if (m_Ready.load(std::memory_order_relaxed)) {
+        m_Totals.Append(m_Totals[m_Totals.ItemCount()-1]+value);
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_FormatFourChars
 +---------------------------------------------------------------------*/
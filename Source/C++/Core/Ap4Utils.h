@@ -39,6 +39,10 @@
 #include "Ap4List.h"
 #include "Ap4String.h"
 #include "Ap4DataBuffer.h"
+#include "Ap4Array.h"
+
+#include <atomic>
+#include <mutex>
 
 /*----------------------------------------------------------------------
 |   global options
@@ -165,6 +169,58 @@ AP4_UI64 AP4_ConvertTime(AP4_UI64 time_value,
                          AP4_UI32 from_time_scale,
                          AP4_UI32 to_time_scale);
 
+/*----------------------------------------------------------------------
+|   running totals
++---------------------------------------------------------------------*/
+/**
+ * Compute the running totals of count values: totals[0] is 0 and
+ * totals[i+1] is totals[i]+values[i], so totals must have room for
+ * count+1 items.
+ */
+void AP4_ComputeRunningTotals(const AP4_UI32* values,
+                              AP4_Cardinal    count,
+                              AP4_UI64*       totals);
+
+/**
+ * Running totals of an array of values, computed the first time a long
+ * range of the values is added up. Shorter ranges are added up directly.
+ * GetRangeTotal() may be called from several threads at once, but the
+ * values may only change while no other thread uses the object, followed
+ * by a call to Append() or Invalidate().
+ */
+class AP4_RunningTotals
+{
+public:
+    // ranges up to this many values are added up directly
+    static const AP4_Cardinal MAX_DIRECT_RANGE_SIZE = 16;
+
+    // constructor
+    AP4_RunningTotals() : m_Ready(false) {}
+
+    // methods
+    /**
+     * Get the sum of values[first..first+count-1]. The range must be
+     * within the array.
+     */
+    AP4_UI64 GetRangeTotal(const AP4_Array<AP4_UI32>& values,
+                           AP4_Ordinal                first,
+                           AP4_Cardinal               count);
+    /**
+     * Update the totals after a value was appended to the array.
+     */
+    void Append(AP4_UI32 value);
+    /**
+     * Discard the totals after a value of the array was changed.
+     */
+    void Invalidate() { m_Ready.store(false, std::memory_order_relaxed); }
+
+private:
+    // members
+    AP4_Array<AP4_UI64> m_Totals;
+    std::atomic<bool>   m_Ready;
+    std::mutex          m_Lock;
+};
+
 /*----------------------------------------------------------------------
 |   random numbers
 +---------------------------------------------------------------------*/
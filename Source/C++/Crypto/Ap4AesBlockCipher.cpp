@@ -41,6 +41,8 @@ Issue Date: 29/07/2002
 #include "Ap4Utils.h"
 #include "Ap4Config.h"
 
+#include <atomic>
+
 /*----------------------------------------------------------------------
 |   AES types
 +---------------------------------------------------------------------*/
@@ -51,6 +53,9 @@ struct aes_ctx                     // the AES context for encryption
 {   aes_32t    k_sch[4*AP4_AES_BLOCK_SIZE];   // the encryption key schedule
     aes_32t    n_rnd;              // the number of cipher rounds
     aes_32t    n_blk;              // the number of bytes in the state
+    aes_08t    hw_enc[15*16];      // round keys for the hardware encryption kernel
+    aes_08t    hw_dec[15*16];      // round keys for the hardware decryption kernel
+    bool       hw;                 // true when the hardware kernels can be used
 };
 #define aes_bad      0             // bad function return value
 #define aes_good     1             // good function return value
@@ -1829,6 +1834,257 @@ static aes_rval aes_dec_blk(const unsigned char in_blk[], unsigned char out_blk[
 
 #endif
 
+/*----------------------------------------------------------------------
+|   hardware AES kernels
+|
+|   The kernels below use the AES instructions of the CPU (AES-NI on x86,
+|   the ARMv8 Cryptography Extension on ARM) and are only used when the
+|   CPU reports support for them at runtime. They process several
+|   independent blocks at a time so that the latency of the AES rounds
+|   is hidden, which is what makes CTR and CBC decryption fast.
++---------------------------------------------------------------------*/
+#define AP4_AES_HW_PIPELINE_DEPTH 8
+
+#if !defined(AP4_CONFIG_NO_AES_HW)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AP4_AES_HW_X86
+#define AP4_AES_HW_TARGET __attribute__((target("aes,sse2")))
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define AP4_AES_HW_X86
+#define AP4_AES_HW_TARGET
+#include <intrin.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif (defined(__aarch64__) || defined(_M_ARM64) || defined(__arm__)) && \
+      (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define AP4_AES_HW_ARM
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+#endif
+
+#if defined(AP4_AES_HW_X86)
+/*----------------------------------------------------------------------
+|   aes_hw_detect
++---------------------------------------------------------------------*/
+static bool
+aes_hw_detect()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    unsigned int ecx = (unsigned int)info[2];
+    unsigned int edx = (unsigned int)info[3];
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+#endif
+    return (ecx & (1<<25)) && (edx & (1<<26)); // AES and SSE2
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_setup_dec
++---------------------------------------------------------------------*/
+AP4_AES_HW_TARGET static void
+aes_hw_setup_dec(aes_ctx* cx)
+{
+    // equivalent inverse cipher: reversed round keys, with InvMixColumns
+    // applied to all but the first and last one
+    unsigned int n = cx->n_rnd;
+    AP4_CopyMemory(&cx->hw_dec[0], &cx->hw_enc[16*n], 16);
+    for (unsigned int i=1; i<n; i++) {
+        __m128i k = _mm_loadu_si128((const __m128i*)&cx->hw_enc[16*(n-i)]);
+        _mm_storeu_si128((__m128i*)&cx->hw_dec[16*i], _mm_aesimc_si128(k));
+    }
+    AP4_CopyMemory(&cx->hw_dec[16*n], &cx->hw_enc[0], 16);
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_enc_blocks
++---------------------------------------------------------------------*/
+AP4_AES_HW_TARGET static void
+aes_hw_enc_blocks(const aes_ctx* cx, const AP4_UI08* in, AP4_UI08* out, unsigned int count)
+{
+    const __m128i* keys = (const __m128i*)cx->hw_enc;
+    unsigned int   n    = cx->n_rnd;
+    while (count) {
+        unsigned int batch = count < AP4_AES_HW_PIPELINE_DEPTH ? count : AP4_AES_HW_PIPELINE_DEPTH;
+        __m128i b[AP4_AES_HW_PIPELINE_DEPTH];
+        __m128i k = _mm_loadu_si128(&keys[0]);
+        for (unsigned int i=0; i<batch; i++) {
+            b[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in+16*i)), k);
+        }
+        for (unsigned int r=1; r<n; r++) {
+            k = _mm_loadu_si128(&keys[r]);
+            for (unsigned int i=0; i<batch; i++) b[i] = _mm_aesenc_si128(b[i], k);
+        }
+        k = _mm_loadu_si128(&keys[n]);
+        for (unsigned int i=0; i<batch; i++) {
+            _mm_storeu_si128((__m128i*)(out+16*i), _mm_aesenclast_si128(b[i], k));
+        }
+        in    += 16*batch;
+        out   += 16*batch;
+        count -= batch;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_dec_blocks
++---------------------------------------------------------------------*/
+AP4_AES_HW_TARGET static void
+aes_hw_dec_blocks(const aes_ctx* cx, const AP4_UI08* in, AP4_UI08* out, unsigned int count)
+{
+    const __m128i* keys = (const __m128i*)cx->hw_dec;
+    unsigned int   n    = cx->n_rnd;
+    while (count) {
+        unsigned int batch = count < AP4_AES_HW_PIPELINE_DEPTH ? count : AP4_AES_HW_PIPELINE_DEPTH;
+        __m128i b[AP4_AES_HW_PIPELINE_DEPTH];
+        __m128i k = _mm_loadu_si128(&keys[0]);
+        for (unsigned int i=0; i<batch; i++) {
+            b[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in+16*i)), k);
+        }
+        for (unsigned int r=1; r<n; r++) {
+            k = _mm_loadu_si128(&keys[r]);
+            for (unsigned int i=0; i<batch; i++) b[i] = _mm_aesdec_si128(b[i], k);
+        }
+        k = _mm_loadu_si128(&keys[n]);
+        for (unsigned int i=0; i<batch; i++) {
+            _mm_storeu_si128((__m128i*)(out+16*i), _mm_aesdeclast_si128(b[i], k));
+        }
+        in    += 16*batch;
+        out   += 16*batch;
+        count -= batch;
+    }
+}
+#endif // AP4_AES_HW_X86
+
+#if defined(AP4_AES_HW_ARM)
+/*----------------------------------------------------------------------
+|   aes_hw_detect
++---------------------------------------------------------------------*/
+static bool
+aes_hw_detect()
+{
+#if defined(__linux__) && defined(__aarch64__) && defined(HWCAP_AES)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__linux__) && defined(__arm__) && defined(HWCAP2_AES)
+    return (getauxval(AT_HWCAP2) & HWCAP2_AES) != 0;
+#else
+    // the compiler was told that the target has the extension
+    return true;
+#endif
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_setup_dec
++---------------------------------------------------------------------*/
+static void
+aes_hw_setup_dec(aes_ctx* cx)
+{
+    unsigned int n = cx->n_rnd;
+    AP4_CopyMemory(&cx->hw_dec[0], &cx->hw_enc[16*n], 16);
+    for (unsigned int i=1; i<n; i++) {
+        vst1q_u8(&cx->hw_dec[16*i], vaesimcq_u8(vld1q_u8(&cx->hw_enc[16*(n-i)])));
+    }
+    AP4_CopyMemory(&cx->hw_dec[16*n], &cx->hw_enc[0], 16);
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_enc_blocks
++---------------------------------------------------------------------*/
+static void
+aes_hw_enc_blocks(const aes_ctx* cx, const AP4_UI08* in, AP4_UI08* out, unsigned int count)
+{
+    unsigned int n = cx->n_rnd;
+    while (count) {
+        unsigned int batch = count < AP4_AES_HW_PIPELINE_DEPTH ? count : AP4_AES_HW_PIPELINE_DEPTH;
+        uint8x16_t b[AP4_AES_HW_PIPELINE_DEPTH];
+        for (unsigned int i=0; i<batch; i++) b[i] = vld1q_u8(in+16*i);
+        for (unsigned int r=0; r<n-1; r++) {
+            uint8x16_t k = vld1q_u8(&cx->hw_enc[16*r]);
+            for (unsigned int i=0; i<batch; i++) b[i] = vaesmcq_u8(vaeseq_u8(b[i], k));
+        }
+        uint8x16_t k  = vld1q_u8(&cx->hw_enc[16*(n-1)]);
+        uint8x16_t kl = vld1q_u8(&cx->hw_enc[16*n]);
+        for (unsigned int i=0; i<batch; i++) {
+            vst1q_u8(out+16*i, veorq_u8(vaeseq_u8(b[i], k), kl));
+        }
+        in    += 16*batch;
+        out   += 16*batch;
+        count -= batch;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   aes_hw_dec_blocks
++---------------------------------------------------------------------*/
+static void
+aes_hw_dec_blocks(const aes_ctx* cx, const AP4_UI08* in, AP4_UI08* out, unsigned int count)
+{
+    unsigned int n = cx->n_rnd;
+    while (count) {
+        unsigned int batch = count < AP4_AES_HW_PIPELINE_DEPTH ? count : AP4_AES_HW_PIPELINE_DEPTH;
+        uint8x16_t b[AP4_AES_HW_PIPELINE_DEPTH];
+        for (unsigned int i=0; i<batch; i++) b[i] = vld1q_u8(in+16*i);
+        for (unsigned int r=0; r<n-1; r++) {
+            uint8x16_t k = vld1q_u8(&cx->hw_dec[16*r]);
+            for (unsigned int i=0; i<batch; i++) b[i] = vaesimcq_u8(vaesdq_u8(b[i], k));
+        }
+        uint8x16_t k  = vld1q_u8(&cx->hw_dec[16*(n-1)]);
+        uint8x16_t kl = vld1q_u8(&cx->hw_dec[16*n]);
+        for (unsigned int i=0; i<batch; i++) {
+            vst1q_u8(out+16*i, veorq_u8(vaesdq_u8(b[i], k), kl));
+        }
+        in    += 16*batch;
+        out   += 16*batch;
+        count -= batch;
+    }
+}
+#endif // AP4_AES_HW_ARM
+
+#if defined(AP4_AES_HW_X86) || defined(AP4_AES_HW_ARM)
+#define AP4_AES_HW
+#endif
+
+/*----------------------------------------------------------------------
+|   globals
++---------------------------------------------------------------------*/
+#if defined(AP4_AES_HW)
+static const bool AP4_AesHardwareAvailable = aes_hw_detect();
+#else
+static const bool AP4_AesHardwareAvailable = false;
+#endif
+// ciphers may be created on several threads while this is changed
+static std::atomic<bool> AP4_AesHardwareEnabled(true);
+
+/*----------------------------------------------------------------------
+|   aes_hw_setup
++---------------------------------------------------------------------*/
+static void
+aes_hw_setup(const unsigned char key[], aes_ctx* cx)
+{
+    cx->hw = false;
+#if defined(AP4_AES_HW)
+    if (!AP4_AesHardwareAvailable || !AP4_AesHardwareEnabled.load(std::memory_order_relaxed)) return;
+
+    // the hardware kernels use the standard round keys, which is the
+    // byte layout of the portable encryption key schedule
+    aes_ctx enc;
+    aes_enc_key(key, AP4_AES_KEY_LENGTH, &enc);
+    AP4_CopyMemory(cx->hw_enc, enc.k_sch, 16*(enc.n_rnd+1));
+    aes_hw_setup_dec(cx);
+    cx->hw = true;
+#else
+    (void)key;
+#endif
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesCbcBlockCipher
 +---------------------------------------------------------------------*/
@@ -1870,12 +2126,40 @@ AP4_AesCbcBlockCipher::Process(const AP4_UI08* input,
 
     // process all blocks
     unsigned int block_count = input_size/AP4_AES_BLOCK_SIZE;
+#if defined(AP4_AES_HW)
+    if (m_Context->hw && m_Direction == DECRYPT) {
+        // blocks are independent when decrypting, so they can be pipelined.
+        // the ciphertext is copied first because output may alias input
+        while (block_count) {
+            unsigned int batch = block_count < AP4_AES_HW_PIPELINE_DEPTH ? block_count : AP4_AES_HW_PIPELINE_DEPTH;
+            AP4_UI08 ciphertext[AP4_AES_HW_PIPELINE_DEPTH*AP4_AES_BLOCK_SIZE];
+            AP4_CopyMemory(ciphertext, input, batch*AP4_AES_BLOCK_SIZE);
+            aes_hw_dec_blocks(m_Context, ciphertext, output, batch);
+            for (unsigned int j=0; j<AP4_AES_BLOCK_SIZE; j++) {
+                output[j] ^= chaining_block[j];
+            }
+            for (unsigned int j=AP4_AES_BLOCK_SIZE; j<batch*AP4_AES_BLOCK_SIZE; j++) {
+                output[j] ^= ciphertext[j-AP4_AES_BLOCK_SIZE];
+            }
+            AP4_CopyMemory(chaining_block, &ciphertext[(batch-1)*AP4_AES_BLOCK_SIZE], AP4_AES_BLOCK_SIZE);
+            input       += batch*AP4_AES_BLOCK_SIZE;
+            output      += batch*AP4_AES_BLOCK_SIZE;
+            block_count -= batch;
+        }
+        return AP4_SUCCESS;
+    }
+#endif
     if (m_Direction == ENCRYPT) {
         for (unsigned int i=0; i<block_count; i++) {
             AP4_UI08 block[AP4_AES_BLOCK_SIZE];
             for (unsigned int j=0; j<AP4_AES_BLOCK_SIZE; j++) {
                 block[j] = input[j] ^ chaining_block[j];
             }
+#if defined(AP4_AES_HW)
+            if (m_Context->hw) {
+                aes_hw_enc_blocks(m_Context, block, output, 1);
+            } else
+#endif
             aes_enc_blk(block, output, m_Context);
             AP4_CopyMemory(chaining_block, output, AP4_AES_BLOCK_SIZE);
             input  += AP4_AES_BLOCK_SIZE;
@@ -1935,6 +2219,35 @@ AP4_AesCtrBlockCipher::Process(const AP4_UI08* input,
         AP4_SetMemory(counter, 0, AP4_AES_BLOCK_SIZE);
     }
 
+#if defined(AP4_AES_HW)
+    if (m_Context->hw) {
+        // encrypt a batch of consecutive counter values at once
+        while (input_size) {
+            AP4_UI08 counters[AP4_AES_HW_PIPELINE_DEPTH*AP4_AES_BLOCK_SIZE];
+            AP4_UI08 key_stream[AP4_AES_HW_PIPELINE_DEPTH*AP4_AES_BLOCK_SIZE];
+            unsigned int batch = 0;
+            AP4_Size     chunk = 0;
+            while (batch < AP4_AES_HW_PIPELINE_DEPTH && chunk < input_size) {
+                AP4_CopyMemory(&counters[batch*AP4_AES_BLOCK_SIZE], counter, AP4_AES_BLOCK_SIZE);
+                ++batch;
+                chunk += AP4_AES_BLOCK_SIZE;
+                for (int x=AP4_AES_BLOCK_SIZE-1; x; --x) {
+                    if (++counter[x]) break;
+                }
+            }
+            if (chunk > input_size) chunk = input_size;
+            aes_hw_enc_blocks(m_Context, counters, key_stream, batch);
+            for (unsigned int j=0; j<chunk; j++) {
+                output[j] = input[j]^key_stream[j];
+            }
+            input      += chunk;
+            output     += chunk;
+            input_size -= chunk;
+        }
+        return AP4_SUCCESS;
+    }
+#endif
+
     // process all blocks
     while (input_size) {
         AP4_UI08 block[AP4_AES_BLOCK_SIZE];
@@ -1985,11 +2298,13 @@ AP4_AesBlockCipher::Create(const AP4_UI08*      key,
             } else {
                 aes_dec_key(key, AP4_AES_KEY_LENGTH, context);
             }
+            aes_hw_setup(key, context);
             cipher = new AP4_AesCbcBlockCipher(direction, context);
             break;
 
         case AP4_BlockCipher::CTR: {
             aes_enc_key(key, AP4_AES_KEY_LENGTH, context);
+            aes_hw_setup(key, context);
             const AP4_BlockCipher::CtrParams* ctr_params = (const AP4_BlockCipher::CtrParams*)mode_params;
             unsigned int counter_size = 16;
             if (ctr_params) {
@@ -2006,6 +2321,24 @@ AP4_AesBlockCipher::Create(const AP4_UI08*      key,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_AesBlockCipher::IsHardwareAccelerationAvailable
++---------------------------------------------------------------------*/
+bool
+AP4_AesBlockCipher::IsHardwareAccelerationAvailable()
+{
+    return AP4_AesHardwareAvailable;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AesBlockCipher::EnableHardwareAcceleration
++---------------------------------------------------------------------*/
+void
+AP4_AesBlockCipher::EnableHardwareAcceleration(bool enable)
+{
+    AP4_AesHardwareEnabled.store(enable, std::memory_order_relaxed);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesBlockCipher::~AP4_AesBlockCipher
 +---------------------------------------------------------------------*/
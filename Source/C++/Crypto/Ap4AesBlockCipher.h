@@ -38,6 +38,12 @@ public:
                              AP4_AesBlockCipher*& cipher);
     virtual ~AP4_AesBlockCipher();
 
+    // hardware acceleration (AES-NI, ARMv8 Cryptography Extension)
+    // is used automatically when the CPU supports it. Disabling it only
+    // affects ciphers created afterwards.
+    static bool IsHardwareAccelerationAvailable();
+    static void EnableHardwareAcceleration(bool enable);
+
     virtual CipherDirection GetDirection() { return m_Direction; }
     
 protected:
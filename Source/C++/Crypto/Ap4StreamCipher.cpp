@@ -32,6 +32,83 @@
 #include "Ap4StreamCipher.h"
 #include "Ap4Utils.h"
 
+/*----------------------------------------------------------------------
+|   AP4_StreamCipher::ProcessSubSamples
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StreamCipher::ProcessSubSamples(const AP4_UI08* in,
+                                    AP4_UI08*       out,
+                                    unsigned int    subsample_count,
+                                    const AP4_UI16* bytes_of_cleartext_data,
+                                    const AP4_UI32* bytes_of_encrypted_data,
+                                    AP4_DataBuffer& scratch)
+{
+    // count the encrypted bytes
+    AP4_Size     encrypted_total  = 0;
+    unsigned int encrypted_ranges = 0;
+    bool         aligned          = true;
+    for (unsigned int i=0; i<subsample_count; i++) {
+        if (bytes_of_encrypted_data[i]) {
+            encrypted_total += bytes_of_encrypted_data[i];
+            ++encrypted_ranges;
+            if (bytes_of_encrypted_data[i]%AP4_CIPHER_BLOCK_SIZE) aligned = false;
+        }
+    }
+
+    // with a single encrypted range there is nothing to gather, and
+    // unaligned ranges can only be joined if the cipher says so (a
+    // pattern cipher, for example, would shift its pattern)
+    if (encrypted_ranges <= 1 || (!aligned && !CanJoinUnalignedBuffers())) {
+        for (unsigned int i=0; i<subsample_count; i++) {
+            AP4_CopyMemory(out, in, bytes_of_cleartext_data[i]);
+            in  += bytes_of_cleartext_data[i];
+            out += bytes_of_cleartext_data[i];
+            if (bytes_of_encrypted_data[i]) {
+                AP4_Size out_size = bytes_of_encrypted_data[i];
+                AP4_Result result = ProcessBuffer(in, bytes_of_encrypted_data[i], out, &out_size, false);
+                if (AP4_FAILED(result)) return result;
+                if (out_size != bytes_of_encrypted_data[i]) return AP4_ERROR_INVALID_FORMAT;
+                in  += bytes_of_encrypted_data[i];
+                out += bytes_of_encrypted_data[i];
+            }
+        }
+        return AP4_SUCCESS;
+    }
+
+    // gather the encrypted ranges, copying the cleartext ranges on the way
+    AP4_Result result = scratch.SetDataSize(2*encrypted_total);
+    if (AP4_FAILED(result)) return result;
+    AP4_UI08* gathered  = scratch.UseData();
+    AP4_UI08* processed = gathered+encrypted_total;
+    AP4_UI08* cursor    = gathered;
+    const AP4_UI08* ranges_in  = in;
+    AP4_UI08*       ranges_out = out;
+    for (unsigned int i=0; i<subsample_count; i++) {
+        AP4_CopyMemory(ranges_out, ranges_in, bytes_of_cleartext_data[i]);
+        ranges_in  += bytes_of_cleartext_data[i];
+        ranges_out += bytes_of_cleartext_data[i]+bytes_of_encrypted_data[i];
+        AP4_CopyMemory(cursor, ranges_in, bytes_of_encrypted_data[i]);
+        ranges_in += bytes_of_encrypted_data[i];
+        cursor    += bytes_of_encrypted_data[i];
+    }
+
+    // process all the encrypted bytes at once
+    AP4_Size out_size = encrypted_total;
+    result = ProcessBuffer(gathered, encrypted_total, processed, &out_size, false);
+    if (AP4_FAILED(result)) return result;
+    if (out_size != encrypted_total) return AP4_ERROR_INVALID_FORMAT;
+
+    // scatter the result back
+    for (unsigned int i=0; i<subsample_count; i++) {
+        out += bytes_of_cleartext_data[i];
+        AP4_CopyMemory(out, processed, bytes_of_encrypted_data[i]);
+        out       += bytes_of_encrypted_data[i];
+        processed += bytes_of_encrypted_data[i];
+    }
+
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CtrStreamCipher::AP4_CtrStreamCipher
 +---------------------------------------------------------------------*/
@@ -551,6 +628,36 @@ AP4_PatternStreamCipher::SetStreamOffset(AP4_UI64      /*offset*/,
     return AP4_ERROR_NOT_SUPPORTED;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_PatternStreamCipher::GetRun
++---------------------------------------------------------------------*/
+void
+AP4_PatternStreamCipher::GetRun(unsigned int pattern_position,
+                                AP4_Size     remain,
+                                AP4_Size&    crypt_size,
+                                AP4_Size&    skip_size)
+{
+    unsigned int pattern_span = m_CryptByteBlock+m_SkipByteBlock;
+    crypt_size = 0;
+    skip_size  = m_SkipByteBlock*16;
+    if (pattern_position < m_CryptByteBlock) {
+        // in the encrypted part
+        crypt_size = (m_CryptByteBlock-pattern_position)*16;
+    } else {
+        // in the skipped part
+        skip_size = (pattern_span-pattern_position)*16;
+    }
+    
+    // clip
+    if (crypt_size > remain) {
+        crypt_size = 16*(remain/16);
+        skip_size  = remain-crypt_size;
+    }
+    if (crypt_size+skip_size > remain) {
+        skip_size = remain-crypt_size;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_PatternStreamCipher
 +---------------------------------------------------------------------*/
@@ -572,57 +679,75 @@ AP4_PatternStreamCipher::ProcessBuffer(const AP4_UI08* in,
     unsigned int block_position   = (unsigned int)(m_StreamOffset/16);
     unsigned int pattern_position = block_position % pattern_span;
 
-    // process the range
-    while (*out_size < in_size) {
-        unsigned int crypt_size = 0;
-        unsigned int skip_size  = m_SkipByteBlock*16;
-        if (pattern_position < m_CryptByteBlock) {
-            // in the encrypted part
-            crypt_size = (m_CryptByteBlock-pattern_position)*16;
-        } else {
-            // in the skipped part
-            skip_size = (pattern_span-pattern_position)*16;
+    // measure the crypt runs, so that they can be gathered and passed to
+    // the cipher in one call rather than one call per pattern
+    AP4_Size     crypt_total = 0;
+    unsigned int crypt_runs  = 0;
+    for (AP4_Size offset=0, position=pattern_position; offset < in_size; position=0) {
+        AP4_Size crypt_size, skip_size;
+        GetRun(position, in_size-offset, crypt_size, skip_size);
+        if (crypt_size) {
+            crypt_total += crypt_size;
+            ++crypt_runs;
         }
-        
-        // clip
-        AP4_Size remain = in_size-*out_size;
-        if (crypt_size > remain) {
-            crypt_size = 16*(remain/16);
-            skip_size  = remain-crypt_size;
+        offset += crypt_size+skip_size;
+    }
+    
+    // gather the crypt runs, and copy the skipped runs through
+    AP4_UI08* gathered = NULL;
+    if (crypt_runs > 1) {
+        AP4_Result result = m_CryptBlocks.SetDataSize(2*crypt_total);
+        if (AP4_FAILED(result)) return result;
+        gathered = m_CryptBlocks.UseData();
+        const AP4_UI08* run_in = in;
+        AP4_UI08*       cursor = gathered;
+        for (AP4_Size offset=0, position=pattern_position; offset < in_size; position=0) {
+            AP4_Size crypt_size, skip_size;
+            GetRun(position, in_size-offset, crypt_size, skip_size);
+            AP4_CopyMemory(cursor, run_in, crypt_size);
+            AP4_CopyMemory(out+offset+crypt_size, run_in+crypt_size, skip_size);
+            cursor += crypt_size;
+            run_in += crypt_size+skip_size;
+            offset += crypt_size+skip_size;
         }
-        if (crypt_size+skip_size > remain) {
-            skip_size = remain-crypt_size;
+    }
+
+    // process the crypt runs
+    if (crypt_total) {
+        AP4_Size in_chunk_size  = crypt_total;
+        AP4_Size out_chunk_size = crypt_total;
+        AP4_Result result;
+        if (gathered) {
+            result = m_Cipher->ProcessBuffer(gathered, in_chunk_size, gathered+crypt_total, &out_chunk_size);
+        } else {
+            // a single run, process it in place
+            AP4_Size skip_size = pattern_position < m_CryptByteBlock ? 0 : (pattern_span-pattern_position)*16;
+            if (skip_size > in_size) skip_size = in_size;
+            result = m_Cipher->ProcessBuffer(in+skip_size, in_chunk_size, out+skip_size, &out_chunk_size);
         }
-        
-        // encrypted part
-        if (crypt_size) {
-            AP4_Size in_chunk_size  = crypt_size;
-            AP4_Size out_chunk_size = crypt_size;
-            
-            AP4_Result result = m_Cipher->ProcessBuffer(in, in_chunk_size, out, &out_chunk_size);
-            if (AP4_FAILED(result)) return result;
-            // check that we got back what we expectected
-            if (out_chunk_size != in_chunk_size) {
-                return AP4_ERROR_INTERNAL;
-            }
-            in             += crypt_size;
-            out            += crypt_size;
-            *out_size      += crypt_size;
-            m_StreamOffset += crypt_size;
+        if (AP4_FAILED(result)) return result;
+        // check that we got back what we expectected
+        if (out_chunk_size != in_chunk_size) {
+            return AP4_ERROR_INTERNAL;
         }
-        
-        // skipped part
-        if (skip_size) {
-            AP4_CopyMemory(out, in, skip_size);
-            in             += skip_size;
-            out            += skip_size;
-            *out_size      += skip_size;
-            m_StreamOffset += skip_size;
+    }
+    
+    // scatter the processed runs back, or copy the skipped runs around
+    // the single run that was processed in place
+    const AP4_UI08* processed = gathered ? gathered+crypt_total : NULL;
+    for (AP4_Size offset=0, position=pattern_position; offset < in_size; position=0) {
+        AP4_Size crypt_size, skip_size;
+        GetRun(position, in_size-offset, crypt_size, skip_size);
+        if (processed) {
+            AP4_CopyMemory(out+offset, processed, crypt_size);
+            processed += crypt_size;
+        } else {
+            AP4_CopyMemory(out+offset+crypt_size, in+offset+crypt_size, skip_size);
         }
-        
-        // we're now at the start of a new pattern
-        pattern_position = 0;
+        offset += crypt_size+skip_size;
     }
+    *out_size      = in_size;
+    m_StreamOffset += in_size;
 
     return AP4_SUCCESS;
 }
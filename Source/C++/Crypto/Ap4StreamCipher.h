@@ -35,6 +35,7 @@
 #include "Ap4Protection.h"
 #include "Ap4Results.h"
 #include "Ap4Types.h"
+#include "Ap4DataBuffer.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -67,6 +68,30 @@ public:
     
     virtual AP4_Result SetIV(const AP4_UI08* iv) = 0;
     virtual const AP4_UI08* GetIV() = 0;
+
+    /**
+     * Returns true if processing two buffers one after the other gives
+     * the same output as processing their concatenation, even when the
+     * first buffer does not end on a block boundary.
+     */
+    virtual bool CanJoinUnalignedBuffers() { return false; }
+
+    /**
+     * Process a whole subsample map, copying the cleartext ranges from
+     * in to out and running the encrypted ranges through the cipher.
+     * The result is always the same as calling ProcessBuffer once per
+     * encrypted range without resetting the cipher state in between.
+     * When that is equivalent to a single call (all the encrypted ranges
+     * are block aligned, or the cipher can join unaligned buffers), the
+     * ranges are gathered in the scratch buffer so that the cipher can
+     * run them through its multi-block pipeline in one pass.
+     */
+    AP4_Result ProcessSubSamples(const AP4_UI08* in,
+                                 AP4_UI08*       out,
+                                 unsigned int    subsample_count,
+                                 const AP4_UI16* bytes_of_cleartext_data,
+                                 const AP4_UI32* bytes_of_encrypted_data,
+                                 AP4_DataBuffer& scratch);
 };
 
 
@@ -98,6 +123,7 @@ public:
     
     virtual AP4_Result      SetIV(const AP4_UI08* iv);
     virtual const AP4_UI08* GetIV()  { return m_IV; }
+    virtual bool            CanJoinUnalignedBuffers() { return true; }
 
 private:
     // methods
@@ -193,11 +219,18 @@ public:
     virtual const AP4_UI08* GetIV();
 
 private:
+    // methods
+    void GetRun(unsigned int pattern_position,
+                AP4_Size     remain,
+                AP4_Size&    crypt_size,
+                AP4_Size&    skip_size);
+
     // members
     AP4_StreamCipher* m_Cipher;
     AP4_UI08          m_CryptByteBlock;
     AP4_UI08          m_SkipByteBlock;
     AP4_UI64          m_StreamOffset;
+    AP4_DataBuffer    m_CryptBlocks;
 };
 
 #endif // _AP4_STREAM_CIPHER_H_
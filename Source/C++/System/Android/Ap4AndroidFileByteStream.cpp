@@ -111,6 +111,7 @@ AP4_AndroidFileByteStream::Create(AP4_FileByteStream*      delegator,
         int create_perm = 0;
         switch (mode) {
           case AP4_FileByteStream::STREAM_MODE_READ:
+          case AP4_FileByteStream::STREAM_MODE_READ_MAPPED: // plain reads
             open_flags = O_RDONLY;
             break;
 
@@ -46,6 +46,18 @@
 #include <fcntl.h>
 #endif
 #include "Ap4FileByteStream.h"
+#include "Ap4Utils.h"
+
+#if defined(AP4_CONFIG_HAVE_MMAP)
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(AP4_CONFIG_HAVE_PREAD)
+#include <unistd.h>
+#endif
 
 #include <memory>
 
@@ -180,7 +192,8 @@ public:
     // methods
     AP4_StdcFileByteStream(AP4_FileByteStream* delegator,
                            FILE*               file, 
-                           AP4_LargeSize       size);
+                           AP4_LargeSize       size,
+                           bool                read_only = false);
     
     ~AP4_StdcFileByteStream();
 
@@ -195,6 +208,9 @@ public:
     AP4_Result Tell(AP4_Position& position);
     AP4_Result GetSize(AP4_LargeSize& size);
     AP4_Result Flush();
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
 
     // AP4_Referenceable methods
     void AddReference();
@@ -207,6 +223,7 @@ private:
     FILE*           m_File;
     AP4_Position    m_Position;
     AP4_LargeSize   m_Size;
+    bool            m_ReadOnly;
 };
 
 /*----------------------------------------------------------------------
@@ -227,6 +244,7 @@ AP4_StdcFileByteStream::Create(AP4_FileByteStream*              delegator,
     // open the file
     FILE* file = NULL;
     AP4_Position size = 0;
+    bool read_only = false;
     if (!strcmp(name, "-stdin") || !strcmp(name, "-stdin#")) {
         file = stdin;
 #if defined(_WIN32)
@@ -247,7 +265,9 @@ AP4_StdcFileByteStream::Create(AP4_FileByteStream*              delegator,
         int open_result;
         switch (mode) {
           case AP4_FileByteStream::STREAM_MODE_READ:
+          case AP4_FileByteStream::STREAM_MODE_READ_MAPPED:
             open_result = fopen_s(&file, name, "rb");
+            read_only = true;
             break;
 
           case AP4_FileByteStream::STREAM_MODE_WRITE:
@@ -280,7 +300,7 @@ AP4_StdcFileByteStream::Create(AP4_FileByteStream*              delegator,
         
     }
 
-    stream = std::make_shared<AP4_StdcFileByteStream>(delegator, file, size);
+    stream = std::make_shared<AP4_StdcFileByteStream>(delegator, file, size, read_only);
     return AP4_SUCCESS;
 }
 
@@ -289,12 +309,14 @@ AP4_StdcFileByteStream::Create(AP4_FileByteStream*              delegator,
 +---------------------------------------------------------------------*/
 AP4_StdcFileByteStream::AP4_StdcFileByteStream(AP4_FileByteStream* delegator,
                                                FILE*               file,
-                                               AP4_LargeSize       size) :
+                                               AP4_LargeSize       size,
+                                               bool                read_only) :
     m_Delegator(delegator),
     m_ReferenceCount(1),
     m_File(file),
     m_Position(0),
-    m_Size(size)
+    m_Size(size),
+    m_ReadOnly(read_only)
 {
 }
 
@@ -432,6 +454,266 @@ AP4_StdcFileByteStream::Flush()
     return (ret_val > 0) ? AP4_FAILURE: AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StdcFileByteStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StdcFileByteStream::ReadAt(AP4_Position position,
+                               void*        buffer,
+                               AP4_Size     bytes_to_read)
+{
+#if defined(AP4_CONFIG_HAVE_PREAD)
+    // files opened for reading only can bypass the stdio buffer, since
+    // there can't be any unflushed writes in it
+    if (m_ReadOnly) {
+        int fd = fileno(m_File);
+        while (bytes_to_read) {
+            ssize_t nbRead = pread(fd, buffer, bytes_to_read, (off_t)position);
+            if (nbRead < 0) {
+                if (errno == EINTR) continue;
+                return AP4_ERROR_READ_FAILED;
+            }
+            if (nbRead == 0) return AP4_ERROR_EOS;
+            bytes_to_read -= (AP4_Size)nbRead;
+            position      += (AP4_Position)nbRead;
+            buffer = (void*)(((AP4_UI08*)buffer)+nbRead);
+        }
+        return AP4_SUCCESS;
+    }
+#endif
+
+    return AP4_ByteStream::ReadAt(position, buffer, bytes_to_read);
+}
+
+#if defined(AP4_CONFIG_HAVE_MMAP)
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream
++---------------------------------------------------------------------*/
+class AP4_MappedFileByteStream: public AP4_ByteStream
+{
+public:
+    // class methods
+    static AP4_Result Create(const char*                      name,
+                             std::shared_ptr<AP4_ByteStream>& stream);
+
+    // methods
+    AP4_MappedFileByteStream(const AP4_UI08* data, AP4_LargeSize size);
+    ~AP4_MappedFileByteStream();
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer, 
+                           AP4_Size  bytesToRead, 
+                           AP4_Size& bytesRead);
+    AP4_Result WritePartial(const void* buffer, 
+                            AP4_Size    bytesToWrite, 
+                            AP4_Size&   bytesWritten);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position);
+    AP4_Result GetSize(AP4_LargeSize& size);
+    AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
+    AP4_Result GetDataView(AP4_Position     position,
+                           AP4_Size         size,
+                           const AP4_UI08*& data);
+    AP4_Result ReadAt(AP4_Position position,
+                      void*        buffer,
+                      AP4_Size     bytes_to_read);
+
+private:
+    // members
+    const AP4_UI08* m_Data;
+    AP4_LargeSize   m_Size;
+    AP4_Position    m_Position;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::Create
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::Create(const char*                      name,
+                                 std::shared_ptr<AP4_ByteStream>& stream)
+{
+    // default value
+    stream = NULL;
+
+    // open the file
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return AP4_ERROR_NO_SUCH_FILE;
+        } else if (errno == EACCES) {
+            return AP4_ERROR_PERMISSION_DENIED;
+        } else {
+            return AP4_ERROR_CANNOT_OPEN_FILE;
+        }
+    }
+
+    // only regular files can be mapped
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+
+    // map the whole file (empty files can't be mapped, but don't need to be),
+    // provided that it fits in the address space
+    AP4_LargeSize size = (AP4_LargeSize)info.st_size;
+    if (size > (AP4_LargeSize)SIZE_MAX) {
+        close(fd);
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    void* data = NULL;
+    if (size) {
+        data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return AP4_ERROR_NOT_SUPPORTED;
+        }
+    }
+
+    // the mapping remains valid after the file is closed
+    close(fd);
+
+    stream = std::make_shared<AP4_MappedFileByteStream>((const AP4_UI08*)data, size);
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::AP4_MappedFileByteStream
++---------------------------------------------------------------------*/
+AP4_MappedFileByteStream::AP4_MappedFileByteStream(const AP4_UI08* data,
+                                                   AP4_LargeSize   size) :
+    m_Data(data),
+    m_Size(size),
+    m_Position(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::~AP4_MappedFileByteStream
++---------------------------------------------------------------------*/
+AP4_MappedFileByteStream::~AP4_MappedFileByteStream()
+{
+    if (m_Data) {
+        munmap((void*)m_Data, (size_t)m_Size);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::ReadPartial(void*     buffer, 
+                                      AP4_Size  bytesToRead, 
+                                      AP4_Size& bytesRead)
+{
+    // check for end of stream
+    if (m_Position >= m_Size) {
+        bytesRead = 0;
+        return AP4_ERROR_EOS;
+    }
+
+    // clamp to the end of the stream
+    if (m_Position+bytesToRead > m_Size) {
+        bytesToRead = (AP4_Size)(m_Size-m_Position);
+    }
+    AP4_CopyMemory(buffer, m_Data+m_Position, bytesToRead);
+    m_Position += bytesToRead;
+    bytesRead = bytesToRead;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::WritePartial(const void* /* buffer */, 
+                                       AP4_Size    /* bytesToWrite */, 
+                                       AP4_Size&   bytesWritten)
+{
+    // this stream is read-only
+    bytesWritten = 0;
+    return AP4_ERROR_WRITE_FAILED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::Seek(AP4_Position position)
+{
+    if (position > m_Size) return AP4_FAILURE;
+    m_Position = position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::Tell
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::Tell(AP4_Position& position)
+{
+    position = m_Position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::GetSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::GetSize(AP4_LargeSize& size)
+{
+    size = m_Size;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::CopyTo
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::CopyTo(AP4_ByteStream& stream, AP4_LargeSize size)
+{
+    // write directly from the mapping, without an intermediate buffer
+    if (m_Position+size > m_Size) return AP4_ERROR_EOS;
+    while (size) {
+        AP4_Size chunk = size > 0x40000000 ? 0x40000000 : (AP4_Size)size;
+        AP4_Result result = stream.Write(m_Data+m_Position, chunk);
+        if (AP4_FAILED(result)) return result;
+        m_Position += chunk;
+        size       -= chunk;
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::GetDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::GetDataView(AP4_Position     position,
+                                      AP4_Size         size,
+                                      const AP4_UI08*& data)
+{
+    data = NULL;
+    if (position+size > m_Size) return AP4_ERROR_OUT_OF_RANGE;
+    data = m_Data+position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MappedFileByteStream::ReadAt
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MappedFileByteStream::ReadAt(AP4_Position position,
+                                 void*        buffer,
+                                 AP4_Size     bytes_to_read)
+{
+    if (position+bytes_to_read > m_Size) return AP4_ERROR_EOS;
+    AP4_CopyMemory(buffer, m_Data+position, bytes_to_read);
+    return AP4_SUCCESS;
+}
+#endif // AP4_CONFIG_HAVE_MMAP
+
 /*----------------------------------------------------------------------
 |   AP4_FileByteStream::Create
 +---------------------------------------------------------------------*/
@@ -440,6 +722,14 @@ AP4_FileByteStream::Create(const char*                      name,
                            AP4_FileByteStream::Mode         mode,
                            std::shared_ptr<AP4_ByteStream>& stream)
 {
+#if defined(AP4_CONFIG_HAVE_MMAP)
+    if (mode == STREAM_MODE_READ_MAPPED && name && strncmp(name, "-std", 4)) {
+        AP4_Result result = AP4_MappedFileByteStream::Create(name, stream);
+        if (result != AP4_ERROR_NOT_SUPPORTED) return result;
+
+        // fall back to regular reads if the file can't be mapped
+    }
+#endif
     return AP4_StdcFileByteStream::Create(NULL, name, mode, stream);
 }
 
@@ -450,7 +740,7 @@ AP4_FileByteStream::Create(const char*                      name,
 AP4_FileByteStream::AP4_FileByteStream(const char*              name, 
                                        AP4_FileByteStream::Mode mode)
 {
-    AP4_Result result = AP4_StdcFileByteStream::Create(this, name, mode,m_Delegate);
+    AP4_Result result = AP4_FileByteStream::Create(name, mode, m_Delegate);
     if (AP4_FAILED(result)) throw AP4_Exception(result);
 }
 #endif
@@ -0,0 +1,35 @@
+#----------------------------------------------------------------------
+#   AppOutputDigest.cmake
+#
+#   app_output_digest(<file> <ignore_mvhd_times> <variable>) sets 
+#   <variable> to the MD5 digest of the lowercase hex encoding of a file.
+#   With <ignore_mvhd_times>, the creation and modification times of the
+#   first mvhd atom, which apps set to the time of the run, are zeroed
+#   before computing the digest.
+#----------------------------------------------------------------------
+function(app_output_digest file ignore_mvhd_times variable)
+  file(READ ${file} content HEX)
+  if(ignore_mvhd_times)
+    string(FIND "${content}" "6d766864" mvhd)
+    if(mvhd EQUAL -1)
+      message(FATAL_ERROR "${file} has no mvhd atom")
+    endif()
+    # the version is the first byte after the type
+    math(EXPR version_position "${mvhd}+8")
+    string(SUBSTRING "${content}" ${version_position} 2 version)
+    if(version STREQUAL "01")
+      set(times_size 32)
+      set(zero_times "00000000000000000000000000000000")
+    else()
+      set(times_size 16)
+      set(zero_times "0000000000000000")
+    endif()
+    math(EXPR times_position "${mvhd}+16")
+    math(EXPR rest_position "${times_position}+${times_size}")
+    string(SUBSTRING "${content}" 0 ${times_position} head)
+    string(SUBSTRING "${content}" ${rest_position} -1 rest)
+    set(content "${head}${zero_times}${rest}")
+  endif()
+  string(MD5 md5 "${content}")
+  set(${variable} ${md5} PARENT_SCOPE)
+endfunction()
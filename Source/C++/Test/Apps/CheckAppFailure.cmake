@@ -0,0 +1,28 @@
+#----------------------------------------------------------------------
+#   CheckAppFailure.cmake
+#
+#   Runs an app with ARGS in WORK_DIR and fails if it succeeds or if it
+#   writes the OUTPUT file there anyway.
+#
+#   cmake -DAPP=<app> -DWORK_DIR=<dir> -DOUTPUT=<file> "-DARGS=<args>"
+#         -P CheckAppFailure.cmake
+#----------------------------------------------------------------------
+foreach(var APP WORK_DIR OUTPUT)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+separate_arguments(ARGS UNIX_COMMAND "${ARGS}")
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+execute_process(COMMAND ${APP} ${ARGS}
+                WORKING_DIRECTORY ${WORK_DIR}
+                RESULT_VARIABLE result)
+if(result EQUAL 0)
+  message(FATAL_ERROR "run succeeded")
+endif()
+if(EXISTS ${WORK_DIR}/${OUTPUT})
+  message(FATAL_ERROR "${OUTPUT} was written")
+endif()
@@ -0,0 +1,40 @@
+#----------------------------------------------------------------------
+#   CheckAppOutput.cmake
+#
+#   Runs an app with ARGS in WORK_DIR and fails if it fails or if the 
+#   OUTPUT file it writes there does not have the EXPECTED_MD5 digest.
+#   The digest is computed over the lowercase hex encoding of the file.
+#   With IGNORE_MVHD_TIMES, the creation and modification times of the
+#   first mvhd atom, which apps set to the time of the run, are zeroed
+#   before computing the digest.
+#
+#   cmake -DAPP=<app> -DWORK_DIR=<dir> -DOUTPUT=<file> 
+#         -DEXPECTED_MD5=<md5> "-DARGS=<args>" [-DIGNORE_MVHD_TIMES=ON]
+#         -P CheckAppOutput.cmake
+#----------------------------------------------------------------------
+foreach(var APP WORK_DIR OUTPUT EXPECTED_MD5)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+include(${CMAKE_CURRENT_LIST_DIR}/AppOutputDigest.cmake)
+
+separate_arguments(ARGS UNIX_COMMAND "${ARGS}")
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+execute_process(COMMAND ${APP} ${ARGS}
+                WORKING_DIRECTORY ${WORK_DIR}
+                RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "run failed (${result})")
+endif()
+if(NOT EXISTS ${WORK_DIR}/${OUTPUT})
+  message(FATAL_ERROR "${OUTPUT} was not written")
+endif()
+
+app_output_digest(${WORK_DIR}/${OUTPUT} "${IGNORE_MVHD_TIMES}" md5)
+if(NOT md5 STREQUAL EXPECTED_MD5)
+  message(FATAL_ERROR "${OUTPUT}: MD5 ${md5}, expected ${EXPECTED_MD5}")
+endif()
@@ -0,0 +1,59 @@
+#----------------------------------------------------------------------
+#   CheckMp4Mux.cmake
+#
+#   Extracts the elementary streams of VIDEO_INPUT (H.264) and 
+#   AUDIO_INPUT (AAC) with MP42AVC and MP42AAC, muxes them with MP4MUX
+#   with each sample storage mode, and fails if a run fails, leaves a 
+#   temporary file behind, or writes an output that does not have the 
+#   EXPECTED_MD5 digest (see CheckAppOutput.cmake, mvhd times ignored).
+#   The memory limits make the memory storage keep all, some and none of
+#   the samples in memory.
+#
+#   cmake -DMP4MUX=<app> -DMP42AVC=<app> -DMP42AAC=<app> 
+#         -DVIDEO_INPUT=<file> -DAUDIO_INPUT=<file> -DWORK_DIR=<dir>
+#         -DEXPECTED_MD5=<md5> -P CheckMp4Mux.cmake
+#----------------------------------------------------------------------
+foreach(var MP4MUX MP42AVC MP42AAC VIDEO_INPUT AUDIO_INPUT WORK_DIR EXPECTED_MD5)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+include(${CMAKE_CURRENT_LIST_DIR}/AppOutputDigest.cmake)
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+foreach(extract "${MP42AVC};${VIDEO_INPUT};video.h264" "${MP42AAC};${AUDIO_INPUT};audio.aac")
+  execute_process(COMMAND ${extract}
+                  WORKING_DIRECTORY ${WORK_DIR}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "extraction failed (${result}): ${extract}")
+  endif()
+endforeach()
+
+set(storages "file" "memory" "memory --memory-limit 16K" "memory --memory-limit 0")
+set(run 0)
+foreach(storage ${storages})
+  math(EXPR run "${run}+1")
+  set(run_dir ${WORK_DIR}/run${run})
+  file(MAKE_DIRECTORY ${run_dir})
+  separate_arguments(args UNIX_COMMAND "--sample-storage ${storage}")
+  execute_process(COMMAND ${MP4MUX} ${args}
+                          --track h264:${WORK_DIR}/video.h264
+                          --track aac:${WORK_DIR}/audio.aac
+                          output.mp4
+                  WORKING_DIRECTORY ${run_dir}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "--sample-storage ${storage}: run failed (${result})")
+  endif()
+  file(GLOB files RELATIVE ${run_dir} ${run_dir}/*)
+  if(NOT files STREQUAL "output.mp4")
+    message(FATAL_ERROR "--sample-storage ${storage}: unexpected files ${files}")
+  endif()
+  app_output_digest(${run_dir}/output.mp4 ON md5)
+  if(NOT md5 STREQUAL EXPECTED_MD5)
+    message(FATAL_ERROR "--sample-storage ${storage}: MD5 ${md5}, expected ${EXPECTED_MD5}")
+  endif()
+endforeach()
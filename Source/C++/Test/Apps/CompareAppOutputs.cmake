@@ -0,0 +1,56 @@
+#----------------------------------------------------------------------
+#   CompareAppOutputs.cmake
+#
+#   Runs an app twice on the same input, once with REFERENCE_ARGS and 
+#   once with ARGS, each in its own directory under WORK_DIR, and fails 
+#   if either run fails or if the two runs do not produce the same files.
+#   If OUTPUT is set, it is passed to the app after the input.
+#
+#   cmake -DAPP=<app> -DINPUT=<file> -DWORK_DIR=<dir> [-DOUTPUT=<file>]
+#         "-DREFERENCE_ARGS=<args>" "-DARGS=<args>" 
+#         -P CompareAppOutputs.cmake
+#----------------------------------------------------------------------
+foreach(var APP INPUT WORK_DIR)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+separate_arguments(REFERENCE_ARGS UNIX_COMMAND "${REFERENCE_ARGS}")
+separate_arguments(ARGS UNIX_COMMAND "${ARGS}")
+
+foreach(run reference test)
+  if(run STREQUAL "reference")
+    set(run_args ${REFERENCE_ARGS})
+  else()
+    set(run_args ${ARGS})
+  endif()
+  file(REMOVE_RECURSE ${WORK_DIR}/${run})
+  file(MAKE_DIRECTORY ${WORK_DIR}/${run})
+  execute_process(COMMAND ${APP} ${run_args} ${INPUT} ${OUTPUT}
+                  WORKING_DIRECTORY ${WORK_DIR}/${run}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${run} run failed (${result})")
+  endif()
+endforeach()
+
+file(GLOB reference_files RELATIVE ${WORK_DIR}/reference ${WORK_DIR}/reference/*)
+file(GLOB test_files RELATIVE ${WORK_DIR}/test ${WORK_DIR}/test/*)
+list(SORT reference_files)
+list(SORT test_files)
+if(NOT reference_files)
+  message(FATAL_ERROR "no output files")
+endif()
+if(NOT reference_files STREQUAL test_files)
+  message(FATAL_ERROR "output files differ: [${reference_files}] vs [${test_files}]")
+endif()
+foreach(file ${reference_files})
+  execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files 
+                          ${WORK_DIR}/reference/${file} 
+                          ${WORK_DIR}/test/${file}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${file} differs")
+  endif()
+endforeach()
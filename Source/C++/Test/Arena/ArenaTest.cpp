@@ -0,0 +1,364 @@
+/*****************************************************************
+|
+|    AP4 - Arena Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Ap4.h"
+
+#include <memory>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size TEST_BLOCK_SIZE = 1024;
+
+/*----------------------------------------------------------------------
+|   Counted
++---------------------------------------------------------------------*/
+struct Counted {
+    static int Live;
+    Counted(AP4_UI32 value = 0) : m_Value(value)   { ++Live; }
+    Counted(const Counted& other) : m_Value(other.m_Value) { ++Live; }
+   ~Counted() { --Live; }
+    AP4_UI32 m_Value;
+};
+int Counted::Live = 0;
+
+/*----------------------------------------------------------------------
+|   IsAligned
++---------------------------------------------------------------------*/
+static bool
+IsAligned(const void* memory)
+{
+    return ((size_t)memory)%AP4_ARENA_ALIGNMENT == 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestResetReuse
++---------------------------------------------------------------------*/
+static int
+TestResetReuse()
+{
+    AP4_Arena arena(TEST_BLOCK_SIZE);
+
+    // fill a few blocks, remembering where each allocation went
+    void* first_pass[64];
+    for (unsigned int i=0; i<64; i++) {
+        first_pass[i] = arena.Allocate(1+i%100);
+        CHECK(first_pass[i] != NULL);
+        CHECK(IsAligned(first_pass[i]));
+        memset(first_pass[i], (int)i, 1+i%100);
+        for (unsigned int j=0; j<i; j++) CHECK(first_pass[j] != first_pass[i]);
+    }
+
+    // after a reset, the same sequence must land on the same memory
+    for (unsigned int pass=0; pass<3; pass++) {
+        arena.Reset();
+        for (unsigned int i=0; i<64; i++) {
+            void* memory = arena.Allocate(1+i%100);
+            CHECK(memory == first_pass[i]);
+        }
+    }
+
+    // zero-sized allocations still get distinct addresses
+    arena.Reset();
+    void* a = arena.Allocate(0);
+    void* b = arena.Allocate(0);
+    CHECK(a != NULL && b != NULL && a != b);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestLargeBlocks
++---------------------------------------------------------------------*/
+static int
+TestLargeBlocks()
+{
+    AP4_Arena arena(TEST_BLOCK_SIZE);
+
+    // small, large, small: the large allocation must not disturb the
+    // regular block, and each one must be fully usable
+    AP4_UI08* small_1 = (AP4_UI08*)arena.Allocate(32);
+    AP4_UI08* large   = (AP4_UI08*)arena.Allocate(10*TEST_BLOCK_SIZE);
+    AP4_UI08* small_2 = (AP4_UI08*)arena.Allocate(32);
+    CHECK(IsAligned(large));
+    CHECK(small_2 == small_1+32);
+    CHECK(large+10*TEST_BLOCK_SIZE <= small_1 || large >= small_2+32);
+    memset(small_1, 1, 32);
+    memset(large,   2, 10*TEST_BLOCK_SIZE);
+    memset(small_2, 3, 32);
+    for (unsigned int i=0; i<32; i++) {
+        CHECK(small_1[i] == 1);
+        CHECK(small_2[i] == 3);
+    }
+
+    // large allocations are released by a reset, but the regular blocks
+    // are kept
+    for (unsigned int pass=0; pass<10; pass++) {
+        arena.Reset();
+        CHECK(arena.Allocate(32) == small_1);
+        AP4_UI08* memory = (AP4_UI08*)arena.Allocate(TEST_BLOCK_SIZE/4+1+pass);
+        CHECK(IsAligned(memory));
+        memset(memory, 4, TEST_BLOCK_SIZE/4+1+pass);
+    }
+
+    // an arena array growing past the block size ends up in a large block
+    AP4_Array<AP4_UI32> array(&arena);
+    for (unsigned int i=0; i<4*TEST_BLOCK_SIZE; i++) {
+        CHECK(AP4_SUCCEEDED(array.Append(i)));
+    }
+    for (unsigned int i=0; i<4*TEST_BLOCK_SIZE; i++) {
+        CHECK(array[i] == i);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestNestedArenas
++---------------------------------------------------------------------*/
+static int
+TestNestedArenas()
+{
+    // an outer arena that lives for the whole test, an inner one that is
+    // reset at every iteration, and the heap, used side by side
+    AP4_Arena outer(TEST_BLOCK_SIZE);
+    AP4_Arena inner(TEST_BLOCK_SIZE);
+    {
+        AP4_Array<Counted> outer_array(&outer);
+        AP4_Array<Counted> heap_array;
+        for (unsigned int i=0; i<100; i++) {
+            {
+                AP4_Array<Counted> inner_array(&inner);
+                for (unsigned int j=0; j<=i; j++) {
+                    CHECK(AP4_SUCCEEDED(inner_array.Append(Counted(1000+j))));
+                }
+                CHECK(AP4_SUCCEEDED(outer_array.Append(Counted(i))));
+                CHECK(AP4_SUCCEEDED(heap_array.Append(Counted(2*i))));
+                for (unsigned int j=0; j<=i; j++) {
+                    CHECK(inner_array[j].m_Value == 1000+j);
+                }
+            }
+            inner.Reset();
+
+            // what the inner arena held is gone, the rest is intact
+            for (unsigned int j=0; j<=i; j++) {
+                CHECK(outer_array[j].m_Value == j);
+                CHECK(heap_array[j].m_Value == 2*j);
+            }
+        }
+        CHECK(Counted::Live == 200);
+    }
+
+    // destroying arena arrays still runs the item destructors
+    CHECK(Counted::Live == 0);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestGrowAfterArena
++---------------------------------------------------------------------*/
+static int
+TestGrowAfterArena()
+{
+    AP4_Array<Counted> copy;
+    AP4_Array<Counted> assigned;
+    {
+        AP4_Arena arena(TEST_BLOCK_SIZE);
+        AP4_Array<Counted> array(&arena);
+        for (unsigned int i=0; i<100; i++) {
+            CHECK(AP4_SUCCEEDED(array.Append(Counted(i))));
+        }
+
+        // copies are heap arrays, and may outlive the arena
+        AP4_Array<Counted> copied(array);
+        copy = copied;
+        assigned = array;
+
+        // an arena array keeps growing in its arena after the fact
+        CHECK(AP4_SUCCEEDED(array.SetItemCount(1000)));
+        CHECK(array[99].m_Value == 99);
+        CHECK(array[999].m_Value == 0);
+    }
+    CHECK(Counted::Live == 200);
+
+    // grow the copies now that the arena is gone
+    for (unsigned int i=100; i<5000; i++) {
+        CHECK(AP4_SUCCEEDED(copy.Append(Counted(i))));
+    }
+    CHECK(AP4_SUCCEEDED(assigned.EnsureCapacity(10000)));
+    for (unsigned int i=0; i<5000; i++) {
+        CHECK(copy[i].m_Value == i);
+        if (i < 100) CHECK(assigned[i].m_Value == i);
+    }
+    CHECK(assigned.ItemCount() == 100);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestAtomFactoryArena
++---------------------------------------------------------------------*/
+static int
+TestAtomFactoryArena()
+{
+    // serialize a trun
+    AP4_TrunAtom trun(AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT |
+                      AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT     |
+                      AP4_TRUN_FLAG_DATA_OFFSET_PRESENT, 1234, 0);
+    AP4_Array<AP4_TrunAtom::Entry> entries;
+    for (unsigned int i=0; i<500; i++) {
+        AP4_TrunAtom::Entry entry;
+        entry.sample_duration = 1000+i;
+        entry.sample_size     = 3*i;
+        entries.Append(entry);
+    }
+    CHECK(AP4_SUCCEEDED(trun.SetEntries(entries)));
+    std::shared_ptr<AP4_MemoryByteStream> stream = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(AP4_SUCCEEDED(trun.Write(*stream)));
+
+    // parse it a few times with an arena, resetting it in between
+    AP4_Arena arena(TEST_BLOCK_SIZE);
+    AP4_DefaultAtomFactory factory;
+    factory.SetArena(&arena);
+    CHECK(factory.GetArena() == &arena);
+    for (unsigned int pass=0; pass<3; pass++) {
+        CHECK(AP4_SUCCEEDED(stream->Seek(0)));
+        AP4_Atom* atom = NULL;
+        CHECK(AP4_SUCCEEDED(factory.CreateAtomFromStream(stream, atom)));
+        AP4_TrunAtom* parsed = AP4_DYNAMIC_CAST(AP4_TrunAtom, atom);
+        CHECK(parsed != NULL);
+        CHECK(parsed->GetDataOffset() == 1234);
+        CHECK(parsed->GetEntries().ItemCount() == 500);
+        for (unsigned int i=0; i<500; i++) {
+            CHECK(parsed->GetEntries()[i].sample_duration == 1000+i);
+            CHECK(parsed->GetEntries()[i].sample_size     == 3*i);
+        }
+        delete atom;
+        arena.Reset();
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestAtomTreeArena
++---------------------------------------------------------------------*/
+static int
+TestAtomTreeArena()
+{
+    // serialize a moof with a traf and a trun
+    AP4_ContainerAtom moof(AP4_ATOM_TYPE_MOOF);
+    moof.AddChild(new AP4_MfhdAtom(7));
+    AP4_ContainerAtom* traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
+    AP4_TrunAtom* trun = new AP4_TrunAtom(AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT, 0, 0);
+    AP4_Array<AP4_TrunAtom::Entry> entries;
+    entries.SetItemCount(10);
+    CHECK(AP4_SUCCEEDED(trun->SetEntries(entries)));
+    traf->AddChild(trun);
+    moof.AddChild(traf);
+    std::shared_ptr<AP4_MemoryByteStream> stream = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(AP4_SUCCEEDED(moof.Write(*stream)));
+
+    // parse it with an arena: the atoms and the child lists come from it
+    AP4_Arena arena;
+    AP4_DefaultAtomFactory factory;
+    factory.SetArena(&arena);
+    AP4_UI08* first_start = NULL;
+    for (unsigned int pass=0; pass<3; pass++) {
+        AP4_UI08* start = (AP4_UI08*)arena.Allocate(1);
+        if (pass == 0) first_start = start;
+        CHECK(start == first_start);
+        CHECK(AP4_SUCCEEDED(stream->Seek(0)));
+        AP4_Atom* atom = NULL;
+        CHECK(AP4_SUCCEEDED(factory.CreateAtomFromStream(stream, atom)));
+        CHECK(AP4_ArenaScope::GetCurrent() == NULL);
+        AP4_UI08* end = (AP4_UI08*)arena.Allocate(1);
+
+        AP4_ContainerAtom* parsed = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+        CHECK(parsed != NULL);
+        AP4_MfhdAtom* mfhd = AP4_DYNAMIC_CAST(AP4_MfhdAtom, parsed->GetChild(AP4_ATOM_TYPE_MFHD));
+        CHECK(mfhd != NULL && mfhd->GetSequenceNumber() == 7);
+        AP4_TrunAtom* parsed_trun = AP4_DYNAMIC_CAST(AP4_TrunAtom, parsed->FindChild("traf/trun"));
+        CHECK(parsed_trun != NULL);
+        CHECK(parsed_trun->GetEntries().ItemCount() == 10);
+        CHECK((AP4_UI08*)parsed > start && (AP4_UI08*)parsed < end);
+        CHECK((AP4_UI08*)mfhd > start && (AP4_UI08*)mfhd < end);
+        CHECK((AP4_UI08*)parsed_trun > start && (AP4_UI08*)parsed_trun < end);
+        CHECK((AP4_UI08*)parsed->GetChildren().FirstItem() > start &&
+              (AP4_UI08*)parsed->GetChildren().FirstItem() < end);
+
+        // atoms added later come from the heap and can be mixed in
+        parsed->AddChild(new AP4_MfhdAtom(8));
+        delete atom;
+        arena.Reset();
+    }
+
+    // without an arena, atoms come from the heap
+    factory.SetArena(NULL);
+    AP4_UI08* start = (AP4_UI08*)arena.Allocate(1);
+    CHECK(AP4_SUCCEEDED(stream->Seek(0)));
+    AP4_Atom* atom = NULL;
+    CHECK(AP4_SUCCEEDED(factory.CreateAtomFromStream(stream, atom)));
+    AP4_UI08* end = (AP4_UI08*)arena.Allocate(1);
+    CHECK(end == start+AP4_ARENA_ALIGNMENT);
+    delete atom;
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    CHECK(TestResetReuse() == 0);
+    CHECK(TestLargeBlocks() == 0);
+    CHECK(TestNestedArenas() == 0);
+    CHECK(TestGrowAfterArena() == 0);
+    CHECK(TestAtomFactoryArena() == 0);
+    CHECK(TestAtomTreeArena() == 0);
+
+    printf("OK\n");
+    return 0;
+}
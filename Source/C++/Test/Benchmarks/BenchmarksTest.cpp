@@ -31,396 +31,726 @@
 +---------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
-#if !defined _REENTRANT
-#define _REENTRANT
-#endif
-#if defined (WIN32)
-#include <sys/timeb.h>
-#else
-#include <sys/time.h>
-#endif
+#include <string.h>
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "Ap4NalParser.h"
+#include "Ap4AvcParser.h"
+#include "Ap4AdtsParser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 /*----------------------------------------------------------------------
 |   constants
+|
+|   All the input data is synthetic and generated from a fixed seed, so
+|   results from different runs and different machines are comparable.
 +---------------------------------------------------------------------*/
-#define TIME_SPAN 30.0  /* seconds */
-#define ENC_IN_BUFFER_SIZE (1024*128)
-#define ENC_OUT_BUFFER_SIZE (ENC_IN_BUFFER_SIZE+32)
-#define SCALE_MB (1024.0f*1024.0f)
+const unsigned int BENCH_DEFAULT_ITERATIONS  = 30;
+const double       BENCH_DEFAULT_MAX_TIME    = 10.0; // seconds per benchmark
+const AP4_UI32     BENCH_RANDOM_SEED         = 0x4150;
+const unsigned int BENCH_VIDEO_FRAME_COUNT   = 300;
+const unsigned int BENCH_VIDEO_GOP_SIZE      = 30;
+const AP4_UI32     BENCH_VIDEO_TIMESCALE     = 30000;
+const AP4_UI32     BENCH_VIDEO_FRAME_DURATION = 1000;
+const AP4_UI16     BENCH_VIDEO_WIDTH         = 320;
+const AP4_UI16     BENCH_VIDEO_HEIGHT        = 240;
+const AP4_UI32     BENCH_AUDIO_TIMESCALE     = 48000;
+const AP4_UI32     BENCH_AUDIO_FRAME_DURATION = 1024;
+const unsigned int BENCH_SEGMENT_FRAME_COUNT = 60;
+const AP4_Size     BENCH_FEED_CHUNK_SIZE     = 65536;
+const AP4_Size     BENCH_CIPHER_BUFFER_SIZE  = 1024*1024;
 
 /*----------------------------------------------------------------------
-|   macros
+|   NextRandom
 +---------------------------------------------------------------------*/
-#define BENCH_START(_msg, _select)      \
-if (_select) {                          \
-    double before = GetTime();          \
-    double after = 0.0;                 \
-    double total = 0.0;                 \
-    printf("%s:", _msg);                \
-    fflush(stdout);                     \
-    unsigned int i;                     \
-    for (i=0; (i<max_iterations) && ((after=GetTime())-before)<max_time; i++) { 
-
-#define BENCH_END(_unit, _scale)                          \
-    }                                                     \
-    double time_diff = after-before;                      \
-    double st = total/(_scale);                           \
-    double stps = (st/time_diff);                         \
-    printf(" %f " _unit "/s (%f " _unit " in %f seconds, %d iterations)\n", stps, st, time_diff, i); \
+static AP4_UI32
+NextRandom(AP4_UI32& state)
+{
+    state = state*1664525+1013904223;
+    return state>>8;
 }
 
-#if defined(WIN32)
 /*----------------------------------------------------------------------
-|   GetTime
+|   BitWriter
 +---------------------------------------------------------------------*/
-static double
-GetTime()
-{
-    struct _timeb time_stamp;
-
-#if defined(_MSC_VER) && (_MSC_VER >= 1400)
-    _ftime_s(&time_stamp);
-#else
-    _ftime(&time_stamp);
-#endif
-    double nowf = (double)time_stamp.time+((double)time_stamp.millitm)/1000.0f;
-    return nowf;
-}
-#else
+class BitWriter {
+public:
+    BitWriter() : m_BitCount(0) {}
+
+    void WriteBits(AP4_UI32 value, unsigned int bit_count) {
+        while (bit_count--) {
+            if ((m_BitCount%8) == 0) m_Bytes.push_back(0);
+            if ((value>>bit_count)&1) m_Bytes.back() |= (AP4_UI08)(0x80>>(m_BitCount%8));
+            ++m_BitCount;
+        }
+    }
+    void WriteGolomb(AP4_UI32 value) {
+        unsigned int bit_count = 0;
+        for (AP4_UI32 x=value+1; x; x >>= 1) ++bit_count;
+        WriteBits(0, bit_count-1);
+        WriteBits(value+1, bit_count);
+    }
+    void WriteTrailingBits() {
+        WriteBits(1, 1);
+        while (m_BitCount%8) WriteBits(0, 1);
+    }
+    std::vector<AP4_UI08>& GetBytes() { return m_Bytes; }
+
+private:
+    std::vector<AP4_UI08> m_Bytes;
+    unsigned int          m_BitCount;
+};
+
 /*----------------------------------------------------------------------
-|   GetTime
+|   SyntheticVideo
+|
+|   An H.264 baseline stream with real SPS, PPS and slice headers, and
+|   random slice data, both as an Annex B elementary stream and as MP4
+|   samples made of length-prefixed NAL units.
 +---------------------------------------------------------------------*/
-static double
-GetTime()
+struct SyntheticVideo {
+    AP4_DataBuffer      m_ElementaryStream;
+    AP4_DataBuffer      m_SampleData;
+    AP4_Array<AP4_Size> m_SampleSizes;
+    AP4_DataBuffer      m_Sps;
+    AP4_DataBuffer      m_Pps;
+};
+
+/*----------------------------------------------------------------------
+|   SyntheticAudio
+|
+|   AAC LC frames with random payloads, both raw and as an ADTS stream.
++---------------------------------------------------------------------*/
+struct SyntheticAudio {
+    AP4_DataBuffer      m_AdtsStream;
+    AP4_DataBuffer      m_SampleData;
+    AP4_Array<AP4_Size> m_SampleSizes;
+};
+
+/*----------------------------------------------------------------------
+|   AppendBytes
++---------------------------------------------------------------------*/
+static void
+AppendBytes(AP4_DataBuffer& buffer, const AP4_UI08* data, AP4_Size data_size)
 {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    double nowf = (double)now.tv_sec+((double)now.tv_usec)/1000000.0f;
-    //printf("%f\n", nowf);
-    return nowf;
+    AP4_Size size = buffer.GetDataSize();
+    buffer.SetDataSize(size+data_size);
+    AP4_CopyMemory(buffer.UseData()+size, data, data_size);
 }
-#endif
 
 /*----------------------------------------------------------------------
-|   PrintUsage
+|   MakeNalUnit
+|
+|   Build a NAL unit from a header byte and an RBSP, inserting emulation
+|   prevention bytes where needed.
 +---------------------------------------------------------------------*/
 static void
-PrintUsage()
+MakeNalUnit(AP4_UI08 header, const std::vector<AP4_UI08>& rbsp, AP4_DataBuffer& nal_unit)
 {
-    printf("benchmarktest [options] <test-name> [, <test-name>, ...]\n"
-           "options:\n"
-           "  --iterations=<n>: run each test for <n> iterations instead of a fixed run time.\n"
-           "  --test-file-read=<filename> (any file for read tests)\n"
-           "  --test-file-mp4=<filename> (MP4 file for parse-file, parse-samples and read-samples)\n"
-           "  --test-file-dcf-cbc=<filename> (DCF/CBC file for read-samples-dcf-cbc)\n"
-           "  --test-file-dcf-ctr=<filename> (DCF/CTR file for read-samples-dcf-ctr)\n"
-           "  --test-file-pdcf-cbc=<filename> (PDCF/CBC file for read-samples-pdcf-cbc)\n"
-           "  --test-file-pdcf-ctr=<filename> (PDCF/CTR file for read-samples-pdcf-ctr)\n"
-           "\n"
-           "valid test names are:\n"
-           "all: run all tests\n"
-           "or one or more of the following tests:\n"
-           "aes-cbc-block-decrypt\n"
-           "aes-cbc-block-encrypt\n"
-           "aes-ctr-block\n"
-           "aes-cbc-stream-encrypt\n"
-           "aes-cbc-stream-decrypt\n"
-           "aes-ctr-stream\n"
-           "parse-file\n"
-           "parse-file-buffered\n"
-           "parse-samples\n"
-           "read-file-seq-1\n"
-           "read-file-seq-16\n"
-           "read-file-seq-256\n"
-           "read-file-seq-4096\n"
-           "read-file-rnd-1\n"
-           "read-file-rnd-16\n"
-           "read-file-rnd-256\n"
-           "read-file-rnd-4096\n"
-           "read-samples\n"
-           "read-samples-dcf-cbc\n"
-           "read-samples-dcf-ctr\n"
-           "read-samples-pdcf-cbc\n"
-           "read-samples-pdcf-ctr\n");
+    nal_unit.SetDataSize(0);
+    nal_unit.Reserve((AP4_Size)(1+rbsp.size()+rbsp.size()/64));
+    AppendBytes(nal_unit, &header, 1);
+    unsigned int zero_count = 0;
+    for (AP4_UI08 byte : rbsp) {
+        if (zero_count == 2 && byte <= 3) {
+            const AP4_UI08 epb = 3;
+            AppendBytes(nal_unit, &epb, 1);
+            zero_count = 0;
+        }
+        AppendBytes(nal_unit, &byte, 1);
+        zero_count = byte ? 0 : zero_count+1;
+    }
 }
 
 /*----------------------------------------------------------------------
-|   CreateDcfDecrypter
+|   MakeSyntheticVideo
 +---------------------------------------------------------------------*/
-static AP4_ByteStream*
-CreateDcfDecrypter(AP4_AtomParent& atoms, const AP4_Byte* key)
+static void
+MakeSyntheticVideo(unsigned int frame_count, SyntheticVideo& video)
 {
-    for (AP4_List<AP4_Atom>::Item* item = atoms.GetChildren().FirstItem();
-         item;
-        item = item->GetNext()) {
-        AP4_Atom* atom = item->GetData();
-        if (atom->GetType() != AP4_ATOM_TYPE_ODRM) continue;
-
-        // check that we have all the atoms we need
-        AP4_ContainerAtom* odrm = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
-        if (odrm == NULL) continue; // not enough info
-        AP4_OdheAtom* odhe = AP4_DYNAMIC_CAST(AP4_OdheAtom, odrm->GetChild(AP4_ATOM_TYPE_ODHE));
-        if (odhe == NULL) continue; // not enough info    
-        AP4_OddaAtom* odda = AP4_DYNAMIC_CAST(AP4_OddaAtom, odrm->GetChild(AP4_ATOM_TYPE_ODDA));;
-        if (odda == NULL) continue; // not enough info
-        AP4_OhdrAtom* ohdr = AP4_DYNAMIC_CAST(AP4_OhdrAtom, odhe->GetChild(AP4_ATOM_TYPE_OHDR));
-        if (ohdr == NULL) continue; // not enough info
-
-        // do nothing if the atom is not encrypted
-        if (ohdr->GetEncryptionMethod() == AP4_OMA_DCF_ENCRYPTION_METHOD_NULL) {
-            continue;
+    AP4_UI32 random = BENCH_RANDOM_SEED;
+    const AP4_UI08 start_code[4] = { 0, 0, 0, 1 };
+
+    // SPS: baseline profile, level 3.0, frame_num on 4 bits, POC type 2
+    BitWriter sps;
+    sps.WriteBits(66, 8);    // profile_idc
+    sps.WriteBits(0xC0, 8);  // constraint flags
+    sps.WriteBits(30, 8);    // level_idc
+    sps.WriteGolomb(0);      // seq_parameter_set_id
+    sps.WriteGolomb(0);      // log2_max_frame_num_minus4
+    sps.WriteGolomb(2);      // pic_order_cnt_type
+    sps.WriteGolomb(1);      // max_num_ref_frames
+    sps.WriteBits(0, 1);     // gaps_in_frame_num_value_allowed_flag
+    sps.WriteGolomb(BENCH_VIDEO_WIDTH/16-1);
+    sps.WriteGolomb(BENCH_VIDEO_HEIGHT/16-1);
+    sps.WriteBits(1, 1);     // frame_mbs_only_flag
+    sps.WriteBits(1, 1);     // direct_8x8_inference_flag
+    sps.WriteBits(0, 1);     // frame_cropping_flag
+    sps.WriteBits(0, 1);     // vui_parameters_present_flag
+    sps.WriteTrailingBits();
+    MakeNalUnit(0x67, sps.GetBytes(), video.m_Sps);
+
+    // PPS: CAVLC, one slice group, deblocking control present
+    BitWriter pps;
+    pps.WriteGolomb(0);      // pic_parameter_set_id
+    pps.WriteGolomb(0);      // seq_parameter_set_id
+    pps.WriteBits(0, 1);     // entropy_coding_mode_flag
+    pps.WriteBits(0, 1);     // bottom_field_pic_order_in_frame_present_flag
+    pps.WriteGolomb(0);      // num_slice_groups_minus1
+    pps.WriteGolomb(0);      // num_ref_idx_l0_default_active_minus1
+    pps.WriteGolomb(0);      // num_ref_idx_l1_default_active_minus1
+    pps.WriteBits(0, 1);     // weighted_pred_flag
+    pps.WriteBits(0, 2);     // weighted_bipred_idc
+    pps.WriteGolomb(0);      // pic_init_qp_minus26
+    pps.WriteGolomb(0);      // pic_init_qs_minus26
+    pps.WriteGolomb(0);      // chroma_qp_index_offset
+    pps.WriteBits(1, 1);     // deblocking_filter_control_present_flag
+    pps.WriteBits(0, 1);     // constrained_intra_pred_flag
+    pps.WriteBits(0, 1);     // redundant_pic_cnt_present_flag
+    pps.WriteTrailingBits();
+    MakeNalUnit(0x68, pps.GetBytes(), video.m_Pps);
+
+    video.m_ElementaryStream.SetDataSize(0);
+    video.m_SampleData.SetDataSize(0);
+    video.m_SampleSizes.Clear();
+    AP4_DataBuffer slice;
+    for (unsigned int i=0; i<frame_count; i++) {
+        bool is_idr = (i%BENCH_VIDEO_GOP_SIZE) == 0;
+
+        // slice header
+        BitWriter rbsp;
+        rbsp.WriteGolomb(0);                     // first_mb_in_slice
+        rbsp.WriteGolomb(is_idr ? 7 : 5);        // slice_type (I or P)
+        rbsp.WriteGolomb(0);                     // pic_parameter_set_id
+        rbsp.WriteBits((i%BENCH_VIDEO_GOP_SIZE)&0xF, 4); // frame_num
+        if (is_idr) {
+            rbsp.WriteGolomb(i/BENCH_VIDEO_GOP_SIZE%2); // idr_pic_id
+        } else {
+            rbsp.WriteBits(0, 1);                // num_ref_idx_active_override_flag
+            rbsp.WriteBits(0, 1);                // ref_pic_list_modification_flag_l0
+        }
+        if (is_idr) {
+            rbsp.WriteBits(0, 1);                // no_output_of_prior_pics_flag
+            rbsp.WriteBits(0, 1);                // long_term_reference_flag
+        } else {
+            rbsp.WriteBits(0, 1);                // adaptive_ref_pic_marking_mode_flag
         }
-                
-        // create the byte stream
-        AP4_ByteStream* cipher_stream = NULL;
-        AP4_Result result = AP4_OmaDcfAtomDecrypter::CreateDecryptingStream(*odrm, 
-                                                   key, 
-                                                   16, 
-                                                   NULL, 
-                                                   cipher_stream);
-        if (AP4_SUCCEEDED(result)) {
-            return cipher_stream;
+        rbsp.WriteGolomb(0);                     // slice_qp_delta
+        rbsp.WriteGolomb(1);                     // disable_deblocking_filter_idc
+        rbsp.WriteTrailingBits();
+
+        // slice data: random bytes, with enough zeros to need escaping
+        AP4_Size data_size = is_idr ? 40000+NextRandom(random)%20000 : 4000+NextRandom(random)%12000;
+        std::vector<AP4_UI08>& bytes = rbsp.GetBytes();
+        for (AP4_Size j=0; j<data_size; j++) {
+            AP4_UI32 r = NextRandom(random);
+            bytes.push_back((r&0xF) == 0 ? 0 : (AP4_UI08)(r>>4));
         }
-    }
+        bytes.push_back(0x80);
+        MakeNalUnit(is_idr ? 0x65 : 0x41, bytes, slice);
 
-    return NULL;
+        // elementary stream
+        if (is_idr) {
+            AppendBytes(video.m_ElementaryStream, start_code, 4);
+            AppendBytes(video.m_ElementaryStream, video.m_Sps.GetData(), video.m_Sps.GetDataSize());
+            AppendBytes(video.m_ElementaryStream, start_code, 4);
+            AppendBytes(video.m_ElementaryStream, video.m_Pps.GetData(), video.m_Pps.GetDataSize());
+        }
+        AppendBytes(video.m_ElementaryStream, start_code, 4);
+        AppendBytes(video.m_ElementaryStream, slice.GetData(), slice.GetDataSize());
+
+        // MP4 sample
+        AP4_UI08 length[4];
+        AP4_BytesFromUInt32BE(length, slice.GetDataSize());
+        AppendBytes(video.m_SampleData, length, 4);
+        AppendBytes(video.m_SampleData, slice.GetData(), slice.GetDataSize());
+        video.m_SampleSizes.Append(4+slice.GetDataSize());
+    }
 }
 
 /*----------------------------------------------------------------------
-|   LoadAndDecryptSamples
+|   MakeSyntheticAudio
 +---------------------------------------------------------------------*/
-static unsigned int
-LoadAndDecryptSamples(AP4_Track*             track, 
-                      AP4_SampleDescription* sample_desc,
-                      unsigned int           repeats)
+static void
+MakeSyntheticAudio(unsigned int frame_count, SyntheticAudio& audio)
 {
-    AP4_ProtectedSampleDescription* pdesc = 
-        AP4_DYNAMIC_CAST(AP4_ProtectedSampleDescription, sample_desc);
-
-    const AP4_UI08 key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-    AP4_SampleDecrypter* decrypter = AP4_SampleDecrypter::Create(pdesc, key, 16);
-
-    unsigned int total_size = 0;
-    while (repeats--) {
-        AP4_Sample     sample;
-        AP4_DataBuffer encrypted_data;
-        AP4_DataBuffer decrypted_data;
-        AP4_Ordinal    index = 0;
-        while (AP4_SUCCEEDED(track->ReadSample(index, sample, encrypted_data))) {
-            if (AP4_FAILED(decrypter->DecryptSampleData(encrypted_data, decrypted_data))) {
-                fprintf(stderr, "ERROR: failed to decrypt sample\n");
-                return 0;
-            }
-            total_size += decrypted_data.GetDataSize();
-            index++;
+    AP4_UI32 random = BENCH_RANDOM_SEED+1;
+    audio.m_AdtsStream.SetDataSize(0);
+    audio.m_SampleData.SetDataSize(0);
+    audio.m_SampleSizes.Clear();
+    AP4_UI08 frame[1024];
+    for (unsigned int i=0; i<frame_count; i++) {
+        AP4_Size frame_size = 200+NextRandom(random)%400;
+        for (AP4_Size j=0; j<frame_size; j++) {
+            frame[j] = (AP4_UI08)NextRandom(random);
         }
+
+        // ADTS header: MPEG-4, no CRC, AAC LC, 48kHz, 2 channels
+        AP4_Size adts_size = 7+frame_size;
+        AP4_UI08 header[7] = {
+            0xFF, 0xF1,
+            (AP4_UI08)((1<<6) | (3<<2)),
+            (AP4_UI08)((2<<6) | (adts_size>>11)),
+            (AP4_UI08)(adts_size>>3),
+            (AP4_UI08)(((adts_size&7)<<5) | 0x1F),
+            0xFC
+        };
+        AppendBytes(audio.m_AdtsStream, header, 7);
+        AppendBytes(audio.m_AdtsStream, frame, frame_size);
+        AppendBytes(audio.m_SampleData, frame, frame_size);
+        audio.m_SampleSizes.Append(frame_size);
     }
-    return total_size;
 }
 
 /*----------------------------------------------------------------------
-|   LoadSamples
+|   MakeAudioSampleDescription
 +---------------------------------------------------------------------*/
-static unsigned int
-LoadSamples(AP4_Track* track, unsigned int repeats)
+static AP4_SampleDescription*
+MakeAudioSampleDescription()
 {
-    AP4_SampleDescription* sample_desc = track->GetSampleDescription(0);
-    if (sample_desc->GetType() == AP4_SampleDescription::TYPE_PROTECTED) {
-        return LoadAndDecryptSamples(track, sample_desc, repeats);
-    } else if (track->GetType() != AP4_Track::TYPE_AUDIO &&
-               track->GetType() != AP4_Track::TYPE_VIDEO) {
-        return 0;
+    const AP4_UI08 aac_dsi[2] = { 0x11, 0x90 }; // AAC LC, 48kHz, stereo
+    AP4_DataBuffer dsi(aac_dsi, 2);
+    return new AP4_MpegAudioSampleDescription(AP4_OTI_MPEG4_AUDIO,
+                                              BENCH_AUDIO_TIMESCALE, 16, 2, &dsi,
+                                              6144, 128000, 128000);
+}
+
+/*----------------------------------------------------------------------
+|   MakeMp4File
++---------------------------------------------------------------------*/
+static AP4_Result
+MakeMp4File(SyntheticVideo&                        video,
+            SyntheticAudio&                        audio,
+            std::shared_ptr<AP4_MemoryByteStream>& output)
+{
+    // video track
+    auto video_data = std::make_shared<AP4_MemoryByteStream>(video.m_SampleData);
+    AP4_SyntheticSampleTable* video_table = new AP4_SyntheticSampleTable();
+    AP4_Array<AP4_DataBuffer> sps_array;
+    AP4_Array<AP4_DataBuffer> pps_array;
+    sps_array.Append(video.m_Sps);
+    pps_array.Append(video.m_Pps);
+    video_table->AddSampleDescription(new AP4_AvcSampleDescription(AP4_SAMPLE_FORMAT_AVC1,
+                                                                   BENCH_VIDEO_WIDTH,
+                                                                   BENCH_VIDEO_HEIGHT,
+                                                                   24,
+                                                                   "h264",
+                                                                   66, 30, 0xC0, 4,
+                                                                   1, 0, 0,
+                                                                   sps_array,
+                                                                   pps_array));
+    AP4_Position offset = 0;
+    for (unsigned int i=0; i<video.m_SampleSizes.ItemCount(); i++) {
+        video_table->AddSample(video_data, offset, video.m_SampleSizes[i],
+                               BENCH_VIDEO_FRAME_DURATION, 0, 0, 0,
+                               (i%BENCH_VIDEO_GOP_SIZE) == 0);
+        offset += video.m_SampleSizes[i];
     }
-    
-    unsigned int total_size = 0;
-    while (repeats--) {
-        AP4_Sample     sample;
-        AP4_DataBuffer sample_data;
-        AP4_Ordinal    index = 0;
-        while (AP4_SUCCEEDED(track->ReadSample(index, sample, sample_data))) {
-            total_size += sample_data.GetDataSize();
-            index++;
-        }
+    AP4_UI64 video_duration = (AP4_UI64)video.m_SampleSizes.ItemCount()*BENCH_VIDEO_FRAME_DURATION;
+
+    // audio track
+    auto audio_data = std::make_shared<AP4_MemoryByteStream>(audio.m_SampleData);
+    AP4_SyntheticSampleTable* audio_table = new AP4_SyntheticSampleTable();
+    audio_table->AddSampleDescription(MakeAudioSampleDescription());
+    offset = 0;
+    for (unsigned int i=0; i<audio.m_SampleSizes.ItemCount(); i++) {
+        audio_table->AddSample(audio_data, offset, audio.m_SampleSizes[i],
+                               BENCH_AUDIO_FRAME_DURATION, 0, 0, 0, true);
+        offset += audio.m_SampleSizes[i];
     }
-    
-    return total_size;
+    AP4_UI64 audio_duration = (AP4_UI64)audio.m_SampleSizes.ItemCount()*BENCH_AUDIO_FRAME_DURATION;
+
+    // movie
+    AP4_Movie* movie = new AP4_Movie(1000);
+    movie->AddTrack(new AP4_Track(AP4_Track::TYPE_VIDEO, video_table, 1, 1000,
+                                  AP4_ConvertTime(video_duration, BENCH_VIDEO_TIMESCALE, 1000),
+                                  BENCH_VIDEO_TIMESCALE, video_duration, "und",
+                                  BENCH_VIDEO_WIDTH<<16, BENCH_VIDEO_HEIGHT<<16));
+    movie->AddTrack(new AP4_Track(AP4_Track::TYPE_AUDIO, audio_table, 2, 1000,
+                                  AP4_ConvertTime(audio_duration, BENCH_AUDIO_TIMESCALE, 1000),
+                                  BENCH_AUDIO_TIMESCALE, audio_duration, "und", 0, 0));
+
+    AP4_File file(movie);
+    AP4_UI32 compatible_brands[2] = { AP4_FILE_BRAND_ISOM, AP4_FILE_BRAND_MP42 };
+    file.SetFileType(AP4_FILE_BRAND_MP42, 1, compatible_brands, 2);
+
+    output = std::make_shared<AP4_MemoryByteStream>();
+    return AP4_FileWriter::Write(file, *output);
 }
 
 /*----------------------------------------------------------------------
-|   ParseSamples
+|   Fragment
+|
+|   Feed an Annex B stream to an AP4_AvcSegmentBuilder and write an init
+|   segment followed by fixed-size media segments.
 +---------------------------------------------------------------------*/
-static unsigned int
-ParseSamples(AP4_Track* track, unsigned int repeats)
+static AP4_Result
+Fragment(const AP4_DataBuffer& elementary_stream, AP4_ByteStream& output)
 {
-    unsigned int total_count = 0;
-    while (repeats--) {
-        AP4_Sample  sample;
-        AP4_Ordinal index = 0;
-        while (AP4_SUCCEEDED(track->GetSample(index, sample))) {
-            ++total_count;
-            ++index;
+    AP4_AvcSegmentBuilder builder(1, (double)BENCH_VIDEO_TIMESCALE/(double)BENCH_VIDEO_FRAME_DURATION);
+    AP4_MemoryByteStream  segments;
+    const AP4_UI08*       data      = elementary_stream.GetData();
+    AP4_Size              remaining = elementary_stream.GetDataSize();
+    unsigned int          sequence_number = 1;
+    for (;;) {
+        // Feed() returns a positive value when it has added a sample
+        bool     eos = (remaining == 0);
+        AP4_Size bytes_consumed = 0;
+        AP4_Result result = builder.Feed(eos ? NULL : data, remaining, bytes_consumed);
+        if (result < AP4_SUCCESS) return result;
+        data      += bytes_consumed;
+        remaining -= bytes_consumed;
+        // at the end of the stream, the last segment is written once the
+        // builder has been flushed
+        bool flushed = (eos && result == AP4_SUCCESS);
+        if (builder.GetSamples().ItemCount() >= BENCH_SEGMENT_FRAME_COUNT ||
+            (flushed && builder.GetSamples().ItemCount())) {
+            AP4_Result write_result = builder.WriteMediaSegment(segments, sequence_number++);
+            if (AP4_FAILED(write_result)) return write_result;
         }
+        if (flushed) break;
     }
-    
-    return total_count;
+
+    // the init segment can only be written once the parameter sets are known
+    AP4_Result result = builder.WriteInitSegment(output);
+    if (AP4_FAILED(result)) return result;
+    return output.Write(segments.GetData(), segments.GetDataSize());
 }
 
 /*----------------------------------------------------------------------
-|   ParseAllSamples
+|   FragmentWithFeeder
+|
+|   Same as Fragment, but through an AP4_StreamFeeder, so that the samples
+|   refer to the feeder's buffers instead of being copied.
 +---------------------------------------------------------------------*/
-static unsigned int
-ParseAllSamples(const char* filename, unsigned int repeats)
+static AP4_Result
+FragmentWithFeeder(const AP4_DataBuffer& elementary_stream, AP4_ByteStream& output)
 {
-    // open the input
-    AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
-        return 0;
-    }
-        
-    // parse the file
-    AP4_File* mp4_file = new AP4_File(*input);
-    
-    // parse all the tracks that need to be parsed
-    unsigned int total_count = 0;
-    for (AP4_List<AP4_Track>::Item* item = mp4_file->GetMovie()->GetTracks().FirstItem(); item; item=item->GetNext()) {
-        AP4_Track* track = item->GetData();
-        total_count += ParseSamples(track, repeats);
+    AP4_AvcSegmentBuilder builder(1, (double)BENCH_VIDEO_TIMESCALE/(double)BENCH_VIDEO_FRAME_DURATION);
+    // the source stream reads from the elementary stream without copying it
+    AP4_StreamFeeder      feeder(std::make_shared<AP4_MemoryByteStream>(const_cast<AP4_DataBuffer&>(elementary_stream)),
+                                 builder);
+    AP4_MemoryByteStream  segments;
+    unsigned int          sequence_number = 1;
+    for (;;) {
+        AP4_Result result = feeder.Feed();
+        bool eos = (result == AP4_ERROR_EOS);
+        if (AP4_FAILED(result) && !eos) return result;
+        if (builder.GetSamples().ItemCount() >= BENCH_SEGMENT_FRAME_COUNT ||
+            (eos && builder.GetSamples().ItemCount())) {
+            AP4_Result write_result = builder.WriteMediaSegment(segments, sequence_number++);
+            if (AP4_FAILED(write_result)) return write_result;
+        }
+        if (eos) break;
     }
 
-    delete mp4_file;
-    input->Release();
-    
-    return total_count;
+    AP4_Result result = builder.WriteInitSegment(output);
+    if (AP4_FAILED(result)) return result;
+    return output.Write(segments.GetData(), segments.GetDataSize());
 }
 
 /*----------------------------------------------------------------------
-|   ParseFile
+|   Encrypt
 +---------------------------------------------------------------------*/
-static unsigned int
-ParseFile(const char* filename, unsigned int repeats, bool buffered)
+static const AP4_UI08 BenchKey[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const AP4_UI08 BenchIv[16] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08
+};
+
+static AP4_Result
+Encrypt(std::shared_ptr<AP4_MemoryByteStream> input, AP4_ByteStream& output)
 {
-    unsigned int total_size = 0;
-    
-    // open the input
-    AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
-        return 0;
-    }
-    if (buffered) {
-        AP4_BufferedInputStream* buffered = new AP4_BufferedInputStream(*input);
-        input->Release();
-        input = buffered;
-    }
-        
-    for (unsigned int i=0; i<repeats; i++) {
-        // parse the file
-        AP4_File* mp4_file = new AP4_File(*input, true);
-        AP4_Movie* movie = mp4_file->GetMovie();
-        if (movie) {
-            total_size += movie->GetMoovAtom()->GetSize();
+    AP4_CencEncryptingProcessor processor(AP4_CENC_VARIANT_MPEG_CENC);
+    processor.GetKeyMap().SetKey(1, BenchKey, 16, BenchIv, 16);
+    processor.GetPropertyMap().SetProperty(1, "KID", "000102030405060708090a0b0c0d0e0f");
+    input->Seek(0);
+    return processor.Process(input, output);
+}
+
+/*----------------------------------------------------------------------
+|   Decrypt
++---------------------------------------------------------------------*/
+static AP4_Result
+Decrypt(std::shared_ptr<AP4_MemoryByteStream> input, AP4_ByteStream& output)
+{
+    AP4_ProtectionKeyMap key_map;
+    key_map.SetKey(1, BenchKey, 16);
+    AP4_CencDecryptingProcessor processor(&key_map);
+    input->Seek(0);
+    return processor.Process(input, output);
+}
+
+/*----------------------------------------------------------------------
+|   MuxTs
++---------------------------------------------------------------------*/
+static AP4_Result
+MuxTs(AP4_Movie& movie, AP4_ByteStream& output)
+{
+    AP4_Track* video_track = movie.GetTrack(AP4_Track::TYPE_VIDEO);
+    AP4_Track* audio_track = movie.GetTrack(AP4_Track::TYPE_AUDIO);
+    if (video_track == NULL || audio_track == NULL) return AP4_ERROR_INVALID_FORMAT;
+
+    AP4_Mpeg2TsWriter writer;
+    AP4_Mpeg2TsWriter::SampleStream* video_stream = NULL;
+    AP4_Mpeg2TsWriter::SampleStream* audio_stream = NULL;
+    AP4_Result result = writer.SetVideoStream(video_track->GetMediaTimeScale(),
+                                              AP4_MPEG2_STREAM_TYPE_AVC,
+                                              AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO,
+                                              video_stream);
+    if (AP4_FAILED(result)) return result;
+    result = writer.SetAudioStream(audio_track->GetMediaTimeScale(),
+                                   AP4_MPEG2_STREAM_TYPE_ISO_IEC_13818_7,
+                                   AP4_MPEG2_TS_DEFAULT_STREAM_ID_AUDIO,
+                                   audio_stream);
+    if (AP4_FAILED(result)) return result;
+    result = writer.WritePAT(output);
+    if (AP4_FAILED(result)) return result;
+    result = writer.WritePMT(output);
+    if (AP4_FAILED(result)) return result;
+
+    // interleave the two tracks in decode order
+    AP4_SampleDescription* video_desc = video_track->GetSampleDescription(0);
+    AP4_SampleDescription* audio_desc = audio_track->GetSampleDescription(0);
+    AP4_Ordinal    video_index = 0;
+    AP4_Ordinal    audio_index = 0;
+    AP4_Sample     video_sample;
+    AP4_Sample     audio_sample;
+    AP4_DataBuffer sample_data;
+    bool have_video = AP4_SUCCEEDED(video_track->GetSample(video_index, video_sample));
+    bool have_audio = AP4_SUCCEEDED(audio_track->GetSample(audio_index, audio_sample));
+    while (have_video || have_audio) {
+        bool pick_video = have_video &&
+            (!have_audio ||
+             AP4_ConvertTime(video_sample.GetDts(), video_track->GetMediaTimeScale(), 1000000) <=
+             AP4_ConvertTime(audio_sample.GetDts(), audio_track->GetMediaTimeScale(), 1000000));
+        if (pick_video) {
+            result = video_sample.ReadData(sample_data);
+            if (AP4_SUCCEEDED(result)) {
+                result = video_stream->WriteSample(video_sample, sample_data, video_desc, true, output);
+            }
+            have_video = AP4_SUCCEEDED(video_track->GetSample(++video_index, video_sample));
+        } else {
+            result = audio_sample.ReadData(sample_data);
+            if (AP4_SUCCEEDED(result)) {
+                result = audio_stream->WriteSample(audio_sample, sample_data, audio_desc, false, output);
+            }
+            have_audio = AP4_SUCCEEDED(audio_track->GetSample(++audio_index, audio_sample));
         }
-        delete mp4_file;
-        input->Seek(0);
+        if (AP4_FAILED(result)) return result;
     }
 
-    input->Release();
-    
-    return total_size;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
-|   LoadAllSamples
+|   BenchmarkResult
++---------------------------------------------------------------------*/
+struct BenchmarkResult {
+    std::string         m_Name;
+    std::string         m_Unit;
+    AP4_UI64            m_WorkPerIteration;
+    std::vector<double> m_Times; // seconds, one entry per iteration
+    bool                m_Failed;
+};
+
+/*----------------------------------------------------------------------
+|   BenchmarkRunner
 +---------------------------------------------------------------------*/
-static unsigned int
-LoadAllSamples(const char* filename, unsigned int repeats)
+class BenchmarkRunner {
+public:
+    // types
+    typedef std::function<AP4_Result(AP4_UI64& work)> Body;
+
+    // constructor
+    BenchmarkRunner(unsigned int iterations, double max_time) :
+        m_Iterations(iterations),
+        m_MaxTime(max_time) {}
+
+    // methods
+    void Run(const char* name, const char* unit, Body body);
+    void WriteJson(FILE* output);
+    bool HasFailures();
+
+private:
+    // members
+    unsigned int                 m_Iterations;
+    double                       m_MaxTime;
+    std::vector<BenchmarkResult> m_Results;
+};
+
+/*----------------------------------------------------------------------
+|   BenchmarkRunner::Run
++---------------------------------------------------------------------*/
+void
+BenchmarkRunner::Run(const char* name, const char* unit, Body body)
 {
-    // open the input
-    AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
-        return 0;
-    }
-        
-    // parse the file
-    AP4_File* mp4_file = new AP4_File(*input);
-
-    // create a stream decrypter if necessary
-    if (mp4_file->GetFileType()->GetMajorBrand() == AP4_OMA_DCF_BRAND_ODCF) {
-        const AP4_UI08 key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-        input->Release();
-        input = CreateDcfDecrypter(*mp4_file, key);
-        delete mp4_file;
-        mp4_file = new AP4_File(*input);
+    typedef std::chrono::steady_clock Clock;
+
+    BenchmarkResult result;
+    result.m_Name             = name;
+    result.m_Unit             = unit;
+    result.m_WorkPerIteration = 0;
+    result.m_Failed           = false;
+    fprintf(stderr, "%s:", name);
+    fflush(stderr);
+
+    // one untimed warm-up run, which also checks that the body works
+    if (AP4_FAILED(body(result.m_WorkPerIteration))) {
+        fprintf(stderr, " FAILED\n");
+        result.m_Failed = true;
+        m_Results.push_back(result);
+        return;
     }
-    
-    // dump all the tracks that need to be dumped
-    unsigned int total_size = 0;
-    for (AP4_List<AP4_Track>::Item* item = mp4_file->GetMovie()->GetTracks().FirstItem(); item; item=item->GetNext()) {
-        AP4_Track* track = item->GetData();
-        total_size += LoadSamples(track, repeats);
+
+    Clock::time_point start = Clock::now();
+    for (unsigned int i=0; i<m_Iterations; i++) {
+        AP4_UI64 work = 0;
+        Clock::time_point before = Clock::now();
+        AP4_Result status = body(work);
+        Clock::time_point after = Clock::now();
+        if (AP4_FAILED(status)) {
+            result.m_Failed = true;
+            break;
+        }
+        result.m_Times.push_back(std::chrono::duration<double>(after-before).count());
+        if (std::chrono::duration<double>(after-start).count() >= m_MaxTime) break;
     }
 
-    delete mp4_file;
-    input->Release();
-    
-    return total_size;
+    if (result.m_Failed) {
+        fprintf(stderr, " FAILED\n");
+    } else {
+        std::vector<double> sorted(result.m_Times);
+        std::sort(sorted.begin(), sorted.end());
+        double median = sorted[sorted.size()/2];
+        fprintf(stderr, " %.3f ms median, %.2f M%s/s (%u iterations)\n",
+                median*1000.0,
+                median > 0.0 ? (double)result.m_WorkPerIteration/median/1000000.0 : 0.0,
+                unit,
+                (unsigned int)result.m_Times.size());
+    }
+    m_Results.push_back(result);
+}
+
+/*----------------------------------------------------------------------
+|   Percentile
++---------------------------------------------------------------------*/
+static double
+Percentile(const std::vector<double>& sorted, double percentile)
+{
+    if (sorted.empty()) return 0.0;
+    double rank = percentile/100.0*(double)(sorted.size()-1);
+    size_t lower = (size_t)rank;
+    size_t upper = lower+1 < sorted.size() ? lower+1 : lower;
+    double fraction = rank-(double)lower;
+    return sorted[lower]+(sorted[upper]-sorted[lower])*fraction;
 }
 
 /*----------------------------------------------------------------------
-|   ReadFile
+|   BenchmarkRunner::WriteJson
 +---------------------------------------------------------------------*/
-static unsigned int
-ReadFile(const char* filename, unsigned int block_size, bool sequential)
+void
+BenchmarkRunner::WriteJson(FILE* output)
 {
-    AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: cannot open file %s (error %d)\n", filename, result);
-        return 0;
+    fprintf(output, "{\n");
+    fprintf(output, "  \"version\": \"%s\",\n", AP4_VERSION_STRING);
+    fprintf(output, "  \"iterations\": %u,\n", m_Iterations);
+    fprintf(output, "  \"benchmarks\": [");
+    for (size_t i=0; i<m_Results.size(); i++) {
+        const BenchmarkResult& result = m_Results[i];
+        std::vector<double> sorted(result.m_Times);
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0.0;
+        for (double t : sorted) mean += t;
+        if (!sorted.empty()) mean /= (double)sorted.size();
+        double median = Percentile(sorted, 50.0);
+
+        fprintf(output, "%s\n    {\n", i ? "," : "");
+        fprintf(output, "      \"name\": \"%s\",\n", result.m_Name.c_str());
+        fprintf(output, "      \"status\": \"%s\",\n", result.m_Failed ? "failed" : "ok");
+        fprintf(output, "      \"unit\": \"%s\",\n", result.m_Unit.c_str());
+        fprintf(output, "      \"work_per_iteration\": %llu,\n", (unsigned long long)result.m_WorkPerIteration);
+        fprintf(output, "      \"iterations\": %u,\n", (unsigned int)sorted.size());
+        fprintf(output, "      \"time_ns\": {\"min\": %.0f, \"mean\": %.0f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f},\n",
+                sorted.empty() ? 0.0 : sorted.front()*1e9,
+                mean*1e9,
+                median*1e9,
+                Percentile(sorted, 90.0)*1e9,
+                Percentile(sorted, 99.0)*1e9,
+                sorted.empty() ? 0.0 : sorted.back()*1e9);
+        fprintf(output, "      \"throughput_per_second\": %.1f\n",
+                median > 0.0 ? (double)result.m_WorkPerIteration/median : 0.0);
+        fprintf(output, "    }");
     }
-    
-    AP4_LargeSize file_size = 0;
-    input->GetSize(file_size);
-    
-    AP4_UI08* buffer = new AP4_UI08[block_size];
-    unsigned int repeats = 128;
-    unsigned int total_read = 0;
-    AP4_Position position = 0;
-    while (repeats--) {
-        AP4_Result result;
-        unsigned int blocks_to_read = (unsigned int)(file_size/block_size);
-        if (blocks_to_read > 4096) blocks_to_read = 4096;
-        input->Seek(0);
-        while (blocks_to_read--) {
-            AP4_Size bytes_read = 0;
-            result = input->ReadPartial(buffer, block_size, bytes_read);
-            if (AP4_FAILED(result)) {
-                if (result == AP4_ERROR_EOS) break;
-                fprintf(stderr, "ERROR: read failed\n");
-                return 0;
-            } else {
-                total_read += bytes_read;
-            }
-            if (!sequential) {
-                position += file_size-(file_size/7);
-                position %= file_size;
-                input->Seek(position); 
-            }
-        }
+    fprintf(output, "\n  ]\n}\n");
+}
+
+/*----------------------------------------------------------------------
+|   BenchmarkRunner::HasFailures
++---------------------------------------------------------------------*/
+bool
+BenchmarkRunner::HasFailures()
+{
+    for (const BenchmarkResult& result : m_Results) {
+        if (result.m_Failed) return true;
+    }
+    return false;
+}
+
+/*----------------------------------------------------------------------
+|   benchmark names
++---------------------------------------------------------------------*/
+static const char* const BenchmarkNames[] = {
+    "aes-cbc-block-encrypt",
+    "aes-cbc-block-decrypt",
+    "aes-ctr-block",
+    "parse-mp4",
+    "parse-fmp4",
+    "sample-table-lookup",
+    "read-samples",
+    "read-samples-batch",
+    "cenc-encrypt",
+    "cenc-decrypt",
+    "ts-mux",
+    "nal-parse",
+    "nal-scan",
+    "avc-frame-parse",
+    "adts-parse",
+    "fragment",
+    "fragment-feeder"
+};
+const unsigned int BenchmarkCount = sizeof(BenchmarkNames)/sizeof(BenchmarkNames[0]);
+
+/*----------------------------------------------------------------------
+|   PrintUsage
++---------------------------------------------------------------------*/
+static void
+PrintUsage()
+{
+    printf("benchmarktest [options] <test-name> [<test-name> ...]\n"
+           "options:\n"
+           "  --iterations=<n>: number of timed iterations per test (default %u)\n"
+           "  --time=<seconds>: stop a test after this much time (default %.0f)\n"
+           "  --scale=<n>: multiply the size of the synthetic inputs by <n> (default 1)\n"
+           "  --json=<filename>: write the JSON results to a file instead of stdout\n"
+           "\n"
+           "valid test names are:\n"
+           "all: run all tests\n"
+           "or one or more of the following tests:\n",
+           BENCH_DEFAULT_ITERATIONS,
+           BENCH_DEFAULT_MAX_TIME);
+    for (unsigned int i=0; i<BenchmarkCount; i++) {
+        printf("%s\n", BenchmarkNames[i]);
     }
-    
-    delete[] buffer;
-    input->Release();
-    
-    return total_read;
 }
 
 /*----------------------------------------------------------------------
@@ -433,253 +763,310 @@ main(int argc, char** argv)
         PrintUsage();
         return 1;
     }
-    
-    bool do_aes_cbc_block_decrypt  = false;
-    bool do_aes_cbc_block_encrypt  = false;
-    bool do_aes_ctr_block          = false;
-    bool do_aes_cbc_stream_encrypt = false;
-    bool do_aes_cbc_stream_decrypt = false;
-    bool do_aes_ctr_stream         = false;
-    bool do_read_file_seq_1        = false;
-    bool do_read_file_seq_16       = false;
-    bool do_read_file_seq_256      = false;
-    bool do_read_file_seq_4096     = false;
-    bool do_read_file_rnd_1        = false;
-    bool do_read_file_rnd_16       = false;
-    bool do_read_file_rnd_256      = false;
-    bool do_read_file_rnd_4096     = false;
-    bool do_parse_file             = false;
-    bool do_parse_file_buffered    = false;
-    bool do_parse_samples          = false;
-    bool do_read_samples           = false;
-    bool do_read_samples_dcf_cbc   = false;
-    bool do_read_samples_dcf_ctr   = false;
-    bool do_read_samples_pdcf_cbc  = false;
-    bool do_read_samples_pdcf_ctr  = false;
-    const char* test_file_read     = "test-bench.mp4";
-    const char* test_file_mp4      = "test-bench.mp4";
-    const char* test_file_dcf_cbc  = "test-bench.mp4.cbc.odf";
-    const char* test_file_dcf_ctr  = "test-bench.mp4.ctr.odf";
-    const char* test_file_pdcf_cbc = "test-bench.cbc.pdcf.mp4";
-    const char* test_file_pdcf_ctr = "test-bench.ctr.pdcf.mp4";
-    float max_time = TIME_SPAN;
-    unsigned int max_iterations = 0xFFFFFFFF;
-    
+
+    bool         selected[BenchmarkCount] = { false };
+    unsigned int iterations = BENCH_DEFAULT_ITERATIONS;
+    double       max_time   = BENCH_DEFAULT_MAX_TIME;
+    unsigned int scale      = 1;
+    const char*  json_filename = NULL;
     while (const char* arg = *(++argv)) {
-        if (!strcmp(arg, "aes-cbc-block-decrypt")) {
-            do_aes_cbc_block_decrypt = true;
-        } else if (!strcmp(arg, "aes-cbc-block-encrypt")) {
-            do_aes_cbc_block_encrypt = true;
-        } else if (!strcmp(arg, "aes-ctr-block")) {
-            do_aes_ctr_block = true;
-        } else if (!strcmp(arg, "aes-cbc-stream-encrypt")) {
-            do_aes_cbc_stream_encrypt = true;
-        } else if (!strcmp(arg, "aes-cbc-stream-decrypt")) {
-            do_aes_cbc_stream_decrypt = true;
-        } else if (!strcmp(arg, "aes-ctr-stream")) {
-            do_aes_ctr_stream = true;
-        } else if (!strcmp(arg, "read-file-seq-1")) {
-            do_read_file_seq_1 = true;
-        } else if (!strcmp(arg, "read-file-seq-16")) {
-            do_read_file_seq_16 = true;
-        } else if (!strcmp(arg, "read-file-seq-256")) {
-            do_read_file_seq_256 = true;
-        } else if (!strcmp(arg, "read-file-seq-4096")) {
-            do_read_file_seq_4096 = true;
-        } else if (!strcmp(arg, "read-file-rnd-1")) {
-            do_read_file_rnd_1 = true;
-        } else if (!strcmp(arg, "read-file-rnd-16")) {
-            do_read_file_rnd_16 = true;
-        } else if (!strcmp(arg, "read-file-rnd-256")) {
-            do_read_file_rnd_256 = true;
-        } else if (!strcmp(arg, "read-file-rnd-4096")) {
-            do_read_file_rnd_4096 = true;
-        } else if (!strcmp(arg, "parse-file")) {
-            do_parse_file = true;
-        } else if (!strcmp(arg, "parse-file-buffered")) {
-            do_parse_file_buffered = true;
-        } else if (!strcmp(arg, "parse-samples")) {
-            do_parse_samples = true;
-        } else if (!strcmp(arg, "read-samples")) {
-            do_read_samples = true;
-        } else if (!strcmp(arg, "read-samples-dcf-cbc")) {
-            do_read_samples_dcf_cbc = true;
-        } else if (!strcmp(arg, "read-samples-dcf-ctr")) {
-            do_read_samples_dcf_ctr = true;
-        } else if (!strcmp(arg, "read-samples-pdcf-cbc")) {
-            do_read_samples_pdcf_cbc = true;
-        } else if (!strcmp(arg, "read-samples-pdcf-ctr")) {
-            do_read_samples_pdcf_ctr = true;
-        } else if (!strncmp(arg, "--test-file-read=", 17)) {
-            test_file_read = arg+17;
-        } else if (!strncmp(arg, "--test-file-mp4=", 16)) {
-            test_file_mp4 = arg+16;
-        } else if (!strncmp(arg, "--test-file-dcf-cbc=", 20)) {
-            test_file_dcf_cbc = arg+20;
-        } else if (!strncmp(arg, "--test-file-dcf-ctr=", 20)) {
-            test_file_dcf_ctr = arg+20;
-        } else if (!strncmp(arg, "--test-file-pdcf-cbc=", 21)) {
-            test_file_pdcf_cbc = arg+21;
-        } else if (!strncmp(arg, "--test-file-pdcf-ctr=", 21)) {
-            test_file_pdcf_ctr = arg+21;
-        } else if (!strncmp(arg, "--iterations=", 13)) {
-            max_iterations = (unsigned int)strtoul(arg+13, NULL, 10);
+        if (!strncmp(arg, "--iterations=", 13)) {
+            iterations = (unsigned int)strtoul(arg+13, NULL, 10);
+        } else if (!strncmp(arg, "--time=", 7)) {
+            max_time = strtod(arg+7, NULL);
+        } else if (!strncmp(arg, "--scale=", 8)) {
+            scale = (unsigned int)strtoul(arg+8, NULL, 10);
+            if (scale == 0) scale = 1;
+        } else if (!strncmp(arg, "--json=", 7)) {
+            json_filename = arg+7;
         } else if (!strcmp(arg, "all")) {
-            do_aes_cbc_block_decrypt  = true;
-            do_aes_cbc_block_encrypt  = true;
-            do_aes_ctr_block          = true;
-            do_aes_cbc_stream_encrypt = true;
-            do_aes_cbc_stream_decrypt = true;
-            do_aes_ctr_stream         = true;
-            do_read_file_seq_1        = true;
-            do_read_file_seq_16       = true;
-            do_read_file_seq_256      = true;
-            do_read_file_seq_4096     = true;
-            do_read_file_rnd_1        = true;
-            do_read_file_rnd_16       = true;
-            do_read_file_rnd_256      = true;
-            do_read_file_rnd_4096     = true;
-            do_parse_file             = true;
-            do_parse_file_buffered    = true;
-            do_parse_samples          = true;
-            do_read_samples           = true;
-            do_read_samples_dcf_cbc   = true;
-            do_read_samples_dcf_ctr   = true;
-            do_read_samples_pdcf_cbc  = true;
-            do_read_samples_pdcf_ctr  = true;
+            for (unsigned int i=0; i<BenchmarkCount; i++) selected[i] = true;
         } else {
-            fprintf(stderr, "ERROR: unknown test name (%s)\n", arg);
-            return 1;
+            unsigned int i;
+            for (i=0; i<BenchmarkCount; i++) {
+                if (!strcmp(arg, BenchmarkNames[i])) break;
+            }
+            if (i == BenchmarkCount) {
+                fprintf(stderr, "ERROR: unknown test name (%s)\n", arg);
+                return 1;
+            }
+            selected[i] = true;
         }
     }
+
+    // generate the synthetic inputs
+    SyntheticVideo video;
+    SyntheticAudio audio;
+    unsigned int video_frame_count = BENCH_VIDEO_FRAME_COUNT*scale;
+    unsigned int audio_frame_count = (unsigned int)((AP4_UI64)video_frame_count*BENCH_VIDEO_FRAME_DURATION*BENCH_AUDIO_TIMESCALE/
+                                                    ((AP4_UI64)BENCH_VIDEO_TIMESCALE*BENCH_AUDIO_FRAME_DURATION));
+    MakeSyntheticVideo(video_frame_count, video);
+    MakeSyntheticAudio(audio_frame_count, audio);
+
+    std::shared_ptr<AP4_MemoryByteStream> mp4;
+    std::shared_ptr<AP4_MemoryByteStream> fmp4      = std::make_shared<AP4_MemoryByteStream>();
+    std::shared_ptr<AP4_MemoryByteStream> encrypted = std::make_shared<AP4_MemoryByteStream>();
+    if (AP4_FAILED(MakeMp4File(video, audio, mp4)) ||
+        AP4_FAILED(Fragment(video.m_ElementaryStream, *fmp4)) ||
+        AP4_FAILED(Encrypt(fmp4, *encrypted))) {
+        fprintf(stderr, "ERROR: failed to generate the synthetic inputs\n");
+        return 1;
+    }
     
-    unsigned char key[] = {
-      0xc4, 0x56, 0x09, 0xfb, 0xe6, 0xa5, 0xde, 0xfd, 0xb0, 0x23, 0x10, 0x06,
-      0x08, 0xbf, 0x3e, 0xbd
+    // the zero-copy feeder path must produce the same segments
+    AP4_MemoryByteStream fmp4_feeder;
+    if (AP4_FAILED(FragmentWithFeeder(video.m_ElementaryStream, fmp4_feeder)) ||
+        fmp4_feeder.GetDataSize() != fmp4->GetDataSize() ||
+        memcmp(fmp4_feeder.GetData(), fmp4->GetData(), fmp4->GetDataSize())) {
+        fprintf(stderr, "ERROR: the stream feeder output differs from the Feed() output\n");
+        return 1;
+    }
+    mp4->Seek(0);
+    AP4_File mp4_file(mp4);
+    AP4_Track* video_track = mp4_file.GetMovie() ? mp4_file.GetMovie()->GetTrack(AP4_Track::TYPE_VIDEO) : NULL;
+    if (video_track == NULL) {
+        fprintf(stderr, "ERROR: failed to parse the synthetic MP4 file\n");
+        return 1;
+    }
+
+    BenchmarkRunner runner(iterations, max_time);
+
+    // block ciphers
+    AP4_DataBuffer cipher_in(BENCH_CIPHER_BUFFER_SIZE);
+    AP4_DataBuffer cipher_out(BENCH_CIPHER_BUFFER_SIZE);
+    cipher_in.SetDataSize(BENCH_CIPHER_BUFFER_SIZE);
+    cipher_out.SetDataSize(BENCH_CIPHER_BUFFER_SIZE);
+    AP4_SetMemory(cipher_in.UseData(), 0, BENCH_CIPHER_BUFFER_SIZE);
+    const AP4_BlockCipher::CipherDirection directions[3] = {
+        AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::DECRYPT, AP4_BlockCipher::ENCRYPT
     };
-    
-    const int blocks_size = 32768;
-    unsigned char blocks_in[blocks_size];
-    AP4_SetMemory(blocks_in, 0, sizeof(blocks_in));
-    unsigned char blocks_out[blocks_size];
-    unsigned char* megabyte_in = new unsigned char[ENC_IN_BUFFER_SIZE];
-    AP4_SetMemory(megabyte_in, 0, ENC_IN_BUFFER_SIZE);
-    unsigned char* megabyte_out = new unsigned char[ENC_OUT_BUFFER_SIZE];
-    
-    AP4_BlockCipher* e_cbc_block_cipher;
-    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CBC, NULL, key, 16, e_cbc_block_cipher);
-    AP4_BlockCipher* d_cbc_block_cipher;
-    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::DECRYPT, AP4_BlockCipher::CBC, NULL, key, 16, d_cbc_block_cipher);
-    AP4_BlockCipher* ctr_block_cipher;
-    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CTR, NULL, key, 16, ctr_block_cipher);
-
-    AP4_CbcStreamCipher e_cbc_stream_cipher(e_cbc_block_cipher);
-    AP4_CbcStreamCipher d_cbc_stream_cipher(d_cbc_block_cipher);
-    AP4_CtrStreamCipher ctr_stream_cipher(ctr_block_cipher, 16);
-
-    BENCH_START("AES CBC Block Encryption", do_aes_cbc_block_encrypt)
-    for (unsigned b=0; b<256; b++) {
-        e_cbc_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
-    }
-    total += 256*blocks_size;
-    BENCH_END("MB", SCALE_MB)
-    
-    BENCH_START("AES CBC Block Decryption", do_aes_cbc_block_decrypt)
-    for (unsigned b=0; b<256; b++) {
-        d_cbc_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
-    }
-    total += 256*blocks_size;
-    BENCH_END("MB", SCALE_MB)
-         
-    BENCH_START("AES CTR Block Encryption/Decryption", do_aes_ctr_block)
-    for (unsigned b=0; b<256; b++) {
-        ctr_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
-    }
-    total += 256*blocks_size;
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("AES CBC Stream Encryption", do_aes_cbc_stream_encrypt)
-    AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
-    AP4_Result result = e_cbc_stream_cipher.ProcessBuffer(megabyte_in, ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
-    if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
-    total += ENC_IN_BUFFER_SIZE;
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("AES CBC Stream Decryption", do_aes_cbc_stream_decrypt)
-    AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
-    d_cbc_stream_cipher.ProcessBuffer(megabyte_in,ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
-    total += ENC_IN_BUFFER_SIZE;
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("AES CTR Stream", do_aes_ctr_stream)
-    AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
-    ctr_stream_cipher.ProcessBuffer(megabyte_in, ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
-    total += ENC_IN_BUFFER_SIZE;
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Sequential (1 Byte Blocks)", do_read_file_seq_1)
-    total += ReadFile(test_file_read, 1, true);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Sequential (16 Byte Blocks)", do_read_file_seq_16)
-    total += ReadFile(test_file_read, 16, true);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Sequential (256 Byte Blocks)", do_read_file_seq_256)
-    total += ReadFile(test_file_read, 256, true);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Sequential (4096 Byte Blocks)", do_read_file_seq_4096)
-    total += ReadFile(test_file_read, 4096, true);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Random (1 Byte Blocks)", do_read_file_rnd_1)
-    total += ReadFile(test_file_read, 1, false);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Random (16 Byte Blocks)", do_read_file_rnd_16)
-    total += ReadFile(test_file_read, 16, false);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Random (256 Byte Blocks)", do_read_file_rnd_256)
-    total += ReadFile(test_file_read, 256, false);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read File Random (4096 Byte Blocks)", do_read_file_rnd_4096)
-    total += ReadFile(test_file_read, 4096, false);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Parse File", do_parse_file)
-    total += ParseFile(test_file_mp4, 10, false);
-    BENCH_END("files", 1)
-
-    BENCH_START("Parse File Buffered", do_parse_file_buffered)
-    total += ParseFile(test_file_mp4, 10, true);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Parse Samples", do_parse_samples)
-    total += ParseAllSamples(test_file_mp4, 10);
-    BENCH_END("samples", 1)
-
-    BENCH_START("Read Samples", do_read_samples)
-    total += LoadAllSamples(test_file_mp4, 16);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read Samples DCF CBC", do_read_samples_dcf_cbc)
-    total += LoadAllSamples(test_file_dcf_cbc, 16);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read Samples DCF CTR", do_read_samples_dcf_ctr)
-    total += LoadAllSamples(test_file_dcf_ctr, 16);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read Samples PDCF CBC", do_read_samples_pdcf_cbc)
-    total += LoadAllSamples(test_file_pdcf_cbc, 16);
-    BENCH_END("MB", SCALE_MB)
-
-    BENCH_START("Read Samples PDCF CTR", do_read_samples_pdcf_ctr)
-    total += LoadAllSamples(test_file_pdcf_ctr, 16);
-    BENCH_END("MB", SCALE_MB)
-
-    return 1;
+    const AP4_BlockCipher::CipherMode modes[3] = {
+        AP4_BlockCipher::CBC, AP4_BlockCipher::CBC, AP4_BlockCipher::CTR
+    };
+    for (unsigned int i=0; i<3; i++) {
+        if (!selected[i]) continue;
+        AP4_BlockCipher* cipher = NULL;
+        AP4_BlockCipher::CtrParams ctr_params;
+        ctr_params.counter_size = 16;
+        AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128,
+                                                             directions[i],
+                                                             modes[i],
+                                                             modes[i] == AP4_BlockCipher::CTR ? &ctr_params : NULL,
+                                                             BenchKey, 16,
+                                                             cipher);
+        runner.Run(BenchmarkNames[i], "B", [&](AP4_UI64& work) {
+            if (cipher == NULL) return AP4_FAILURE;
+            work = BENCH_CIPHER_BUFFER_SIZE;
+            return cipher->Process(cipher_in.GetData(), BENCH_CIPHER_BUFFER_SIZE, cipher_out.UseData(), BenchIv);
+        });
+        delete cipher;
+    }
+
+    // atom parsing
+    if (selected[3]) {
+        runner.Run("parse-mp4", "B", [&](AP4_UI64& work) {
+            mp4->Seek(0);
+            AP4_File file(mp4, true);
+            if (file.GetMovie() == NULL) return AP4_FAILURE;
+            work = file.GetMovie()->GetMoovAtom()->GetSize();
+            return AP4_SUCCESS;
+        });
+    }
+    if (selected[4]) {
+        runner.Run("parse-fmp4", "atoms", [&](AP4_UI64& work) {
+            fmp4->Seek(0);
+            AP4_File file(fmp4);
+            if (file.GetMovie() == NULL) return AP4_FAILURE;
+            work = file.GetChildren().ItemCount();
+            return AP4_SUCCESS;
+        });
+    }
+
+    // sample tables
+    if (selected[5]) {
+        runner.Run("sample-table-lookup", "samples", [&](AP4_UI64& work) {
+            AP4_Cardinal sample_count = video_track->GetSampleCount();
+            AP4_UI32     random = BENCH_RANDOM_SEED;
+            AP4_Sample   sample;
+            for (AP4_Cardinal i=0; i<sample_count; i++) {
+                AP4_Result result = video_track->GetSample(NextRandom(random)%sample_count, sample);
+                if (AP4_FAILED(result)) return result;
+                AP4_Ordinal index = 0;
+                result = video_track->GetSampleIndexForTimeStampMs(NextRandom(random)%(AP4_UI32)video_track->GetDurationMs(), index);
+                if (AP4_FAILED(result)) return result;
+            }
+            work = 2*sample_count;
+            return AP4_SUCCESS;
+        });
+    }
+
+    // sample reading
+    if (selected[6]) {
+        runner.Run("read-samples", "B", [&](AP4_UI64& work) {
+            AP4_Sample     sample;
+            AP4_DataBuffer sample_data;
+            work = 0;
+            for (AP4_Ordinal i=0; i<video_track->GetSampleCount(); i++) {
+                AP4_Result result = video_track->ReadSample(i, sample, sample_data);
+                if (AP4_FAILED(result)) return result;
+                work += sample_data.GetDataSize();
+            }
+            return AP4_SUCCESS;
+        });
+    }
+    if (selected[7]) {
+        runner.Run("read-samples-batch", "B", [&](AP4_UI64& work) {
+            AP4_Array<AP4_Sample>         samples;
+            AP4_Array<AP4_SampleDataView> views;
+            AP4_DataBuffer                arena;
+            work = 0;
+            for (AP4_Ordinal i=0; i<video_track->GetSampleCount(); i += 64) {
+                AP4_Result result = video_track->ReadSamples(i, 64, samples, arena, views);
+                if (AP4_FAILED(result)) return result;
+                work += arena.GetDataSize();
+            }
+            return AP4_SUCCESS;
+        });
+    }
+
+    // common encryption
+    if (selected[8]) {
+        runner.Run("cenc-encrypt", "B", [&](AP4_UI64& work) {
+            AP4_MemoryByteStream output;
+            work = fmp4->GetDataSize();
+            return Encrypt(fmp4, output);
+        });
+    }
+    if (selected[9]) {
+        runner.Run("cenc-decrypt", "B", [&](AP4_UI64& work) {
+            AP4_MemoryByteStream output;
+            work = encrypted->GetDataSize();
+            return Decrypt(encrypted, output);
+        });
+    }
+
+    // MPEG-2 TS
+    if (selected[10]) {
+        runner.Run("ts-mux", "B", [&](AP4_UI64& work) {
+            AP4_MemoryByteStream output;
+            AP4_Result result = MuxTs(*mp4_file.GetMovie(), output);
+            work = output.GetDataSize();
+            return result;
+        });
+    }
+
+    // elementary streams
+    const AP4_DataBuffer& es = video.m_ElementaryStream;
+    if (selected[11]) {
+        runner.Run("nal-parse", "B", [&](AP4_UI64& work) {
+            AP4_NalParser parser;
+            AP4_Size      offset = 0;
+            unsigned int  nal_unit_count = 0;
+            for (;;) {
+                AP4_Size chunk = es.GetDataSize()-offset;
+                if (chunk > BENCH_FEED_CHUNK_SIZE) chunk = BENCH_FEED_CHUNK_SIZE;
+                bool eos = (offset+chunk == es.GetDataSize());
+                AP4_Size bytes_consumed = 0;
+                const AP4_DataBuffer* nal_unit = NULL;
+                AP4_Result result = parser.Feed(es.GetData()+offset, chunk, bytes_consumed, nal_unit, eos);
+                if (AP4_FAILED(result)) return result;
+                offset += bytes_consumed;
+                if (nal_unit) {
+                    ++nal_unit_count;
+                } else if (eos) {
+                    break;
+                }
+            }
+            work = es.GetDataSize();
+            return nal_unit_count ? AP4_SUCCESS : AP4_FAILURE;
+        });
+    }
+    if (selected[12]) {
+        runner.Run("nal-scan", "B", [&](AP4_UI64& work) {
+            AP4_Array<AP4_NalUnitRange> nal_units;
+            AP4_Size bytes_consumed = 0;
+            work = es.GetDataSize();
+            return AP4_NalParser::FindNalUnits(es.GetData(), es.GetDataSize(), nal_units, bytes_consumed, true);
+        });
+    }
+    if (selected[13]) {
+        runner.Run("avc-frame-parse", "B", [&](AP4_UI64& work) {
+            AP4_AvcFrameParser parser;
+            AP4_Size      offset = 0;
+            unsigned int  access_unit_count = 0;
+            for (;;) {
+                AP4_Size chunk = es.GetDataSize()-offset;
+                if (chunk > BENCH_FEED_CHUNK_SIZE) chunk = BENCH_FEED_CHUNK_SIZE;
+                bool eos = (chunk == 0);
+                AP4_Size bytes_consumed = 0;
+                AP4_AvcFrameParser::AccessUnitInfo access_unit_info;
+                AP4_Result result = parser.Feed(chunk ? es.GetData()+offset : NULL, chunk, bytes_consumed, access_unit_info, eos);
+                if (AP4_FAILED(result)) return result;
+                offset += bytes_consumed;
+                if (access_unit_info.nal_units.ItemCount()) {
+                    ++access_unit_count;
+                    access_unit_info.Reset();
+                } else if (eos) {
+                    break;
+                }
+            }
+            work = es.GetDataSize();
+            return access_unit_count == video_frame_count ? AP4_SUCCESS : AP4_FAILURE;
+        });
+    }
+    if (selected[14]) {
+        runner.Run("adts-parse", "B", [&](AP4_UI64& work) {
+            const AP4_DataBuffer& adts = audio.m_AdtsStream;
+            AP4_AdtsParser parser;
+            AP4_Size       offset = 0;
+            unsigned int   frame_count = 0;
+            AP4_DataBuffer frame_data;
+            for (;;) {
+                AP4_Size to_feed = adts.GetDataSize()-offset;
+                bool eos = (parser.GetBytesFree() >= to_feed);
+                AP4_Result result = parser.Feed(adts.GetData()+offset, &to_feed, eos ? AP4_BITSTREAM_FLAG_EOS : 0);
+                if (AP4_FAILED(result)) return result;
+                offset += to_feed;
+                AP4_AacFrame frame;
+                while (AP4_SUCCEEDED(parser.FindFrame(frame))) {
+                    frame_data.SetDataSize(frame.m_Info.m_FrameLength);
+                    frame.m_Source->ReadBytes(frame_data.UseData(), frame.m_Info.m_FrameLength);
+                    ++frame_count;
+                }
+                if (eos) break;
+            }
+            work = adts.GetDataSize();
+            return frame_count == audio_frame_count ? AP4_SUCCESS : AP4_FAILURE;
+        });
+    }
+
+    // fragmentation
+    if (selected[15]) {
+        runner.Run("fragment", "B", [&](AP4_UI64& work) {
+            AP4_MemoryByteStream output;
+            work = es.GetDataSize();
+            return Fragment(es, output);
+        });
+    }
+    if (selected[16]) {
+        runner.Run("fragment-feeder", "B", [&](AP4_UI64& work) {
+            AP4_MemoryByteStream output;
+            work = es.GetDataSize();
+            return FragmentWithFeeder(es, output);
+        });
+    }
+
+    // output the results
+    FILE* json = stdout;
+    if (json_filename) {
+        json = fopen(json_filename, "w");
+        if (json == NULL) {
+            fprintf(stderr, "ERROR: cannot open output file (%s)\n", json_filename);
+            return 1;
+        }
+    }
+    runner.WriteJson(json);
+    if (json != stdout) fclose(json);
+
+    return runner.HasFailures() ? 1 : 0;
 }
@@ -0,0 +1,233 @@
+/*****************************************************************
+|
+|    AP4 - Box Scanner Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const unsigned int TEST_FRAGMENT_COUNT = 50;
+const AP4_UI32     TEST_TRUN_FLAGS     = AP4_TRUN_FLAG_DATA_OFFSET_PRESENT                |
+                                         AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT            |
+                                         AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT                |
+                                         AP4_TRUN_FLAG_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT;
+
+/*----------------------------------------------------------------------
+|   GetSampleCount
++---------------------------------------------------------------------*/
+static AP4_Cardinal
+GetSampleCount(unsigned int fragment)
+{
+    return 1+(fragment*7)%20;
+}
+
+/*----------------------------------------------------------------------
+|   WriteTestFile
+|
+|   A sidx, then fragments with a moof and an mdat (with a 64-bit size
+|   for odd fragments), then a free box that extends to the end.
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteTestFile(AP4_ByteStream& stream)
+{
+    AP4_SidxAtom sidx(1, 90000, 1000, 0);
+    sidx.SetReferenceCount(TEST_FRAGMENT_COUNT);
+    for (unsigned int i=0; i<TEST_FRAGMENT_COUNT; i++) {
+        AP4_SidxAtom::Reference& reference = sidx.UseReferences()[i];
+        reference.m_ReferencedSize     = 1000+i;
+        reference.m_SubsegmentDuration = 3000*i;
+        reference.m_StartsWithSap      = (i%2) == 0;
+        reference.m_SapType            = (AP4_UI08)(i%4);
+        reference.m_SapDeltaTime       = i;
+    }
+    AP4_Result result = sidx.Write(stream);
+    if (AP4_FAILED(result)) return result;
+
+    for (unsigned int i=0; i<TEST_FRAGMENT_COUNT; i++) {
+        AP4_ContainerAtom moof(AP4_ATOM_TYPE_MOOF);
+        moof.AddChild(new AP4_MfhdAtom(i+1));
+        AP4_ContainerAtom* traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
+        AP4_UI32 tfhd_flags = AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT;
+        if (i%2) tfhd_flags |= AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT;
+        traf->AddChild(new AP4_TfhdAtom(tfhd_flags, 1, 100000*i, 0, 0, 0, 0x10000+i));
+        traf->AddChild(new AP4_TfdtAtom(1, 0x100000000ULL+1000*i));
+        AP4_TrunAtom* trun = new AP4_TrunAtom(TEST_TRUN_FLAGS, 8*i, 0);
+        AP4_Array<AP4_TrunAtom::Entry> entries;
+        for (unsigned int j=0; j<GetSampleCount(i); j++) {
+            AP4_TrunAtom::Entry entry;
+            entry.sample_duration                = 1000+j;
+            entry.sample_size                    = 100*i+j;
+            entry.sample_composition_time_offset = j;
+            entries.Append(entry);
+        }
+        trun->SetEntries(entries);
+        traf->AddChild(trun);
+        moof.AddChild(traf);
+        result = moof.Write(stream);
+        if (AP4_FAILED(result)) return result;
+
+        // mdat
+        if (i%2) {
+            stream.WriteUI32(1);
+            stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+            stream.WriteUI64(16+i);
+        } else {
+            stream.WriteUI32(8+i);
+            stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+        }
+        for (unsigned int j=0; j<i; j++) stream.WriteUI08((AP4_UI08)j);
+    }
+
+    // free box to the end
+    stream.WriteUI32(0);
+    stream.WriteUI32(AP4_ATOM_TYPE_FREE);
+    return stream.Write("0123456789", 10);
+}
+
+/*----------------------------------------------------------------------
+|   CheckFragment
++---------------------------------------------------------------------*/
+static int
+CheckFragment(AP4_BoxScanner& scanner, const AP4_BoxScanner::Box& moof, unsigned int fragment)
+{
+    AP4_BoxScanner moof_children(NULL, 0);
+    CHECK(AP4_SUCCEEDED(scanner.GetChildren(moof, moof_children)));
+    AP4_BoxScanner::Box box;
+    CHECK(AP4_SUCCEEDED(moof_children.Next(box)) && box.m_Type == AP4_ATOM_TYPE_MFHD);
+    AP4_BoxScanner unused(NULL, 0);
+    CHECK(scanner.GetChildren(box, unused) == AP4_ERROR_NOT_SUPPORTED);
+    CHECK(AP4_SUCCEEDED(moof_children.Next(box)) && box.m_Type == AP4_ATOM_TYPE_TRAF);
+    AP4_BoxScanner traf_children(NULL, 0);
+    CHECK(AP4_SUCCEEDED(moof_children.GetChildren(box, traf_children)));
+    CHECK(moof_children.Next(box) == AP4_ERROR_EOS);
+
+    // tfhd
+    AP4_BoxScanner::TfhdFields tfhd;
+    CHECK(AP4_SUCCEEDED(traf_children.Next(box)));
+    CHECK(AP4_SUCCEEDED(traf_children.ReadTfhd(box, tfhd)));
+    CHECK(tfhd.m_TrackId == 1);
+    CHECK(tfhd.m_DefaultSampleFlags == 0x10000+fragment);
+    CHECK(tfhd.m_BaseDataOffset == ((fragment%2) ? 100000*fragment : 0));
+
+    // tfdt
+    AP4_UI64 base_media_decode_time = 0;
+    CHECK(AP4_SUCCEEDED(traf_children.Next(box)));
+    CHECK(traf_children.ReadTfhd(box, tfhd) == AP4_ERROR_INVALID_PARAMETERS);
+    CHECK(AP4_SUCCEEDED(traf_children.ReadTfdt(box, base_media_decode_time)));
+    CHECK(base_media_decode_time == 0x100000000ULL+1000*fragment);
+
+    // trun, first with too little room
+    AP4_BoxScanner::TrunFields trun;
+    AP4_TrunAtom::Entry        entries[20];
+    AP4_Cardinal               sample_count = GetSampleCount(fragment);
+    CHECK(AP4_SUCCEEDED(traf_children.Next(box)));
+    CHECK(traf_children.ReadTrun(box, trun, entries, sample_count-1) == AP4_ERROR_BUFFER_TOO_SMALL);
+    CHECK(trun.m_SampleCount == sample_count);
+    CHECK(AP4_SUCCEEDED(traf_children.ReadTrun(box, trun, entries, 20)));
+    CHECK(trun.m_Flags == TEST_TRUN_FLAGS);
+    CHECK(trun.m_DataOffset == (AP4_SI32)(8*fragment));
+    for (unsigned int i=0; i<sample_count; i++) {
+        CHECK(entries[i].sample_duration == 1000+i);
+        CHECK(entries[i].sample_size == 100*fragment+i);
+        CHECK(entries[i].sample_flags == 0);
+        CHECK(entries[i].sample_composition_time_offset == i);
+    }
+    CHECK(traf_children.Next(box) == AP4_ERROR_EOS);
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    AP4_MemoryByteStream stream;
+    CHECK(AP4_SUCCEEDED(WriteTestFile(stream)));
+
+    // walk the whole file
+    AP4_BoxScanner scanner(stream.GetData(), stream.GetDataSize());
+    AP4_BoxScanner::Box box;
+    CHECK(AP4_SUCCEEDED(scanner.Next(box)));
+    CHECK(box.m_Type == AP4_ATOM_TYPE_SIDX && box.m_Offset == 0 && box.m_HeaderSize == 8);
+    AP4_BoxScanner::SidxFields sidx;
+    AP4_SidxAtom::Reference    references[TEST_FRAGMENT_COUNT];
+    CHECK(scanner.ReadSidx(box, sidx, NULL, 0) == AP4_ERROR_BUFFER_TOO_SMALL);
+    CHECK(AP4_SUCCEEDED(scanner.ReadSidx(box, sidx, references, TEST_FRAGMENT_COUNT)));
+    CHECK(sidx.m_ReferenceId == 1 && sidx.m_TimeScale == 90000);
+    CHECK(sidx.m_EarliestPresentationTime == 1000 && sidx.m_FirstOffset == 0);
+    CHECK(sidx.m_ReferenceCount == TEST_FRAGMENT_COUNT);
+    for (unsigned int i=0; i<TEST_FRAGMENT_COUNT; i++) {
+        CHECK(references[i].m_ReferenceType == 0);
+        CHECK(references[i].m_ReferencedSize == 1000+i);
+        CHECK(references[i].m_SubsegmentDuration == 3000*i);
+        CHECK(references[i].m_StartsWithSap == ((i%2) == 0));
+        CHECK(references[i].m_SapType == i%4);
+        CHECK(references[i].m_SapDeltaTime == i);
+    }
+    for (unsigned int i=0; i<TEST_FRAGMENT_COUNT; i++) {
+        CHECK(AP4_SUCCEEDED(scanner.Next(box)) && box.m_Type == AP4_ATOM_TYPE_MOOF);
+        CHECK(CheckFragment(scanner, box, i) == 0);
+        CHECK(AP4_SUCCEEDED(scanner.Next(box)) && box.m_Type == AP4_ATOM_TYPE_MDAT);
+        CHECK(box.m_HeaderSize == ((i%2) ? 16 : 8));
+        CHECK(box.GetPayloadSize() == i);
+        CHECK(box.GetPayloadOffset()+i <= stream.GetDataSize());
+        if (i) CHECK(scanner.GetPayload(box)[i-1] == (AP4_UI08)(i-1));
+    }
+    CHECK(AP4_SUCCEEDED(scanner.Next(box)) && box.m_Type == AP4_ATOM_TYPE_FREE);
+    CHECK(box.GetPayloadSize() == 10);
+    CHECK(box.m_Offset+box.m_Size == stream.GetDataSize());
+    CHECK(scanner.Next(box) == AP4_ERROR_EOS);
+
+    // a truncated box stops the scan
+    AP4_BoxScanner truncated(stream.GetData(), 40);
+    CHECK(truncated.Next(box) == AP4_ERROR_INVALID_FORMAT);
+    CHECK(truncated.Next(box) == AP4_ERROR_EOS);
+
+    // a range that starts past its end is empty
+    AP4_BoxScanner inverted(stream.GetData(), 16, 8);
+    CHECK(inverted.Next(box) == AP4_ERROR_EOS);
+    AP4_BoxScanner range(stream.GetData(), 0, stream.GetDataSize());
+    CHECK(AP4_SUCCEEDED(range.Next(box)) && box.m_Type == AP4_ATOM_TYPE_SIDX);
+
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,395 @@
+/*****************************************************************
+|
+|    AP4 - Byte Stream Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Ap4.h"
+
+#include <memory>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size TEST_DATA_SIZE = 100000;
+
+/*----------------------------------------------------------------------
+|   MakeTestData
++---------------------------------------------------------------------*/
+static void
+MakeTestData(AP4_DataBuffer& data)
+{
+    data.SetDataSize(TEST_DATA_SIZE);
+    for (unsigned int i=0; i<TEST_DATA_SIZE; i++) {
+        data.UseData()[i] = (AP4_UI08)(i*7+(i>>8));
+    }
+}
+
+/*----------------------------------------------------------------------
+|   DataViewTest
++---------------------------------------------------------------------*/
+static int
+DataViewTest(const AP4_DataBuffer& data)
+{
+    auto memory = std::make_shared<AP4_MemoryByteStream>(data.GetData(), data.GetDataSize());
+    const AP4_UI08* view = NULL;
+    CHECK(AP4_SUCCEEDED(memory->GetDataView(1000, 500, view)));
+    CHECK(view && memcmp(view, data.GetData()+1000, 500) == 0);
+    CHECK(memory->GetDataView(TEST_DATA_SIZE-10, 11, view) == AP4_ERROR_OUT_OF_RANGE);
+
+    AP4_SubStream sub(memory, 2000, 3000);
+    CHECK(AP4_SUCCEEDED(sub.GetDataView(10, 100, view)));
+    CHECK(view && memcmp(view, data.GetData()+2010, 100) == 0);
+    CHECK(sub.GetDataView(2990, 11, view) == AP4_ERROR_OUT_OF_RANGE);
+
+    AP4_Sample sample(memory, 5000, 1234, 0, 0, 0, 0, true);
+    CHECK(AP4_SUCCEEDED(sample.GetDataView(view)));
+    CHECK(view && memcmp(view, data.GetData()+5000, 1234) == 0);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   BatchReadTest
++---------------------------------------------------------------------*/
+static int
+BatchReadTest(const AP4_DataBuffer& data)
+{
+    auto stream1 = std::make_shared<AP4_MemoryByteStream>(data.GetData(), data.GetDataSize());
+    auto stream2 = std::make_shared<AP4_MemoryByteStream>(data.GetData(), data.GetDataSize());
+
+    // contiguous runs, gaps, a backward jump, an empty sample and a stream switch
+    AP4_Sample samples[] = {
+        AP4_Sample(stream1, 100,  10,   0, 0, 0, 0, true),
+        AP4_Sample(stream1, 110,  20,   0, 0, 0, 0, true),
+        AP4_Sample(stream1, 130,  0,    0, 0, 0, 0, true),
+        AP4_Sample(stream1, 130,  300,  0, 0, 0, 0, true),
+        AP4_Sample(stream1, 5000, 1000, 0, 0, 0, 0, true),
+        AP4_Sample(stream2, 6000, 50,   0, 0, 0, 0, true),
+        AP4_Sample(stream1, 50,   50,   0, 0, 0, 0, true),
+        AP4_Sample(stream1, 100,  7,    0, 0, 0, 0, true)
+    };
+    const unsigned int sample_count = sizeof(samples)/sizeof(samples[0]);
+    AP4_SampleDataView views[sample_count];
+    AP4_DataBuffer arena;
+    CHECK(AP4_SUCCEEDED(AP4_Sample::ReadDataBatch(samples, sample_count, arena, views)));
+    AP4_Size total = 0;
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_DataBuffer expected;
+        CHECK(AP4_SUCCEEDED(samples[i].ReadData(expected)));
+        CHECK(views[i].m_Size == expected.GetDataSize());
+        CHECK(views[i].m_Data == arena.GetData()+total);
+        CHECK(memcmp(views[i].m_Data, expected.GetData(), views[i].m_Size) == 0);
+        total += views[i].m_Size;
+    }
+    CHECK(arena.GetDataSize() == total);
+
+    // reading past the end of the stream must fail
+    AP4_Sample bad(stream1, TEST_DATA_SIZE-10, 20, 0, 0, 0, 0, true);
+    CHECK(AP4_Sample::ReadDataBatch(&bad, 1, arena, views) == AP4_ERROR_OUT_OF_RANGE);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   MappedFileTest
++---------------------------------------------------------------------*/
+static int
+MappedFileTest(const AP4_DataBuffer& data, const char* filename)
+{
+    // write a file
+    {
+        std::shared_ptr<AP4_ByteStream> output;
+        CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_WRITE, output)));
+        CHECK(AP4_SUCCEEDED(output->Write(data.GetData(), data.GetDataSize())));
+    }
+
+    // read it back
+    std::shared_ptr<AP4_ByteStream> input;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input)));
+    AP4_LargeSize size = 0;
+    CHECK(AP4_SUCCEEDED(input->GetSize(size)));
+    CHECK(size == TEST_DATA_SIZE);
+
+    AP4_DataBuffer buffer(TEST_DATA_SIZE);
+    CHECK(AP4_SUCCEEDED(input->Seek(777)));
+    CHECK(AP4_SUCCEEDED(input->Read(buffer.UseData(), 1000)));
+    CHECK(memcmp(buffer.GetData(), data.GetData()+777, 1000) == 0);
+    AP4_Position position = 0;
+    CHECK(AP4_SUCCEEDED(input->Tell(position)));
+    CHECK(position == 1777);
+
+    CHECK(AP4_SUCCEEDED(input->Seek(TEST_DATA_SIZE-10)));
+    CHECK(input->Read(buffer.UseData(), 11) == AP4_ERROR_EOS);
+
+    AP4_MemoryByteStream copy;
+    CHECK(AP4_SUCCEEDED(input->Seek(0)));
+    CHECK(AP4_SUCCEEDED(input->CopyTo(copy, TEST_DATA_SIZE)));
+    CHECK(copy.GetDataSize() == TEST_DATA_SIZE);
+    CHECK(memcmp(copy.GetData(), data.GetData(), TEST_DATA_SIZE) == 0);
+
+#if defined(AP4_CONFIG_HAVE_MMAP)
+    const AP4_UI08* view = NULL;
+    CHECK(AP4_SUCCEEDED(input->GetDataView(50000, 50000, view)));
+    CHECK(view && memcmp(view, data.GetData()+50000, 50000) == 0);
+#endif
+
+    input = NULL;
+    remove(filename);
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CheckReadAt
++---------------------------------------------------------------------*/
+static int
+CheckReadAt(AP4_ByteStream& stream, const AP4_UI08* expected, AP4_Size size)
+{
+    AP4_Position start = 0;
+    CHECK(AP4_SUCCEEDED(stream.Tell(start)));
+    AP4_DataBuffer buffer(size);
+    const AP4_Position offsets[] = { 0, 1, 4095, 4096, 9999, size-100 };
+    for (unsigned int i=0; i<sizeof(offsets)/sizeof(offsets[0]); i++) {
+        AP4_Size chunk = size-offsets[i] < 5000 ? (AP4_Size)(size-offsets[i]) : 5000;
+        CHECK(AP4_SUCCEEDED(stream.ReadAt(offsets[i], buffer.UseData(), chunk)));
+        CHECK(memcmp(buffer.GetData(), expected+offsets[i], chunk) == 0);
+    }
+    CHECK(stream.ReadAt(size-10, buffer.UseData(), 11) == AP4_ERROR_EOS);
+
+    // the stream position is left alone
+    AP4_Position position = 0;
+    CHECK(AP4_SUCCEEDED(stream.Tell(position)));
+    CHECK(position == start);
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ReadAtTest
++---------------------------------------------------------------------*/
+static int
+ReadAtTest(const AP4_DataBuffer& data, const char* filename)
+{
+    auto memory = std::make_shared<AP4_MemoryByteStream>(data.GetData(), data.GetDataSize());
+    CHECK(AP4_SUCCEEDED(memory->Seek(123)));
+    CHECK(CheckReadAt(*memory, data.GetData(), TEST_DATA_SIZE) == 0);
+
+    AP4_SubStream sub(memory, 2000, 50000);
+    CHECK(AP4_SUCCEEDED(sub.Seek(10)));
+    CHECK(CheckReadAt(sub, data.GetData()+2000, 50000) == 0);
+
+    AP4_DupStream dup(memory);
+    CHECK(CheckReadAt(dup, data.GetData(), TEST_DATA_SIZE) == 0);
+
+    // buffered reads, both inside and outside of the buffer
+    CHECK(AP4_SUCCEEDED(memory->Seek(0)));
+    AP4_BufferedInputStream buffered(memory);
+    AP4_UI08 head[100];
+    CHECK(AP4_SUCCEEDED(buffered.Read(head, sizeof(head))));
+    CHECK(memcmp(head, data.GetData(), sizeof(head)) == 0);
+    CHECK(CheckReadAt(buffered, data.GetData(), TEST_DATA_SIZE) == 0);
+    CHECK(AP4_SUCCEEDED(buffered.Read(head, sizeof(head))));
+    CHECK(memcmp(head, data.GetData()+100, sizeof(head)) == 0);
+
+    // files, with the native positional read
+    {
+        std::shared_ptr<AP4_ByteStream> output;
+        CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_WRITE, output)));
+        CHECK(AP4_SUCCEEDED(output->Write(data.GetData(), data.GetDataSize())));
+    }
+    std::shared_ptr<AP4_ByteStream> file;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, file)));
+    CHECK(AP4_SUCCEEDED(file->Seek(55)));
+    CHECK(CheckReadAt(*file, data.GetData(), TEST_DATA_SIZE) == 0);
+    CHECK(AP4_SUCCEEDED(file->Read(head, sizeof(head))));
+    CHECK(memcmp(head, data.GetData()+55, sizeof(head)) == 0);
+
+    file = NULL;
+    remove(filename);
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   WritePatchedOutput
++---------------------------------------------------------------------*/
+static int
+WritePatchedOutput(AP4_ByteStream& stream, const AP4_DataBuffer& data)
+{
+    // a size placeholder, then the data in uneven chunks
+    CHECK(AP4_SUCCEEDED(stream.WriteUI32(0)));
+    AP4_Size offset = 0;
+    for (AP4_Size chunk = 1; offset < data.GetDataSize(); chunk = (chunk*13+7)%3001) {
+        if (chunk > data.GetDataSize()-offset) chunk = data.GetDataSize()-offset;
+        CHECK(AP4_SUCCEEDED(stream.Write(data.GetData()+offset, chunk)));
+        offset += chunk;
+    }
+
+    // patch a recent field and the placeholder, then append a trailer
+    AP4_Position end = 0;
+    CHECK(AP4_SUCCEEDED(stream.Tell(end)));
+    CHECK(AP4_SUCCEEDED(stream.Seek(end-10)));
+    CHECK(AP4_SUCCEEDED(stream.WriteUI16(0xABCD)));
+    CHECK(AP4_SUCCEEDED(stream.Seek(0)));
+    CHECK(AP4_SUCCEEDED(stream.WriteUI32((AP4_UI32)end)));
+    CHECK(AP4_SUCCEEDED(stream.Seek(end)));
+    CHECK(AP4_SUCCEEDED(stream.WriteUI32(0x12345678)));
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   BufferedOutputTest
++---------------------------------------------------------------------*/
+static int
+BufferedOutputTest(const AP4_DataBuffer& data, const char* filename)
+{
+    auto expected = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(WritePatchedOutput(*expected, data) == 0);
+
+    // small buffers, so that patches land in buffers already handed off
+    auto memory = std::make_shared<AP4_MemoryByteStream>();
+    {
+        AP4_BufferedOutputStream buffered(memory, 1000, 2);
+        CHECK(WritePatchedOutput(buffered, data) == 0);
+        AP4_LargeSize size = 0;
+        CHECK(AP4_SUCCEEDED(buffered.GetSize(size)));
+        CHECK(size == expected->GetDataSize());
+
+        // reading back sees everything written so far
+        AP4_UI32 value = 0;
+        CHECK(AP4_SUCCEEDED(buffered.Seek(0)));
+        CHECK(AP4_SUCCEEDED(buffered.ReadUI32(value)));
+        CHECK(value == data.GetDataSize()+4);
+        CHECK(AP4_SUCCEEDED(buffered.Flush()));
+    }
+    CHECK(memory->GetDataSize() == expected->GetDataSize());
+    CHECK(memcmp(memory->GetData(), expected->GetData(), expected->GetDataSize()) == 0);
+
+    // files, with the default buffers
+    {
+        std::shared_ptr<AP4_ByteStream> output;
+        CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_WRITE, output)));
+        AP4_BufferedOutputStream buffered(output);
+        CHECK(WritePatchedOutput(buffered, data) == 0);
+    }
+    std::shared_ptr<AP4_ByteStream> file;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, file)));
+    AP4_DataBuffer written(expected->GetDataSize());
+    CHECK(AP4_SUCCEEDED(file->Read(written.UseData(), expected->GetDataSize())));
+    CHECK(memcmp(written.GetData(), expected->GetData(), expected->GetDataSize()) == 0);
+    file = NULL;
+    remove(filename);
+
+    // errors from the sink are reported
+    AP4_SubStream* limited = new AP4_SubStream(memory, 0, 5000);
+    {
+        AP4_BufferedOutputStream buffered(std::shared_ptr<AP4_ByteStream>(limited), 1000, 2);
+        AP4_Result result = AP4_SUCCESS;
+        for (unsigned int i=0; i<10 && AP4_SUCCEEDED(result); i++) {
+            result = buffered.Write(data.GetData(), 1000);
+        }
+        if (AP4_SUCCEEDED(result)) result = buffered.Flush();
+        CHECK(AP4_FAILED(result));
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   BufferChainTest
++---------------------------------------------------------------------*/
+static int
+BufferChainTest(const AP4_DataBuffer& data)
+{
+    // the data split into two shared buffers, referenced in several pieces
+    auto head = std::make_shared<AP4_DataBuffer>(data.GetData(), 60000);
+    auto tail = std::make_shared<AP4_DataBuffer>(data.GetData()+60000, TEST_DATA_SIZE-60000);
+    AP4_BufferChainByteStream chain;
+    CHECK(AP4_SUCCEEDED(chain.AppendReference(head, 0, 10000)));
+    CHECK(AP4_SUCCEEDED(chain.AppendReference(head, 10000, 20000)));
+    CHECK(AP4_SUCCEEDED(chain.AppendData(data.GetData()+30000, 5)));
+    CHECK(AP4_SUCCEEDED(chain.AppendData(data.GetData()+30005, 29995)));
+    CHECK(AP4_SUCCEEDED(chain.AppendReference(tail, 0, TEST_DATA_SIZE-60000)));
+    CHECK(chain.AppendReference(tail, 1, TEST_DATA_SIZE-60000) == AP4_ERROR_OUT_OF_RANGE);
+    AP4_LargeSize size = 0;
+    CHECK(AP4_SUCCEEDED(chain.GetSize(size)));
+    CHECK(size == TEST_DATA_SIZE);
+
+    // reads across slices, from anywhere
+    AP4_DataBuffer buffer(TEST_DATA_SIZE);
+    CHECK(AP4_SUCCEEDED(chain.Read(buffer.UseData(), TEST_DATA_SIZE)));
+    CHECK(memcmp(buffer.GetData(), data.GetData(), TEST_DATA_SIZE) == 0);
+    CHECK(chain.Read(buffer.UseData(), 1) == AP4_ERROR_EOS);
+    CHECK(AP4_SUCCEEDED(chain.Seek(29990)));
+    CHECK(AP4_SUCCEEDED(chain.Read(buffer.UseData(), 20)));
+    CHECK(memcmp(buffer.GetData(), data.GetData()+29990, 20) == 0);
+    CHECK(CheckReadAt(chain, data.GetData(), TEST_DATA_SIZE) == 0);
+    CHECK(chain.Seek(TEST_DATA_SIZE+1) == AP4_ERROR_OUT_OF_RANGE);
+
+    // copies, without going through an intermediate buffer
+    AP4_MemoryByteStream copy;
+    CHECK(AP4_SUCCEEDED(chain.Seek(5)));
+    CHECK(AP4_SUCCEEDED(chain.CopyTo(copy, TEST_DATA_SIZE-5)));
+    CHECK(copy.GetDataSize() == TEST_DATA_SIZE-5);
+    CHECK(memcmp(copy.GetData(), data.GetData()+5, TEST_DATA_SIZE-5) == 0);
+
+    // the chain is read-only
+    CHECK(AP4_FAILED(chain.Write(data.GetData(), 1)));
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int argc, char** argv)
+{
+    const char* filename = argc > 1 ? argv[1] : "bytestreamtest.tmp";
+
+    AP4_DataBuffer data;
+    MakeTestData(data);
+
+    CHECK(DataViewTest(data) == 0);
+    CHECK(BatchReadTest(data) == 0);
+    CHECK(MappedFileTest(data, filename) == 0);
+    CHECK(ReadAtTest(data, filename) == 0);
+    CHECK(BufferedOutputTest(data, filename) == 0);
+    CHECK(BufferChainTest(data) == 0);
+
+    printf("OK\n");
+    return 0;
+}
@@ -34,10 +34,18 @@
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "Ap4AesBlockCipher.h"
 #include "Ap4Hmac.h"
 #include "Ap4KeyWrap.h"
 
+#include <memory>
+
+#if !defined(REPEAT_COUNT)
 #define REPEAT_COUNT 10000
+#endif
+#if !defined(RUN_COUNT)
+#define RUN_COUNT 1000
+#endif
 
 unsigned char __1_bin[] = {
   0x48
@@ -1790,7 +1798,7 @@ TestCtrStreamCipher()
         CHECK(BuffersEqual(TestVectors3[i].clear, buffer, size));
     }
 
-    for (int run=0; run<1000; run++) {
+    for (int run=0; run<RUN_COUNT; run++) {
         for (unsigned int i=0; i<sizeof(TestVectors3)/sizeof(TestVectors3[0]); i++) {
             printf("Encrypt Test Vector2 %d\n", i);
 
@@ -1932,11 +1940,11 @@ TestCtrStreamCipher()
 
             AP4_Result result;
             TestVector& vector = TestVectors3[i];
-            AP4_ByteStream* cleartext_stream = new AP4_MemoryByteStream(vector.clear, vector.clear_length);
+            std::shared_ptr<AP4_ByteStream> cleartext_stream = std::make_shared<AP4_MemoryByteStream>(vector.clear, vector.clear_length);
             
-            AP4_ByteStream* encrypting_stream = NULL;
+            std::shared_ptr<AP4_ByteStream> encrypting_stream;
             result = AP4_EncryptingStream::Create(AP4_BlockCipher::CTR,
-                                                  *cleartext_stream,
+                                                  cleartext_stream,
                                                   iv,
                                                   16,
                                                   key,
@@ -1959,8 +1967,6 @@ TestCtrStreamCipher()
             CHECK(result == AP4_ERROR_EOS);
             CHECK(total_read == vector.enc_length);
             
-            encrypting_stream->Release();
-            cleartext_stream->Release();
         }
 
         for (unsigned int i=0; i<sizeof(TestVectors3)/sizeof(TestVectors3[0]); i++) {
@@ -1968,11 +1974,11 @@ TestCtrStreamCipher()
 
             AP4_Result result;
             TestVector& vector = TestVectors3[i];
-            AP4_ByteStream* encrypted_stream = new AP4_MemoryByteStream(vector.enc, vector.enc_length);
+            std::shared_ptr<AP4_ByteStream> encrypted_stream = std::make_shared<AP4_MemoryByteStream>(vector.enc, vector.enc_length);
             
-            AP4_ByteStream* decrypting_stream = NULL;
+            std::shared_ptr<AP4_ByteStream> decrypting_stream;
             result = AP4_DecryptingStream::Create(AP4_BlockCipher::CTR,
-                                                  *encrypted_stream,
+                                                  encrypted_stream,
                                                   vector.clear_length,
                                                   iv,
                                                   16,
@@ -2008,8 +2014,6 @@ TestCtrStreamCipher()
                 CHECK(BuffersEqual(vector.clear+position, out_buffer, out_size));
             }            
 
-            decrypting_stream->Release();
-            encrypted_stream->Release();
         }
     }
 
@@ -2078,7 +2082,7 @@ TestCbcStreamCipher()
         CHECK(BuffersEqual(TestVectors[i].clear, buffer, size));
     }
 
-    for (int run=0; run<1000; run++) {
+    for (int run=0; run<RUN_COUNT; run++) {
         for (unsigned int i=0; i<sizeof(TestVectors2)/sizeof(TestVectors2[0]); i++) {
             printf("Encrypt Test Vector2 %d\n", i);
 
@@ -2220,11 +2224,11 @@ TestCbcStreamCipher()
 
             AP4_Result result;
             TestVector& vector = TestVectors2[i];
-            AP4_ByteStream* cleartext_stream = new AP4_MemoryByteStream(vector.clear, vector.clear_length);
+            std::shared_ptr<AP4_ByteStream> cleartext_stream = std::make_shared<AP4_MemoryByteStream>(vector.clear, vector.clear_length);
             
-            AP4_ByteStream* encrypting_stream = NULL;
+            std::shared_ptr<AP4_ByteStream> encrypting_stream;
             result = AP4_EncryptingStream::Create(AP4_BlockCipher::CBC,
-                                                  *cleartext_stream,
+                                                  cleartext_stream,
                                                   iv,
                                                   16,
                                                   key,
@@ -2247,8 +2251,6 @@ TestCbcStreamCipher()
             CHECK(result == AP4_ERROR_EOS);
             CHECK(total_read == vector.enc_length);
             
-            encrypting_stream->Release();
-            cleartext_stream->Release();
         }
 
         for (unsigned int i=0; i<sizeof(TestVectors2)/sizeof(TestVectors2[0]); i++) {
@@ -2256,11 +2258,11 @@ TestCbcStreamCipher()
 
             AP4_Result result;
             TestVector& vector = TestVectors2[i];
-            AP4_ByteStream* encrypted_stream = new AP4_MemoryByteStream(vector.enc, vector.enc_length);
+            std::shared_ptr<AP4_ByteStream> encrypted_stream = std::make_shared<AP4_MemoryByteStream>(vector.enc, vector.enc_length);
             
-            AP4_ByteStream* decrypting_stream = NULL;
+            std::shared_ptr<AP4_ByteStream> decrypting_stream;
             result = AP4_DecryptingStream::Create(AP4_BlockCipher::CBC,
-                                                  *encrypted_stream,
+                                                  encrypted_stream,
                                                   vector.clear_length,
                                                   iv,
                                                   16,
@@ -2296,8 +2298,222 @@ TestCbcStreamCipher()
                 CHECK(BuffersEqual(vector.clear+position, out_buffer, out_size));
             }            
 
-            decrypting_stream->Release();
-            encrypted_stream->Release();
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CreateStreamCipher
++---------------------------------------------------------------------*/
+static AP4_StreamCipher*
+CreateStreamCipher(AP4_BlockCipher::CipherMode      mode,
+                   AP4_BlockCipher::CipherDirection direction,
+                   const AP4_UI08*                  key)
+{
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = 8;
+    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128,
+                                                         direction,
+                                                         mode,
+                                                         mode == AP4_BlockCipher::CTR ? &ctr_params : NULL,
+                                                         key,
+                                                         16,
+                                                         block_cipher);
+    if (mode == AP4_BlockCipher::CTR) {
+        return new AP4_CtrStreamCipher(block_cipher, 8);
+    } else {
+        return new AP4_CbcStreamCipher(block_cipher);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   CheckSubSampleMap
++---------------------------------------------------------------------*/
+static int
+CheckSubSampleMap(AP4_BlockCipher::CipherMode      mode,
+                  AP4_BlockCipher::CipherDirection direction,
+                  AP4_UI08                         crypt_byte_block,
+                  AP4_UI08                         skip_byte_block,
+                  const AP4_UI08*                  key,
+                  const AP4_UI08*                  iv,
+                  AP4_Array<AP4_UI16>&             bytes_of_cleartext_data,
+                  AP4_Array<AP4_UI32>&             bytes_of_encrypted_data)
+{
+    bool pattern = crypt_byte_block != 0;
+    unsigned int subsample_count = bytes_of_cleartext_data.ItemCount();
+    AP4_Size sample_size = 0;
+    bool aligned = true;
+    for (unsigned int i=0; i<subsample_count; i++) {
+        sample_size += bytes_of_cleartext_data[i]+bytes_of_encrypted_data[i];
+        if (bytes_of_encrypted_data[i]%16) aligned = false;
+    }
+    AP4_DataBuffer input(sample_size);
+    input.SetDataSize(sample_size);
+    for (unsigned int i=0; i<sample_size; i++) {
+        input.UseData()[i] = (AP4_UI08)rand();
+    }
+
+    // reference: one block at a time for aligned patterns, one range at a
+    // time otherwise (with a pattern cipher, an unaligned range followed by
+    // another encrypted range is an error)
+    AP4_DataBuffer expected(sample_size);
+    expected.SetDataSize(sample_size);
+    AP4_Result expected_result = AP4_SUCCESS;
+    AP4_StreamCipher* reference = CreateStreamCipher(mode, direction, key);
+    if (pattern && !aligned) {
+        reference = new AP4_PatternStreamCipher(reference, crypt_byte_block, skip_byte_block);
+    }
+    reference->SetIV(iv);
+    const AP4_UI08* in  = input.GetData();
+    AP4_UI08*       out = expected.UseData();
+    unsigned int    block_index = 0;
+    for (unsigned int i=0; i<subsample_count && AP4_SUCCEEDED(expected_result); i++) {
+        AP4_CopyMemory(out, in, bytes_of_cleartext_data[i]);
+        in  += bytes_of_cleartext_data[i];
+        out += bytes_of_cleartext_data[i];
+        if (pattern && aligned) {
+            unsigned int span = crypt_byte_block+skip_byte_block;
+            for (unsigned int b=0; b<bytes_of_encrypted_data[i]/16; b++, block_index++) {
+                if (block_index%span < crypt_byte_block) {
+                    AP4_Size out_size = 16;
+                    CHECK(reference->ProcessBuffer(in, 16, out, &out_size) == AP4_SUCCESS);
+                    CHECK(out_size == 16);
+                } else {
+                    AP4_CopyMemory(out, in, 16);
+                }
+                in  += 16;
+                out += 16;
+            }
+        } else if (bytes_of_encrypted_data[i]) {
+            AP4_Size out_size = bytes_of_encrypted_data[i];
+            expected_result = reference->ProcessBuffer(in, bytes_of_encrypted_data[i], out, &out_size);
+            if (AP4_SUCCEEDED(expected_result)) CHECK(out_size == bytes_of_encrypted_data[i]);
+            in  += bytes_of_encrypted_data[i];
+            out += bytes_of_encrypted_data[i];
+        }
+    }
+    delete reference;
+
+    // batched
+    AP4_StreamCipher* cipher = CreateStreamCipher(mode, direction, key);
+    if (pattern) {
+        cipher = new AP4_PatternStreamCipher(cipher, crypt_byte_block, skip_byte_block);
+    }
+    cipher->SetIV(iv);
+    AP4_DataBuffer output(sample_size);
+    output.SetDataSize(sample_size);
+    AP4_DataBuffer scratch;
+    AP4_Result result = cipher->ProcessSubSamples(input.GetData(),
+                                                  output.UseData(),
+                                                  subsample_count,
+                                                  &bytes_of_cleartext_data[0],
+                                                  &bytes_of_encrypted_data[0],
+                                                  scratch);
+    delete cipher;
+    CHECK(result == expected_result);
+    if (AP4_SUCCEEDED(result)) {
+        CHECK(BuffersEqual(output.GetData(), expected.GetData(), sample_size));
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestSubSampleCiphers
++---------------------------------------------------------------------*/
+static int
+TestSubSampleCiphers()
+{
+    AP4_UI08 key[16] = {
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+    };
+    AP4_UI08 iv[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfe
+    };
+    struct {
+        AP4_BlockCipher::CipherMode      mode;
+        AP4_BlockCipher::CipherDirection direction;
+        AP4_UI08                         crypt_byte_block;
+        AP4_UI08                         skip_byte_block;
+    } configs[] = {
+        { AP4_BlockCipher::CTR, AP4_BlockCipher::ENCRYPT, 0, 0 },
+        { AP4_BlockCipher::CTR, AP4_BlockCipher::DECRYPT, 0, 0 },
+        { AP4_BlockCipher::CTR, AP4_BlockCipher::ENCRYPT, 1, 1 },
+        { AP4_BlockCipher::CTR, AP4_BlockCipher::DECRYPT, 1, 9 },
+        { AP4_BlockCipher::CBC, AP4_BlockCipher::ENCRYPT, 1, 9 },
+        { AP4_BlockCipher::CBC, AP4_BlockCipher::DECRYPT, 1, 9 },
+        { AP4_BlockCipher::CBC, AP4_BlockCipher::DECRYPT, 5, 5 },
+        { AP4_BlockCipher::CBC, AP4_BlockCipher::DECRYPT, 0, 0 }
+    };
+
+    for (unsigned int c=0; c<sizeof(configs)/sizeof(configs[0]); c++) {
+        bool cbc = configs[c].mode == AP4_BlockCipher::CBC;
+        for (unsigned int t=0; t<REPEAT_COUNT/10; t++) {
+            // make up a subsample map, with unaligned ranges every other
+            // time (CBC only supports full blocks)
+            bool full_blocks_only = cbc || (t%2 == 0);
+            AP4_Array<AP4_UI16> bytes_of_cleartext_data;
+            AP4_Array<AP4_UI32> bytes_of_encrypted_data;
+            unsigned int subsample_count = 1+rand()%8;
+            for (unsigned int i=0; i<subsample_count; i++) {
+                AP4_UI16 cleartext_size = (AP4_UI16)(rand()%64);
+                AP4_UI32 encrypted_size = (AP4_UI32)(rand()%(i%3 ? 700 : 40));
+                if (full_blocks_only) encrypted_size -= encrypted_size%16;
+                bytes_of_cleartext_data.Append(cleartext_size);
+                bytes_of_encrypted_data.Append(encrypted_size);
+            }
+            int result = CheckSubSampleMap(configs[c].mode,
+                                           configs[c].direction,
+                                           configs[c].crypt_byte_block,
+                                           configs[c].skip_byte_block,
+                                           key,
+                                           iv,
+                                           bytes_of_cleartext_data,
+                                           bytes_of_encrypted_data);
+            if (result) return result;
+        }
+    }
+
+    // unaligned pattern ranges must not be joined: with 1:1, gathering
+    // {24, 40} would encrypt the second range from the middle of a block
+    struct {
+        AP4_UI32   encrypted_sizes[2];
+        AP4_Result result;
+    } unaligned[] = {
+        { { 24, 40 }, AP4_ERROR_INVALID_FORMAT },
+        { { 32, 40 }, AP4_SUCCESS },
+        { { 0,  40 }, AP4_SUCCESS }
+    };
+    for (unsigned int u=0; u<sizeof(unaligned)/sizeof(unaligned[0]); u++) {
+        AP4_Array<AP4_UI16> bytes_of_cleartext_data;
+        AP4_Array<AP4_UI32> bytes_of_encrypted_data;
+        for (unsigned int i=0; i<2; i++) {
+            bytes_of_cleartext_data.Append(4);
+            bytes_of_encrypted_data.Append(unaligned[u].encrypted_sizes[i]);
+        }
+        for (unsigned int d=0; d<2; d++) {
+            AP4_BlockCipher::CipherDirection direction = d ? AP4_BlockCipher::DECRYPT : AP4_BlockCipher::ENCRYPT;
+            int result = CheckSubSampleMap(AP4_BlockCipher::CTR, direction, 1, 1, key, iv,
+                                           bytes_of_cleartext_data,
+                                           bytes_of_encrypted_data);
+            if (result) return result;
+
+            // the outcome must also be what the spec mandates, not just
+            // what the reference does
+            AP4_StreamCipher* cipher = new AP4_PatternStreamCipher(CreateStreamCipher(AP4_BlockCipher::CTR, direction, key), 1, 1);
+            cipher->SetIV(iv);
+            AP4_UI08 sample[4+24+4+40+8] = {0};
+            AP4_UI08 output[sizeof(sample)];
+            AP4_DataBuffer scratch;
+            AP4_Result outcome = cipher->ProcessSubSamples(sample, output, 2,
+                                                           &bytes_of_cleartext_data[0],
+                                                           &bytes_of_encrypted_data[0],
+                                                           scratch);
+            delete cipher;
+            CHECK(outcome == unaligned[u].result);
         }
     }
 
@@ -2315,14 +2531,26 @@ main(int /*argc*/, char** /*argv*/)
     result = TestKeyWrap();
     if (result) return result;
     
-    result = TestBlockCiphers();
-    if (result) return result;
+    // run the cipher tests with the hardware AES kernels (when available)
+    // and with the portable implementation
+    for (unsigned int pass=0; pass<2; pass++) {
+        bool hardware = (pass == 0);
+        if (hardware && !AP4_AesBlockCipher::IsHardwareAccelerationAvailable()) continue;
+        printf("=== AES %s\n", hardware ? "hardware" : "portable");
+        AP4_AesBlockCipher::EnableHardwareAcceleration(hardware);
 
-    result = TestCtrStreamCipher();
-    if (result) return result;
+        result = TestBlockCiphers();
+        if (result) return result;
 
-    result = TestCbcStreamCipher();
-    if (result) return result;
+        result = TestCtrStreamCipher();
+        if (result) return result;
+
+        result = TestCbcStreamCipher();
+        if (result) return result;
+
+        result = TestSubSampleCiphers();
+        if (result) return result;
+    }
     
     return 0;
 }
@@ -0,0 +1,327 @@
+/*****************************************************************
+|
+|    AP4 - MPEG2 Transport Stream Writer Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Ap4.h"
+
+#include <memory>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
+|
+|   The expected digests were produced by the per-packet implementation
+|   of the writer that preceded the in-place packetizer, by running this
+|   test with --print against it. Any change to the packet output,
+|   including to stuffing, PCR or continuity counters, changes them.
++---------------------------------------------------------------------*/
+const unsigned int TS_PACKET_SIZE = 188;
+const AP4_UI64     EXPECTED_PES_DIGEST  = 0xCE6BAB42BC2161E9ULL;
+const AP4_UI64     EXPECTED_FILE_DIGEST = 0xFACA38C850517728ULL;
+
+static bool PrintDigests = false;
+
+/*----------------------------------------------------------------------
+|   Digest
++---------------------------------------------------------------------*/
+static AP4_UI64
+Digest(const AP4_DataBuffer& buffer)
+{
+    // 64-bit FNV-1a
+    AP4_UI64 digest = 0xCBF29CE484222325ULL;
+    for (unsigned int i=0; i<buffer.GetDataSize(); i++) {
+        digest ^= buffer.GetData()[i];
+        digest *= 0x100000001B3ULL;
+    }
+    return digest;
+}
+
+/*----------------------------------------------------------------------
+|   CheckDigest
++---------------------------------------------------------------------*/
+static int
+CheckDigest(const char* name, const AP4_DataBuffer& buffer, AP4_UI64 expected)
+{
+    AP4_UI64 digest = Digest(buffer);
+    if (PrintDigests) {
+        printf("%s: size=%u digest=0x%016llXULL\n", name, (unsigned int)buffer.GetDataSize(), (unsigned long long)digest);
+        return 0;
+    }
+    if (digest != expected) {
+        fprintf(stderr, "%s: digest 0x%016llX, expected 0x%016llX\n", name, (unsigned long long)digest, (unsigned long long)expected);
+        return -1;
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   PesCollector
+|
+|   Checks the TS packet layer and reassembles the PES packets of one PID
++---------------------------------------------------------------------*/
+class PesCollector {
+public:
+    PesCollector(AP4_UI16 pid) : m_PID(pid) {}
+
+    // returns false if the packet layer is not valid
+    bool Parse(const AP4_DataBuffer& packets) {
+        int continuity_counters[8192];
+        for (unsigned int i=0; i<8192; i++) continuity_counters[i] = -1;
+        m_PesPackets.Clear();
+        if (packets.GetDataSize()%TS_PACKET_SIZE) return false;
+        for (const AP4_UI08* packet = packets.GetData();
+             packet < packets.GetData()+packets.GetDataSize();
+             packet += TS_PACKET_SIZE) {
+            if (packet[0] != 0x47) return false;
+            bool         payload_start = (packet[1]&0x40) != 0;
+            unsigned int pid = ((packet[1]&0x1F)<<8) | packet[2];
+            unsigned int adaptation_field_control = (packet[3]>>4)&3;
+            unsigned int continuity_counter = packet[3]&0x0F;
+            if (adaptation_field_control == 0) return false;
+            if (adaptation_field_control & 1) {
+                // the counter only increments for packets with a payload
+                if (continuity_counters[pid] >= 0 &&
+                    continuity_counter != ((unsigned int)continuity_counters[pid]+1)%16) {
+                    return false;
+                }
+                continuity_counters[pid] = continuity_counter;
+            }
+            unsigned int payload_offset = 4;
+            if (adaptation_field_control & 2) {
+                payload_offset += 1+packet[4];
+                if (payload_offset > TS_PACKET_SIZE) return false;
+            }
+            if (pid != m_PID || (adaptation_field_control & 1) == 0) continue;
+            if (payload_start) {
+                m_PesPackets.Append(AP4_DataBuffer());
+            } else if (m_PesPackets.ItemCount() == 0) {
+                return false;
+            }
+            AP4_DataBuffer& pes = m_PesPackets[m_PesPackets.ItemCount()-1];
+            pes.AppendData(packet+payload_offset, TS_PACKET_SIZE-payload_offset);
+        }
+        return true;
+    }
+
+    // returns the payload of a PES packet, or NULL if its header is not valid
+    const AP4_UI08* GetPayload(unsigned int index, unsigned int& payload_size) {
+        const AP4_DataBuffer& pes = m_PesPackets[index];
+        if (pes.GetDataSize() < 9) return NULL;
+        const AP4_UI08* data = pes.GetData();
+        if (data[0] != 0 || data[1] != 0 || data[2] != 1) return NULL;
+        unsigned int header_size = 9+data[8];
+        if (header_size > pes.GetDataSize()) return NULL;
+        payload_size = pes.GetDataSize()-header_size;
+        return data+header_size;
+    }
+
+    AP4_UI16                  m_PID;
+    AP4_Array<AP4_DataBuffer> m_PesPackets;
+};
+
+/*----------------------------------------------------------------------
+|   RawSampleStream
++---------------------------------------------------------------------*/
+class RawSampleStream : public AP4_Mpeg2TsWriter::SampleStream {
+public:
+    RawSampleStream(AP4_UI16 pid) :
+        AP4_Mpeg2TsWriter::SampleStream(pid, AP4_MPEG2_STREAM_TYPE_ISO_IEC_13818_1_PES, 0xBD, 90000, NULL, 0) {}
+
+    virtual AP4_Result WriteSample(AP4_Sample&            sample,
+                                   AP4_DataBuffer&        sample_data,
+                                   AP4_SampleDescription* /* sample_description */,
+                                   bool                   with_pcr,
+                                   AP4_ByteStream&        output) {
+        return WritePES(sample_data.GetData(),
+                        sample_data.GetDataSize(),
+                        sample.GetDts(),
+                        true,
+                        sample.GetCts(),
+                        with_pcr,
+                        output);
+    }
+};
+
+/*----------------------------------------------------------------------
+|   TestWritePES
+|
+|   Write PES packets of sizes around the packet boundaries, with and
+|   without DTS and PCR, and check that they can be reassembled.
++---------------------------------------------------------------------*/
+static int
+TestWritePES()
+{
+    AP4_DataBuffer                  packets;
+    std::shared_ptr<AP4_ByteStream> output = std::make_shared<AP4_MemoryByteStream>(packets);
+    RawSampleStream                 stream(0x123);
+    AP4_DataBuffer                  data;
+    AP4_Array<unsigned int>         sizes;
+
+    for (unsigned int size=0; size<=400; size++) sizes.Append(size);
+    sizes.Append(1000);
+    sizes.Append(65535);
+    sizes.Append(65536);
+    sizes.Append(100000);
+
+    AP4_UI64 dts = 0;
+    for (unsigned int i=0; i<sizes.ItemCount(); i++) {
+        data.SetDataSize(sizes[i]);
+        for (unsigned int j=0; j<sizes[i]; j++) {
+            data.UseData()[j] = (AP4_UI08)(i+j*7);
+        }
+        bool with_dts = (i%2) == 0;
+        bool with_pcr = (i%3) == 0;
+        CHECK(AP4_SUCCEEDED(stream.WritePES(data.GetData(), data.GetDataSize(), dts, with_dts, dts+3000, with_pcr, *output)));
+        dts += 1001;
+    }
+
+    PesCollector collector(0x123);
+    CHECK(collector.Parse(packets));
+    CHECK(collector.m_PesPackets.ItemCount() == sizes.ItemCount());
+    for (unsigned int i=0; i<sizes.ItemCount(); i++) {
+        unsigned int    payload_size = 0;
+        const AP4_UI08* payload = collector.GetPayload(i, payload_size);
+        CHECK(payload != NULL);
+        CHECK(payload_size == sizes[i]);
+        for (unsigned int j=0; j<payload_size; j++) {
+            CHECK(payload[j] == (AP4_UI08)(i+j*7));
+        }
+    }
+
+    return CheckDigest("pes", packets, EXPECTED_PES_DIGEST);
+}
+
+/*----------------------------------------------------------------------
+|   TestWriteFile
+|
+|   Convert an MP4 file with AVC video and AAC audio the way mp42hls does.
++---------------------------------------------------------------------*/
+static int
+TestWriteFile(const char* filename)
+{
+    std::shared_ptr<AP4_ByteStream> input;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input)));
+    AP4_File   file(input, true);
+    AP4_Movie* movie = file.GetMovie();
+    CHECK(movie != NULL);
+    AP4_Track* audio_track = movie->GetTrack(AP4_Track::TYPE_AUDIO);
+    AP4_Track* video_track = movie->GetTrack(AP4_Track::TYPE_VIDEO);
+    CHECK(audio_track != NULL && video_track != NULL);
+
+    AP4_DataBuffer                   packets;
+    std::shared_ptr<AP4_ByteStream>  output = std::make_shared<AP4_MemoryByteStream>(packets);
+    AP4_Mpeg2TsWriter                writer;
+    AP4_Mpeg2TsWriter::SampleStream* audio_stream = NULL;
+    AP4_Mpeg2TsWriter::SampleStream* video_stream = NULL;
+    CHECK(AP4_SUCCEEDED(writer.SetAudioStream(audio_track->GetMediaTimeScale(),
+                                              AP4_MPEG2_STREAM_TYPE_ISO_IEC_13818_7,
+                                              AP4_MPEG2_TS_DEFAULT_STREAM_ID_AUDIO,
+                                              audio_stream)));
+    CHECK(AP4_SUCCEEDED(writer.SetVideoStream(video_track->GetMediaTimeScale(),
+                                              AP4_MPEG2_STREAM_TYPE_AVC,
+                                              AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO,
+                                              video_stream)));
+    CHECK(AP4_SUCCEEDED(writer.WritePAT(*output)));
+    CHECK(AP4_SUCCEEDED(writer.WritePMT(*output)));
+
+    // interleave the samples in decoding order
+    AP4_Ordinal    audio_index = 0;
+    AP4_Ordinal    video_index = 0;
+    AP4_Sample     sample;
+    AP4_DataBuffer sample_data;
+    while (audio_index < audio_track->GetSampleCount() || video_index < video_track->GetSampleCount()) {
+        bool use_audio = video_index >= video_track->GetSampleCount();
+        if (!use_audio && audio_index < audio_track->GetSampleCount()) {
+            AP4_Sample audio_sample;
+            AP4_Sample video_sample;
+            CHECK(AP4_SUCCEEDED(audio_track->GetSample(audio_index, audio_sample)));
+            CHECK(AP4_SUCCEEDED(video_track->GetSample(video_index, video_sample)));
+            use_audio = (double)audio_sample.GetDts()/(double)audio_track->GetMediaTimeScale() <=
+                        (double)video_sample.GetDts()/(double)video_track->GetMediaTimeScale();
+        }
+        if (use_audio) {
+            CHECK(AP4_SUCCEEDED(audio_track->ReadSample(audio_index, sample, sample_data)));
+            AP4_SampleDescription* description = audio_track->GetSampleDescription(sample.GetDescriptionIndex());
+            CHECK(AP4_SUCCEEDED(audio_stream->WriteSample(sample, sample_data, description, false, *output)));
+            ++audio_index;
+        } else {
+            CHECK(AP4_SUCCEEDED(video_track->GetSample(video_index, sample)));
+            AP4_SampleDescription* description = video_track->GetSampleDescription(sample.GetDescriptionIndex());
+            CHECK(AP4_SUCCEEDED(video_stream->WriteSample(sample, description, true, *output)));
+            ++video_index;
+        }
+    }
+
+    PesCollector audio(AP4_MPEG2_TS_DEFAULT_PID_AUDIO);
+    PesCollector video(AP4_MPEG2_TS_DEFAULT_PID_VIDEO);
+    CHECK(audio.Parse(packets));
+    CHECK(video.Parse(packets));
+    CHECK(audio.m_PesPackets.ItemCount() == audio_track->GetSampleCount());
+    CHECK(video.m_PesPackets.ItemCount() == video_track->GetSampleCount());
+
+    return CheckDigest("file", packets, EXPECTED_FILE_DIGEST);
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int argc, char** argv)
+{
+    const char* filename = NULL;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--print")) {
+            PrintDigests = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename == NULL) {
+        fprintf(stderr, "usage: Mpeg2TsTest [--print] <mp4-file>\n");
+        return 1;
+    }
+
+    int result = TestWritePES();
+    if (result) return result;
+    result = TestWriteFile(filename);
+    if (result) return result;
+
+    return 0;
+}
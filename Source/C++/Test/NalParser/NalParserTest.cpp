@@ -0,0 +1,243 @@
+/*****************************************************************
+|
+|    AP4 - NAL Parser Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Ap4.h"
+#include "Ap4NalParser.h"
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const unsigned int TEST_ITERATIONS = 200;
+
+/*----------------------------------------------------------------------
+|   MakeTestData
+|
+|   Random data with enough 00, 01 and 03 bytes to produce start codes,
+|   4-byte start codes, empty NAL units and emulation prevention bytes.
++---------------------------------------------------------------------*/
+static void
+MakeTestData(AP4_DataBuffer& data, AP4_Size size)
+{
+    data.SetDataSize(size);
+    AP4_UI08* bytes = data.UseData();
+    for (unsigned int i=0; i<size; i++) {
+        unsigned int r = (unsigned int)rand();
+        switch (r%10) {
+            case 0: case 1: case 2: case 3: bytes[i] = 0; break;
+            case 4: bytes[i] = 1; break;
+            case 5: bytes[i] = 3; break;
+            default: bytes[i] = (AP4_UI08)(r>>8); break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------
+|   ReferenceFindStartCode
++---------------------------------------------------------------------*/
+static AP4_Size
+ReferenceFindStartCode(const AP4_UI08* data, AP4_Size data_size)
+{
+    for (AP4_Size i=0; i+3 <= data_size; i++) {
+        if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1) return i;
+    }
+    return data_size;
+}
+
+/*----------------------------------------------------------------------
+|   ReferenceUnescape
++---------------------------------------------------------------------*/
+static void
+ReferenceUnescape(AP4_DataBuffer& data)
+{
+    unsigned int zero_count = 0;
+    unsigned int bytes_removed = 0;
+    AP4_UI08* out      = data.UseData();
+    const AP4_UI08* in = data.GetData();
+    AP4_Size  in_size  = data.GetDataSize();
+    for (unsigned int i=0; i<in_size; i++) {
+        if (zero_count == 2 && in[i] == 3 && i+1 < in_size && in[i+1] <= 3) {
+            ++bytes_removed;
+            zero_count = 0;
+        } else {
+            out[i-bytes_removed] = in[i];
+            zero_count = in[i] == 0 ? zero_count+1 : 0;
+        }
+    }
+    data.SetDataSize(in_size-bytes_removed);
+}
+
+/*----------------------------------------------------------------------
+|   ReferenceCountEmulationPreventionBytes
++---------------------------------------------------------------------*/
+static unsigned int
+ReferenceCountEmulationPreventionBytes(const AP4_UI08* data,
+                                       unsigned int    data_size,
+                                       unsigned int    unescaped_size)
+{
+    unsigned int zero_count = 0;
+    unsigned int bytes_produced = 0;
+    unsigned int emulation_prevention_bytes = 0;
+    if (data_size <= 2) return 0;
+    for (unsigned int i=0; i<data_size; i++) {
+        if (zero_count == 2 && data[i] == 3 && i+1 < data_size && data[i+1] <= 3) {
+            ++emulation_prevention_bytes;
+            zero_count = 0;
+        } else {
+            if (++bytes_produced >= unescaped_size) break;
+            zero_count = data[i] == 0 ? zero_count+1 : 0;
+        }
+    }
+    return emulation_prevention_bytes;
+}
+
+/*----------------------------------------------------------------------
+|   ScanTest
++---------------------------------------------------------------------*/
+static int
+ScanTest()
+{
+    AP4_DataBuffer data;
+    for (unsigned int i=0; i<TEST_ITERATIONS; i++) {
+        MakeTestData(data, 1+(AP4_Size)rand()%2000);
+        const AP4_UI08* bytes = data.GetData();
+        AP4_Size        size  = data.GetDataSize();
+
+        // start codes, from every possible alignment
+        for (AP4_Size offset=0; offset<size && offset<64; offset++) {
+            CHECK(AP4_NalParser::FindStartCode(bytes+offset, size-offset) ==
+                  ReferenceFindStartCode(bytes+offset, size-offset));
+        }
+
+        // emulation prevention bytes
+        for (unsigned int j=0; j<8; j++) {
+            unsigned int unescaped_size = (unsigned int)rand()%(size+8);
+            CHECK(AP4_NalParser::CountEmulationPreventionBytes(bytes, size, unescaped_size) ==
+                  ReferenceCountEmulationPreventionBytes(bytes, size, unescaped_size));
+        }
+        AP4_DataBuffer escaped(data);
+        AP4_DataBuffer expected(data);
+        AP4_NalParser::Unescape(escaped);
+        ReferenceUnescape(expected);
+        CHECK(escaped.GetDataSize() == expected.GetDataSize());
+        CHECK(memcmp(escaped.GetData(), expected.GetData(), expected.GetDataSize()) == 0);
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   FeedTest
++---------------------------------------------------------------------*/
+static int
+FeedTest()
+{
+    AP4_DataBuffer data;
+    for (unsigned int i=0; i<TEST_ITERATIONS; i++) {
+        MakeTestData(data, 1+(AP4_Size)rand()%5000);
+        const AP4_UI08* bytes = data.GetData();
+        AP4_Size        size  = data.GetDataSize();
+
+        // find all the NAL units at once
+        AP4_Array<AP4_NalUnitRange> nal_units;
+        AP4_Size bytes_consumed = 0;
+        CHECK(AP4_SUCCEEDED(AP4_NalParser::FindNalUnits(bytes, size, nal_units, bytes_consumed, true)));
+        CHECK(bytes_consumed == size);
+
+        // the same NAL units must come out of Feed with arbitrary chunking
+        AP4_NalParser parser;
+        AP4_Size      offset = 0;
+        AP4_Cardinal  count  = 0;
+        for (;;) {
+            AP4_Size chunk = 1+(AP4_Size)rand()%100;
+            if (chunk > size-offset) chunk = size-offset;
+            bool eos = (offset+chunk == size);
+            const AP4_DataBuffer* nalu = NULL;
+            CHECK(AP4_SUCCEEDED(parser.Feed(bytes+offset, chunk, bytes_consumed, nalu, eos)));
+            offset += bytes_consumed;
+            if (nalu) {
+                CHECK(count < nal_units.ItemCount());
+                const AP4_NalUnitRange& range = nal_units[count++];
+                CHECK(nalu->GetDataSize() == range.m_Size);
+                CHECK(memcmp(nalu->GetData(), bytes+range.m_Offset, range.m_Size) == 0);
+            } else if (offset == size) {
+                break;
+            }
+        }
+        CHECK(count == nal_units.ItemCount());
+
+        // scanning in pieces must give the same result as scanning at once
+        AP4_Array<AP4_NalUnitRange> pieces;
+        AP4_Size base = 0;
+        AP4_Size end  = 0;
+        for (;;) {
+            end += 1+(AP4_Size)rand()%1000;
+            if (end > size) end = size;
+            AP4_Array<AP4_NalUnitRange> found;
+            CHECK(AP4_SUCCEEDED(AP4_NalParser::FindNalUnits(bytes+base, end-base, found, bytes_consumed, end == size)));
+            for (unsigned int j=0; j<found.ItemCount(); j++) {
+                found[j].m_Offset += base;
+                pieces.Append(found[j]);
+            }
+            base += bytes_consumed;
+            if (end == size) break;
+        }
+        CHECK(pieces.ItemCount() == nal_units.ItemCount());
+        for (unsigned int j=0; j<pieces.ItemCount(); j++) {
+            CHECK(pieces[j].m_Offset == nal_units[j].m_Offset);
+            CHECK(pieces[j].m_Size   == nal_units[j].m_Size);
+        }
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    srand(1);
+    if (ScanTest()) return 1;
+    if (FeedTest()) return 1;
+
+    printf("NalParser tests passed\n");
+    return 0;
+}
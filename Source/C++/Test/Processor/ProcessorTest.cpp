@@ -0,0 +1,343 @@
+/*****************************************************************
+|
+|    AP4 - Processor Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+#include <memory>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const unsigned int TEST_SEGMENT_COUNT       = 24;
+const unsigned int TEST_SAMPLES_PER_SEGMENT = 40;
+
+/*----------------------------------------------------------------------
+|   NextRandom
++---------------------------------------------------------------------*/
+static AP4_UI32
+NextRandom(AP4_UI32& state)
+{
+    state = state*1664525+1013904223;
+    return state>>8;
+}
+
+/*----------------------------------------------------------------------
+|   TestSegmentBuilder
++---------------------------------------------------------------------*/
+class TestSegmentBuilder : public AP4_AacSegmentBuilder
+{
+public:
+    TestSegmentBuilder() : AP4_AacSegmentBuilder(1) {
+        unsigned char aac_dsi[2] = { 0x11, 0x90 }; // AAC LC, 48kHz, stereo
+        AP4_DataBuffer dsi(aac_dsi, 2);
+        m_SampleDescription = new AP4_MpegAudioSampleDescription(AP4_OTI_MPEG4_AUDIO,
+                                                                 48000, 16, 2, &dsi,
+                                                                 6144, 128000, 128000);
+        m_Timescale = 48000;
+    }
+};
+
+/*----------------------------------------------------------------------
+|   CreateFragmentedInput
++---------------------------------------------------------------------*/
+static int
+CreateFragmentedInput(std::shared_ptr<AP4_MemoryByteStream>& output)
+{
+    TestSegmentBuilder builder;
+    output = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(builder.WriteInitSegment(*output) == AP4_SUCCESS);
+
+    AP4_UI32 random = 1234;
+    for (unsigned int i=0; i<TEST_SEGMENT_COUNT; i++) {
+        for (unsigned int j=0; j<TEST_SAMPLES_PER_SEGMENT; j++) {
+            AP4_Size size = 100+NextRandom(random)%500;
+            auto sample_data = std::make_shared<AP4_MemoryByteStream>(size);
+            for (unsigned int x=0; x<size; x++) {
+                sample_data->WriteUI08((AP4_UI08)NextRandom(random));
+            }
+            AP4_Sample sample(sample_data, 0, size, 1024, 0, 0, 0, true);
+            CHECK(builder.AddSample(sample) == AP4_SUCCESS);
+        }
+        CHECK(builder.WriteMediaSegment(*output, i+1) == AP4_SUCCESS);
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   BuffersEqual
++---------------------------------------------------------------------*/
+static bool
+BuffersEqual(AP4_MemoryByteStream& a, AP4_MemoryByteStream& b)
+{
+    return a.GetDataSize() == b.GetDataSize() &&
+           AP4_CompareMemory(a.GetData(), b.GetData(), a.GetDataSize()) == 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestEncryptingProcessor
++---------------------------------------------------------------------*/
+class TestEncryptingProcessor : public AP4_CencEncryptingProcessor
+{
+public:
+    TestEncryptingProcessor(AP4_CencVariant variant, AP4_UI32 options) :
+        AP4_CencEncryptingProcessor(variant, options),
+        m_IndependentFragmentCount(0) {}
+
+    // AP4_Processor methods
+    virtual AP4_Processor::FragmentHandler* CreateFragmentHandler(AP4_TrakAtom*      trak,
+                                                                  AP4_TrexAtom*      trex,
+                                                                  AP4_ContainerAtom* traf,
+                                                                  AP4_ByteStream&    moof_data,
+                                                                  AP4_Position       moof_offset) {
+        AP4_Processor::FragmentHandler* handler =
+            AP4_CencEncryptingProcessor::CreateFragmentHandler(trak, trex, traf, moof_data, moof_offset);
+        if (handler && handler->IsIndependent()) ++m_IndependentFragmentCount;
+        return handler;
+    }
+
+    // members
+    unsigned int m_IndependentFragmentCount;
+};
+
+/*----------------------------------------------------------------------
+|   Encrypt
++---------------------------------------------------------------------*/
+static int
+Encrypt(std::shared_ptr<AP4_ByteStream>        input,
+        unsigned int                           thread_count,
+        std::shared_ptr<AP4_MemoryByteStream>& output,
+        AP4_CencVariant                        variant = AP4_CENC_VARIANT_MPEG_CENC,
+        AP4_UI32                               options = 0,
+        const char*                            clear_lead = NULL,
+        unsigned int*                          independent_fragment_count = NULL)
+{
+    const AP4_UI08 key[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                               0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    // with 16-byte IVs, the block counter wraps around within the first
+    // fragments (8-byte IVs are followed by a zero block counter)
+    AP4_UI08 iv[16] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 };
+    if (options & AP4_CencEncryptingProcessor::OPTION_IV_SIZE_8) {
+        AP4_SetMemory(&iv[8], 0, 8);
+    }
+    TestEncryptingProcessor processor(variant, options);
+    for (AP4_UI32 track_id=1; track_id<=2; track_id++) {
+        processor.GetKeyMap().SetKey(track_id, key, 16, iv, 16);
+        processor.GetPropertyMap().SetProperty(track_id, "KID", "000102030405060708090a0b0c0d0e0f");
+        if (clear_lead) processor.GetPropertyMap().SetProperty(track_id, "ClearLeadFragments", clear_lead);
+    }
+    processor.SetThreadCount(thread_count);
+
+    output = std::make_shared<AP4_MemoryByteStream>();
+    input->Seek(0);
+    CHECK(processor.Process(input, *output) == AP4_SUCCESS);
+    if (independent_fragment_count) *independent_fragment_count = processor.m_IndependentFragmentCount;
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   Decrypt
++---------------------------------------------------------------------*/
+static int
+Decrypt(std::shared_ptr<AP4_ByteStream>       input,
+        unsigned int                          thread_count,
+        std::shared_ptr<AP4_MemoryByteStream>& output)
+{
+    const AP4_UI08 key[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                               0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    AP4_ProtectionKeyMap key_map;
+    key_map.SetKey(1, key, 16);
+    key_map.SetKey(2, key, 16);
+    AP4_CencDecryptingProcessor processor(&key_map);
+    processor.SetThreadCount(thread_count);
+
+    output = std::make_shared<AP4_MemoryByteStream>();
+    input->Seek(0);
+    CHECK(processor.Process(input, *output) == AP4_SUCCESS);
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CompareSamples
++---------------------------------------------------------------------*/
+static int
+CompareSamples(std::shared_ptr<AP4_ByteStream> a,
+               std::shared_ptr<AP4_ByteStream> b,
+               AP4_UI32                        track_id,
+               unsigned int&                   sample_count,
+               bool                            with_arena = false)
+{
+    // the second reader may parse its fragments into arenas, which must not
+    // change the result
+    AP4_LinearReader* readers[2] = { NULL, NULL };
+    std::shared_ptr<AP4_ByteStream> streams[2] = { a, b };
+    AP4_File* files[2] = { NULL, NULL };
+    for (unsigned int i=0; i<2; i++) {
+        streams[i]->Seek(0);
+        files[i] = new AP4_File(streams[i], true);
+        CHECK(files[i]->GetMovie());
+        readers[i] = new AP4_LinearReader(*files[i]->GetMovie(), streams[i]);
+        CHECK(readers[i]->EnableTrack(track_id) == AP4_SUCCESS);
+    }
+    if (with_arena) readers[1]->EnableFragmentArenas();
+    sample_count = 0;
+    for (;;) {
+        AP4_Sample     samples[2];
+        AP4_DataBuffer data[2];
+        AP4_Result     results[2];
+        for (unsigned int i=0; i<2; i++) {
+            results[i] = readers[i]->ReadNextSample(track_id, samples[i], data[i]);
+        }
+        CHECK(results[0] == results[1]);
+        if (AP4_FAILED(results[0])) break;
+        CHECK(data[0].GetDataSize() == data[1].GetDataSize());
+        CHECK(AP4_CompareMemory(data[0].GetData(), data[1].GetData(), data[0].GetDataSize()) == 0);
+        ++sample_count;
+    }
+    for (unsigned int i=0; i<2; i++) {
+        delete readers[i];
+        delete files[i];
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   EncryptionVariantsTest
++---------------------------------------------------------------------*/
+static int
+EncryptionVariantsTest(std::shared_ptr<AP4_ByteStream> clear,
+                       AP4_Cardinal                    track_count,
+                       AP4_Cardinal                    traf_count,
+                       AP4_Cardinal                    first_traf_count) // first of their track
+{
+    // fragments are encrypted concurrently when their IVs can be computed
+    // in advance (counter mode or constant IV), but not with CBC chaining,
+    // and the output must not depend on the number of threads
+    struct {
+        AP4_CencVariant variant;
+        AP4_UI32        options;
+        bool            independent;
+    } variants[] = {
+        { AP4_CENC_VARIANT_MPEG_CENC, 0,                                            true  },
+        { AP4_CENC_VARIANT_MPEG_CENC, AP4_CencEncryptingProcessor::OPTION_IV_SIZE_8, true  },
+        { AP4_CENC_VARIANT_MPEG_CENS, 0,                                            true  },
+        { AP4_CENC_VARIANT_MPEG_CBCS, 0,                                            true  },
+        { AP4_CENC_VARIANT_MPEG_CBC1, 0,                                            false },
+        { AP4_CENC_VARIANT_PIFF_CTR,  0,                                            true  }
+    };
+    for (unsigned int i=0; i<sizeof(variants)/sizeof(variants[0]); i++) {
+        for (unsigned int with_clear_lead=0; with_clear_lead<=1; with_clear_lead++) {
+            // the fragments of the cleartext lead are always independent
+            const char*  clear_lead = with_clear_lead ? "1" : NULL;
+            unsigned int expected   = variants[i].independent ? traf_count : with_clear_lead*first_traf_count;
+            std::shared_ptr<AP4_MemoryByteStream> encrypted;
+            std::shared_ptr<AP4_MemoryByteStream> encrypted_mt;
+            unsigned int independent_count = 0;
+            CHECK(Encrypt(clear, 1, encrypted, variants[i].variant, variants[i].options, clear_lead) == 0);
+            CHECK(Encrypt(clear, 4, encrypted_mt, variants[i].variant, variants[i].options, clear_lead, &independent_count) == 0);
+            CHECK(BuffersEqual(*encrypted, *encrypted_mt));
+            CHECK(independent_count == expected);
+            
+            // the decrypted samples must match the clear ones
+            if (variants[i].variant == AP4_CENC_VARIANT_PIFF_CTR) continue;
+            std::shared_ptr<AP4_MemoryByteStream> decrypted;
+            CHECK(Decrypt(encrypted_mt, 4, decrypted) == 0);
+            for (AP4_UI32 track_id=1; track_id<=track_count; track_id++) {
+                unsigned int sample_count = 0;
+                CHECK(CompareSamples(clear, decrypted, track_id, sample_count) == 0);
+                CHECK(sample_count > 0);
+            }
+        }
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int argc, char** argv)
+{
+    std::shared_ptr<AP4_MemoryByteStream> clear;
+    CHECK(CreateFragmentedInput(clear) == 0);
+
+    // encryption must give the same result whether or not worker threads
+    // are available
+    std::shared_ptr<AP4_MemoryByteStream> encrypted;
+    std::shared_ptr<AP4_MemoryByteStream> encrypted_mt;
+    CHECK(Encrypt(clear, 1, encrypted) == 0);
+    CHECK(Encrypt(clear, 4, encrypted_mt) == 0);
+    CHECK(BuffersEqual(*encrypted, *encrypted_mt));
+    CHECK(!BuffersEqual(*clear, *encrypted));
+    CHECK(EncryptionVariantsTest(clear, 1, TEST_SEGMENT_COUNT, 1) == 0);
+
+    // decryption with worker threads must be byte-identical to a
+    // single-threaded run
+    std::shared_ptr<AP4_MemoryByteStream> decrypted;
+    CHECK(Decrypt(encrypted, 1, decrypted) == 0);
+    for (unsigned int thread_count=2; thread_count<=8; thread_count*=2) {
+        std::shared_ptr<AP4_MemoryByteStream> decrypted_mt;
+        CHECK(Decrypt(encrypted, thread_count, decrypted_mt) == 0);
+        CHECK(BuffersEqual(*decrypted, *decrypted_mt));
+    }
+    
+    // all the samples must have been decrypted: the sample data of the
+    // clear input must be found in the decrypted output
+    unsigned int sample_count = 0;
+    CHECK(CompareSamples(clear, decrypted, 1, sample_count, true) == 0);
+    CHECK(sample_count == TEST_SEGMENT_COUNT*TEST_SAMPLES_PER_SEGMENT);
+
+    // a fragmented audio and video file, with one fragment per track, for
+    // the subsample encryption of AVC video
+    if (argc > 1) {
+        std::shared_ptr<AP4_ByteStream> input;
+        CHECK(AP4_FileByteStream::Create(argv[1], AP4_FileByteStream::STREAM_MODE_READ, input) == AP4_SUCCESS);
+        CHECK(EncryptionVariantsTest(input, 2, 2, 2) == 0);
+    }
+
+    printf("Processor test passed\n");
+    return 0;
+}
@@ -0,0 +1,623 @@
+/*****************************************************************
+|
+|    AP4 - Sample Table Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Cardinal TEST_SAMPLE_COUNT = 5000;
+
+/*----------------------------------------------------------------------
+|   NextRandom
++---------------------------------------------------------------------*/
+static AP4_UI32
+NextRandom(AP4_UI32& state)
+{
+    state = state*1664525+1013904223;
+    return state>>8;
+}
+
+/*----------------------------------------------------------------------
+|   CompareSamples
++---------------------------------------------------------------------*/
+static bool
+CompareSamples(AP4_Sample& a, AP4_Sample& b)
+{
+    return a.GetOffset()           == b.GetOffset()           &&
+           a.GetSize()             == b.GetSize()             &&
+           a.GetDts()              == b.GetDts()              &&
+           a.GetCts()              == b.GetCts()              &&
+           a.GetDuration()         == b.GetDuration()         &&
+           a.GetDescriptionIndex() == b.GetDescriptionIndex() &&
+           a.IsSync()              == b.IsSync();
+}
+
+/*----------------------------------------------------------------------
+|   BuildTable
++---------------------------------------------------------------------*/
+static AP4_SyntheticSampleTable*
+BuildTable(std::shared_ptr<AP4_ByteStream> stream, AP4_Cardinal chunk_size)
+{
+    AP4_SyntheticSampleTable* table = new AP4_SyntheticSampleTable(chunk_size);
+    table->AddSampleDescription(new AP4_GenericVideoSampleDescription(AP4_ATOM_TYPE('t','e','s','t'),
+                                                                     640, 480, 24, "", NULL));
+    AP4_UI32 state    = 1234;
+    AP4_UI64 dts      = 0;
+    AP4_Position offset = 0;
+    for (unsigned int i=0; i<TEST_SAMPLE_COUNT; i++) {
+        AP4_Size size     = 1+NextRandom(state)%2000;
+        AP4_UI32 duration = (i%100 < 50) ? 1000 : 1000+NextRandom(state)%3;
+        AP4_UI32 cts      = (i%3)*1000;
+        bool     sync     = (i%30) == 0;
+        table->AddSample(stream, offset, size, duration, 0, dts, cts, sync);
+        offset += size;
+        dts    += duration;
+    }
+
+    return table;
+}
+
+/*----------------------------------------------------------------------
+|   BuildStbl
++---------------------------------------------------------------------*/
+static AP4_ContainerAtom*
+BuildStbl(std::shared_ptr<AP4_ByteStream> stream, AP4_Cardinal chunk_size)
+{
+    AP4_SyntheticSampleTable* table = BuildTable(stream, chunk_size);
+    AP4_ContainerAtom*        stbl  = NULL;
+    AP4_Result                result = table->GenerateStblAtom(stbl);
+    delete table;
+    if (AP4_FAILED(result)) return NULL;
+    return stbl;
+}
+
+/*----------------------------------------------------------------------
+|   SampleIndexTest
++---------------------------------------------------------------------*/
+static int
+SampleIndexTest(AP4_Cardinal chunk_size)
+{
+    auto stream = std::make_shared<AP4_MemoryByteStream>();
+    AP4_ContainerAtom* stbl = BuildStbl(stream, chunk_size);
+    CHECK(stbl != NULL);
+
+    AP4_AtomSampleTable plain(stbl, stream);
+    AP4_AtomSampleTable indexed(stbl, stream);
+    indexed.EnableSampleIndex();
+    CHECK(AP4_SUCCEEDED(indexed.BuildSampleIndex()));
+    CHECK(plain.GetSampleCount() == TEST_SAMPLE_COUNT);
+    CHECK(indexed.GetSampleCount() == TEST_SAMPLE_COUNT);
+
+    // random access in both directions
+    AP4_UI32 state = 5678;
+    for (unsigned int i=0; i<2*TEST_SAMPLE_COUNT; i++) {
+        AP4_Ordinal index = (i < TEST_SAMPLE_COUNT) ? TEST_SAMPLE_COUNT-1-i : NextRandom(state)%TEST_SAMPLE_COUNT;
+        AP4_Sample a, b;
+        CHECK(AP4_SUCCEEDED(plain.GetSample(index, a)));
+        CHECK(AP4_SUCCEEDED(indexed.GetSample(index, b)));
+        CHECK(CompareSamples(a, b));
+    }
+    AP4_Sample sample;
+    CHECK(indexed.GetSample(TEST_SAMPLE_COUNT, sample) == AP4_ERROR_OUT_OF_RANGE);
+
+    // timestamp lookups
+    AP4_Sample last;
+    CHECK(AP4_SUCCEEDED(plain.GetSample(TEST_SAMPLE_COUNT-1, last)));
+    AP4_UI64 end = last.GetDts()+last.GetDuration();
+    for (AP4_UI64 ts=0; ts<end+3000; ts += 777) {
+        AP4_Ordinal a = 0, b = 0;
+        AP4_Result result_a = plain.GetSampleIndexForTimeStamp(ts, a);
+        AP4_Result result_b = indexed.GetSampleIndexForTimeStamp(ts, b);
+        CHECK(AP4_SUCCEEDED(result_a) == AP4_SUCCEEDED(result_b));
+        if (AP4_SUCCEEDED(result_a)) CHECK(a == b);
+    }
+
+    // sync sample lookups
+    for (AP4_Ordinal i=0; i<TEST_SAMPLE_COUNT; i += 7) {
+        CHECK(plain.GetNearestSyncSampleIndex(i, true)  == indexed.GetNearestSyncSampleIndex(i, true));
+        CHECK(plain.GetNearestSyncSampleIndex(i, false) == indexed.GetNearestSyncSampleIndex(i, false));
+    }
+
+    delete stbl;
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ParseStbl
++---------------------------------------------------------------------*/
+static AP4_ContainerAtom*
+ParseStbl(std::shared_ptr<AP4_ByteStream> stream, AP4_Size deferred_threshold)
+{
+    AP4_DefaultAtomFactory factory;
+    factory.SetDeferredPayloadThreshold(deferred_threshold);
+    stream->Seek(0);
+    AP4_Atom* atom = NULL;
+    if (AP4_FAILED(factory.CreateAtomFromStream(stream, atom))) return NULL;
+    return AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+}
+
+/*----------------------------------------------------------------------
+|   DeferredTablesTest
++---------------------------------------------------------------------*/
+static int
+DeferredTablesTest(AP4_Cardinal chunk_size)
+{
+    auto media = std::make_shared<AP4_MemoryByteStream>();
+    AP4_ContainerAtom* stbl = BuildStbl(media, chunk_size);
+    CHECK(stbl != NULL);
+    auto serialized = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(AP4_SUCCEEDED(stbl->Write(*serialized)));
+    delete stbl;
+
+    AP4_ContainerAtom* eager    = ParseStbl(serialized, 0);
+    AP4_ContainerAtom* deferred = ParseStbl(serialized, 64);
+    CHECK(eager != NULL && deferred != NULL);
+
+    // loading a deferred table must not move the source stream
+    CHECK(AP4_SUCCEEDED(serialized->Seek(17)));
+    AP4_AtomSampleTable eager_table(eager, media);
+    AP4_AtomSampleTable deferred_table(deferred, media);
+    CHECK(deferred_table.GetSampleCount() == TEST_SAMPLE_COUNT);
+    for (AP4_Ordinal i=0; i<TEST_SAMPLE_COUNT; i++) {
+        AP4_Sample a, b;
+        CHECK(AP4_SUCCEEDED(eager_table.GetSample(i, a)));
+        CHECK(AP4_SUCCEEDED(deferred_table.GetSample(i, b)));
+        CHECK(CompareSamples(a, b));
+    }
+    AP4_Position position = 0;
+    serialized->Tell(position);
+    CHECK(position == 17);
+
+    // timestamp lookups can be the first access to the time tables
+    AP4_ContainerAtom* lookup_first = ParseStbl(serialized, 64);
+    CHECK(lookup_first != NULL);
+    AP4_AtomSampleTable lookup_table(lookup_first, media);
+    for (AP4_UI64 ts=0; ts<TEST_SAMPLE_COUNT*1000+3000; ts += 777) {
+        AP4_Ordinal a = 0, b = 0;
+        AP4_Result result_a = eager_table.GetSampleIndexForTimeStamp(ts, a);
+        AP4_Result result_b = lookup_table.GetSampleIndexForTimeStamp(ts, b);
+        CHECK(AP4_SUCCEEDED(result_a) == AP4_SUCCEEDED(result_b));
+        if (AP4_SUCCEEDED(result_a)) CHECK(a == b);
+    }
+    delete lookup_first;
+
+    // re-serializing a deferred atom reproduces the original bytes
+    AP4_ContainerAtom* untouched = ParseStbl(serialized, 64);
+    CHECK(untouched != NULL);
+    AP4_MemoryByteStream rewritten;
+    CHECK(AP4_SUCCEEDED(untouched->Write(rewritten)));
+    CHECK(rewritten.GetDataSize() == serialized->GetDataSize());
+    CHECK(AP4_CompareMemory(rewritten.GetData(), serialized->GetData(), rewritten.GetDataSize()) == 0);
+
+    delete eager;
+    delete deferred;
+    delete untouched;
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   DeferredLoadFailureTest
++---------------------------------------------------------------------*/
+static int
+DeferredLoadFailureTest()
+{
+    auto media = std::make_shared<AP4_MemoryByteStream>();
+    AP4_ContainerAtom* stbl = BuildStbl(media, 10);
+    CHECK(stbl != NULL);
+    AP4_DataBuffer source_data;
+    auto source = std::make_shared<AP4_MemoryByteStream>(source_data);
+    CHECK(AP4_SUCCEEDED(stbl->Write(*source)));
+    delete stbl;
+    stbl = ParseStbl(source, 64);
+    CHECK(stbl != NULL);
+
+    // the deferred entries can no longer be read
+    source_data.SetDataSize(16);
+    AP4_StszAtom* stsz = AP4_DYNAMIC_CAST(AP4_StszAtom, stbl->GetChild(AP4_ATOM_TYPE_STSZ));
+    AP4_StcoAtom* stco = AP4_DYNAMIC_CAST(AP4_StcoAtom, stbl->GetChild(AP4_ATOM_TYPE_STCO));
+    AP4_SttsAtom* stts = AP4_DYNAMIC_CAST(AP4_SttsAtom, stbl->GetChild(AP4_ATOM_TYPE_STTS));
+    AP4_CttsAtom* ctts = AP4_DYNAMIC_CAST(AP4_CttsAtom, stbl->GetChild(AP4_ATOM_TYPE_CTTS));
+    CHECK(stsz != NULL && stco != NULL && stts != NULL && ctts != NULL);
+    AP4_Size size = 0;
+    AP4_UI32 offset = 0;
+    AP4_UI64 dts = 0;
+    AP4_UI64 range_size = 0;
+    for (unsigned int i=0; i<2; i++) {
+        // the failure is reported by every access, not just the first one
+        CHECK(AP4_FAILED(stsz->GetSampleSize(1, size)));
+        CHECK(AP4_FAILED(stsz->GetSampleRangeSize(1, 100, range_size)));
+        CHECK(AP4_FAILED(stco->GetChunkOffset(1, offset)));
+        CHECK(stco->GetChunkOffsets() == NULL);
+        CHECK(AP4_FAILED(stts->GetDts(1, dts)));
+        CHECK(AP4_FAILED(ctts->GetCtsOffset(1, offset)));
+    }
+    CHECK(stsz->GetSampleCount() == TEST_SAMPLE_COUNT);
+    AP4_MemoryByteStream rewritten;
+    CHECK(AP4_FAILED(stsz->Write(rewritten)));
+    CHECK(AP4_FAILED(stco->Write(rewritten)));
+    CHECK(AP4_FAILED(stts->Write(rewritten)));
+    CHECK(AP4_FAILED(ctts->Write(rewritten)));
+
+    delete stbl;
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CompareTracks
++---------------------------------------------------------------------*/
+static int
+CompareTracks(AP4_File& a, AP4_File& b)
+{
+    CHECK(a.GetMovie() != NULL && b.GetMovie() != NULL);
+    AP4_Track* track_a = a.GetMovie()->GetTrack(1);
+    AP4_Track* track_b = b.GetMovie()->GetTrack(1);
+    CHECK(track_a != NULL && track_b != NULL);
+    CHECK(track_a->GetSampleCount() == TEST_SAMPLE_COUNT);
+    CHECK(track_b->GetSampleCount() == TEST_SAMPLE_COUNT);
+    for (AP4_Ordinal i=0; i<TEST_SAMPLE_COUNT; i++) {
+        AP4_Sample sample_a, sample_b;
+        CHECK(AP4_SUCCEEDED(track_a->GetSample(i, sample_a)));
+        CHECK(AP4_SUCCEEDED(track_b->GetSample(i, sample_b)));
+        CHECK(CompareSamples(sample_a, sample_b));
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   DeferredFileTest
++---------------------------------------------------------------------*/
+static int
+DeferredFileTest()
+{
+    // serialize a movie with one large track
+    auto media = std::make_shared<AP4_MemoryByteStream>();
+    AP4_SyntheticSampleTable* table = BuildTable(media, 10);
+    AP4_UI64 duration = 0;
+    for (AP4_Ordinal i=0; i<table->GetSampleCount(); i++) {
+        AP4_Sample sample;
+        CHECK(AP4_SUCCEEDED(table->GetSample(i, sample)));
+        duration += sample.GetDuration();
+    }
+    AP4_Movie movie(1000);
+    movie.AddTrack(new AP4_Track(AP4_Track::TYPE_VIDEO, table, 1, 1000, duration, 1000, duration, "und", 640<<16, 480<<16));
+    auto serialized = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(AP4_SUCCEEDED(movie.GetMoovAtom()->Write(*serialized)));
+
+    serialized->Seek(0);
+    AP4_File eager(serialized, true);
+
+    // a factory without a threshold is only set up for the parsing
+    AP4_DefaultAtomFactory factory;
+    serialized->Seek(0);
+    AP4_File deferred(serialized, factory, true, true);
+    CHECK(factory.GetDeferredPayloadThreshold() == 0);
+    CHECK(CompareTracks(eager, deferred) == 0);
+
+    // a factory with a threshold of its own keeps it
+    factory.SetDeferredPayloadThreshold(64);
+    serialized->Seek(0);
+    AP4_File custom(serialized, factory, true, true);
+    CHECK(factory.GetDeferredPayloadThreshold() == 64);
+    CHECK(CompareTracks(eager, custom) == 0);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   SampleRecordTest
++---------------------------------------------------------------------*/
+static int
+SampleRecordTest()
+{
+    auto stream = std::make_shared<AP4_MemoryByteStream>();
+    AP4_ContainerAtom* stbl = BuildStbl(stream, 10);
+    CHECK(stbl != NULL);
+    AP4_AtomSampleTable table(stbl, stream);
+
+    AP4_SampleRecordArray records;
+    for (AP4_Ordinal i=0; i<table.GetSampleCount(); i++) {
+        AP4_Sample sample;
+        CHECK(AP4_SUCCEEDED(table.GetSample(i, sample)));
+        CHECK(AP4_SUCCEEDED(records.Append(sample)));
+    }
+    AP4_Sample detached;
+    CHECK(AP4_SUCCEEDED(records.Append(detached)));
+    CHECK(records.ItemCount() == TEST_SAMPLE_COUNT+1);
+    for (AP4_Ordinal i=0; i<TEST_SAMPLE_COUNT; i++) {
+        AP4_Sample a, b;
+        CHECK(AP4_SUCCEEDED(table.GetSample(i, a)));
+        CHECK(AP4_SUCCEEDED(records.GetSample(i, b)));
+        CHECK(CompareSamples(a, b));
+        CHECK(b.GetDataStream() == stream);
+    }
+    CHECK(AP4_SUCCEEDED(records.GetSample(TEST_SAMPLE_COUNT, detached)));
+    CHECK(detached.GetDataStream() == nullptr);
+    CHECK(records.GetSample(TEST_SAMPLE_COUNT+1, detached) == AP4_ERROR_OUT_OF_RANGE);
+
+    delete stbl;
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ConcurrentReadTest
++---------------------------------------------------------------------*/
+static int
+ConcurrentReadTest()
+{
+    // media data where each byte is a function of its offset
+    auto media = std::make_shared<AP4_MemoryByteStream>();
+    AP4_ContainerAtom* stbl = BuildStbl(media, 10);
+    CHECK(stbl != NULL);
+    AP4_AtomSampleTable builder(stbl, media);
+    AP4_Sample last;
+    CHECK(AP4_SUCCEEDED(builder.GetSample(TEST_SAMPLE_COUNT-1, last)));
+    AP4_Size media_size = (AP4_Size)(last.GetOffset()+last.GetSize());
+    AP4_DataBuffer media_data(media_size);
+    media_data.SetDataSize(media_size);
+    for (AP4_Size i=0; i<media_size; i++) {
+        media_data.UseData()[i] = (AP4_UI08)(i*7+(i>>8));
+    }
+    CHECK(AP4_SUCCEEDED(media->Write(media_data.GetData(), media_size)));
+
+    // one shared table, with deferred entries and lazily built caches
+    auto serialized = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(AP4_SUCCEEDED(stbl->Write(*serialized)));
+    delete stbl;
+    AP4_ContainerAtom* deferred = ParseStbl(serialized, 64);
+    CHECK(deferred != NULL);
+    AP4_AtomSampleTable table(deferred, media);
+
+    // each thread walks the samples in its own order and checks them
+    std::atomic<unsigned int> failures(0);
+    std::vector<std::thread> threads;
+    for (unsigned int t=0; t<4; t++) {
+        threads.emplace_back([&, t] {
+            AP4_UI32       state = 100+t;
+            AP4_DataBuffer data;
+            for (unsigned int i=0; i<TEST_SAMPLE_COUNT; i++) {
+                AP4_Ordinal index = (t%2) ? NextRandom(state)%TEST_SAMPLE_COUNT : i;
+                AP4_Sample sample;
+                if (AP4_FAILED(table.GetSample(index, sample)) ||
+                    AP4_FAILED(sample.ReadData(data))          ||
+                    data.GetDataSize() != sample.GetSize()     ||
+                    AP4_CompareMemory(data.GetData(),
+                                      media_data.GetData()+sample.GetOffset(),
+                                      data.GetDataSize()) != 0) {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (unsigned int t=0; t<threads.size(); t++) {
+        threads[t].join();
+    }
+    CHECK(failures == 0);
+
+    // the results match a single-threaded walk
+    AP4_ContainerAtom* eager = ParseStbl(serialized, 0);
+    CHECK(eager != NULL);
+    AP4_AtomSampleTable reference(eager, media);
+    for (AP4_Ordinal i=0; i<TEST_SAMPLE_COUNT; i++) {
+        AP4_Sample a, b;
+        CHECK(AP4_SUCCEEDED(reference.GetSample(i, a)));
+        CHECK(AP4_SUCCEEDED(table.GetSample(i, b)));
+        CHECK(CompareSamples(a, b));
+    }
+
+    delete eager;
+    delete deferred;
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CheckTimeTables
++---------------------------------------------------------------------*/
+static int
+CheckTimeTables(AP4_SttsAtom&               stts,
+                AP4_CttsAtom&               ctts,
+                const AP4_Array<AP4_UI64>&  dts,
+                const AP4_Array<AP4_UI32>&  durations,
+                const AP4_Array<AP4_UI32>&  offsets,
+                AP4_UI32&                   state)
+{
+    AP4_Cardinal sample_count = dts.ItemCount();
+    for (unsigned int i=0; i<2*sample_count; i++) {
+        // sequential first, then random
+        AP4_Ordinal sample = i < sample_count ? i : NextRandom(state)%sample_count;
+        AP4_UI64 sample_dts = 0;
+        AP4_UI32 duration   = 0;
+        AP4_UI32 offset     = 0;
+        CHECK(AP4_SUCCEEDED(stts.GetDts(sample+1, sample_dts, &duration)));
+        CHECK(sample_dts == dts[sample] && duration == durations[sample]);
+        CHECK(AP4_SUCCEEDED(ctts.GetCtsOffset(sample+1, offset)));
+        CHECK(offset == offsets[sample]);
+
+        // the sample found for a timestamp is the last one that starts at or before it
+        AP4_UI64 ts = sample_dts+(duration ? NextRandom(state)%duration : 0);
+        AP4_Ordinal found = 0;
+        if (duration) {
+            CHECK(AP4_SUCCEEDED(stts.GetSampleIndexForTimeStamp(ts, found)));
+            CHECK(found == sample);
+        }
+    }
+    AP4_UI64 end = dts[sample_count-1]+durations[sample_count-1];
+    AP4_UI64 sample_dts = 0;
+    AP4_UI32 offset     = 0;
+    AP4_Ordinal found   = 0;
+    CHECK(stts.GetDts(0, sample_dts) == AP4_ERROR_OUT_OF_RANGE);
+    CHECK(stts.GetDts(sample_count+1, sample_dts) == AP4_ERROR_OUT_OF_RANGE);
+    CHECK(ctts.GetCtsOffset(sample_count+1, offset) == AP4_ERROR_OUT_OF_RANGE);
+    CHECK(AP4_FAILED(stts.GetSampleIndexForTimeStamp(end, found)));
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TimeTablesTest
++---------------------------------------------------------------------*/
+static int
+TimeTablesTest()
+{
+    // variable durations and offsets, with some empty entries
+    AP4_SttsAtom        stts;
+    AP4_CttsAtom        ctts;
+    AP4_Array<AP4_UI64> dts;
+    AP4_Array<AP4_UI32> durations;
+    AP4_Array<AP4_UI32> offsets;
+    AP4_UI32            state = 7;
+    AP4_UI64            next_dts = 0;
+    for (unsigned int pass=0; pass<2; pass++) {
+        for (unsigned int i=0; i<2000; i++) {
+            AP4_UI32 count    = NextRandom(state)%4;
+            AP4_UI32 duration = (i%50 == 0) ? 0 : 1+NextRandom(state)%3000;
+            CHECK(AP4_SUCCEEDED(stts.AddEntry(count, duration)));
+            CHECK(AP4_SUCCEEDED(ctts.AddEntry(count, i)));
+            for (unsigned int j=0; j<count; j++) {
+                dts.Append(next_dts);
+                durations.Append(duration);
+                offsets.Append(i);
+                next_dts += duration;
+            }
+        }
+
+        // the second pass adds entries after the lookups have started
+        CHECK(CheckTimeTables(stts, ctts, dts, durations, offsets, state) == 0);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   SampleRangeSizeTest
++---------------------------------------------------------------------*/
+static int
+SampleRangeSizeTest()
+{
+    // running totals, including sizes that overflow 32 bits and odd counts
+    AP4_UI32 state = 11;
+    AP4_Array<AP4_UI32> values;
+    for (unsigned int i=0; i<1003; i++) {
+        values.Append((i%100 == 0) ? 0xFFFFFFFF : NextRandom(state)%5000);
+    }
+    for (AP4_Cardinal count=0; count<=values.ItemCount(); count += (count < 20 ? 1 : 97)) {
+        AP4_Array<AP4_UI64> totals;
+        totals.SetItemCount(count+1);
+        AP4_ComputeRunningTotals(&values[0], count, &totals[0]);
+        AP4_UI64 total = 0;
+        CHECK(totals[0] == 0);
+        for (AP4_Ordinal i=0; i<count; i++) {
+            total += values[i];
+            CHECK(totals[i+1] == total);
+        }
+    }
+
+    // ranges of all lengths, with entries added after the totals are computed
+    AP4_StszAtom stsz;
+    AP4_Stz2Atom stz2(16);
+    for (unsigned int pass=0; pass<2; pass++) {
+        for (unsigned int i=0; i<500; i++) {
+            AP4_UI32 size = NextRandom(state)%0x10000;
+            CHECK(AP4_SUCCEEDED(stsz.AddEntry(size)));
+            CHECK(AP4_SUCCEEDED(stz2.AddEntry(size)));
+        }
+        AP4_Cardinal sample_count = stsz.GetSampleCount();
+        for (unsigned int i=0; i<200; i++) {
+            AP4_Ordinal  first = 1+NextRandom(state)%sample_count;
+            AP4_Cardinal count = NextRandom(state)%(sample_count-first+2);
+            AP4_UI64 expected = 0;
+            for (AP4_Ordinal j=first; j<first+count; j++) {
+                AP4_Size size = 0;
+                CHECK(AP4_SUCCEEDED(stsz.GetSampleSize(j, size)));
+                expected += size;
+            }
+            AP4_UI64 range_size = 0;
+            CHECK(AP4_SUCCEEDED(stsz.GetSampleRangeSize(first, count, range_size)));
+            CHECK(range_size == expected);
+            CHECK(AP4_SUCCEEDED(stz2.GetSampleRangeSize(first, count, range_size)));
+            CHECK(range_size == expected);
+        }
+        AP4_UI64 range_size = 0;
+        CHECK(stsz.GetSampleRangeSize(sample_count, 2, range_size) == AP4_ERROR_OUT_OF_RANGE);
+        CHECK(stz2.GetSampleRangeSize(0, 1, range_size) == AP4_ERROR_OUT_OF_RANGE);
+    }
+
+    // changing a size discards the running totals
+    AP4_UI64 before_stsz = 0, before_stz2 = 0, after = 0;
+    CHECK(AP4_SUCCEEDED(stsz.GetSampleRangeSize(1, 1000, before_stsz)));
+    CHECK(AP4_SUCCEEDED(stz2.GetSampleRangeSize(1, 1000, before_stz2)));
+    AP4_Size size = 0;
+    CHECK(AP4_SUCCEEDED(stsz.GetSampleSize(500, size)));
+    CHECK(AP4_SUCCEEDED(stsz.SetSampleSize(500, size+1)));
+    CHECK(AP4_SUCCEEDED(stz2.SetSampleSize(500, size+1)));
+    CHECK(AP4_SUCCEEDED(stsz.GetSampleRangeSize(1, 1000, after)));
+    CHECK(after == before_stsz+1);
+    CHECK(AP4_SUCCEEDED(stz2.GetSampleRangeSize(1, 1000, after)));
+    CHECK(after == before_stz2+1);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    CHECK(SampleIndexTest(1) == 0);
+    CHECK(SampleIndexTest(10) == 0);
+    CHECK(SampleIndexTest(333) == 0);
+    CHECK(DeferredTablesTest(1) == 0);
+    CHECK(DeferredTablesTest(10) == 0);
+    CHECK(DeferredLoadFailureTest() == 0);
+    CHECK(DeferredFileTest() == 0);
+    CHECK(SampleRecordTest() == 0);
+    CHECK(ConcurrentReadTest() == 0);
+    CHECK(TimeTablesTest() == 0);
+    CHECK(SampleRangeSizeTest() == 0);
+
+    printf("OK\n");
+    return 0;
+}
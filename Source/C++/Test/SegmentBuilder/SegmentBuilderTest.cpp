@@ -0,0 +1,532 @@
+/*****************************************************************
+|
+|    AP4 - Segment Builder Test
+|
+|    Copyright 2002-2008 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Ap4.h"
+
+#include <memory>
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const unsigned int TEST_GOP_COUNT      = 6;
+const unsigned int TEST_GOP_SIZE       = 12;
+const double       TEST_FRAME_RATE     = 25.0;
+const AP4_UI32     TEST_FRAME_DURATION = 1000; // at the 25000 timescale
+
+// display index, within the GOP, of the frames of a GOP in decode order
+// (I P B B P B B P B B P B)
+const unsigned int TEST_GOP_DISPLAY_INDEXES[TEST_GOP_SIZE] = {
+    0, 3, 1, 2, 6, 4, 5, 9, 7, 8, 11, 10
+};
+
+// same for open GOPs, where 2 leading frames follow the I frame in decode
+// order (I B B P B B P B B P B B), and the display order does not go back to
+// 0 at the start of each GOP
+const unsigned int TEST_OPEN_GOP_DISPLAY_INDEXES[TEST_GOP_SIZE] = {
+    2, 0, 1, 5, 3, 4, 8, 6, 7, 11, 9, 10
+};
+
+/*----------------------------------------------------------------------
+|   TestVideoSegmentBuilder
++---------------------------------------------------------------------*/
+class TestVideoSegmentBuilder : public AP4_VideoSegmentBuilder
+{
+public:
+    TestVideoSegmentBuilder(bool open_gops = false) : 
+        AP4_VideoSegmentBuilder(1, TEST_FRAME_RATE),
+        m_OpenGops(open_gops) {}
+
+    // AP4_SegmentBuilder methods
+    virtual AP4_Result CreateTrack(AP4_Track*& track) {
+        AP4_SampleDescription* sample_description =
+            new AP4_GenericVideoSampleDescription(AP4_SAMPLE_FORMAT_AVC1, 64, 64, 24, "", NULL);
+        return CreateVideoTrack(sample_description, 64, 64, track);
+    }
+    virtual AP4_UI32 GetCompatibleBrand() { return AP4_FILE_BRAND_AVC1; }
+
+    // AP4_FeedSegmentBuilder methods
+    virtual AP4_Result Feed(const void*, AP4_Size, AP4_Size& bytes_consumed) {
+        bytes_consumed = 0;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+
+    // methods
+    unsigned int GetDisplayIndex(unsigned int decode_index) {
+        unsigned int frame     = decode_index%TEST_GOP_SIZE;
+        unsigned int gop_start = decode_index-frame;
+        return gop_start+(m_OpenGops ? TEST_OPEN_GOP_DISPLAY_INDEXES[frame] : TEST_GOP_DISPLAY_INDEXES[frame]);
+    }
+    AP4_Result AddFrame(unsigned int decode_index) {
+        unsigned int frame = decode_index%TEST_GOP_SIZE;
+        auto sample_data = std::make_shared<AP4_MemoryByteStream>(4);
+        sample_data->WriteUI32(decode_index);
+        AP4_Sample sample(sample_data, 0, 4, TEST_FRAME_DURATION, 0, 0, 0, frame == 0);
+        unsigned int display_index = GetDisplayIndex(decode_index);
+        if (!m_OpenGops) display_index %= TEST_GOP_SIZE;
+        return AddAccessUnit(sample, decode_index, 2*display_index);
+    }
+
+    // members
+    bool m_OpenGops;
+};
+
+/*----------------------------------------------------------------------
+|   ChunkedVideoTest
++---------------------------------------------------------------------*/
+static int
+ChunkedVideoTest(bool open_gops)
+{
+    TestVideoSegmentBuilder builder(open_gops);
+    builder.SetChunkTarget(4, 0);
+    auto output = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(builder.WriteInitSegment(*output) == AP4_SUCCESS);
+
+    // write chunks as soon as they are ready, starting a segment with each GOP
+    unsigned int sequence_number = 1;
+    unsigned int chunk_count     = 0;
+    unsigned int segment_count   = 0;
+    CHECK(!builder.IsChunkReady());
+    for (unsigned int i=0; i<=TEST_GOP_COUNT*TEST_GOP_SIZE; i++) {
+        bool flush = (i == TEST_GOP_COUNT*TEST_GOP_SIZE);
+        if (!flush) {
+            CHECK(builder.AddFrame(i) == AP4_SUCCESS);
+        }
+        while (flush || builder.IsChunkReady()) {
+            bool starts_segment = builder.IsChunkIndependent();
+            AP4_Result result = builder.WriteMediaChunk(*output, sequence_number, starts_segment, flush);
+            if (result == AP4_ERROR_NOT_ENOUGH_DATA) break;
+            CHECK(result == AP4_SUCCESS);
+            ++sequence_number;
+            ++chunk_count;
+            if (starts_segment) ++segment_count;
+        }
+
+        // after the first GOP, chunks are written while the GOP is in progress
+        if (i >= TEST_GOP_SIZE+6 && !flush) {
+            CHECK(builder.GetSamples().ItemCount() < 6);
+        }
+    }
+    CHECK(builder.GetSamples().ItemCount() == 0);
+    CHECK(segment_count == TEST_GOP_COUNT);
+    CHECK(chunk_count == TEST_GOP_COUNT*3);
+    CHECK(builder.WriteMediaChunk(*output, sequence_number, false, true) == AP4_ERROR_NOT_ENOUGH_DATA);
+
+    // read the samples back and check their timestamps
+    output->Seek(0);
+    AP4_File file(output, true);
+    CHECK(file.GetMovie() && file.GetMovie()->HasFragments());
+    AP4_LinearReader reader(*file.GetMovie(), output);
+    CHECK(reader.EnableTrack(1) == AP4_SUCCESS);
+    for (unsigned int i=0; i<TEST_GOP_COUNT*TEST_GOP_SIZE; i++) {
+        AP4_Sample     sample;
+        AP4_DataBuffer data;
+        CHECK(reader.ReadNextSample(1, sample, data) == AP4_SUCCESS);
+        CHECK(data.GetDataSize() == 4);
+        CHECK(AP4_BytesToUInt32BE(data.GetData()) == i);
+        unsigned int gop_start = i-i%TEST_GOP_SIZE;
+        CHECK(sample.GetDts() == (AP4_UI64)i*TEST_FRAME_DURATION);
+        CHECK(sample.GetCts() == (AP4_UI64)builder.GetDisplayIndex(i)*TEST_FRAME_DURATION);
+        CHECK(sample.IsSync() == (i == gop_start));
+    }
+    AP4_Sample     sample;
+    AP4_DataBuffer data;
+    CHECK(AP4_FAILED(reader.ReadNextSample(1, sample, data)));
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ChunkedAudioTest
++---------------------------------------------------------------------*/
+static int
+ChunkedAudioTest()
+{
+    // 95 ADTS frames, AAC LC, 48kHz stereo, with a 1-byte payload
+    const unsigned int frame_count = 95;
+    AP4_DataBuffer adts;
+    for (unsigned int i=0; i<frame_count; i++) {
+        AP4_UI08 frame[8] = { 0xFF, 0xF1, 0x4C, 0x80, 0x01, 0x1F, 0xFC, (AP4_UI08)i };
+        adts.AppendData(frame, sizeof(frame));
+    }
+
+    // 1024-sample frames at 48kHz: 200ms chunks hold 10 frames
+    AP4_AacSegmentBuilder builder(1);
+    builder.SetChunkTarget(0, 200);
+    auto output = std::make_shared<AP4_MemoryByteStream>();
+    unsigned int sequence_number = 1;
+    unsigned int chunk_count     = 0;
+    const AP4_UI08* data = adts.GetData();
+    AP4_Size data_size = adts.GetDataSize();
+    bool eos = false;
+    for (;;) {
+        AP4_Size bytes_consumed = 0;
+        AP4_Result result = builder.Feed(data_size ? data : NULL, data_size, bytes_consumed);
+        CHECK(result >= 0); // 1 when a frame was added
+        data      += bytes_consumed;
+        data_size -= bytes_consumed;
+        if (result == AP4_SUCCESS && bytes_consumed == 0 && data_size == 0) {
+            // no frame: stop once the parser has been drained after the end of stream
+            if (eos) break;
+            eos = true;
+        }
+        if (builder.IsChunkReady()) {
+            CHECK(builder.WriteMediaChunk(*output, sequence_number++, false) == AP4_SUCCESS);
+            ++chunk_count;
+        }
+    }
+    CHECK(chunk_count == 9);
+    CHECK(builder.WriteMediaChunk(*output, sequence_number++, false, true) == AP4_SUCCESS);
+    CHECK(builder.GetSamples().ItemCount() == 0);
+    CHECK(builder.GetMediaStartTime() == frame_count*1024);
+
+    // scan the top-level boxes: 10 moof/mdat pairs and no styp
+    AP4_DataBuffer buffer;
+    AP4_LargeSize size = 0;
+    output->GetSize(size);
+    buffer.SetDataSize((AP4_Size)size);
+    CHECK(output->ReadAt(0, buffer.UseData(), (AP4_Size)size) == AP4_SUCCESS);
+    AP4_BoxScanner scanner(buffer.GetData(), buffer.GetDataSize());
+    AP4_BoxScanner::Box box;
+    unsigned int moof_count = 0;
+    unsigned int mdat_count = 0;
+    while (scanner.Next(box) == AP4_SUCCESS) {
+        CHECK(box.m_Type != AP4_ATOM_TYPE_STYP);
+        if (box.m_Type == AP4_ATOM_TYPE_MOOF) ++moof_count;
+        if (box.m_Type == AP4_ATOM_TYPE_MDAT) ++mdat_count;
+    }
+    CHECK(moof_count == 10);
+    CHECK(mdat_count == 10);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   AudioFeederTest
++---------------------------------------------------------------------*/
+static int
+AudioFeederTest()
+{
+    // ADTS frames of varying sizes, more than what fits in one feeder buffer
+    const unsigned int frame_count = 600;
+    AP4_DataBuffer adts;
+    for (unsigned int i=0; i<frame_count; i++) {
+        AP4_Size payload_size = 1+(i*37)%500;
+        AP4_Size frame_size   = 7+payload_size;
+        AP4_UI08 header[7] = { 0xFF, 0xF1, 0x4C,
+                               (AP4_UI08)(0x80 | ((frame_size>>11)&3)),
+                               (AP4_UI08)(frame_size>>3),
+                               (AP4_UI08)(((frame_size&7)<<5) | 0x1F),
+                               0xFC };
+        adts.AppendData(header, sizeof(header));
+        for (unsigned int j=0; j<payload_size; j++) {
+            AP4_UI08 byte = (AP4_UI08)(i+j);
+            adts.AppendData(&byte, 1);
+        }
+    }
+
+    // the samples refer to the feeder's buffers
+    AP4_AacSegmentBuilder builder(1);
+    AP4_StreamFeeder feeder(std::make_shared<AP4_MemoryByteStream>(adts), builder);
+    AP4_Result result;
+    do {
+        result = feeder.Feed();
+    } while (result == AP4_SUCCESS);
+    CHECK(result == AP4_ERROR_EOS);
+    CHECK(builder.GetSamples().ItemCount() == frame_count);
+    for (unsigned int i=0; i<frame_count; i++) {
+        AP4_Sample sample;
+        AP4_DataBuffer sample_data;
+        CHECK(builder.GetSamples().GetSample(i, sample) == AP4_SUCCESS);
+        CHECK(sample.GetDuration() == 1024);
+        CHECK(sample.ReadData(sample_data) == AP4_SUCCESS);
+        CHECK(sample_data.GetDataSize() == 1+(i*37)%500);
+        for (unsigned int j=0; j<sample_data.GetDataSize(); j++) {
+            CHECK(sample_data.GetData()[j] == (AP4_UI08)(i+j));
+        }
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   MuxerTest
++---------------------------------------------------------------------*/
+static int
+MuxerTest(bool open_gops)
+{
+    // 2 GOPs (960ms) per segment, with the audio fed slightly ahead of the video
+    TestVideoSegmentBuilder video_builder(open_gops);
+    AP4_AacSegmentBuilder   audio_builder(2);
+    AP4_SegmentMuxer        muxer(900);
+    CHECK(muxer.AddBuilder(audio_builder) == AP4_SUCCESS);
+    CHECK(muxer.AddBuilder(video_builder) == AP4_SUCCESS);
+    CHECK(muxer.AddBuilder(video_builder) == AP4_ERROR_INVALID_PARAMETERS);
+    CHECK(muxer.AddEvent("urn:test", "1", 1000, 500, 100, 7, (const AP4_UI08*)"hello", 5) == AP4_SUCCESS);
+    auto output = std::make_shared<AP4_MemoryByteStream>();
+
+    // AAC LC, 48kHz stereo, with a 1-byte payload
+    const unsigned int video_frame_count = TEST_GOP_COUNT*TEST_GOP_SIZE;
+    const unsigned int audio_frame_count = 135; // 2880ms
+    unsigned int audio_frame = 0;
+    unsigned int sequence_number = 1;
+    unsigned int segment_count = 0;
+    for (unsigned int i=0; i<video_frame_count; i++) {
+        while (audio_frame < audio_frame_count && audio_frame*1024*25 < (i+1)*48000) {
+            AP4_UI08 frame[8] = { 0xFF, 0xF1, 0x4C, 0x80, 0x01, 0x1F, 0xFC, (AP4_UI08)audio_frame };
+            for (AP4_Size offset = 0; offset < sizeof(frame);) {
+                AP4_Size bytes_consumed = 0;
+                CHECK(audio_builder.Feed(frame+offset, sizeof(frame)-offset, bytes_consumed) >= 0);
+                offset += bytes_consumed;
+            }
+            ++audio_frame;
+        }
+        CHECK(video_builder.AddFrame(i) == AP4_SUCCESS);
+        // a segment is ready as soon as the sync sample that follows it is
+        // added, even when leading frames that come before it in display
+        // order are still to come
+        bool ready = muxer.IsSegmentReady();
+        CHECK(ready == (i && i%(2*TEST_GOP_SIZE) == 0));
+        if (ready) {
+            CHECK(muxer.WriteMediaSegment(*output, sequence_number++) == AP4_SUCCESS);
+            ++segment_count;
+        }
+    }
+    // the first call that adds no frame signals the end of the stream to the parser
+    AP4_Size bytes_consumed = 0;
+    for (unsigned int empty_calls = 0; empty_calls < 2;) {
+        if (audio_builder.Feed(NULL, 0, bytes_consumed) == AP4_SUCCESS) ++empty_calls;
+    }
+    CHECK(segment_count == 2);
+    CHECK(muxer.WriteMediaSegment(*output, sequence_number++, true) == AP4_SUCCESS);
+    CHECK(muxer.WriteMediaSegment(*output, sequence_number++, true) == AP4_ERROR_NOT_ENOUGH_DATA);
+
+    // styp, sidx, emsg (first segment only), moof with 2 trafs, mdat
+    AP4_DataBuffer buffer;
+    AP4_LargeSize size = 0;
+    output->GetSize(size);
+    buffer.SetDataSize((AP4_Size)size);
+    CHECK(output->ReadAt(0, buffer.UseData(), (AP4_Size)size) == AP4_SUCCESS);
+    const AP4_Atom::Type expected_types[] = {
+        AP4_ATOM_TYPE_STYP, AP4_ATOM_TYPE_SIDX, AP4_ATOM_TYPE_EMSG, AP4_ATOM_TYPE_MOOF, AP4_ATOM_TYPE_MDAT,
+        AP4_ATOM_TYPE_STYP, AP4_ATOM_TYPE_SIDX, AP4_ATOM_TYPE_MOOF, AP4_ATOM_TYPE_MDAT,
+        AP4_ATOM_TYPE_STYP, AP4_ATOM_TYPE_SIDX, AP4_ATOM_TYPE_MOOF, AP4_ATOM_TYPE_MDAT
+    };
+    AP4_BoxScanner scanner(buffer.GetData(), buffer.GetDataSize());
+    AP4_BoxScanner::Box box;
+    AP4_DefaultAtomFactory atom_factory;
+    unsigned int box_count = 0;
+    unsigned int segment   = 0;
+    AP4_UI64     referenced_size = 0;
+    while (scanner.Next(box) == AP4_SUCCESS) {
+        CHECK(box_count < sizeof(expected_types)/sizeof(expected_types[0]));
+        CHECK(box.m_Type == expected_types[box_count++]);
+        if (box.m_Type == AP4_ATOM_TYPE_STYP) {
+            CHECK(referenced_size == 0);
+        } else if (box.m_Type == AP4_ATOM_TYPE_SIDX || box.m_Type == AP4_ATOM_TYPE_EMSG) {
+            AP4_Atom* atom = NULL;
+            CHECK(output->Seek(box.m_Offset) == AP4_SUCCESS);
+            CHECK(atom_factory.CreateAtomFromStream(output, atom) == AP4_SUCCESS);
+            if (AP4_SidxAtom* sidx = AP4_DYNAMIC_CAST(AP4_SidxAtom, atom)) {
+                // the video track is the reference track
+                CHECK(sidx->GetReferenceId() == 1);
+                CHECK(sidx->GetTimeScale() == 25000);
+                CHECK(sidx->GetEarliestPresentationTime() == segment*24000);
+                CHECK(sidx->GetReferences().ItemCount() == 1);
+                CHECK(sidx->GetReferences()[0].m_SubsegmentDuration == 24000);
+                CHECK(sidx->GetReferences()[0].m_StartsWithSap);
+                referenced_size = sidx->GetReferences()[0].m_ReferencedSize;
+            } else if (AP4_EmsgAtom* emsg = AP4_DYNAMIC_CAST(AP4_EmsgAtom, atom)) {
+                CHECK(emsg->GetSchemeIdUri() == "urn:test");
+                CHECK(emsg->GetValue() == "1");
+                CHECK(emsg->GetPresentationTime() == 500);
+                CHECK(emsg->GetId() == 7);
+                CHECK(emsg->GetMessageData().GetDataSize() == 5);
+                referenced_size -= box.m_Size;
+            } else {
+                CHECK(false);
+            }
+            delete atom;
+        } else {
+            referenced_size -= box.m_Size;
+            if (box.m_Type == AP4_ATOM_TYPE_MDAT) {
+                ++segment;
+            }
+        }
+    }
+    CHECK(box_count == sizeof(expected_types)/sizeof(expected_types[0]));
+    CHECK(referenced_size == 0);
+
+    // read back both tracks
+    auto file_stream = std::make_shared<AP4_MemoryByteStream>();
+    CHECK(muxer.WriteInitSegment(*file_stream) == AP4_SUCCESS);
+    file_stream->Write(buffer.GetData(), buffer.GetDataSize());
+    file_stream->Seek(0);
+    AP4_File file(file_stream, true);
+    CHECK(file.GetMovie() && file.GetMovie()->GetTracks().ItemCount() == 2);
+    AP4_LinearReader reader(*file.GetMovie(), file_stream);
+    CHECK(reader.EnableTrack(1) == AP4_SUCCESS);
+    CHECK(reader.EnableTrack(2) == AP4_SUCCESS);
+    unsigned int video_sample_count = 0;
+    unsigned int audio_sample_count = 0;
+    AP4_Sample     sample;
+    AP4_DataBuffer data;
+    AP4_UI32       track_id = 0;
+    while (AP4_SUCCEEDED(reader.ReadNextSample(sample, data, track_id))) {
+        if (track_id == 1) {
+            CHECK(AP4_BytesToUInt32BE(data.GetData()) == video_sample_count);
+            CHECK(sample.GetDts() == (AP4_UI64)video_sample_count*TEST_FRAME_DURATION);
+            CHECK(sample.GetCts() == (AP4_UI64)video_builder.GetDisplayIndex(video_sample_count)*TEST_FRAME_DURATION);
+            ++video_sample_count;
+        } else {
+            CHECK(track_id == 2);
+            CHECK(data.GetDataSize() == 1 && data.GetData()[0] == (AP4_UI08)audio_sample_count);
+            CHECK(sample.GetDts() == (AP4_UI64)audio_sample_count*1024);
+            ++audio_sample_count;
+        }
+    }
+    CHECK(video_sample_count == video_frame_count);
+    CHECK(audio_sample_count == audio_frame_count);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ParseEmsg
++---------------------------------------------------------------------*/
+static AP4_Atom*
+ParseEmsg(AP4_UI08 version, const AP4_UI08* payload, AP4_Size payload_size)
+{
+    auto box = std::make_shared<AP4_MemoryByteStream>();
+    box->WriteUI32(AP4_FULL_ATOM_HEADER_SIZE+payload_size);
+    box->WriteUI32(AP4_ATOM_TYPE_EMSG);
+    box->WriteUI08(version);
+    box->WriteUI24(0);
+    box->Write(payload, payload_size);
+    box->Seek(0);
+    AP4_DefaultAtomFactory atom_factory;
+    AP4_Atom* atom = NULL;
+    if (AP4_FAILED(atom_factory.CreateAtomFromStream(box, atom))) return NULL;
+    return atom;
+}
+
+/*----------------------------------------------------------------------
+|   EmsgParseTest
++---------------------------------------------------------------------*/
+static int
+EmsgParseTest()
+{
+    // version 0: strings, then timescale, presentation time delta, duration, id
+    const AP4_UI08 v0[] = {
+        'u', 'r', 'n', 0, '1', 0,
+        0, 0, 0x03, 0xE8, 0, 0, 0, 5, 0, 0, 0, 10, 0, 0, 0, 7,
+        'h', 'i'
+    };
+    AP4_Atom* atom = ParseEmsg(0, v0, sizeof(v0));
+    AP4_EmsgAtom* emsg = AP4_DYNAMIC_CAST(AP4_EmsgAtom, atom);
+    CHECK(emsg);
+    CHECK(emsg->GetSchemeIdUri() == "urn");
+    CHECK(emsg->GetValue() == "1");
+    CHECK(emsg->GetTimeScale() == 1000);
+    CHECK(emsg->GetPresentationTime() == 5);
+    CHECK(emsg->GetEventDuration() == 10);
+    CHECK(emsg->GetId() == 7);
+    CHECK(emsg->GetMessageData().GetDataSize() == 2);
+    delete atom;
+
+    // malformed payloads are not parsed as emsg atoms
+    const AP4_UI08 no_value_terminator[] = {
+        'u', 'r', 'n', 0, '1', '1',
+        0, 0, 0x03, 0xE8, 0, 0, 0, 5, 0, 0, 0, 10, 0, 0, 0, 7
+    };
+    const AP4_UI08 truncated_fields[] = {
+        'u', 'r', 'n', 0, '1', 0,
+        0, 0, 0x03, 0xE8, 0, 0, 0, 5, 0, 0, 0, 10
+    };
+    const AP4_UI08 no_strings[] = {
+        0, 0, 0x03, 0xE8, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0, 0, 10, 0, 0, 0, 7
+    };
+    struct {
+        AP4_UI08        version;
+        const AP4_UI08* payload;
+        AP4_Size        payload_size;
+    } malformed[] = {
+        { 0, no_value_terminator, sizeof(no_value_terminator) },
+        { 0, truncated_fields,    sizeof(truncated_fields)    },
+        { 0, v0,                  0                           },
+        { 0, v0,                  4                           },
+        { 1, no_strings,          sizeof(no_strings)          },
+        { 1, no_strings,          12                          }
+    };
+    for (unsigned int i=0; i<sizeof(malformed)/sizeof(malformed[0]); i++) {
+        atom = ParseEmsg(malformed[i].version, malformed[i].payload, malformed[i].payload_size);
+        CHECK(atom != NULL);
+        CHECK(atom->GetType() == AP4_ATOM_TYPE_EMSG);
+        CHECK(AP4_DYNAMIC_CAST(AP4_EmsgAtom, atom) == NULL);
+        delete atom;
+
+        AP4_MemoryByteStream fields;
+        fields.WriteUI08(malformed[i].version);
+        fields.WriteUI24(0);
+        fields.Write(malformed[i].payload, malformed[i].payload_size);
+        fields.Seek(0);
+        CHECK(AP4_EmsgAtom::Create(AP4_FULL_ATOM_HEADER_SIZE+malformed[i].payload_size, fields) == NULL);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int /*argc*/, char** /*argv*/)
+{
+    if (ChunkedVideoTest(false)) return 1;
+    if (ChunkedVideoTest(true)) return 1;
+    if (ChunkedAudioTest()) return 1;
+    if (AudioFeederTest()) return 1;
+    if (MuxerTest(false)) return 1;
+    if (MuxerTest(true)) return 1;
+    if (EmsgParseTest()) return 1;
+
+    printf("Segment Builder test passed\n");
+    return 0;
+}